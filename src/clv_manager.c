@@ -0,0 +1,398 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Partitions created with PLL_ATTRIB_LIMIT_MEMORY keep the inner CLVs in a
+   fixed number of slots. When a CLV is written and no slot is free, the CLV
+   that is cheapest to recompute, i.e. the one with the smallest subtree, is
+   evicted. Evicted CLVs are recomputed by pll_clv_require() in partials.c */
+
+static size_t clv_size(const pll_partition_t * partition)
+{
+  size_t elem_size = (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION) ?
+                       sizeof(float) : sizeof(double);
+
+  return (size_t)(partition->alloc_sites + partition->asc_additional_sites) *
+         partition->states_padded * partition->rate_cats * elem_size;
+}
+
+/* recomputing a subtree of n tips in the right order needs about log2(n)
+   slots, plus the CLVs pinned by the caller */
+static unsigned int default_slots(const pll_partition_t * partition)
+{
+  unsigned int slots = (unsigned int)ceil(log2(PLL_MAX(partition->tips, 2)))
+                       + 4;
+
+  return PLL_MIN(slots, partition->clv_buffers);
+}
+
+static void dealloc_slots(pll_clv_manager_t * manager)
+{
+  unsigned int i;
+
+  if (manager->slot_clv)
+    for (i = 0; i < manager->slots; ++i)
+      pll_aligned_free(manager->slot_clv[i]);
+  free(manager->slot_clv);
+  free(manager->slot_node);
+}
+
+PLL_EXPORT void pll_clv_manager_destroy(pll_clv_manager_t * manager)
+{
+  if (!manager) return;
+
+  dealloc_slots(manager);
+  free(manager->node_slot);
+  free(manager->pins);
+  free(manager->last_use);
+  free(manager->cost);
+  free(manager->version);
+  free(manager->producer);
+  free(manager->producer_version);
+  free(manager->has_producer);
+  free(manager->stack);
+  free(manager->stack_pins);
+  free(manager);
+}
+
+/* allocates slots [first,last) */
+static int alloc_slots(const pll_partition_t * partition,
+                       pll_clv_manager_t * manager,
+                       unsigned int first,
+                       unsigned int last)
+{
+  unsigned int i;
+  size_t size = clv_size(partition);
+
+  for (i = first; i < last; ++i)
+  {
+    manager->slot_node[i] = PLL_CLV_SLOT_NONE;
+    manager->slot_clv[i] = pll_aligned_alloc(size, partition->alignment);
+    if (!manager->slot_clv[i])
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+      return PLL_FAILURE;
+    }
+
+    /* as in pll_partition_create, avoid uninitialized padding */
+    memset(manager->slot_clv[i], 0, size);
+  }
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT pll_clv_manager_t * pll_clv_manager_create(
+                                            const pll_partition_t * partition)
+{
+  unsigned int i;
+  unsigned int nodes = partition->nodes;
+
+  pll_clv_manager_t * manager = (pll_clv_manager_t *)calloc(1,
+                                                   sizeof(pll_clv_manager_t));
+  if (!manager)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+    return NULL;
+  }
+
+  manager->slots = default_slots(partition);
+  manager->slot_clv = (double **)calloc(manager->slots, sizeof(double *));
+  manager->slot_node = (unsigned int *)calloc(manager->slots,
+                                              sizeof(unsigned int));
+  manager->node_slot = (unsigned int *)malloc(nodes * sizeof(unsigned int));
+  manager->pins = (unsigned int *)calloc(nodes, sizeof(unsigned int));
+  manager->last_use = (unsigned long *)calloc(nodes, sizeof(unsigned long));
+  manager->cost = (unsigned int *)calloc(nodes, sizeof(unsigned int));
+  manager->version = (unsigned int *)calloc(nodes, sizeof(unsigned int));
+  manager->producer = (pll_operation_t *)calloc(nodes,
+                                                sizeof(pll_operation_t));
+  manager->producer_version = (unsigned int *)calloc(2 * nodes,
+                                                     sizeof(unsigned int));
+  manager->has_producer = (char *)calloc(nodes, sizeof(char));
+  manager->stack = (unsigned int *)malloc(nodes * sizeof(unsigned int));
+  manager->stack_pins = (char *)calloc(nodes, sizeof(char));
+
+  if (!manager->slot_clv || !manager->slot_node || !manager->node_slot ||
+      !manager->pins || !manager->last_use || !manager->cost ||
+      !manager->version || !manager->producer ||
+      !manager->producer_version || !manager->has_producer ||
+      !manager->stack || !manager->stack_pins)
+  {
+    pll_clv_manager_destroy(manager);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+    return NULL;
+  }
+
+  for (i = 0; i < nodes; ++i)
+    manager->node_slot[i] = PLL_CLV_SLOT_NONE;
+
+  if (!alloc_slots(partition, manager, 0, manager->slots))
+  {
+    pll_clv_manager_destroy(manager);
+    return NULL;
+  }
+
+  return manager;
+}
+
+static void evict(pll_partition_t * partition, unsigned int slot)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+  unsigned int node = manager->slot_node[slot];
+
+  if (node == PLL_CLV_SLOT_NONE)
+    return;
+
+  manager->node_slot[node] = PLL_CLV_SLOT_NONE;
+  manager->slot_node[slot] = PLL_CLV_SLOT_NONE;
+  partition->clv[node] = NULL;
+}
+
+/* returns a free slot, or the slot of the unpinned CLV with the smallest
+   recomputation cost (least recently used among equals). Returns
+   PLL_CLV_SLOT_NONE if all slots are pinned. With occupied_only set, free
+   slots are skipped */
+static unsigned int victim_slot(const pll_clv_manager_t * manager,
+                                int occupied_only)
+{
+  unsigned int i, node;
+  unsigned int victim = PLL_CLV_SLOT_NONE;
+
+  for (i = 0; i < manager->slots; ++i)
+  {
+    node = manager->slot_node[i];
+
+    if (node == PLL_CLV_SLOT_NONE)
+    {
+      if (occupied_only)
+        continue;
+      return i;
+    }
+
+    if (manager->pins[node])
+      continue;
+
+    if (victim == PLL_CLV_SLOT_NONE ||
+        manager->cost[node] < manager->cost[manager->slot_node[victim]] ||
+        (manager->cost[node] == manager->cost[manager->slot_node[victim]] &&
+         manager->last_use[node] <
+           manager->last_use[manager->slot_node[victim]]))
+      victim = i;
+  }
+
+  return victim;
+}
+
+/* assigns a slot to the CLV of clv_index, evicting another CLV if needed.
+   The content of the slot is undefined unless the CLV was already resident */
+PLL_EXPORT int pll_clv_acquire(pll_partition_t * partition,
+                               unsigned int clv_index)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+  unsigned int slot;
+
+  manager->last_use[clv_index] = ++manager->clock;
+
+  if (manager->node_slot[clv_index] != PLL_CLV_SLOT_NONE)
+    return PLL_SUCCESS;
+
+  slot = victim_slot(manager, 0);
+  if (slot == PLL_CLV_SLOT_NONE)
+  {
+    pll_errno = PLL_ERROR_CLV_UNAVAILABLE;
+    snprintf(pll_errmsg, 200,
+             "No CLV slot available for node %u (%u slots, all in use).",
+             clv_index, manager->slots);
+    return PLL_FAILURE;
+  }
+
+  evict(partition, slot);
+
+  manager->slot_node[slot] = clv_index;
+  manager->node_slot[clv_index] = slot;
+  partition->clv[clv_index] = manager->slot_clv[slot];
+
+  return PLL_SUCCESS;
+}
+
+/* records that op has (re)defined the CLV of its parent */
+PLL_EXPORT void pll_clv_computed(pll_partition_t * partition,
+                                 const pll_operation_t * op)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+  unsigned int parent = op->parent_clv_index;
+
+  manager->producer[parent] = *op;
+  manager->has_producer[parent] = 1;
+  manager->producer_version[2*parent] = manager->version[op->child1_clv_index];
+  manager->producer_version[2*parent+1] =
+                                      manager->version[op->child2_clv_index];
+  manager->cost[parent] = 1 + manager->cost[op->child1_clv_index] +
+                          manager->cost[op->child2_clv_index];
+  manager->version[parent]++;
+}
+
+/* marks the CLV of clv_index as not computed, e.g. after its operation
+   failed, such that pll_clv_require() reports it instead of returning stale
+   content. The CLV is evicted unless it is pinned */
+PLL_EXPORT void pll_clv_invalidate(pll_partition_t * partition,
+                                   unsigned int clv_index)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+  unsigned int slot;
+
+  if (!manager || clv_index < partition->tips)
+    return;
+
+  slot = manager->node_slot[clv_index];
+  if (slot != PLL_CLV_SLOT_NONE && !manager->pins[clv_index])
+    evict(partition, slot);
+
+  manager->has_producer[clv_index] = 0;
+  manager->version[clv_index]++;
+}
+
+PLL_EXPORT void pll_clv_release(pll_partition_t * partition,
+                                const unsigned int * clv_indices,
+                                unsigned int count)
+{
+  unsigned int i;
+
+  if (!partition->clv_manager)
+    return;
+
+  for (i = 0; i < count; ++i)
+    if (clv_indices[i] >= partition->tips)
+      partition->clv_manager->pins[clv_indices[i]]--;
+}
+
+/* sets the number of CLVs kept in memory for a partition created with
+   PLL_ATTRIB_LIMIT_MEMORY. Resident CLVs are kept as far as the new number of
+   slots allows. At least three slots are needed for a single operation, and
+   recomputing a subtree of n tips may require up to log2(n) + 2 */
+PLL_EXPORT int pll_set_clv_slots(pll_partition_t * partition,
+                                 unsigned int slots)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+  unsigned int i, j;
+  unsigned int slot;
+  double ** slot_clv;
+  unsigned int * slot_node;
+
+  if (!manager)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "CLV slots require a partition with PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  slots = PLL_MIN(slots, partition->clv_buffers);
+  if (slots < PLL_MIN(3, partition->clv_buffers))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "At least three CLV slots are required.");
+    return PLL_FAILURE;
+  }
+
+  if (slots == manager->slots)
+    return PLL_SUCCESS;
+
+  /* evict the cheapest CLVs until the remaining ones fit */
+  for (i = 0, j = 0; i < manager->slots; ++i)
+    if (manager->slot_node[i] != PLL_CLV_SLOT_NONE)
+      ++j;
+  while (j > slots)
+  {
+    slot = victim_slot(manager, 1);
+    if (slot == PLL_CLV_SLOT_NONE)
+    {
+      pll_errno = PLL_ERROR_CLV_UNAVAILABLE;
+      snprintf(pll_errmsg, 200, "Too many pinned CLVs for %u slots.", slots);
+      return PLL_FAILURE;
+    }
+    evict(partition, slot);
+    --j;
+  }
+
+  slot_clv = (double **)calloc(slots, sizeof(double *));
+  slot_node = (unsigned int *)calloc(slots, sizeof(unsigned int));
+  if (!slot_clv || !slot_node)
+  {
+    free(slot_clv);
+    free(slot_node);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+    return PLL_FAILURE;
+  }
+
+  /* move occupied slots to the front and free the excess buffers */
+  for (i = 0, j = 0; i < manager->slots; ++i)
+  {
+    if (manager->slot_node[i] != PLL_CLV_SLOT_NONE)
+    {
+      slot_clv[j] = manager->slot_clv[i];
+      slot_node[j] = manager->slot_node[i];
+      manager->node_slot[slot_node[j]] = j;
+      ++j;
+    }
+  }
+  for (i = 0; i < manager->slots; ++i)
+  {
+    if (manager->slot_node[i] == PLL_CLV_SLOT_NONE)
+    {
+      if (j < slots)
+      {
+        slot_clv[j] = manager->slot_clv[i];
+        slot_node[j] = PLL_CLV_SLOT_NONE;
+        ++j;
+      }
+      else
+        pll_aligned_free(manager->slot_clv[i]);
+    }
+  }
+
+  free(manager->slot_clv);
+  free(manager->slot_node);
+  manager->slot_clv = slot_clv;
+  manager->slot_node = slot_node;
+  manager->slots = slots;
+
+  /* allocate the additional slots */
+  if (j < slots && !alloc_slots(partition, manager, j, slots))
+  {
+    /* keep the slots allocated so far */
+    for (i = j; i < slots && manager->slot_clv[i]; ++i);
+    manager->slots = i;
+    return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT unsigned int pll_get_clv_slots(const pll_partition_t * partition)
+{
+  return partition->clv_manager ? partition->clv_manager->slots : 0;
+}
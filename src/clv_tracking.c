@@ -0,0 +1,251 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Once pll_utree_update_partials_lazy has been called for a partition, every
+   update of its CLVs, p-matrices and tips is recorded with the time of the
+   update. A directional CLV of the tree is up to date if its buffer was last
+   written by exactly the operation the tree currently implies, and after the
+   CLVs and p-matrices of both children. Since this is checked against the
+   current tree, topological moves, their rollbacks and branch length changes
+   (through pll_update_prob_matrices) need no explicit invalidation, and
+   several partitions can share the same tree */
+
+/* time assigned to CLVs that are scheduled for recomputation */
+#define TIME_PENDING ((unsigned long)-1)
+
+static pll_clv_tracking_t * tracking_create(const pll_partition_t * partition)
+{
+  pll_clv_tracking_t * tracking = (pll_clv_tracking_t *)calloc(1,
+                                                  sizeof(pll_clv_tracking_t));
+  if (!tracking)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for CLV tracking.");
+    return NULL;
+  }
+
+  tracking->op = (pll_operation_t *)calloc(partition->nodes,
+                                           sizeof(pll_operation_t));
+  tracking->clv_time = (unsigned long *)calloc(partition->nodes,
+                                               sizeof(unsigned long));
+  /* one extra entry keeps the allocation valid without scale buffers */
+  tracking->scaler_time = (unsigned long *)calloc(partition->scale_buffers + 1,
+                                                  sizeof(unsigned long));
+  tracking->pmatrix_time = (unsigned long *)calloc(partition->prob_matrices,
+                                                   sizeof(unsigned long));
+  if (!tracking->op || !tracking->clv_time || !tracking->scaler_time ||
+      !tracking->pmatrix_time)
+  {
+    pll_clv_tracking_destroy(tracking);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for CLV tracking.");
+    return NULL;
+  }
+
+  return tracking;
+}
+
+PLL_EXPORT void pll_clv_tracking_destroy(pll_clv_tracking_t * tracking)
+{
+  if (!tracking) return;
+
+  free(tracking->op);
+  free(tracking->clv_time);
+  free(tracking->scaler_time);
+  free(tracking->pmatrix_time);
+  free(tracking);
+}
+
+/* records the operations executed by the update_partials functions */
+PLL_EXPORT void pll_clv_tracking_operations(pll_partition_t * partition,
+                                            const pll_operation_t * operations,
+                                            unsigned int count)
+{
+  unsigned int i;
+  pll_clv_tracking_t * tracking = partition->clv_tracking;
+
+  if (!tracking) return;
+
+  for (i = 0; i < count; ++i)
+  {
+    const pll_operation_t * op = operations + i;
+
+    tracking->op[op->parent_clv_index] = *op;
+    tracking->clv_time[op->parent_clv_index] = ++tracking->clock;
+    if (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE)
+      tracking->scaler_time[op->parent_scaler_index] = tracking->clock;
+  }
+}
+
+/* records an update of the p-matrices by pll_update_prob_matrices */
+PLL_EXPORT void pll_clv_tracking_pmatrices(pll_partition_t * partition,
+                                           const unsigned int * matrix_indices,
+                                           unsigned int count)
+{
+  unsigned int i;
+  pll_clv_tracking_t * tracking = partition->clv_tracking;
+
+  if (!tracking) return;
+
+  ++tracking->clock;
+  for (i = 0; i < count; ++i)
+    tracking->pmatrix_time[matrix_indices[i]] = tracking->clock;
+}
+
+/* records a change of the data of a tip */
+PLL_EXPORT void pll_clv_tracking_tip(pll_partition_t * partition,
+                                     unsigned int tip_index)
+{
+  pll_clv_tracking_t * tracking = partition->clv_tracking;
+
+  if (!tracking) return;
+
+  tracking->clv_time[tip_index] = ++tracking->clock;
+}
+
+/* forgets the content of all inner CLVs, such that the next call of
+   pll_utree_update_partials_lazy recomputes all of them. Required after
+   updating CLVs with pll_update_partials_range, which is not tracked */
+PLL_EXPORT void pll_invalidate_partials(pll_partition_t * partition)
+{
+  pll_clv_tracking_t * tracking = partition->clv_tracking;
+
+  if (!tracking) return;
+
+  memset(tracking->clv_time + partition->tips,
+         0,
+         partition->clv_buffers * sizeof(unsigned long));
+}
+
+static int same_operation(const pll_operation_t * a,
+                          const pll_operation_t * b)
+{
+  return a->parent_clv_index == b->parent_clv_index &&
+         a->parent_scaler_index == b->parent_scaler_index &&
+         a->child1_clv_index == b->child1_clv_index &&
+         a->child1_matrix_index == b->child1_matrix_index &&
+         a->child1_scaler_index == b->child1_scaler_index &&
+         a->child2_clv_index == b->child2_clv_index &&
+         a->child2_matrix_index == b->child2_matrix_index &&
+         a->child2_scaler_index == b->child2_scaler_index;
+}
+
+/* post-order traversal of the subtree of node that appends the operations of
+   stale CLVs to ops. Returns the time at which the CLV of node was computed,
+   or TIME_PENDING if it is recomputed */
+static unsigned long lazy_traverse(const pll_clv_tracking_t * tracking,
+                                   const pll_unode_t * node,
+                                   pll_operation_t * ops,
+                                   unsigned int * ops_count)
+{
+  pll_operation_t op;
+  unsigned long time;
+  unsigned long time1;
+  unsigned long time2;
+
+  /* tips that were not set since the tracking started have time 0 */
+  if (!node->next)
+    return tracking->clv_time[node->clv_index];
+
+  time1 = lazy_traverse(tracking, node->next->back, ops, ops_count);
+  time2 = lazy_traverse(tracking, node->next->next->back, ops, ops_count);
+
+  op.parent_clv_index = node->clv_index;
+  op.parent_scaler_index = node->scaler_index;
+  op.child1_clv_index = node->next->back->clv_index;
+  op.child1_scaler_index = node->next->back->scaler_index;
+  op.child1_matrix_index = node->next->back->pmatrix_index;
+  op.child2_clv_index = node->next->next->back->clv_index;
+  op.child2_scaler_index = node->next->next->back->scaler_index;
+  op.child2_matrix_index = node->next->next->back->pmatrix_index;
+
+  time = tracking->clv_time[node->clv_index];
+  if (time && time1 < time && time2 < time &&
+      same_operation(tracking->op + node->clv_index, &op) &&
+      tracking->pmatrix_time[op.child1_matrix_index] < time &&
+      tracking->pmatrix_time[op.child2_matrix_index] < time &&
+      (op.parent_scaler_index == PLL_SCALE_BUFFER_NONE ||
+       tracking->scaler_time[op.parent_scaler_index] == time))
+    return time;
+
+  ops[(*ops_count)++] = op;
+  return TIME_PENDING;
+}
+
+/* updates the CLVs at both end-points of root_edge, recomputing only CLVs
+   whose subtree, branch lengths or model changed since they were computed.
+   The first call for a partition recomputes all CLVs. If ops_count is not
+   NULL, it receives the number of recomputed CLVs */
+PLL_EXPORT int pll_utree_update_partials_lazy(pll_partition_t * partition,
+                                              const pll_utree_t * tree,
+                                              const pll_unode_t * root_edge,
+                                              unsigned int * ops_count)
+{
+  unsigned int count = 0;
+  int retval = PLL_SUCCESS;
+  pll_operation_t * ops;
+
+  if (!tree->binary)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Lazy CLV updates require a binary tree.");
+    return PLL_FAILURE;
+  }
+
+  if (partition->attributes & PLL_ATTRIB_LIMIT_MEMORY)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Lazy CLV updates are not supported with PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  if (!partition->clv_tracking)
+  {
+    partition->clv_tracking = tracking_create(partition);
+    if (!partition->clv_tracking)
+      return PLL_FAILURE;
+  }
+
+  ops = (pll_operation_t *)malloc(PLL_MAX(tree->inner_count, 1) *
+                                  sizeof(pll_operation_t));
+  if (!ops)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for operations.");
+    return PLL_FAILURE;
+  }
+
+  lazy_traverse(partition->clv_tracking, root_edge, ops, &count);
+  lazy_traverse(partition->clv_tracking, root_edge->back, ops, &count);
+
+  if (count)
+    retval = pll_update_partials(partition, ops, count);
+
+  free(ops);
+
+  if (ops_count)
+    *ops_count = count;
+
+  return retval;
+}
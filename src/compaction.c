@@ -0,0 +1,297 @@
+/*
+    Copyright (C) 2015 Tomas Flouri, Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Under PLL_ATTRIB_SITE_COMPACTION, pll_set_pattern_weights reorders the
+   stored sites such that the sites with a positive weight come first, in
+   their original order, followed by the ascertainment bias sites and the
+   sites of zero weight. partition->sites is set to the number of sites with a
+   positive weight, hence all kernels, thread ranges and partition set tasks
+   skip the other sites. The tip data, weights, invariant sites and tip gap
+   bitvectors are permuted along; the inner CLVs must be recomputed. Site
+   ranges and the per-site log-likelihoods of the range functions refer to the
+   stored order, whereas pll_compute_root_loglikelihood and
+   pll_compute_edge_loglikelihood return per-site log-likelihoods in the
+   original order (zero for sites of zero weight) */
+
+/* stored position of the k-th site of an order with the given number of
+   sites of positive weight, skipping the ascertainment bias sites */
+static unsigned int site_position(const pll_partition_t * partition,
+                                  unsigned int sites,
+                                  unsigned int k)
+{
+  return k < sites ? k : k + partition->asc_additional_sites;
+}
+
+static size_t tip_site_size(const pll_partition_t * partition)
+{
+  if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+    return sizeof(unsigned char);
+
+  return (size_t)partition->states_padded * partition->rate_cats *
+         ((partition->attributes & PLL_ATTRIB_SINGLE_PRECISION) ?
+            sizeof(float) : sizeof(double));
+}
+
+/* allocates the compaction state of a partition with the identity order, or
+   with the order of source if given */
+PLL_EXPORT int pll_compaction_initialize(pll_partition_t * partition,
+                                         const pll_compaction_t * source)
+{
+  unsigned int i;
+  unsigned int sites = partition->alloc_sites;
+  size_t stored = (size_t)sites + partition->asc_additional_sites;
+  pll_compaction_t * compaction;
+
+  compaction = (pll_compaction_t *)calloc(1, sizeof(pll_compaction_t));
+  if (!compaction)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for site compaction.");
+    return PLL_FAILURE;
+  }
+  partition->compaction = compaction;
+
+  compaction->site_order = (unsigned int *)malloc(sites * sizeof(unsigned int));
+  compaction->site_slot = (unsigned int *)malloc(sites * sizeof(unsigned int));
+  compaction->order = (unsigned int *)malloc(sites * sizeof(unsigned int));
+  compaction->weights = (unsigned int *)malloc(sites * sizeof(unsigned int));
+  compaction->source = (unsigned int *)malloc(stored * sizeof(unsigned int));
+  /* the buffer holds the tip data of one node or the weights */
+  compaction->buffer = malloc(stored * PLL_MAX(tip_site_size(partition),
+                                               sizeof(unsigned int)));
+  if (!compaction->site_order || !compaction->site_slot ||
+      !compaction->order || !compaction->weights || !compaction->source ||
+      !compaction->buffer)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for site compaction.");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < sites; ++i)
+  {
+    compaction->site_order[i] = source ? source->site_order[i] : i;
+    compaction->site_slot[i] = source ? source->site_slot[i] : i;
+  }
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT void pll_compaction_destroy(pll_compaction_t * compaction)
+{
+  if (!compaction) return;
+
+  free(compaction->site_order);
+  free(compaction->site_slot);
+  free(compaction->order);
+  free(compaction->weights);
+  free(compaction->source);
+  free(compaction->buffer);
+  free(compaction);
+}
+
+/* moves the stored entries of size elem_size such that stored position i
+   receives the entry at compaction->source[i] */
+static void permute(pll_compaction_t * compaction,
+                    void * data,
+                    size_t elem_size,
+                    size_t stored)
+{
+  size_t i;
+  char * buffer = (char *)compaction->buffer;
+
+  for (i = 0; i < stored; ++i)
+    memcpy(buffer + i * elem_size,
+           (char *)data + compaction->source[i] * elem_size,
+           elem_size);
+  memcpy(data, buffer, stored * elem_size);
+}
+
+static void permute_bits(pll_compaction_t * compaction,
+                         unsigned int * bits,
+                         size_t stored)
+{
+  size_t i;
+  size_t words = (stored + 31) / 32;
+  unsigned int * buffer = (unsigned int *)compaction->buffer;
+
+  memset(buffer, 0, words * sizeof(unsigned int));
+  for (i = 0; i < stored; ++i)
+    if (PLL_GAP_BIT(bits, compaction->source[i]))
+      buffer[i >> 5] |= 1u << (i & 31);
+  memcpy(bits, buffer, words * sizeof(unsigned int));
+}
+
+/* stores the sites in compaction->order, of which the first sites ones have
+   a positive weight */
+static void reorder(pll_partition_t * partition, unsigned int sites)
+{
+  unsigned int i,k;
+  pll_compaction_t * compaction = partition->compaction;
+  unsigned int asc = partition->asc_additional_sites;
+  size_t stored = (size_t)partition->alloc_sites + asc;
+
+  for (k = 0; k < partition->alloc_sites; ++k)
+    compaction->source[site_position(partition, sites, k)] =
+      site_position(partition,
+                    partition->sites,
+                    compaction->site_slot[compaction->order[k]]);
+  for (k = 0; k < asc; ++k)
+    compaction->source[sites + k] = partition->sites + k;
+
+  for (i = 0; i < partition->tips; ++i)
+  {
+    if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+    {
+      if (partition->tipchars && partition->tipchars[i])
+        permute(compaction, partition->tipchars[i], 1, stored);
+    }
+    else if (partition->clv[i])
+      permute(compaction,
+              partition->clv[i],
+              tip_site_size(partition),
+              stored);
+
+    if (partition->gap_bits)
+      permute_bits(compaction, pll_get_gap_bitvector(partition, i), stored);
+
+    pll_clv_tracking_tip(partition, i);
+  }
+  permute(compaction,
+          partition->pattern_weights,
+          sizeof(unsigned int),
+          stored);
+
+  for (k = 0; k < partition->alloc_sites; ++k)
+  {
+    compaction->site_order[k] = compaction->order[k];
+    compaction->site_slot[compaction->order[k]] = k;
+  }
+  partition->sites = sites;
+
+  if (partition->invariant)
+    pll_update_invariant_sites(partition);
+}
+
+/* stores the sites of positive weight first. pattern_weights holds the
+   weights of all sites in the original order */
+PLL_EXPORT void pll_compaction_apply(pll_partition_t * partition,
+                                     const unsigned int * pattern_weights)
+{
+  unsigned int i,k = 0;
+  unsigned int sites;
+  pll_compaction_t * compaction = partition->compaction;
+
+  for (i = 0; i < partition->alloc_sites; ++i)
+    if (pattern_weights[i])
+      compaction->order[k++] = i;
+  sites = k;
+  for (i = 0; i < partition->alloc_sites; ++i)
+    if (!pattern_weights[i])
+      compaction->order[k++] = i;
+
+  if (sites != partition->sites ||
+      memcmp(compaction->order,
+             compaction->site_order,
+             partition->alloc_sites * sizeof(unsigned int)))
+    reorder(partition, sites);
+
+  for (i = 0; i < partition->alloc_sites; ++i)
+    partition->pattern_weights[site_position(partition, sites, i)] =
+      pattern_weights[compaction->site_order[i]];
+}
+
+/* moves the tip data of a single tip, which were set for all sites in their
+   original order, to the stored order of the sites. Unlike expanding and
+   reapplying the order, this leaves the other tips untouched */
+PLL_EXPORT void pll_compaction_tip(pll_partition_t * partition,
+                                   unsigned int tip_index)
+{
+  unsigned int k;
+  pll_compaction_t * compaction = partition->compaction;
+  unsigned int asc = partition->asc_additional_sites;
+  size_t stored = (size_t)partition->alloc_sites + asc;
+
+  /* all sites have a positive weight, hence the order is the original one */
+  if (partition->sites == partition->alloc_sites)
+    return;
+
+  for (k = 0; k < partition->alloc_sites; ++k)
+    compaction->source[site_position(partition, partition->sites, k)] =
+      compaction->site_order[k];
+  for (k = 0; k < asc; ++k)
+    compaction->source[partition->sites + k] = partition->alloc_sites + k;
+
+  if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+  {
+    if (partition->tipchars && partition->tipchars[tip_index])
+      permute(compaction, partition->tipchars[tip_index], 1, stored);
+  }
+  else if (partition->clv[tip_index])
+    permute(compaction,
+            partition->clv[tip_index],
+            tip_site_size(partition),
+            stored);
+
+  if (partition->gap_bits)
+    permute_bits(compaction,
+                 pll_get_gap_bitvector(partition, tip_index),
+                 stored);
+}
+
+/* restores the original order of the sites, e.g. before new tip data are
+   set. The weights of the sites, in the original order, are kept in
+   compaction->weights */
+PLL_EXPORT void pll_compaction_expand(pll_partition_t * partition)
+{
+  unsigned int i;
+  pll_compaction_t * compaction = partition->compaction;
+
+  for (i = 0; i < partition->alloc_sites; ++i)
+  {
+    compaction->order[i] = i;
+    compaction->weights[compaction->site_order[i]] =
+      partition->pattern_weights[site_position(partition,
+                                               partition->sites,
+                                               i)];
+  }
+
+  if (partition->sites != partition->alloc_sites)
+    reorder(partition, partition->alloc_sites);
+}
+
+/* moves the per-site values of the stored sites of positive weight to the
+   original positions of their sites, and sets the other values to zero */
+PLL_EXPORT void pll_compaction_scatter(const pll_partition_t * partition,
+                                       double * persite_values)
+{
+  unsigned int k;
+  const unsigned int * site_order = partition->compaction->site_order;
+
+  /* the sites of positive weight are stored in increasing order, hence
+     site_order[k] >= k and the values can be moved from the last one */
+  for (k = partition->sites; k > 0; --k)
+    persite_values[site_order[k-1]] = persite_values[k-1];
+  for (k = partition->sites; k < partition->alloc_sites; ++k)
+    persite_values[site_order[k]] = 0;
+}
@@ -81,15 +81,29 @@ PLL_EXPORT int pll_core_update_sumtable_repeats(unsigned int states,
 #ifdef HAVE_AVX2
   if (attrib & PLL_ATTRIB_ARCH_AVX2 &&  PLL_STAT(avx2_present))
   {
-    core_update_sumtable = pll_core_update_sumtable_repeats_generic_avx2;
-    if (states == 4)
+    if (use_bclv)
+      core_update_sumtable = pll_core_update_sumtable_repeatsbclv_generic_avx2;
+    else if (states == 4)
     {
       // avx is good enough
-      if (use_bclv)
-        core_update_sumtable = pll_core_update_sumtable_repeatsbclv_4x4_avx;
-      else
-        core_update_sumtable = pll_core_update_sumtable_repeats_4x4_avx;
+      core_update_sumtable = pll_core_update_sumtable_repeats_4x4_avx;
+    }
+    else
+      core_update_sumtable = pll_core_update_sumtable_repeats_generic_avx2;
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 &&  PLL_STAT(avx512f_present))
+  {
+    if (use_bclv && states == 4)
+    {
+      // for DNA, avx is faster than avx512
+      core_update_sumtable = pll_core_update_sumtable_repeatsbclv_4x4_avx;
     }
+    else if (use_bclv)
+      core_update_sumtable = pll_core_update_sumtable_repeatsbclv_generic_avx512;
+    else
+      core_update_sumtable = pll_core_update_sumtable_repeats_generic_avx512;
   }
 #endif
 
@@ -395,6 +409,23 @@ PLL_EXPORT int pll_core_update_sumtable_ii(unsigned int states,
                                            attrib);
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_update_sumtable_ii_avx512(states,
+                                              sites,
+                                              rate_cats,
+                                              parent_clv,
+                                              child_clv,
+                                              parent_scaler,
+                                              child_scaler,
+                                              eigenvecs,
+                                              inv_eigenvecs,
+                                              freqs,
+                                              sumtable,
+                                              attrib);
+  }
+#endif
 
   unsigned int min_scaler;
   unsigned int * rate_scalings = NULL;
@@ -550,6 +581,24 @@ PLL_EXPORT int pll_core_update_sumtable_ti(unsigned int states,
                                            attrib);
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_update_sumtable_ti_avx512(states,
+                                              sites,
+                                              rate_cats,
+                                              parent_clv,
+                                              left_tipchars,
+                                              parent_scaler,
+                                              eigenvecs,
+                                              inv_eigenvecs,
+                                              freqs,
+                                              tipmap,
+                                              tipmap_size,
+                                              sumtable,
+                                              attrib);
+  }
+#endif
 
   /* non-vectorized version, special case for 4 states */
   if (states == 4)
@@ -724,7 +773,7 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
   double t_branch_length;
   unsigned int scale_factors;
 
-  double *diagptable, *diagp;
+  double *diagptable, *diagp, *expd;
   const int * invariant_ptr;
   double ki;
 
@@ -744,8 +793,9 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
   *d_f = 0.0;
   *dd_f = 0.0;
 
+  /* the last rate_cats * states entries hold the exponentials */
   diagptable = (double *) pll_aligned_alloc(
-                                      rate_cats * states * 4 * sizeof(double),
+                                      rate_cats * states * 5 * sizeof(double),
                                       PLL_ALIGNMENT_AVX);
   if (!diagptable)
   {
@@ -753,6 +803,18 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
     snprintf (pll_errmsg, 200, "Cannot allocate memory for diagptable");
     return PLL_FAILURE;
   }
+  expd = diagptable + rate_cats * states * 4;
+
+  diagp = expd;
+  for(i = 0; i < rate_cats; ++i)
+  {
+    t_eigenvals = eigenvals[i];
+    ki = rates[i]/(1.0 - prop_invar[i]);
+    t_branch_length = branch_length;
+    for(j = 0; j < states; ++j)
+      *diagp++ = t_eigenvals[j] * ki * t_branch_length;
+  }
+  pll_core_exp(rate_cats * states, expd, expd, attrib);
 
   /* pre-compute the derivatives of the P matrix for all discrete GAMMA rates */
   diagp = diagptable;
@@ -760,10 +822,9 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
   {
     t_eigenvals = eigenvals[i];
     ki = rates[i]/(1.0 - prop_invar[i]);
-    t_branch_length = branch_length;
     for(j = 0; j < states; ++j)
     {
-      diagp[0] = exp(t_eigenvals[j] * ki * t_branch_length);
+      diagp[0] = expd[i*states + j];
       diagp[1] = t_eigenvals[j] * ki * diagp[0];
       diagp[2] = t_eigenvals[j] * ki * t_eigenvals[j] * ki * diagp[0];
       diagp[3] = 0;
@@ -779,6 +840,27 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
   }
 #endif
 
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    states_padded = (states+3) & 0xFFFFFFFC;
+
+    pll_core_likelihood_derivatives_avx512(states,
+                                           states_padded,
+                                           rate_cats,
+                                           ef_sites,
+                                           pattern_weights,
+                                           rate_weights,
+                                           invariant,
+                                           prop_invar,
+                                           freqs,
+                                           sumtable,
+                                           diagptable,
+                                           d_f,
+                                           dd_f);
+  }
+  else
+#endif
 #ifdef HAVE_AVX2
   if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
   {
@@ -927,3 +1009,305 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
 
   return PLL_SUCCESS;
 }
+
+static void core_likelihood_derivatives_multi(unsigned int states,
+                                              unsigned int states_padded,
+                                              unsigned int rate_cats,
+                                              unsigned int sites,
+                                              unsigned int points,
+                                              const unsigned int * pattern_weights,
+                                              const double * rate_weights,
+                                              const unsigned int * site_scalings,
+                                              const int * invariant,
+                                              const double * prop_invar,
+                                              double * const * freqs,
+                                              const double * sumtable,
+                                              const double * diagptable,
+                                              double * logl,
+                                              double * d_f,
+                                              double * dd_f)
+{
+  unsigned int i, j, k, n;
+  unsigned int row = 3 * points;
+  const double * sum = sumtable;
+  const double * t_sum;
+  const double * diagp;
+  double site_lk[3];
+  double cat_lk[3];
+  double deriv1, deriv2;
+  double log_threshold = log(PLL_SCALE_THRESHOLD);
+
+  for (k = 0; k < points; ++k)
+    d_f[k] = dd_f[k] = 0;
+  if (logl)
+    for (k = 0; k < points; ++k)
+      logl[k] = 0;
+
+  for (n = 0; n < sites; ++n)
+  {
+    for (k = 0; k < points; ++k)
+    {
+      site_lk[0] = site_lk[1] = site_lk[2] = 0;
+
+      t_sum = sum;
+      diagp = diagptable + k;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        cat_lk[0] = cat_lk[1] = cat_lk[2] = 0;
+        for (j = 0; j < states; ++j)
+        {
+          cat_lk[0] += t_sum[j] * diagp[0];
+          cat_lk[1] += t_sum[j] * diagp[points];
+          cat_lk[2] += t_sum[j] * diagp[2*points];
+          diagp += row;
+        }
+
+        /* account for invariant sites */
+        if (prop_invar[i] > 0)
+        {
+          cat_lk[0] *= 1. - prop_invar[i];
+          cat_lk[1] *= 1. - prop_invar[i];
+          cat_lk[2] *= 1. - prop_invar[i];
+
+          if (invariant && invariant[n] != -1)
+            cat_lk[0] += freqs[i][invariant[n]] * prop_invar[i];
+        }
+
+        site_lk[0] += cat_lk[0] * rate_weights[i];
+        site_lk[1] += cat_lk[1] * rate_weights[i];
+        site_lk[2] += cat_lk[2] * rate_weights[i];
+
+        t_sum += states_padded;
+      }
+
+      deriv1 = (-site_lk[1] / site_lk[0]);
+      deriv2 = (deriv1 * deriv1 - (site_lk[2] / site_lk[0]));
+      d_f[k] += pattern_weights[n] * deriv1;
+      dd_f[k] += pattern_weights[n] * deriv2;
+
+      if (logl)
+        logl[k] += pattern_weights[n] *
+                   (log(site_lk[0]) +
+                    (site_scalings ? site_scalings[n] * log_threshold : 0));
+    }
+
+    sum += rate_cats * states_padded;
+  }
+}
+
+/* Evaluates the log-likelihood and the partial derivatives of -logL on the
+ * branch length at count branch lengths in a single pass over the sumtable.
+ * site_scalings: [input] number of scaling events of each site, or NULL
+ * logl: [output] log-likelihood at each branch length, may be NULL
+ * d_f, dd_f: [output] first and second derivative at each branch length
+ * Ascertainment bias correction is not applied.
+ */
+PLL_EXPORT int pll_core_likelihood_derivatives_multi(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     const double * rate_weights,
+                                                     const unsigned int * site_scalings,
+                                                     const int * invariant,
+                                                     const unsigned int * pattern_weights,
+                                                     unsigned int count,
+                                                     const double * branch_lengths,
+                                                     const double * prop_invar,
+                                                     double * const * freqs,
+                                                     const double * rates,
+                                                     double * const * eigenvals,
+                                                     const double * sumtable,
+                                                     double * logl,
+                                                     double * d_f,
+                                                     double * dd_f,
+                                                     unsigned int attrib)
+{
+  unsigned int i, j, k;
+  unsigned int states_padded = states;
+  unsigned int points = count;
+  unsigned int alignment = PLL_ALIGNMENT_CPU;
+  size_t table_size;
+  double * diagptable;
+  double * diagp;
+  double * expd;
+  double * results;
+  double ki;
+  int retval = PLL_SUCCESS;
+
+  if (!count)
+    return PLL_SUCCESS;
+
+  /* the vectorized kernels process 4 or 8 branch lengths at once */
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+    states_padded = (states+1) & 0xFFFFFFFE;
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    states_padded = (states+3) & 0xFFFFFFFC;
+    points = (count+3) & 0xFFFFFFFC;
+    alignment = PLL_ALIGNMENT_AVX;
+  }
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    states_padded = (states+3) & 0xFFFFFFFC;
+    points = (count+3) & 0xFFFFFFFC;
+    alignment = PLL_ALIGNMENT_AVX;
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    states_padded = (states+3) & 0xFFFFFFFC;
+    points = (count+7) & 0xFFFFFFF8;
+    alignment = PLL_ALIGNMENT_AVX512;
+  }
+#endif
+
+  /* layout: diagptable holds for each rate category and state the three rows
+     exp(x*t), x*exp(x*t), x^2*exp(x*t) over all points, followed by the
+     arguments of the exponentials and the results */
+  table_size = (size_t)rate_cats * states * 3 * points;
+  diagptable = (double *)pll_aligned_alloc((table_size +
+                                            (size_t)rate_cats * states * points +
+                                            3 * points) * sizeof(double),
+                                           alignment);
+  if (!diagptable)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for diagptable");
+    return PLL_FAILURE;
+  }
+  expd = diagptable + table_size;
+  results = expd + (size_t)rate_cats * states * points;
+
+  /* padding points repeat the last branch length */
+  diagp = expd;
+  for (i = 0; i < rate_cats; ++i)
+  {
+    ki = rates[i]/(1.0 - prop_invar[i]);
+    for (j = 0; j < states; ++j)
+      for (k = 0; k < points; ++k)
+        *diagp++ = eigenvals[i][j] * ki *
+                   branch_lengths[PLL_MIN(k, count-1)];
+  }
+  pll_core_exp(rate_cats * states * points, expd, expd, attrib);
+
+  diagp = diagptable;
+  for (i = 0; i < rate_cats; ++i)
+  {
+    ki = rates[i]/(1.0 - prop_invar[i]);
+    for (j = 0; j < states; ++j)
+    {
+      double x = eigenvals[i][j] * ki;
+      const double * e = expd + (i * states + j) * points;
+
+      for (k = 0; k < points; ++k)
+      {
+        diagp[k] = e[k];
+        diagp[points + k] = x * e[k];
+        diagp[2 * points + k] = x * x * e[k];
+      }
+      diagp += 3 * points;
+    }
+  }
+
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    retval = pll_core_likelihood_derivatives_multi_avx512(states,
+                                                          states_padded,
+                                                          rate_cats,
+                                                          sites,
+                                                          points,
+                                                          pattern_weights,
+                                                          rate_weights,
+                                                          site_scalings,
+                                                          invariant,
+                                                          prop_invar,
+                                                          freqs,
+                                                          sumtable,
+                                                          diagptable,
+                                                          logl ? results : NULL,
+                                                          results + points,
+                                                          results + 2 * points);
+  }
+  else
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    retval = pll_core_likelihood_derivatives_multi_avx2(states,
+                                                        states_padded,
+                                                        rate_cats,
+                                                        sites,
+                                                        points,
+                                                        pattern_weights,
+                                                        rate_weights,
+                                                        site_scalings,
+                                                        invariant,
+                                                        prop_invar,
+                                                        freqs,
+                                                        sumtable,
+                                                        diagptable,
+                                                        logl ? results : NULL,
+                                                        results + points,
+                                                        results + 2 * points);
+  }
+  else
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    retval = pll_core_likelihood_derivatives_multi_avx(states,
+                                                       states_padded,
+                                                       rate_cats,
+                                                       sites,
+                                                       points,
+                                                       pattern_weights,
+                                                       rate_weights,
+                                                       site_scalings,
+                                                       invariant,
+                                                       prop_invar,
+                                                       freqs,
+                                                       sumtable,
+                                                       diagptable,
+                                                       logl ? results : NULL,
+                                                       results + points,
+                                                       results + 2 * points);
+  }
+  else
+#endif
+  {
+    core_likelihood_derivatives_multi(states,
+                                      states_padded,
+                                      rate_cats,
+                                      sites,
+                                      points,
+                                      pattern_weights,
+                                      rate_weights,
+                                      site_scalings,
+                                      invariant,
+                                      prop_invar,
+                                      freqs,
+                                      sumtable,
+                                      diagptable,
+                                      logl ? results : NULL,
+                                      results + points,
+                                      results + 2 * points);
+  }
+
+  if (retval == PLL_SUCCESS)
+  {
+    if (logl)
+      memcpy(logl, results, count * sizeof(double));
+    memcpy(d_f, results + points, count * sizeof(double));
+    memcpy(dd_f, results + 2 * points, count * sizeof(double));
+  }
+
+  pll_aligned_free(diagptable);
+
+  return retval;
+}
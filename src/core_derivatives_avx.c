@@ -1798,8 +1798,11 @@ PLL_EXPORT int pll_core_likelihood_derivatives_avx(unsigned int states,
       __m256d v_deriv2 = _mm256_sub_pd(_mm256_mul_pd(v_deriv1, v_deriv1),
                                        _mm256_mul_pd(v_term2, v_recip0));
 
-      /* assumption: no zero weights */
-      if ((pattern_weights[n-3] | pattern_weights[n-2] |
+      /* all 4 weights are 1 iff both their AND and OR are 1 (bootstrap
+         replicates have zero weights) */
+      if ((pattern_weights[n-3] & pattern_weights[n-2] &
+           pattern_weights[n-1] & pattern_weights[n]) == 1 &&
+          (pattern_weights[n-3] | pattern_weights[n-2] |
            pattern_weights[n-1] | pattern_weights[n]) == 1)
       {
         /* all 4 weights are 1 -> no multiplication needed */
@@ -1848,3 +1851,227 @@ PLL_EXPORT int pll_core_likelihood_derivatives_avx(unsigned int states,
 
   return PLL_SUCCESS;
 }
+
+/* number of sites whose likelihoods are buffered for vectorized logarithms */
+#define MULTI_SITE_BLOCK 64
+
+static void multi_flush_sites(unsigned int count,
+                              unsigned int points_padded,
+                              double * lk_block,
+                              const unsigned int * pattern_weights,
+                              const unsigned int * site_scalings,
+                              double * logl)
+{
+  unsigned int k, n;
+  double log_threshold = log(PLL_SCALE_THRESHOLD);
+
+  pll_core_log_avx(count * points_padded, lk_block, lk_block);
+
+  for (n = 0; n < count; ++n)
+  {
+    double scaling = site_scalings ? site_scalings[n] * log_threshold : 0;
+    const double * site_lk = lk_block + n * points_padded;
+
+    for (k = 0; k < points_padded; ++k)
+      logl[k] += pattern_weights[n] * (site_lk[k] + scaling);
+  }
+}
+
+/* accumulates the derivatives of -logL of one site at 4 points and stores
+   its likelihoods for the logarithms */
+static inline void multi_site_derivatives(__m256d v_lk0,
+                                          __m256d v_lk1,
+                                          __m256d v_lk2,
+                                          unsigned int pattern_weight,
+                                          double * d_f,
+                                          double * dd_f,
+                                          double * site_lk)
+{
+  __m256d v_patw = _mm256_set1_pd(pattern_weight);
+  __m256d v_recip0 = _mm256_div_pd(_mm256_set1_pd(1.), v_lk0);
+  __m256d v_deriv1 = _mm256_mul_pd(v_lk1, v_recip0);
+  __m256d v_deriv2 = _mm256_sub_pd(_mm256_mul_pd(v_deriv1, v_deriv1),
+                                   _mm256_mul_pd(v_lk2, v_recip0));
+
+  __m256d v_df = _mm256_sub_pd(_mm256_load_pd(d_f),
+                               _mm256_mul_pd(v_deriv1, v_patw));
+  __m256d v_ddf = _mm256_add_pd(_mm256_load_pd(dd_f),
+                                _mm256_mul_pd(v_deriv2, v_patw));
+
+  _mm256_store_pd(d_f, v_df);
+  _mm256_store_pd(dd_f, v_ddf);
+
+  if (site_lk)
+    _mm256_store_pd(site_lk, v_lk0);
+}
+
+/* evaluates the likelihood and the derivatives of -logL at points_padded
+   branch lengths. The diagptable holds for each rate category and state the
+   rows exp(x*t), x*exp(x*t) and x^2*exp(x*t) over all branch lengths, such
+   that each sumtable entry is loaded once for all points. Sites are
+   processed in pairs, which share the loads of the diagptable */
+PLL_EXPORT int pll_core_likelihood_derivatives_multi_avx(unsigned int states,
+                                                         unsigned int states_padded,
+                                                         unsigned int rate_cats,
+                                                         unsigned int sites,
+                                                         unsigned int points_padded,
+                                                         const unsigned int * pattern_weights,
+                                                         const double * rate_weights,
+                                                         const unsigned int * site_scalings,
+                                                         const int * invariant,
+                                                         const double * prop_invar,
+                                                         double * const * freqs,
+                                                         const double * sumtable,
+                                                         const double * diagptable,
+                                                         double * logl,
+                                                         double * d_f,
+                                                         double * dd_f)
+{
+  unsigned int i,j,k,n;
+  unsigned int span_padded = rate_cats * states_padded;
+  unsigned int block_sites = 0;
+  unsigned int row = 3 * points_padded;
+  double * lk_block = NULL;
+
+  if (logl)
+  {
+    lk_block = (double *)pll_aligned_alloc(MULTI_SITE_BLOCK * points_padded *
+                                             sizeof(double),
+                                           PLL_ALIGNMENT_AVX);
+    if (!lk_block)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      return PLL_FAILURE;
+    }
+    memset(logl, 0, points_padded * sizeof(double));
+  }
+
+  memset(d_f, 0, points_padded * sizeof(double));
+  memset(dd_f, 0, points_padded * sizeof(double));
+
+  const double * sum = sumtable;
+  for (n = 0; n < sites; n += 2)
+  {
+    /* the second site of an incomplete pair repeats the first one */
+    unsigned int pair = (n + 1 < sites) ? 2 : 1;
+    unsigned int m = n + pair - 1;
+
+    for (k = 0; k < points_padded; k += 4)
+    {
+      const double * diagp = diagptable + k;
+      const double * sum_a = sum;
+      const double * sum_b = sum + (pair - 1) * span_padded;
+
+      __m256d v_lka0 = _mm256_setzero_pd();
+      __m256d v_lka1 = _mm256_setzero_pd();
+      __m256d v_lka2 = _mm256_setzero_pd();
+      __m256d v_lkb0 = _mm256_setzero_pd();
+      __m256d v_lkb1 = _mm256_setzero_pd();
+      __m256d v_lkb2 = _mm256_setzero_pd();
+
+      for (i = 0; i < rate_cats; ++i)
+      {
+        __m256d v_cata0 = _mm256_setzero_pd();
+        __m256d v_cata1 = _mm256_setzero_pd();
+        __m256d v_cata2 = _mm256_setzero_pd();
+        __m256d v_catb0 = _mm256_setzero_pd();
+        __m256d v_catb1 = _mm256_setzero_pd();
+        __m256d v_catb2 = _mm256_setzero_pd();
+
+        for (j = 0; j < states; ++j)
+        {
+          /* rows of exp(x*t), x*exp(x*t) and x^2*exp(x*t) */
+          __m256d v_e0 = _mm256_load_pd(diagp);
+          __m256d v_e1 = _mm256_load_pd(diagp + points_padded);
+          __m256d v_e2 = _mm256_load_pd(diagp + 2*points_padded);
+          __m256d v_suma = _mm256_broadcast_sd(&sum_a[j]);
+          __m256d v_sumb = _mm256_broadcast_sd(&sum_b[j]);
+
+          v_cata0 = _mm256_add_pd(v_cata0, _mm256_mul_pd(v_suma, v_e0));
+          v_cata1 = _mm256_add_pd(v_cata1, _mm256_mul_pd(v_suma, v_e1));
+          v_cata2 = _mm256_add_pd(v_cata2, _mm256_mul_pd(v_suma, v_e2));
+          v_catb0 = _mm256_add_pd(v_catb0, _mm256_mul_pd(v_sumb, v_e0));
+          v_catb1 = _mm256_add_pd(v_catb1, _mm256_mul_pd(v_sumb, v_e1));
+          v_catb2 = _mm256_add_pd(v_catb2, _mm256_mul_pd(v_sumb, v_e2));
+
+          diagp += row;
+        }
+
+        /* account for invariant sites */
+        if (prop_invar[i] > 0)
+        {
+          __m256d v_inv_prop = _mm256_set1_pd(1. - prop_invar[i]);
+          v_cata0 = _mm256_mul_pd(v_cata0, v_inv_prop);
+          v_cata1 = _mm256_mul_pd(v_cata1, v_inv_prop);
+          v_cata2 = _mm256_mul_pd(v_cata2, v_inv_prop);
+          v_catb0 = _mm256_mul_pd(v_catb0, v_inv_prop);
+          v_catb1 = _mm256_mul_pd(v_catb1, v_inv_prop);
+          v_catb2 = _mm256_mul_pd(v_catb2, v_inv_prop);
+
+          if (invariant && invariant[n] != -1)
+            v_cata0 = _mm256_add_pd(v_cata0,
+                                    _mm256_set1_pd(freqs[i][invariant[n]] *
+                                                   prop_invar[i]));
+          if (invariant && invariant[m] != -1)
+            v_catb0 = _mm256_add_pd(v_catb0,
+                                    _mm256_set1_pd(freqs[i][invariant[m]] *
+                                                   prop_invar[i]));
+        }
+
+        __m256d v_weight = _mm256_set1_pd(rate_weights[i]);
+        v_lka0 = _mm256_add_pd(v_lka0, _mm256_mul_pd(v_cata0, v_weight));
+        v_lka1 = _mm256_add_pd(v_lka1, _mm256_mul_pd(v_cata1, v_weight));
+        v_lka2 = _mm256_add_pd(v_lka2, _mm256_mul_pd(v_cata2, v_weight));
+        v_lkb0 = _mm256_add_pd(v_lkb0, _mm256_mul_pd(v_catb0, v_weight));
+        v_lkb1 = _mm256_add_pd(v_lkb1, _mm256_mul_pd(v_catb1, v_weight));
+        v_lkb2 = _mm256_add_pd(v_lkb2, _mm256_mul_pd(v_catb2, v_weight));
+
+        sum_a += states_padded;
+        sum_b += states_padded;
+      }
+
+      multi_site_derivatives(v_lka0,
+                             v_lka1,
+                             v_lka2,
+                             pattern_weights[n],
+                             d_f + k,
+                             dd_f + k,
+                             lk_block ?
+                               lk_block + block_sites * points_padded + k :
+                               NULL);
+      if (pair == 2)
+        multi_site_derivatives(v_lkb0,
+                               v_lkb1,
+                               v_lkb2,
+                               pattern_weights[m],
+                               d_f + k,
+                               dd_f + k,
+                               lk_block ?
+                                 lk_block + (block_sites+1)*points_padded + k :
+                                 NULL);
+    }
+
+    sum += pair * span_padded;
+    block_sites += pair;
+
+    /* MULTI_SITE_BLOCK is even, hence pairs are never split */
+    if (lk_block && (block_sites == MULTI_SITE_BLOCK || n + pair == sites))
+    {
+      multi_flush_sites(block_sites,
+                        points_padded,
+                        lk_block,
+                        pattern_weights + n + pair - block_sites,
+                        site_scalings ?
+                          site_scalings + n + pair - block_sites : NULL,
+                        logl);
+    }
+    if (block_sites == MULTI_SITE_BLOCK)
+      block_sites = 0;
+  }
+
+  if (lk_block)
+    pll_aligned_free(lk_block);
+
+  return PLL_SUCCESS;
+}
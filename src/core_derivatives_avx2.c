@@ -999,6 +999,258 @@ PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx2(unsigned int states
   return PLL_SUCCESS;
 }
 
+/* product of the four matrix rows starting at mat (of states_padded columns
+   each) with clv */
+static inline __m256d matrix_quad(unsigned int states_padded,
+                                  const double * mat,
+                                  const double * clv)
+{
+  unsigned int j;
+
+  const double * m0 = mat;
+  const double * m1 = m0 + states_padded;
+  const double * m2 = m1 + states_padded;
+  const double * m3 = m2 + states_padded;
+
+  __m256d v_term0 = _mm256_setzero_pd();
+  __m256d v_term1 = _mm256_setzero_pd();
+  __m256d v_term2 = _mm256_setzero_pd();
+  __m256d v_term3 = _mm256_setzero_pd();
+
+  for (j = 0; j < states_padded; j += 4)
+  {
+    __m256d v_clv = _mm256_load_pd(clv+j);
+
+    v_term0 = _mm256_fmadd_pd(_mm256_load_pd(m0+j), v_clv, v_term0);
+    v_term1 = _mm256_fmadd_pd(_mm256_load_pd(m1+j), v_clv, v_term1);
+    v_term2 = _mm256_fmadd_pd(_mm256_load_pd(m2+j), v_clv, v_term2);
+    v_term3 = _mm256_fmadd_pd(_mm256_load_pd(m3+j), v_clv, v_term3);
+  }
+
+  __m256d xmm0 = _mm256_unpackhi_pd (v_term0, v_term1);
+  __m256d xmm1 = _mm256_unpacklo_pd (v_term0, v_term1);
+  __m256d xmm2 = _mm256_unpackhi_pd (v_term2, v_term3);
+  __m256d xmm3 = _mm256_unpacklo_pd (v_term2, v_term3);
+  xmm0 = _mm256_add_pd (xmm0, xmm1);
+  xmm1 = _mm256_add_pd (xmm2, xmm3);
+  xmm2 = _mm256_permute2f128_pd (xmm0, xmm1, _MM_SHUFFLE(0, 2, 0, 1));
+  xmm3 = _mm256_blend_pd (xmm0, xmm1, 12);
+
+  return _mm256_add_pd (xmm2, xmm3);
+}
+
+/* body of the bclv repeats sumtable kernel. The left terms are computed once
+   per parent class into bclv_buffer. It is inlined with constant
+   states_padded for 4 and 20 states */
+static inline __attribute__((always_inline))
+void update_sumtable_repeatsbclv(unsigned int states_padded,
+                                 unsigned int sites,
+                                 unsigned int parent_sites,
+                                 unsigned int rate_cats,
+                                 const double * clvp,
+                                 const double * clvc,
+                                 const unsigned int * parent_scaler,
+                                 const unsigned int * child_scaler,
+                                 const double * tt_eigenvecs,
+                                 const double * tt_inv_eigenvecs,
+                                 double * sum,
+                                 const unsigned int * parent_site_id,
+                                 const unsigned int * child_site_id,
+                                 double * bclv_buffer,
+                                 unsigned int * rate_scalings,
+                                 const __m256d * v_scale_minlh)
+{
+  unsigned int i, j, n;
+
+  unsigned int span_padded = rate_cats * states_padded;
+  size_t matrix_size = states_padded * states_padded;
+  unsigned int min_scaler;
+
+  /* left terms of each parent class */
+  double * lbclv = bclv_buffer;
+  for (n = 0; n < parent_sites; ++n)
+  {
+    for (i = 0; i < rate_cats; ++i)
+    {
+      const double * ct_inv_eigenvecs = tt_inv_eigenvecs + i*matrix_size;
+
+      for (j = 0; j < states_padded; j += 4)
+        _mm256_store_pd (lbclv + j,
+                         matrix_quad(states_padded,
+                                     ct_inv_eigenvecs + j*states_padded,
+                                     clvp));
+
+      clvp += states_padded;
+      lbclv += states_padded;
+    }
+  }
+
+  for (n = 0; n < sites; n++)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+    const double * lterm = &bclv_buffer[pid * span_padded];
+    const double * t_clvc = &clvc[cid * span_padded];
+
+    /* compute per-rate scalers and obtain minimum value (within site) */
+    if (rate_scalings)
+    {
+      min_scaler = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[pid*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[cid*rate_cats+i] : 0;
+        if (rate_scalings[i] < min_scaler)
+          min_scaler = rate_scalings[i];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - min_scaler,
+                                   PLL_SCALE_RATE_MAXDIFF);
+      }
+    }
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      const double * c_eigenvecs = tt_eigenvecs + i*matrix_size;
+
+      for (j = 0; j < states_padded; j += 4)
+      {
+        __m256d v_righterm_sum = matrix_quad(states_padded,
+                                             c_eigenvecs + j*states_padded,
+                                             t_clvc);
+
+        /* update sum */
+        __m256d v_prod = _mm256_mul_pd (_mm256_load_pd (lterm + j),
+                                        v_righterm_sum);
+
+        /* apply per-rate scalers */
+        if (rate_scalings && rate_scalings[i] > 0)
+        {
+          v_prod = _mm256_mul_pd(v_prod, v_scale_minlh[rate_scalings[i]-1]);
+        }
+
+        _mm256_store_pd (sum + j, v_prod);
+      }
+
+      t_clvc += states_padded;
+      lterm  += states_padded;
+      sum    += states_padded;
+    }
+  }
+}
+
+PLL_EXPORT int pll_core_update_sumtable_repeatsbclv_generic_avx2(unsigned int states,
+                                                                 unsigned int sites,
+                                                                 unsigned int parent_sites,
+                                                                 unsigned int rate_cats,
+                                                                 const double * clvp,
+                                                                 const double * clvc,
+                                                                 const unsigned int * parent_scaler,
+                                                                 const unsigned int * child_scaler,
+                                                                 double * const * eigenvecs,
+                                                                 double * const * inv_eigenvecs,
+                                                                 double * const * freqs,
+                                                                 double *sumtable,
+                                                                 const unsigned int * parent_site_id,
+                                                                 const unsigned int * child_site_id,
+                                                                 double * bclv_buffer,
+                                                                 unsigned int inv,
+                                                                 unsigned int attrib)
+{
+  unsigned int i, j, k;
+
+  double * t_freqs;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+
+  /* scaling stuff */
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  __m256d v_scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf (pll_errmsg, 200, "Cannot allocate memory for rate scalers");
+      return PLL_FAILURE;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      v_scale_minlh[i] = _mm256_set1_pd(scale_factor);
+    }
+  }
+
+  /* padded eigenvecs and transposed padded inv_eigenvecs */
+  double * tt_eigenvecs = (double *) pll_aligned_alloc (
+        (2 * states_padded * states_padded * rate_cats) * sizeof(double),
+        PLL_ALIGNMENT_AVX);
+
+  if (!tt_eigenvecs)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf (pll_errmsg, 200, "Cannot allocate memory for tt_eigenvecs");
+    return PLL_FAILURE;
+  }
+
+  double * tt_inv_eigenvecs = tt_eigenvecs +
+                              states_padded * states_padded * rate_cats;
+
+  memset(tt_eigenvecs, 0, (2 * states_padded * states_padded * rate_cats) * sizeof(double));
+
+  /* add padding to eigenvecs matrices and multiply with frequencies */
+  for (i = 0; i < rate_cats; ++i)
+  {
+    t_freqs = freqs[i];
+    for (j = 0; j < states; ++j)
+      for (k = 0; k < states; ++k)
+      {
+        tt_inv_eigenvecs[i * states_padded * states_padded + j * states_padded
+            + k] = inv_eigenvecs[i][k * states_padded + j] * t_freqs[k];
+        tt_eigenvecs[i * states_padded * states_padded + j * states_padded
+            + k] = eigenvecs[i][j * states_padded + k];
+      }
+  }
+
+  /* dedicated instances for DNA and protein data */
+  if (states == 4)
+    update_sumtable_repeatsbclv(4, sites, parent_sites, rate_cats, clvp, clvc,
+                                parent_scaler, child_scaler, tt_eigenvecs,
+                                tt_inv_eigenvecs, sumtable, parent_site_id,
+                                child_site_id, bclv_buffer, rate_scalings,
+                                v_scale_minlh);
+  else if (states == 20)
+    update_sumtable_repeatsbclv(20, sites, parent_sites, rate_cats, clvp, clvc,
+                                parent_scaler, child_scaler, tt_eigenvecs,
+                                tt_inv_eigenvecs, sumtable, parent_site_id,
+                                child_site_id, bclv_buffer, rate_scalings,
+                                v_scale_minlh);
+  else
+    update_sumtable_repeatsbclv(states_padded, sites, parent_sites, rate_cats,
+                                clvp, clvc, parent_scaler, child_scaler,
+                                tt_eigenvecs, tt_inv_eigenvecs, sumtable,
+                                parent_site_id, child_site_id, bclv_buffer,
+                                rate_scalings, v_scale_minlh);
+
+  pll_aligned_free (tt_eigenvecs);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
 #define COMPUTE_TI_QCOL(q, offset) \
 /* row 0 */ \
 v_mat    = _mm256_load_pd(rm0 + offset); \
@@ -1731,8 +1983,11 @@ int pll_core_likelihood_derivatives_avx2(unsigned int states,
       __m256d v_deriv2 = _mm256_sub_pd(_mm256_mul_pd(v_deriv1, v_deriv1),
                                        _mm256_mul_pd(v_term2, v_recip0));
 
-      /* assumption: no zero weights */
-      if ((pattern_weights[n-3] | pattern_weights[n-2] |
+      /* all 4 weights are 1 iff both their AND and OR are 1 (bootstrap
+         replicates have zero weights) */
+      if ((pattern_weights[n-3] & pattern_weights[n-2] &
+           pattern_weights[n-1] & pattern_weights[n]) == 1 &&
+          (pattern_weights[n-3] | pattern_weights[n-2] |
            pattern_weights[n-1] | pattern_weights[n]) == 1)
       {
         /* all 4 weights are 1 -> no multiplication needed */
@@ -1781,3 +2036,227 @@ int pll_core_likelihood_derivatives_avx2(unsigned int states,
 
   return PLL_SUCCESS;
 }
+
+/* number of sites whose likelihoods are buffered for vectorized logarithms */
+#define MULTI_SITE_BLOCK 64
+
+static void multi_flush_sites(unsigned int count,
+                              unsigned int points_padded,
+                              double * lk_block,
+                              const unsigned int * pattern_weights,
+                              const unsigned int * site_scalings,
+                              double * logl)
+{
+  unsigned int k, n;
+  double log_threshold = log(PLL_SCALE_THRESHOLD);
+
+  pll_core_log_avx2(count * points_padded, lk_block, lk_block);
+
+  for (n = 0; n < count; ++n)
+  {
+    double scaling = site_scalings ? site_scalings[n] * log_threshold : 0;
+    const double * site_lk = lk_block + n * points_padded;
+
+    for (k = 0; k < points_padded; ++k)
+      logl[k] += pattern_weights[n] * (site_lk[k] + scaling);
+  }
+}
+
+/* accumulates the derivatives of -logL of one site at 4 points and stores
+   its likelihoods for the logarithms */
+static inline void multi_site_derivatives(__m256d v_lk0,
+                                          __m256d v_lk1,
+                                          __m256d v_lk2,
+                                          unsigned int pattern_weight,
+                                          double * d_f,
+                                          double * dd_f,
+                                          double * site_lk)
+{
+  __m256d v_patw = _mm256_set1_pd(pattern_weight);
+  __m256d v_recip0 = _mm256_div_pd(_mm256_set1_pd(1.), v_lk0);
+  __m256d v_deriv1 = _mm256_mul_pd(v_lk1, v_recip0);
+  __m256d v_deriv2 = _mm256_fmsub_pd(v_deriv1,
+                                     v_deriv1,
+                                     _mm256_mul_pd(v_lk2, v_recip0));
+
+  __m256d v_df = _mm256_fnmadd_pd(v_deriv1, v_patw, _mm256_load_pd(d_f));
+  __m256d v_ddf = _mm256_fmadd_pd(v_deriv2, v_patw, _mm256_load_pd(dd_f));
+
+  _mm256_store_pd(d_f, v_df);
+  _mm256_store_pd(dd_f, v_ddf);
+
+  if (site_lk)
+    _mm256_store_pd(site_lk, v_lk0);
+}
+
+/* evaluates the likelihood and the derivatives of -logL at points_padded
+   branch lengths. The diagptable holds for each rate category and state the
+   rows exp(x*t), x*exp(x*t) and x^2*exp(x*t) over all branch lengths, such
+   that each sumtable entry is loaded once for all points. Sites are
+   processed in pairs, which share the loads of the diagptable */
+PLL_EXPORT
+int pll_core_likelihood_derivatives_multi_avx2(unsigned int states,
+                                               unsigned int states_padded,
+                                               unsigned int rate_cats,
+                                               unsigned int sites,
+                                               unsigned int points_padded,
+                                               const unsigned int * pattern_weights,
+                                               const double * rate_weights,
+                                               const unsigned int * site_scalings,
+                                               const int * invariant,
+                                               const double * prop_invar,
+                                               double * const * freqs,
+                                               const double * sumtable,
+                                               const double * diagptable,
+                                               double * logl,
+                                               double * d_f,
+                                               double * dd_f)
+{
+  unsigned int i,j,k,n;
+  unsigned int span_padded = rate_cats * states_padded;
+  unsigned int block_sites = 0;
+  unsigned int row = 3 * points_padded;
+  double * lk_block = NULL;
+
+  if (logl)
+  {
+    lk_block = (double *)pll_aligned_alloc(MULTI_SITE_BLOCK * points_padded *
+                                             sizeof(double),
+                                           PLL_ALIGNMENT_AVX);
+    if (!lk_block)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      return PLL_FAILURE;
+    }
+    memset(logl, 0, points_padded * sizeof(double));
+  }
+
+  memset(d_f, 0, points_padded * sizeof(double));
+  memset(dd_f, 0, points_padded * sizeof(double));
+
+  const double * sum = sumtable;
+  for (n = 0; n < sites; n += 2)
+  {
+    /* the second site of an incomplete pair repeats the first one */
+    unsigned int pair = (n + 1 < sites) ? 2 : 1;
+    unsigned int m = n + pair - 1;
+
+    for (k = 0; k < points_padded; k += 4)
+    {
+      const double * diagp = diagptable + k;
+      const double * sum_a = sum;
+      const double * sum_b = sum + (pair - 1) * span_padded;
+
+      __m256d v_lka0 = _mm256_setzero_pd();
+      __m256d v_lka1 = _mm256_setzero_pd();
+      __m256d v_lka2 = _mm256_setzero_pd();
+      __m256d v_lkb0 = _mm256_setzero_pd();
+      __m256d v_lkb1 = _mm256_setzero_pd();
+      __m256d v_lkb2 = _mm256_setzero_pd();
+
+      for (i = 0; i < rate_cats; ++i)
+      {
+        __m256d v_cata0 = _mm256_setzero_pd();
+        __m256d v_cata1 = _mm256_setzero_pd();
+        __m256d v_cata2 = _mm256_setzero_pd();
+        __m256d v_catb0 = _mm256_setzero_pd();
+        __m256d v_catb1 = _mm256_setzero_pd();
+        __m256d v_catb2 = _mm256_setzero_pd();
+
+        for (j = 0; j < states; ++j)
+        {
+          /* rows of exp(x*t), x*exp(x*t) and x^2*exp(x*t) */
+          __m256d v_e0 = _mm256_load_pd(diagp);
+          __m256d v_e1 = _mm256_load_pd(diagp + points_padded);
+          __m256d v_e2 = _mm256_load_pd(diagp + 2*points_padded);
+          __m256d v_suma = _mm256_broadcast_sd(&sum_a[j]);
+          __m256d v_sumb = _mm256_broadcast_sd(&sum_b[j]);
+
+          v_cata0 = _mm256_fmadd_pd(v_suma, v_e0, v_cata0);
+          v_cata1 = _mm256_fmadd_pd(v_suma, v_e1, v_cata1);
+          v_cata2 = _mm256_fmadd_pd(v_suma, v_e2, v_cata2);
+          v_catb0 = _mm256_fmadd_pd(v_sumb, v_e0, v_catb0);
+          v_catb1 = _mm256_fmadd_pd(v_sumb, v_e1, v_catb1);
+          v_catb2 = _mm256_fmadd_pd(v_sumb, v_e2, v_catb2);
+
+          diagp += row;
+        }
+
+        /* account for invariant sites */
+        if (prop_invar[i] > 0)
+        {
+          __m256d v_inv_prop = _mm256_set1_pd(1. - prop_invar[i]);
+          v_cata0 = _mm256_mul_pd(v_cata0, v_inv_prop);
+          v_cata1 = _mm256_mul_pd(v_cata1, v_inv_prop);
+          v_cata2 = _mm256_mul_pd(v_cata2, v_inv_prop);
+          v_catb0 = _mm256_mul_pd(v_catb0, v_inv_prop);
+          v_catb1 = _mm256_mul_pd(v_catb1, v_inv_prop);
+          v_catb2 = _mm256_mul_pd(v_catb2, v_inv_prop);
+
+          if (invariant && invariant[n] != -1)
+            v_cata0 = _mm256_add_pd(v_cata0,
+                                    _mm256_set1_pd(freqs[i][invariant[n]] *
+                                                   prop_invar[i]));
+          if (invariant && invariant[m] != -1)
+            v_catb0 = _mm256_add_pd(v_catb0,
+                                    _mm256_set1_pd(freqs[i][invariant[m]] *
+                                                   prop_invar[i]));
+        }
+
+        __m256d v_weight = _mm256_set1_pd(rate_weights[i]);
+        v_lka0 = _mm256_fmadd_pd(v_cata0, v_weight, v_lka0);
+        v_lka1 = _mm256_fmadd_pd(v_cata1, v_weight, v_lka1);
+        v_lka2 = _mm256_fmadd_pd(v_cata2, v_weight, v_lka2);
+        v_lkb0 = _mm256_fmadd_pd(v_catb0, v_weight, v_lkb0);
+        v_lkb1 = _mm256_fmadd_pd(v_catb1, v_weight, v_lkb1);
+        v_lkb2 = _mm256_fmadd_pd(v_catb2, v_weight, v_lkb2);
+
+        sum_a += states_padded;
+        sum_b += states_padded;
+      }
+
+      multi_site_derivatives(v_lka0,
+                             v_lka1,
+                             v_lka2,
+                             pattern_weights[n],
+                             d_f + k,
+                             dd_f + k,
+                             lk_block ?
+                               lk_block + block_sites * points_padded + k :
+                               NULL);
+      if (pair == 2)
+        multi_site_derivatives(v_lkb0,
+                               v_lkb1,
+                               v_lkb2,
+                               pattern_weights[m],
+                               d_f + k,
+                               dd_f + k,
+                               lk_block ?
+                                 lk_block + (block_sites+1)*points_padded + k :
+                                 NULL);
+    }
+
+    sum += pair * span_padded;
+    block_sites += pair;
+
+    /* MULTI_SITE_BLOCK is even, hence pairs are never split */
+    if (lk_block && (block_sites == MULTI_SITE_BLOCK || n + pair == sites))
+    {
+      multi_flush_sites(block_sites,
+                        points_padded,
+                        lk_block,
+                        pattern_weights + n + pair - block_sites,
+                        site_scalings ?
+                          site_scalings + n + pair - block_sites : NULL,
+                        logl);
+    }
+    if (block_sites == MULTI_SITE_BLOCK)
+      block_sites = 0;
+  }
+
+  if (lk_block)
+    pll_aligned_free(lk_block);
+
+  return PLL_SUCCESS;
+}
@@ -0,0 +1,908 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+
+#define BLOCK_MASK(n) (((n) >= 8) ? 0xFF : 0x0F)
+
+/* build the per-rate matrices used for the left and right terms of the
+   sumtable, i.e. left[k][m][j] = freqs_k[m] * inv_eigenvecs_k[m][j] and
+   right[k][m][j] = eigenvecs_k[j][m] */
+static double * create_eigen_matrices(unsigned int states,
+                                      unsigned int states_padded,
+                                      unsigned int rate_cats,
+                                      double * const * eigenvecs,
+                                      double * const * inv_eigenvecs,
+                                      double * const * freqs)
+{
+  unsigned int i,j,k;
+  size_t matrix_size = states * states_padded;
+  size_t size = 2 * rate_cats * matrix_size * sizeof(double);
+
+  double * mem = (double *)pll_aligned_alloc(size, PLL_ALIGNMENT_AVX512);
+  if (!mem)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return NULL;
+  }
+  memset(mem, 0, size);
+
+  double * left = mem;
+  double * right = mem + rate_cats * matrix_size;
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    const double * t_eigenvecs = eigenvecs[k];
+    const double * t_inv_eigenvecs = inv_eigenvecs[k];
+    const double * t_freqs = freqs[k];
+
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+      {
+        left[i*states_padded+j] = t_freqs[i] *
+                                  t_inv_eigenvecs[i*states_padded+j];
+        right[i*states_padded+j] = t_eigenvecs[j*states_padded+i];
+      }
+
+    left += matrix_size;
+    right += matrix_size;
+  }
+
+  return mem;
+}
+
+/* res[j] = sum_m v[m] * matrix[m][j] for each rate category */
+static inline void site_eigen_term(unsigned int states,
+                                   unsigned int states_padded,
+                                   unsigned int rate_cats,
+                                   const double * v,
+                                   const double * matrix,
+                                   double * res)
+{
+  unsigned int i,j,k;
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    for (i = 0; i < states_padded; i += 8)
+    {
+      __mmask8 m = BLOCK_MASK(states_padded - i);
+      __m512d v_term = _mm512_setzero_pd();
+
+      for (j = 0; j < states; ++j)
+        v_term = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m,
+                                                       matrix+j*states_padded+i),
+                                 _mm512_set1_pd(v[j]),
+                                 v_term);
+
+      _mm512_mask_storeu_pd(res + i, m, v_term);
+    }
+    v += states_padded;
+    res += states_padded;
+    matrix += states * states_padded;
+  }
+}
+
+/* sum[j] = lterm[j] * rterm[j], with relative per-rate scalers applied */
+static inline void site_sumtable(unsigned int states_padded,
+                                 unsigned int rate_cats,
+                                 const double * lterm,
+                                 const double * rterm,
+                                 const unsigned int * rate_scalings,
+                                 const double * scale_minlh,
+                                 double * sum)
+{
+  unsigned int i,k;
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    __m512d v_scale = _mm512_set1_pd((rate_scalings && rate_scalings[k] > 0) ?
+                                     scale_minlh[rate_scalings[k]-1] : 1.);
+
+    for (i = 0; i < states_padded; i += 8)
+    {
+      __mmask8 m = BLOCK_MASK(states_padded - i);
+      __m512d v_sum = _mm512_mul_pd(_mm512_maskz_loadu_pd(m, lterm + i),
+                                    _mm512_maskz_loadu_pd(m, rterm + i));
+      _mm512_mask_storeu_pd(sum + i, m, _mm512_mul_pd(v_sum, v_scale));
+    }
+
+    lterm += states_padded;
+    rterm += states_padded;
+    sum += states_padded;
+  }
+}
+
+static inline void site_rate_scalers(unsigned int rate_cats,
+                                     const unsigned int * parent_scaler,
+                                     unsigned int pid,
+                                     const unsigned int * child_scaler,
+                                     unsigned int cid,
+                                     unsigned int * rate_scalings)
+{
+  unsigned int i;
+  unsigned int min_scaler = UINT_MAX;
+
+  /* compute minimum per-rate scaler -> common per-site scaler */
+  for (i = 0; i < rate_cats; ++i)
+  {
+    rate_scalings[i] = (parent_scaler) ? parent_scaler[pid*rate_cats+i] : 0;
+    rate_scalings[i] += (child_scaler) ? child_scaler[cid*rate_cats+i] : 0;
+    if (rate_scalings[i] < min_scaler)
+      min_scaler = rate_scalings[i];
+  }
+
+  /* compute relative capped per-rate scalers */
+  for (i = 0; i < rate_cats; ++i)
+  {
+    rate_scalings[i] = PLL_MIN(rate_scalings[i] - min_scaler,
+                               PLL_SCALE_RATE_MAXDIFF);
+  }
+}
+
+PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx512(unsigned int states,
+                                                               unsigned int sites,
+                                                               unsigned int parent_sites,
+                                                               unsigned int rate_cats,
+                                                               const double * clvp,
+                                                               const double * clvc,
+                                                               const unsigned int * parent_scaler,
+                                                               const unsigned int * child_scaler,
+                                                               double * const * eigenvecs,
+                                                               double * const * inv_eigenvecs,
+                                                               double * const * freqs,
+                                                               double *sumtable,
+                                                               const unsigned int * parent_site_id,
+                                                               const unsigned int * child_site_id,
+                                                               double * bclv_buffer,
+                                                               unsigned int inv,
+                                                               unsigned int attrib)
+{
+  unsigned int i,n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+  size_t matrix_size = states * states_padded;
+
+  double * sum = sumtable;
+
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return PLL_FAILURE;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  double * eigen = create_eigen_matrices(states,
+                                         states_padded,
+                                         rate_cats,
+                                         eigenvecs,
+                                         inv_eigenvecs,
+                                         freqs);
+  double * lterm = (double *)pll_aligned_alloc(2 * span_padded * sizeof(double),
+                                               PLL_ALIGNMENT_AVX512);
+  if (!eigen || !lterm)
+  {
+    if (eigen) pll_aligned_free(eigen);
+    if (lterm) pll_aligned_free(lterm);
+    if (rate_scalings) free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  double * rterm = lterm + span_padded;
+  const double * left = eigen;
+  const double * right = eigen + rate_cats * matrix_size;
+
+  /* build sumtable */
+  for (n = 0; n < sites; n++)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+
+    if (per_rate_scaling)
+      site_rate_scalers(rate_cats,
+                        parent_scaler,
+                        pid,
+                        child_scaler,
+                        cid,
+                        rate_scalings);
+
+    site_eigen_term(states,
+                    states_padded,
+                    rate_cats,
+                    clvp + pid*span_padded,
+                    left,
+                    lterm);
+    site_eigen_term(states,
+                    states_padded,
+                    rate_cats,
+                    clvc + cid*span_padded,
+                    right,
+                    rterm);
+    site_sumtable(states_padded,
+                  rate_cats,
+                  lterm,
+                  rterm,
+                  rate_scalings,
+                  scale_minlh,
+                  sum);
+
+    sum += span_padded;
+  }
+
+  pll_aligned_free(lterm);
+  pll_aligned_free(eigen);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_core_update_sumtable_repeatsbclv_generic_avx512(unsigned int states,
+                                                                   unsigned int sites,
+                                                                   unsigned int parent_sites,
+                                                                   unsigned int rate_cats,
+                                                                   const double * clvp,
+                                                                   const double * clvc,
+                                                                   const unsigned int * parent_scaler,
+                                                                   const unsigned int * child_scaler,
+                                                                   double * const * eigenvecs,
+                                                                   double * const * inv_eigenvecs,
+                                                                   double * const * freqs,
+                                                                   double *sumtable,
+                                                                   const unsigned int * parent_site_id,
+                                                                   const unsigned int * child_site_id,
+                                                                   double * bclv_buffer,
+                                                                   unsigned int inv,
+                                                                   unsigned int attrib)
+{
+  unsigned int i,n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+  size_t matrix_size = states * states_padded;
+
+  double * sum = sumtable;
+
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return PLL_FAILURE;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  double * eigen = create_eigen_matrices(states,
+                                         states_padded,
+                                         rate_cats,
+                                         eigenvecs,
+                                         inv_eigenvecs,
+                                         freqs);
+  double * rterm = (double *)pll_aligned_alloc(span_padded * sizeof(double),
+                                               PLL_ALIGNMENT_AVX512);
+  if (!eigen || !rterm)
+  {
+    if (eigen) pll_aligned_free(eigen);
+    if (rterm) pll_aligned_free(rterm);
+    if (rate_scalings) free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  const double * left = eigen;
+  const double * right = eigen + rate_cats * matrix_size;
+
+  /* the left terms are computed once per parent class */
+  for (n = 0; n < parent_sites; ++n)
+    site_eigen_term(states,
+                    states_padded,
+                    rate_cats,
+                    clvp + n*span_padded,
+                    left,
+                    bclv_buffer + n*span_padded);
+
+  /* build sumtable */
+  for (n = 0; n < sites; n++)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+
+    if (per_rate_scaling)
+      site_rate_scalers(rate_cats,
+                        parent_scaler,
+                        pid,
+                        child_scaler,
+                        cid,
+                        rate_scalings);
+
+    site_eigen_term(states,
+                    states_padded,
+                    rate_cats,
+                    clvc + cid*span_padded,
+                    right,
+                    rterm);
+    site_sumtable(states_padded,
+                  rate_cats,
+                  bclv_buffer + pid*span_padded,
+                  rterm,
+                  rate_scalings,
+                  scale_minlh,
+                  sum);
+
+    sum += span_padded;
+  }
+
+  pll_aligned_free(rterm);
+  pll_aligned_free(eigen);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_core_update_sumtable_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * clvp,
+                                                  const double * clvc,
+                                                  const unsigned int * parent_scaler,
+                                                  const unsigned int * child_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  double * sumtable,
+                                                  unsigned int attrib)
+{
+  return pll_core_update_sumtable_repeats_generic_avx512(states,
+                                                         sites,
+                                                         sites,
+                                                         rate_cats,
+                                                         clvp,
+                                                         clvc,
+                                                         parent_scaler,
+                                                         child_scaler,
+                                                         eigenvecs,
+                                                         inv_eigenvecs,
+                                                         freqs,
+                                                         sumtable,
+                                                         NULL,
+                                                         NULL,
+                                                         NULL,
+                                                         0,
+                                                         attrib);
+}
+
+PLL_EXPORT int pll_core_update_sumtable_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * parent_clv,
+                                                  const unsigned char * left_tipchars,
+                                                  const unsigned int * parent_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  double * sumtable,
+                                                  unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+  size_t matrix_size = states * states_padded;
+
+  double * sum = sumtable;
+
+  /* 4-state tip characters are the state masks themselves */
+  if (states == 4)
+  {
+    tipmap = NULL;
+    tipmap_size = 16;
+  }
+
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return PLL_FAILURE;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  double * eigen = create_eigen_matrices(states,
+                                         states_padded,
+                                         rate_cats,
+                                         eigenvecs,
+                                         inv_eigenvecs,
+                                         freqs);
+  double * lookup = (double *)pll_aligned_alloc((tipmap_size + 1) *
+                                                span_padded * sizeof(double),
+                                                PLL_ALIGNMENT_AVX512);
+  if (!eigen || !lookup)
+  {
+    if (eigen) pll_aligned_free(eigen);
+    if (lookup) pll_aligned_free(lookup);
+    if (rate_scalings) free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+  memset(lookup, 0, (tipmap_size + 1) * span_padded * sizeof(double));
+
+  double * rterm = lookup + tipmap_size * span_padded;
+  const double * left = eigen;
+  const double * right = eigen + rate_cats * matrix_size;
+
+  /* precompute the left terms for every tip state */
+  for (n = 0; n < tipmap_size; ++n)
+  {
+    pll_state_t state = tipmap ? tipmap[n] : n;
+    double * lterm = lookup + n*span_padded;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * lmat = left + k*matrix_size;
+      for (i = 0; i < states; ++i)
+      {
+        if (!((state >> i) & 1))
+          continue;
+        for (j = 0; j < states; ++j)
+          lterm[j] += lmat[i*states_padded+j];
+      }
+      lterm += states_padded;
+    }
+  }
+
+  /* build sumtable */
+  for (n = 0; n < sites; n++)
+  {
+    if (per_rate_scaling)
+      site_rate_scalers(rate_cats,
+                        parent_scaler,
+                        n,
+                        NULL,
+                        n,
+                        rate_scalings);
+
+    site_eigen_term(states,
+                    states_padded,
+                    rate_cats,
+                    parent_clv + n*span_padded,
+                    right,
+                    rterm);
+    site_sumtable(states_padded,
+                  rate_cats,
+                  lookup + left_tipchars[n]*span_padded,
+                  rterm,
+                  rate_scalings,
+                  scale_minlh,
+                  sum);
+
+    sum += span_padded;
+  }
+
+  pll_aligned_free(lookup);
+  pll_aligned_free(eigen);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT
+int pll_core_likelihood_derivatives_avx512(unsigned int states,
+                                           unsigned int states_padded,
+                                           unsigned int rate_cats,
+                                           unsigned int ef_sites,
+                                           const unsigned int * pattern_weights,
+                                           const double * rate_weights,
+                                           const int * invariant,
+                                           const double * prop_invar,
+                                           double * const * freqs,
+                                           const double * sumtable,
+                                           const double * diagptable,
+                                           double * d_f,
+                                           double * dd_f)
+{
+  unsigned int i,j,k,n;
+  unsigned int span_padded = rate_cats * states_padded;
+
+  double * invar_lk = NULL;
+
+  /* check if proportion of invariant site is used */
+  int use_pinv = 0;
+  for (i = 0; i < rate_cats; ++i)
+    use_pinv |= (prop_invar[i] > 0);
+
+  /* rows of the diagptable for the likelihood and its 1st and 2nd derivative,
+     laid out as a site sumtable, with rate weights and the proportion of
+     variable sites folded in */
+  double * t_diagp = (double *) pll_aligned_alloc(
+                                      3 * span_padded * sizeof(double),
+                                      PLL_ALIGNMENT_AVX512);
+  if (!t_diagp)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+  memset(t_diagp, 0, 3 * span_padded * sizeof(double));
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    double weight = rate_weights[i];
+    if (prop_invar[i] > 0)
+      weight *= 1. - prop_invar[i];
+
+    for (j = 0; j < states; ++j)
+      for (k = 0; k < 3; ++k)
+        t_diagp[k*span_padded + i*states_padded + j] =
+            weight * diagptable[i * states * 4 + j * 4 + k];
+  }
+
+  if (use_pinv)
+  {
+    invar_lk = (double *) calloc(states, sizeof(double));
+
+    if (!invar_lk)
+    {
+      pll_aligned_free(t_diagp);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      return PLL_FAILURE;
+    }
+
+    /* pre-compute weighted invariant site likelihoods */
+    for (i = 0; i < rate_cats; ++i)
+      if (prop_invar[i] > 0)
+        for (j = 0; j < states; ++j)
+          invar_lk[j] += rate_weights[i] * freqs[i][j] * prop_invar[i];
+  }
+
+  const double * r0 = t_diagp;
+  const double * r1 = r0 + span_padded;
+  const double * r2 = r1 + span_padded;
+
+  const double * sum = sumtable;
+  double df = 0, ddf = 0;
+
+  for (n = 0; n < ef_sites; ++n)
+  {
+    __m512d v_lk0 = _mm512_setzero_pd();
+    __m512d v_lk1 = _mm512_setzero_pd();
+    __m512d v_lk2 = _mm512_setzero_pd();
+
+    for (i = 0; i < span_padded; i += 8)
+    {
+      __mmask8 m = BLOCK_MASK(span_padded - i);
+      __m512d v_sum = _mm512_maskz_loadu_pd(m, sum + i);
+
+      v_lk0 = _mm512_fmadd_pd(v_sum, _mm512_maskz_loadu_pd(m, r0 + i), v_lk0);
+      v_lk1 = _mm512_fmadd_pd(v_sum, _mm512_maskz_loadu_pd(m, r1 + i), v_lk1);
+      v_lk2 = _mm512_fmadd_pd(v_sum, _mm512_maskz_loadu_pd(m, r2 + i), v_lk2);
+    }
+
+    double site_lk0 = _mm512_reduce_add_pd(v_lk0);
+    double site_lk1 = _mm512_reduce_add_pd(v_lk1);
+    double site_lk2 = _mm512_reduce_add_pd(v_lk2);
+
+    /* account for invariant sites */
+    if (use_pinv && invariant && invariant[n] != -1)
+      site_lk0 += invar_lk[invariant[n]];
+
+    /* build derivatives */
+    double deriv1 = -site_lk1 / site_lk0;
+    double deriv2 = deriv1 * deriv1 - site_lk2 / site_lk0;
+    df += pattern_weights[n] * deriv1;
+    ddf += pattern_weights[n] * deriv2;
+
+    sum += span_padded;
+  }
+
+  *d_f = df;
+  *dd_f = ddf;
+
+  pll_aligned_free(t_diagp);
+  if (invar_lk)
+    free(invar_lk);
+
+  return PLL_SUCCESS;
+}
+
+/* number of sites whose likelihoods are buffered for vectorized logarithms */
+#define MULTI_SITE_BLOCK 64
+
+static void multi_flush_sites(unsigned int count,
+                              unsigned int points_padded,
+                              double * lk_block,
+                              const unsigned int * pattern_weights,
+                              const unsigned int * site_scalings,
+                              double * logl)
+{
+  unsigned int k, n;
+  double log_threshold = log(PLL_SCALE_THRESHOLD);
+
+  pll_core_log_avx512(count * points_padded, lk_block, lk_block);
+
+  for (n = 0; n < count; ++n)
+  {
+    double scaling = site_scalings ? site_scalings[n] * log_threshold : 0;
+    const double * site_lk = lk_block + n * points_padded;
+
+    for (k = 0; k < points_padded; ++k)
+      logl[k] += pattern_weights[n] * (site_lk[k] + scaling);
+  }
+}
+
+/* accumulates the derivatives of -logL of one site at 8 points and stores
+   its likelihoods for the logarithms */
+static inline void multi_site_derivatives(__m512d v_lk0,
+                                          __m512d v_lk1,
+                                          __m512d v_lk2,
+                                          unsigned int pattern_weight,
+                                          double * d_f,
+                                          double * dd_f,
+                                          double * site_lk)
+{
+  __m512d v_patw = _mm512_set1_pd(pattern_weight);
+  __m512d v_recip0 = _mm512_div_pd(_mm512_set1_pd(1.), v_lk0);
+  __m512d v_deriv1 = _mm512_mul_pd(v_lk1, v_recip0);
+  __m512d v_deriv2 = _mm512_fmsub_pd(v_deriv1,
+                                     v_deriv1,
+                                     _mm512_mul_pd(v_lk2, v_recip0));
+
+  __m512d v_df = _mm512_fnmadd_pd(v_deriv1, v_patw, _mm512_load_pd(d_f));
+  __m512d v_ddf = _mm512_fmadd_pd(v_deriv2, v_patw, _mm512_load_pd(dd_f));
+
+  _mm512_store_pd(d_f, v_df);
+  _mm512_store_pd(dd_f, v_ddf);
+
+  if (site_lk)
+    _mm512_store_pd(site_lk, v_lk0);
+}
+
+/* evaluates the likelihood and the derivatives of -logL at points_padded
+   branch lengths. The diagptable holds for each rate category and state the
+   rows exp(x*t), x*exp(x*t) and x^2*exp(x*t) over all branch lengths, such
+   that each sumtable entry is loaded once for all points. Sites are
+   processed in pairs, which share the loads of the diagptable */
+PLL_EXPORT
+int pll_core_likelihood_derivatives_multi_avx512(unsigned int states,
+                                                 unsigned int states_padded,
+                                                 unsigned int rate_cats,
+                                                 unsigned int sites,
+                                                 unsigned int points_padded,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * rate_weights,
+                                                 const unsigned int * site_scalings,
+                                                 const int * invariant,
+                                                 const double * prop_invar,
+                                                 double * const * freqs,
+                                                 const double * sumtable,
+                                                 const double * diagptable,
+                                                 double * logl,
+                                                 double * d_f,
+                                                 double * dd_f)
+{
+  unsigned int i,j,k,n;
+  unsigned int span_padded = rate_cats * states_padded;
+  unsigned int block_sites = 0;
+  unsigned int row = 3 * points_padded;
+  double * lk_block = NULL;
+
+  if (logl)
+  {
+    lk_block = (double *)pll_aligned_alloc(MULTI_SITE_BLOCK * points_padded *
+                                             sizeof(double),
+                                           PLL_ALIGNMENT_AVX512);
+    if (!lk_block)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      return PLL_FAILURE;
+    }
+    memset(logl, 0, points_padded * sizeof(double));
+  }
+
+  memset(d_f, 0, points_padded * sizeof(double));
+  memset(dd_f, 0, points_padded * sizeof(double));
+
+  const double * sum = sumtable;
+  for (n = 0; n < sites; n += 2)
+  {
+    /* the second site of an incomplete pair repeats the first one */
+    unsigned int pair = (n + 1 < sites) ? 2 : 1;
+    unsigned int m = n + pair - 1;
+
+    for (k = 0; k < points_padded; k += 8)
+    {
+      const double * diagp = diagptable + k;
+      const double * sum_a = sum;
+      const double * sum_b = sum + (pair - 1) * span_padded;
+
+      __m512d v_lka0 = _mm512_setzero_pd();
+      __m512d v_lka1 = _mm512_setzero_pd();
+      __m512d v_lka2 = _mm512_setzero_pd();
+      __m512d v_lkb0 = _mm512_setzero_pd();
+      __m512d v_lkb1 = _mm512_setzero_pd();
+      __m512d v_lkb2 = _mm512_setzero_pd();
+
+      for (i = 0; i < rate_cats; ++i)
+      {
+        __m512d v_cata0 = _mm512_setzero_pd();
+        __m512d v_cata1 = _mm512_setzero_pd();
+        __m512d v_cata2 = _mm512_setzero_pd();
+        __m512d v_catb0 = _mm512_setzero_pd();
+        __m512d v_catb1 = _mm512_setzero_pd();
+        __m512d v_catb2 = _mm512_setzero_pd();
+
+        for (j = 0; j < states; ++j)
+        {
+          /* rows of exp(x*t), x*exp(x*t) and x^2*exp(x*t) */
+          __m512d v_e0 = _mm512_load_pd(diagp);
+          __m512d v_e1 = _mm512_load_pd(diagp + points_padded);
+          __m512d v_e2 = _mm512_load_pd(diagp + 2*points_padded);
+          __m512d v_suma = _mm512_set1_pd(sum_a[j]);
+          __m512d v_sumb = _mm512_set1_pd(sum_b[j]);
+
+          v_cata0 = _mm512_fmadd_pd(v_suma, v_e0, v_cata0);
+          v_cata1 = _mm512_fmadd_pd(v_suma, v_e1, v_cata1);
+          v_cata2 = _mm512_fmadd_pd(v_suma, v_e2, v_cata2);
+          v_catb0 = _mm512_fmadd_pd(v_sumb, v_e0, v_catb0);
+          v_catb1 = _mm512_fmadd_pd(v_sumb, v_e1, v_catb1);
+          v_catb2 = _mm512_fmadd_pd(v_sumb, v_e2, v_catb2);
+
+          diagp += row;
+        }
+
+        /* account for invariant sites */
+        if (prop_invar[i] > 0)
+        {
+          __m512d v_inv_prop = _mm512_set1_pd(1. - prop_invar[i]);
+          v_cata0 = _mm512_mul_pd(v_cata0, v_inv_prop);
+          v_cata1 = _mm512_mul_pd(v_cata1, v_inv_prop);
+          v_cata2 = _mm512_mul_pd(v_cata2, v_inv_prop);
+          v_catb0 = _mm512_mul_pd(v_catb0, v_inv_prop);
+          v_catb1 = _mm512_mul_pd(v_catb1, v_inv_prop);
+          v_catb2 = _mm512_mul_pd(v_catb2, v_inv_prop);
+
+          if (invariant && invariant[n] != -1)
+            v_cata0 = _mm512_add_pd(v_cata0,
+                                    _mm512_set1_pd(freqs[i][invariant[n]] *
+                                                   prop_invar[i]));
+          if (invariant && invariant[m] != -1)
+            v_catb0 = _mm512_add_pd(v_catb0,
+                                    _mm512_set1_pd(freqs[i][invariant[m]] *
+                                                   prop_invar[i]));
+        }
+
+        __m512d v_weight = _mm512_set1_pd(rate_weights[i]);
+        v_lka0 = _mm512_fmadd_pd(v_cata0, v_weight, v_lka0);
+        v_lka1 = _mm512_fmadd_pd(v_cata1, v_weight, v_lka1);
+        v_lka2 = _mm512_fmadd_pd(v_cata2, v_weight, v_lka2);
+        v_lkb0 = _mm512_fmadd_pd(v_catb0, v_weight, v_lkb0);
+        v_lkb1 = _mm512_fmadd_pd(v_catb1, v_weight, v_lkb1);
+        v_lkb2 = _mm512_fmadd_pd(v_catb2, v_weight, v_lkb2);
+
+        sum_a += states_padded;
+        sum_b += states_padded;
+      }
+
+      multi_site_derivatives(v_lka0,
+                             v_lka1,
+                             v_lka2,
+                             pattern_weights[n],
+                             d_f + k,
+                             dd_f + k,
+                             lk_block ?
+                               lk_block + block_sites * points_padded + k :
+                               NULL);
+      if (pair == 2)
+        multi_site_derivatives(v_lkb0,
+                               v_lkb1,
+                               v_lkb2,
+                               pattern_weights[m],
+                               d_f + k,
+                               dd_f + k,
+                               lk_block ?
+                                 lk_block + (block_sites+1)*points_padded + k :
+                                 NULL);
+    }
+
+    sum += pair * span_padded;
+    block_sites += pair;
+
+    /* MULTI_SITE_BLOCK is even, hence pairs are never split */
+    if (lk_block && (block_sites == MULTI_SITE_BLOCK || n + pair == sites))
+    {
+      multi_flush_sites(block_sites,
+                        points_padded,
+                        lk_block,
+                        pattern_weights + n + pair - block_sites,
+                        site_scalings ?
+                          site_scalings + n + pair - block_sites : NULL,
+                        logl);
+    }
+    if (block_sites == MULTI_SITE_BLOCK)
+      block_sites = 0;
+  }
+
+  if (lk_block)
+    pll_aligned_free(lk_block);
+
+  return PLL_SUCCESS;
+}
@@ -0,0 +1,1607 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* p-matrix updates of at least this many branches use the batched kernels,
+   which exponentiate the eigenvalues of several branches at once */
+#define PMATRIX_BATCH_MIN 8
+
+/* Adapters giving the specialized kernels the signatures of the pll_core_*
+   dispatchers, so that they can be stored in a pll_kernels_t table */
+
+static double edge_loglikelihood_ti_4x4(unsigned int states,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        const double * parent_clv,
+                                        const unsigned int * parent_scaler,
+                                        const unsigned char * tipchars,
+                                        const pll_state_t * tipmap,
+                                        unsigned int tipmap_size,
+                                        const double * pmatrix,
+                                        double * const * frequencies,
+                                        const double * rate_weights,
+                                        const unsigned int * pattern_weights,
+                                        const double * invar_proportion,
+                                        const int * invar_indices,
+                                        const unsigned int * freqs_indices,
+                                        double * persite_lnl,
+                                        unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_4x4(sites,
+                                            rate_cats,
+                                            parent_clv,
+                                            parent_scaler,
+                                            tipchars,
+                                            pmatrix,
+                                            frequencies,
+                                            rate_weights,
+                                            pattern_weights,
+                                            invar_proportion,
+                                            invar_indices,
+                                            freqs_indices,
+                                            persite_lnl,
+                                            attrib);
+}
+
+#ifdef HAVE_SSE3
+static void create_lookup_4x4_sse(unsigned int states,
+                                  unsigned int rate_cats,
+                                  double * lookup,
+                                  const double * left_matrix,
+                                  const double * right_matrix,
+                                  const pll_state_t * tipmap,
+                                  unsigned int tipmap_size,
+                                  unsigned int attrib)
+{
+  pll_core_create_lookup_4x4_sse(rate_cats,
+                                 lookup,
+                                 left_matrix,
+                                 right_matrix);
+}
+
+static void create_lookup_sse(unsigned int states,
+                              unsigned int rate_cats,
+                              double * lookup,
+                              const double * left_matrix,
+                              const double * right_matrix,
+                              const pll_state_t * tipmap,
+                              unsigned int tipmap_size,
+                              unsigned int attrib)
+{
+  pll_core_create_lookup_sse(states,
+                             rate_cats,
+                             lookup,
+                             left_matrix,
+                             right_matrix,
+                             tipmap,
+                             tipmap_size);
+}
+
+static void update_partial_tt_4x4_sse(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      double * parent_clv,
+                                      unsigned int * parent_scaler,
+                                      const unsigned char * left_tipchars,
+                                      const unsigned char * right_tipchars,
+                                      const pll_state_t * tipmap,
+                                      unsigned int tipmap_size,
+                                      const double * lookup,
+                                      unsigned int attrib)
+{
+  pll_core_update_partial_tt_4x4_sse(sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_tipchars,
+                                     right_tipchars,
+                                     lookup,
+                                     attrib);
+}
+
+static void update_partial_tt_sse(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  double * parent_clv,
+                                  unsigned int * parent_scaler,
+                                  const unsigned char * left_tipchars,
+                                  const unsigned char * right_tipchars,
+                                  const pll_state_t * tipmap,
+                                  unsigned int tipmap_size,
+                                  const double * lookup,
+                                  unsigned int attrib)
+{
+  pll_core_update_partial_tt_sse(states,
+                                 sites,
+                                 rate_cats,
+                                 parent_clv,
+                                 parent_scaler,
+                                 left_tipchars,
+                                 right_tipchars,
+                                 lookup,
+                                 tipmap_size,
+                                 attrib);
+}
+
+static void update_partial_ti_4x4_sse(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      double * parent_clv,
+                                      unsigned int * parent_scaler,
+                                      const unsigned char * left_tipchars,
+                                      const double * right_clv,
+                                      const double * left_matrix,
+                                      const double * right_matrix,
+                                      const unsigned int * right_scaler,
+                                      const pll_state_t * tipmap,
+                                      unsigned int tipmap_size,
+                                      unsigned int attrib)
+{
+  pll_core_update_partial_ti_4x4_sse(sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_tipchars,
+                                     right_clv,
+                                     left_matrix,
+                                     right_matrix,
+                                     right_scaler,
+                                     attrib);
+}
+
+static void update_partial_ii_4x4_sse(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      double * parent_clv,
+                                      unsigned int * parent_scaler,
+                                      const double * left_clv,
+                                      const double * right_clv,
+                                      const double * left_matrix,
+                                      const double * right_matrix,
+                                      const unsigned int * left_scaler,
+                                      const unsigned int * right_scaler,
+                                      unsigned int attrib)
+{
+  pll_core_update_partial_ii_4x4_sse(sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_clv,
+                                     right_clv,
+                                     left_matrix,
+                                     right_matrix,
+                                     left_scaler,
+                                     right_scaler,
+                                     attrib);
+}
+
+static double root_loglikelihood_4x4_sse(unsigned int states,
+                                         unsigned int sites,
+                                         unsigned int rate_cats,
+                                         const double * clv,
+                                         const unsigned int * scaler,
+                                         double * const * frequencies,
+                                         const double * rate_weights,
+                                         const unsigned int * pattern_weights,
+                                         const double * invar_proportion,
+                                         const int * invar_indices,
+                                         const unsigned int * freqs_indices,
+                                         double * persite_lnl,
+                                         unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_4x4_sse(sites,
+                                             rate_cats,
+                                             clv,
+                                             scaler,
+                                             frequencies,
+                                             rate_weights,
+                                             pattern_weights,
+                                             invar_proportion,
+                                             invar_indices,
+                                             freqs_indices,
+                                             persite_lnl);
+}
+
+static double root_loglikelihood_sse(unsigned int states,
+                                     unsigned int sites,
+                                     unsigned int rate_cats,
+                                     const double * clv,
+                                     const unsigned int * scaler,
+                                     double * const * frequencies,
+                                     const double * rate_weights,
+                                     const unsigned int * pattern_weights,
+                                     const double * invar_proportion,
+                                     const int * invar_indices,
+                                     const unsigned int * freqs_indices,
+                                     double * persite_lnl,
+                                     unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_sse(states,
+                                         sites,
+                                         rate_cats,
+                                         clv,
+                                         scaler,
+                                         frequencies,
+                                         rate_weights,
+                                         pattern_weights,
+                                         invar_proportion,
+                                         invar_indices,
+                                         freqs_indices,
+                                         persite_lnl);
+}
+
+static double edge_loglikelihood_ti_4x4_sse(unsigned int states,
+                                            unsigned int sites,
+                                            unsigned int rate_cats,
+                                            const double * parent_clv,
+                                            const unsigned int * parent_scaler,
+                                            const unsigned char * tipchars,
+                                            const pll_state_t * tipmap,
+                                            unsigned int tipmap_size,
+                                            const double * pmatrix,
+                                            double * const * frequencies,
+                                            const double * rate_weights,
+                                            const unsigned int * pattern_weights,
+                                            const double * invar_proportion,
+                                            const int * invar_indices,
+                                            const unsigned int * freqs_indices,
+                                            double * persite_lnl,
+                                            unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_4x4_sse(sites,
+                                                rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                tipchars,
+                                                pmatrix,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                attrib);
+}
+
+static double edge_loglikelihood_ti_sse(unsigned int states,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        const double * parent_clv,
+                                        const unsigned int * parent_scaler,
+                                        const unsigned char * tipchars,
+                                        const pll_state_t * tipmap,
+                                        unsigned int tipmap_size,
+                                        const double * pmatrix,
+                                        double * const * frequencies,
+                                        const double * rate_weights,
+                                        const unsigned int * pattern_weights,
+                                        const double * invar_proportion,
+                                        const int * invar_indices,
+                                        const unsigned int * freqs_indices,
+                                        double * persite_lnl,
+                                        unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_sse(states,
+                                            sites,
+                                            rate_cats,
+                                            parent_clv,
+                                            parent_scaler,
+                                            tipchars,
+                                            tipmap,
+                                            pmatrix,
+                                            frequencies,
+                                            rate_weights,
+                                            pattern_weights,
+                                            invar_proportion,
+                                            invar_indices,
+                                            freqs_indices,
+                                            persite_lnl,
+                                            attrib);
+}
+
+static double edge_loglikelihood_ii_4x4_sse(unsigned int states,
+                                            unsigned int sites,
+                                            unsigned int rate_cats,
+                                            const double * parent_clv,
+                                            const unsigned int * parent_scaler,
+                                            const double * child_clv,
+                                            const unsigned int * child_scaler,
+                                            const double * pmatrix,
+                                            double * const * frequencies,
+                                            const double * rate_weights,
+                                            const unsigned int * pattern_weights,
+                                            const double * invar_proportion,
+                                            const int * invar_indices,
+                                            const unsigned int * freqs_indices,
+                                            double * persite_lnl,
+                                            unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ii_4x4_sse(sites,
+                                                rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                child_clv,
+                                                child_scaler,
+                                                pmatrix,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                attrib);
+}
+
+static int update_sumtable_ti_sse(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  const double * parent_clv,
+                                  const unsigned char * left_tipchars,
+                                  const unsigned int * parent_scaler,
+                                  double * const * eigenvecs,
+                                  double * const * inv_eigenvecs,
+                                  double * const * freqs,
+                                  const pll_state_t * tipmap,
+                                  unsigned int tipmap_size,
+                                  double * sumtable,
+                                  unsigned int attrib)
+{
+  return pll_core_update_sumtable_ti_sse(states,
+                                         sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         left_tipchars,
+                                         parent_scaler,
+                                         eigenvecs,
+                                         inv_eigenvecs,
+                                         freqs,
+                                         tipmap,
+                                         sumtable,
+                                         attrib);
+}
+
+static int update_pmatrix_4x4_sse(double ** pmatrix,
+                                  unsigned int states,
+                                  unsigned int rate_cats,
+                                  const double * rates,
+                                  const double * branch_lengths,
+                                  const unsigned int * matrix_indices,
+                                  const unsigned int * params_indices,
+                                  const double * prop_invar,
+                                  double * const * eigenvals,
+                                  double * const * eigenvecs,
+                                  double * const * inv_eigenvecs,
+                                  unsigned int count,
+                                  unsigned int attrib)
+{
+  return pll_core_update_pmatrix_4x4_sse(pmatrix,
+                                         rate_cats,
+                                         rates,
+                                         branch_lengths,
+                                         matrix_indices,
+                                         params_indices,
+                                         prop_invar,
+                                         eigenvals,
+                                         eigenvecs,
+                                         inv_eigenvecs,
+                                         count);
+}
+
+static int update_pmatrix_20x20_sse(double ** pmatrix,
+                                    unsigned int states,
+                                    unsigned int rate_cats,
+                                    const double * rates,
+                                    const double * branch_lengths,
+                                    const unsigned int * matrix_indices,
+                                    const unsigned int * params_indices,
+                                    const double * prop_invar,
+                                    double * const * eigenvals,
+                                    double * const * eigenvecs,
+                                    double * const * inv_eigenvecs,
+                                    unsigned int count,
+                                    unsigned int attrib)
+{
+  return pll_core_update_pmatrix_20x20_sse(pmatrix,
+                                           rate_cats,
+                                           rates,
+                                           branch_lengths,
+                                           matrix_indices,
+                                           params_indices,
+                                           prop_invar,
+                                           eigenvals,
+                                           eigenvecs,
+                                           inv_eigenvecs,
+                                           count);
+}
+#endif
+
+#ifdef HAVE_AVX
+static void create_lookup_4x4_avx(unsigned int states,
+                                  unsigned int rate_cats,
+                                  double * lookup,
+                                  const double * left_matrix,
+                                  const double * right_matrix,
+                                  const pll_state_t * tipmap,
+                                  unsigned int tipmap_size,
+                                  unsigned int attrib)
+{
+  pll_core_create_lookup_4x4_avx(rate_cats,
+                                 lookup,
+                                 left_matrix,
+                                 right_matrix);
+}
+
+static void create_lookup_avx(unsigned int states,
+                              unsigned int rate_cats,
+                              double * lookup,
+                              const double * left_matrix,
+                              const double * right_matrix,
+                              const pll_state_t * tipmap,
+                              unsigned int tipmap_size,
+                              unsigned int attrib)
+{
+  pll_core_create_lookup_avx(states,
+                             rate_cats,
+                             lookup,
+                             left_matrix,
+                             right_matrix,
+                             tipmap,
+                             tipmap_size);
+}
+
+static void update_partial_tt_4x4_avx(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      double * parent_clv,
+                                      unsigned int * parent_scaler,
+                                      const unsigned char * left_tipchars,
+                                      const unsigned char * right_tipchars,
+                                      const pll_state_t * tipmap,
+                                      unsigned int tipmap_size,
+                                      const double * lookup,
+                                      unsigned int attrib)
+{
+  pll_core_update_partial_tt_4x4_avx(sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_tipchars,
+                                     right_tipchars,
+                                     lookup,
+                                     attrib);
+}
+
+static void update_partial_tt_avx(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  double * parent_clv,
+                                  unsigned int * parent_scaler,
+                                  const unsigned char * left_tipchars,
+                                  const unsigned char * right_tipchars,
+                                  const pll_state_t * tipmap,
+                                  unsigned int tipmap_size,
+                                  const double * lookup,
+                                  unsigned int attrib)
+{
+  pll_core_update_partial_tt_avx(states,
+                                 sites,
+                                 rate_cats,
+                                 parent_clv,
+                                 parent_scaler,
+                                 left_tipchars,
+                                 right_tipchars,
+                                 lookup,
+                                 tipmap_size,
+                                 attrib);
+}
+
+static void update_partial_ti_4x4_avx(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      double * parent_clv,
+                                      unsigned int * parent_scaler,
+                                      const unsigned char * left_tipchars,
+                                      const double * right_clv,
+                                      const double * left_matrix,
+                                      const double * right_matrix,
+                                      const unsigned int * right_scaler,
+                                      const pll_state_t * tipmap,
+                                      unsigned int tipmap_size,
+                                      unsigned int attrib)
+{
+  pll_core_update_partial_ti_4x4_avx(sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_tipchars,
+                                     right_clv,
+                                     left_matrix,
+                                     right_matrix,
+                                     right_scaler,
+                                     attrib);
+}
+
+static void update_partial_ti_20x20_avx(unsigned int states,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        double * parent_clv,
+                                        unsigned int * parent_scaler,
+                                        const unsigned char * left_tipchars,
+                                        const double * right_clv,
+                                        const double * left_matrix,
+                                        const double * right_matrix,
+                                        const unsigned int * right_scaler,
+                                        const pll_state_t * tipmap,
+                                        unsigned int tipmap_size,
+                                        unsigned int attrib)
+{
+  pll_core_update_partial_ti_20x20_avx(sites,
+                                       rate_cats,
+                                       parent_clv,
+                                       parent_scaler,
+                                       left_tipchars,
+                                       right_clv,
+                                       left_matrix,
+                                       right_matrix,
+                                       right_scaler,
+                                       tipmap,
+                                       tipmap_size,
+                                       attrib);
+}
+
+static void update_partial_ii_4x4_avx(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      double * parent_clv,
+                                      unsigned int * parent_scaler,
+                                      const double * left_clv,
+                                      const double * right_clv,
+                                      const double * left_matrix,
+                                      const double * right_matrix,
+                                      const unsigned int * left_scaler,
+                                      const unsigned int * right_scaler,
+                                      unsigned int attrib)
+{
+  pll_core_update_partial_ii_4x4_avx(sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_clv,
+                                     right_clv,
+                                     left_matrix,
+                                     right_matrix,
+                                     left_scaler,
+                                     right_scaler,
+                                     attrib);
+}
+
+static double root_loglikelihood_4x4_avx(unsigned int states,
+                                         unsigned int sites,
+                                         unsigned int rate_cats,
+                                         const double * clv,
+                                         const unsigned int * scaler,
+                                         double * const * frequencies,
+                                         const double * rate_weights,
+                                         const unsigned int * pattern_weights,
+                                         const double * invar_proportion,
+                                         const int * invar_indices,
+                                         const unsigned int * freqs_indices,
+                                         double * persite_lnl,
+                                         unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_4x4_avx(sites,
+                                             rate_cats,
+                                             clv,
+                                             scaler,
+                                             frequencies,
+                                             rate_weights,
+                                             pattern_weights,
+                                             invar_proportion,
+                                             invar_indices,
+                                             freqs_indices,
+                                             persite_lnl);
+}
+
+static double root_loglikelihood_avx(unsigned int states,
+                                     unsigned int sites,
+                                     unsigned int rate_cats,
+                                     const double * clv,
+                                     const unsigned int * scaler,
+                                     double * const * frequencies,
+                                     const double * rate_weights,
+                                     const unsigned int * pattern_weights,
+                                     const double * invar_proportion,
+                                     const int * invar_indices,
+                                     const unsigned int * freqs_indices,
+                                     double * persite_lnl,
+                                     unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_avx(states,
+                                         sites,
+                                         rate_cats,
+                                         clv,
+                                         scaler,
+                                         frequencies,
+                                         rate_weights,
+                                         pattern_weights,
+                                         invar_proportion,
+                                         invar_indices,
+                                         freqs_indices,
+                                         persite_lnl);
+}
+
+static double edge_loglikelihood_ti_4x4_avx(unsigned int states,
+                                            unsigned int sites,
+                                            unsigned int rate_cats,
+                                            const double * parent_clv,
+                                            const unsigned int * parent_scaler,
+                                            const unsigned char * tipchars,
+                                            const pll_state_t * tipmap,
+                                            unsigned int tipmap_size,
+                                            const double * pmatrix,
+                                            double * const * frequencies,
+                                            const double * rate_weights,
+                                            const unsigned int * pattern_weights,
+                                            const double * invar_proportion,
+                                            const int * invar_indices,
+                                            const unsigned int * freqs_indices,
+                                            double * persite_lnl,
+                                            unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_4x4_avx(sites,
+                                                rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                tipchars,
+                                                pmatrix,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                attrib);
+}
+
+static double edge_loglikelihood_ti_20x20_avx(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              const double * parent_clv,
+                                              const unsigned int * parent_scaler,
+                                              const unsigned char * tipchars,
+                                              const pll_state_t * tipmap,
+                                              unsigned int tipmap_size,
+                                              const double * pmatrix,
+                                              double * const * frequencies,
+                                              const double * rate_weights,
+                                              const unsigned int * pattern_weights,
+                                              const double * invar_proportion,
+                                              const int * invar_indices,
+                                              const unsigned int * freqs_indices,
+                                              double * persite_lnl,
+                                              unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_20x20_avx(sites,
+                                                  rate_cats,
+                                                  parent_clv,
+                                                  parent_scaler,
+                                                  tipchars,
+                                                  tipmap,
+                                                  tipmap_size,
+                                                  pmatrix,
+                                                  frequencies,
+                                                  rate_weights,
+                                                  pattern_weights,
+                                                  invar_proportion,
+                                                  invar_indices,
+                                                  freqs_indices,
+                                                  persite_lnl,
+                                                  attrib);
+}
+
+static double edge_loglikelihood_ti_avx(unsigned int states,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        const double * parent_clv,
+                                        const unsigned int * parent_scaler,
+                                        const unsigned char * tipchars,
+                                        const pll_state_t * tipmap,
+                                        unsigned int tipmap_size,
+                                        const double * pmatrix,
+                                        double * const * frequencies,
+                                        const double * rate_weights,
+                                        const unsigned int * pattern_weights,
+                                        const double * invar_proportion,
+                                        const int * invar_indices,
+                                        const unsigned int * freqs_indices,
+                                        double * persite_lnl,
+                                        unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_avx(states,
+                                            sites,
+                                            rate_cats,
+                                            parent_clv,
+                                            parent_scaler,
+                                            tipchars,
+                                            tipmap,
+                                            pmatrix,
+                                            frequencies,
+                                            rate_weights,
+                                            pattern_weights,
+                                            invar_proportion,
+                                            invar_indices,
+                                            freqs_indices,
+                                            persite_lnl,
+                                            attrib);
+}
+
+static double edge_loglikelihood_ii_4x4_avx(unsigned int states,
+                                            unsigned int sites,
+                                            unsigned int rate_cats,
+                                            const double * parent_clv,
+                                            const unsigned int * parent_scaler,
+                                            const double * child_clv,
+                                            const unsigned int * child_scaler,
+                                            const double * pmatrix,
+                                            double * const * frequencies,
+                                            const double * rate_weights,
+                                            const unsigned int * pattern_weights,
+                                            const double * invar_proportion,
+                                            const int * invar_indices,
+                                            const unsigned int * freqs_indices,
+                                            double * persite_lnl,
+                                            unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ii_4x4_avx(sites,
+                                                rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                child_clv,
+                                                child_scaler,
+                                                pmatrix,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                attrib);
+}
+
+static int update_pmatrix_4x4_avx(double ** pmatrix,
+                                  unsigned int states,
+                                  unsigned int rate_cats,
+                                  const double * rates,
+                                  const double * branch_lengths,
+                                  const unsigned int * matrix_indices,
+                                  const unsigned int * params_indices,
+                                  const double * prop_invar,
+                                  double * const * eigenvals,
+                                  double * const * eigenvecs,
+                                  double * const * inv_eigenvecs,
+                                  unsigned int count,
+                                  unsigned int attrib)
+{
+  return pll_core_update_pmatrix_4x4_avx(pmatrix,
+                                         rate_cats,
+                                         rates,
+                                         branch_lengths,
+                                         matrix_indices,
+                                         params_indices,
+                                         prop_invar,
+                                         eigenvals,
+                                         eigenvecs,
+                                         inv_eigenvecs,
+                                         count);
+}
+
+static int update_pmatrix_20x20_avx(double ** pmatrix,
+                                    unsigned int states,
+                                    unsigned int rate_cats,
+                                    const double * rates,
+                                    const double * branch_lengths,
+                                    const unsigned int * matrix_indices,
+                                    const unsigned int * params_indices,
+                                    const double * prop_invar,
+                                    double * const * eigenvals,
+                                    double * const * eigenvecs,
+                                    double * const * inv_eigenvecs,
+                                    unsigned int count,
+                                    unsigned int attrib)
+{
+  return pll_core_update_pmatrix_20x20_avx(pmatrix,
+                                           rate_cats,
+                                           rates,
+                                           branch_lengths,
+                                           matrix_indices,
+                                           params_indices,
+                                           prop_invar,
+                                           eigenvals,
+                                           eigenvecs,
+                                           inv_eigenvecs,
+                                           count);
+}
+#endif
+
+#ifdef HAVE_AVX2
+static void update_partial_ti_20x20_avx2(unsigned int states,
+                                         unsigned int sites,
+                                         unsigned int rate_cats,
+                                         double * parent_clv,
+                                         unsigned int * parent_scaler,
+                                         const unsigned char * left_tipchars,
+                                         const double * right_clv,
+                                         const double * left_matrix,
+                                         const double * right_matrix,
+                                         const unsigned int * right_scaler,
+                                         const pll_state_t * tipmap,
+                                         unsigned int tipmap_size,
+                                         unsigned int attrib)
+{
+  pll_core_update_partial_ti_20x20_avx2(sites,
+                                        rate_cats,
+                                        parent_clv,
+                                        parent_scaler,
+                                        left_tipchars,
+                                        right_clv,
+                                        left_matrix,
+                                        right_matrix,
+                                        right_scaler,
+                                        tipmap,
+                                        tipmap_size,
+                                        attrib);
+}
+
+static double root_loglikelihood_avx2(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      const double * clv,
+                                      const unsigned int * scaler,
+                                      double * const * frequencies,
+                                      const double * rate_weights,
+                                      const unsigned int * pattern_weights,
+                                      const double * invar_proportion,
+                                      const int * invar_indices,
+                                      const unsigned int * freqs_indices,
+                                      double * persite_lnl,
+                                      unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_avx2(states,
+                                          sites,
+                                          rate_cats,
+                                          clv,
+                                          scaler,
+                                          frequencies,
+                                          rate_weights,
+                                          pattern_weights,
+                                          invar_proportion,
+                                          invar_indices,
+                                          freqs_indices,
+                                          persite_lnl);
+}
+
+static double edge_loglikelihood_ti_20x20_avx2(unsigned int states,
+                                               unsigned int sites,
+                                               unsigned int rate_cats,
+                                               const double * parent_clv,
+                                               const unsigned int * parent_scaler,
+                                               const unsigned char * tipchars,
+                                               const pll_state_t * tipmap,
+                                               unsigned int tipmap_size,
+                                               const double * pmatrix,
+                                               double * const * frequencies,
+                                               const double * rate_weights,
+                                               const unsigned int * pattern_weights,
+                                               const double * invar_proportion,
+                                               const int * invar_indices,
+                                               const unsigned int * freqs_indices,
+                                               double * persite_lnl,
+                                               unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_20x20_avx2(sites,
+                                                   rate_cats,
+                                                   parent_clv,
+                                                   parent_scaler,
+                                                   tipchars,
+                                                   tipmap,
+                                                   tipmap_size,
+                                                   pmatrix,
+                                                   frequencies,
+                                                   rate_weights,
+                                                   pattern_weights,
+                                                   invar_proportion,
+                                                   invar_indices,
+                                                   freqs_indices,
+                                                   persite_lnl,
+                                                   attrib);
+}
+
+static int update_pmatrix_avx2(double ** pmatrix,
+                               unsigned int states,
+                               unsigned int rate_cats,
+                               const double * rates,
+                               const double * branch_lengths,
+                               const unsigned int * matrix_indices,
+                               const unsigned int * params_indices,
+                               const double * prop_invar,
+                               double * const * eigenvals,
+                               double * const * eigenvecs,
+                               double * const * inv_eigenvecs,
+                               unsigned int count,
+                               unsigned int attrib)
+{
+  /* the hand-tuned 4x4 and 20x20 kernels are faster than the batched one */
+  if (count >= PMATRIX_BATCH_MIN && states != 4 && states != 20)
+    return pll_core_update_pmatrix_batch_avx2(pmatrix,
+                                              states,
+                                              rate_cats,
+                                              rates,
+                                              branch_lengths,
+                                              matrix_indices,
+                                              params_indices,
+                                              prop_invar,
+                                              eigenvals,
+                                              eigenvecs,
+                                              inv_eigenvecs,
+                                              count);
+
+  if (states == 4)
+    return pll_core_update_pmatrix_4x4_avx(pmatrix,
+                                           rate_cats,
+                                           rates,
+                                           branch_lengths,
+                                           matrix_indices,
+                                           params_indices,
+                                           prop_invar,
+                                           eigenvals,
+                                           eigenvecs,
+                                           inv_eigenvecs,
+                                           count);
+
+  if (states == 20)
+    return pll_core_update_pmatrix_20x20_avx2(pmatrix,
+                                              rate_cats,
+                                              rates,
+                                              branch_lengths,
+                                              matrix_indices,
+                                              params_indices,
+                                              prop_invar,
+                                              eigenvals,
+                                              eigenvecs,
+                                              inv_eigenvecs,
+                                              count);
+
+  return pll_core_update_pmatrix(pmatrix,
+                                 states,
+                                 rate_cats,
+                                 rates,
+                                 branch_lengths,
+                                 matrix_indices,
+                                 params_indices,
+                                 prop_invar,
+                                 eigenvals,
+                                 eigenvecs,
+                                 inv_eigenvecs,
+                                 count,
+                                 attrib);
+}
+#endif
+
+#ifdef HAVE_AVX512
+static void update_partial_ti_4x4_avx512(unsigned int states,
+                                         unsigned int sites,
+                                         unsigned int rate_cats,
+                                         double * parent_clv,
+                                         unsigned int * parent_scaler,
+                                         const unsigned char * left_tipchars,
+                                         const double * right_clv,
+                                         const double * left_matrix,
+                                         const double * right_matrix,
+                                         const unsigned int * right_scaler,
+                                         const pll_state_t * tipmap,
+                                         unsigned int tipmap_size,
+                                         unsigned int attrib)
+{
+  pll_core_update_partial_ti_4x4_avx512(sites,
+                                        rate_cats,
+                                        parent_clv,
+                                        parent_scaler,
+                                        left_tipchars,
+                                        right_clv,
+                                        left_matrix,
+                                        right_matrix,
+                                        right_scaler,
+                                        attrib);
+}
+
+static void update_partial_ii_4x4_avx512(unsigned int states,
+                                         unsigned int sites,
+                                         unsigned int rate_cats,
+                                         double * parent_clv,
+                                         unsigned int * parent_scaler,
+                                         const double * left_clv,
+                                         const double * right_clv,
+                                         const double * left_matrix,
+                                         const double * right_matrix,
+                                         const unsigned int * left_scaler,
+                                         const unsigned int * right_scaler,
+                                         unsigned int attrib)
+{
+  pll_core_update_partial_ii_4x4_avx512(sites,
+                                        rate_cats,
+                                        parent_clv,
+                                        parent_scaler,
+                                        left_clv,
+                                        right_clv,
+                                        left_matrix,
+                                        right_matrix,
+                                        left_scaler,
+                                        right_scaler,
+                                        attrib);
+}
+
+static double root_loglikelihood_avx512(unsigned int states,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        const double * clv,
+                                        const unsigned int * scaler,
+                                        double * const * frequencies,
+                                        const double * rate_weights,
+                                        const unsigned int * pattern_weights,
+                                        const double * invar_proportion,
+                                        const int * invar_indices,
+                                        const unsigned int * freqs_indices,
+                                        double * persite_lnl,
+                                        unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_avx512(states,
+                                            sites,
+                                            rate_cats,
+                                            clv,
+                                            scaler,
+                                            frequencies,
+                                            rate_weights,
+                                            pattern_weights,
+                                            invar_proportion,
+                                            invar_indices,
+                                            freqs_indices,
+                                            persite_lnl);
+}
+
+static double edge_loglikelihood_ti_4x4_avx512(unsigned int states,
+                                               unsigned int sites,
+                                               unsigned int rate_cats,
+                                               const double * parent_clv,
+                                               const unsigned int * parent_scaler,
+                                               const unsigned char * tipchars,
+                                               const pll_state_t * tipmap,
+                                               unsigned int tipmap_size,
+                                               const double * pmatrix,
+                                               double * const * frequencies,
+                                               const double * rate_weights,
+                                               const unsigned int * pattern_weights,
+                                               const double * invar_proportion,
+                                               const int * invar_indices,
+                                               const unsigned int * freqs_indices,
+                                               double * persite_lnl,
+                                               unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_4x4_avx512(sites,
+                                                   rate_cats,
+                                                   parent_clv,
+                                                   parent_scaler,
+                                                   tipchars,
+                                                   pmatrix,
+                                                   frequencies,
+                                                   rate_weights,
+                                                   pattern_weights,
+                                                   invar_proportion,
+                                                   invar_indices,
+                                                   freqs_indices,
+                                                   persite_lnl,
+                                                   attrib);
+}
+
+static int update_pmatrix_avx512(double ** pmatrix,
+                                 unsigned int states,
+                                 unsigned int rate_cats,
+                                 const double * rates,
+                                 const double * branch_lengths,
+                                 const unsigned int * matrix_indices,
+                                 const unsigned int * params_indices,
+                                 const double * prop_invar,
+                                 double * const * eigenvals,
+                                 double * const * eigenvecs,
+                                 double * const * inv_eigenvecs,
+                                 unsigned int count,
+                                 unsigned int attrib)
+{
+  (void)attrib;
+
+#ifdef HAVE_AVX2
+  /* the hand-tuned 20x20 kernel beats both AVX-512 kernels */
+  if (states == 20 && PLL_STAT(avx2_present))
+    return pll_core_update_pmatrix_20x20_avx2(pmatrix,
+                                              rate_cats,
+                                              rates,
+                                              branch_lengths,
+                                              matrix_indices,
+                                              params_indices,
+                                              prop_invar,
+                                              eigenvals,
+                                              eigenvecs,
+                                              inv_eigenvecs,
+                                              count);
+#endif
+
+  if (count >= PMATRIX_BATCH_MIN && states != 4)
+    return pll_core_update_pmatrix_batch_avx512(pmatrix,
+                                                states,
+                                                rate_cats,
+                                                rates,
+                                                branch_lengths,
+                                                matrix_indices,
+                                                params_indices,
+                                                prop_invar,
+                                                eigenvals,
+                                                eigenvecs,
+                                                inv_eigenvecs,
+                                                count);
+
+  /* a 4x4 row fits in a single ymm register */
+  if (states == 4)
+    return pll_core_update_pmatrix_4x4_avx(pmatrix,
+                                           rate_cats,
+                                           rates,
+                                           branch_lengths,
+                                           matrix_indices,
+                                           params_indices,
+                                           prop_invar,
+                                           eigenvals,
+                                           eigenvecs,
+                                           inv_eigenvecs,
+                                           count);
+
+  return pll_core_update_pmatrix_avx512(pmatrix,
+                                        states,
+                                        rate_cats,
+                                        rates,
+                                        branch_lengths,
+                                        matrix_indices,
+                                        params_indices,
+                                        prop_invar,
+                                        eigenvals,
+                                        eigenvecs,
+                                        inv_eigenvecs,
+                                        count);
+}
+#endif
+
+/* single-precision kernels read and write float CLVs */
+
+static void update_partial_ii_sp(unsigned int states,
+                                 unsigned int sites,
+                                 unsigned int rate_cats,
+                                 double * parent_clv,
+                                 unsigned int * parent_scaler,
+                                 const double * left_clv,
+                                 const double * right_clv,
+                                 const double * left_matrix,
+                                 const double * right_matrix,
+                                 const unsigned int * left_scaler,
+                                 const unsigned int * right_scaler,
+                                 unsigned int attrib)
+{
+  pll_core_update_partial_ii_sp(states,
+                                sites,
+                                rate_cats,
+                                (float *)parent_clv,
+                                parent_scaler,
+                                (const float *)left_clv,
+                                (const float *)right_clv,
+                                left_matrix,
+                                right_matrix,
+                                left_scaler,
+                                right_scaler,
+                                attrib);
+}
+
+static double root_loglikelihood_sp(unsigned int states,
+                                    unsigned int sites,
+                                    unsigned int rate_cats,
+                                    const double * clv,
+                                    const unsigned int * scaler,
+                                    double * const * frequencies,
+                                    const double * rate_weights,
+                                    const unsigned int * pattern_weights,
+                                    const double * invar_proportion,
+                                    const int * invar_indices,
+                                    const unsigned int * freqs_indices,
+                                    double * persite_lnl,
+                                    unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_sp(states,
+                                        sites,
+                                        rate_cats,
+                                        (const float *)clv,
+                                        scaler,
+                                        frequencies,
+                                        rate_weights,
+                                        pattern_weights,
+                                        invar_proportion,
+                                        invar_indices,
+                                        freqs_indices,
+                                        persite_lnl,
+                                        attrib);
+}
+
+static double edge_loglikelihood_ii_sp(unsigned int states,
+                                       unsigned int sites,
+                                       unsigned int rate_cats,
+                                       const double * parent_clv,
+                                       const unsigned int * parent_scaler,
+                                       const double * child_clv,
+                                       const unsigned int * child_scaler,
+                                       const double * pmatrix,
+                                       double * const * frequencies,
+                                       const double * rate_weights,
+                                       const unsigned int * pattern_weights,
+                                       const double * invar_proportion,
+                                       const int * invar_indices,
+                                       const unsigned int * freqs_indices,
+                                       double * persite_lnl,
+                                       unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ii_sp(states,
+                                           sites,
+                                           rate_cats,
+                                           (const float *)parent_clv,
+                                           parent_scaler,
+                                           (const float *)child_clv,
+                                           child_scaler,
+                                           pmatrix,
+                                           frequencies,
+                                           rate_weights,
+                                           pattern_weights,
+                                           invar_proportion,
+                                           invar_indices,
+                                           freqs_indices,
+                                           persite_lnl,
+                                           attrib);
+}
+
+static int update_sumtable_ii_sp(unsigned int states,
+                                 unsigned int sites,
+                                 unsigned int rate_cats,
+                                 const double * parent_clv,
+                                 const double * child_clv,
+                                 const unsigned int * parent_scaler,
+                                 const unsigned int * child_scaler,
+                                 double * const * eigenvecs,
+                                 double * const * inv_eigenvecs,
+                                 double * const * freqs,
+                                 double * sumtable,
+                                 unsigned int attrib)
+{
+  return pll_core_update_sumtable_ii_sp(states,
+                                        sites,
+                                        rate_cats,
+                                        (const float *)parent_clv,
+                                        (const float *)child_clv,
+                                        parent_scaler,
+                                        child_scaler,
+                                        eigenvecs,
+                                        inv_eigenvecs,
+                                        freqs,
+                                        sumtable,
+                                        attrib);
+}
+
+#ifdef HAVE_AVX512
+static void update_partial_ii_sp_avx512(unsigned int states,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        double * parent_clv,
+                                        unsigned int * parent_scaler,
+                                        const double * left_clv,
+                                        const double * right_clv,
+                                        const double * left_matrix,
+                                        const double * right_matrix,
+                                        const unsigned int * left_scaler,
+                                        const unsigned int * right_scaler,
+                                        unsigned int attrib)
+{
+  pll_core_update_partial_ii_sp_avx512(states,
+                                       sites,
+                                       rate_cats,
+                                       (float *)parent_clv,
+                                       parent_scaler,
+                                       (const float *)left_clv,
+                                       (const float *)right_clv,
+                                       left_matrix,
+                                       right_matrix,
+                                       left_scaler,
+                                       right_scaler,
+                                       attrib);
+}
+
+static double root_loglikelihood_sp_avx512(unsigned int states,
+                                           unsigned int sites,
+                                           unsigned int rate_cats,
+                                           const double * clv,
+                                           const unsigned int * scaler,
+                                           double * const * frequencies,
+                                           const double * rate_weights,
+                                           const unsigned int * pattern_weights,
+                                           const double * invar_proportion,
+                                           const int * invar_indices,
+                                           const unsigned int * freqs_indices,
+                                           double * persite_lnl,
+                                           unsigned int attrib)
+{
+  return pll_core_root_loglikelihood_sp_avx512(states,
+                                               sites,
+                                               rate_cats,
+                                               (const float *)clv,
+                                               scaler,
+                                               frequencies,
+                                               rate_weights,
+                                               pattern_weights,
+                                               invar_proportion,
+                                               invar_indices,
+                                               freqs_indices,
+                                               persite_lnl,
+                                               attrib);
+}
+
+static double edge_loglikelihood_ii_sp_avx512(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              const double * parent_clv,
+                                              const unsigned int * parent_scaler,
+                                              const double * child_clv,
+                                              const unsigned int * child_scaler,
+                                              const double * pmatrix,
+                                              double * const * frequencies,
+                                              const double * rate_weights,
+                                              const unsigned int * pattern_weights,
+                                              const double * invar_proportion,
+                                              const int * invar_indices,
+                                              const unsigned int * freqs_indices,
+                                              double * persite_lnl,
+                                              unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ii_sp_avx512(states,
+                                                  sites,
+                                                  rate_cats,
+                                                  (const float *)parent_clv,
+                                                  parent_scaler,
+                                                  (const float *)child_clv,
+                                                  child_scaler,
+                                                  pmatrix,
+                                                  frequencies,
+                                                  rate_weights,
+                                                  pattern_weights,
+                                                  invar_proportion,
+                                                  invar_indices,
+                                                  freqs_indices,
+                                                  persite_lnl,
+                                                  attrib);
+}
+#endif
+
+PLL_EXPORT void pll_core_select_kernels(pll_kernels_t * kernels,
+                                        unsigned int states,
+                                        unsigned int attrib)
+{
+  /* non-vectorized kernels; the pll_core_* functions fall through to their
+     generic code when no usable architecture flag is set */
+  kernels->create_lookup = pll_core_create_lookup;
+  kernels->update_partial_tt = pll_core_update_partial_tt;
+  kernels->update_partial_ti = pll_core_update_partial_ti;
+  kernels->update_partial_ii = pll_core_update_partial_ii;
+  kernels->update_partial_single = pll_core_update_partial_single;
+  kernels->update_partial_repeats = pll_core_update_partial_repeats;
+  kernels->root_loglikelihood = pll_core_root_loglikelihood;
+  kernels->root_loglikelihood_repeats = pll_core_root_loglikelihood_repeats;
+  kernels->edge_loglikelihood_ti = (states == 4) ?
+                                     edge_loglikelihood_ti_4x4 :
+                                     pll_core_edge_loglikelihood_ti;
+  kernels->edge_loglikelihood_ii = pll_core_edge_loglikelihood_ii;
+  kernels->edge_loglikelihood_repeats = pll_core_edge_loglikelihood_repeats;
+  kernels->update_sumtable_ti = pll_core_update_sumtable_ti;
+  kernels->update_sumtable_ii = pll_core_update_sumtable_ii;
+  kernels->update_sumtable_repeats = pll_core_update_sumtable_repeats;
+  kernels->likelihood_derivatives = pll_core_likelihood_derivatives;
+  kernels->update_pmatrix = pll_core_update_pmatrix;
+
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+  {
+    if (states == 4)
+    {
+      kernels->create_lookup = create_lookup_4x4_sse;
+      kernels->update_partial_tt = update_partial_tt_4x4_sse;
+      kernels->update_partial_ti = update_partial_ti_4x4_sse;
+      kernels->update_partial_ii = update_partial_ii_4x4_sse;
+      kernels->root_loglikelihood = root_loglikelihood_4x4_sse;
+      kernels->edge_loglikelihood_ti = edge_loglikelihood_ti_4x4_sse;
+      kernels->edge_loglikelihood_ii = edge_loglikelihood_ii_4x4_sse;
+      kernels->update_pmatrix = update_pmatrix_4x4_sse;
+    }
+    else
+    {
+      kernels->create_lookup = create_lookup_sse;
+      kernels->update_partial_tt = update_partial_tt_sse;
+      kernels->update_partial_ti = pll_core_update_partial_ti_sse;
+      kernels->update_partial_ii = pll_core_update_partial_ii_sse;
+      kernels->root_loglikelihood = root_loglikelihood_sse;
+      kernels->edge_loglikelihood_ti = edge_loglikelihood_ti_sse;
+      kernels->edge_loglikelihood_ii = pll_core_edge_loglikelihood_ii_sse;
+
+      /* other state counts use the generic code with SSE padding */
+      if (states == 20)
+        kernels->update_pmatrix = update_pmatrix_20x20_sse;
+    }
+    kernels->update_sumtable_ti = update_sumtable_ti_sse;
+    kernels->update_sumtable_ii = pll_core_update_sumtable_ii_sse;
+
+    /* the generic single-child kernel is slower than the SSE ones */
+    kernels->update_partial_single = NULL;
+  }
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    if (states == 4)
+    {
+      kernels->create_lookup = create_lookup_4x4_avx;
+      kernels->update_partial_tt = update_partial_tt_4x4_avx;
+      kernels->update_partial_ti = update_partial_ti_4x4_avx;
+      kernels->update_partial_ii = update_partial_ii_4x4_avx;
+      kernels->root_loglikelihood = root_loglikelihood_4x4_avx;
+      kernels->edge_loglikelihood_ti = edge_loglikelihood_ti_4x4_avx;
+      kernels->edge_loglikelihood_ii = edge_loglikelihood_ii_4x4_avx;
+      kernels->update_pmatrix = update_pmatrix_4x4_avx;
+    }
+    else
+    {
+      kernels->create_lookup = create_lookup_avx;
+      kernels->update_partial_tt = update_partial_tt_avx;
+      kernels->update_partial_ti = (states == 20) ?
+                                     update_partial_ti_20x20_avx :
+                                     pll_core_update_partial_ti_avx;
+      kernels->update_partial_ii = pll_core_update_partial_ii_avx;
+      kernels->root_loglikelihood = root_loglikelihood_avx;
+      kernels->edge_loglikelihood_ti = (states == 20) ?
+                                         edge_loglikelihood_ti_20x20_avx :
+                                         edge_loglikelihood_ti_avx;
+      kernels->edge_loglikelihood_ii = pll_core_edge_loglikelihood_ii_avx;
+
+      /* other state counts use the generic code with AVX padding */
+      if (states == 20)
+        kernels->update_pmatrix = update_pmatrix_20x20_avx;
+    }
+    kernels->update_sumtable_ti = pll_core_update_sumtable_ti_avx;
+    kernels->update_sumtable_ii = pll_core_update_sumtable_ii_avx;
+
+    /* the generic single-child kernel is slower than the AVX ones */
+    kernels->update_partial_single = NULL;
+  }
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    /* there are no AVX2 kernels for 4 states; the AVX ones are used */
+    if (states == 4)
+    {
+      kernels->create_lookup = create_lookup_4x4_avx;
+      kernels->update_partial_tt = update_partial_tt_4x4_avx;
+      kernels->update_partial_ti = update_partial_ti_4x4_avx;
+      kernels->update_partial_ii = update_partial_ii_4x4_avx;
+      kernels->root_loglikelihood = root_loglikelihood_4x4_avx;
+      kernels->edge_loglikelihood_ti = edge_loglikelihood_ti_4x4_avx;
+      kernels->edge_loglikelihood_ii = edge_loglikelihood_ii_4x4_avx;
+    }
+    else
+    {
+      kernels->create_lookup = create_lookup_avx;
+      kernels->update_partial_tt = update_partial_tt_avx;
+      kernels->update_partial_ti = (states == 20) ?
+                                     update_partial_ti_20x20_avx2 :
+                                     pll_core_update_partial_ti_avx2;
+      kernels->update_partial_ii = pll_core_update_partial_ii_avx2;
+      kernels->root_loglikelihood = root_loglikelihood_avx2;
+      kernels->edge_loglikelihood_ti = (states == 20) ?
+                                         edge_loglikelihood_ti_20x20_avx2 :
+                                         edge_loglikelihood_ti_avx;
+      kernels->edge_loglikelihood_ii = pll_core_edge_loglikelihood_ii_avx2;
+    }
+    kernels->update_partial_single = pll_core_update_partial_single_avx2;
+    kernels->update_pmatrix = update_pmatrix_avx2;
+    kernels->update_sumtable_ti = pll_core_update_sumtable_ti_avx2;
+    kernels->update_sumtable_ii = pll_core_update_sumtable_ii_avx2;
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    /* the AVX lookup kernels are memory bound, so we reuse them */
+    if (states == 4)
+    {
+      kernels->create_lookup = create_lookup_4x4_avx;
+      kernels->update_partial_tt = update_partial_tt_4x4_avx;
+      kernels->update_partial_ti = update_partial_ti_4x4_avx512;
+      kernels->update_partial_ii = update_partial_ii_4x4_avx512;
+      kernels->edge_loglikelihood_ti = edge_loglikelihood_ti_4x4_avx512;
+    }
+    else
+    {
+      kernels->create_lookup = create_lookup_avx;
+      kernels->update_partial_tt = update_partial_tt_avx;
+      kernels->update_partial_ti = pll_core_update_partial_ti_avx512;
+      kernels->update_partial_ii = pll_core_update_partial_ii_avx512;
+      kernels->edge_loglikelihood_ti = pll_core_edge_loglikelihood_ti_avx512;
+    }
+    kernels->update_partial_single = pll_core_update_partial_single_avx512;
+    kernels->update_pmatrix = update_pmatrix_avx512;
+    kernels->root_loglikelihood = root_loglikelihood_avx512;
+    kernels->edge_loglikelihood_ii = pll_core_edge_loglikelihood_ii_avx512;
+    kernels->update_sumtable_ti = pll_core_update_sumtable_ti_avx512;
+    kernels->update_sumtable_ii = pll_core_update_sumtable_ii_avx512;
+  }
+#endif
+
+  /* single-precision partitions only store inner-inner CLVs; tip patterns
+     and site repeats are rejected by pll_partition_create() */
+  if (attrib & PLL_ATTRIB_SINGLE_PRECISION)
+  {
+    kernels->create_lookup = NULL;
+    kernels->update_partial_tt = NULL;
+    kernels->update_partial_ti = NULL;
+    kernels->update_partial_single = NULL;
+    kernels->update_partial_repeats = NULL;
+    kernels->root_loglikelihood_repeats = NULL;
+    kernels->edge_loglikelihood_ti = NULL;
+    kernels->edge_loglikelihood_repeats = NULL;
+    kernels->update_sumtable_ti = NULL;
+    kernels->update_sumtable_repeats = NULL;
+
+    kernels->update_partial_ii = update_partial_ii_sp;
+    kernels->root_loglikelihood = root_loglikelihood_sp;
+    kernels->edge_loglikelihood_ii = edge_loglikelihood_ii_sp;
+    kernels->update_sumtable_ii = update_sumtable_ii_sp;
+
+#ifdef HAVE_AVX512
+    if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+    {
+      kernels->update_partial_ii = update_partial_ii_sp_avx512;
+      kernels->root_loglikelihood = root_loglikelihood_sp_avx512;
+      kernels->edge_loglikelihood_ii = edge_loglikelihood_ii_sp_avx512;
+    }
+#endif
+  }
+}
@@ -158,6 +158,23 @@ PLL_EXPORT double pll_core_root_loglikelihood(unsigned int states,
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_root_loglikelihood_avx512(states,
+                                              sites,
+                                              rate_cats,
+                                              clv,
+                                              scaler,
+                                              frequencies,
+                                              rate_weights,
+                                              pattern_weights,
+                                              invar_proportion,
+                                              invar_indices,
+                                              freqs_indices,
+                                              persite_lnl);
+  }
+  #endif
 
 
   /* iterate through sites */
@@ -332,6 +349,12 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats(unsigned int states,
     core_root_loglikelihood = pll_core_root_loglikelihood_repeats_avx2;
     // TODO call 4x4 avx (not avx2) functions when implemented
   }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    core_root_loglikelihood = pll_core_root_loglikelihood_repeats_avx512;
+  }
 #endif
     return core_root_loglikelihood(states,
                                   sites,
@@ -437,6 +460,25 @@ double pll_core_edge_loglikelihood_ti_4x4(unsigned int sites,
                                                   attrib);
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_edge_loglikelihood_ti_4x4_avx512(sites,
+                                                     rate_cats,
+                                                     parent_clv,
+                                                     parent_scaler,
+                                                     tipchars,
+                                                     pmatrix,
+                                                     frequencies,
+                                                     rate_weights,
+                                                     pattern_weights,
+                                                     invar_proportion,
+                                                     invar_indices,
+                                                     freqs_indices,
+                                                     persite_lnl,
+                                                     attrib);
+  }
+  #endif
 
   unsigned int site_scalings;
   unsigned int * rate_scalings = NULL;
@@ -753,6 +795,28 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_edge_loglikelihood_ti_avx512(states,
+                                                 sites,
+                                                 rate_cats,
+                                                 parent_clv,
+                                                 parent_scaler,
+                                                 tipchars,
+                                                 tipmap,
+                                                 tipmap_size,
+                                                 pmatrix,
+                                                 frequencies,
+                                                 rate_weights,
+                                                 pattern_weights,
+                                                 invar_proportion,
+                                                 invar_indices,
+                                                 freqs_indices,
+                                                 persite_lnl,
+                                                 attrib);
+  }
+  #endif
 
   unsigned int site_scalings;
   unsigned int * rate_scalings = NULL;
@@ -931,7 +995,24 @@ double pll_core_edge_loglikelihood_repeats(unsigned int states,
 #ifdef HAVE_AVX2
   if (attrib & PLL_ATTRIB_ARCH_AVX2 &&  PLL_STAT(avx2_present))
   {
-    core_edge_loglikelihood = pll_core_edge_loglikelihood_repeats_generic_avx2;
+    if (use_bclv)
+      core_edge_loglikelihood = pll_core_edge_loglikelihood_repeatsbclv_generic_avx2;
+    else
+      core_edge_loglikelihood = pll_core_edge_loglikelihood_repeats_generic_avx2;
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 &&  PLL_STAT(avx512f_present))
+  {
+    if (use_bclv && states == 4)
+    {
+      // for DNA, avx is faster than avx512
+      core_edge_loglikelihood = pll_core_edge_loglikelihood_repeatsbclv_4x4_avx;
+    }
+    else if (use_bclv)
+      core_edge_loglikelihood = pll_core_edge_loglikelihood_repeatsbclv_generic_avx512;
+    else
+      core_edge_loglikelihood = pll_core_edge_loglikelihood_repeats_generic_avx512;
   }
 #endif
   return core_edge_loglikelihood(states,
@@ -1271,6 +1352,27 @@ double pll_core_edge_loglikelihood_ii(unsigned int states,
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_edge_loglikelihood_ii_avx512(states,
+                                                 sites,
+                                                 rate_cats,
+                                                 clvp,
+                                                 parent_scaler,
+                                                 clvc,
+                                                 child_scaler,
+                                                 pmatrix,
+                                                 frequencies,
+                                                 rate_weights,
+                                                 pattern_weights,
+                                                 invar_proportion,
+                                                 invar_indices,
+                                                 freqs_indices,
+                                                 persite_lnl,
+                                                 attrib);
+  }
+  #endif
 
   unsigned int site_scalings;
   unsigned int * rate_scalings = NULL;
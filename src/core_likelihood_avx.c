@@ -22,6 +22,59 @@
 #include <limits.h>
 #include "pll.h"
 
+/* The site likelihoods are collected in blocks, whose log-likelihoods are
+   then computed with the vectorized log of core_math_avx.c */
+#define SITE_BLOCK 64
+
+typedef struct site_block_s
+{
+  unsigned int first;
+  unsigned int count;
+  double lk[SITE_BLOCK];
+  unsigned int scalings[SITE_BLOCK];
+} site_block_t;
+
+/* adds the log-likelihoods of the sites in block to logl and empties it */
+static double flush_sites(site_block_t * block,
+                          const unsigned int * pattern_weights,
+                          double * persite_lnl,
+                          double logl)
+{
+  unsigned int first = block->first;
+
+  logl = pll_core_site_loglikelihoods_avx(block->count,
+                                          block->lk,
+                                          block->scalings,
+                                          pattern_weights + first,
+                                          persite_lnl ? persite_lnl + first : NULL,
+                                          logl);
+  block->count = 0;
+
+  return logl;
+}
+
+/* appends site with likelihood site_lk to block, which must hold consecutive
+   sites, and flushes the block when it is full */
+static inline double add_site(site_block_t * block,
+                              unsigned int site,
+                              double site_lk,
+                              unsigned int site_scalings,
+                              const unsigned int * pattern_weights,
+                              double * persite_lnl,
+                              double logl)
+{
+  if (!block->count)
+    block->first = site;
+
+  block->lk[block->count] = site_lk;
+  block->scalings[block->count++] = site_scalings;
+
+  if (block->count == SITE_BLOCK)
+    logl = flush_sites(block, pattern_weights, persite_lnl, logl);
+
+  return logl;
+}
+
 PLL_EXPORT double pll_core_root_loglikelihood_avx(unsigned int states,
                                                   unsigned int sites,
                                                   unsigned int rate_cats,
@@ -37,6 +90,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx(unsigned int states,
 {
   unsigned int i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -94,19 +148,18 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[i] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -126,6 +179,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx(unsigned int states,
 {
   unsigned int i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -186,19 +240,18 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[id])
-      term += scaler[id] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[id] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -217,6 +270,7 @@ double pll_core_root_loglikelihood_4x4_avx(unsigned int sites,
 {
   unsigned int i,j;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -264,19 +318,18 @@ double pll_core_root_loglikelihood_4x4_avx(unsigned int sites,
       clv += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[i] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -300,6 +353,7 @@ double pll_core_edge_loglikelihood_ti_4x4_avx(unsigned int sites,
 {
   unsigned int n,i;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -307,7 +361,7 @@ double pll_core_edge_loglikelihood_ti_4x4_avx(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states_padded = 4;
@@ -473,22 +527,18 @@ double pll_core_edge_loglikelihood_ti_4x4_avx(unsigned int sites,
       coffset += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-
-    /* apply per-site scaler, if necessary */
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
@@ -516,6 +566,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx(unsigned int sites,
 {
   unsigned int n,i,j,m;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -523,7 +574,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states = 20;
@@ -697,20 +748,18 @@ double pll_core_edge_loglikelihood_ti_20x20_avx(unsigned int sites,
 
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
@@ -738,6 +787,7 @@ double pll_core_edge_loglikelihood_ti_avx(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -745,7 +795,7 @@ double pll_core_edge_loglikelihood_ti_avx(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   pll_state_t cstate;
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
@@ -925,20 +975,18 @@ double pll_core_edge_loglikelihood_ti_avx(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -969,13 +1017,14 @@ double pll_core_edge_loglikelihood_repeats_generic_avx(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
 
@@ -1152,20 +1201,18 @@ double pll_core_edge_loglikelihood_repeats_generic_avx(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -1192,6 +1239,7 @@ double pll_core_edge_loglikelihood_ii_avx(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -1200,7 +1248,7 @@ double pll_core_edge_loglikelihood_ii_avx(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
 
@@ -1372,20 +1420,18 @@ double pll_core_edge_loglikelihood_ii_avx(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -1412,6 +1458,7 @@ double pll_core_edge_loglikelihood_ii_4x4_avx(unsigned int sites,
 {
   unsigned int n,i;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * pmat;
@@ -1421,7 +1468,7 @@ double pll_core_edge_loglikelihood_ii_4x4_avx(unsigned int sites,
   const double * clvc = child_clv;
  
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states = 4;
   unsigned int states_padded = 4;
@@ -1558,22 +1605,18 @@ double pll_core_edge_loglikelihood_ii_4x4_avx(unsigned int sites,
       clvc += states_padded;
     }
 
-    /* compute site log-likelihood */
-    site_lk = log(terma);
-
-    /* apply per-site scaler, if necessary */
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -1606,13 +1649,14 @@ double pll_core_edge_loglikelihood_repeats_4x4_avx(unsigned int states,
 {
   unsigned int n,i;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = 4;
   unsigned int span = states * rate_cats;
@@ -1753,22 +1797,18 @@ double pll_core_edge_loglikelihood_repeats_4x4_avx(unsigned int states,
       clvc += states_padded;
     }
 
-    /* compute site log-likelihood */
-    site_lk = log(terma);
-
-    /* apply per-site scaler, if necessary */
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -1799,13 +1839,14 @@ double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx(unsigned int states,
 {
   unsigned int n,i;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = 4;
   unsigned int span = states * rate_cats;
@@ -1958,22 +1999,18 @@ double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx(unsigned int states,
       child_res += states_padded;
     }
 
-    /* compute site log-likelihood */
-    site_lk = log(terma);
-
-    /* apply per-site scaler, if necessary */
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -22,6 +22,59 @@
 #include <limits.h>
 #include "pll.h"
 
+/* The site likelihoods are collected in blocks, whose log-likelihoods are
+   then computed with the vectorized log of core_math_avx2.c */
+#define SITE_BLOCK 64
+
+typedef struct site_block_s
+{
+  unsigned int first;
+  unsigned int count;
+  double lk[SITE_BLOCK];
+  unsigned int scalings[SITE_BLOCK];
+} site_block_t;
+
+/* adds the log-likelihoods of the sites in block to logl and empties it */
+static double flush_sites(site_block_t * block,
+                          const unsigned int * pattern_weights,
+                          double * persite_lnl,
+                          double logl)
+{
+  unsigned int first = block->first;
+
+  logl = pll_core_site_loglikelihoods_avx2(block->count,
+                                           block->lk,
+                                           block->scalings,
+                                           pattern_weights + first,
+                                           persite_lnl ? persite_lnl + first : NULL,
+                                           logl);
+  block->count = 0;
+
+  return logl;
+}
+
+/* appends site with likelihood site_lk to block, which must hold consecutive
+   sites, and flushes the block when it is full */
+static inline double add_site(site_block_t * block,
+                              unsigned int site,
+                              double site_lk,
+                              unsigned int site_scalings,
+                              const unsigned int * pattern_weights,
+                              double * persite_lnl,
+                              double logl)
+{
+  if (!block->count)
+    block->first = site;
+
+  block->lk[block->count] = site_lk;
+  block->scalings[block->count++] = site_scalings;
+
+  if (block->count == SITE_BLOCK)
+    logl = flush_sites(block, pattern_weights, persite_lnl, logl);
+
+  return logl;
+}
+
 PLL_EXPORT double pll_core_root_loglikelihood_avx2(unsigned int states,
                                                    unsigned int sites,
                                                    unsigned int rate_cats,
@@ -37,6 +90,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx2(unsigned int states,
 {
   unsigned int i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -92,19 +146,18 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx2(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[i] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -124,6 +177,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx2(unsigned int states,
 {
   unsigned int i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -182,19 +236,18 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx2(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[id])
-      term += scaler[id] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[id] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -218,6 +271,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx2(unsigned int sites,
 {
   unsigned int n,i,j,m = 0;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -225,7 +279,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx2(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states = 20;
@@ -400,20 +454,18 @@ double pll_core_edge_loglikelihood_ti_20x20_avx2(unsigned int sites,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
@@ -441,6 +493,7 @@ double pll_core_edge_loglikelihood_ii_avx2(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -449,7 +502,7 @@ double pll_core_edge_loglikelihood_ii_avx2(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
 
@@ -617,20 +670,18 @@ double pll_core_edge_loglikelihood_ii_avx2(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -661,13 +712,14 @@ double pll_core_edge_loglikelihood_repeats_generic_avx2(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
   unsigned int span = states_padded * rate_cats;
@@ -840,20 +892,302 @@ double pll_core_edge_loglikelihood_repeats_generic_avx2(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
+
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
+  if (rate_scalings)
+    free(rate_scalings);
 
-    site_lk *= pattern_weights[n];
+  return logl;
+}
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
+/* product of the four p-matrix rows starting at pmat (of states_padded
+   columns each) with clv */
+static inline __m256d matrix_quad(unsigned int states_padded,
+                                  const double * pmat,
+                                  const double * clv)
+{
+  unsigned int k;
+
+  const double * row0 = pmat;
+  const double * row1 = row0 + states_padded;
+  const double * row2 = row1 + states_padded;
+  const double * row3 = row2 + states_padded;
+
+  __m256d xmm0 = _mm256_setzero_pd();
+  __m256d xmm1 = _mm256_setzero_pd();
+  __m256d xmm2 = _mm256_setzero_pd();
+  __m256d xmm3 = _mm256_setzero_pd();
+
+  for (k = 0; k < states_padded; k += 4)
+  {
+    __m256d xmm5 = _mm256_load_pd(clv+k);
 
-    logl += site_lk;
+    xmm0 = _mm256_fmadd_pd(_mm256_load_pd(row0+k), xmm5, xmm0);
+    xmm1 = _mm256_fmadd_pd(_mm256_load_pd(row1+k), xmm5, xmm1);
+    xmm2 = _mm256_fmadd_pd(_mm256_load_pd(row2+k), xmm5, xmm2);
+    xmm3 = _mm256_fmadd_pd(_mm256_load_pd(row3+k), xmm5, xmm3);
   }
 
+  /* create a vector containing the sums of xmm0, xmm1, xmm2, xmm3 */
+  __m256d xmm4 = _mm256_unpackhi_pd(xmm0,xmm1);
+  __m256d xmm5 = _mm256_unpacklo_pd(xmm0,xmm1);
+
+  __m256d xmm6 = _mm256_unpackhi_pd(xmm2,xmm3);
+  __m256d xmm7 = _mm256_unpacklo_pd(xmm2,xmm3);
+
+  xmm0 = _mm256_add_pd(xmm4,xmm5);
+  xmm1 = _mm256_add_pd(xmm6,xmm7);
+
+  xmm2 = _mm256_permute2f128_pd(xmm0,xmm1, _MM_SHUFFLE(0,2,0,1));
+  xmm3 = _mm256_blend_pd(xmm0,xmm1,12);
+
+  return _mm256_add_pd(xmm2,xmm3);
+}
+
+/* body of the bclv repeats edge kernel. The child terms diag(freqs) * P * clvc
+   are computed once per child class into bclv. It is inlined with constant
+   states_padded for 4 and 20 states */
+static inline __attribute__((always_inline))
+double edge_loglikelihood_repeatsbclv(unsigned int states,
+                                      unsigned int states_padded,
+                                      unsigned int sites,
+                                      unsigned int child_sites,
+                                      unsigned int rate_cats,
+                                      const double * parent_clv,
+                                      const unsigned int * parent_scaler,
+                                      const double * child_clv,
+                                      const unsigned int * child_scaler,
+                                      const double * pmatrix,
+                                      double ** frequencies,
+                                      const double * rate_weights,
+                                      const unsigned int * pattern_weights,
+                                      const double * invar_proportion,
+                                      const int * invar_indices,
+                                      const unsigned int * freqs_indices,
+                                      double * persite_lnl,
+                                      const unsigned int * parent_site_id,
+                                      const unsigned int * child_site_id,
+                                      double * bclv,
+                                      unsigned int * rate_scalings,
+                                      const double * scale_minlh)
+{
+  unsigned int n,i,j;
+  double logl = 0;
+  site_block_t block = {0};
+  double prop_invar = 0;
+
+  const double * freqs = NULL;
+
+  double terma, terma_r;
+  double inv_site_lk;
+
+  unsigned int span = states_padded * rate_cats;
+  size_t matrix_size = states * states_padded;
+
+  __m256d xmm0, xmm1;
+
+  unsigned int site_scalings;
+
+  /* child terms of each child class */
+  double * child_res = bclv;
+  for (n = 0; n < child_sites; ++n)
+  {
+    for (i = 0; i < rate_cats; ++i)
+    {
+      const double * pmat = pmatrix + i*matrix_size;
+      freqs = frequencies[freqs_indices[i]];
+
+      for (j = 0; j < states_padded; j += 4)
+      {
+        xmm0 = matrix_quad(states_padded, pmat + j*states_padded, child_clv);
+
+        /* multiply with frequencies */
+        xmm1 = _mm256_load_pd(freqs+j);
+        _mm256_store_pd(child_res+j, _mm256_mul_pd(xmm0,xmm1));
+      }
+
+      child_clv += states_padded;
+      child_res += states_padded;
+    }
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+    const double *clvp = &parent_clv[pid * span];
+    const double *cres = &bclv[cid * span];
+    terma = 0;
+
+    if (rate_scalings)
+    {
+      /* compute minimum per-rate scaler -> common per-site scaler */
+      site_scalings = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[pid*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[cid*rate_cats+i] : 0;
+        if (rate_scalings[i] < site_scalings)
+          site_scalings = rate_scalings[i];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                                   PLL_SCALE_RATE_MAXDIFF);
+      }
+    }
+    else
+    {
+      /* count number of scaling factors to account for */
+      site_scalings =  (parent_scaler) ? parent_scaler[pid] : 0;
+      site_scalings += (child_scaler) ? child_scaler[cid] : 0;
+    }
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      /* multiply with clvp */
+      xmm0 = _mm256_setzero_pd();
+      for (j = 0; j < states_padded; j += 4)
+        xmm0 = _mm256_fmadd_pd(_mm256_load_pd(cres+j),
+                               _mm256_load_pd(clvp+j),
+                               xmm0);
+
+      /* add up the elements of xmm0 */
+      xmm1 = _mm256_hadd_pd(xmm0,xmm0);
+      terma_r = ((double *)&xmm1)[0] + ((double *)&xmm1)[2];
+
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings && rate_scalings[i] > 0)
+      {
+        terma_r *= scale_minlh[rate_scalings[i]-1];
+      }
+
+      /* account for invariant sites */
+      prop_invar = invar_proportion ? invar_proportion[freqs_indices[i]] : 0;
+      if (prop_invar > 0)
+      {
+        freqs = frequencies[freqs_indices[i]];
+        inv_site_lk = (invar_indices[n] == -1) ?
+                          0 : freqs[invar_indices[n]];
+        terma += rate_weights[i] * (terma_r * (1 - prop_invar) +
+                 inv_site_lk * prop_invar);
+      }
+      else
+      {
+        terma += terma_r * rate_weights[i];
+      }
+
+      clvp += states_padded;
+      cres += states_padded;
+    }
+
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
+
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
+  return logl;
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeatsbclv_generic_avx2(unsigned int states,
+                                                            unsigned int sites,
+                                                            const unsigned int child_sites,
+                                                            unsigned int rate_cats,
+                                                            const double * parent_clv,
+                                                            const unsigned int * parent_scaler,
+                                                            const double * child_clv,
+                                                            const unsigned int * child_scaler,
+                                                            const double * pmatrix,
+                                                            double ** frequencies,
+                                                            const double * rate_weights,
+                                                            const unsigned int * pattern_weights,
+                                                            const double * invar_proportion,
+                                                            const int * invar_indices,
+                                                            const unsigned int * freqs_indices,
+                                                            double * persite_lnl,
+                                                            const unsigned int * parent_site_id,
+                                                            const unsigned int * child_site_id,
+                                                            double * bclv,
+                                                            unsigned int attrib)
+{
+  unsigned int i;
+  double logl;
+
+  /* scaling stuff */
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return -INFINITY;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  /* dedicated instances for DNA and protein data */
+  if (states == 4)
+    logl = edge_loglikelihood_repeatsbclv(4, 4, sites, child_sites, rate_cats,
+                                          parent_clv, parent_scaler, child_clv,
+                                          child_scaler, pmatrix, frequencies,
+                                          rate_weights, pattern_weights,
+                                          invar_proportion, invar_indices,
+                                          freqs_indices, persite_lnl,
+                                          parent_site_id, child_site_id, bclv,
+                                          rate_scalings, scale_minlh);
+  else if (states == 20)
+    logl = edge_loglikelihood_repeatsbclv(20, 20, sites, child_sites, rate_cats,
+                                          parent_clv, parent_scaler, child_clv,
+                                          child_scaler, pmatrix, frequencies,
+                                          rate_weights, pattern_weights,
+                                          invar_proportion, invar_indices,
+                                          freqs_indices, persite_lnl,
+                                          parent_site_id, child_site_id, bclv,
+                                          rate_scalings, scale_minlh);
+  else
+    logl = edge_loglikelihood_repeatsbclv(states, (states+3) & 0xFFFFFFFC,
+                                          sites, child_sites, rate_cats,
+                                          parent_clv, parent_scaler, child_clv,
+                                          child_scaler, pmatrix, frequencies,
+                                          rate_weights, pattern_weights,
+                                          invar_proportion, invar_indices,
+                                          freqs_indices, persite_lnl,
+                                          parent_site_id, child_site_id, bclv,
+                                          rate_scalings, scale_minlh);
+
   if (rate_scalings)
     free(rate_scalings);
 
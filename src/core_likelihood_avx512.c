@@ -0,0 +1,805 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+
+#define BLOCK_MASK(n) (((n) >= 8) ? 0xFF : 0x0F)
+
+/* The site likelihoods are collected in blocks, whose log-likelihoods are
+   then computed with the vectorized log of core_math_avx512.c */
+#define SITE_BLOCK 64
+
+typedef struct site_block_s
+{
+  unsigned int first;
+  unsigned int count;
+  double lk[SITE_BLOCK];
+  unsigned int scalings[SITE_BLOCK];
+} site_block_t;
+
+/* adds the log-likelihoods of the sites in block to logl and empties it */
+static double flush_sites(site_block_t * block,
+                          const unsigned int * pattern_weights,
+                          double * persite_lnl,
+                          double logl)
+{
+  unsigned int first = block->first;
+
+  logl = pll_core_site_loglikelihoods_avx512(block->count,
+                                             block->lk,
+                                             block->scalings,
+                                             pattern_weights + first,
+                                             persite_lnl ? persite_lnl + first : NULL,
+                                             logl);
+  block->count = 0;
+
+  return logl;
+}
+
+/* appends site with likelihood site_lk to block, which must hold consecutive
+   sites, and flushes the block when it is full */
+static inline double add_site(site_block_t * block,
+                              unsigned int site,
+                              double site_lk,
+                              unsigned int site_scalings,
+                              const unsigned int * pattern_weights,
+                              double * persite_lnl,
+                              double logl)
+{
+  if (!block->count)
+    block->first = site;
+
+  block->lk[block->count] = site_lk;
+  block->scalings[block->count++] = site_scalings;
+
+  if (block->count == SITE_BLOCK)
+    logl = flush_sites(block, pattern_weights, persite_lnl, logl);
+
+  return logl;
+}
+
+/* compute the per-rate dot products term_r[k] = sum_i a[k][i] * b[k][i] of
+   two site vectors of rate_cats * states_padded entries */
+static inline void rate_terms(unsigned int states_padded,
+                              unsigned int rate_cats,
+                              const double * a,
+                              const double * b,
+                              double * term_r)
+{
+  unsigned int i,k;
+
+  if (states_padded == 4)
+  {
+    /* two rate categories per vector */
+    for (k = 0; k < rate_cats; k += 2)
+    {
+      __mmask8 m = BLOCK_MASK(4*(rate_cats - k));
+      __m512d v_prod = _mm512_mul_pd(_mm512_maskz_loadu_pd(m, a),
+                                     _mm512_maskz_loadu_pd(m, b));
+
+      term_r[k] = _mm512_mask_reduce_add_pd(0x0F, v_prod);
+      if (k+1 < rate_cats)
+        term_r[k+1] = _mm512_mask_reduce_add_pd(0xF0, v_prod);
+
+      a += 8;
+      b += 8;
+    }
+    return;
+  }
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    __m512d v_sum = _mm512_setzero_pd();
+    for (i = 0; i < states_padded; i += 8)
+    {
+      __mmask8 m = BLOCK_MASK(states_padded - i);
+      v_sum = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a + i),
+                              _mm512_maskz_loadu_pd(m, b + i),
+                              v_sum);
+    }
+    term_r[k] = _mm512_reduce_add_pd(v_sum);
+
+    a += states_padded;
+    b += states_padded;
+  }
+}
+
+/* combine the per-rate likelihoods of a site, accounting for invariant sites
+   and (relative) per-rate scalers */
+static inline double site_likelihood(unsigned int rate_cats,
+                                     const double * term_r,
+                                     double * const * frequencies,
+                                     const double * rate_weights,
+                                     const double * invar_proportion,
+                                     const int * invar_indices,
+                                     unsigned int site,
+                                     const unsigned int * freqs_indices,
+                                     const unsigned int * rate_scalings,
+                                     const double * scale_minlh)
+{
+  unsigned int i;
+  double terma = 0;
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    double terma_r = term_r[i];
+
+    /* apply per-rate scalers, if necessary */
+    if (rate_scalings && rate_scalings[i] > 0)
+      terma_r *= scale_minlh[rate_scalings[i]-1];
+
+    /* account for invariant sites */
+    double prop_invar = invar_proportion ?
+                          invar_proportion[freqs_indices[i]] : 0;
+    if (prop_invar > 0)
+    {
+      const double * freqs = frequencies[freqs_indices[i]];
+      double inv_site_lk = (invar_indices[site] == -1) ?
+                             0 : freqs[invar_indices[site]];
+      terma += rate_weights[i] * (terma_r * (1 - prop_invar) +
+               inv_site_lk * prop_invar);
+    }
+    else
+    {
+      terma += terma_r * rate_weights[i];
+    }
+  }
+
+  return terma;
+}
+
+/* compute the number of scaling factors to account for at a site; in per-rate
+   mode also the relative capped per-rate scalers */
+static inline unsigned int site_scalers(unsigned int rate_cats,
+                                        const unsigned int * parent_scaler,
+                                        unsigned int pid,
+                                        const unsigned int * child_scaler,
+                                        unsigned int cid,
+                                        unsigned int * rate_scalings)
+{
+  unsigned int i;
+  unsigned int site_scalings;
+
+  if (rate_scalings)
+  {
+    /* compute minimum per-rate scaler -> common per-site scaler */
+    site_scalings = UINT_MAX;
+    for (i = 0; i < rate_cats; ++i)
+    {
+      rate_scalings[i] = (parent_scaler) ? parent_scaler[pid*rate_cats+i] : 0;
+      rate_scalings[i] += (child_scaler) ? child_scaler[cid*rate_cats+i] : 0;
+      if (rate_scalings[i] < site_scalings)
+        site_scalings = rate_scalings[i];
+    }
+
+    /* compute relative capped per-rate scalers */
+    for (i = 0; i < rate_cats; ++i)
+    {
+      rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                                 PLL_SCALE_RATE_MAXDIFF);
+    }
+  }
+  else
+  {
+    /* count number of scaling factors to account for */
+    site_scalings =  (parent_scaler) ? parent_scaler[pid] : 0;
+    site_scalings += (child_scaler) ? child_scaler[cid] : 0;
+  }
+
+  return site_scalings;
+}
+
+/* cterm = diag(freqs) * P * clvc for each rate category, with pt the
+   transposed p-matrices multiplied by the frequencies */
+static inline void child_terms(unsigned int states,
+                               unsigned int states_padded,
+                               unsigned int rate_cats,
+                               const double * clvc,
+                               const double * pt,
+                               double * cterm)
+{
+  unsigned int i,j,k;
+  size_t matrix_size = states * states_padded;
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    for (i = 0; i < states_padded; i += 8)
+    {
+      __mmask8 m = BLOCK_MASK(states_padded - i);
+      __m512d v_term = _mm512_setzero_pd();
+
+      for (j = 0; j < states; ++j)
+        v_term = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m,
+                                                       pt+j*states_padded+i),
+                                 _mm512_set1_pd(clvc[j]),
+                                 v_term);
+
+      _mm512_mask_storeu_pd(cterm + i, m, v_term);
+    }
+    clvc += states_padded;
+    cterm += states_padded;
+    pt += matrix_size;
+  }
+}
+
+static void * alloc_workspace(size_t size)
+{
+  void * mem = pll_aligned_alloc(size, PLL_ALIGNMENT_AVX512);
+  if (!mem)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return NULL;
+  }
+  memset(mem, 0, size);
+  return mem;
+}
+
+PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx512(unsigned int states,
+                                                             unsigned int sites,
+                                                             unsigned int rate_cats,
+                                                             const double * clv,
+                                                             const unsigned int * site_id,
+                                                             const unsigned int * scaler,
+                                                             double * const * frequencies,
+                                                             const double * rate_weights,
+                                                             const unsigned int * pattern_weights,
+                                                             const double * invar_proportion,
+                                                             const int * invar_indices,
+                                                             const unsigned int * freqs_indices,
+                                                             double * persite_lnl)
+{
+  unsigned int i,j;
+  double logl = 0;
+  site_block_t block = {0};
+  double term;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* frequencies of all rate categories, laid out as a site CLV */
+  double * freqs = (double *)alloc_workspace((span_padded + rate_cats) *
+                                             sizeof(double));
+  if (!freqs)
+    return -INFINITY;
+
+  double * term_r = freqs + span_padded;
+
+  for (j = 0; j < rate_cats; ++j)
+    memcpy(freqs + j*states_padded,
+           frequencies[freqs_indices[j]],
+           states * sizeof(double));
+
+  for (i = 0; i < sites; ++i)
+  {
+    unsigned int id = PLL_GET_ID(site_id, i);
+
+    rate_terms(states_padded, rate_cats, clv + id*span_padded, freqs, term_r);
+
+    term = site_likelihood(rate_cats,
+                           term_r,
+                           frequencies,
+                           rate_weights,
+                           invar_proportion,
+                           invar_indices,
+                           i,
+                           freqs_indices,
+                           NULL,
+                           NULL);
+
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[id] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
+
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
+  pll_aligned_free(freqs);
+
+  return logl;
+}
+
+PLL_EXPORT double pll_core_root_loglikelihood_avx512(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     const double * clv,
+                                                     const unsigned int * scaler,
+                                                     double * const * frequencies,
+                                                     const double * rate_weights,
+                                                     const unsigned int * pattern_weights,
+                                                     const double * invar_proportion,
+                                                     const int * invar_indices,
+                                                     const unsigned int * freqs_indices,
+                                                     double * persite_lnl)
+{
+  return pll_core_root_loglikelihood_repeats_avx512(states,
+                                                    sites,
+                                                    rate_cats,
+                                                    clv,
+                                                    NULL,
+                                                    scaler,
+                                                    frequencies,
+                                                    rate_weights,
+                                                    pattern_weights,
+                                                    invar_proportion,
+                                                    invar_indices,
+                                                    freqs_indices,
+                                                    persite_lnl);
+}
+
+/* edge log-likelihood over site repeats. If bclv is not NULL, the child
+   terms are computed once per child class into bclv */
+static double edge_loglikelihood_repeats(unsigned int states,
+                                         unsigned int sites,
+                                         const unsigned int child_sites,
+                                         unsigned int rate_cats,
+                                         const double * parent_clv,
+                                         const unsigned int * parent_scaler,
+                                         const double * child_clv,
+                                         const unsigned int * child_scaler,
+                                         const double * pmatrix,
+                                         double ** frequencies,
+                                         const double * rate_weights,
+                                         const unsigned int * pattern_weights,
+                                         const double * invar_proportion,
+                                         const int * invar_indices,
+                                         const unsigned int * freqs_indices,
+                                         double * persite_lnl,
+                                         const unsigned int * parent_site_id,
+                                         const unsigned int * child_site_id,
+                                         double * bclv,
+                                         unsigned int attrib)
+{
+  unsigned int n,i,j,k;
+  double logl = 0;
+  site_block_t block = {0};
+
+  double site_lk;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+  size_t matrix_size = states * states_padded;
+
+  /* scaling stuff */
+  unsigned int site_scalings;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return -INFINITY;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  /* transposed p-matrices with rows multiplied by the frequencies, i.e.
+     pt[k][j][i] = freqs_k[i] * P_k[i][j], and a site buffer for the child
+     terms followed by the per-rate likelihoods */
+  double * pt = (double *)alloc_workspace((matrix_size * rate_cats +
+                                           span_padded + rate_cats) *
+                                          sizeof(double));
+  if (!pt)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+    return -INFINITY;
+  }
+
+  double * cterm = pt + matrix_size * rate_cats;
+  double * term_r = cterm + span_padded;
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    const double * freqs = frequencies[freqs_indices[k]];
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        pt[k*matrix_size + j*states_padded + i] =
+          freqs[i] * pmatrix[k*matrix_size + i*states_padded + j];
+  }
+
+  if (bclv)
+  {
+    for (n = 0; n < child_sites; ++n)
+      child_terms(states,
+                  states_padded,
+                  rate_cats,
+                  child_clv + n*span_padded,
+                  pt,
+                  bclv + n*span_padded);
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+    const double * clvc = child_clv + cid*span_padded;
+    const double * site_cterm = cterm;
+
+    site_scalings = site_scalers(rate_cats,
+                                 parent_scaler,
+                                 pid,
+                                 child_scaler,
+                                 cid,
+                                 rate_scalings);
+
+    if (bclv)
+      site_cterm = bclv + cid*span_padded;
+    else
+      child_terms(states, states_padded, rate_cats, clvc, pt, cterm);
+
+    rate_terms(states_padded,
+               rate_cats,
+               parent_clv + pid*span_padded,
+               site_cterm,
+               term_r);
+
+    site_lk = site_likelihood(rate_cats,
+                              term_r,
+                              frequencies,
+                              rate_weights,
+                              invar_proportion,
+                              invar_indices,
+                              n,
+                              freqs_indices,
+                              rate_scalings,
+                              scale_minlh);
+
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    site_lk,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
+
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
+  pll_aligned_free(pt);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return logl;
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeats_generic_avx512(unsigned int states,
+                                                          unsigned int sites,
+                                                          const unsigned int child_sites,
+                                                          unsigned int rate_cats,
+                                                          const double * parent_clv,
+                                                          const unsigned int * parent_scaler,
+                                                          const double * child_clv,
+                                                          const unsigned int * child_scaler,
+                                                          const double * pmatrix,
+                                                          double ** frequencies,
+                                                          const double * rate_weights,
+                                                          const unsigned int * pattern_weights,
+                                                          const double * invar_proportion,
+                                                          const int * invar_indices,
+                                                          const unsigned int * freqs_indices,
+                                                          double * persite_lnl,
+                                                          const unsigned int * parent_site_id,
+                                                          const unsigned int * child_site_id,
+                                                          double * bclv,
+                                                          unsigned int attrib)
+{
+  return edge_loglikelihood_repeats(states,
+                                    sites,
+                                    child_sites,
+                                    rate_cats,
+                                    parent_clv,
+                                    parent_scaler,
+                                    child_clv,
+                                    child_scaler,
+                                    pmatrix,
+                                    frequencies,
+                                    rate_weights,
+                                    pattern_weights,
+                                    invar_proportion,
+                                    invar_indices,
+                                    freqs_indices,
+                                    persite_lnl,
+                                    parent_site_id,
+                                    child_site_id,
+                                    NULL,
+                                    attrib);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeatsbclv_generic_avx512(unsigned int states,
+                                                              unsigned int sites,
+                                                              const unsigned int child_sites,
+                                                              unsigned int rate_cats,
+                                                              const double * parent_clv,
+                                                              const unsigned int * parent_scaler,
+                                                              const double * child_clv,
+                                                              const unsigned int * child_scaler,
+                                                              const double * pmatrix,
+                                                              double ** frequencies,
+                                                              const double * rate_weights,
+                                                              const unsigned int * pattern_weights,
+                                                              const double * invar_proportion,
+                                                              const int * invar_indices,
+                                                              const unsigned int * freqs_indices,
+                                                              double * persite_lnl,
+                                                              const unsigned int * parent_site_id,
+                                                              const unsigned int * child_site_id,
+                                                              double * bclv,
+                                                              unsigned int attrib)
+{
+  return edge_loglikelihood_repeats(states,
+                                    sites,
+                                    child_sites,
+                                    rate_cats,
+                                    parent_clv,
+                                    parent_scaler,
+                                    child_clv,
+                                    child_scaler,
+                                    pmatrix,
+                                    frequencies,
+                                    rate_weights,
+                                    pattern_weights,
+                                    invar_proportion,
+                                    invar_indices,
+                                    freqs_indices,
+                                    persite_lnl,
+                                    parent_site_id,
+                                    child_site_id,
+                                    bclv,
+                                    attrib);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const double * child_clv,
+                                             const unsigned int * child_scaler,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_repeats_generic_avx512(states,
+                                                            sites,
+                                                            sites,
+                                                            rate_cats,
+                                                            parent_clv,
+                                                            parent_scaler,
+                                                            child_clv,
+                                                            child_scaler,
+                                                            pmatrix,
+                                                            (double **)frequencies,
+                                                            rate_weights,
+                                                            pattern_weights,
+                                                            invar_proportion,
+                                                            invar_indices,
+                                                            freqs_indices,
+                                                            persite_lnl,
+                                                            NULL,
+                                                            NULL,
+                                                            NULL,
+                                                            attrib);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const unsigned char * tipchars,
+                                             const pll_state_t * tipmap,
+                                             unsigned int tipmap_size,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib)
+{
+  unsigned int n,i,j,k;
+  double logl = 0;
+  site_block_t block = {0};
+
+  double site_lk;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* 4-state tip characters are the state masks themselves */
+  if (states == 4)
+  {
+    tipmap = NULL;
+    tipmap_size = 16;
+  }
+
+  /* scaling stuff */
+  unsigned int site_scalings;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return -INFINITY;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  /* precompute freqs[i] * sum(P[i][j]) over the states j of each tip state */
+  double * lookup = (double *)alloc_workspace((tipmap_size * span_padded +
+                                               rate_cats) * sizeof(double));
+  if (!lookup)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+    return -INFINITY;
+  }
+
+  double * term_r = lookup + tipmap_size * span_padded;
+
+  for (n = 0; n < tipmap_size; ++n)
+  {
+    pll_state_t state = tipmap ? tipmap[n] : n;
+    double * lterm = lookup + n*span_padded;
+    const double * pmat = pmatrix;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * freqs = frequencies[freqs_indices[k]];
+      for (i = 0; i < states; ++i)
+      {
+        double term = 0;
+        for (j = 0; j < states; ++j)
+          if ((state >> j) & 1)
+            term += pmat[j];
+        lterm[i] = freqs[i] * term;
+        pmat += states_padded;
+      }
+      lterm += states_padded;
+    }
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    site_scalings = site_scalers(rate_cats,
+                                 parent_scaler,
+                                 n,
+                                 NULL,
+                                 n,
+                                 rate_scalings);
+
+    rate_terms(states_padded,
+               rate_cats,
+               parent_clv + n*span_padded,
+               lookup + tipchars[n]*span_padded,
+               term_r);
+
+    site_lk = site_likelihood(rate_cats,
+                              term_r,
+                              frequencies,
+                              rate_weights,
+                              invar_proportion,
+                              invar_indices,
+                              n,
+                              freqs_indices,
+                              rate_scalings,
+                              scale_minlh);
+
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    site_lk,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
+
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
+  pll_aligned_free(lookup);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return logl;
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_4x4_avx512(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const unsigned char * tipchars,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib)
+{
+  return pll_core_edge_loglikelihood_ti_avx512(4,
+                                               sites,
+                                               rate_cats,
+                                               parent_clv,
+                                               parent_scaler,
+                                               tipchars,
+                                               NULL,
+                                               16,
+                                               pmatrix,
+                                               frequencies,
+                                               rate_weights,
+                                               pattern_weights,
+                                               invar_proportion,
+                                               invar_indices,
+                                               freqs_indices,
+                                               persite_lnl,
+                                               attrib);
+}
@@ -22,6 +22,59 @@
 #include <limits.h>
 #include "pll.h"
 
+/* The site likelihoods are collected in blocks, whose log-likelihoods are
+   then computed with the vectorized log of core_math_sse.c */
+#define SITE_BLOCK 64
+
+typedef struct site_block_s
+{
+  unsigned int first;
+  unsigned int count;
+  double lk[SITE_BLOCK];
+  unsigned int scalings[SITE_BLOCK];
+} site_block_t;
+
+/* adds the log-likelihoods of the sites in block to logl and empties it */
+static double flush_sites(site_block_t * block,
+                          const unsigned int * pattern_weights,
+                          double * persite_lnl,
+                          double logl)
+{
+  unsigned int first = block->first;
+
+  logl = pll_core_site_loglikelihoods_sse(block->count,
+                                          block->lk,
+                                          block->scalings,
+                                          pattern_weights + first,
+                                          persite_lnl ? persite_lnl + first : NULL,
+                                          logl);
+  block->count = 0;
+
+  return logl;
+}
+
+/* appends site with likelihood site_lk to block, which must hold consecutive
+   sites, and flushes the block when it is full */
+static inline double add_site(site_block_t * block,
+                              unsigned int site,
+                              double site_lk,
+                              unsigned int site_scalings,
+                              const unsigned int * pattern_weights,
+                              double * persite_lnl,
+                              double logl)
+{
+  if (!block->count)
+    block->first = site;
+
+  block->lk[block->count] = site_lk;
+  block->scalings[block->count++] = site_scalings;
+
+  if (block->count == SITE_BLOCK)
+    logl = flush_sites(block, pattern_weights, persite_lnl, logl);
+
+  return logl;
+}
+
 PLL_EXPORT double pll_core_root_loglikelihood_sse(unsigned int states,
                                                   unsigned int sites,
                                                   unsigned int rate_cats,
@@ -37,6 +90,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_sse(unsigned int states,
 {
   unsigned int i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -91,19 +145,18 @@ PLL_EXPORT double pll_core_root_loglikelihood_sse(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[i] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -123,6 +176,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_sse(unsigned int states,
 {
   unsigned int i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -180,19 +234,18 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_sse(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[id])
-      term += scaler[id] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[id] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -210,6 +263,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_4x4_sse(unsigned int sites,
 {
   unsigned int i,j;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -260,19 +314,18 @@ PLL_EXPORT double pll_core_root_loglikelihood_4x4_sse(unsigned int sites,
       clv += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    i,
+                    term,
+                    scaler ? scaler[i] : 0,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
+  }
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
 
-    logl += term;
-  }
   return logl;
 }
 
@@ -296,6 +349,7 @@ double pll_core_edge_loglikelihood_ti_sse(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -303,7 +357,7 @@ double pll_core_edge_loglikelihood_ti_sse(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   pll_state_t cstate;
   unsigned int states_padded = (states+1) & 0xFFFFFFFE;
@@ -457,20 +511,18 @@ double pll_core_edge_loglikelihood_ti_sse(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -497,6 +549,7 @@ double pll_core_edge_loglikelihood_ii_sse(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -505,7 +558,7 @@ double pll_core_edge_loglikelihood_ii_sse(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+1) & 0xFFFFFFFE;
 
@@ -649,20 +702,18 @@ double pll_core_edge_loglikelihood_ii_sse(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -693,13 +744,14 @@ double pll_core_edge_loglikelihood_repeats_generic_sse(unsigned int states,
 {
   unsigned int n,i,j,k;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+1) & 0xFFFFFFFE;
   unsigned int span = rate_cats*states_padded;
@@ -848,20 +900,18 @@ double pll_core_edge_loglikelihood_repeats_generic_sse(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -887,6 +937,7 @@ double pll_core_edge_loglikelihood_ii_4x4_sse(unsigned int sites,
 {
   unsigned int n,i;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -895,7 +946,7 @@ double pll_core_edge_loglikelihood_ii_4x4_sse(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states = 4;
   unsigned int states_padded = 4;
@@ -1061,20 +1112,18 @@ double pll_core_edge_loglikelihood_ii_4x4_sse(unsigned int sites,
       clvc += states_padded;
     }
 
-    /* compute site log-likelihood and apply per-site scaler if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   if (rate_scalings)
     free(rate_scalings);
 
@@ -1099,6 +1148,7 @@ double pll_core_edge_loglikelihood_ti_4x4_sse(unsigned int sites,
 {
   unsigned int i,k,n;
   double logl = 0;
+  site_block_t block = {0};
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -1106,7 +1156,7 @@ double pll_core_edge_loglikelihood_ti_4x4_sse(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states_padded = 4;
@@ -1311,20 +1361,18 @@ double pll_core_edge_loglikelihood_ti_4x4_sse(unsigned int sites,
       coffset += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(terma);
-    if (site_scalings)
-      site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+    /* the log-likelihoods are computed for blocks of sites */
+    logl = add_site(&block,
+                    n,
+                    terma,
+                    site_scalings,
+                    pattern_weights,
+                    persite_lnl,
+                    logl);
   }
 
+  logl = flush_sites(&block, pattern_weights, persite_lnl, logl);
+
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
@@ -0,0 +1,146 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Element-wise log, exp and expm1 of count doubles, using the vectorized
+   functions of the architecture selected in attrib. x and y may be the same
+   array */
+
+PLL_EXPORT void pll_core_log(unsigned int count,
+                             const double * x,
+                             double * y,
+                             unsigned int attrib)
+{
+  unsigned int i;
+
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_log_avx512(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    pll_core_log_avx2(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    pll_core_log_avx(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+  {
+    pll_core_log_sse(count, x, y);
+    return;
+  }
+  #endif
+
+  for (i = 0; i < count; ++i)
+    y[i] = log(x[i]);
+}
+
+PLL_EXPORT void pll_core_exp(unsigned int count,
+                             const double * x,
+                             double * y,
+                             unsigned int attrib)
+{
+  unsigned int i;
+
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_exp_avx512(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    pll_core_exp_avx2(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    pll_core_exp_avx(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+  {
+    pll_core_exp_sse(count, x, y);
+    return;
+  }
+  #endif
+
+  for (i = 0; i < count; ++i)
+    y[i] = exp(x[i]);
+}
+
+PLL_EXPORT void pll_core_expm1(unsigned int count,
+                               const double * x,
+                               double * y,
+                               unsigned int attrib)
+{
+  unsigned int i;
+
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_expm1_avx512(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    pll_core_expm1_avx2(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    pll_core_expm1_avx(count, x, y);
+    return;
+  }
+  #endif
+  #ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+  {
+    pll_core_expm1_sse(count, x, y);
+    return;
+  }
+  #endif
+
+  for (i = 0; i < count; ++i)
+    y[i] = expm1(x[i]);
+}
@@ -0,0 +1,310 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Vectorized log, exp and expm1 for arguments in the range where the result
+   is a normal number. Arguments outside that range (and NaNs) are passed on
+   to libm, so the results agree with libm to within a few ULP everywhere.
+   See core_math_sse.c for a description of the algorithms */
+
+#define LOG_LG1    6.666666666666735130e-01
+#define LOG_LG2    3.999999999940941908e-01
+#define LOG_LG3    2.857142874366239149e-01
+#define LOG_LG4    2.222219843214978396e-01
+#define LOG_LG5    1.818357216161805012e-01
+#define LOG_LG6    1.531383769920937332e-01
+#define LOG_LG7    1.479819860511658591e-01
+#define LN2_HI     6.93147180369123816490e-01
+#define LN2_LO     1.90821492927058770002e-10
+#define LOG2E      1.44269504088896338700e+00
+#define SQRT2      1.41421356237309504880e+00
+#define MIN_NORMAL 2.2250738585072014e-308
+#define MAX_FINITE 1.7976931348623157e+308
+
+/* 2^52 + 2^51; adding it rounds a double of magnitude less than 2^51 to an
+   integer, which then occupies the low bits of the mantissa */
+#define ROUND_MAGIC 6755399441055744.0
+
+static inline __m256d log_avx2(__m256d x)
+{
+  const __m256i mant_mask = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+  const __m256i one_bits = _mm256_set1_epi64x(0x3FF0000000000000LL);
+  const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d half = _mm256_set1_pd(0.5);
+
+  __m256i bits = _mm256_castpd_si256(x);
+  __m256d m, k, f, s, z, w, t1, t2, hfsq, big;
+
+  /* x = m * 2^k with m in [1,2) */
+  m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mant_mask),
+                                          one_bits));
+  k = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                                          _mm256_castpd_si256(two52)));
+  k = _mm256_sub_pd(k, _mm256_set1_pd(4503599627370496.0 + 1023));
+
+  /* move m to [sqrt(2)/2, sqrt(2)) */
+  big = _mm256_cmp_pd(m, _mm256_set1_pd(SQRT2), _CMP_GT_OQ);
+  m = _mm256_blendv_pd(m, _mm256_mul_pd(m, half), big);
+  k = _mm256_add_pd(k, _mm256_and_pd(big, one));
+
+  f = _mm256_sub_pd(m, one);
+  hfsq = _mm256_mul_pd(_mm256_mul_pd(half, f), f);
+  s = _mm256_div_pd(f, _mm256_add_pd(_mm256_set1_pd(2.0), f));
+  z = _mm256_mul_pd(s, s);
+  w = _mm256_mul_pd(z, z);
+
+  t1 = _mm256_fmadd_pd(w, _mm256_set1_pd(LOG_LG6), _mm256_set1_pd(LOG_LG4));
+  t1 = _mm256_fmadd_pd(w, t1, _mm256_set1_pd(LOG_LG2));
+  t1 = _mm256_mul_pd(w, t1);
+  t2 = _mm256_fmadd_pd(w, _mm256_set1_pd(LOG_LG7), _mm256_set1_pd(LOG_LG5));
+  t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(LOG_LG3));
+  t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(LOG_LG1));
+  t2 = _mm256_mul_pd(z, t2);
+
+  /* k*ln2_hi - ((hfsq - (s*(hfsq+R) + k*ln2_lo)) - f) */
+  t1 = _mm256_fmadd_pd(s,
+                       _mm256_add_pd(hfsq, _mm256_add_pd(t1, t2)),
+                       _mm256_mul_pd(k, _mm256_set1_pd(LN2_LO)));
+  t1 = _mm256_sub_pd(_mm256_sub_pd(hfsq, t1), f);
+
+  return _mm256_fmsub_pd(k, _mm256_set1_pd(LN2_HI), t1);
+}
+
+/* computes 2^k and expm1(r) for x = k*ln(2) + r with |r| <= ln(2)/2 */
+static inline __m256d expm1_reduced_avx2(__m256d x, __m256d * p2k)
+{
+  const __m256d magic = _mm256_set1_pd(ROUND_MAGIC);
+  __m256d k, kmagic, r, p;
+  __m256i ki;
+
+  kmagic = _mm256_fmadd_pd(x, _mm256_set1_pd(LOG2E), magic);
+  k = _mm256_sub_pd(kmagic, magic);
+  r = _mm256_fnmadd_pd(k, _mm256_set1_pd(LN2_HI), x);
+  r = _mm256_fnmadd_pd(k, _mm256_set1_pd(LN2_LO), r);
+
+  /* Taylor polynomial of degree 13 */
+  p = _mm256_set1_pd(1.0/6227020800.0);
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/479001600.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/39916800.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/3628800.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/362880.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/40320.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/5040.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/720.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/120.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/24.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0/6.0));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(0.5));
+  p = _mm256_fmadd_pd(p, _mm256_mul_pd(r, r), r);
+
+  /* 2^k from the integer in the low bits of k + magic */
+  ki = _mm256_sub_epi64(_mm256_castpd_si256(kmagic),
+                        _mm256_castpd_si256(magic));
+  *p2k = _mm256_castsi256_pd(_mm256_slli_epi64(
+                               _mm256_add_epi64(ki, _mm256_set1_epi64x(1023)),
+                               52));
+  return p;
+}
+
+static inline __m256d exp_avx2(__m256d x)
+{
+  __m256d p2k;
+  __m256d p = expm1_reduced_avx2(x, &p2k);
+
+  return _mm256_fmadd_pd(p2k, p, p2k);
+}
+
+static inline __m256d expm1_avx2(__m256d x)
+{
+  __m256d p2k;
+  __m256d p;
+
+  /* expm1(x) rounds to -1 well above -700 */
+  x = _mm256_max_pd(x, _mm256_set1_pd(-700.0));
+  p = expm1_reduced_avx2(x, &p2k);
+
+  return _mm256_fmadd_pd(p2k, p, _mm256_sub_pd(p2k, _mm256_set1_pd(1.0)));
+}
+
+/* non-zero if all elements of x are within [lo,hi] */
+static inline int in_range_avx2(__m256d x, double lo, double hi)
+{
+  __m256d mask = _mm256_and_pd(_mm256_cmp_pd(x,_mm256_set1_pd(lo),_CMP_GE_OQ),
+                               _mm256_cmp_pd(x,_mm256_set1_pd(hi),_CMP_LE_OQ));
+  return _mm256_movemask_pd(mask) == 0xF;
+}
+
+PLL_EXPORT void pll_core_log_avx2(unsigned int count,
+                                  const double * x,
+                                  double * y)
+{
+  unsigned int i,j;
+  double tail[4];
+
+  for (i = 0; i < count; i += 4)
+  {
+    __m256d v_x;
+
+    if (i + 4 <= count)
+      v_x = _mm256_loadu_pd(x+i);
+    else
+    {
+      for (j = 0; j < 4; ++j)
+        tail[j] = (i + j < count) ? x[i+j] : 1.0;
+      v_x = _mm256_loadu_pd(tail);
+    }
+
+    if (in_range_avx2(v_x, MIN_NORMAL, MAX_FINITE))
+      v_x = log_avx2(v_x);
+    else
+    {
+      _mm256_storeu_pd(tail, v_x);
+      for (j = 0; j < 4; ++j)
+        tail[j] = log(tail[j]);
+      v_x = _mm256_loadu_pd(tail);
+    }
+
+    if (i + 4 <= count)
+      _mm256_storeu_pd(y+i, v_x);
+    else
+    {
+      _mm256_storeu_pd(tail, v_x);
+      for (j = 0; i + j < count; ++j)
+        y[i+j] = tail[j];
+    }
+  }
+}
+
+PLL_EXPORT void pll_core_exp_avx2(unsigned int count,
+                                  const double * x,
+                                  double * y)
+{
+  unsigned int i,j;
+  double tail[4];
+
+  for (i = 0; i < count; i += 4)
+  {
+    __m256d v_x;
+
+    if (i + 4 <= count)
+      v_x = _mm256_loadu_pd(x+i);
+    else
+    {
+      for (j = 0; j < 4; ++j)
+        tail[j] = (i + j < count) ? x[i+j] : 0.0;
+      v_x = _mm256_loadu_pd(tail);
+    }
+
+    if (in_range_avx2(v_x, -708.0, 708.0))
+      v_x = exp_avx2(v_x);
+    else
+    {
+      _mm256_storeu_pd(tail, v_x);
+      for (j = 0; j < 4; ++j)
+        tail[j] = exp(tail[j]);
+      v_x = _mm256_loadu_pd(tail);
+    }
+
+    if (i + 4 <= count)
+      _mm256_storeu_pd(y+i, v_x);
+    else
+    {
+      _mm256_storeu_pd(tail, v_x);
+      for (j = 0; i + j < count; ++j)
+        y[i+j] = tail[j];
+    }
+  }
+}
+
+PLL_EXPORT void pll_core_expm1_avx2(unsigned int count,
+                                    const double * x,
+                                    double * y)
+{
+  unsigned int i,j;
+  double tail[4];
+
+  for (i = 0; i < count; i += 4)
+  {
+    __m256d v_x;
+
+    if (i + 4 <= count)
+      v_x = _mm256_loadu_pd(x+i);
+    else
+    {
+      for (j = 0; j < 4; ++j)
+        tail[j] = (i + j < count) ? x[i+j] : 0.0;
+      v_x = _mm256_loadu_pd(tail);
+    }
+
+    if (in_range_avx2(v_x, -HUGE_VAL, 708.0))
+      v_x = expm1_avx2(v_x);
+    else
+    {
+      _mm256_storeu_pd(tail, v_x);
+      for (j = 0; j < 4; ++j)
+        tail[j] = expm1(tail[j]);
+      v_x = _mm256_loadu_pd(tail);
+    }
+
+    if (i + 4 <= count)
+      _mm256_storeu_pd(y+i, v_x);
+    else
+    {
+      _mm256_storeu_pd(tail, v_x);
+      for (j = 0; i + j < count; ++j)
+        y[i+j] = tail[j];
+    }
+  }
+}
+
+/* adds the log-likelihoods of count consecutive sites to logl, given their
+   likelihoods and the number of times they were scaled. The likelihoods in
+   site_lk are overwritten and persite_lnl may be NULL */
+PLL_EXPORT double pll_core_site_loglikelihoods_avx2(unsigned int count,
+                                                    double * site_lk,
+                                                    const unsigned int * site_scalings,
+                                                    const unsigned int * pattern_weights,
+                                                    double * persite_lnl,
+                                                    double logl)
+{
+  unsigned int i;
+  double term;
+
+  pll_core_log_avx2(count, site_lk, site_lk);
+
+  for (i = 0; i < count; ++i)
+  {
+    term = site_lk[i];
+    if (site_scalings[i])
+      term += site_scalings[i] * log(PLL_SCALE_THRESHOLD);
+
+    term *= pattern_weights[i];
+
+    if (persite_lnl)
+      persite_lnl[i] = term;
+
+    logl += term;
+  }
+
+  return logl;
+}
@@ -0,0 +1,259 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Vectorized log, exp and expm1 for arguments in the range where the result
+   is a normal number. Arguments outside that range (and NaNs) are passed on
+   to libm, so the results agree with libm to within a few ULP everywhere.
+   See core_math_sse.c for a description of the algorithms */
+
+#define LOG_LG1    6.666666666666735130e-01
+#define LOG_LG2    3.999999999940941908e-01
+#define LOG_LG3    2.857142874366239149e-01
+#define LOG_LG4    2.222219843214978396e-01
+#define LOG_LG5    1.818357216161805012e-01
+#define LOG_LG6    1.531383769920937332e-01
+#define LOG_LG7    1.479819860511658591e-01
+#define LN2_HI     6.93147180369123816490e-01
+#define LN2_LO     1.90821492927058770002e-10
+#define LOG2E      1.44269504088896338700e+00
+#define SQRT2      1.41421356237309504880e+00
+#define MIN_NORMAL 2.2250738585072014e-308
+#define MAX_FINITE 1.7976931348623157e+308
+
+static inline __m512d log_avx512(__m512d x)
+{
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512d half = _mm512_set1_pd(0.5);
+
+  __m512d m, k, f, s, z, w, t1, t2, hfsq;
+  __mmask8 big;
+
+  /* x = m * 2^k with m in [1,2) */
+  m = _mm512_getmant_pd(x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src);
+  k = _mm512_getexp_pd(x);
+
+  /* move m to [sqrt(2)/2, sqrt(2)) */
+  big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(SQRT2), _CMP_GT_OQ);
+  m = _mm512_mask_mul_pd(m, big, m, half);
+  k = _mm512_mask_add_pd(k, big, k, one);
+
+  f = _mm512_sub_pd(m, one);
+  hfsq = _mm512_mul_pd(_mm512_mul_pd(half, f), f);
+  s = _mm512_div_pd(f, _mm512_add_pd(_mm512_set1_pd(2.0), f));
+  z = _mm512_mul_pd(s, s);
+  w = _mm512_mul_pd(z, z);
+
+  t1 = _mm512_fmadd_pd(w, _mm512_set1_pd(LOG_LG6), _mm512_set1_pd(LOG_LG4));
+  t1 = _mm512_fmadd_pd(w, t1, _mm512_set1_pd(LOG_LG2));
+  t1 = _mm512_mul_pd(w, t1);
+  t2 = _mm512_fmadd_pd(w, _mm512_set1_pd(LOG_LG7), _mm512_set1_pd(LOG_LG5));
+  t2 = _mm512_fmadd_pd(w, t2, _mm512_set1_pd(LOG_LG3));
+  t2 = _mm512_fmadd_pd(w, t2, _mm512_set1_pd(LOG_LG1));
+  t2 = _mm512_mul_pd(z, t2);
+
+  /* k*ln2_hi - ((hfsq - (s*(hfsq+R) + k*ln2_lo)) - f) */
+  t1 = _mm512_fmadd_pd(s,
+                       _mm512_add_pd(hfsq, _mm512_add_pd(t1, t2)),
+                       _mm512_mul_pd(k, _mm512_set1_pd(LN2_LO)));
+  t1 = _mm512_sub_pd(_mm512_sub_pd(hfsq, t1), f);
+
+  return _mm512_fmsub_pd(k, _mm512_set1_pd(LN2_HI), t1);
+}
+
+/* computes 2^k and expm1(r) for x = k*ln(2) + r with |r| <= ln(2)/2 */
+static inline __m512d expm1_reduced_avx512(__m512d x, __m512d * p2k)
+{
+  __m512d k, r, p;
+
+  k = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(LOG2E)),
+                           _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  r = _mm512_fnmadd_pd(k, _mm512_set1_pd(LN2_HI), x);
+  r = _mm512_fnmadd_pd(k, _mm512_set1_pd(LN2_LO), r);
+
+  /* Taylor polynomial of degree 13 */
+  p = _mm512_set1_pd(1.0/6227020800.0);
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/479001600.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/39916800.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/3628800.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/362880.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/40320.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/5040.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/720.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/120.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/24.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0/6.0));
+  p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(0.5));
+  p = _mm512_fmadd_pd(p, _mm512_mul_pd(r, r), r);
+
+  *p2k = _mm512_scalef_pd(_mm512_set1_pd(1.0), k);
+  return p;
+}
+
+static inline __m512d exp_avx512(__m512d x)
+{
+  __m512d p2k;
+  __m512d p = expm1_reduced_avx512(x, &p2k);
+
+  return _mm512_fmadd_pd(p2k, p, p2k);
+}
+
+static inline __m512d expm1_avx512(__m512d x)
+{
+  __m512d p2k;
+  __m512d p;
+
+  /* expm1(x) rounds to -1 well above -700 */
+  x = _mm512_max_pd(x, _mm512_set1_pd(-700.0));
+  p = expm1_reduced_avx512(x, &p2k);
+
+  return _mm512_fmadd_pd(p2k, p, _mm512_sub_pd(p2k, _mm512_set1_pd(1.0)));
+}
+
+/* mask of the elements of x that are not within [lo,hi] */
+static inline __mmask8 out_of_range_avx512(__m512d x, double lo, double hi)
+{
+  return _mm512_cmp_pd_mask(x, _mm512_set1_pd(lo), _CMP_NGE_UQ) |
+         _mm512_cmp_pd_mask(x, _mm512_set1_pd(hi), _CMP_NLE_UQ);
+}
+
+PLL_EXPORT void pll_core_log_avx512(unsigned int count,
+                                    const double * x,
+                                    double * y)
+{
+  unsigned int i,j;
+  double tmp[8];
+
+  for (i = 0; i < count; i += 8)
+  {
+    __mmask8 mask = (count - i >= 8) ? 0xFF : (__mmask8)((1u << (count-i)) - 1);
+    __mmask8 bad;
+    __m512d v_x = _mm512_mask_loadu_pd(_mm512_set1_pd(1.0), mask, x+i);
+
+    bad = out_of_range_avx512(v_x, MIN_NORMAL, MAX_FINITE);
+    v_x = log_avx512(v_x);
+
+    /* arguments outside the range are passed to libm */
+    if (bad)
+    {
+      _mm512_storeu_pd(tmp, v_x);
+      for (j = 0; j < 8; ++j)
+        if (bad & (1u << j))
+          tmp[j] = log(x[i+j]);
+      v_x = _mm512_loadu_pd(tmp);
+    }
+
+    _mm512_mask_storeu_pd(y+i, mask, v_x);
+  }
+}
+
+PLL_EXPORT void pll_core_exp_avx512(unsigned int count,
+                                    const double * x,
+                                    double * y)
+{
+  unsigned int i,j;
+  double tmp[8];
+
+  for (i = 0; i < count; i += 8)
+  {
+    __mmask8 mask = (count - i >= 8) ? 0xFF : (__mmask8)((1u << (count-i)) - 1);
+    __mmask8 bad;
+    __m512d v_x = _mm512_mask_loadu_pd(_mm512_set1_pd(0.0), mask, x+i);
+
+    bad = out_of_range_avx512(v_x, -708.0, 708.0);
+    v_x = exp_avx512(v_x);
+
+    /* arguments outside the range are passed to libm */
+    if (bad)
+    {
+      _mm512_storeu_pd(tmp, v_x);
+      for (j = 0; j < 8; ++j)
+        if (bad & (1u << j))
+          tmp[j] = exp(x[i+j]);
+      v_x = _mm512_loadu_pd(tmp);
+    }
+
+    _mm512_mask_storeu_pd(y+i, mask, v_x);
+  }
+}
+
+PLL_EXPORT void pll_core_expm1_avx512(unsigned int count,
+                                      const double * x,
+                                      double * y)
+{
+  unsigned int i,j;
+  double tmp[8];
+
+  for (i = 0; i < count; i += 8)
+  {
+    __mmask8 mask = (count - i >= 8) ? 0xFF : (__mmask8)((1u << (count-i)) - 1);
+    __mmask8 bad;
+    __m512d v_x = _mm512_mask_loadu_pd(_mm512_set1_pd(0.0), mask, x+i);
+
+    bad = out_of_range_avx512(v_x, -HUGE_VAL, 708.0);
+    v_x = expm1_avx512(v_x);
+
+    /* arguments outside the range are passed to libm */
+    if (bad)
+    {
+      _mm512_storeu_pd(tmp, v_x);
+      for (j = 0; j < 8; ++j)
+        if (bad & (1u << j))
+          tmp[j] = expm1(x[i+j]);
+      v_x = _mm512_loadu_pd(tmp);
+    }
+
+    _mm512_mask_storeu_pd(y+i, mask, v_x);
+  }
+}
+
+/* adds the log-likelihoods of count consecutive sites to logl, given their
+   likelihoods and the number of times they were scaled. The likelihoods in
+   site_lk are overwritten and persite_lnl may be NULL */
+PLL_EXPORT double pll_core_site_loglikelihoods_avx512(unsigned int count,
+                                                      double * site_lk,
+                                                      const unsigned int * site_scalings,
+                                                      const unsigned int * pattern_weights,
+                                                      double * persite_lnl,
+                                                      double logl)
+{
+  unsigned int i;
+  double term;
+
+  pll_core_log_avx512(count, site_lk, site_lk);
+
+  for (i = 0; i < count; ++i)
+  {
+    term = site_lk[i];
+    if (site_scalings[i])
+      term += site_scalings[i] * log(PLL_SCALE_THRESHOLD);
+
+    term *= pattern_weights[i];
+
+    if (persite_lnl)
+      persite_lnl[i] = term;
+
+    logl += term;
+  }
+
+  return logl;
+}
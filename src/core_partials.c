@@ -176,6 +176,34 @@ PLL_EXPORT void pll_core_update_partial_tt(unsigned int states,
     return;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    /* the AVX lookup kernels are memory bound, so we reuse them */
+    if (states == 4)
+      pll_core_update_partial_tt_4x4_avx(sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         parent_scaler,
+                                         left_tipchars,
+                                         right_tipchars,
+                                         lookup,
+                                         attrib);
+    else
+      pll_core_update_partial_tt_avx(states,
+                                     sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_tipchars,
+                                     right_tipchars,
+                                     lookup,
+                                     tipmap_size,
+                                     attrib);
+
+    return;
+  }
+  #endif
 
   unsigned int span = states * rate_cats;
   unsigned int log2_maxstates = (unsigned int)ceil(log2(tipmap_size));
@@ -269,6 +297,22 @@ PLL_EXPORT void pll_core_update_partial_ti_4x4(unsigned int sites,
     return;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_ti_4x4_avx512(sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_tipchars,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          right_scaler,
+                                          attrib);
+    return;
+  }
+  #endif
 
   /* init scaling-related stuff */
   if (parent_scaler)
@@ -443,6 +487,25 @@ PLL_EXPORT void pll_core_update_partial_ti(unsigned int states,
     return;
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_ti_avx512(states,
+                                      sites,
+                                      rate_cats,
+                                      parent_clv,
+                                      parent_scaler,
+                                      left_tipchars,
+                                      right_clv,
+                                      left_matrix,
+                                      right_matrix,
+                                      right_scaler,
+                                      tipmap,
+                                      tipmap_size,
+                                      attrib);
+    return;
+  }
+#endif
 
   if (states == 4)
   {
@@ -578,15 +641,24 @@ PLL_EXPORT void pll_core_update_partial_repeats(unsigned int states,
 #ifdef HAVE_AVX2 
   if (attrib & PLL_ATTRIB_ARCH_AVX2 &&  PLL_STAT(avx2_present))
   { 
-    core_update_partials = pll_core_update_partial_repeats_generic_avx2;
-    if (states == 4) 
+    if (use_bclv)
+      core_update_partials = pll_core_update_partial_repeatsbclv_generic_avx2;
+    else if (states == 4)
     {
       // for DNA, avx is faster than avx2
-      if (use_bclv)
-        core_update_partials = pll_core_update_partial_repeatsbclv_4x4_avx;
-      else  
-        core_update_partials = pll_core_update_partial_repeats_4x4_avx;
+      core_update_partials = pll_core_update_partial_repeats_4x4_avx;
     }
+    else
+      core_update_partials = pll_core_update_partial_repeats_generic_avx2;
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 &&  PLL_STAT(avx512f_present))
+  {
+    if (use_bclv)
+      core_update_partials = pll_core_update_partial_repeatsbclv_generic_avx512;
+    else
+      core_update_partials = pll_core_update_partial_repeats_generic_avx512;
   }
 #endif
    core_update_partials(states,
@@ -687,6 +759,24 @@ PLL_EXPORT void pll_core_update_partial_ii(unsigned int states,
     return;
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_ii_avx512(states,
+                                      sites,
+                                      rate_cats,
+                                      parent_clv,
+                                      parent_scaler,
+                                      left_clv,
+                                      right_clv,
+                                      left_matrix,
+                                      right_matrix,
+                                      left_scaler,
+                                      right_scaler,
+                                      attrib);
+    return;
+  }
+#endif
 
   /* init scaling-related stuff */
   if (parent_scaler)
@@ -764,6 +854,140 @@ PLL_EXPORT void pll_core_update_partial_ii(unsigned int states,
   }
 }
 
+/* computes the parent CLV from one child only, i.e. at sites at which the
+   other child is undetermined and its term P * 1 is one for each state */
+PLL_EXPORT void pll_core_update_partial_single(unsigned int states,
+                                               unsigned int sites,
+                                               unsigned int rate_cats,
+                                               double * parent_clv,
+                                               unsigned int * parent_scaler,
+                                               const double * child_clv,
+                                               const double * child_matrix,
+                                               const unsigned int * child_scaler,
+                                               unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int site_scale;
+  unsigned int init_mask;
+
+  const double * mat;
+
+  unsigned int states_padded = states;
+
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+    states_padded = (states+1) & 0xFFFFFFFE;
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+    states_padded = (states+3) & 0xFFFFFFFC;
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    pll_core_update_partial_single_avx2(states,
+                                        sites,
+                                        rate_cats,
+                                        parent_clv,
+                                        parent_scaler,
+                                        child_clv,
+                                        child_matrix,
+                                        child_scaler,
+                                        attrib);
+    return;
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_single_avx512(states,
+                                          sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          child_clv,
+                                          child_matrix,
+                                          child_scaler,
+                                          attrib);
+    return;
+  }
+#endif
+
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* init scaling-related stuff */
+  if (parent_scaler)
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+
+    /* the parent scaler is the one of the child */
+    fill_parent_scaler(scaler_size, parent_scaler, child_scaler, NULL);
+  }
+  else
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+
+  /* compute CLV */
+  for (n = 0; n < sites; ++n)
+  {
+    mat = child_matrix;
+    site_scale = init_mask;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      unsigned int rate_scale = 1;
+      for (i = 0; i < states; ++i)
+      {
+        double term = 0;
+        for (j = 0; j < states; ++j)
+          term += mat[j] * child_clv[j];
+        parent_clv[i] = term;
+
+        rate_scale &= (term < PLL_SCALE_THRESHOLD);
+
+        mat += states_padded;
+      }
+      for (; i < states_padded; ++i)
+        parent_clv[i] = 0;
+
+      /* check if scaling is needed for the current rate category */
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_scale)
+        {
+          for (i = 0; i < states; ++i)
+            parent_clv[i] *= PLL_SCALE_FACTOR;
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        site_scale = site_scale && rate_scale;
+
+      parent_clv += states_padded;
+      child_clv  += states_padded;
+    }
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (site_scale)
+    {
+      parent_clv -= span_padded;
+      for (i = 0; i < span_padded; ++i)
+        parent_clv[i] *= PLL_SCALE_FACTOR;
+      parent_clv += span_padded;
+      parent_scaler[n] += 1;
+    }
+  }
+}
+
 PLL_EXPORT void pll_core_update_partial_repeats_generic(unsigned int states,
                                                         unsigned int parent_sites,
                                                         unsigned int left_sites,
@@ -1137,6 +1361,25 @@ PLL_EXPORT void pll_core_create_lookup(unsigned int states,
     return;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    if (states == 4)
+      pll_core_create_lookup_4x4_avx(rate_cats,
+                                     lookup,
+                                     left_matrix,
+                                     right_matrix);
+    else
+      pll_core_create_lookup_avx(states,
+                                 rate_cats,
+                                 lookup,
+                                 left_matrix,
+                                 right_matrix,
+                                 tipmap,
+                                 tipmap_size);
+    return;
+  }
+  #endif
   if (states == 4)
   {
     pll_core_create_lookup_4x4(rate_cats,
@@ -1069,6 +1069,256 @@ PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
   }
 }
 
+/* 4x4 case of pll_core_update_partial_single_avx2(): the p-matrices are
+   transposed once, such that the child CLV entries are broadcast and no
+   horizontal sums are needed */
+static void update_partial_single_4x4_avx2(unsigned int sites,
+                                           unsigned int rate_cats,
+                                           double * parent_clv,
+                                           unsigned int * parent_scaler,
+                                           const double * child_clv,
+                                           const double * child_matrix,
+                                           unsigned int scale_mode)
+{
+  unsigned int i,j,k,n;
+  unsigned int scale_mask;
+  unsigned int span = 4 * rate_cats;
+  __m256d v_scale_threshold = _mm256_set1_pd(PLL_SCALE_THRESHOLD);
+  __m256d v_scale_factor = _mm256_set1_pd(PLL_SCALE_FACTOR);
+
+  double * t = (double *)pll_aligned_alloc(16 * rate_cats * sizeof(double),
+                                           PLL_ALIGNMENT_AVX);
+  if (!t)
+    return;
+
+  for (k = 0; k < rate_cats; ++k)
+    for (i = 0; i < 4; ++i)
+      for (j = 0; j < 4; ++j)
+        t[16*k + 4*j + i] = child_matrix[16*k + 4*i + j];
+
+  for (n = 0; n < sites; ++n)
+  {
+    const double * tk = t;
+    scale_mask = (scale_mode == 1) ? 0xF : 0;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      __m256d v_term = _mm256_mul_pd(_mm256_load_pd(tk),
+                                     _mm256_broadcast_sd(child_clv));
+      v_term = _mm256_fmadd_pd(_mm256_load_pd(tk+4),
+                               _mm256_broadcast_sd(child_clv+1),
+                               v_term);
+      v_term = _mm256_fmadd_pd(_mm256_load_pd(tk+8),
+                               _mm256_broadcast_sd(child_clv+2),
+                               v_term);
+      v_term = _mm256_fmadd_pd(_mm256_load_pd(tk+12),
+                               _mm256_broadcast_sd(child_clv+3),
+                               v_term);
+
+      unsigned int rate_mask = _mm256_movemask_pd(_mm256_cmp_pd(v_term,
+                                                                v_scale_threshold,
+                                                                _CMP_LT_OS));
+
+      /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+       * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+      if (scale_mode == 2 && rate_mask == 0xF)
+      {
+        v_term = _mm256_mul_pd(v_term, v_scale_factor);
+        parent_scaler[n*rate_cats + k] += 1;
+      }
+      scale_mask &= rate_mask;
+
+      _mm256_store_pd(parent_clv, v_term);
+
+      tk += 16;
+      parent_clv += 4;
+      child_clv  += 4;
+    }
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask == 0xF)
+    {
+      parent_clv -= span;
+      for (i = 0; i < span; i += 4)
+      {
+        __m256d v_prod = _mm256_load_pd(parent_clv + i);
+        v_prod = _mm256_mul_pd(v_prod,v_scale_factor);
+        _mm256_store_pd(parent_clv + i, v_prod);
+      }
+      parent_clv += span;
+      parent_scaler[n] += 1;
+    }
+  }
+
+  pll_aligned_free(t);
+}
+
+PLL_EXPORT void pll_core_update_partial_single_avx2(unsigned int states,
+                                                    unsigned int sites,
+                                                    unsigned int rate_cats,
+                                                    double * parent_clv,
+                                                    unsigned int * parent_scaler,
+                                                    const double * child_clv,
+                                                    const double * child_matrix,
+                                                    const unsigned int * child_scaler,
+                                                    unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+
+  const double * mat;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int scale_mask;
+  unsigned int init_mask;
+  __m256d v_scale_threshold = _mm256_set1_pd(PLL_SCALE_THRESHOLD);
+  __m256d v_scale_factor = _mm256_set1_pd(PLL_SCALE_FACTOR);
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 0xF : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* the parent scaler is the one of the child */
+    fill_parent_scaler(scaler_size, parent_scaler, child_scaler, NULL);
+  }
+
+  if (states == 4)
+  {
+    update_partial_single_4x4_avx2(sites,
+                                   rate_cats,
+                                   parent_clv,
+                                   parent_scaler,
+                                   child_clv,
+                                   child_matrix,
+                                   scale_mode);
+    return;
+  }
+
+  size_t displacement = (states_padded - states) * (states_padded);
+
+  /* compute CLV */
+  for (n = 0; n < sites; ++n)
+  {
+    mat = child_matrix;
+    scale_mask = init_mask;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      unsigned int rate_mask = 0xF;
+
+      /* iterate over quadruples of rows */
+      for (i = 0; i < states_padded; i += 4)
+      {
+        __m256d v_term0 = _mm256_setzero_pd();
+        __m256d v_term1 = _mm256_setzero_pd();
+        __m256d v_term2 = _mm256_setzero_pd();
+        __m256d v_term3 = _mm256_setzero_pd();
+
+        __m256d v_clv;
+
+        /* point to the four rows of the matrix */
+        const double * m0 = mat;
+        const double * m1 = m0 + states_padded;
+        const double * m2 = m1 + states_padded;
+        const double * m3 = m2 + states_padded;
+
+        /* iterate over quadruples of columns */
+        for (j = 0; j < states_padded; j += 4)
+        {
+          v_clv   = _mm256_load_pd(child_clv+j);
+
+          v_term0 = _mm256_fmadd_pd(_mm256_load_pd(m0), v_clv, v_term0);
+          v_term1 = _mm256_fmadd_pd(_mm256_load_pd(m1), v_clv, v_term1);
+          v_term2 = _mm256_fmadd_pd(_mm256_load_pd(m2), v_clv, v_term2);
+          v_term3 = _mm256_fmadd_pd(_mm256_load_pd(m3), v_clv, v_term3);
+
+          m0 += 4;
+          m1 += 4;
+          m2 += 4;
+          m3 += 4;
+        }
+
+        /* point pmatrix to the next four rows */
+        mat = m3;
+
+        __m256d xmm0 = _mm256_unpackhi_pd(v_term0,v_term1);
+        __m256d xmm1 = _mm256_unpacklo_pd(v_term0,v_term1);
+
+        __m256d xmm2 = _mm256_unpackhi_pd(v_term2,v_term3);
+        __m256d xmm3 = _mm256_unpacklo_pd(v_term2,v_term3);
+
+        xmm0 = _mm256_add_pd(xmm0,xmm1);
+        xmm1 = _mm256_add_pd(xmm2,xmm3);
+
+        xmm2 = _mm256_permute2f128_pd(xmm0,xmm1, _MM_SHUFFLE(0,2,0,1));
+
+        xmm3 = _mm256_blend_pd(xmm0,xmm1,12);
+
+        __m256d v_term_sum = _mm256_add_pd(xmm2,xmm3);
+
+        /* check if scaling is needed for the current rate category */
+        __m256d v_cmp = _mm256_cmp_pd(v_term_sum,
+                                      v_scale_threshold,
+                                      _CMP_LT_OS);
+        rate_mask = rate_mask & _mm256_movemask_pd(v_cmp);
+
+        _mm256_store_pd(parent_clv+i, v_term_sum);
+      }
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_mask == 0xF)
+        {
+          for (i = 0; i < states_padded; i += 4)
+          {
+            __m256d v_prod = _mm256_load_pd(parent_clv + i);
+            v_prod = _mm256_mul_pd(v_prod, v_scale_factor);
+            _mm256_store_pd(parent_clv + i, v_prod);
+          }
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        scale_mask = scale_mask & rate_mask;
+
+      /* reset the pointer to the start of the next p-matrix, as in
+         pll_core_update_partial_ii_avx2() */
+      mat -= displacement;
+
+      parent_clv += states_padded;
+      child_clv  += states_padded;
+    }
+
+    /* if *all* entries of the site CLV were below the threshold then scale
+       (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask == 0xF)
+    {
+      parent_clv -= span_padded;
+      for (i = 0; i < span_padded; i += 4)
+      {
+        __m256d v_prod = _mm256_load_pd(parent_clv + i);
+        v_prod = _mm256_mul_pd(v_prod,v_scale_factor);
+        _mm256_store_pd(parent_clv + i, v_prod);
+      }
+      parent_clv += span_padded;
+      parent_scaler[n] += 1;
+    }
+  }
+}
+
 PLL_EXPORT void pll_core_update_partial_repeats_20x20_avx2(unsigned int parent_sites,
                                                            unsigned int left_sites,
                                                            unsigned int right_sites,
@@ -1528,3 +1778,228 @@ PLL_EXPORT void pll_core_update_partial_repeats_generic_avx2(unsigned int states
   }
 }
 
+
+/* product of the four p-matrix rows starting at mat (of states_padded
+   columns each) with clv */
+static inline __m256d matrix_quad(unsigned int states_padded,
+                                  const double * mat,
+                                  const double * clv)
+{
+  unsigned int j;
+
+  const double * m0 = mat;
+  const double * m1 = m0 + states_padded;
+  const double * m2 = m1 + states_padded;
+  const double * m3 = m2 + states_padded;
+
+  __m256d v_term0 = _mm256_setzero_pd();
+  __m256d v_term1 = _mm256_setzero_pd();
+  __m256d v_term2 = _mm256_setzero_pd();
+  __m256d v_term3 = _mm256_setzero_pd();
+
+  for (j = 0; j < states_padded; j += 4)
+  {
+    __m256d v_clv = _mm256_load_pd(clv+j);
+
+    v_term0 = _mm256_fmadd_pd(_mm256_load_pd(m0+j), v_clv, v_term0);
+    v_term1 = _mm256_fmadd_pd(_mm256_load_pd(m1+j), v_clv, v_term1);
+    v_term2 = _mm256_fmadd_pd(_mm256_load_pd(m2+j), v_clv, v_term2);
+    v_term3 = _mm256_fmadd_pd(_mm256_load_pd(m3+j), v_clv, v_term3);
+  }
+
+  __m256d xmm0 = _mm256_unpackhi_pd(v_term0,v_term1);
+  __m256d xmm1 = _mm256_unpacklo_pd(v_term0,v_term1);
+
+  __m256d xmm2 = _mm256_unpackhi_pd(v_term2,v_term3);
+  __m256d xmm3 = _mm256_unpacklo_pd(v_term2,v_term3);
+
+  xmm0 = _mm256_add_pd(xmm0,xmm1);
+  xmm1 = _mm256_add_pd(xmm2,xmm3);
+
+  xmm2 = _mm256_permute2f128_pd(xmm0,xmm1, _MM_SHUFFLE(0,2,0,1));
+
+  xmm3 = _mm256_blend_pd(xmm0,xmm1,12);
+
+  return _mm256_add_pd(xmm2,xmm3);
+}
+
+/* body of the bclv repeats kernel. The left terms are computed once per
+   left class into bclv_buffer and then looked up for each parent site. It is
+   inlined with constant states_padded for 4 and 20 states */
+static inline __attribute__((always_inline))
+void update_partial_repeatsbclv(unsigned int states,
+                                unsigned int states_padded,
+                                unsigned int parent_sites,
+                                unsigned int left_sites,
+                                unsigned int rate_cats,
+                                double * parent_clv,
+                                unsigned int * parent_scaler,
+                                const double * left_clv,
+                                const double * right_clv,
+                                const double * left_matrix,
+                                const double * right_matrix,
+                                const unsigned int * parent_id_site,
+                                const unsigned int * left_site_id,
+                                const unsigned int * right_site_id,
+                                double * bclv_buffer,
+                                unsigned int scale_mode)
+{
+  unsigned int i,k,n;
+
+  unsigned int span_padded = states_padded * rate_cats;
+  size_t matrix_size = states * states_padded;
+
+  unsigned int scale_mask;
+  unsigned int init_mask = (scale_mode == 1) ? 0xF : 0;
+  __m256d v_scale_threshold = _mm256_set1_pd(PLL_SCALE_THRESHOLD);
+  __m256d v_scale_factor = _mm256_set1_pd(PLL_SCALE_FACTOR);
+
+  /* left terms of each left class */
+  double * left_res = bclv_buffer;
+  for (n = 0; n < left_sites; ++n)
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * lmat = left_matrix + k*matrix_size;
+
+      for (i = 0; i < states_padded; i += 4)
+        _mm256_store_pd(left_res+i,
+                        matrix_quad(states_padded,
+                                    lmat + i*states_padded,
+                                    left_clv));
+
+      left_clv += states_padded;
+      left_res += states_padded;
+    }
+  }
+
+  for (n = 0; n < parent_sites; ++n)
+  {
+    unsigned int site = PLL_GET_SITE(parent_id_site, n);
+    unsigned int lid = PLL_GET_ID(left_site_id, site);
+    unsigned int rid = PLL_GET_ID(right_site_id, site);
+    const double * lres = &bclv_buffer[lid * span_padded];
+    const double * rclv = &right_clv[rid * span_padded];
+
+    scale_mask = init_mask;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * rmat = right_matrix + k*matrix_size;
+      unsigned int rate_mask = 0xF;
+
+      for (i = 0; i < states_padded; i += 4)
+      {
+        __m256d v_prod = _mm256_mul_pd(_mm256_load_pd(lres+i),
+                                       matrix_quad(states_padded,
+                                                   rmat + i*states_padded,
+                                                   rclv));
+
+        /* check if scaling is needed for the current rate category */
+        __m256d v_cmp = _mm256_cmp_pd(v_prod, v_scale_threshold, _CMP_LT_OS);
+        rate_mask = rate_mask & _mm256_movemask_pd(v_cmp);
+
+        _mm256_store_pd(parent_clv+i, v_prod);
+      }
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_mask == 0xF)
+        {
+          for (i = 0; i < states_padded; i += 4)
+          {
+            __m256d v_prod = _mm256_load_pd(parent_clv + i);
+            v_prod = _mm256_mul_pd(v_prod, v_scale_factor);
+            _mm256_store_pd(parent_clv + i, v_prod);
+          }
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        scale_mask = scale_mask & rate_mask;
+
+      parent_clv += states_padded;
+      lres += states_padded;
+      rclv += states_padded;
+    }
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask == 0xF)
+    {
+      parent_clv -= span_padded;
+      for (i = 0; i < span_padded; i += 4)
+      {
+        __m256d v_prod = _mm256_load_pd(parent_clv + i);
+        v_prod = _mm256_mul_pd(v_prod,v_scale_factor);
+        _mm256_store_pd(parent_clv + i, v_prod);
+      }
+      parent_clv += span_padded;
+      parent_scaler[n] += 1;
+    }
+  }
+}
+
+PLL_EXPORT void pll_core_update_partial_repeatsbclv_generic_avx2(unsigned int states,
+                                                                 unsigned int parent_sites,
+                                                                 unsigned int left_sites,
+                                                                 unsigned int right_sites,
+                                                                 unsigned int rate_cats,
+                                                                 double * parent_clv,
+                                                                 unsigned int * parent_scaler,
+                                                                 const double * left_clv,
+                                                                 const double * right_clv,
+                                                                 const double * left_matrix,
+                                                                 const double * right_matrix,
+                                                                 const unsigned int * left_scaler,
+                                                                 const unsigned int * right_scaler,
+                                                                 const unsigned int * parent_id_site,
+                                                                 const unsigned int * left_site_id,
+                                                                 const unsigned int * right_site_id,
+                                                                 double * bclv_buffer,
+                                                                 unsigned int attrib)
+{
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    /* add up the scale vector of the two children if available */
+    if (scale_mode == 2)
+      pll_fill_parent_scaler_repeats_per_rate(parent_sites, rate_cats, parent_scaler, parent_id_site,
+        left_scaler, left_site_id, right_scaler, right_site_id);
+    else
+      pll_fill_parent_scaler_repeats(parent_sites, parent_scaler, parent_id_site,
+        left_scaler, left_site_id, right_scaler, right_site_id);
+  }
+
+  /* dedicated instances for DNA and protein data */
+  if (states == 4)
+    update_partial_repeatsbclv(4, 4, parent_sites, left_sites, rate_cats,
+                               parent_clv, parent_scaler, left_clv, right_clv,
+                               left_matrix, right_matrix, parent_id_site,
+                               left_site_id, right_site_id, bclv_buffer,
+                               scale_mode);
+  else if (states == 20)
+    update_partial_repeatsbclv(20, 20, parent_sites, left_sites, rate_cats,
+                               parent_clv, parent_scaler, left_clv, right_clv,
+                               left_matrix, right_matrix, parent_id_site,
+                               left_site_id, right_site_id, bclv_buffer,
+                               scale_mode);
+  else
+    update_partial_repeatsbclv(states, (states+3) & 0xFFFFFFFC, parent_sites,
+                               left_sites, rate_cats, parent_clv,
+                               parent_scaler, left_clv, right_clv,
+                               left_matrix, right_matrix, parent_id_site,
+                               left_site_id, right_site_id, bclv_buffer,
+                               scale_mode);
+}
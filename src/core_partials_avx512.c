@@ -0,0 +1,1235 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* The AVX-512 kernels keep the AVX memory layout (states padded to a multiple
+   of four), hence CLVs are only guaranteed to be 32-byte aligned and the last
+   quadruple of a rate category is handled with masked loads and stores.
+
+   Instead of computing dot products of p-matrix rows with the child CLV
+   (which requires horizontal reductions), the p-matrices are transposed once
+   per call (rows padded to full vectors) and the CLV entries are broadcast,
+   i.e. for each rate category
+
+     parent[0..states) += P^T[j][0..states) * child[j],  j = 0..states-1
+
+   For 4 states, two consecutive rate categories are packed in one vector. */
+
+#define BLOCK_MASK(n) (((n) >= 8) ? 0xFF : 0x0F)
+
+static void fill_parent_scaler(unsigned int scaler_size,
+                               unsigned int * parent_scaler,
+                               const unsigned int * left_scaler,
+                               const unsigned int * right_scaler)
+{
+  unsigned int i;
+
+  if (!left_scaler && !right_scaler)
+    memset(parent_scaler, 0, sizeof(unsigned int) * scaler_size);
+  else if (left_scaler && right_scaler)
+  {
+    memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    for (i = 0; i < scaler_size; ++i)
+      parent_scaler[i] += right_scaler[i];
+  }
+  else
+  {
+    if (left_scaler)
+      memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    else
+      memcpy(parent_scaler, right_scaler, sizeof(unsigned int) * scaler_size);
+  }
+}
+
+/* row stride of a transposed matrix; rows are padded to full vectors so that
+   they can be read with aligned loads */
+#define TRANSPOSED_STRIDE(states) (((states)+7) & 0xFFFFFFF8)
+
+/* transpose the states x states_padded p-matrix of each rate category, such
+   that row j of the result holds column j of the original; padding is zero */
+static double * transpose_matrix(unsigned int states,
+                                 unsigned int states_padded,
+                                 unsigned int rate_cats,
+                                 const double * matrix)
+{
+  unsigned int i,j,k;
+  unsigned int stride = TRANSPOSED_STRIDE(states);
+  size_t matrix_size = states * states_padded;
+  size_t transposed_size = states * stride;
+
+  double * t = (double *)pll_aligned_alloc(transposed_size * rate_cats *
+                                           sizeof(double),
+                                           PLL_ALIGNMENT_AVX512);
+  if (!t)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return NULL;
+  }
+  memset(t, 0, transposed_size * rate_cats * sizeof(double));
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    double * tk = t + k*transposed_size;
+    const double * mk = matrix + k*matrix_size;
+
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        tk[j*stride + i] = mk[i*states_padded + j];
+  }
+
+  return t;
+}
+
+/* interleave the columns of the 4x4 p-matrices of two consecutive rate
+   categories: vector j of pair p holds column j of rate 2p in lanes 0-3 and
+   column j of rate 2p+1 in lanes 4-7 */
+static double * pair_matrix_4x4(unsigned int rate_cats, const double * matrix)
+{
+  unsigned int i,j,k;
+  unsigned int pairs = (rate_cats+1) / 2;
+
+  double * t = (double *)pll_aligned_alloc(pairs * 32 * sizeof(double),
+                                           PLL_ALIGNMENT_AVX512);
+  if (!t)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return NULL;
+  }
+  memset(t, 0, pairs * 32 * sizeof(double));
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    double * pt = t + (k >> 1)*32 + (k & 1)*4;
+    for (i = 0; i < 4; ++i)
+      for (j = 0; j < 4; ++j)
+        pt[j*8 + i] = matrix[k*16 + i*4 + j];
+  }
+
+  return t;
+}
+
+/* precompute the left terms of the p-matrix for every tip state (or state
+   combination). If tipmap is NULL, the state code is the 4-bit nucleotide
+   mask itself */
+static double * create_tip_lookup(unsigned int states,
+                                  unsigned int states_padded,
+                                  unsigned int rate_cats,
+                                  const double * matrix,
+                                  const pll_state_t * tipmap,
+                                  unsigned int tipmap_size,
+                                  unsigned int * lookup_span)
+{
+  unsigned int i,j,k,n;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* round up to full vectors so that the last (half) rate pair can be read
+     without masking in the 4x4 kernels */
+  span_padded = (span_padded + 7) & 0xFFFFFFF8;
+
+  double * lookup = (double *)pll_aligned_alloc(tipmap_size * span_padded *
+                                                sizeof(double),
+                                                PLL_ALIGNMENT_AVX512);
+  if (!lookup)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return NULL;
+  }
+  memset(lookup, 0, tipmap_size * span_padded * sizeof(double));
+
+  for (n = 0; n < tipmap_size; ++n)
+  {
+    pll_state_t state = tipmap ? tipmap[n] : n;
+    double * lterm = lookup + n*span_padded;
+    const double * lmat = matrix;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      for (i = 0; i < states; ++i)
+      {
+        double terma = 0;
+        for (j = 0; j < states; ++j)
+          if ((state >> j) & 1)
+            terma += lmat[j];
+        lterm[i] = terma;
+        lmat += states_padded;
+      }
+      lterm += states_padded;
+    }
+  }
+
+  *lookup_span = span_padded;
+  return lookup;
+}
+
+static void scale_site_clv(double * clv, unsigned int span_padded)
+{
+  unsigned int i;
+  __m512d v_scale_factor = _mm512_set1_pd(PLL_SCALE_FACTOR);
+
+  for (i = 0; i < span_padded; i += 8)
+  {
+    __mmask8 m = BLOCK_MASK(span_padded - i);
+    __m512d v_clv = _mm512_maskz_loadu_pd(m, clv + i);
+    _mm512_mask_storeu_pd(clv + i, m, _mm512_mul_pd(v_clv, v_scale_factor));
+  }
+}
+
+/* multiply a block of (at most four) vectors, starting at column offset of the
+   transposed matrix t, with clv; blocks is a compile-time constant in all
+   callers such that the accumulators are kept in registers. Odd and even
+   states are accumulated separately, which yields up to eight independent
+   FMA chains */
+#define BLOCK_FMADD(acc,row,c,b) \
+  acc = _mm512_fmadd_pd(_mm512_load_pd((row) + 8*(b)), c, acc)
+
+static inline __attribute__((always_inline))
+void matrix_clv_block(unsigned int states,
+                      unsigned int states_padded,
+                      unsigned int offset,
+                      const unsigned int blocks,
+                      double * out,
+                      const double * clv,
+                      const double * t,
+                      int multiply)
+{
+  unsigned int j,b;
+  unsigned int stride = TRANSPOSED_STRIDE(states);
+
+  __m512d v_even0 = _mm512_setzero_pd();
+  __m512d v_even1 = _mm512_setzero_pd();
+  __m512d v_even2 = _mm512_setzero_pd();
+  __m512d v_even3 = _mm512_setzero_pd();
+  __m512d v_odd0 = _mm512_setzero_pd();
+  __m512d v_odd1 = _mm512_setzero_pd();
+  __m512d v_odd2 = _mm512_setzero_pd();
+  __m512d v_odd3 = _mm512_setzero_pd();
+
+  const double * tj = t + offset;
+  for (j = 0; j + 1 < states; j += 2)
+  {
+    __m512d v_c0 = _mm512_set1_pd(clv[j]);
+    __m512d v_c1 = _mm512_set1_pd(clv[j+1]);
+
+    BLOCK_FMADD(v_even0, tj, v_c0, 0);
+    BLOCK_FMADD(v_odd0, tj + stride, v_c1, 0);
+    if (blocks > 1)
+    {
+      BLOCK_FMADD(v_even1, tj, v_c0, 1);
+      BLOCK_FMADD(v_odd1, tj + stride, v_c1, 1);
+    }
+    if (blocks > 2)
+    {
+      BLOCK_FMADD(v_even2, tj, v_c0, 2);
+      BLOCK_FMADD(v_odd2, tj + stride, v_c1, 2);
+    }
+    if (blocks > 3)
+    {
+      BLOCK_FMADD(v_even3, tj, v_c0, 3);
+      BLOCK_FMADD(v_odd3, tj + stride, v_c1, 3);
+    }
+    tj += 2*stride;
+  }
+  if (j < states)
+  {
+    __m512d v_c0 = _mm512_set1_pd(clv[j]);
+
+    BLOCK_FMADD(v_even0, tj, v_c0, 0);
+    if (blocks > 1) BLOCK_FMADD(v_even1, tj, v_c0, 1);
+    if (blocks > 2) BLOCK_FMADD(v_even2, tj, v_c0, 2);
+    if (blocks > 3) BLOCK_FMADD(v_even3, tj, v_c0, 3);
+  }
+
+  v_even0 = _mm512_add_pd(v_even0, v_odd0);
+  v_even1 = _mm512_add_pd(v_even1, v_odd1);
+  v_even2 = _mm512_add_pd(v_even2, v_odd2);
+  v_even3 = _mm512_add_pd(v_even3, v_odd3);
+
+  for (b = 0; b < blocks; ++b)
+  {
+    __mmask8 m = BLOCK_MASK(states_padded - offset - 8*b);
+    __m512d v_term = (b == 0) ? v_even0 : (b == 1) ? v_even1 :
+                     (b == 2) ? v_even2 : v_even3;
+    if (multiply)
+      v_term = _mm512_mul_pd(v_term,
+                             _mm512_maskz_loadu_pd(m, out + offset + 8*b));
+    _mm512_mask_storeu_pd(out + offset + 8*b, m, v_term);
+  }
+}
+
+/* compute out[0..states_padded) = P * clv for one rate category, with t the
+   transposed matrix, or multiply out by P * clv if multiply is set */
+static inline __attribute__((always_inline))
+void matrix_clv_product(unsigned int states,
+                        unsigned int states_padded,
+                        double * out,
+                        const double * clv,
+                        const double * t,
+                        int multiply)
+{
+  unsigned int i;
+
+  for (i = 0; i + 32 <= states_padded; i += 32)
+    matrix_clv_block(states, states_padded, i, 4, out, clv, t, multiply);
+
+  switch ((states_padded - i + 7) / 8)
+  {
+    case 1:
+      matrix_clv_block(states, states_padded, i, 1, out, clv, t, multiply);
+      break;
+    case 2:
+      matrix_clv_block(states, states_padded, i, 2, out, clv, t, multiply);
+      break;
+    case 3:
+      matrix_clv_block(states, states_padded, i, 3, out, clv, t, multiply);
+      break;
+  }
+}
+
+/* compute the CLV of a single site. The left terms are either precomputed
+   (lterm, tip child) or computed from left_clv and the transposed matrix lt.
+   In per-rate scaling mode (rate_scaler != NULL) scaling is applied directly;
+   otherwise, returns non-zero if all entries fell below the threshold */
+static inline __attribute__((always_inline))
+int site_partial(unsigned int states,
+                 unsigned int states_padded,
+                 unsigned int rate_cats,
+                 double * parent_clv,
+                 unsigned int * rate_scaler,
+                 const double * lterm,
+                 const double * left_clv,
+                 const double * right_clv,
+                 const double * lt,
+                 const double * rt)
+{
+  unsigned int i,k;
+  size_t matrix_size = states * TRANSPOSED_STRIDE(states);
+  int site_scale = 1;
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    int rate_scale = 1;
+
+    /* the left terms are written to parent_clv first and then multiplied by
+       the right terms; precomputed left terms are multiplied in below */
+    if (!lterm)
+      matrix_clv_product(states, states_padded, parent_clv, left_clv, lt, 0);
+    matrix_clv_product(states, states_padded, parent_clv, right_clv, rt,
+                       !lterm);
+
+    for (i = 0; i < states_padded; i += 8)
+    {
+      __mmask8 m = BLOCK_MASK(states_padded - i);
+      __m512d v_prod = _mm512_maskz_loadu_pd(m, parent_clv + i);
+      if (lterm)
+        v_prod = _mm512_mul_pd(v_prod, _mm512_maskz_loadu_pd(m, lterm + i));
+
+      __mmask8 below = _mm512_cmp_pd_mask(v_prod,
+                                          v_scale_threshold,
+                                          _CMP_LT_OS);
+      rate_scale &= ((below & m) == m);
+
+      _mm512_mask_storeu_pd(parent_clv + i, m, v_prod);
+    }
+
+    if (rate_scaler)
+    {
+      /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+       * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+      if (rate_scale)
+      {
+        scale_site_clv(parent_clv, states_padded);
+        rate_scaler[k] += 1;
+      }
+    }
+    else
+      site_scale &= rate_scale;
+
+    parent_clv += states_padded;
+    right_clv  += states_padded;
+    rt += matrix_size;
+    if (lterm)
+      lterm += states_padded;
+    else
+    {
+      left_clv += states_padded;
+      lt += matrix_size;
+    }
+  }
+
+  return site_scale;
+}
+
+/* 4x4 counterpart of site_partial() with two rate categories per vector, lt
+   and rt are created with pair_matrix_4x4() */
+static inline __attribute__((always_inline))
+int site_partial_4x4(unsigned int rate_cats,
+                     double * parent_clv,
+                     unsigned int * rate_scaler,
+                     const double * lterm,
+                     const double * left_clv,
+                     const double * right_clv,
+                     const double * lt,
+                     const double * rt)
+{
+  unsigned int k;
+  int site_scale = 1;
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+  __m512d v_scale_factor = _mm512_set1_pd(PLL_SCALE_FACTOR);
+
+  /* broadcast state j of each of the two rate categories */
+  const __m512i v_idx0 = _mm512_set_epi64(4,4,4,4,0,0,0,0);
+  const __m512i v_idx1 = _mm512_set_epi64(5,5,5,5,1,1,1,1);
+  const __m512i v_idx2 = _mm512_set_epi64(6,6,6,6,2,2,2,2);
+  const __m512i v_idx3 = _mm512_set_epi64(7,7,7,7,3,3,3,3);
+
+  for (k = 0; k < rate_cats; k += 2)
+  {
+    __mmask8 m = BLOCK_MASK(4*(rate_cats - k));
+    __m512d v_clv;
+    __m512d v_terma;
+    __m512d v_termb;
+
+    if (lterm)
+      v_terma = _mm512_maskz_loadu_pd(m, lterm);
+    else
+    {
+      v_clv = _mm512_maskz_loadu_pd(m, left_clv);
+      v_terma = _mm512_mul_pd(_mm512_load_pd(lt),
+                              _mm512_permutexvar_pd(v_idx0, v_clv));
+      v_terma = _mm512_fmadd_pd(_mm512_load_pd(lt+8),
+                                _mm512_permutexvar_pd(v_idx1, v_clv),
+                                v_terma);
+      v_terma = _mm512_fmadd_pd(_mm512_load_pd(lt+16),
+                                _mm512_permutexvar_pd(v_idx2, v_clv),
+                                v_terma);
+      v_terma = _mm512_fmadd_pd(_mm512_load_pd(lt+24),
+                                _mm512_permutexvar_pd(v_idx3, v_clv),
+                                v_terma);
+    }
+
+    v_clv = _mm512_maskz_loadu_pd(m, right_clv);
+    v_termb = _mm512_mul_pd(_mm512_load_pd(rt),
+                            _mm512_permutexvar_pd(v_idx0, v_clv));
+    v_termb = _mm512_fmadd_pd(_mm512_load_pd(rt+8),
+                              _mm512_permutexvar_pd(v_idx1, v_clv),
+                              v_termb);
+    v_termb = _mm512_fmadd_pd(_mm512_load_pd(rt+16),
+                              _mm512_permutexvar_pd(v_idx2, v_clv),
+                              v_termb);
+    v_termb = _mm512_fmadd_pd(_mm512_load_pd(rt+24),
+                              _mm512_permutexvar_pd(v_idx3, v_clv),
+                              v_termb);
+
+    __m512d v_prod = _mm512_mul_pd(v_terma, v_termb);
+
+    /* lanes outside the site count as below the threshold */
+    __mmask8 below = _mm512_cmp_pd_mask(v_prod, v_scale_threshold, _CMP_LT_OS)
+                     | (__mmask8)~m;
+    int lo_scale = (below & 0x0F) == 0x0F;
+    int hi_scale = (below & 0xF0) == 0xF0;
+
+    if (rate_scaler)
+    {
+      /* PER-RATE SCALING: scale the rate categories whose entries are *all*
+         below the threshold */
+      __mmask8 scale_mask = (lo_scale ? 0x0F : 0) | (hi_scale ? 0xF0 : 0);
+      v_prod = _mm512_mask_mul_pd(v_prod, scale_mask, v_prod, v_scale_factor);
+      rate_scaler[k] += lo_scale;
+      if (k+1 < rate_cats)
+        rate_scaler[k+1] += hi_scale;
+    }
+    else
+      site_scale &= lo_scale & hi_scale;
+
+    _mm512_mask_storeu_pd(parent_clv, m, v_prod);
+
+    parent_clv += 8;
+    right_clv  += 8;
+    rt += 32;
+    if (lterm)
+      lterm += 8;
+    else
+    {
+      left_clv += 8;
+      lt += 32;
+    }
+  }
+
+  return site_scale;
+}
+
+/* precompute the left terms of a site CLV, i.e. lterm = P * left_clv for each
+   rate category, with lt created by transpose_matrix() */
+static inline void site_left_terms(unsigned int states,
+                                   unsigned int states_padded,
+                                   unsigned int rate_cats,
+                                   double * lterm,
+                                   const double * left_clv,
+                                   const double * lt)
+{
+  unsigned int k;
+  size_t matrix_size = states * TRANSPOSED_STRIDE(states);
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    matrix_clv_product(states, states_padded, lterm, left_clv, lt, 0);
+
+    lterm += states_padded;
+    left_clv += states_padded;
+    lt += matrix_size;
+  }
+}
+
+/* 4x4 counterpart of site_left_terms(), lt is created with pair_matrix_4x4() */
+static inline void site_left_terms_4x4(unsigned int rate_cats,
+                                       double * lterm,
+                                       const double * left_clv,
+                                       const double * lt)
+{
+  unsigned int k;
+
+  const __m512i v_idx0 = _mm512_set_epi64(4,4,4,4,0,0,0,0);
+  const __m512i v_idx1 = _mm512_set_epi64(5,5,5,5,1,1,1,1);
+  const __m512i v_idx2 = _mm512_set_epi64(6,6,6,6,2,2,2,2);
+  const __m512i v_idx3 = _mm512_set_epi64(7,7,7,7,3,3,3,3);
+
+  for (k = 0; k < rate_cats; k += 2)
+  {
+    __mmask8 m = BLOCK_MASK(4*(rate_cats - k));
+    __m512d v_clv = _mm512_maskz_loadu_pd(m, left_clv);
+    __m512d v_terma;
+
+    v_terma = _mm512_mul_pd(_mm512_load_pd(lt),
+                            _mm512_permutexvar_pd(v_idx0, v_clv));
+    v_terma = _mm512_fmadd_pd(_mm512_load_pd(lt+8),
+                              _mm512_permutexvar_pd(v_idx1, v_clv),
+                              v_terma);
+    v_terma = _mm512_fmadd_pd(_mm512_load_pd(lt+16),
+                              _mm512_permutexvar_pd(v_idx2, v_clv),
+                              v_terma);
+    v_terma = _mm512_fmadd_pd(_mm512_load_pd(lt+24),
+                              _mm512_permutexvar_pd(v_idx3, v_clv),
+                              v_terma);
+
+    _mm512_mask_storeu_pd(lterm, m, v_terma);
+
+    lterm += 8;
+    left_clv += 8;
+    lt += 32;
+  }
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const double * left_clv,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * left_scaler,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib)
+{
+  unsigned int n;
+  unsigned int span_padded = 4 * rate_cats;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+
+  double * lt = pair_matrix_4x4(rate_cats, left_matrix);
+  double * rt = pair_matrix_4x4(rate_cats, right_matrix);
+  if (!lt || !rt)
+  {
+    if (lt) pll_aligned_free(lt);
+    if (rt) pll_aligned_free(rt);
+    return;
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    int site_scale = site_partial_4x4(rate_cats,
+                                      parent_clv,
+                                      (scale_mode == 2) ?
+                                        parent_scaler + n*rate_cats : NULL,
+                                      NULL,
+                                      left_clv,
+                                      right_clv,
+                                      lt,
+                                      rt);
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mode == 1 && site_scale)
+    {
+      scale_site_clv(parent_clv, span_padded);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span_padded;
+    left_clv   += span_padded;
+    right_clv  += span_padded;
+  }
+
+  pll_aligned_free(lt);
+  pll_aligned_free(rt);
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const double * left_clv,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * left_scaler,
+                                                  const unsigned int * right_scaler,
+                                                  unsigned int attrib)
+{
+  unsigned int n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* dedicated function for 4x4 matrices */
+  if (states == 4)
+  {
+    pll_core_update_partial_ii_4x4_avx512(sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_clv,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          left_scaler,
+                                          right_scaler,
+                                          attrib);
+    return;
+  }
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+
+  double * lt = transpose_matrix(states, states_padded, rate_cats, left_matrix);
+  double * rt = transpose_matrix(states, states_padded, rate_cats, right_matrix);
+  if (!lt || !rt)
+  {
+    if (lt) pll_aligned_free(lt);
+    if (rt) pll_aligned_free(rt);
+    return;
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    int site_scale = site_partial(states,
+                                  states_padded,
+                                  rate_cats,
+                                  parent_clv,
+                                  (scale_mode == 2) ?
+                                    parent_scaler + n*rate_cats : NULL,
+                                  NULL,
+                                  left_clv,
+                                  right_clv,
+                                  lt,
+                                  rt);
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mode == 1 && site_scale)
+    {
+      scale_site_clv(parent_clv, span_padded);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span_padded;
+    left_clv   += span_padded;
+    right_clv  += span_padded;
+  }
+
+  pll_aligned_free(lt);
+  pll_aligned_free(rt);
+}
+
+/* the parent CLV is computed from one child only, with a precomputed left
+   term of ones in place of the undetermined child */
+PLL_EXPORT void pll_core_update_partial_single_avx512(unsigned int states,
+                                                      unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const double * child_clv,
+                                                      const double * child_matrix,
+                                                      const unsigned int * child_scaler,
+                                                      unsigned int attrib)
+{
+  unsigned int i,n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+#ifdef HAVE_AVX2
+  /* the AVX2 kernel is faster for 4 states */
+  if (states == 4 && PLL_STAT(avx2_present))
+  {
+    pll_core_update_partial_single_avx2(states,
+                                        sites,
+                                        rate_cats,
+                                        parent_clv,
+                                        parent_scaler,
+                                        child_clv,
+                                        child_matrix,
+                                        child_scaler,
+                                        attrib);
+    return;
+  }
+#endif
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* the parent scaler is the one of the child */
+    fill_parent_scaler(scaler_size, parent_scaler, child_scaler, NULL);
+  }
+
+  double * ones = (double *)pll_aligned_alloc(span_padded * sizeof(double),
+                                              PLL_ALIGNMENT_AVX512);
+  double * ct = (states == 4) ?
+                  pair_matrix_4x4(rate_cats, child_matrix) :
+                  transpose_matrix(states, states_padded, rate_cats,
+                                   child_matrix);
+  if (!ones || !ct)
+  {
+    if (ones) pll_aligned_free(ones);
+    if (ct) pll_aligned_free(ct);
+    return;
+  }
+
+  for (i = 0; i < span_padded; ++i)
+    ones[i] = (i % states_padded < states) ? 1.0 : 0.0;
+
+  for (n = 0; n < sites; ++n)
+  {
+    int site_scale;
+    unsigned int * rate_scaler = (scale_mode == 2) ?
+                                   parent_scaler + n*rate_cats : NULL;
+
+    if (states == 4)
+      site_scale = site_partial_4x4(rate_cats,
+                                    parent_clv,
+                                    rate_scaler,
+                                    ones,
+                                    NULL,
+                                    child_clv,
+                                    NULL,
+                                    ct);
+    else
+      site_scale = site_partial(states,
+                                states_padded,
+                                rate_cats,
+                                parent_clv,
+                                rate_scaler,
+                                ones,
+                                NULL,
+                                child_clv,
+                                NULL,
+                                ct);
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mode == 1 && site_scale)
+    {
+      scale_site_clv(parent_clv, span_padded);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span_padded;
+    child_clv  += span_padded;
+  }
+
+  pll_aligned_free(ones);
+  pll_aligned_free(ct);
+}
+
+PLL_EXPORT void pll_core_update_partial_ti_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const unsigned char * left_tipchars,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib)
+{
+  unsigned int n;
+  unsigned int span_padded = 4 * rate_cats;
+  unsigned int lookup_span;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
+  }
+
+  /* tip characters are 4-bit state masks */
+  double * lookup = create_tip_lookup(4,
+                                      4,
+                                      rate_cats,
+                                      left_matrix,
+                                      NULL,
+                                      16,
+                                      &lookup_span);
+  double * rt = pair_matrix_4x4(rate_cats, right_matrix);
+  if (!lookup || !rt)
+  {
+    if (lookup) pll_aligned_free(lookup);
+    if (rt) pll_aligned_free(rt);
+    return;
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    int site_scale = site_partial_4x4(rate_cats,
+                                      parent_clv,
+                                      (scale_mode == 2) ?
+                                        parent_scaler + n*rate_cats : NULL,
+                                      lookup + left_tipchars[n]*lookup_span,
+                                      NULL,
+                                      right_clv,
+                                      NULL,
+                                      rt);
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mode == 1 && site_scale)
+    {
+      scale_site_clv(parent_clv, span_padded);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span_padded;
+    right_clv  += span_padded;
+  }
+
+  pll_aligned_free(lookup);
+  pll_aligned_free(rt);
+}
+
+PLL_EXPORT void pll_core_update_partial_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const unsigned char * left_tipchars,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * right_scaler,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  unsigned int attrib)
+{
+  unsigned int n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+  unsigned int lookup_span;
+
+  /* dedicated function for 4x4 matrices (DNA) */
+  if (states == 4)
+  {
+    pll_core_update_partial_ti_4x4_avx512(sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_tipchars,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          right_scaler,
+                                          attrib);
+    return;
+  }
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
+  }
+
+  double * lookup = create_tip_lookup(states,
+                                      states_padded,
+                                      rate_cats,
+                                      left_matrix,
+                                      tipmap,
+                                      tipmap_size,
+                                      &lookup_span);
+  double * rt = transpose_matrix(states, states_padded, rate_cats, right_matrix);
+  if (!lookup || !rt)
+  {
+    if (lookup) pll_aligned_free(lookup);
+    if (rt) pll_aligned_free(rt);
+    return;
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    int site_scale = site_partial(states,
+                                  states_padded,
+                                  rate_cats,
+                                  parent_clv,
+                                  (scale_mode == 2) ?
+                                    parent_scaler + n*rate_cats : NULL,
+                                  lookup + left_tipchars[n]*lookup_span,
+                                  NULL,
+                                  right_clv,
+                                  NULL,
+                                  rt);
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mode == 1 && site_scale)
+    {
+      scale_site_clv(parent_clv, span_padded);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span_padded;
+    right_clv  += span_padded;
+  }
+
+  pll_aligned_free(lookup);
+  pll_aligned_free(rt);
+}
+
+PLL_EXPORT void pll_core_update_partial_repeats_generic_avx512(unsigned int states,
+                                                               unsigned int parent_sites,
+                                                               unsigned int left_sites,
+                                                               unsigned int right_sites,
+                                                               unsigned int rate_cats,
+                                                               double * parent_clv,
+                                                               unsigned int * parent_scaler,
+                                                               const double * left_clv,
+                                                               const double * right_clv,
+                                                               const double * left_matrix,
+                                                               const double * right_matrix,
+                                                               const unsigned int * left_scaler,
+                                                               const unsigned int * right_scaler,
+                                                               const unsigned int * parent_id_site,
+                                                               const unsigned int * left_site_id,
+                                                               const unsigned int * right_site_id,
+                                                               double * bclv_buffer,
+                                                               unsigned int attrib)
+{
+  unsigned int n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+
+    /* add up the scale vectors of the two children if available */
+    if (scale_mode == 2)
+      pll_fill_parent_scaler_repeats_per_rate(parent_sites, rate_cats,
+                                              parent_scaler, parent_id_site,
+                                              left_scaler, left_site_id,
+                                              right_scaler, right_site_id);
+    else
+      pll_fill_parent_scaler_repeats(parent_sites, parent_scaler,
+                                     parent_id_site, left_scaler, left_site_id,
+                                     right_scaler, right_site_id);
+  }
+
+  double * lt;
+  double * rt;
+  if (states == 4)
+  {
+    lt = pair_matrix_4x4(rate_cats, left_matrix);
+    rt = pair_matrix_4x4(rate_cats, right_matrix);
+  }
+  else
+  {
+    lt = transpose_matrix(states, states_padded, rate_cats, left_matrix);
+    rt = transpose_matrix(states, states_padded, rate_cats, right_matrix);
+  }
+  if (!lt || !rt)
+  {
+    if (lt) pll_aligned_free(lt);
+    if (rt) pll_aligned_free(rt);
+    return;
+  }
+
+  for (n = 0; n < parent_sites; ++n)
+  {
+    unsigned int site = PLL_GET_SITE(parent_id_site, n);
+    unsigned int lid = PLL_GET_ID(left_site_id, site);
+    unsigned int rid = PLL_GET_ID(right_site_id, site);
+    unsigned int * rate_scaler = (scale_mode == 2) ?
+                                   parent_scaler + n*rate_cats : NULL;
+    int site_scale;
+
+    if (states == 4)
+      site_scale = site_partial_4x4(rate_cats,
+                                    parent_clv,
+                                    rate_scaler,
+                                    NULL,
+                                    left_clv + lid*span_padded,
+                                    right_clv + rid*span_padded,
+                                    lt,
+                                    rt);
+    else
+      site_scale = site_partial(states,
+                                states_padded,
+                                rate_cats,
+                                parent_clv,
+                                rate_scaler,
+                                NULL,
+                                left_clv + lid*span_padded,
+                                right_clv + rid*span_padded,
+                                lt,
+                                rt);
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mode == 1 && site_scale)
+    {
+      scale_site_clv(parent_clv, span_padded);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span_padded;
+  }
+
+  pll_aligned_free(lt);
+  pll_aligned_free(rt);
+}
+
+PLL_EXPORT void pll_core_update_partial_repeatsbclv_generic_avx512(unsigned int states,
+                                                                   unsigned int parent_sites,
+                                                                   unsigned int left_sites,
+                                                                   unsigned int right_sites,
+                                                                   unsigned int rate_cats,
+                                                                   double * parent_clv,
+                                                                   unsigned int * parent_scaler,
+                                                                   const double * left_clv,
+                                                                   const double * right_clv,
+                                                                   const double * left_matrix,
+                                                                   const double * right_matrix,
+                                                                   const unsigned int * left_scaler,
+                                                                   const unsigned int * right_scaler,
+                                                                   const unsigned int * parent_id_site,
+                                                                   const unsigned int * left_site_id,
+                                                                   const unsigned int * right_site_id,
+                                                                   double * bclv_buffer,
+                                                                   unsigned int attrib)
+{
+  unsigned int n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+
+    /* add up the scale vectors of the two children if available */
+    if (scale_mode == 2)
+      pll_fill_parent_scaler_repeats_per_rate(parent_sites, rate_cats,
+                                              parent_scaler, parent_id_site,
+                                              left_scaler, left_site_id,
+                                              right_scaler, right_site_id);
+    else
+      pll_fill_parent_scaler_repeats(parent_sites, parent_scaler,
+                                     parent_id_site, left_scaler, left_site_id,
+                                     right_scaler, right_site_id);
+  }
+
+  double * lt;
+  double * rt;
+  if (states == 4)
+  {
+    lt = pair_matrix_4x4(rate_cats, left_matrix);
+    rt = pair_matrix_4x4(rate_cats, right_matrix);
+  }
+  else
+  {
+    lt = transpose_matrix(states, states_padded, rate_cats, left_matrix);
+    rt = transpose_matrix(states, states_padded, rate_cats, right_matrix);
+  }
+  if (!lt || !rt)
+  {
+    if (lt) pll_aligned_free(lt);
+    if (rt) pll_aligned_free(rt);
+    return;
+  }
+
+  /* the left terms are computed once per left class and then looked up in
+     bclv_buffer for each parent site */
+  for (n = 0; n < left_sites; ++n)
+  {
+    if (states == 4)
+      site_left_terms_4x4(rate_cats,
+                          bclv_buffer + n*span_padded,
+                          left_clv + n*span_padded,
+                          lt);
+    else
+      site_left_terms(states,
+                      states_padded,
+                      rate_cats,
+                      bclv_buffer + n*span_padded,
+                      left_clv + n*span_padded,
+                      lt);
+  }
+
+  for (n = 0; n < parent_sites; ++n)
+  {
+    unsigned int site = PLL_GET_SITE(parent_id_site, n);
+    unsigned int lid = PLL_GET_ID(left_site_id, site);
+    unsigned int rid = PLL_GET_ID(right_site_id, site);
+    unsigned int * rate_scaler = (scale_mode == 2) ?
+                                   parent_scaler + n*rate_cats : NULL;
+    int site_scale;
+
+    if (states == 4)
+      site_scale = site_partial_4x4(rate_cats,
+                                    parent_clv,
+                                    rate_scaler,
+                                    bclv_buffer + lid*span_padded,
+                                    NULL,
+                                    right_clv + rid*span_padded,
+                                    NULL,
+                                    rt);
+    else
+      site_scale = site_partial(states,
+                                states_padded,
+                                rate_cats,
+                                parent_clv,
+                                rate_scaler,
+                                bclv_buffer + lid*span_padded,
+                                NULL,
+                                right_clv + rid*span_padded,
+                                NULL,
+                                rt);
+
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mode == 1 && site_scale)
+    {
+      scale_site_clv(parent_clv, span_padded);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span_padded;
+  }
+
+  pll_aligned_free(lt);
+  pll_aligned_free(rt);
+}
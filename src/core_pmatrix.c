@@ -156,6 +156,38 @@ PLL_EXPORT int pll_core_update_pmatrix(double ** pmatrix,
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    if (states == 4)
+    {
+      /* use AVX version here since a 4x4 row fits in a single ymm register */
+      return pll_core_update_pmatrix_4x4_avx(pmatrix,
+                                             rate_cats,
+                                             rates,
+                                             branch_lengths,
+                                             matrix_indices,
+                                             params_indices,
+                                             prop_invar,
+                                             eigenvals,
+                                             eigenvecs,
+                                             inv_eigenvecs,
+                                             count);
+    }
+    return pll_core_update_pmatrix_avx512(pmatrix,
+                                          states,
+                                          rate_cats,
+                                          rates,
+                                          branch_lengths,
+                                          matrix_indices,
+                                          params_indices,
+                                          prop_invar,
+                                          eigenvals,
+                                          eigenvecs,
+                                          inv_eigenvecs,
+                                          count);
+  }
+  #endif
 
   expd = (double *)malloc(states * sizeof(double));
   temp = (double *)malloc(states*states*sizeof(double));
@@ -203,14 +235,15 @@ PLL_EXPORT int pll_core_update_pmatrix(double ** pmatrix,
         if (pinvar > PLL_MISC_EPSILON)
         {
           for (j = 0; j < states; ++j)
-            expd[j] = expm1(evals[j] * rates[n] * branch_lengths[i]
-                                       / (1.0 - pinvar));
+            expd[j] = evals[j] * rates[n] * branch_lengths[i]
+                                       / (1.0 - pinvar);
         }
         else
         {
           for (j = 0; j < states; ++j)
-           expd[j] = expm1(evals[j] * rates[n] * branch_lengths[i]);
+           expd[j] = evals[j] * rates[n] * branch_lengths[i];
         }
+        pll_core_expm1(states, expd, expd, attrib);
 
         for (j = 0; j < states; ++j)
           for (k = 0; k < states; ++k)
@@ -241,3 +274,148 @@ PLL_EXPORT int pll_core_update_pmatrix(double ** pmatrix,
   free(temp);
   return PLL_SUCCESS;
 }
+
+/* coefficients of the closed-form transition probabilities of nucleotide
+   models with HKY structure (JC69, K80, F81 and HKY), i.e. a single
+   transition and a single transversion rate. With E1 = expm1(f[0] t) and
+   E2 = expm1(f[1] t) for purine and expm1(f[2] t) for pyrimidine columns,
+
+     P(t)[i][j] = I[i][j] + a[i][j] * E1 + b[i][j] * E2[j]
+
+   where a and b are stored row-wise in coefs[0..15] and coefs[16..31], and f
+   in coefs[32..34]. States are ordered A,C,G,T, such that odd columns are
+   pyrimidines */
+PLL_EXPORT void pll_core_pmatrix_4x4_closed_coefs(const double * subst_params,
+                                                  const double * frequencies,
+                                                  double * coefs)
+{
+  unsigned int i,j;
+  double pi_r = frequencies[0] + frequencies[2];
+  double pi_y = frequencies[1] + frequencies[3];
+  double kappa = subst_params[1] / subst_params[0];
+  double * a = coefs;
+  double * b = coefs + 16;
+  double * f = coefs + 32;
+
+  /* scale the rate matrix to a mean substitution rate of 1 */
+  double beta = 1.0 / (2*(pi_r*pi_y + kappa*(frequencies[0]*frequencies[2] +
+                                             frequencies[1]*frequencies[3])));
+
+  for (i = 0; i < 4; ++i)
+  {
+    for (j = 0; j < 4; ++j)
+    {
+      double pi_j = frequencies[j];
+      double pi_class = (j & 1) ? pi_y : pi_r;
+
+      if ((i & 1) != (j & 1))
+      {
+        /* transversion */
+        a[i*4+j] = -pi_j;
+        b[i*4+j] = 0;
+      }
+      else
+      {
+        a[i*4+j] = pi_j * (1/pi_class - 1);
+        b[i*4+j] = (i == j) ? (pi_class - pi_j) / pi_class : -pi_j / pi_class;
+      }
+    }
+  }
+
+  f[0] = -beta;
+  f[1] = -beta * (1 + pi_r*(kappa - 1));
+  f[2] = -beta * (1 + pi_y*(kappa - 1));
+}
+
+/* computes the p-matrices of 4-state models with HKY structure in closed
+   form, see pll_core_pmatrix_4x4_closed_coefs() */
+PLL_EXPORT int pll_core_update_pmatrix_4x4_closed(double ** pmatrix,
+                                                  unsigned int rate_cats,
+                                                  const double * rates,
+                                                  const double * branch_lengths,
+                                                  const unsigned int * matrix_indices,
+                                                  const unsigned int * params_indices,
+                                                  const double * prop_invar,
+                                                  double * const * subst_params,
+                                                  double * const * frequencies,
+                                                  unsigned int count,
+                                                  unsigned int attrib)
+{
+  unsigned int i,n,j,k;
+  double * coefs;
+  double * c;
+  double * pmat;
+  double t, e1, e2[2];
+
+  #ifdef HAVE_AVX
+  if ((attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present)) ||
+      (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present)) ||
+      (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present)))
+  {
+    return pll_core_update_pmatrix_4x4_closed_avx(pmatrix,
+                                                  rate_cats,
+                                                  rates,
+                                                  branch_lengths,
+                                                  matrix_indices,
+                                                  params_indices,
+                                                  prop_invar,
+                                                  subst_params,
+                                                  frequencies,
+                                                  count);
+  }
+  #else
+  (void)attrib;
+  #endif
+
+  coefs = (double *)malloc(rate_cats * 35 * sizeof(double));
+  if (!coefs)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  /* categories sharing a rate matrix share the coefficients */
+  for (n = 0; n < rate_cats; ++n)
+  {
+    if (n && params_indices[n] == params_indices[n-1])
+      memcpy(coefs + n*35, coefs + (n-1)*35, 35*sizeof(double));
+    else
+      pll_core_pmatrix_4x4_closed_coefs(subst_params[params_indices[n]],
+                                        frequencies[params_indices[n]],
+                                        coefs + n*35);
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    assert(branch_lengths[i] >= 0);
+
+    pmat = pmatrix[matrix_indices[i]];
+
+    for (n = 0; n < rate_cats; ++n)
+    {
+      double pinvar = prop_invar[params_indices[n]];
+
+      c = coefs + n*35;
+
+      t = rates[n] * branch_lengths[i];
+      if (pinvar > PLL_MISC_EPSILON)
+        t /= (1.0 - pinvar);
+
+      /* expm1 keeps the accuracy for Qt -> 0, as in pll_core_update_pmatrix */
+      e1 = expm1(c[32] * t);
+      e2[0] = (c[33] == c[32]) ? e1 : expm1(c[33] * t);
+      e2[1] = (c[34] == c[33]) ? e2[0] : expm1(c[34] * t);
+
+      for (j = 0; j < 4; ++j)
+        for (k = 0; k < 4; ++k)
+          pmat[j*4+k] = ((j == k) ? 1.0 : 0) + c[j*4+k] * e1 +
+                        c[16+j*4+k] * e2[k & 1];
+
+      pmat += 16;
+    }
+  }
+
+  free(coefs);
+  return PLL_SUCCESS;
+}
@@ -127,10 +127,6 @@ PLL_EXPORT int pll_core_update_pmatrix_4x4_avx(double ** pmatrix,
           xmm2 = _mm256_div_pd(xmm2,xmm1);
         }
           
-        /* TODO: implement a vectorized double-precision exponentiation */
-        //xmm1 = _mm256_exp_pd(xmm2);     /* expd */
-
-        /* for now exponentiate non-vectorized */
         _mm256_store_pd(expd,xmm2);
 
         /* NOTE: in order to deal with numerical issues in cases when Qt -> 0, we
@@ -139,10 +135,8 @@ PLL_EXPORT int pll_core_update_pmatrix_4x4_avx(double ** pmatrix,
          * In short, we use expm1() to compute (exp(Qt) - I), and then correct
          * for this by adding an identity matrix I in the very end */
 
-        xmm1 = _mm256_set_pd(expm1(expd[3]),
-                             expm1(expd[2]),
-                             expm1(expd[1]),
-                             expm1(expd[0]));
+        pll_core_expm1_avx(4, expd, expd);
+        xmm1 = _mm256_load_pd(expd);
 
 
         /* multiply inverse eigenvectors with computed result */
@@ -439,8 +433,7 @@ PLL_EXPORT int pll_core_update_pmatrix_20x20_avx(double ** pmatrix,
        * In short, we use expm1() to compute (exp(Qt) - I), and then correct
        * for this by adding an identity matrix I in the very end */
 
-      for (k = 0; k < 20; ++k)
-        expd[k] = expm1(expd[k]);
+      pll_core_expm1_avx(20, expd, expd);
         
       /* load expd */
       xmm4 = _mm256_load_pd(expd+0);
@@ -539,3 +532,104 @@ PLL_EXPORT int pll_core_update_pmatrix_20x20_avx(double ** pmatrix,
   free(tran_evecs);
   return PLL_SUCCESS;
 }
+
+PLL_EXPORT int pll_core_update_pmatrix_4x4_closed_avx(double ** pmatrix,
+                                                      unsigned int rate_cats,
+                                                      const double * rates,
+                                                      const double * branch_lengths,
+                                                      const unsigned int * matrix_indices,
+                                                      const unsigned int * params_indices,
+                                                      const double * prop_invar,
+                                                      double * const * subst_params,
+                                                      double * const * frequencies,
+                                                      unsigned int count)
+{
+  unsigned int i,n;
+  double * coefs;
+  double * c;
+  double * pmat;
+  double t, e1, e2r, e2y;
+
+  coefs = (double *)pll_aligned_alloc(rate_cats * 36 * sizeof(double),
+                                      PLL_ALIGNMENT_AVX);
+  if (!coefs)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  /* coefficients padded to 36 doubles per category to keep rows aligned */
+  for (n = 0; n < rate_cats; ++n)
+  {
+    if (n && params_indices[n] == params_indices[n-1])
+      memcpy(coefs + n*36, coefs + (n-1)*36, 36*sizeof(double));
+    else
+      pll_core_pmatrix_4x4_closed_coefs(subst_params[params_indices[n]],
+                                        frequencies[params_indices[n]],
+                                        coefs + n*36);
+  }
+
+  __m256d xmm0,xmm1,xmm2;
+
+  __m256d idm_row0 = _mm256_set_pd(0., 0., 0., 1.0);
+  __m256d idm_row1 = _mm256_set_pd(0., 0., 1.0, 0.);
+  __m256d idm_row2 = _mm256_set_pd(0., 1.0, 0., 0.);
+  __m256d idm_row3 = _mm256_set_pd(1.0, 0., 0., 0.);
+
+  for (i = 0; i < count; ++i)
+  {
+    assert(branch_lengths[i] >= 0);
+
+    pmat = pmatrix[matrix_indices[i]];
+
+    for (n = 0; n < rate_cats; ++n)
+    {
+      double pinvar = prop_invar[params_indices[n]];
+
+      c = coefs + n*36;
+
+      t = rates[n] * branch_lengths[i];
+      if (pinvar > PLL_MISC_EPSILON)
+        t /= (1.0 - pinvar);
+
+      /* JC69 and F81 need one exponential, K80 two */
+      e1 = expm1(c[32] * t);
+      e2r = (c[33] == c[32]) ? e1 : expm1(c[33] * t);
+      e2y = (c[34] == c[33]) ? e2r : expm1(c[34] * t);
+
+      /* columns A,C,G,T are purine, pyrimidine, purine, pyrimidine */
+      xmm0 = _mm256_set1_pd(e1);
+      xmm1 = _mm256_set_pd(e2y, e2r, e2y, e2r);
+
+      xmm2 = _mm256_add_pd(idm_row0,
+                           _mm256_mul_pd(_mm256_load_pd(c+0), xmm0));
+      xmm2 = _mm256_add_pd(xmm2,
+                           _mm256_mul_pd(_mm256_load_pd(c+16), xmm1));
+      _mm256_store_pd(pmat+0, xmm2);
+
+      xmm2 = _mm256_add_pd(idm_row1,
+                           _mm256_mul_pd(_mm256_load_pd(c+4), xmm0));
+      xmm2 = _mm256_add_pd(xmm2,
+                           _mm256_mul_pd(_mm256_load_pd(c+20), xmm1));
+      _mm256_store_pd(pmat+4, xmm2);
+
+      xmm2 = _mm256_add_pd(idm_row2,
+                           _mm256_mul_pd(_mm256_load_pd(c+8), xmm0));
+      xmm2 = _mm256_add_pd(xmm2,
+                           _mm256_mul_pd(_mm256_load_pd(c+24), xmm1));
+      _mm256_store_pd(pmat+8, xmm2);
+
+      xmm2 = _mm256_add_pd(idm_row3,
+                           _mm256_mul_pd(_mm256_load_pd(c+12), xmm0));
+      xmm2 = _mm256_add_pd(xmm2,
+                           _mm256_mul_pd(_mm256_load_pd(c+28), xmm1));
+      _mm256_store_pd(pmat+12, xmm2);
+
+      pmat += 16;
+    }
+  }
+
+  pll_aligned_free(coefs);
+  return PLL_SUCCESS;
+}
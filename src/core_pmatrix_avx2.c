@@ -187,8 +187,7 @@ int pll_core_update_pmatrix_20x20_avx2(double ** pmatrix,
        * In short, we use expm1() to compute (exp(Qt) - I), and then correct
        * for this by adding an identity matrix I in the very end */
 
-      for (k = 0; k < 20; ++k)
-        expd[k] = expm1(expd[k]);
+      pll_core_expm1_avx2(20, expd, expd);
 
       /* load expd */
       xmm4 = _mm256_load_pd(expd+0);
@@ -282,3 +281,216 @@ int pll_core_update_pmatrix_20x20_avx2(double ** pmatrix,
   free(tran_evecs);
   return PLL_SUCCESS;
 }
+
+/* computes the p-matrices of four branches at a time, exponentiating the
+   eigenvalues of all of them together with the vectorized expm1. Used for
+   large batches of matrices, e.g. after a full traversal */
+PLL_EXPORT int pll_core_update_pmatrix_batch_avx2(double ** pmatrix,
+                                                  unsigned int states,
+                                                  unsigned int rate_cats,
+                                                  const double * rates,
+                                                  const double * branch_lengths,
+                                                  const unsigned int * matrix_indices,
+                                                  const unsigned int * params_indices,
+                                                  const double * prop_invar,
+                                                  double * const * eigenvals,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  unsigned int count)
+{
+  unsigned int i,n,j,k,m,b;
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int batch;
+
+  double pinvar;
+  double * evecs;
+  double * inv_evecs;
+  double * evals;
+  double * pmat;
+  double * expd;
+  double * temp;
+  double lengths[4];
+
+  /* expd[(n*4+b)*states_padded + k] holds the exponentiated eigenvalue k
+     of branch b and rate category n, padded with zeros */
+  expd = (double *)pll_aligned_alloc(rate_cats * 4 * states_padded *
+                                     sizeof(double),
+                                     PLL_ALIGNMENT_AVX);
+  temp = (double *)pll_aligned_alloc(states_padded * sizeof(double),
+                                     PLL_ALIGNMENT_AVX);
+  if (!expd || !temp)
+  {
+    if (expd) pll_aligned_free(expd);
+    if (temp) pll_aligned_free(temp);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  memset(expd, 0, rate_cats * 4 * states_padded * sizeof(double));
+
+  for (i = 0; i < count; i += 4)
+  {
+    batch = PLL_MIN(4, count - i);
+    for (b = 0; b < 4; ++b)
+    {
+      lengths[b] = (b < batch) ? branch_lengths[i+b] : 0;
+      assert(lengths[b] >= 0);
+    }
+
+    for (n = 0; n < rate_cats; ++n)
+    {
+      pinvar = prop_invar[params_indices[n]];
+      evals = eigenvals[params_indices[n]];
+
+      __m256d v_t = _mm256_mul_pd(_mm256_loadu_pd(lengths),
+                                  _mm256_set1_pd(rates[n]));
+      if (pinvar > PLL_MISC_EPSILON)
+        v_t = _mm256_div_pd(v_t, _mm256_set1_pd(1.0 - pinvar));
+
+      for (k = 0; k < states; ++k)
+      {
+        double e[4];
+
+        _mm256_storeu_pd(e, _mm256_mul_pd(_mm256_set1_pd(evals[k]), v_t));
+        for (b = 0; b < 4; ++b)
+          expd[(n*4+b)*states_padded+k] = e[b];
+      }
+    }
+
+    /* exponentiate the eigenvalues of all branches and rate categories at
+       once (see pll_core_update_pmatrix for the use of expm1). The padding
+       remains zero */
+    pll_core_expm1_avx2(rate_cats * 4 * states_padded, expd, expd);
+
+    /* the matrices are written one after the other */
+    for (b = 0; b < batch; ++b)
+    {
+      for (n = 0; n < rate_cats; ++n)
+      {
+        const double * e = expd + (n*4+b)*states_padded;
+
+        evecs = eigenvecs[params_indices[n]];
+        inv_evecs = inv_eigenvecs[params_indices[n]];
+        pmat = pmatrix[matrix_indices[i+b]] + n*states*states_padded;
+
+        /* if branch length is zero then set the p-matrix to identity matrix */
+        if (!lengths[b])
+        {
+          for (j = 0; j < states; ++j)
+            for (k = 0; k < states_padded; ++k)
+              pmat[j*states_padded + k] = (j == k) ? 1 : 0;
+          continue;
+        }
+
+        /* pmat = I + inv_evecs * diag(expd) * evecs */
+        for (j = 0; j < states; ++j)
+        {
+          const double * inv_row = inv_evecs + j*states_padded;
+
+          /* temp = row j of inv_evecs * diag(expd) */
+          for (k = 0; k < states_padded; k += 4)
+            _mm256_store_pd(temp+k,
+                            _mm256_mul_pd(_mm256_load_pd(inv_row+k),
+                                          _mm256_load_pd(e+k)));
+
+          /* blocks of 16 columns are accumulated in registers, with two
+             sets of accumulators for even and odd m to hide the latency of
+             the fused multiply-adds */
+          for (k = 0; k + 16 <= states_padded; k += 16)
+          {
+            __m256d v_acc0 = _mm256_setzero_pd();
+            __m256d v_acc1 = _mm256_setzero_pd();
+            __m256d v_acc2 = _mm256_setzero_pd();
+            __m256d v_acc3 = _mm256_setzero_pd();
+            __m256d v_acc4 = _mm256_setzero_pd();
+            __m256d v_acc5 = _mm256_setzero_pd();
+            __m256d v_acc6 = _mm256_setzero_pd();
+            __m256d v_acc7 = _mm256_setzero_pd();
+
+            for (m = 0; m + 1 < states; m += 2)
+            {
+              const double * r0 = evecs + m*states_padded + k;
+              const double * r1 = r0 + states_padded;
+              __m256d v_t0 = _mm256_broadcast_sd(temp+m);
+              __m256d v_t1 = _mm256_broadcast_sd(temp+m+1);
+
+              v_acc0 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+0), v_acc0);
+              v_acc1 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+4), v_acc1);
+              v_acc2 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+8), v_acc2);
+              v_acc3 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+12), v_acc3);
+              v_acc4 = _mm256_fmadd_pd(v_t1, _mm256_load_pd(r1+0), v_acc4);
+              v_acc5 = _mm256_fmadd_pd(v_t1, _mm256_load_pd(r1+4), v_acc5);
+              v_acc6 = _mm256_fmadd_pd(v_t1, _mm256_load_pd(r1+8), v_acc6);
+              v_acc7 = _mm256_fmadd_pd(v_t1, _mm256_load_pd(r1+12), v_acc7);
+            }
+            if (m < states)
+            {
+              const double * r0 = evecs + m*states_padded + k;
+              __m256d v_t0 = _mm256_broadcast_sd(temp+m);
+
+              v_acc0 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+0), v_acc0);
+              v_acc1 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+4), v_acc1);
+              v_acc2 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+8), v_acc2);
+              v_acc3 = _mm256_fmadd_pd(v_t0, _mm256_load_pd(r0+12), v_acc3);
+            }
+
+            _mm256_store_pd(pmat+j*states_padded+k+0,
+                            _mm256_add_pd(v_acc0, v_acc4));
+            _mm256_store_pd(pmat+j*states_padded+k+4,
+                            _mm256_add_pd(v_acc1, v_acc5));
+            _mm256_store_pd(pmat+j*states_padded+k+8,
+                            _mm256_add_pd(v_acc2, v_acc6));
+            _mm256_store_pd(pmat+j*states_padded+k+12,
+                            _mm256_add_pd(v_acc3, v_acc7));
+          }
+
+          /* remaining columns, four at a time with four accumulators */
+          for (; k < states_padded; k += 4)
+          {
+            const double * r0 = evecs + k;
+            __m256d v_acc0 = _mm256_setzero_pd();
+            __m256d v_acc1 = _mm256_setzero_pd();
+            __m256d v_acc2 = _mm256_setzero_pd();
+            __m256d v_acc3 = _mm256_setzero_pd();
+
+            for (m = 0; m + 3 < states; m += 4)
+            {
+              v_acc0 = _mm256_fmadd_pd(_mm256_broadcast_sd(temp+m),
+                                       _mm256_load_pd(r0+m*states_padded),
+                                       v_acc0);
+              v_acc1 = _mm256_fmadd_pd(_mm256_broadcast_sd(temp+m+1),
+                                       _mm256_load_pd(r0+(m+1)*states_padded),
+                                       v_acc1);
+              v_acc2 = _mm256_fmadd_pd(_mm256_broadcast_sd(temp+m+2),
+                                       _mm256_load_pd(r0+(m+2)*states_padded),
+                                       v_acc2);
+              v_acc3 = _mm256_fmadd_pd(_mm256_broadcast_sd(temp+m+3),
+                                       _mm256_load_pd(r0+(m+3)*states_padded),
+                                       v_acc3);
+            }
+            for (; m < states; ++m)
+              v_acc0 = _mm256_fmadd_pd(_mm256_broadcast_sd(temp+m),
+                                       _mm256_load_pd(r0+m*states_padded),
+                                       v_acc0);
+
+            _mm256_store_pd(pmat+j*states_padded+k,
+                            _mm256_add_pd(_mm256_add_pd(v_acc0, v_acc1),
+                                          _mm256_add_pd(v_acc2, v_acc3)));
+          }
+
+          pmat[j*states_padded+j] += 1.0;
+
+          /* clear the padding in case the eigenvectors are not zero-padded */
+          for (k = states; k < states_padded; ++k)
+            pmat[j*states_padded+k] = 0;
+        }
+      }
+    }
+  }
+
+  pll_aligned_free(expd);
+  pll_aligned_free(temp);
+  return PLL_SUCCESS;
+}
@@ -0,0 +1,323 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+#define BLOCK_MASK(n) (((n) >= 8) ? 0xFF : 0x0F)
+
+PLL_EXPORT int pll_core_update_pmatrix_avx512(double ** pmatrix,
+                                              unsigned int states,
+                                              unsigned int rate_cats,
+                                              const double * rates,
+                                              const double * branch_lengths,
+                                              const unsigned int * matrix_indices,
+                                              const unsigned int * params_indices,
+                                              const double * prop_invar,
+                                              double * const * eigenvals,
+                                              double * const * eigenvecs,
+                                              double * const * inv_eigenvecs,
+                                              unsigned int count)
+{
+  unsigned int i,n,j,k,m;
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+
+  double pinvar;
+  double * evecs;
+  double * inv_evecs;
+  double * evals;
+  double * pmat;
+  double * expd;
+  double * temp;
+
+  expd = (double *)pll_aligned_alloc(states_padded * sizeof(double),
+                                     PLL_ALIGNMENT_AVX512);
+  temp = (double *)pll_aligned_alloc(states*states_padded*sizeof(double),
+                                     PLL_ALIGNMENT_AVX512);
+
+  if (!expd || !temp)
+  {
+    if (expd) pll_aligned_free(expd);
+    if (temp) pll_aligned_free(temp);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  memset(expd, 0, states_padded * sizeof(double));
+
+  for (i = 0; i < count; ++i)
+  {
+    assert(branch_lengths[i] >= 0);
+
+    /* compute effective pmatrix location */
+    for (n = 0; n < rate_cats; ++n)
+    {
+      pmat = pmatrix[matrix_indices[i]] + n*states*states_padded;
+
+      pinvar = prop_invar[params_indices[n]];
+      evecs = eigenvecs[params_indices[n]];
+      inv_evecs = inv_eigenvecs[params_indices[n]];
+      evals = eigenvals[params_indices[n]];
+
+      /* if branch length is zero then set the p-matrix to identity matrix */
+      if (!branch_lengths[i])
+      {
+        for (j = 0; j < states; ++j)
+          for (k = 0; k < states_padded; ++k)
+            pmat[j*states_padded + k] = (j == k) ? 1 : 0;
+        continue;
+      }
+
+      /* exponentiate eigenvalues; expm1() is used to compute (exp(Qt) - I)
+         and the identity matrix is added back in the end (see generic
+         version in core_pmatrix.c) */
+      if (pinvar > PLL_MISC_EPSILON)
+      {
+        for (j = 0; j < states; ++j)
+          expd[j] = evals[j] * rates[n] * branch_lengths[i] / (1.0 - pinvar);
+      }
+      else
+      {
+        for (j = 0; j < states; ++j)
+          expd[j] = evals[j] * rates[n] * branch_lengths[i];
+      }
+      pll_core_expm1_avx512(states, expd, expd);
+
+      /* temp = inv_evecs * diag(expd), rows padded with zeros */
+      for (j = 0; j < states; ++j)
+      {
+        for (k = 0; k < states_padded; k += 8)
+        {
+          __mmask8 mask = BLOCK_MASK(states_padded - k);
+          __m512d v_inv = _mm512_maskz_loadu_pd(mask,
+                                                inv_evecs+j*states_padded+k);
+          __m512d v_exp = _mm512_maskz_loadu_pd(mask, expd+k);
+          _mm512_mask_storeu_pd(temp+j*states_padded+k,
+                                mask,
+                                _mm512_mul_pd(v_inv, v_exp));
+        }
+      }
+
+      /* pmat = I + temp * evecs */
+      for (j = 0; j < states; ++j)
+      {
+        const double * t = temp + j*states_padded;
+
+        for (k = 0; k < states_padded; k += 8)
+        {
+          __mmask8 mask = BLOCK_MASK(states_padded - k);
+          __m512d v_row = _mm512_setzero_pd();
+
+          for (m = 0; m < states; ++m)
+            v_row = _mm512_fmadd_pd(_mm512_set1_pd(t[m]),
+                                    _mm512_maskz_loadu_pd(mask,
+                                                          evecs+m*states_padded+k),
+                                    v_row);
+
+          _mm512_mask_storeu_pd(pmat+j*states_padded+k, mask, v_row);
+        }
+
+        pmat[j*states_padded+j] += 1.0;
+
+        /* clear the padding in case the eigenvectors are not zero-padded */
+        for (k = states; k < states_padded; ++k)
+          pmat[j*states_padded+k] = 0;
+      }
+
+      #ifdef DEBUG
+      for (j = 0; j < states; ++j)
+        for (k = 0; k < states; ++k)
+          assert(pmat[j*states_padded+k] >= 0);
+      #endif
+    }
+  }
+
+  pll_aligned_free(expd);
+  pll_aligned_free(temp);
+  return PLL_SUCCESS;
+}
+
+/* computes the p-matrices of eight branches at a time, see
+   pll_core_update_pmatrix_batch_avx2 */
+PLL_EXPORT int pll_core_update_pmatrix_batch_avx512(double ** pmatrix,
+                                                    unsigned int states,
+                                                    unsigned int rate_cats,
+                                                    const double * rates,
+                                                    const double * branch_lengths,
+                                                    const unsigned int * matrix_indices,
+                                                    const unsigned int * params_indices,
+                                                    const double * prop_invar,
+                                                    double * const * eigenvals,
+                                                    double * const * eigenvecs,
+                                                    double * const * inv_eigenvecs,
+                                                    unsigned int count)
+{
+  unsigned int i,n,j,k,m,b;
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int batch;
+
+  double pinvar;
+  double * evecs;
+  double * inv_evecs;
+  double * evals;
+  double * pmat;
+  double * expd;
+  double * temp;
+  double lengths[8];
+
+  /* expd[(n*8+b)*states_padded + k] holds the exponentiated eigenvalue k
+     of branch b and rate category n */
+  expd = (double *)pll_aligned_alloc(rate_cats * 8 * states_padded *
+                                     sizeof(double),
+                                     PLL_ALIGNMENT_AVX512);
+  temp = (double *)pll_aligned_alloc(states_padded * sizeof(double),
+                                     PLL_ALIGNMENT_AVX512);
+  if (!expd || !temp)
+  {
+    if (expd) pll_aligned_free(expd);
+    if (temp) pll_aligned_free(temp);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  memset(expd, 0, rate_cats * 8 * states_padded * sizeof(double));
+
+  for (i = 0; i < count; i += 8)
+  {
+    batch = PLL_MIN(8, count - i);
+    for (b = 0; b < 8; ++b)
+    {
+      lengths[b] = (b < batch) ? branch_lengths[i+b] : 0;
+      assert(lengths[b] >= 0);
+    }
+
+    for (n = 0; n < rate_cats; ++n)
+    {
+      pinvar = prop_invar[params_indices[n]];
+      evals = eigenvals[params_indices[n]];
+
+      __m512d v_t = _mm512_mul_pd(_mm512_loadu_pd(lengths),
+                                  _mm512_set1_pd(rates[n]));
+      if (pinvar > PLL_MISC_EPSILON)
+        v_t = _mm512_div_pd(v_t, _mm512_set1_pd(1.0 - pinvar));
+
+      for (k = 0; k < states; ++k)
+      {
+        double e[8];
+
+        _mm512_storeu_pd(e, _mm512_mul_pd(_mm512_set1_pd(evals[k]), v_t));
+        for (b = 0; b < 8; ++b)
+          expd[(n*8+b)*states_padded+k] = e[b];
+      }
+    }
+
+    /* exponentiate the eigenvalues of all branches and rate categories at
+       once; the padding remains zero */
+    pll_core_expm1_avx512(rate_cats * 8 * states_padded, expd, expd);
+
+    /* the matrices are written one after the other */
+    for (b = 0; b < batch; ++b)
+    {
+      for (n = 0; n < rate_cats; ++n)
+      {
+        const double * e = expd + (n*8+b)*states_padded;
+
+        evecs = eigenvecs[params_indices[n]];
+        inv_evecs = inv_eigenvecs[params_indices[n]];
+        pmat = pmatrix[matrix_indices[i+b]] + n*states*states_padded;
+
+        /* if branch length is zero then set the p-matrix to identity matrix */
+        if (!lengths[b])
+        {
+          for (j = 0; j < states; ++j)
+            for (k = 0; k < states_padded; ++k)
+              pmat[j*states_padded + k] = (j == k) ? 1 : 0;
+          continue;
+        }
+
+        /* pmat = I + inv_evecs * diag(expd) * evecs */
+        for (j = 0; j < states; ++j)
+        {
+          const double * inv_row = inv_evecs + j*states_padded;
+
+          /* temp = row j of inv_evecs * diag(expd) */
+          for (m = 0; m < states; ++m)
+            temp[m] = inv_row[m] * e[m];
+
+          /* columns are processed eight at a time, with four accumulators
+             over m to hide the latency of the fused multiply-adds */
+          for (k = 0; k < states_padded; k += 8)
+          {
+            __mmask8 mask = BLOCK_MASK(states_padded - k);
+            const double * r0 = evecs + k;
+            __m512d v_acc0 = _mm512_setzero_pd();
+            __m512d v_acc1 = _mm512_setzero_pd();
+            __m512d v_acc2 = _mm512_setzero_pd();
+            __m512d v_acc3 = _mm512_setzero_pd();
+
+            for (m = 0; m + 3 < states; m += 4)
+            {
+              v_acc0 = _mm512_fmadd_pd(_mm512_set1_pd(temp[m]),
+                                       _mm512_maskz_loadu_pd(mask,
+                                                   r0+m*states_padded),
+                                       v_acc0);
+              v_acc1 = _mm512_fmadd_pd(_mm512_set1_pd(temp[m+1]),
+                                       _mm512_maskz_loadu_pd(mask,
+                                                   r0+(m+1)*states_padded),
+                                       v_acc1);
+              v_acc2 = _mm512_fmadd_pd(_mm512_set1_pd(temp[m+2]),
+                                       _mm512_maskz_loadu_pd(mask,
+                                                   r0+(m+2)*states_padded),
+                                       v_acc2);
+              v_acc3 = _mm512_fmadd_pd(_mm512_set1_pd(temp[m+3]),
+                                       _mm512_maskz_loadu_pd(mask,
+                                                   r0+(m+3)*states_padded),
+                                       v_acc3);
+            }
+            for (; m < states; ++m)
+              v_acc0 = _mm512_fmadd_pd(_mm512_set1_pd(temp[m]),
+                                       _mm512_maskz_loadu_pd(mask,
+                                                   r0+m*states_padded),
+                                       v_acc0);
+
+            _mm512_mask_storeu_pd(pmat+j*states_padded+k,
+                                  mask,
+                                  _mm512_add_pd(_mm512_add_pd(v_acc0, v_acc1),
+                                                _mm512_add_pd(v_acc2, v_acc3)));
+          }
+
+          pmat[j*states_padded+j] += 1.0;
+
+          /* clear the padding in case the eigenvectors are not zero-padded */
+          for (k = states; k < states_padded; ++k)
+            pmat[j*states_padded+k] = 0;
+        }
+      }
+    }
+  }
+
+  pll_aligned_free(expd);
+  pll_aligned_free(temp);
+  return PLL_SUCCESS;
+}
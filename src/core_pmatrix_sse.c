@@ -178,11 +178,6 @@ PLL_EXPORT int pll_core_update_pmatrix_4x4_sse(double ** pmatrix,
           xmm8 = _mm_div_pd(xmm8,xmm1);
         }
           
-        /* TODO: implement a vectorized double-precision exponentiation */
-        //xmm1 = _mm_exp_pd(xmm7);     /* expd */
-        //xmm2 = _mm_exp_pd(xmm8);     /* expd */
-
-        /* for now exponentiate non-vectorized */
         _mm_store_pd(expd+0,xmm7);
         _mm_store_pd(expd+2,xmm8);
 
@@ -214,8 +209,9 @@ PLL_EXPORT int pll_core_update_pmatrix_4x4_sse(double ** pmatrix,
          * for this by adding an identity matrix I in the very end */
 
         /* load exponentiated eigenvalues */
-        xmm1 = _mm_set_pd(expm1(expd[1]), expm1(expd[0]));
-        xmm2 = _mm_set_pd(expm1(expd[3]), expm1(expd[2]));
+        pll_core_expm1_sse(4, expd, expd);
+        xmm1 = _mm_load_pd(expd+0);
+        xmm2 = _mm_load_pd(expd+2);
 
         /* compute pmatrix */
         ONESTEP4(0);
@@ -404,8 +400,7 @@ PLL_EXPORT int pll_core_update_pmatrix_20x20_sse(double ** pmatrix,
 
 
       /* exponentiate eigenvalues */
-      for (k = 0; k < 20; ++k)
-        expd[k] = expm1(expd[k]);
+      pll_core_expm1_sse(20, expd, expd);
 
       /* load expd */
       xmm0 = _mm_load_pd(expd+0);
@@ -0,0 +1,670 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+
+/* Kernels for partitions created with PLL_ATTRIB_SINGLE_PRECISION. CLVs are
+   stored as float, while p-matrices, eigen decompositions, sumtables and the
+   accumulation of site likelihoods remain in double precision. The generic
+   versions below are used for all architectures without a dedicated
+   single-precision kernel and therefore must respect the padding of the
+   selected architecture. */
+
+static unsigned int sp_states_padded(unsigned int states, unsigned int attrib)
+{
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+    return (states+1) & 0xFFFFFFFE;
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+    return (states+3) & 0xFFFFFFFC;
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+    return (states+3) & 0xFFFFFFFC;
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+    return (states+3) & 0xFFFFFFFC;
+#endif
+  return states;
+}
+
+static void fill_parent_scaler(unsigned int scaler_size,
+                               unsigned int * parent_scaler,
+                               const unsigned int * left_scaler,
+                               const unsigned int * right_scaler)
+{
+  unsigned int i;
+
+  if (!left_scaler && !right_scaler)
+    memset(parent_scaler, 0, sizeof(unsigned int) * scaler_size);
+  else if (left_scaler && right_scaler)
+  {
+    memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    for (i = 0; i < scaler_size; ++i)
+      parent_scaler[i] += right_scaler[i];
+  }
+  else
+  {
+    if (left_scaler)
+      memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    else
+      memcpy(parent_scaler, right_scaler, sizeof(unsigned int) * scaler_size);
+  }
+}
+
+/* convert the p-matrices of all rate categories to single precision */
+static float * convert_matrix(unsigned int states,
+                              unsigned int states_padded,
+                              unsigned int rate_cats,
+                              const double * matrix)
+{
+  unsigned int i;
+  size_t size = (size_t)states * states_padded * rate_cats;
+
+  float * m = (float *)malloc(size * sizeof(float));
+  if (!m)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return NULL;
+  }
+
+  for (i = 0; i < size; ++i)
+    m[i] = (float)matrix[i];
+
+  return m;
+}
+
+/* site log-likelihood from the (scaled) likelihood of the variable part and
+   the likelihood of the invariant part. As CLVs are scaled much more often in
+   single precision, the two parts are combined in log space whenever the site
+   was scaled */
+static double site_loglikelihood(double var_lk,
+                                 double inv_lk,
+                                 unsigned int site_scalings)
+{
+  double logl;
+
+  if (!site_scalings)
+    return log(var_lk + inv_lk);
+
+  logl = log(var_lk) + site_scalings * log(PLL_SCALE_THRESHOLD_SP);
+  if (inv_lk > 0)
+  {
+    double logl_inv = log(inv_lk);
+    if (logl_inv > logl)
+      logl = logl_inv + log1p(exp(logl - logl_inv));
+    else
+      logl += log1p(exp(logl_inv - logl));
+  }
+
+  return logl;
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_sp(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              float * parent_clv,
+                                              unsigned int * parent_scaler,
+                                              const float * left_clv,
+                                              const float * right_clv,
+                                              const double * left_matrix,
+                                              const double * right_matrix,
+                                              const unsigned int * left_scaler,
+                                              const unsigned int * right_scaler,
+                                              unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int site_scale;
+  unsigned int init_mask;
+
+  const float * lmat;
+  const float * rmat;
+
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_ii_sp_avx512(states,
+                                         sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         parent_scaler,
+                                         left_clv,
+                                         right_clv,
+                                         left_matrix,
+                                         right_matrix,
+                                         left_scaler,
+                                         right_scaler,
+                                         attrib);
+    return;
+  }
+#endif
+
+  unsigned int states_padded = sp_states_padded(states, attrib);
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* init scaling-related stuff */
+  if (parent_scaler)
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+
+    /* add up the scale vectors of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+  else
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+
+  float * lm = convert_matrix(states, states_padded, rate_cats, left_matrix);
+  float * rm = convert_matrix(states, states_padded, rate_cats, right_matrix);
+  if (!lm || !rm)
+  {
+    if (lm) free(lm);
+    if (rm) free(rm);
+    return;
+  }
+
+  /* compute CLV */
+  for (n = 0; n < sites; ++n)
+  {
+    lmat = lm;
+    rmat = rm;
+    site_scale = init_mask;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      unsigned int rate_scale = 1;
+      for (i = 0; i < states; ++i)
+      {
+        float terma = 0;
+        float termb = 0;
+        for (j = 0; j < states; ++j)
+        {
+          terma += lmat[j] * left_clv[j];
+          termb += rmat[j] * right_clv[j];
+        }
+        parent_clv[i] = terma*termb;
+
+        rate_scale &= (parent_clv[i] < PLL_SCALE_THRESHOLD_SP);
+
+        lmat += states_padded;
+        rmat += states_padded;
+      }
+      for (i = states; i < states_padded; ++i)
+        parent_clv[i] = 0;
+
+      /* check if scaling is needed for the current rate category */
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR_SP */
+        if (rate_scale)
+        {
+          for (i = 0; i < states; ++i)
+            parent_clv[i] *= PLL_SCALE_FACTOR_SP;
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        site_scale = site_scale && rate_scale;
+
+      parent_clv += states_padded;
+      left_clv   += states_padded;
+      right_clv  += states_padded;
+    }
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR_SP */
+    if (site_scale)
+    {
+      parent_clv -= span_padded;
+      for (i = 0; i < span_padded; ++i)
+        parent_clv[i] *= PLL_SCALE_FACTOR_SP;
+      parent_clv += span_padded;
+      parent_scaler[n] += 1;
+    }
+  }
+
+  free(lm);
+  free(rm);
+}
+
+PLL_EXPORT double pll_core_root_loglikelihood_sp(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const float * clv,
+                                                 const unsigned int * scaler,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib)
+{
+  unsigned int i,j,k;
+  double logl = 0;
+  const double * freqs = NULL;
+
+  double prop_invar = 0;
+
+  double term, term_inv, term_r;
+  double site_lk, inv_site_lk;
+
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_root_loglikelihood_sp_avx512(states,
+                                                 sites,
+                                                 rate_cats,
+                                                 clv,
+                                                 scaler,
+                                                 frequencies,
+                                                 rate_weights,
+                                                 pattern_weights,
+                                                 invar_proportion,
+                                                 invar_indices,
+                                                 freqs_indices,
+                                                 persite_lnl,
+                                                 attrib);
+  }
+#endif
+
+  unsigned int states_padded = sp_states_padded(states, attrib);
+
+  unsigned int site_scalings;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD_SP;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  /* iterate through sites */
+  for (i = 0; i < sites; ++i)
+  {
+    if (per_rate_scaling)
+    {
+      /* compute minimum per-rate scaler -> common per-site scaler */
+      site_scalings = UINT_MAX;
+      for (j = 0; j < rate_cats; ++j)
+      {
+        rate_scalings[j] = (scaler) ? scaler[i*rate_cats+j] : 0;
+        if (rate_scalings[j] < site_scalings)
+          site_scalings = rate_scalings[j];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (j = 0; j < rate_cats; ++j)
+      {
+        rate_scalings[j] = PLL_MIN(rate_scalings[j] - site_scalings,
+                                   PLL_SCALE_RATE_MAXDIFF);
+      }
+    }
+    else
+      site_scalings = (scaler) ? scaler[i] : 0;
+
+    term = term_inv = 0;
+    for (j = 0; j < rate_cats; ++j)
+    {
+      freqs = frequencies[freqs_indices[j]];
+      term_r = 0;
+      for (k = 0; k < states; ++k)
+      {
+        term_r += clv[k] * freqs[k];
+      }
+
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings && rate_scalings[j] > 0)
+        term_r *= scale_minlh[rate_scalings[j]-1];
+
+      /* account for invariant sites */
+      prop_invar = invar_proportion ? invar_proportion[freqs_indices[j]] : 0;
+      if (prop_invar > 0)
+      {
+        inv_site_lk = (invar_indices[i] == -1) ?
+                           0 : freqs[invar_indices[i]];
+        term += rate_weights[j] * term_r * (1 - prop_invar);
+        term_inv += rate_weights[j] * inv_site_lk * prop_invar;
+      }
+      else
+      {
+        term += term_r * rate_weights[j];
+      }
+
+      clv += states_padded;
+    }
+
+    /* compute site log-likelihood and scale if necessary */
+    site_lk = site_loglikelihood(term, term_inv, site_scalings);
+
+    site_lk *= pattern_weights[i];
+
+    /* store per-site log-likelihood */
+    if (persite_lnl)
+      persite_lnl[i] = site_lk;
+
+    logl += site_lk;
+  }
+
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return logl;
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_sp(unsigned int states,
+                                         unsigned int sites,
+                                         unsigned int rate_cats,
+                                         const float * parent_clv,
+                                         const unsigned int * parent_scaler,
+                                         const float * child_clv,
+                                         const unsigned int * child_scaler,
+                                         const double * pmatrix,
+                                         double * const * frequencies,
+                                         const double * rate_weights,
+                                         const unsigned int * pattern_weights,
+                                         const double * invar_proportion,
+                                         const int * invar_indices,
+                                         const unsigned int * freqs_indices,
+                                         double * persite_lnl,
+                                         unsigned int attrib)
+{
+  unsigned int n,i,j,k;
+  double logl = 0;
+
+  const float * clvp = parent_clv;
+  const float * clvc = child_clv;
+  double prop_invar = 0;
+  const float * pmat;
+  const double * freqs = NULL;
+
+  double terma, terma_inv, terma_r;
+  float termb;
+  double site_lk, inv_site_lk;
+
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_edge_loglikelihood_ii_sp_avx512(states,
+                                                    sites,
+                                                    rate_cats,
+                                                    parent_clv,
+                                                    parent_scaler,
+                                                    child_clv,
+                                                    child_scaler,
+                                                    pmatrix,
+                                                    frequencies,
+                                                    rate_weights,
+                                                    pattern_weights,
+                                                    invar_proportion,
+                                                    invar_indices,
+                                                    freqs_indices,
+                                                    persite_lnl,
+                                                    attrib);
+  }
+#endif
+
+  unsigned int states_padded = sp_states_padded(states, attrib);
+
+  unsigned int site_scalings;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  float * pm = convert_matrix(states, states_padded, rate_cats, pmatrix);
+  if (!pm)
+    return -INFINITY;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD_SP;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    if (per_rate_scaling)
+    {
+      /* compute minimum per-rate scaler -> common per-site scaler */
+      site_scalings = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[n*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[n*rate_cats+i] : 0;
+        if (rate_scalings[i] < site_scalings)
+          site_scalings = rate_scalings[i];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                                   PLL_SCALE_RATE_MAXDIFF);
+      }
+    }
+    else
+    {
+      /* count number of scaling factors to account for */
+      site_scalings =  (parent_scaler) ? parent_scaler[n] : 0;
+      site_scalings += (child_scaler) ? child_scaler[n] : 0;
+    }
+
+    pmat = pm;
+    terma = terma_inv = 0;
+    for (i = 0; i < rate_cats; ++i)
+    {
+      freqs = frequencies[freqs_indices[i]];
+      terma_r = 0;
+      for (j = 0; j < states; ++j)
+      {
+        termb = 0;
+        for (k = 0; k < states; ++k)
+        {
+          termb += pmat[k] * clvc[k];
+        }
+
+        terma_r += clvp[j] * freqs[j] * termb;
+        pmat += states_padded;
+      }
+
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings && rate_scalings[i] > 0)
+      {
+        terma_r *= scale_minlh[rate_scalings[i]-1];
+      }
+
+      /* account for invariant sites */
+      prop_invar = invar_proportion ? invar_proportion[freqs_indices[i]] : 0;
+      if (prop_invar > 0)
+      {
+        inv_site_lk = (invar_indices[n] == -1) ?
+                          0 : freqs[invar_indices[n]];
+        terma += rate_weights[i] * terma_r * (1 - prop_invar);
+        terma_inv += rate_weights[i] * inv_site_lk * prop_invar;
+      }
+      else
+      {
+        terma += terma_r * rate_weights[i];
+      }
+
+      clvp += states_padded;
+      clvc += states_padded;
+    }
+
+    /* compute site log-likelihood and scale if necessary */
+    site_lk = site_loglikelihood(terma, terma_inv, site_scalings);
+
+    site_lk *= pattern_weights[n];
+
+    /* store per-site log-likelihood */
+    if (persite_lnl)
+      persite_lnl[n] = site_lk;
+
+    logl += site_lk;
+  }
+
+  if (rate_scalings)
+    free(rate_scalings);
+  free(pm);
+
+  return logl;
+}
+
+PLL_EXPORT int pll_core_update_sumtable_ii_sp(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              const float * parent_clv,
+                                              const float * child_clv,
+                                              const unsigned int * parent_scaler,
+                                              const unsigned int * child_scaler,
+                                              double * const * eigenvecs,
+                                              double * const * inv_eigenvecs,
+                                              double * const * freqs,
+                                              double * sumtable,
+                                              unsigned int attrib)
+{
+  unsigned int i, j, k, n;
+  double lefterm  = 0;
+  double righterm = 0;
+
+  double * sum                   = sumtable;
+  const float * t_clvp           = parent_clv;
+  const float * t_clvc           = child_clv;
+  const double * t_eigenvecs;
+  const double * t_inv_eigenvecs;
+  const double * t_freqs;
+
+  /* the sumtable is laid out for the double-precision derivative kernels of
+     the selected architecture */
+  unsigned int states_padded = sp_states_padded(states, attrib);
+
+  unsigned int min_scaler;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      return PLL_FAILURE;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD_SP;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  /* build sumtable */
+  for (n = 0; n < sites; n++)
+  {
+    if (per_rate_scaling)
+    {
+      /* compute minimum per-rate scaler -> common per-site scaler */
+      min_scaler = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[n*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[n*rate_cats+i] : 0;
+        if (rate_scalings[i] < min_scaler)
+          min_scaler = rate_scalings[i];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - min_scaler,
+                                   PLL_SCALE_RATE_MAXDIFF);
+      }
+    }
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      t_eigenvecs     = eigenvecs[i];
+      t_inv_eigenvecs = inv_eigenvecs[i];
+      t_freqs         = freqs[i];
+
+      for (j = 0; j < states; ++j)
+      {
+        lefterm = 0;
+        righterm = 0;
+        for (k = 0; k < states; ++k)
+        {
+          lefterm  += t_clvp[k] * t_freqs[k] *
+                                      t_inv_eigenvecs[k * states_padded + j];
+          righterm += t_eigenvecs[j * states_padded + k] * t_clvc[k];
+        }
+        sum[j] = lefterm * righterm;
+
+        if (rate_scalings && rate_scalings[i] > 0)
+          sum[j] *= scale_minlh[rate_scalings[i]-1];
+      }
+      for (j = states; j < states_padded; ++j)
+        sum[j] = 0;
+
+      t_clvc += states_padded;
+      t_clvp += states_padded;
+      sum += states_padded;
+    }
+  }
+
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
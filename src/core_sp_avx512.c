@@ -0,0 +1,773 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+
+/* Single-precision AVX-512 kernels. A vector holds 16 floats; if the padded
+   number of states divides 16 (4, 8 or 16), the CLV entries of 16/states_padded
+   consecutive rate categories are processed as one vector ("packed" layout)
+   and the child entries are distributed to the lanes with a permutation.
+   Otherwise, each rate category is processed separately in chunks of 16
+   states, broadcasting the child entries as in the double-precision kernels.
+
+   In both cases the p-matrices are converted to float and transposed once per
+   call. Per-rate likelihoods are summed up in double precision. */
+
+#define LANE_MASK(n) (((n) >= 16) ? 0xFFFF : (__mmask16)((1u << (n)) - 1))
+
+static void fill_parent_scaler(unsigned int scaler_size,
+                               unsigned int * parent_scaler,
+                               const unsigned int * left_scaler,
+                               const unsigned int * right_scaler)
+{
+  unsigned int i;
+
+  if (!left_scaler && !right_scaler)
+    memset(parent_scaler, 0, sizeof(unsigned int) * scaler_size);
+  else if (left_scaler && right_scaler)
+  {
+    memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    for (i = 0; i < scaler_size; ++i)
+      parent_scaler[i] += right_scaler[i];
+  }
+  else
+  {
+    if (left_scaler)
+      memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    else
+      memcpy(parent_scaler, right_scaler, sizeof(unsigned int) * scaler_size);
+  }
+}
+
+static void * alloc_workspace(size_t size)
+{
+  void * mem = pll_aligned_alloc(size, PLL_ALIGNMENT_AVX512);
+  if (!mem)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return NULL;
+  }
+  memset(mem, 0, size);
+  return mem;
+}
+
+static inline int is_packed(unsigned int states_padded)
+{
+  return states_padded <= 16 && !(16 % states_padded);
+}
+
+/* size (in floats) of the matrix created by create_matrix() */
+static size_t matrix_size(unsigned int states,
+                          unsigned int states_padded,
+                          unsigned int rate_cats)
+{
+  if (is_packed(states_padded))
+  {
+    unsigned int rpb = 16 / states_padded;
+    return (size_t)((rate_cats + rpb - 1) / rpb) * states * 16;
+  }
+  return (size_t)rate_cats * states * states_padded;
+}
+
+/* convert the p-matrices to float. In the packed layout, vector j of block b
+   holds column j of the p-matrices of the rate categories in block b; in the
+   per-rate layout, row j of rate k holds column j of its p-matrix */
+static float * create_matrix(unsigned int states,
+                             unsigned int states_padded,
+                             unsigned int rate_cats,
+                             const double * matrix)
+{
+  unsigned int i,j,k;
+  size_t pmat_size = states * states_padded;
+
+  float * w = (float *)alloc_workspace(matrix_size(states,
+                                                   states_padded,
+                                                   rate_cats) * sizeof(float));
+  if (!w)
+    return NULL;
+
+  if (is_packed(states_padded))
+  {
+    unsigned int rpb = 16 / states_padded;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      float * wk = w + (k / rpb)*states*16 + (k % rpb)*states_padded;
+      const double * mk = matrix + k*pmat_size;
+
+      for (i = 0; i < states; ++i)
+        for (j = 0; j < states; ++j)
+          wk[j*16 + i] = (float)mk[i*states_padded + j];
+    }
+  }
+  else
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      float * wk = w + k*pmat_size;
+      const double * mk = matrix + k*pmat_size;
+
+      for (i = 0; i < states; ++i)
+        for (j = 0; j < states; ++j)
+          wk[j*states_padded + i] = (float)mk[i*states_padded + j];
+    }
+  }
+
+  return w;
+}
+
+/* permutation indices distributing entry j of each rate category of a packed
+   vector to all lanes of that rate category */
+static void create_permutations(unsigned int states,
+                                unsigned int states_padded,
+                                __m512i * perm)
+{
+  unsigned int j,l;
+  int idx[16];
+
+  for (j = 0; j < states; ++j)
+  {
+    for (l = 0; l < 16; ++l)
+      idx[l] = (int)((l / states_padded)*states_padded + j);
+    perm[j] = _mm512_loadu_si512((const void *)idx);
+  }
+}
+
+/* frequencies of all rate categories laid out as a (float) site CLV */
+static float * create_freqs(unsigned int states,
+                            unsigned int states_padded,
+                            unsigned int rate_cats,
+                            double * const * frequencies,
+                            const unsigned int * freqs_indices)
+{
+  unsigned int i,k;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  float * f = (float *)alloc_workspace(((span_padded + 15) & ~15u) *
+                                       sizeof(float));
+  if (!f)
+    return NULL;
+
+  for (k = 0; k < rate_cats; ++k)
+    for (i = 0; i < states; ++i)
+      f[k*states_padded + i] = (float)frequencies[freqs_indices[k]][i];
+
+  return f;
+}
+
+/* product of the p-matrices with the child entries of a packed block */
+static inline __m512 packed_term(unsigned int states,
+                                 const float * w,
+                                 const __m512i * perm,
+                                 __m512 v_clv)
+{
+  unsigned int j;
+  __m512 v_term = _mm512_setzero_ps();
+
+  for (j = 0; j < states; ++j)
+    v_term = _mm512_fmadd_ps(_mm512_load_ps(w + j*16),
+                             _mm512_permutexvar_ps(perm[j], v_clv),
+                             v_term);
+
+  return v_term;
+}
+
+/* product of entries [i, i+16) of a transposed p-matrix with a rate CLV */
+static inline __m512 rate_term(unsigned int states,
+                               unsigned int states_padded,
+                               const float * t,
+                               const float * clv,
+                               __mmask16 m)
+{
+  unsigned int j;
+  __m512 v_term = _mm512_setzero_ps();
+
+  for (j = 0; j < states; ++j)
+    v_term = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, t + j*states_padded),
+                             _mm512_set1_ps(clv[j]),
+                             v_term);
+
+  return v_term;
+}
+
+static void scale_clv(float * clv, unsigned int size)
+{
+  unsigned int i;
+  __m512 v_scale_factor = _mm512_set1_ps(PLL_SCALE_FACTOR_SP);
+
+  for (i = 0; i < size; i += 16)
+  {
+    __mmask16 m = LANE_MASK(size - i);
+    __m512 v_clv = _mm512_maskz_loadu_ps(m, clv + i);
+    _mm512_mask_storeu_ps(clv + i, m, _mm512_mul_ps(v_clv, v_scale_factor));
+  }
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_sp_avx512(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const float * left_clv,
+                                                     const float * right_clv,
+                                                     const double * left_matrix,
+                                                     const double * right_matrix,
+                                                     const unsigned int * left_scaler,
+                                                     const unsigned int * right_scaler,
+                                                     unsigned int attrib)
+{
+  unsigned int b,i,k,n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+  size_t pmat_size = states * states_padded;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+
+  float * lt = create_matrix(states, states_padded, rate_cats, left_matrix);
+  float * rt = create_matrix(states, states_padded, rate_cats, right_matrix);
+  if (!lt || !rt)
+  {
+    if (lt) pll_aligned_free(lt);
+    if (rt) pll_aligned_free(rt);
+    return;
+  }
+
+  __m512 v_scale_threshold = _mm512_set1_ps(PLL_SCALE_THRESHOLD_SP);
+  __m512 v_scale_factor = _mm512_set1_ps(PLL_SCALE_FACTOR_SP);
+
+  if (is_packed(states_padded))
+  {
+    __m512i perm[16];
+    unsigned int rpb = 16 / states_padded;
+    __mmask16 rate_mask = LANE_MASK(states_padded);
+
+    create_permutations(states, states_padded, perm);
+
+    for (n = 0; n < sites; ++n)
+    {
+      int site_scale = 1;
+
+      for (b = 0; b*16 < span_padded; ++b)
+      {
+        __mmask16 m = LANE_MASK(span_padded - b*16);
+
+        __m512 v_terma = packed_term(states,
+                                     lt + b*states*16,
+                                     perm,
+                                     _mm512_maskz_loadu_ps(m,
+                                                           left_clv + b*16));
+        __m512 v_termb = packed_term(states,
+                                     rt + b*states*16,
+                                     perm,
+                                     _mm512_maskz_loadu_ps(m,
+                                                           right_clv + b*16));
+
+        __m512 v_prod = _mm512_mul_ps(v_terma, v_termb);
+
+        __mmask16 below = _mm512_cmp_ps_mask(v_prod,
+                                             v_scale_threshold,
+                                             _CMP_LT_OS);
+
+        if (scale_mode == 2)
+        {
+          /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+           * the threshold then scale (all) entries by PLL_SCALE_FACTOR_SP */
+          for (k = 0; k < rpb && b*rpb + k < rate_cats; ++k)
+          {
+            __mmask16 g = (__mmask16)(rate_mask << (k*states_padded));
+            if ((below & g) == g)
+            {
+              v_prod = _mm512_mask_mul_ps(v_prod, g, v_prod, v_scale_factor);
+              parent_scaler[n*rate_cats + b*rpb + k] += 1;
+            }
+          }
+        }
+        else
+          site_scale &= ((below & m) == m);
+
+        _mm512_mask_storeu_ps(parent_clv + b*16, m, v_prod);
+      }
+
+      /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+       * the threshold then scale (all) entries by PLL_SCALE_FACTOR_SP */
+      if (scale_mode == 1 && site_scale)
+      {
+        scale_clv(parent_clv, span_padded);
+        parent_scaler[n] += 1;
+      }
+
+      parent_clv += span_padded;
+      left_clv   += span_padded;
+      right_clv  += span_padded;
+    }
+  }
+  else
+  {
+    for (n = 0; n < sites; ++n)
+    {
+      int site_scale = 1;
+
+      for (k = 0; k < rate_cats; ++k)
+      {
+        int rate_scale = 1;
+
+        for (i = 0; i < states_padded; i += 16)
+        {
+          __mmask16 m = LANE_MASK(states_padded - i);
+
+          __m512 v_prod = _mm512_mul_ps(rate_term(states,
+                                                  states_padded,
+                                                  lt + k*pmat_size + i,
+                                                  left_clv,
+                                                  m),
+                                        rate_term(states,
+                                                  states_padded,
+                                                  rt + k*pmat_size + i,
+                                                  right_clv,
+                                                  m));
+
+          __mmask16 below = _mm512_cmp_ps_mask(v_prod,
+                                               v_scale_threshold,
+                                               _CMP_LT_OS);
+          rate_scale &= ((below & m) == m);
+
+          _mm512_mask_storeu_ps(parent_clv + i, m, v_prod);
+        }
+
+        if (scale_mode == 2)
+        {
+          /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+           * the threshold then scale (all) entries by PLL_SCALE_FACTOR_SP */
+          if (rate_scale)
+          {
+            scale_clv(parent_clv, states_padded);
+            parent_scaler[n*rate_cats + k] += 1;
+          }
+        }
+        else
+          site_scale &= rate_scale;
+
+        parent_clv += states_padded;
+        left_clv   += states_padded;
+        right_clv  += states_padded;
+      }
+
+      /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+       * the threshold then scale (all) entries by PLL_SCALE_FACTOR_SP */
+      if (scale_mode == 1 && site_scale)
+      {
+        scale_clv(parent_clv - span_padded, span_padded);
+        parent_scaler[n] += 1;
+      }
+    }
+  }
+
+  pll_aligned_free(lt);
+  pll_aligned_free(rt);
+}
+
+/* compute the per-rate likelihoods term_r[k] (in double precision) of a site
+   as the sum of clvp * freqs * (P * clvc); if clvc is NULL, the product with
+   the p-matrix is omitted (root) */
+static inline void site_rate_terms(unsigned int states,
+                                   unsigned int states_padded,
+                                   unsigned int rate_cats,
+                                   const float * clvp,
+                                   const float * clvc,
+                                   const float * pt,
+                                   const __m512i * perm,
+                                   const float * freqs,
+                                   float * tmp,
+                                   double * term_r)
+{
+  unsigned int b,i,k;
+  unsigned int span_padded = states_padded * rate_cats;
+  size_t pmat_size = states * states_padded;
+
+  if (is_packed(states_padded))
+  {
+    unsigned int rpb = 16 / states_padded;
+
+    for (b = 0; b*16 < span_padded; ++b)
+    {
+      __mmask16 m = LANE_MASK(span_padded - b*16);
+      __m512 v_prod = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, clvp + b*16),
+                                    _mm512_load_ps(freqs + b*16));
+
+      if (clvc)
+        v_prod = _mm512_mul_ps(v_prod,
+                               packed_term(states,
+                                           pt + b*states*16,
+                                           perm,
+                                           _mm512_maskz_loadu_ps(m,
+                                                                 clvc + b*16)));
+
+      _mm512_store_ps(tmp, v_prod);
+
+      for (k = 0; k < rpb && b*rpb + k < rate_cats; ++k)
+      {
+        double sum = 0;
+        for (i = 0; i < states; ++i)
+          sum += tmp[k*states_padded + i];
+        term_r[b*rpb + k] = sum;
+      }
+    }
+    return;
+  }
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    for (i = 0; i < states_padded; i += 16)
+    {
+      __mmask16 m = LANE_MASK(states_padded - i);
+      __m512 v_prod = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, clvp + i),
+                                    _mm512_maskz_loadu_ps(m, freqs + i));
+
+      if (clvc)
+        v_prod = _mm512_mul_ps(v_prod,
+                               rate_term(states,
+                                         states_padded,
+                                         pt + k*pmat_size + i,
+                                         clvc,
+                                         m));
+
+      _mm512_mask_storeu_ps(tmp + i, m, v_prod);
+    }
+
+    double sum = 0;
+    for (i = 0; i < states; ++i)
+      sum += tmp[i];
+    term_r[k] = sum;
+
+    clvp  += states_padded;
+    freqs += states_padded;
+    if (clvc)
+      clvc += states_padded;
+  }
+}
+
+/* combine the per-rate likelihoods of a site into the site log-likelihood,
+   accounting for invariant sites and scalers. As CLVs are scaled much more
+   often in single precision, the variable and the invariant part are
+   combined in log space whenever the site was scaled */
+static inline double site_loglikelihood(unsigned int rate_cats,
+                                        const double * term_r,
+                                        double * const * frequencies,
+                                        const double * rate_weights,
+                                        const double * invar_proportion,
+                                        const int * invar_indices,
+                                        unsigned int site,
+                                        const unsigned int * freqs_indices,
+                                        unsigned int site_scalings,
+                                        const unsigned int * rate_scalings,
+                                        const double * scale_minlh)
+{
+  unsigned int i;
+  double terma = 0;
+  double terma_inv = 0;
+  double logl;
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    double terma_r = term_r[i];
+
+    /* apply per-rate scalers, if necessary */
+    if (rate_scalings && rate_scalings[i] > 0)
+      terma_r *= scale_minlh[rate_scalings[i]-1];
+
+    /* account for invariant sites */
+    double prop_invar = invar_proportion ?
+                          invar_proportion[freqs_indices[i]] : 0;
+    if (prop_invar > 0)
+    {
+      const double * freqs = frequencies[freqs_indices[i]];
+      double inv_site_lk = (invar_indices[site] == -1) ?
+                             0 : freqs[invar_indices[site]];
+      terma += rate_weights[i] * terma_r * (1 - prop_invar);
+      terma_inv += rate_weights[i] * inv_site_lk * prop_invar;
+    }
+    else
+    {
+      terma += terma_r * rate_weights[i];
+    }
+  }
+
+  if (!site_scalings)
+    return log(terma + terma_inv);
+
+  logl = log(terma) + site_scalings * log(PLL_SCALE_THRESHOLD_SP);
+  if (terma_inv > 0)
+  {
+    double logl_inv = log(terma_inv);
+    if (logl_inv > logl)
+      logl = logl_inv + log1p(exp(logl - logl_inv));
+    else
+      logl += log1p(exp(logl_inv - logl));
+  }
+
+  return logl;
+}
+
+/* compute the number of scaling factors to account for at a site; in per-rate
+   mode also the relative capped per-rate scalers */
+static inline unsigned int site_scalers(unsigned int rate_cats,
+                                        const unsigned int * parent_scaler,
+                                        const unsigned int * child_scaler,
+                                        unsigned int site,
+                                        unsigned int * rate_scalings)
+{
+  unsigned int i;
+  unsigned int site_scalings;
+
+  if (rate_scalings)
+  {
+    /* compute minimum per-rate scaler -> common per-site scaler */
+    site_scalings = UINT_MAX;
+    for (i = 0; i < rate_cats; ++i)
+    {
+      rate_scalings[i] = (parent_scaler) ? parent_scaler[site*rate_cats+i] : 0;
+      rate_scalings[i] += (child_scaler) ? child_scaler[site*rate_cats+i] : 0;
+      if (rate_scalings[i] < site_scalings)
+        site_scalings = rate_scalings[i];
+    }
+
+    /* compute relative capped per-rate scalers */
+    for (i = 0; i < rate_cats; ++i)
+    {
+      rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                                 PLL_SCALE_RATE_MAXDIFF);
+    }
+  }
+  else
+  {
+    /* count number of scaling factors to account for */
+    site_scalings =  (parent_scaler) ? parent_scaler[site] : 0;
+    site_scalings += (child_scaler) ? child_scaler[site] : 0;
+  }
+
+  return site_scalings;
+}
+
+static double loglikelihood_sp(unsigned int states,
+                               unsigned int sites,
+                               unsigned int rate_cats,
+                               const float * parent_clv,
+                               const unsigned int * parent_scaler,
+                               const float * child_clv,
+                               const unsigned int * child_scaler,
+                               const double * pmatrix,
+                               double * const * frequencies,
+                               const double * rate_weights,
+                               const unsigned int * pattern_weights,
+                               const double * invar_proportion,
+                               const int * invar_indices,
+                               const unsigned int * freqs_indices,
+                               double * persite_lnl,
+                               unsigned int attrib)
+{
+  unsigned int i,n;
+  double logl = 0;
+  double term;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  __m512i perm[16];
+  float * pt = NULL;
+  unsigned int * rate_scalings = NULL;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  float * freqs = create_freqs(states,
+                               states_padded,
+                               rate_cats,
+                               frequencies,
+                               freqs_indices);
+  double * term_r = (double *)alloc_workspace(rate_cats * sizeof(double));
+  float * tmp = (float *)alloc_workspace(((states_padded + 15) & ~15u) *
+                                         sizeof(float));
+  if (child_clv)
+    pt = create_matrix(states, states_padded, rate_cats, pmatrix);
+
+  if (!freqs || !term_r || !tmp || (child_clv && !pt))
+  {
+    if (freqs) pll_aligned_free(freqs);
+    if (term_r) pll_aligned_free(term_r);
+    if (tmp) pll_aligned_free(tmp);
+    if (pt) pll_aligned_free(pt);
+    return -INFINITY;
+  }
+
+  if (is_packed(states_padded))
+    create_permutations(states, states_padded, perm);
+
+  if (attrib & PLL_ATTRIB_RATE_SCALERS)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    /* powers of scale threshold for undoing the scaling */
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD_SP;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+
+  for (n = 0; n < sites; ++n)
+  {
+    unsigned int site_scalings = site_scalers(rate_cats,
+                                              parent_scaler,
+                                              child_scaler,
+                                              n,
+                                              rate_scalings);
+
+    site_rate_terms(states,
+                    states_padded,
+                    rate_cats,
+                    parent_clv,
+                    child_clv,
+                    pt,
+                    perm,
+                    freqs,
+                    tmp,
+                    term_r);
+
+    term = site_loglikelihood(rate_cats,
+                              term_r,
+                              frequencies,
+                              rate_weights,
+                              invar_proportion,
+                              invar_indices,
+                              n,
+                              freqs_indices,
+                              site_scalings,
+                              rate_scalings,
+                              scale_minlh);
+
+    term *= pattern_weights[n];
+
+    /* store per-site log-likelihood */
+    if (persite_lnl)
+      persite_lnl[n] = term;
+
+    logl += term;
+
+    parent_clv += span_padded;
+    if (child_clv)
+      child_clv += span_padded;
+  }
+
+  if (rate_scalings)
+    free(rate_scalings);
+  if (pt)
+    pll_aligned_free(pt);
+  pll_aligned_free(freqs);
+  pll_aligned_free(term_r);
+  pll_aligned_free(tmp);
+
+  return logl;
+}
+
+PLL_EXPORT double pll_core_root_loglikelihood_sp_avx512(unsigned int states,
+                                                        unsigned int sites,
+                                                        unsigned int rate_cats,
+                                                        const float * clv,
+                                                        const unsigned int * scaler,
+                                                        double * const * frequencies,
+                                                        const double * rate_weights,
+                                                        const unsigned int * pattern_weights,
+                                                        const double * invar_proportion,
+                                                        const int * invar_indices,
+                                                        const unsigned int * freqs_indices,
+                                                        double * persite_lnl,
+                                                        unsigned int attrib)
+{
+  return loglikelihood_sp(states,
+                          sites,
+                          rate_cats,
+                          clv,
+                          scaler,
+                          NULL,
+                          NULL,
+                          NULL,
+                          frequencies,
+                          rate_weights,
+                          pattern_weights,
+                          invar_proportion,
+                          invar_indices,
+                          freqs_indices,
+                          persite_lnl,
+                          attrib);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_sp_avx512(unsigned int states,
+                                                unsigned int sites,
+                                                unsigned int rate_cats,
+                                                const float * parent_clv,
+                                                const unsigned int * parent_scaler,
+                                                const float * child_clv,
+                                                const unsigned int * child_scaler,
+                                                const double * pmatrix,
+                                                double * const * frequencies,
+                                                const double * rate_weights,
+                                                const unsigned int * pattern_weights,
+                                                const double * invar_proportion,
+                                                const int * invar_indices,
+                                                const unsigned int * freqs_indices,
+                                                double * persite_lnl,
+                                                unsigned int attrib)
+{
+  return loglikelihood_sp(states,
+                          sites,
+                          rate_cats,
+                          parent_clv,
+                          parent_scaler,
+                          child_clv,
+                          child_scaler,
+                          pmatrix,
+                          frequencies,
+                          rate_weights,
+                          pattern_weights,
+                          invar_proportion,
+                          invar_indices,
+                          freqs_indices,
+                          persite_lnl,
+                          attrib);
+}
@@ -19,21 +19,130 @@
     Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
 */
 
+#include <limits.h>
 #include "pll.h"
 
-static int sumtable_tipinner(pll_partition_t * partition,
-                             unsigned int parent_clv_index,
-                             unsigned int child_clv_index,
-                             const unsigned int * parent_scaler,
-                             const unsigned int * child_scaler,
-                             const unsigned int * params_indices,
-                             double *sumtable)
+/* arguments of a sumtable update over a range of sites */
+typedef struct sumtable_args_s
 {
-  unsigned int i, retval;
-  unsigned int tip_clv_index;
-  unsigned int inner_clv_index;
-  unsigned int sites = partition->sites;
-  const unsigned int * scaler;
+  pll_partition_t * partition;
+  unsigned int parent_clv_index;
+  unsigned int child_clv_index;
+  const unsigned int * parent_scaler;
+  const unsigned int * child_scaler;
+  double ** eigenvecs;
+  double ** inv_eigenvecs;
+  double ** freqs;
+  double * sumtable;
+  unsigned int begin;
+  unsigned int end;
+  int (*range)(const struct sumtable_args_s * args,
+               unsigned int begin,
+               unsigned int end);
+} sumtable_args_t;
+
+static double * clv_site(const pll_partition_t * partition,
+                         double * clv,
+                         unsigned int site)
+{
+  size_t span = partition->states_padded * partition->rate_cats;
+
+  if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+    return (double *)((float *)clv + site * span);
+
+  return clv + site * span;
+}
+
+static const unsigned int * scaler_site(const pll_partition_t * partition,
+                                        const unsigned int * scaler,
+                                        unsigned int site)
+{
+  if (!scaler) return NULL;
+
+  if (partition->attributes & PLL_ATTRIB_RATE_SCALERS)
+    return scaler + site * partition->rate_cats;
+
+  return scaler + site;
+}
+
+/* in the tip-inner case, parent_clv_index is the inner node */
+static int sumtable_tipinner_range(const sumtable_args_t * args,
+                                   unsigned int begin,
+                                   unsigned int end)
+{
+  pll_partition_t * partition = args->partition;
+
+  return partition->kernels.update_sumtable_ti(partition->states,
+                                               end - begin,
+                                               partition->rate_cats,
+                                               clv_site(partition,
+                                                        partition->clv[args->parent_clv_index],
+                                                        begin),
+                                               partition->tipchars[args->child_clv_index]
+                                                 + begin,
+                                               scaler_site(partition,
+                                                           args->parent_scaler,
+                                                           begin),
+                                               args->eigenvecs,
+                                               args->inv_eigenvecs,
+                                               args->freqs,
+                                               partition->tipmap,
+                                               partition->maxstates,
+                                               args->sumtable + (size_t)begin *
+                                                 partition->rate_cats *
+                                                 partition->states_padded,
+                                               partition->attributes);
+}
+
+static int sumtable_innerinner_range(const sumtable_args_t * args,
+                                     unsigned int begin,
+                                     unsigned int end)
+{
+  pll_partition_t * partition = args->partition;
+
+  return partition->kernels.update_sumtable_ii(partition->states,
+                                               end - begin,
+                                               partition->rate_cats,
+                                               clv_site(partition,
+                                                        partition->clv[args->parent_clv_index],
+                                                        begin),
+                                               clv_site(partition,
+                                                        partition->clv[args->child_clv_index],
+                                                        begin),
+                                               scaler_site(partition,
+                                                           args->parent_scaler,
+                                                           begin),
+                                               scaler_site(partition,
+                                                           args->child_scaler,
+                                                           begin),
+                                               args->eigenvecs,
+                                               args->inv_eigenvecs,
+                                               args->freqs,
+                                               args->sumtable + (size_t)begin *
+                                                 partition->rate_cats *
+                                                 partition->states_padded,
+                                               partition->attributes);
+}
+
+static int sumtable_job(void * data, unsigned int tid, unsigned int count)
+{
+  sumtable_args_t * args = (sumtable_args_t *)data;
+  unsigned int begin, end;
+
+  pll_threadpool_sites(args->end - args->begin, tid, count, &begin, &end);
+
+  return (begin < end) ?
+           args->range(args, args->begin + begin, args->begin + end) :
+           PLL_SUCCESS;
+}
+
+static int sumtable_sites(pll_partition_t * partition,
+                          sumtable_args_t * args,
+                          const unsigned int * params_indices,
+                          struct pll_threadpool * pool)
+{
+  unsigned int i;
+  int retval;
 
   double ** eigenvecs = (double **)malloc(partition->rate_cats *
                                           sizeof(double *));
@@ -52,10 +161,6 @@ static int sumtable_tipinner(pll_partition_t * partition,
     return PLL_FAILURE;
   }
 
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->states;
-
   for (i = 0; i < partition->rate_cats; ++i)
   {
     eigenvecs[i] = partition->eigenvecs[params_indices[i]];
@@ -63,39 +168,58 @@ static int sumtable_tipinner(pll_partition_t * partition,
     freqs[i] = partition->frequencies[params_indices[i]];
   }
 
+  args->partition = partition;
+  args->eigenvecs = eigenvecs;
+  args->inv_eigenvecs = inv_eigenvecs;
+  args->freqs = freqs;
+
+  if (pool)
+    retval = pll_threadpool_run(pool, sumtable_job, args);
+  else if (args->begin < args->end)
+    retval = args->range(args, args->begin, args->end);
+  else
+    retval = PLL_SUCCESS;
+
+  free(freqs);
+  free(eigenvecs);
+  free(inv_eigenvecs);
+
+  return retval;
+}
+
+static int sumtable_tipinner(pll_partition_t * partition,
+                             unsigned int parent_clv_index,
+                             unsigned int child_clv_index,
+                             const unsigned int * parent_scaler,
+                             const unsigned int * child_scaler,
+                             const unsigned int * params_indices,
+                             double *sumtable,
+                             unsigned int begin,
+                             unsigned int end,
+                             struct pll_threadpool * pool)
+{
+  sumtable_args_t args;
+
   /* find which of the two child nodes is the tip */
   if (parent_clv_index < partition->tips)
   {
-    tip_clv_index = parent_clv_index;
-    inner_clv_index = child_clv_index;
-    scaler = child_scaler;
+    args.child_clv_index = parent_clv_index;
+    args.parent_clv_index = child_clv_index;
+    args.parent_scaler = child_scaler;
   }
   else
   {
-    tip_clv_index = child_clv_index;
-    inner_clv_index = parent_clv_index;
-    scaler = parent_scaler;
+    args.child_clv_index = child_clv_index;
+    args.parent_clv_index = parent_clv_index;
+    args.parent_scaler = parent_scaler;
   }
+  args.child_scaler = NULL;
+  args.sumtable = sumtable;
+  args.begin = begin;
+  args.end = end;
+  args.range = sumtable_tipinner_range;
 
-  retval = pll_core_update_sumtable_ti(partition->states,
-                                       sites,
-                                       partition->rate_cats,
-                                       partition->clv[inner_clv_index],
-                                       partition->tipchars[tip_clv_index],
-                                       scaler,
-                                       eigenvecs,
-                                       inv_eigenvecs,
-                                       freqs,
-                                       partition->tipmap,
-                                       partition->maxstates,
-                                       sumtable,
-                                       partition->attributes);
-
-  free(freqs);
-  free(eigenvecs);
-  free(inv_eigenvecs);
-
-  return retval;
+  return sumtable_sites(partition, &args, params_indices, pool);
 }
 
 static int sumtable_innerinner(pll_partition_t * partition,
@@ -104,56 +228,92 @@ static int sumtable_innerinner(pll_partition_t * partition,
                                 const unsigned int * parent_scaler,
                                 const unsigned int * child_scaler,
                                 const unsigned int * params_indices,
-                                double *sumtable)
+                                double *sumtable,
+                                unsigned int begin,
+                                unsigned int end,
+                                struct pll_threadpool * pool)
 {
-  unsigned int i, retval;
-  unsigned int sites = partition->sites;
+  sumtable_args_t args;
 
-  double ** eigenvecs = (double **)malloc(partition->rate_cats *
-                                          sizeof(double *));
-  double ** inv_eigenvecs = (double **)malloc(partition->rate_cats *
-                                              sizeof(double *));
-  double ** freqs = (double **)malloc(partition->rate_cats *
-                                      sizeof(double *));
-  if (!eigenvecs || !inv_eigenvecs || !freqs)
-  {
-    if (eigenvecs) free(eigenvecs);
-    if (inv_eigenvecs) free(inv_eigenvecs);
-    if (freqs) free(freqs);
+  args.parent_clv_index = parent_clv_index;
+  args.child_clv_index = child_clv_index;
+  args.parent_scaler = parent_scaler;
+  args.child_scaler = child_scaler;
+  args.sumtable = sumtable;
+  args.begin = begin;
+  args.end = end;
+  args.range = sumtable_innerinner_range;
 
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
-    return PLL_FAILURE;
-  }
+  return sumtable_sites(partition, &args, params_indices, pool);
+}
 
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->asc_additional_sites;
+/* updates the sumtable entries of sites [begin,end), splitting them among
+   the threads of pool if given */
+static int update_sumtable_sites(pll_partition_t * partition,
+                                 unsigned int parent_clv_index,
+                                 unsigned int child_clv_index,
+                                 const unsigned int * parent_scaler,
+                                 const unsigned int * child_scaler,
+                                 const unsigned int * params_indices,
+                                 double * sumtable,
+                                 unsigned int begin,
+                                 unsigned int end,
+                                 struct pll_threadpool * pool)
+{
+  int retval = PLL_FAILURE;
 
-  for (i = 0; i < partition->rate_cats; ++i)
+  if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
   {
-    eigenvecs[i] = partition->eigenvecs[params_indices[i]];
-    inv_eigenvecs[i] = partition->inv_eigenvecs[params_indices[i]];
-    freqs[i] = partition->frequencies[params_indices[i]];
+    if ((parent_clv_index < partition->tips) &&
+        (child_clv_index < partition->tips))
+    {
+      /* tip-tip case */
+      assert(0);
+    }
+    else if ((parent_clv_index < partition->tips) ||
+             (child_clv_index < partition->tips))
+    {
+      /* tip-inner */
+      retval = sumtable_tipinner(partition,
+                                 parent_clv_index,
+                                 child_clv_index,
+                                 parent_scaler,
+                                 child_scaler,
+                                 params_indices,
+                                 sumtable,
+                                 begin,
+                                 end,
+                                 pool);
+    }
+    else
+    {
+      /* inner-inner */
+      retval = sumtable_innerinner(partition,
+                                   parent_clv_index,
+                                   child_clv_index,
+                                   parent_scaler,
+                                   child_scaler,
+                                   params_indices,
+                                   sumtable,
+                                   begin,
+                                   end,
+                                   pool);
+    }
+  }
+  else
+  {
+    /* inner-inner */
+    retval = sumtable_innerinner(partition,
+                                 parent_clv_index,
+                                 child_clv_index,
+                                 parent_scaler,
+                                 child_scaler,
+                                 params_indices,
+                                 sumtable,
+                                 begin,
+                                 end,
+                                 pool);
   }
-
-  retval =
-  pll_core_update_sumtable_ii(partition->states,
-                              sites,
-                              partition->rate_cats,
-                              partition->clv[parent_clv_index],
-                              partition->clv[child_clv_index],
-                              parent_scaler,
-                              child_scaler,
-                              eigenvecs,
-                              inv_eigenvecs,
-                              freqs,
-                              sumtable,
-                              partition->attributes);
-
-  free(freqs);
-  free(eigenvecs);
-  free(inv_eigenvecs);
 
   return retval;
 }
@@ -206,23 +366,23 @@ static int sumtable_repeats(pll_partition_t * partition,
   unsigned int child_ids = pll_get_sites_number(partition, child_clv_index);
   unsigned int inv = parent_ids > child_ids;
   retval =
-    pll_core_update_sumtable_repeats(partition->states,
-                        sites,
-                        inv ? child_ids : parent_ids,
-                        partition->rate_cats,
-                        partition->clv[inv ? child_clv_index : parent_clv_index],
-                        partition->clv[!inv ? child_clv_index : parent_clv_index],
-                        inv ? child_scaler : parent_scaler,
-                        !inv ? child_scaler : parent_scaler,
-                        eigenvecs,
-                        inv_eigenvecs,
-                        freqs,
-                        sumtable,
-                        inv ? child_site_id : parent_site_id,
-                        !inv ? child_site_id : parent_site_id,
-                        partition->repeats->bclv_buffer,
-                        inv,
-                        partition->attributes);
+    partition->kernels.update_sumtable_repeats(partition->states,
+                                               sites,
+                                               inv ? child_ids : parent_ids,
+                                               partition->rate_cats,
+                                               partition->clv[inv ? child_clv_index : parent_clv_index],
+                                               partition->clv[!inv ? child_clv_index : parent_clv_index],
+                                               inv ? child_scaler : parent_scaler,
+                                               !inv ? child_scaler : parent_scaler,
+                                               eigenvecs,
+                                               inv_eigenvecs,
+                                               freqs,
+                                               sumtable,
+                                               inv ? child_site_id : parent_site_id,
+                                               !inv ? child_site_id : parent_site_id,
+                                               partition->repeats->bclv_buffer,
+                                               inv,
+                                               partition->attributes);
 
   free(freqs);
   free(eigenvecs);
@@ -243,10 +403,15 @@ PLL_EXPORT int pll_update_sumtable(pll_partition_t * partition,
                                       double *sumtable)
 {
   int retval;
+  unsigned int clv_indices[2] = {parent_clv_index, child_clv_index};
 
   unsigned int * parent_scaler;
   unsigned int * child_scaler;
 
+  /* recompute evicted CLVs under PLL_ATTRIB_LIMIT_MEMORY */
+  if (!pll_clv_require(partition, clv_indices, 2))
+    return PLL_FAILURE;
+
   /* get parent scaler */
   if (parent_scaler_index == PLL_SCALE_BUFFER_NONE)
     parent_scaler = NULL;
@@ -271,71 +436,116 @@ PLL_EXPORT int pll_update_sumtable(pll_partition_t * partition,
                                  params_indices,
                                  sumtable);
   }
-  else if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+  else
   {
-    if ((parent_clv_index < partition->tips) &&
-        (child_clv_index < partition->tips))
-    {
-      /* tip-tip case */
-      assert(0);
-    }
-    else if ((parent_clv_index < partition->tips) ||
-             (child_clv_index < partition->tips))
-    {
-      /* tip-inner */
-      retval = sumtable_tipinner(partition,
-                                 parent_clv_index,
-                                 child_clv_index,
-                                 parent_scaler,
-                                 child_scaler,
-                                 params_indices,
-                                 sumtable);
-    }
-    else
-    {
-      /* inner-inner */
-      retval = sumtable_innerinner(partition,
+    /* ascertainment bias sites are included */
+    retval = update_sumtable_sites(partition,
                                    parent_clv_index,
                                    child_clv_index,
                                    parent_scaler,
                                    child_scaler,
                                    params_indices,
-                                   sumtable);
-    }
+                                   sumtable,
+                                   0,
+                                   partition->sites +
+                                     partition->asc_additional_sites,
+                                   partition->threadpool);
   }
-  else
+
+  pll_clv_release(partition, clv_indices, 2);
+
+  return retval;
+}
+
+/* checks that the sites [begin,end) can be processed independently of the
+   remaining sites */
+static int check_site_range(const pll_partition_t * partition,
+                            unsigned int begin,
+                            unsigned int end,
+                            unsigned int sites)
+{
+  if (pll_repeats_enabled(partition))
   {
-    /* inner-inner */
-    retval = sumtable_innerinner(partition,
-                                 parent_clv_index,
-                                 child_clv_index,
-                                 parent_scaler,
-                                 child_scaler,
-                                 params_indices,
-                                 sumtable);
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with site repeats.");
+    return PLL_FAILURE;
   }
 
-  return retval;
+  if (begin > end || end > sites)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Invalid site range [%u,%u) (sites: %u).", begin, end, sites);
+    return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
 }
 
-/* Computes partial derivatives on the branch lengths.
- * branch_length: [input] value where the derivative is computed
- * sumtable: [input] must be computed at the edge where the derivatives will
- *                   be computed
- * d_f:  [output] first derivative
- * dd_f: [output] second derivative
- */
-PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
-                                                  int parent_scaler_index,
-                                                  int child_scaler_index,
-                                                  double branch_length,
-                                                  const unsigned int * params_indices,
-                                                  const double * sumtable,
-                                                  double * d_f,
-                                                  double * dd_f)
+/* same as pll_update_sumtable, but only updates the entries of sites
+ * [site_begin, site_end), which may include the ascertainment bias sites
+ * (site_end <= sites + asc_additional_sites). The entries are stored at their
+ * offset in a sumtable allocated for all sites */
+PLL_EXPORT int pll_update_sumtable_range(pll_partition_t * partition,
+                                         unsigned int parent_clv_index,
+                                         unsigned int child_clv_index,
+                                         int parent_scaler_index,
+                                         int child_scaler_index,
+                                         const unsigned int * params_indices,
+                                         double * sumtable,
+                                         unsigned int site_begin,
+                                         unsigned int site_end)
+{
+  if (!check_site_range(partition,
+                        site_begin,
+                        site_end,
+                        partition->sites + partition->asc_additional_sites))
+    return PLL_FAILURE;
+
+  if (partition->clv_manager)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  return update_sumtable_sites(partition,
+                               parent_clv_index,
+                               child_clv_index,
+                               (parent_scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                                 NULL :
+                                 partition->scale_buffer[parent_scaler_index],
+                               (child_scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                                 NULL :
+                                 partition->scale_buffer[child_scaler_index],
+                               params_indices,
+                               sumtable,
+                               site_begin,
+                               site_end,
+                               NULL);
+}
+
+/* arguments of a derivatives computation over a range of sites */
+typedef struct derivatives_args_s
+{
+  pll_partition_t * partition;
+  const unsigned int * parent_scaler;
+  const unsigned int * child_scaler;
+  double branch_length;
+  double * prop_invar;
+  double ** freqs;
+  double ** eigenvals;
+  const double * sumtable;
+  double * d_f;   /* per-thread partial sums */
+  double * dd_f;
+} derivatives_args_t;
+
+static int derivatives_params(pll_partition_t * partition,
+                              const unsigned int * params_indices,
+                              derivatives_args_t * args)
 {
-  unsigned int * parent_scaler;
-  unsigned int * child_scaler;
   unsigned int i;
   unsigned int rate_cats = partition->rate_cats;
 
@@ -360,6 +570,122 @@ PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
     prop_invar[i] = partition->prop_invar[params_indices[i]];
   }
 
+  args->partition = partition;
+  args->eigenvals = eigenvals;
+  args->freqs = freqs;
+  args->prop_invar = prop_invar;
+
+  return PLL_SUCCESS;
+}
+
+static int derivatives_range(const derivatives_args_t * args,
+                             unsigned int begin,
+                             unsigned int end,
+                             double * d_f,
+                             double * dd_f)
+{
+  pll_partition_t * partition = args->partition;
+
+  if (begin == end)
+  {
+    *d_f = *dd_f = 0;
+    return PLL_SUCCESS;
+  }
+
+  return partition->kernels.likelihood_derivatives(partition->states,
+                                                   end - begin,
+                                                   partition->rate_cats,
+                                                   partition->rate_weights,
+                                                   scaler_site(partition,
+                                                               args->parent_scaler,
+                                                               begin),
+                                                   scaler_site(partition,
+                                                               args->child_scaler,
+                                                               begin),
+                                                   end - begin,
+                                                   end - begin,
+                                                   partition->invariant ?
+                                                     partition->invariant + begin : NULL,
+                                                   partition->pattern_weights + begin,
+                                                   args->branch_length,
+                                                   args->prop_invar,
+                                                   args->freqs,
+                                                   partition->rates,
+                                                   args->eigenvals,
+                                                   args->sumtable + (size_t)begin *
+                                                     partition->rate_cats *
+                                                     partition->states_padded,
+                                                   d_f,
+                                                   dd_f,
+                                                   partition->attributes);
+}
+
+static int derivatives_job(void * data, unsigned int tid, unsigned int count)
+{
+  derivatives_args_t * args = (derivatives_args_t *)data;
+  unsigned int begin, end;
+
+  pll_threadpool_sites(args->partition->sites, tid, count, &begin, &end);
+
+  return derivatives_range(args, begin, end, args->d_f + tid, args->dd_f + tid);
+}
+
+static int derivatives_threads(pll_partition_t * partition,
+                               derivatives_args_t * args,
+                               double * d_f,
+                               double * dd_f)
+{
+  unsigned int i;
+  unsigned int count = pll_threadpool_size(partition->threadpool);
+  int retval;
+
+  args->d_f = (double *)malloc(2 * count * sizeof(double));
+  if (!args->d_f)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+  args->dd_f = args->d_f + count;
+
+  retval = pll_threadpool_run(partition->threadpool, derivatives_job, args);
+
+  /* reduce in thread order to obtain reproducible results */
+  *d_f = *dd_f = 0;
+  for (i = 0; i < count; ++i)
+  {
+    *d_f += args->d_f[i];
+    *dd_f += args->dd_f[i];
+  }
+
+  free(args->d_f);
+
+  return retval;
+}
+
+/* Computes partial derivatives on the branch lengths.
+ * branch_length: [input] value where the derivative is computed
+ * sumtable: [input] must be computed at the edge where the derivatives will
+ *                   be computed
+ * d_f:  [output] first derivative
+ * dd_f: [output] second derivative
+ */
+PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
+                                                  int parent_scaler_index,
+                                                  int child_scaler_index,
+                                                  double branch_length,
+                                                  const unsigned int * params_indices,
+                                                  const double * sumtable,
+                                                  double * d_f,
+                                                  double * dd_f)
+{
+  derivatives_args_t args;
+  unsigned int * parent_scaler;
+  unsigned int * child_scaler;
+
+  if (!derivatives_params(partition, params_indices, &args))
+    return PLL_FAILURE;
+
   /* get parent scaler */
   if (parent_scaler_index == PLL_SCALE_BUFFER_NONE)
     parent_scaler = NULL;
@@ -385,29 +711,521 @@ PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
       : 0;
     child_ids = child_ids ? child_ids : partition->sites;
   }
-  int retval = pll_core_likelihood_derivatives(partition->states,
-                                               partition->sites,
+
+  int retval;
+
+  /* the ascertainment bias correction needs the derivatives of all sites,
+     hence only the plain case is split among threads */
+  if (partition->threadpool && !pll_repeats_enabled(partition) &&
+      !(partition->attributes & PLL_ATTRIB_AB_MASK))
+  {
+    args.parent_scaler = parent_scaler;
+    args.child_scaler = child_scaler;
+    args.branch_length = branch_length;
+    args.sumtable = sumtable;
+
+    retval = derivatives_threads(partition, &args, d_f, dd_f);
+  }
+  else
+    retval = partition->kernels.likelihood_derivatives(partition->states,
+                                                       partition->sites,
+                                                       partition->rate_cats,
+                                                       partition->rate_weights,
+                                                       parent_scaler,
+                                                       child_scaler,
+                                                       parent_ids,
+                                                       child_ids,
+                                                       partition->invariant,
+                                                       partition->pattern_weights,
+                                                       branch_length,
+                                                       args.prop_invar,
+                                                       args.freqs,
+                                                       partition->rates,
+                                                       args.eigenvals,
+                                                       sumtable,
+                                                       d_f,
+                                                       dd_f,
+                                                       partition->attributes);
+
+  free (args.freqs);
+  free (args.prop_invar);
+  free (args.eigenvals);
+
+  return retval;
+}
+
+/* same as pll_compute_likelihood_derivatives, but only accounts for sites
+ * [site_begin, site_end). The derivatives of disjoint ranges add up to the
+ * derivatives of the whole partition. Ascertainment bias correction is not
+ * supported, as it depends on all sites.
+ * sumtable: [input] sumtable of all sites (or at least of the range)
+ */
+PLL_EXPORT int pll_compute_likelihood_derivatives_range(pll_partition_t * partition,
+                                                        int parent_scaler_index,
+                                                        int child_scaler_index,
+                                                        double branch_length,
+                                                        const unsigned int * params_indices,
+                                                        const double * sumtable,
+                                                        double * d_f,
+                                                        double * dd_f,
+                                                        unsigned int site_begin,
+                                                        unsigned int site_end)
+{
+  derivatives_args_t args;
+  int retval;
+
+  if (!check_site_range(partition, site_begin, site_end, partition->sites))
+    return PLL_FAILURE;
+
+  if (partition->attributes & PLL_ATTRIB_AB_MASK)
+  {
+    pll_errno = PLL_ERROR_AB_NOSUPPORT;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with ascertainment bias correction.");
+    return PLL_FAILURE;
+  }
+
+  if (!derivatives_params(partition, params_indices, &args))
+    return PLL_FAILURE;
+
+  args.parent_scaler = (parent_scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                         NULL : partition->scale_buffer[parent_scaler_index];
+  args.child_scaler = (child_scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                         NULL : partition->scale_buffer[child_scaler_index];
+  args.branch_length = branch_length;
+  args.sumtable = sumtable;
+
+  retval = derivatives_range(&args, site_begin, site_end, d_f, dd_f);
+
+  free (args.freqs);
+  free (args.prop_invar);
+  free (args.eigenvals);
+
+  return retval;
+}
+
+/* arguments of a multi-point derivatives computation over a range of sites */
+typedef struct derivatives_multi_args_s
+{
+  derivatives_args_t params;
+  const unsigned int * site_scalings;
+  unsigned int count;
+  const double * branch_lengths;
+  double * logl;   /* per-thread partial sums, count values per thread */
+  double * d_f;
+  double * dd_f;
+} derivatives_multi_args_t;
+
+/* number of scaling events of each site at the edge, as accounted for by the
+   log-likelihood functions */
+static int derivatives_site_scalings(pll_partition_t * partition,
+                                     unsigned int parent_clv_index,
+                                     unsigned int child_clv_index,
+                                     const unsigned int * parent_scaler,
+                                     const unsigned int * child_scaler,
+                                     unsigned int ** site_scalings)
+{
+  unsigned int i, n;
+  unsigned int rate_cats = partition->rate_cats;
+  const unsigned int * parent_site_id = pll_get_site_id(partition,
+                                                        parent_clv_index);
+  const unsigned int * child_site_id = pll_get_site_id(partition,
+                                                       child_clv_index);
+
+  *site_scalings = NULL;
+  if (!parent_scaler && !child_scaler)
+    return PLL_SUCCESS;
+
+  *site_scalings = (unsigned int *)malloc(partition->sites *
+                                          sizeof(unsigned int));
+  if (!*site_scalings)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  for (n = 0; n < partition->sites; ++n)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+    unsigned int scalings;
+
+    if (partition->attributes & PLL_ATTRIB_RATE_SCALERS)
+    {
+      /* the sumtable is scaled relative to the minimum per-rate scaler */
+      (*site_scalings)[n] = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        scalings = parent_scaler ? parent_scaler[pid*rate_cats+i] : 0;
+        scalings += child_scaler ? child_scaler[cid*rate_cats+i] : 0;
+        (*site_scalings)[n] = PLL_MIN((*site_scalings)[n], scalings);
+      }
+    }
+    else
+    {
+      scalings = parent_scaler ? parent_scaler[pid] : 0;
+      scalings += child_scaler ? child_scaler[cid] : 0;
+      (*site_scalings)[n] = scalings;
+    }
+  }
+
+  return PLL_SUCCESS;
+}
+
+static int derivatives_multi_range(const derivatives_multi_args_t * args,
+                                   unsigned int begin,
+                                   unsigned int end,
+                                   double * logl,
+                                   double * d_f,
+                                   double * dd_f)
+{
+  pll_partition_t * partition = args->params.partition;
+
+  if (begin == end)
+  {
+    if (logl)
+      memset(logl, 0, args->count * sizeof(double));
+    memset(d_f, 0, args->count * sizeof(double));
+    memset(dd_f, 0, args->count * sizeof(double));
+    return PLL_SUCCESS;
+  }
+
+  return pll_core_likelihood_derivatives_multi(partition->states,
+                                               end - begin,
                                                partition->rate_cats,
                                                partition->rate_weights,
-                                               parent_scaler,
-                                               child_scaler,
-                                               parent_ids,
-                                               child_ids,
-                                               partition->invariant,
-                                               partition->pattern_weights,
-                                               branch_length,
-                                               prop_invar,
-                                               freqs,
+                                               args->site_scalings ?
+                                                 args->site_scalings + begin :
+                                                 NULL,
+                                               partition->invariant ?
+                                                 partition->invariant + begin :
+                                                 NULL,
+                                               partition->pattern_weights + begin,
+                                               args->count,
+                                               args->branch_lengths,
+                                               args->params.prop_invar,
+                                               args->params.freqs,
                                                partition->rates,
-                                               eigenvals,
-                                               sumtable,
+                                               args->params.eigenvals,
+                                               args->params.sumtable +
+                                                 (size_t)begin *
+                                                 partition->rate_cats *
+                                                 partition->states_padded,
+                                               logl,
                                                d_f,
                                                dd_f,
                                                partition->attributes);
+}
+
+static int derivatives_multi_job(void * data,
+                                 unsigned int tid,
+                                 unsigned int count)
+{
+  derivatives_multi_args_t * args = (derivatives_multi_args_t *)data;
+  size_t offset = (size_t)tid * args->count;
+  unsigned int begin, end;
+
+  pll_threadpool_sites(args->params.partition->sites, tid, count, &begin, &end);
+
+  return derivatives_multi_range(args,
+                                 begin,
+                                 end,
+                                 args->logl ? args->logl + offset : NULL,
+                                 args->d_f + offset,
+                                 args->dd_f + offset);
+}
+
+static int derivatives_multi_threads(pll_partition_t * partition,
+                                     derivatives_multi_args_t * args,
+                                     double * logl,
+                                     double * d_f,
+                                     double * dd_f)
+{
+  unsigned int i, k;
+  unsigned int count = pll_threadpool_size(partition->threadpool);
+  size_t size = (size_t)count * args->count;
+  int retval;
+
+  args->d_f = (double *)malloc(3 * size * sizeof(double));
+  if (!args->d_f)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+  args->dd_f = args->d_f + size;
+  args->logl = logl ? args->dd_f + size : NULL;
+
+  retval = pll_threadpool_run(partition->threadpool, derivatives_multi_job, args);
+
+  /* reduce in thread order to obtain reproducible results */
+  for (k = 0; k < args->count; ++k)
+  {
+    d_f[k] = dd_f[k] = 0;
+    if (logl)
+      logl[k] = 0;
+    for (i = 0; i < count; ++i)
+    {
+      d_f[k] += args->d_f[i * args->count + k];
+      dd_f[k] += args->dd_f[i * args->count + k];
+      if (logl)
+        logl[k] += args->logl[i * args->count + k];
+    }
+  }
+
+  free(args->d_f);
+
+  return retval;
+}
+
+/* Computes the log-likelihood and the partial derivatives on the branch
+ * length at count branch lengths, with a single pass over the sumtable.
+ * branch_lengths: [input] count values where the derivatives are computed
+ * sumtable: [input] computed with pll_update_sumtable at the edge between
+ *                   parent_clv_index and child_clv_index
+ * logl: [output] log-likelihood at each branch length, may be NULL
+ * d_f, dd_f: [output] first and second derivatives at each branch length,
+ *                     as returned by pll_compute_likelihood_derivatives
+ * Ascertainment bias correction is not supported.
+ */
+PLL_EXPORT int pll_compute_likelihood_derivatives_multi(pll_partition_t * partition,
+                                                        unsigned int parent_clv_index,
+                                                        unsigned int child_clv_index,
+                                                        int parent_scaler_index,
+                                                        int child_scaler_index,
+                                                        unsigned int count,
+                                                        const double * branch_lengths,
+                                                        const unsigned int * params_indices,
+                                                        const double * sumtable,
+                                                        double * logl,
+                                                        double * d_f,
+                                                        double * dd_f)
+{
+  derivatives_multi_args_t args;
+  unsigned int * site_scalings = NULL;
+  const unsigned int * parent_scaler;
+  const unsigned int * child_scaler;
+  int retval;
+
+  if (partition->attributes & PLL_ATTRIB_AB_MASK)
+  {
+    pll_errno = PLL_ERROR_AB_NOSUPPORT;
+    snprintf(pll_errmsg, 200,
+             "Multi-point derivatives are not supported with ascertainment "
+             "bias correction.");
+    return PLL_FAILURE;
+  }
+
+  if (!count)
+    return PLL_SUCCESS;
+
+  parent_scaler = (parent_scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                    NULL : partition->scale_buffer[parent_scaler_index];
+  child_scaler = (child_scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                    NULL : partition->scale_buffer[child_scaler_index];
+
+  /* scaling only shifts the log-likelihood */
+  if (logl && !derivatives_site_scalings(partition,
+                                         parent_clv_index,
+                                         child_clv_index,
+                                         parent_scaler,
+                                         child_scaler,
+                                         &site_scalings))
+    return PLL_FAILURE;
+
+  if (!derivatives_params(partition, params_indices, &args.params))
+  {
+    free(site_scalings);
+    return PLL_FAILURE;
+  }
 
-  free (freqs);
-  free (prop_invar);
-  free (eigenvals);
+  args.params.sumtable = sumtable;
+  args.site_scalings = site_scalings;
+  args.count = count;
+  args.branch_lengths = branch_lengths;
+
+  /* per-site scalings resolve the site repeats, so all cases can be split
+     among threads */
+  if (partition->threadpool)
+    retval = derivatives_multi_threads(partition, &args, logl, d_f, dd_f);
+  else
+    retval = derivatives_multi_range(&args,
+                                     0,
+                                     partition->sites,
+                                     logl,
+                                     d_f,
+                                     dd_f);
+
+  free(site_scalings);
+  free(args.params.freqs);
+  free(args.params.prop_invar);
+  free(args.params.eigenvals);
 
   return retval;
 }
+
+typedef struct set_derivatives_s
+{
+  pll_partition_set_t * set;
+  unsigned int parent_clv_index;
+  unsigned int child_clv_index;
+  int parent_scaler_index;
+  int child_scaler_index;
+  double branch_length;
+  unsigned int * const * params_indices;
+  double * const * sumtables;
+} set_derivatives_t;
+
+static int set_sumtable_task(void * data,
+                             unsigned int tid,
+                             unsigned int task_index)
+{
+  set_derivatives_t * job = (set_derivatives_t *)data;
+  const pll_set_task_t * task = job->set->tasks + task_index;
+  pll_partition_t * partition = job->set->partitions[task->partition];
+  unsigned int end;
+
+  (void)tid;
+
+  /* partitions with site repeats or limited CLV memory are processed whole
+     by their first task */
+  if (pll_repeats_enabled(partition) || partition->clv_manager)
+  {
+    if (task->begin)
+      return PLL_SUCCESS;
+
+    return pll_update_sumtable(partition,
+                               job->parent_clv_index,
+                               job->child_clv_index,
+                               job->parent_scaler_index,
+                               job->child_scaler_index,
+                               job->params_indices[task->partition],
+                               job->sumtables[task->partition]);
+  }
+
+  /* the tasks cover all allocated sites, of which only the first ones are
+     computed under PLL_ATTRIB_SITE_COMPACTION */
+  end = PLL_MIN(task->end, partition->sites + partition->asc_additional_sites);
+  if (task->begin >= end)
+    return PLL_SUCCESS;
+
+  return pll_update_sumtable_range(partition,
+                                   job->parent_clv_index,
+                                   job->child_clv_index,
+                                   job->parent_scaler_index,
+                                   job->child_scaler_index,
+                                   job->params_indices[task->partition],
+                                   job->sumtables[task->partition],
+                                   task->begin,
+                                   end);
+}
+
+static int set_derivatives_task(void * data,
+                                unsigned int tid,
+                                unsigned int task_index)
+{
+  set_derivatives_t * job = (set_derivatives_t *)data;
+  const pll_set_task_t * task = job->set->tasks + task_index;
+  pll_partition_t * partition = job->set->partitions[task->partition];
+  unsigned int end = PLL_MIN(task->end, partition->sites);
+  double * d_f = job->set->task_values + 2 * task_index;
+  double * dd_f = d_f + 1;
+
+  (void)tid;
+  *d_f = *dd_f = 0;
+
+  if (pll_repeats_enabled(partition) ||
+      (partition->attributes & PLL_ATTRIB_AB_MASK))
+  {
+    /* site repeats and the ascertainment bias correction cannot be split
+       into ranges, hence the first task processes the whole partition */
+    if (task->begin)
+      return PLL_SUCCESS;
+
+    return pll_compute_likelihood_derivatives(partition,
+                                              job->parent_scaler_index,
+                                              job->child_scaler_index,
+                                              job->branch_length,
+                                              job->params_indices[task->partition],
+                                              job->sumtables[task->partition],
+                                              d_f,
+                                              dd_f);
+  }
+
+  if (task->begin >= end)
+    return PLL_SUCCESS;
+
+  return pll_compute_likelihood_derivatives_range(partition,
+                                                  job->parent_scaler_index,
+                                                  job->child_scaler_index,
+                                                  job->branch_length,
+                                                  job->params_indices[task->partition],
+                                                  job->sumtables[task->partition],
+                                                  d_f,
+                                                  dd_f,
+                                                  task->begin,
+                                                  end);
+}
+
+/* applies pll_update_sumtable to all partitions of the set.
+ * params_indices[i]: [input] parameter indices of partition i
+ * sumtables[i]: [output] sumtable of partition i, allocated as for
+ *                        pll_update_sumtable */
+PLL_EXPORT int pll_partition_set_update_sumtable(pll_partition_set_t * set,
+                                                 unsigned int parent_clv_index,
+                                                 unsigned int child_clv_index,
+                                                 int parent_scaler_index,
+                                                 int child_scaler_index,
+                                                 unsigned int * const * params_indices,
+                                                 double * const * sumtables)
+{
+  set_derivatives_t job;
+
+  job.set = set;
+  job.parent_clv_index = parent_clv_index;
+  job.child_clv_index = child_clv_index;
+  job.parent_scaler_index = parent_scaler_index;
+  job.child_scaler_index = child_scaler_index;
+  job.params_indices = params_indices;
+  job.sumtables = sumtables;
+
+  return pll_partition_set_run(set, set_sumtable_task, &job);
+}
+
+/* computes the derivatives of the log-likelihood of all partitions of the
+ * set on a branch length shared by all partitions.
+ * sumtables[i]: [input] sumtable of partition i at the edge
+ * d_f, dd_f: [output] sums over all partitions
+ * partition_d_f, partition_dd_f: [output] if given, derivatives of each
+ *                                partition */
+PLL_EXPORT int pll_partition_set_compute_likelihood_derivatives(
+                                        pll_partition_set_t * set,
+                                        int parent_scaler_index,
+                                        int child_scaler_index,
+                                        double branch_length,
+                                        unsigned int * const * params_indices,
+                                        double * const * sumtables,
+                                        double * d_f,
+                                        double * dd_f,
+                                        double * partition_d_f,
+                                        double * partition_dd_f)
+{
+  set_derivatives_t job;
+
+  job.set = set;
+  job.parent_scaler_index = parent_scaler_index;
+  job.child_scaler_index = child_scaler_index;
+  job.branch_length = branch_length;
+  job.params_indices = params_indices;
+  job.sumtables = sumtables;
+
+  if (!pll_partition_set_run(set, set_derivatives_task, &job))
+    return PLL_FAILURE;
+
+  /* reduce in task order to obtain reproducible results */
+  *d_f = pll_partition_set_reduce(set, set->task_values, partition_d_f);
+  *dd_f = pll_partition_set_reduce(set, set->task_values + 1, partition_dd_f);
+
+  return PLL_SUCCESS;
+}
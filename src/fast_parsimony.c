@@ -79,6 +79,18 @@ static int alloc_pars_structs(pll_parsimony_t * parsimony,
   return PLL_SUCCESS;
 }
 
+/* read entry offset of the CLV of a tip, which is stored in single precision
+   if PLL_ATTRIB_SINGLE_PRECISION is set */
+static double tipclv_entry(const pll_partition_t * partition,
+                           unsigned int tip_index,
+                           size_t offset)
+{
+  if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+    return ((const float *)(partition->clv[tip_index]))[offset];
+
+  return partition->clv[tip_index][offset];
+}
+
 static int check_informative_extended(const pll_partition_t * partition,
                                       unsigned int index,
                                       unsigned int * singleton)
@@ -101,11 +113,11 @@ static int check_informative_extended(const pll_partition_t * partition,
     c = 0;
 
     unsigned int *site_id = pll_get_site_id(partition, i);
-    double * clv = partition->clv[i] +
-                   PLL_GET_ID(site_id, index)*partition->states_padded*partition->rate_cats;
+    size_t offset = (size_t)PLL_GET_ID(site_id, index) *
+                    partition->states_padded * partition->rate_cats;
 
     for (j = 0; j < partition->states; ++j)
-       c = (c << 1) | (unsigned int)(clv[j]);
+       c = (c << 1) | (unsigned int)tipclv_entry(partition, i, offset + j);
 
     map[c]++;
   }
@@ -169,11 +181,11 @@ static int check_informative(const pll_partition_t * partition,
       c = 0;
 
       unsigned int *site_id = pll_get_site_id(partition, i);
-      double * clv = partition->clv[i] +
-                     PLL_GET_ID(site_id, index)*partition->states_padded*partition->rate_cats;
+      size_t offset = (size_t)PLL_GET_ID(site_id, index) *
+                      partition->states_padded * partition->rate_cats;
 
       for (j = 0; j < partition->states; ++j)
-         c = (c << 1) | (unsigned int)(clv[j]);
+         c = (c << 1) | (unsigned int)tipclv_entry(partition, i, offset + j);
 
       map[c]++;
     }
@@ -312,11 +324,11 @@ static int fill_parsimony_vectors(const pll_partition_t * partition,
           }
           else
           {
-            double * clv = partition->clv[i] + 
-                           PLL_GET_ID(site_id, j)*partition->states_padded * partition->rate_cats;
+            size_t offset = (size_t)PLL_GET_ID(site_id, j) *
+                            partition->states_padded * partition->rate_cats;
 
             for (k = 0; k < states; ++k)
-              if ((int)(clv[k]))
+              if ((int)tipclv_entry(partition, i, offset + k))
               {
                 val[k] |= (1 << bitcount);
               }
@@ -0,0 +1,152 @@
+/*
+    Copyright (C) 2015 Tomas Flouri, Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Under PLL_ATTRIB_GAP_ELISION every node keeps a bitvector of the sites at
+   which all tips of its subtree are undetermined. The CLV of such a subtree
+   is all-ones (P * 1 = 1), hence the update_partials functions write the
+   sites at which both children are undetermined directly, and compute the
+   sites at which one child is undetermined from the other child only. The
+   bitvectors are not used by the likelihood and derivative functions. Bit
+   i%32 of word i/32 refers to site i; the ascertainment bias sites are never
+   marked */
+
+static unsigned int gap_words(const pll_partition_t * partition)
+{
+  return (partition->alloc_sites + partition->asc_additional_sites + 31) / 32;
+}
+
+PLL_EXPORT int pll_gaps_initialize(pll_partition_t * partition)
+{
+  partition->gap_bits = (unsigned int *)calloc((size_t)partition->nodes *
+                                                 gap_words(partition),
+                                               sizeof(unsigned int));
+  if (!partition->gap_bits)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for gap bitvectors.");
+    return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* returns the all-gap bitvector of a node, or NULL if gap elision is off */
+PLL_EXPORT unsigned int * pll_get_gap_bitvector(const pll_partition_t * partition,
+                                                unsigned int clv_index)
+{
+  if (!partition->gap_bits)
+    return NULL;
+
+  return partition->gap_bits + (size_t)clv_index * gap_words(partition);
+}
+
+/* marks the sites of a tip whose state code covers all states */
+PLL_EXPORT void pll_gaps_tip(pll_partition_t * partition,
+                             unsigned int tip_index,
+                             const pll_state_t * map,
+                             const char * sequence)
+{
+  unsigned int i;
+  unsigned int * bits = pll_get_gap_bitvector(partition, tip_index);
+  pll_state_t undetermined = (partition->states < 64) ?
+                               ((pll_state_t)1 << partition->states) - 1 :
+                               ~(pll_state_t)0;
+
+  if (!bits) return;
+
+  memset(bits, 0, gap_words(partition) * sizeof(unsigned int));
+  for (i = 0; i < partition->sites; ++i)
+    if ((map[(int)sequence[i]] & undetermined) == undetermined)
+      bits[i >> 5] |= 1u << (i & 31);
+}
+
+/* marks the sites of a tip whose CLV entries are all one */
+PLL_EXPORT void pll_gaps_tip_clv(pll_partition_t * partition,
+                                 unsigned int tip_index,
+                                 const double * clv,
+                                 int padding)
+{
+  unsigned int i,j;
+  unsigned int * bits = pll_get_gap_bitvector(partition, tip_index);
+
+  if (!bits) return;
+
+  memset(bits, 0, gap_words(partition) * sizeof(unsigned int));
+  for (i = 0; i < partition->sites; ++i)
+  {
+    for (j = 0; j < partition->states && clv[j] == 1.0; ++j);
+    if (j == partition->states)
+      bits[i >> 5] |= 1u << (i & 31);
+    clv += padding ? partition->states_padded : partition->states;
+  }
+}
+
+/* sets the bitvector of each parent to the intersection of its children. As
+   it is not split by sites, this is done before the CLVs are computed */
+PLL_EXPORT void pll_gaps_operations(pll_partition_t * partition,
+                                    const pll_operation_t * operations,
+                                    unsigned int count)
+{
+  unsigned int i,j;
+  unsigned int words;
+  unsigned int * parent;
+  const unsigned int * left;
+  const unsigned int * right;
+
+  if (!partition->gap_bits) return;
+
+  words = gap_words(partition);
+  for (i = 0; i < count; ++i)
+  {
+    parent = pll_get_gap_bitvector(partition, operations[i].parent_clv_index);
+    left = pll_get_gap_bitvector(partition, operations[i].child1_clv_index);
+    right = pll_get_gap_bitvector(partition, operations[i].child2_clv_index);
+
+    for (j = 0; j < words; ++j)
+      parent[j] = left[j] & right[j];
+  }
+}
+
+/* returns the end of the run of sites starting at site at which both
+   bitvectors have the same bits as at site, but at most end */
+PLL_EXPORT unsigned int pll_gaps_run_end(const unsigned int * left,
+                                         const unsigned int * right,
+                                         unsigned int site,
+                                         unsigned int end)
+{
+  unsigned int w = site >> 5;
+  unsigned int lfill = (left[w] >> (site & 31)) & 1 ? ~0u : 0;
+  unsigned int rfill = (right[w] >> (site & 31)) & 1 ? ~0u : 0;
+  unsigned int x = ((left[w] ^ lfill) | (right[w] ^ rfill)) &
+                   (~0u << (site & 31));
+
+  /* skip whole words of the same bits */
+  while (!x)
+  {
+    if (++w >= (end + 31) >> 5)
+      return end;
+    x = (left[w] ^ lfill) | (right[w] ^ rfill);
+  }
+
+  return PLL_MIN((w << 5) + PLL_CTZ32(x), end);
+}
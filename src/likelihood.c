@@ -21,6 +21,225 @@
 
 #include "pll.h"
 
+/* arguments of a log-likelihood computation over a range of sites */
+typedef struct lk_args_s
+{
+  pll_partition_t * partition;
+  unsigned int parent_clv_index;
+  int parent_scaler_index;
+  unsigned int child_clv_index;
+  int child_scaler_index;
+  unsigned int matrix_index;
+  const unsigned int * freqs_indices;
+  double * persite_lnl;
+  double (*range)(const struct lk_args_s * args,
+                  unsigned int begin,
+                  unsigned int end);
+  double * logl;  /* per-thread partial sums */
+} lk_args_t;
+
+static double * clv_site(const pll_partition_t * partition,
+                         double * clv,
+                         unsigned int site)
+{
+  size_t span = partition->states_padded * partition->rate_cats;
+
+  if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+    return (double *)((float *)clv + site * span);
+
+  return clv + site * span;
+}
+
+static unsigned int * scaler_site(const pll_partition_t * partition,
+                                  int scaler_index,
+                                  unsigned int site)
+{
+  if (scaler_index == PLL_SCALE_BUFFER_NONE)
+    return NULL;
+
+  if (partition->attributes & PLL_ATTRIB_RATE_SCALERS)
+    return partition->scale_buffer[scaler_index] + site * partition->rate_cats;
+
+  return partition->scale_buffer[scaler_index] + site;
+}
+
+static double root_loglikelihood_range(const lk_args_t * args,
+                                       unsigned int begin,
+                                       unsigned int end)
+{
+  pll_partition_t * partition = args->partition;
+
+  return partition->kernels.root_loglikelihood(partition->states,
+                                               end - begin,
+                                               partition->rate_cats,
+                                               clv_site(partition,
+                                                        partition->clv[args->parent_clv_index],
+                                                        begin),
+                                               /* root kernels read one
+                                                  scaler entry per site */
+                                               args->parent_scaler_index ==
+                                                 PLL_SCALE_BUFFER_NONE ? NULL :
+                                                 partition->scale_buffer[args->parent_scaler_index]
+                                                   + begin,
+                                               partition->frequencies,
+                                               partition->rate_weights,
+                                               partition->pattern_weights + begin,
+                                               partition->prop_invar,
+                                               partition->invariant ?
+                                                 partition->invariant + begin : NULL,
+                                               args->freqs_indices,
+                                               args->persite_lnl ?
+                                                 args->persite_lnl + begin : NULL,
+                                               partition->attributes);
+}
+
+static double edge_loglikelihood_ti_range(const lk_args_t * args,
+                                          unsigned int begin,
+                                          unsigned int end)
+{
+  pll_partition_t * partition = args->partition;
+
+  return partition->kernels.edge_loglikelihood_ti(partition->states,
+                                                  end - begin,
+                                                  partition->rate_cats,
+                                                  clv_site(partition,
+                                                           partition->clv[args->parent_clv_index],
+                                                           begin),
+                                                  scaler_site(partition,
+                                                              args->parent_scaler_index,
+                                                              begin),
+                                                  partition->tipchars[args->child_clv_index] + begin,
+                                                  partition->tipmap,
+                                                  partition->maxstates,
+                                                  partition->pmatrix[args->matrix_index],
+                                                  partition->frequencies,
+                                                  partition->rate_weights,
+                                                  partition->pattern_weights + begin,
+                                                  partition->prop_invar,
+                                                  partition->invariant ?
+                                                    partition->invariant + begin : NULL,
+                                                  args->freqs_indices,
+                                                  args->persite_lnl ?
+                                                    args->persite_lnl + begin : NULL,
+                                                  partition->attributes);
+}
+
+static double edge_loglikelihood_ii_range(const lk_args_t * args,
+                                          unsigned int begin,
+                                          unsigned int end)
+{
+  pll_partition_t * partition = args->partition;
+
+  return partition->kernels.edge_loglikelihood_ii(partition->states,
+                                                  end - begin,
+                                                  partition->rate_cats,
+                                                  clv_site(partition,
+                                                           partition->clv[args->parent_clv_index],
+                                                           begin),
+                                                  scaler_site(partition,
+                                                              args->parent_scaler_index,
+                                                              begin),
+                                                  clv_site(partition,
+                                                           partition->clv[args->child_clv_index],
+                                                           begin),
+                                                  scaler_site(partition,
+                                                              args->child_scaler_index,
+                                                              begin),
+                                                  partition->pmatrix[args->matrix_index],
+                                                  partition->frequencies,
+                                                  partition->rate_weights,
+                                                  partition->pattern_weights + begin,
+                                                  partition->prop_invar,
+                                                  partition->invariant ?
+                                                    partition->invariant + begin : NULL,
+                                                  args->freqs_indices,
+                                                  args->persite_lnl ?
+                                                    args->persite_lnl + begin : NULL,
+                                                  partition->attributes);
+}
+
+static int loglikelihood_job(void * data, unsigned int tid, unsigned int count)
+{
+  lk_args_t * args = (lk_args_t *)data;
+  unsigned int begin, end;
+
+  pll_threadpool_sites(args->partition->sites, tid, count, &begin, &end);
+
+  args->logl[tid] = (begin < end) ? args->range(args, begin, end) : 0;
+
+  return PLL_SUCCESS;
+}
+
+/* computes the log-likelihood of all sites (excluding the ascertainment bias
+   sites), splitting them among the threads of the partition */
+static double loglikelihood_sites(lk_args_t * args)
+{
+  struct pll_threadpool * pool = args->partition->threadpool;
+  unsigned int i;
+  unsigned int count;
+  double logl = 0;
+
+  if (pool)
+  {
+    count = pll_threadpool_size(pool);
+    args->logl = (double *)malloc(count * sizeof(double));
+    if (args->logl)
+    {
+      pll_threadpool_run(pool, loglikelihood_job, args);
+
+      /* reduce in thread order to obtain reproducible results */
+      for (i = 0; i < count; ++i)
+        logl += args->logl[i];
+      free(args->logl);
+      return logl;
+    }
+  }
+
+  return args->range(args, 0, args->partition->sites);
+}
+
+/* checks that the sites [begin,end) can be evaluated independently of the
+   remaining sites */
+static int check_site_range(const pll_partition_t * partition,
+                            unsigned int begin,
+                            unsigned int end)
+{
+  if (pll_repeats_enabled(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with site repeats.");
+    return PLL_FAILURE;
+  }
+
+  if (partition->clv_manager)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  if (partition->attributes & PLL_ATTRIB_AB_MASK)
+  {
+    pll_errno = PLL_ERROR_AB_NOSUPPORT;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with ascertainment bias correction.");
+    return PLL_FAILURE;
+  }
+
+  if (begin > end || end > partition->sites)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Invalid site range [%u,%u) (sites: %u).",
+             begin, end, partition->sites);
+    return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
 static double compute_asc_bias_correction(double logl_base,
                                           unsigned int sum_w,
                                           unsigned int sum_w_inv,
@@ -128,6 +347,11 @@ PLL_EXPORT double pll_compute_root_loglikelihood(pll_partition_t * partition,
   double logl = 0;
   unsigned int * scaler;
   unsigned int identifiers;
+
+  /* recompute an evicted CLV under PLL_ATTRIB_LIMIT_MEMORY */
+  if (!pll_clv_require(partition, &clv_index, 1))
+    return -INFINITY;
+
   /* get scaler array if specified */
   if (scaler_index == PLL_SCALE_BUFFER_NONE)
     scaler = NULL;
@@ -138,46 +362,42 @@ PLL_EXPORT double pll_compute_root_loglikelihood(pll_partition_t * partition,
   if (pll_repeats_enabled(partition) &&
       partition->repeats->pernode_ids[clv_index]) 
   {
-    logl = pll_core_root_loglikelihood_repeats(partition->states,
-                                     partition->sites,
-                                     partition->rate_cats,
-                                     partition->clv[clv_index],
-                                     partition->repeats->pernode_site_id[clv_index],
-                                     scaler,
-                                     partition->frequencies,
-                                     partition->rate_weights,
-                                     partition->pattern_weights,
-                                     partition->prop_invar,
-                                     partition->invariant,
-                                     freqs_indices,
-                                     persite_lnl,
-                                     partition->attributes);
+    logl = partition->kernels.root_loglikelihood_repeats(partition->states,
+                                                         partition->sites,
+                                                         partition->rate_cats,
+                                                         partition->clv[clv_index],
+                                                         partition->repeats->pernode_site_id[clv_index],
+                                                         scaler,
+                                                         partition->frequencies,
+                                                         partition->rate_weights,
+                                                         partition->pattern_weights,
+                                                         partition->prop_invar,
+                                                         partition->invariant,
+                                                         freqs_indices,
+                                                         persite_lnl,
+                                                         partition->attributes);
   }
   else
   {
+    lk_args_t args;
+
+    args.partition = partition;
+    args.parent_clv_index = clv_index;
+    args.parent_scaler_index = scaler_index;
+    args.freqs_indices = freqs_indices;
+    args.persite_lnl = persite_lnl;
+    args.range = root_loglikelihood_range;
+
     /* compute log-likelihood via the core function */
-    logl = pll_core_root_loglikelihood(partition->states,
-                                     partition->sites,
-                                     partition->rate_cats,
-                                     partition->clv[clv_index],
-                                     scaler,
-                                     partition->frequencies,
-                                     partition->rate_weights,
-                                     partition->pattern_weights,
-                                     partition->prop_invar,
-                                     partition->invariant,
-                                     freqs_indices,
-                                     persite_lnl,
-                                     partition->attributes);
+    logl = loglikelihood_sites(&args);
   }
-
   /* ascertainment bias correction */
   if (partition->attributes & PLL_ATTRIB_AB_MASK)
   {
     /* Note the assertion must be done for all rate matrices
     assert(prop_invar == 0);
     */
-    identifiers = pll_get_sites_number(partition, clv_index) - partition->rate_cats;
+    identifiers = pll_get_sites_number(partition, clv_index) - partition->states;
     logl += root_loglikelihood_asc_bias(partition,
                                         identifiers,
                                         partition->clv[clv_index],
@@ -185,9 +405,44 @@ PLL_EXPORT double pll_compute_root_loglikelihood(pll_partition_t * partition,
                                         freqs_indices);
   }
 
+  /* per-site log-likelihoods in the original order of the sites */
+  if (persite_lnl && partition->compaction)
+    pll_compaction_scatter(partition, persite_lnl);
+
+  pll_clv_release(partition, &clv_index, 1);
+
   return logl;
 }
 
+/* same as pll_compute_root_loglikelihood, but only accounts for sites
+   [site_begin, site_end). The log-likelihoods of disjoint ranges add up to the
+   log-likelihood of the whole partition. persite_lnl, if given, is indexed by
+   the absolute site number. Returns -INFINITY on error */
+PLL_EXPORT double pll_compute_root_loglikelihood_range(pll_partition_t * partition,
+                                                       unsigned int clv_index,
+                                                       int scaler_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int site_begin,
+                                                       unsigned int site_end)
+{
+  lk_args_t args;
+
+  if (!check_site_range(partition, site_begin, site_end))
+    return -INFINITY;
+
+  if (site_begin == site_end)
+    return 0;
+
+  args.partition = partition;
+  args.parent_clv_index = clv_index;
+  args.parent_scaler_index = scaler_index;
+  args.freqs_indices = freqs_indices;
+  args.persite_lnl = persite_lnl;
+
+  return root_loglikelihood_range(&args, site_begin, site_end);
+}
+
 static double edge_loglikelihood_asc_bias_ti(pll_partition_t * partition,
                                              unsigned int parent_clv_index,
                                              unsigned int * parent_scaler,
@@ -276,7 +531,6 @@ static double edge_loglikelihood_tipinner(pll_partition_t * partition,
                                           double * persite_lnl)
 {
   double logl = 0;
-  unsigned int states = partition->states;
 
   unsigned int * parent_scaler;
 
@@ -285,43 +539,18 @@ static double edge_loglikelihood_tipinner(pll_partition_t * partition,
   else
     parent_scaler = partition->scale_buffer[parent_scaler_index];
 
-  if (states == 4)
-  {
-    logl = pll_core_edge_loglikelihood_ti_4x4(partition->sites,
-                                              partition->rate_cats,
-                                              partition->clv[parent_clv_index],
-                                              parent_scaler,
-                                              partition->tipchars[child_clv_index],
-                                              partition->pmatrix[matrix_index],
-                                              partition->frequencies,
-                                              partition->rate_weights,
-                                              partition->pattern_weights,
-                                              partition->prop_invar,
-                                              partition->invariant,
-                                              freqs_indices,
-                                              persite_lnl,
-                                              partition->attributes);
-  }
-  else
-  {
-    logl = pll_core_edge_loglikelihood_ti(partition->states,
-                                          partition->sites,
-                                          partition->rate_cats,
-                                          partition->clv[parent_clv_index],
-                                          parent_scaler,
-                                          partition->tipchars[child_clv_index],
-                                          partition->tipmap,
-                                          partition->maxstates,
-                                          partition->pmatrix[matrix_index],
-                                          partition->frequencies,
-                                          partition->rate_weights,
-                                          partition->pattern_weights,
-                                          partition->prop_invar,
-                                          partition->invariant,
-                                          freqs_indices,
-                                          persite_lnl,
-                                          partition->attributes);
-  }
+  lk_args_t args;
+
+  args.partition = partition;
+  args.parent_clv_index = parent_clv_index;
+  args.parent_scaler_index = parent_scaler_index;
+  args.child_clv_index = child_clv_index;
+  args.matrix_index = matrix_index;
+  args.freqs_indices = freqs_indices;
+  args.persite_lnl = persite_lnl;
+  args.range = edge_loglikelihood_ti_range;
+
+  logl = loglikelihood_sites(&args);
 
   /* ascertainment bias correction */
   if (partition->attributes & PLL_ATTRIB_AB_MASK)
@@ -467,22 +696,19 @@ static double edge_loglikelihood(pll_partition_t * partition,
     parent_scaler = partition->scale_buffer[parent_scaler_index];
 
   /* compute log-likelihood via the core function */
-  logl = pll_core_edge_loglikelihood_ii(partition->states,
-                                        partition->sites,
-                                        partition->rate_cats,
-                                        clvp,
-                                        parent_scaler,
-                                        clvc,
-                                        child_scaler,
-                                        partition->pmatrix[matrix_index],
-                                        partition->frequencies,
-                                        partition->rate_weights,
-                                        partition->pattern_weights,
-                                        partition->prop_invar,
-                                        partition->invariant,
-                                        freqs_indices,
-                                        persite_lnl,
-                                        partition->attributes);
+  lk_args_t args;
+
+  args.partition = partition;
+  args.parent_clv_index = parent_clv_index;
+  args.parent_scaler_index = parent_scaler_index;
+  args.child_clv_index = child_clv_index;
+  args.child_scaler_index = child_scaler_index;
+  args.matrix_index = matrix_index;
+  args.freqs_indices = freqs_indices;
+  args.persite_lnl = persite_lnl;
+  args.range = edge_loglikelihood_ii_range;
+
+  logl = loglikelihood_sites(&args);
 
   /* ascertainment bias correction */
   if (partition->attributes & PLL_ATTRIB_AB_MASK)
@@ -541,26 +767,26 @@ static double edge_loglikelihood_repeats(pll_partition_t * partition,
     parent_scaler = partition->scale_buffer[parent_scaler_index];
 
   /* compute log-likelihood via the core function */
-  logl = pll_core_edge_loglikelihood_repeats(partition->states,
-                                        partition->sites,
-                                        !inv ? parent_sites : child_sites, 
-                                        partition->rate_cats,
-                                        inv ? clvp : clvc,
-                                        inv ? parent_scaler : child_scaler,
-                                        !inv ? clvp : clvc,
-                                        !inv ? parent_scaler : child_scaler,
-                                        partition->pmatrix[matrix_index],
-                                        partition->frequencies,
-                                        partition->rate_weights,
-                                        partition->pattern_weights,
-                                        partition->prop_invar,
-                                        partition->invariant,
-                                        freqs_indices,
-                                        persite_lnl, 
-                                        inv ? parent_site_id : child_site_id,
-                                        !inv ? parent_site_id : child_site_id,
-                                        partition->repeats->bclv_buffer,
-                                        partition->attributes);
+  logl = partition->kernels.edge_loglikelihood_repeats(partition->states,
+                                                       partition->sites,
+                                                       !inv ? parent_sites : child_sites,
+                                                       partition->rate_cats,
+                                                       inv ? clvp : clvc,
+                                                       inv ? parent_scaler : child_scaler,
+                                                       !inv ? clvp : clvc,
+                                                       !inv ? parent_scaler : child_scaler,
+                                                       partition->pmatrix[matrix_index],
+                                                       partition->frequencies,
+                                                       partition->rate_weights,
+                                                       partition->pattern_weights,
+                                                       partition->prop_invar,
+                                                       partition->invariant,
+                                                       freqs_indices,
+                                                       persite_lnl,
+                                                       inv ? parent_site_id : child_site_id,
+                                                       !inv ? parent_site_id : child_site_id,
+                                                       partition->repeats->bclv_buffer,
+                                                       partition->attributes);
 
   /* ascertainment bias correction */
   if (partition->attributes & PLL_ATTRIB_AB_MASK)
@@ -583,14 +809,14 @@ static double edge_loglikelihood_repeats(pll_partition_t * partition,
 
 
 
-PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
-                                                 unsigned int parent_clv_index,
-                                                 int parent_scaler_index,
-                                                 unsigned int child_clv_index,
-                                                 int child_scaler_index,
-                                                 unsigned int matrix_index,
-                                                 const unsigned int * freqs_indices,
-                                                 double * persite_lnl)
+static double compute_edge_loglikelihood(pll_partition_t * partition,
+                                         unsigned int parent_clv_index,
+                                         int parent_scaler_index,
+                                         unsigned int child_clv_index,
+                                         int child_scaler_index,
+                                         unsigned int matrix_index,
+                                         const unsigned int * freqs_indices,
+                                         double * persite_lnl)
 {
   double logl;
   
@@ -634,3 +860,230 @@ PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
 
   return logl;
 }
+
+PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
+                                                 unsigned int parent_clv_index,
+                                                 int parent_scaler_index,
+                                                 unsigned int child_clv_index,
+                                                 int child_scaler_index,
+                                                 unsigned int matrix_index,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl)
+{
+  double logl;
+  unsigned int clv_indices[2] = {parent_clv_index, child_clv_index};
+
+  /* recompute evicted CLVs under PLL_ATTRIB_LIMIT_MEMORY */
+  if (!pll_clv_require(partition, clv_indices, 2))
+    return -INFINITY;
+
+  logl = compute_edge_loglikelihood(partition,
+                                    parent_clv_index,
+                                    parent_scaler_index,
+                                    child_clv_index,
+                                    child_scaler_index,
+                                    matrix_index,
+                                    freqs_indices,
+                                    persite_lnl);
+
+  /* per-site log-likelihoods in the original order of the sites */
+  if (persite_lnl && partition->compaction)
+    pll_compaction_scatter(partition, persite_lnl);
+
+  pll_clv_release(partition, clv_indices, 2);
+
+  return logl;
+}
+
+/* same as pll_compute_edge_loglikelihood, but only accounts for sites
+   [site_begin, site_end). Returns -INFINITY on error */
+PLL_EXPORT double pll_compute_edge_loglikelihood_range(pll_partition_t * partition,
+                                                       unsigned int parent_clv_index,
+                                                       int parent_scaler_index,
+                                                       unsigned int child_clv_index,
+                                                       int child_scaler_index,
+                                                       unsigned int matrix_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int site_begin,
+                                                       unsigned int site_end)
+{
+  lk_args_t args;
+
+  if (!check_site_range(partition, site_begin, site_end))
+    return -INFINITY;
+
+  if (site_begin == site_end)
+    return 0;
+
+  args.partition = partition;
+  args.matrix_index = matrix_index;
+  args.freqs_indices = freqs_indices;
+  args.persite_lnl = persite_lnl;
+
+  if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+      ((parent_clv_index < partition->tips) ||
+       (child_clv_index < partition->tips)))
+  {
+    /* the tip is always the child */
+    if (parent_clv_index < partition->tips)
+    {
+      args.parent_clv_index = child_clv_index;
+      args.parent_scaler_index = child_scaler_index;
+      args.child_clv_index = parent_clv_index;
+    }
+    else
+    {
+      args.parent_clv_index = parent_clv_index;
+      args.parent_scaler_index = parent_scaler_index;
+      args.child_clv_index = child_clv_index;
+    }
+    args.child_scaler_index = PLL_SCALE_BUFFER_NONE;
+
+    return edge_loglikelihood_ti_range(&args, site_begin, site_end);
+  }
+
+  args.parent_clv_index = parent_clv_index;
+  args.parent_scaler_index = parent_scaler_index;
+  args.child_clv_index = child_clv_index;
+  args.child_scaler_index = child_scaler_index;
+
+  return edge_loglikelihood_ii_range(&args, site_begin, site_end);
+}
+
+typedef struct set_lk_s
+{
+  pll_partition_set_t * set;
+  int root;
+  unsigned int parent_clv_index;
+  int parent_scaler_index;
+  unsigned int child_clv_index;
+  int child_scaler_index;
+  unsigned int matrix_index;
+  unsigned int * const * freqs_indices;
+} set_lk_t;
+
+static int set_loglikelihood_task(void * data,
+                                  unsigned int tid,
+                                  unsigned int task_index)
+{
+  set_lk_t * job = (set_lk_t *)data;
+  const pll_set_task_t * task = job->set->tasks + task_index;
+  pll_partition_t * partition = job->set->partitions[task->partition];
+  const unsigned int * freqs_indices = job->freqs_indices[task->partition];
+  unsigned int end = PLL_MIN(task->end, partition->sites);
+  double * logl = job->set->task_values + 2 * task_index;
+
+  (void)tid;
+  *logl = 0;
+
+  if (pll_repeats_enabled(partition) || partition->clv_manager ||
+      (partition->attributes & PLL_ATTRIB_AB_MASK))
+  {
+    /* site repeats, limited CLV memory and the ascertainment bias correction
+       cannot be split into ranges, hence the first task processes the whole
+       partition */
+    if (task->begin)
+      return PLL_SUCCESS;
+
+    if (job->root)
+      *logl = pll_compute_root_loglikelihood(partition,
+                                             job->parent_clv_index,
+                                             job->parent_scaler_index,
+                                             freqs_indices,
+                                             NULL);
+    else
+      *logl = pll_compute_edge_loglikelihood(partition,
+                                             job->parent_clv_index,
+                                             job->parent_scaler_index,
+                                             job->child_clv_index,
+                                             job->child_scaler_index,
+                                             job->matrix_index,
+                                             freqs_indices,
+                                             NULL);
+  }
+  else if (task->begin < end)
+  {
+    if (job->root)
+      *logl = pll_compute_root_loglikelihood_range(partition,
+                                                   job->parent_clv_index,
+                                                   job->parent_scaler_index,
+                                                   freqs_indices,
+                                                   NULL,
+                                                   task->begin,
+                                                   end);
+    else
+      *logl = pll_compute_edge_loglikelihood_range(partition,
+                                                   job->parent_clv_index,
+                                                   job->parent_scaler_index,
+                                                   job->child_clv_index,
+                                                   job->child_scaler_index,
+                                                   job->matrix_index,
+                                                   freqs_indices,
+                                                   NULL,
+                                                   task->begin,
+                                                   end);
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* sums the per-task log-likelihoods in task order, such that the result does
+   not depend on the number of threads nor on the scheduling */
+static double set_loglikelihood(set_lk_t * job, double * partition_lnl)
+{
+  if (!pll_partition_set_run(job->set, set_loglikelihood_task, job))
+    return -INFINITY;
+
+  return pll_partition_set_reduce(job->set,
+                                  job->set->task_values,
+                                  partition_lnl);
+}
+
+/* computes the log-likelihood of all partitions of the set at the root CLV.
+   freqs_indices[i] are the frequency indices of partition i. If
+   partition_lnl is given, the log-likelihood of partition i is stored in
+   partition_lnl[i]. Returns the sum over all partitions */
+PLL_EXPORT double pll_partition_set_compute_root_loglikelihood(
+                                      pll_partition_set_t * set,
+                                      unsigned int clv_index,
+                                      int scaler_index,
+                                      unsigned int * const * freqs_indices,
+                                      double * partition_lnl)
+{
+  set_lk_t job;
+
+  job.set = set;
+  job.root = 1;
+  job.parent_clv_index = clv_index;
+  job.parent_scaler_index = scaler_index;
+  job.freqs_indices = freqs_indices;
+
+  return set_loglikelihood(&job, partition_lnl);
+}
+
+/* same as pll_partition_set_compute_root_loglikelihood, but the
+   log-likelihood is computed at the edge between two CLVs */
+PLL_EXPORT double pll_partition_set_compute_edge_loglikelihood(
+                                      pll_partition_set_t * set,
+                                      unsigned int parent_clv_index,
+                                      int parent_scaler_index,
+                                      unsigned int child_clv_index,
+                                      int child_scaler_index,
+                                      unsigned int matrix_index,
+                                      unsigned int * const * freqs_indices,
+                                      double * partition_lnl)
+{
+  set_lk_t job;
+
+  job.set = set;
+  job.root = 0;
+  job.parent_clv_index = parent_clv_index;
+  job.parent_scaler_index = parent_scaler_index;
+  job.child_clv_index = child_clv_index;
+  job.child_scaler_index = child_scaler_index;
+  job.matrix_index = matrix_index;
+  job.freqs_indices = freqs_indices;
+
+  return set_loglikelihood(&job, partition_lnl);
+}
@@ -177,21 +177,17 @@ static void mytred2(double **a, const unsigned int n, double *d, double *e)
     }
 }
 
-/* TODO: Add code for SSE/AVX. Perhaps allocate qmatrix in one chunk to avoid the
-complex checking when to dealloc */
-static double ** create_ratematrix(double * params,
-                                   double * frequencies,
-                                   unsigned int states)
+/* TODO: Add code for SSE/AVX. */
+static void create_ratematrix(const double * params,
+                              const double * frequencies,
+                              unsigned int states,
+                              double * params_normalized,
+                              double ** qmatrix)
 {
-  unsigned int i,j,k,success;
-
-  double ** qmatrix;
+  unsigned int i,j,k;
 
   /* normalize substitution parameters */
   unsigned int params_count = (states*states - states) / 2;
-  double * params_normalized = (double *)malloc(sizeof(double) * params_count);
-  if (!params_normalized)
-    return NULL;
 
   memcpy(params_normalized,params,params_count*sizeof(double));
 
@@ -199,26 +195,6 @@ static double ** create_ratematrix(double * params,
     for (i = 0; i < params_count; ++i)
       params_normalized[i] /= params_normalized[params_count - 1];
 
-  /* allocate qmatrix */
-  qmatrix = (double **)malloc(states*sizeof(double *));
-  if (!qmatrix)
-  {
-    free(params_normalized);
-    return NULL;
-  }
-
-  success = 1;
-  for (i = 0; i < states; ++i)
-    if (!(qmatrix[i] = (double *)malloc(states*sizeof(double)))) success=0;
-
-  if (!success)
-  {
-    for(i = 0; i < states; ++i) free(qmatrix[i]);
-    free(qmatrix);
-    free(params_normalized);
-    return NULL;
-  }
-
   /* construct a matrix equal to sqrt(pi) * Q sqrt(pi)^-1 in order to ensure
      it is symmetric */
 
@@ -242,10 +218,74 @@ static double ** create_ratematrix(double * params,
   for (i = 0; i < states; ++i)
     for (j = 0; j < states; ++j)
       qmatrix[i][j] /= mean;
+}
+
+/* detects nucleotide rate matrices with a single transition (AG, CT) and a
+   single transversion rate (AC, AT, CG, GT). The closed form assumes that the
+   frequencies sum to 1 */
+static unsigned int model_structure(const double * subst_params,
+                                    const double * frequencies,
+                                    unsigned int states)
+{
+  unsigned int i;
+  int equal_freqs = 1;
+  double tv = subst_params[0];
+  double sum = 0;
+
+  if (states != 4) return PLL_MODEL_STRUCTURE_GENERIC;
+
+  for (i = 0; i < states; ++i)
+    sum += frequencies[i];
+  if (sum < PLL_ONE_MIN || sum > PLL_ONE_MAX)
+    return PLL_MODEL_STRUCTURE_GENERIC;
+
+  if (!(tv > 0) ||
+      subst_params[2] != tv ||
+      subst_params[3] != tv ||
+      subst_params[5] != tv ||
+      subst_params[1] != subst_params[4])
+    return PLL_MODEL_STRUCTURE_GENERIC;
+
+  if (!(frequencies[0] + frequencies[2] > 0) ||
+      !(frequencies[1] + frequencies[3] > 0))
+    return PLL_MODEL_STRUCTURE_GENERIC;
 
-  free(params_normalized);
+  for (i = 1; i < states; ++i)
+    if (frequencies[i] != frequencies[0])
+      equal_freqs = 0;
 
-  return qmatrix;
+  if (subst_params[1] == tv)
+    return equal_freqs ? PLL_MODEL_STRUCTURE_JC69 : PLL_MODEL_STRUCTURE_F81;
+
+  return equal_freqs ? PLL_MODEL_STRUCTURE_K80 : PLL_MODEL_STRUCTURE_HKY;
+}
+
+/* allocates the rate matrix rows, the normalized parameters and the
+   tridiagonal decomposition vectors used by pll_update_eigen */
+static int alloc_eigen_work(pll_partition_t * partition)
+{
+  unsigned int i;
+  unsigned int states = partition->states;
+  unsigned int params_count = (states*states - states) / 2;
+
+  partition->eigen_work = (double *)malloc((states*states + 2*states +
+                                            params_count) * sizeof(double));
+  partition->eigen_rows = (double **)malloc(states * sizeof(double *));
+  if (!partition->eigen_work || !partition->eigen_rows)
+  {
+    free(partition->eigen_work);
+    free(partition->eigen_rows);
+    partition->eigen_work = NULL;
+    partition->eigen_rows = NULL;
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < states; ++i)
+    partition->eigen_rows[i] = partition->eigen_work + i*states;
+
+  return PLL_SUCCESS;
 }
 
 PLL_EXPORT int pll_update_eigen(pll_partition_t * partition,
@@ -263,29 +303,31 @@ PLL_EXPORT int pll_update_eigen(pll_partition_t * partition,
 
   unsigned int states = partition->states;
   unsigned int states_padded = partition->states_padded;
+  unsigned int params_count = (states*states - states) / 2;
 
-  a = create_ratematrix(subst_params,
-                        freqs,
-                        states);
-  if (!a)
+  /* skip the decomposition if the parameters did not change */
+  double * input = partition->eigen_input +
+                   (size_t)params_index * (params_count + states);
+  if (partition->eigen_version[params_index] &&
+      !memcmp(input, subst_params, params_count*sizeof(double)) &&
+      !memcmp(input + params_count, freqs, states*sizeof(double)))
   {
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
-    return PLL_FAILURE;
+    partition->eigen_decomp_valid[params_index] = 1;
+    return PLL_SUCCESS;
   }
 
-  d = (double *)malloc(states*sizeof(double));
-  e = (double *)malloc(states*sizeof(double));
-  if (!d || !e)
-  {
-    if (d) free(d);
-    if (e) free(e);
-    for(i = 0; i < states; ++i) free(a[i]);
-    free(a);
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+  if (!partition->eigen_work && !alloc_eigen_work(partition))
     return PLL_FAILURE;
-  }
+
+  a = partition->eigen_rows;
+  d = partition->eigen_work + states*states;
+  e = d + states;
+
+  create_ratematrix(subst_params,
+                    freqs,
+                    states,
+                    e + states,
+                    a);
 
   mytred2(a, states, d, e);
   mytqli(d, e, states, a);
@@ -319,17 +361,71 @@ PLL_EXPORT int pll_update_eigen(pll_partition_t * partition,
     for (j = 0; j < states; ++j)
       eigenvecs[i*states_padded+j] *= sqrt(freqs[j]);
 
+  memcpy(input, subst_params, params_count*sizeof(double));
+  memcpy(input + params_count, freqs, states*sizeof(double));
+  partition->eigen_version[params_index]++;
+  partition->model_structure[params_index] = model_structure(subst_params,
+                                                             freqs,
+                                                             states);
   partition->eigen_decomp_valid[params_index] = 1;
-
-  free(d);
-  free(e);
-  for (i = 0; i < states; ++i)
-    free(a[i]);
-  free(a);
+  pll_pmatrix_cache_invalidate(partition);
 
   return PLL_SUCCESS;
 }
 
+/* returns the version of the eigen decomposition of a rate matrix. The
+   version changes whenever pll_update_eigen recomputes the decomposition from
+   changed parameters, and is 0 if it was never computed */
+PLL_EXPORT unsigned long pll_get_eigen_version(const pll_partition_t * partition,
+                                               unsigned int params_index)
+{
+  return partition->eigen_version[params_index];
+}
+
+static int update_pmatrices(pll_partition_t * partition,
+                            const unsigned int * params_indices,
+                            const unsigned int * matrix_indices,
+                            const double * branch_lengths,
+                            unsigned int count)
+{
+  unsigned int n;
+  int closed_form = (partition->states == 4) &&
+                    (partition->attributes & PLL_ATTRIB_CLOSED_PMATRIX);
+
+  /* use the closed-form kernels if requested and all rate matrices allow it */
+  for (n = 0; n < partition->rate_cats && closed_form; ++n)
+    if (partition->model_structure[params_indices[n]] ==
+        PLL_MODEL_STRUCTURE_GENERIC)
+      closed_form = 0;
+
+  if (closed_form)
+    return pll_core_update_pmatrix_4x4_closed(partition->pmatrix,
+                                              partition->rate_cats,
+                                              partition->rates,
+                                              branch_lengths,
+                                              matrix_indices,
+                                              params_indices,
+                                              partition->prop_invar,
+                                              partition->subst_params,
+                                              partition->frequencies,
+                                              count,
+                                              partition->attributes);
+
+  return partition->kernels.update_pmatrix(partition->pmatrix,
+                                           partition->states,
+                                           partition->rate_cats,
+                                           partition->rates,
+                                           branch_lengths,
+                                           matrix_indices,
+                                           params_indices,
+                                           partition->prop_invar,
+                                           partition->eigenvals,
+                                           partition->eigenvecs,
+                                           partition->inv_eigenvecs,
+                                           count,
+                                           partition->attributes);
+}
+
 PLL_EXPORT int pll_update_prob_matrices(pll_partition_t * partition,
                                         const unsigned int * params_indices,
                                         const unsigned int * matrix_indices,
@@ -348,19 +444,41 @@ PLL_EXPORT int pll_update_prob_matrices(pll_partition_t * partition,
     }
   }
 
-  return pll_core_update_pmatrix(partition->pmatrix,
-                                 partition->states,
-                                 partition->rate_cats,
-                                 partition->rates,
-                                 branch_lengths,
-                                 matrix_indices,
-                                 params_indices,
-                                 partition->prop_invar,
-                                 partition->eigenvals,
-                                 partition->eigenvecs,
-                                 partition->inv_eigenvecs,
-                                 count,
-                                 partition->attributes);
+  pll_clv_tracking_pmatrices(partition, matrix_indices, count);
+
+  if (partition->pmatrix_cache)
+  {
+    pll_pmatrix_cache_t * cache = partition->pmatrix_cache;
+    unsigned int misses;
+
+    /* compute only the p-matrices that are not cached */
+    if (!pll_pmatrix_cache_lookup(partition,
+                                  params_indices,
+                                  matrix_indices,
+                                  branch_lengths,
+                                  count,
+                                  &misses))
+      return PLL_FAILURE;
+
+    if (!misses)
+      return PLL_SUCCESS;
+
+    if (!update_pmatrices(partition,
+                          params_indices,
+                          cache->miss_matrix,
+                          cache->miss_length,
+                          misses))
+      return PLL_FAILURE;
+
+    pll_pmatrix_cache_store(partition, params_indices, misses);
+    return PLL_SUCCESS;
+  }
+
+  return update_pmatrices(partition,
+                          params_indices,
+                          matrix_indices,
+                          branch_lengths,
+                          count);
 }
 
 PLL_EXPORT void pll_set_frequencies(pll_partition_t * partition,
@@ -377,6 +495,7 @@ PLL_EXPORT void pll_set_category_rates(pll_partition_t * partition,
                                        const double * rates)
 {
   memcpy(partition->rates, rates, partition->rate_cats*sizeof(double));
+  pll_pmatrix_cache_invalidate(partition);
 }
 
 PLL_EXPORT void pll_set_category_weights(pll_partition_t * partition,
@@ -446,14 +565,39 @@ PLL_EXPORT int pll_update_invariant_sites_proportion(pll_partition_t * partition
   }
 
   partition->prop_invar[params_index] = prop_invar;
+  pll_pmatrix_cache_invalidate(partition);
 
   return PLL_SUCCESS;
 }
 
+/* decode the state bitmask stored at the given offset of a tip CLV */
+static pll_state_t tipclv_state(const pll_partition_t * partition,
+                                unsigned int tip_index,
+                                size_t offset)
+{
+  unsigned int k;
+  pll_state_t state = 0;
+
+  if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+  {
+    const float * tipclv = (const float *)(partition->clv[tip_index]) + offset;
+    for (k = 0; k < partition->states; ++k)
+      state |= ((pll_state_t)tipclv[k] << k);
+  }
+  else
+  {
+    const double * tipclv = partition->clv[tip_index] + offset;
+    for (k = 0; k < partition->states; ++k)
+      state |= ((pll_state_t)tipclv[k] << k);
+  }
+
+  return state;
+}
+
 PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
                                                   unsigned int * state_inv_count)
 {
-  unsigned int i,j,k;
+  unsigned int i,j;
   unsigned int invariant_count = 0;
   unsigned int tips = partition->tips;
   unsigned int sites = partition->sites;
@@ -461,7 +605,6 @@ PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
   pll_state_t gap_state = 0;
   pll_state_t cur_state;
   int * invariant = partition->invariant;
-  double * tipclv;
 
   /* gap state has always all bits set to one */
   for (i = 0; i < states; ++i)
@@ -527,16 +670,10 @@ PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
       for (j = 0; j < sites; ++j)
       {
         unsigned int clv_shift = j*span_padded;
-        tipclv = partition->clv[0] + clv_shift;
         pll_state_t state = gap_state;
         for (i = 0; i < tips; ++i)
         {
-          tipclv = partition->clv[i] + clv_shift;
-          cur_state = 0;
-          for (k = 0; k < states; ++k)
-          {
-            cur_state |= ((pll_state_t)tipclv[k] << k);
-          }
+          cur_state = tipclv_state(partition, i, clv_shift);
           state &= cur_state;
           if (!state)
           {
@@ -557,7 +694,7 @@ PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
 
 PLL_EXPORT int pll_update_invariant_sites(pll_partition_t * partition)
 {
-  unsigned int i,j,k;
+  unsigned int i,j;
   pll_state_t state;
   unsigned int states = partition->states;
   unsigned int states_padded = partition->states_padded;
@@ -566,7 +703,6 @@ PLL_EXPORT int pll_update_invariant_sites(pll_partition_t * partition)
   unsigned int rate_cats = partition->rate_cats;
   pll_state_t gap_state = 0;
   pll_state_t * invariant;
-  double * tipclv;
 
   /* gap state has always all bits set to one */
   for (i = 0; i < states; ++i)
@@ -579,7 +715,7 @@ PLL_EXPORT int pll_update_invariant_sites(pll_partition_t * partition)
      sites, or -1 for variant sites */
   if (!partition->invariant)
   {
-    partition->invariant = (int *)malloc(sites * sizeof(int));
+    partition->invariant = (int *)malloc(partition->alloc_sites * sizeof(int));
   }
 
   invariant = (pll_state_t *)malloc(sites * sizeof(pll_state_t));
@@ -632,12 +768,7 @@ PLL_EXPORT int pll_update_invariant_sites(pll_partition_t * partition)
       for (j = 0; j < sites; ++j)
       {
         unsigned int site = site_id ? site_id[j] : j;
-        tipclv = partition->clv[i] + span_padded * site;
-        state = 0;
-        for (k = 0; k < states; ++k)
-        {
-          state |= ((pll_state_t)tipclv[k] << k);
-        }
+        state = tipclv_state(partition, i, span_padded * site);
         invariant[j] &= state;
       }
     }
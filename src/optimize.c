@@ -0,0 +1,665 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Branch lengths are optimized one edge at a time with Newton-Raphson,
+   visiting the edges of the tree in pre-order. The CLVs at the end-points of
+   each edge are brought up to date with pll_utree_update_partials_lazy, so
+   moving to an adjacent edge recomputes a single CLV. Each Newton step
+   evaluates the full step and three shortened steps in one pass over the
+   sumtable, and the longest step that improves the likelihood is taken */
+
+#define OPT_MAX_ITER 32
+#define OPT_POINTS 4
+
+typedef struct optimize_s
+{
+  pll_partition_t * const * partitions;
+  unsigned int count;
+  pll_utree_t * tree;
+  unsigned int * const * params_indices;
+  double min_length;
+  double max_length;
+  double tolerance;
+  pll_optimize_workspace_t * workspace;
+  double max_change;                 /* largest change in the current sweep */
+  double logl;                       /* log-likelihood at the last edge */
+} optimize_t;
+
+static size_t sumtable_size(const pll_partition_t * partition)
+{
+  unsigned int sites = partition->alloc_sites;
+
+  if (partition->asc_bias_alloc)
+    sites += partition->states;
+
+  return (size_t)sites * partition->rate_cats * partition->states_padded;
+}
+
+PLL_EXPORT pll_optimize_workspace_t * pll_optimize_workspace_create(
+                                        pll_partition_t * const * partitions,
+                                        unsigned int count)
+{
+  unsigned int i;
+  pll_optimize_workspace_t * workspace;
+
+  workspace = (pll_optimize_workspace_t *)calloc(1,
+                                             sizeof(pll_optimize_workspace_t));
+  if (!workspace)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for workspace.");
+    return NULL;
+  }
+
+  workspace->partition_count = count;
+  workspace->sumtable_size = (size_t *)calloc(count, sizeof(size_t));
+  workspace->sumtable = (double **)calloc(count, sizeof(double *));
+  if (!workspace->sumtable_size || !workspace->sumtable)
+  {
+    pll_optimize_workspace_destroy(workspace);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for workspace.");
+    return NULL;
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    workspace->sumtable_size[i] = sumtable_size(partitions[i]);
+    workspace->sumtable[i] = (double *)pll_aligned_alloc(
+                                  workspace->sumtable_size[i] * sizeof(double),
+                                  partitions[i]->alignment);
+    if (!workspace->sumtable[i])
+    {
+      pll_optimize_workspace_destroy(workspace);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate memory for sumtables.");
+      return NULL;
+    }
+  }
+
+  return workspace;
+}
+
+PLL_EXPORT void pll_optimize_workspace_destroy(
+                                        pll_optimize_workspace_t * workspace)
+{
+  unsigned int i;
+
+  if (!workspace) return;
+
+  if (workspace->sumtable)
+    for (i = 0; i < workspace->partition_count; ++i)
+      pll_aligned_free(workspace->sumtable[i]);
+
+  free(workspace->sumtable);
+  free(workspace->sumtable_size);
+  free(workspace);
+}
+
+/* brings the CLVs at both end-points of the edge up to date and computes the
+   sumtables of all partitions */
+static int prepare_edge(optimize_t * opt, const pll_unode_t * edge)
+{
+  unsigned int i;
+
+  for (i = 0; i < opt->count; ++i)
+  {
+    pll_partition_t * partition = opt->partitions[i];
+
+    if (!pll_utree_update_partials_lazy(partition, opt->tree, edge, NULL))
+      return PLL_FAILURE;
+
+    if (!pll_update_sumtable(partition,
+                             edge->clv_index,
+                             edge->back->clv_index,
+                             edge->scaler_index,
+                             edge->back->scaler_index,
+                             opt->params_indices[i],
+                             opt->workspace->sumtable[i]))
+      return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* log-likelihood and derivatives of -logL summed over all partitions, at
+   count branch lengths of the edge */
+static int edge_derivatives(const optimize_t * opt,
+                            const pll_unode_t * edge,
+                            unsigned int count,
+                            const double * lengths,
+                            double * logl,
+                            double * d_f,
+                            double * dd_f)
+{
+  unsigned int i, k;
+  double part_logl[OPT_POINTS];
+  double part_d_f[OPT_POINTS];
+  double part_dd_f[OPT_POINTS];
+
+  for (k = 0; k < count; ++k)
+    logl[k] = d_f[k] = dd_f[k] = 0;
+
+  for (i = 0; i < opt->count; ++i)
+  {
+    if (!pll_compute_likelihood_derivatives_multi(opt->partitions[i],
+                                                  edge->clv_index,
+                                                  edge->back->clv_index,
+                                                  edge->scaler_index,
+                                                  edge->back->scaler_index,
+                                                  count,
+                                                  lengths,
+                                                  opt->params_indices[i],
+                                                  opt->workspace->sumtable[i],
+                                                  part_logl,
+                                                  part_d_f,
+                                                  part_dd_f))
+      return PLL_FAILURE;
+
+    for (k = 0; k < count; ++k)
+    {
+      logl[k] += part_logl[k];
+      d_f[k] += part_d_f[k];
+      dd_f[k] += part_dd_f[k];
+    }
+  }
+
+  return PLL_SUCCESS;
+}
+
+static double clamp_length(const optimize_t * opt, double length)
+{
+  return PLL_MIN(PLL_MAX(length, opt->min_length), opt->max_length);
+}
+
+static int set_length(optimize_t * opt, pll_unode_t * edge, double length)
+{
+  unsigned int i;
+
+  edge->length = edge->back->length = length;
+
+  for (i = 0; i < opt->count; ++i)
+    if (!pll_update_prob_matrices(opt->partitions[i],
+                                  opt->params_indices[i],
+                                  &edge->pmatrix_index,
+                                  &length,
+                                  1))
+      return PLL_FAILURE;
+
+  return PLL_SUCCESS;
+}
+
+static int optimize_edge(optimize_t * opt, pll_unode_t * edge)
+{
+  unsigned int i, k;
+  double length = clamp_length(opt, edge->length);
+  double target;
+  double lengths[OPT_POINTS];
+  double logl[OPT_POINTS];
+  double d_f[OPT_POINTS];
+  double dd_f[OPT_POINTS];
+
+  if (!prepare_edge(opt, edge))
+    return PLL_FAILURE;
+
+  if (!edge_derivatives(opt, edge, 1, &length, logl, d_f, dd_f))
+    return PLL_FAILURE;
+  opt->logl = logl[0];
+
+  for (i = 0; i < OPT_MAX_ITER; ++i)
+  {
+    /* Newton step on -logL where it is convex, otherwise a multiplicative
+       step in the descent direction */
+    if (dd_f[0] > 0)
+      target = length - d_f[0] / dd_f[0];
+    else
+      target = (d_f[0] < 0) ? 4 * length : length / 4;
+    target = clamp_length(opt, target);
+
+    if (fabs(target - length) < opt->tolerance)
+      break;
+
+    /* the full step and three shortened steps, evaluated in one pass */
+    for (k = 0; k < OPT_POINTS; ++k)
+      lengths[k] = length + (target - length) / (1u << k);
+
+    if (!edge_derivatives(opt, edge, OPT_POINTS, lengths, logl, d_f, dd_f))
+      return PLL_FAILURE;
+
+    for (k = 0; k < OPT_POINTS; ++k)
+      if (logl[k] > opt->logl)
+        break;
+
+    if (k == OPT_POINTS)
+      break;
+
+    length = lengths[k];
+    opt->logl = logl[k];
+    d_f[0] = d_f[k];
+    dd_f[0] = dd_f[k];
+  }
+
+  opt->max_change = PLL_MAX(opt->max_change, fabs(length - edge->length));
+
+  if (length != edge->length)
+    return set_length(opt, edge, length);
+
+  return PLL_SUCCESS;
+}
+
+/* optimizes the edge of node and the edges of the subtree behind it */
+static int optimize_subtree(optimize_t * opt, pll_unode_t * node)
+{
+  if (!optimize_edge(opt, node))
+    return PLL_FAILURE;
+
+  if (!node->back->next)
+    return PLL_SUCCESS;
+
+  if (!optimize_subtree(opt, node->back->next))
+    return PLL_FAILURE;
+
+  return optimize_subtree(opt, node->back->next->next);
+}
+
+static int optimize_sweep(optimize_t * opt)
+{
+  pll_unode_t * root = opt->tree->vroot;
+
+  if (!optimize_subtree(opt, root))
+    return PLL_FAILURE;
+
+  if (!root->next)
+    return PLL_SUCCESS;
+
+  if (!optimize_subtree(opt, root->next))
+    return PLL_FAILURE;
+
+  return optimize_subtree(opt, root->next->next);
+}
+
+/* Optimizes all branch lengths of the tree by Newton-Raphson, with at most
+ * smoothings sweeps over the edges. The sweeps stop early when no branch
+ * length changed by more than tolerance. The branch lengths are linked
+ * across the count partitions, which must use the CLV, scaler and p-matrix
+ * indices of the tree, and whose p-matrices must match the branch lengths.
+ * Branch lengths and p-matrices are updated in place, and only the CLVs
+ * invalidated by the changes are recomputed.
+ * params_indices[i]: [input] parameter indices of partition i
+ * min_length, max_length: [input] bounds of the branch lengths
+ * workspace: [input] created by pll_optimize_workspace_create for the same
+ *                    partitions, or NULL for a temporary one
+ * logl: [output] if not NULL, the final log-likelihood
+ * Ascertainment bias correction is not supported.
+ */
+PLL_EXPORT int pll_optimize_branch_lengths(pll_partition_t * const * partitions,
+                                           unsigned int count,
+                                           pll_utree_t * tree,
+                                           unsigned int * const * params_indices,
+                                           double min_length,
+                                           double max_length,
+                                           double tolerance,
+                                           unsigned int smoothings,
+                                           pll_optimize_workspace_t * workspace,
+                                           double * logl)
+{
+  unsigned int i;
+  optimize_t opt;
+  double d_f, dd_f;
+  int retval;
+
+  if (!count || !(min_length > 0) || !(max_length >= min_length) ||
+      !(tolerance > 0))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Invalid branch length optimization parameters.");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    if (partitions[i]->attributes & PLL_ATTRIB_AB_MASK)
+    {
+      pll_errno = PLL_ERROR_AB_NOSUPPORT;
+      snprintf(pll_errmsg, 200,
+               "Branch length optimization is not supported with "
+               "ascertainment bias correction.");
+      return PLL_FAILURE;
+    }
+
+    if (workspace && (i >= workspace->partition_count ||
+                      workspace->sumtable_size[i] <
+                        sumtable_size(partitions[i])))
+    {
+      pll_errno = PLL_ERROR_PARAM_INVALID;
+      snprintf(pll_errmsg, 200, "Workspace does not match the partitions.");
+      return PLL_FAILURE;
+    }
+  }
+
+  opt.partitions = partitions;
+  opt.count = count;
+  opt.tree = tree;
+  opt.params_indices = params_indices;
+  opt.min_length = min_length;
+  opt.max_length = max_length;
+  opt.tolerance = tolerance;
+  opt.workspace = workspace;
+
+  if (!workspace)
+  {
+    opt.workspace = pll_optimize_workspace_create(partitions, count);
+    if (!opt.workspace)
+      return PLL_FAILURE;
+  }
+
+  /* log-likelihood of the initial branch lengths */
+  retval = prepare_edge(&opt, tree->vroot);
+  if (retval)
+    retval = edge_derivatives(&opt,
+                              tree->vroot,
+                              1,
+                              &tree->vroot->length,
+                              &opt.logl,
+                              &d_f,
+                              &dd_f);
+
+  for (i = 0; i < smoothings && retval; ++i)
+  {
+    opt.max_change = 0;
+    retval = optimize_sweep(&opt);
+
+    if (opt.max_change < tolerance)
+      break;
+  }
+
+  if (retval && logl)
+    *logl = opt.logl;
+
+  if (!workspace)
+    pll_optimize_workspace_destroy(opt.workspace);
+
+  return retval;
+}
+
+/* appends, in pre-order, the operations computing the upward CLVs of the
+   subtree of node, whose parent side has the CLV up_clv, and the lower
+   end-points of its edges */
+static void gradient_traverse(const pll_unode_t * node,
+                              unsigned int up_clv,
+                              int up_scaler,
+                              const unsigned int * up_clv_indices,
+                              const int * up_scaler_indices,
+                              pll_operation_t * ops,
+                              unsigned int * ops_count,
+                              const pll_unode_t ** edges,
+                              unsigned int * edges_count)
+{
+  unsigned int i;
+  const pll_unode_t * child;
+  const pll_unode_t * sibling;
+
+  if (!node->next)
+    return;
+
+  for (i = 0; i < 2; ++i)
+  {
+    pll_operation_t * op = ops + (*ops_count)++;
+
+    child = i ? node->next->next : node->next;
+    sibling = i ? node->next : node->next->next;
+
+    op->parent_clv_index = up_clv_indices[child->pmatrix_index];
+    op->parent_scaler_index = up_scaler_indices ?
+                                up_scaler_indices[child->pmatrix_index] :
+                                PLL_SCALE_BUFFER_NONE;
+    op->child1_clv_index = up_clv;
+    op->child1_scaler_index = up_scaler;
+    op->child1_matrix_index = node->pmatrix_index;
+    op->child2_clv_index = sibling->back->clv_index;
+    op->child2_scaler_index = sibling->back->scaler_index;
+    op->child2_matrix_index = sibling->back->pmatrix_index;
+
+    edges[(*edges_count)++] = child->back;
+
+    gradient_traverse(child->back,
+                      op->parent_clv_index,
+                      op->parent_scaler_index,
+                      up_clv_indices,
+                      up_scaler_indices,
+                      ops,
+                      ops_count,
+                      edges,
+                      edges_count);
+  }
+}
+
+/* checks that the upward CLV and scale buffers written by the operations
+   exist and are distinct from each other and from those of the tree */
+static int check_up_buffers(const pll_partition_t * partition,
+                            const pll_utree_t * tree,
+                            const pll_operation_t * ops,
+                            unsigned int ops_count)
+{
+  unsigned int i;
+  int retval = PLL_SUCCESS;
+  char * clv_used = (char *)calloc(partition->nodes, 1);
+  char * scaler_used = (char *)calloc(partition->scale_buffers + 1, 1);
+
+  if (!clv_used || !scaler_used)
+  {
+    free(clv_used);
+    free(scaler_used);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for buffer checks.");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < tree->tip_count + tree->inner_count; ++i)
+  {
+    const pll_unode_t * node = tree->nodes[i];
+
+    if (node->clv_index < partition->nodes)
+      clv_used[node->clv_index] = 1;
+    if (node->scaler_index != PLL_SCALE_BUFFER_NONE &&
+        (unsigned int)node->scaler_index < partition->scale_buffers)
+      scaler_used[node->scaler_index] = 1;
+  }
+
+  for (i = 0; i < ops_count && retval; ++i)
+  {
+    unsigned int clv = ops[i].parent_clv_index;
+    int scaler = ops[i].parent_scaler_index;
+
+    if (clv >= partition->nodes || clv_used[clv] ||
+        (scaler != PLL_SCALE_BUFFER_NONE &&
+         ((unsigned int)scaler >= partition->scale_buffers ||
+          scaler_used[scaler])))
+    {
+      pll_errno = PLL_ERROR_PARAM_INVALID;
+      snprintf(pll_errmsg, 200,
+               "Upward CLV %u or scale buffer %d is used by the tree, "
+               "used twice or does not exist.", clv, scaler);
+      retval = PLL_FAILURE;
+    }
+    else
+    {
+      clv_used[clv] = 1;
+      if (scaler != PLL_SCALE_BUFFER_NONE)
+        scaler_used[scaler] = 1;
+    }
+  }
+
+  free(clv_used);
+  free(scaler_used);
+
+  return retval;
+}
+
+/* Computes the derivative of the log-likelihood with respect to every branch
+ * length of the tree. A post-order pass brings the CLVs of the tree up to
+ * date towards tree->vroot through pll_utree_update_partials_lazy, and a
+ * pre-order pass computes for each edge the upward CLV, i.e. the CLV of its
+ * end-point closer to the root, conditioned on the rest of the tree.
+ * The upward CLVs need spare buffers: the partition must be created with
+ * tree->edge_count - 1 CLV (and scale) buffers in addition to those of the
+ * tree, one for each edge but the root edge. Upward buffers that are used by
+ * the tree, by another edge or do not exist are rejected with
+ * PLL_ERROR_PARAM_INVALID, as they would overwrite CLVs still to be read.
+ * up_clv_indices: [input] CLV index of the upward CLV of each edge, indexed
+ *                         by the p-matrix index of the edge (edge_count
+ *                         entries, the one of the root edge is not used)
+ * up_scaler_indices: [input] likewise for the scale buffers, or NULL to
+ *                            leave the upward CLVs unscaled (small trees)
+ * workspace: [input] created by pll_optimize_workspace_create for this
+ *                    partition, or NULL for a temporary one
+ * gradient: [output] dlogL/dt of each edge, indexed by its p-matrix index
+ * logl: [output] if not NULL, the log-likelihood of the tree
+ */
+PLL_EXPORT int pll_utree_compute_gradient(pll_partition_t * partition,
+                                          const pll_utree_t * tree,
+                                          const unsigned int * params_indices,
+                                          const unsigned int * up_clv_indices,
+                                          const int * up_scaler_indices,
+                                          pll_optimize_workspace_t * workspace,
+                                          double * gradient,
+                                          double * logl)
+{
+  unsigned int i;
+  unsigned int ops_count = 0;
+  unsigned int edges_count = 0;
+  const pll_unode_t * root = tree->vroot;
+  pll_operation_t * ops;
+  const pll_unode_t ** edges;
+  pll_optimize_workspace_t * ws = workspace;
+  double d_f, dd_f;
+  int retval = PLL_SUCCESS;
+
+  if (workspace && (!workspace->partition_count ||
+                    workspace->sumtable_size[0] < sumtable_size(partition)))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Workspace does not match the partition.");
+    return PLL_FAILURE;
+  }
+
+  if (!pll_utree_update_partials_lazy(partition, tree, root, NULL))
+    return PLL_FAILURE;
+
+  ops = (pll_operation_t *)malloc(tree->edge_count * sizeof(pll_operation_t));
+  edges = (const pll_unode_t **)malloc(tree->edge_count *
+                                       sizeof(pll_unode_t *));
+  if (!ops || !edges)
+  {
+    free(ops);
+    free(edges);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for operations.");
+    return PLL_FAILURE;
+  }
+
+  if (!ws)
+  {
+    ws = pll_optimize_workspace_create(&partition, 1);
+    if (!ws)
+    {
+      free(ops);
+      free(edges);
+      return PLL_FAILURE;
+    }
+  }
+
+  /* the CLVs at both end-points of the root edge are already computed */
+  edges[edges_count++] = root;
+  gradient_traverse(root,
+                    root->back->clv_index,
+                    root->back->scaler_index,
+                    up_clv_indices,
+                    up_scaler_indices,
+                    ops,
+                    &ops_count,
+                    edges,
+                    &edges_count);
+  gradient_traverse(root->back,
+                    root->clv_index,
+                    root->scaler_index,
+                    up_clv_indices,
+                    up_scaler_indices,
+                    ops,
+                    &ops_count,
+                    edges,
+                    &edges_count);
+
+  retval = check_up_buffers(partition, tree, ops, ops_count);
+
+  if (retval && ops_count)
+    retval = pll_update_partials(partition, ops, ops_count);
+
+  for (i = 0; i < edges_count && retval; ++i)
+  {
+    const pll_unode_t * edge = edges[i];
+    unsigned int up_clv = i ? up_clv_indices[edge->pmatrix_index] :
+                              edge->back->clv_index;
+    int up_scaler = i ? (up_scaler_indices ?
+                           up_scaler_indices[edge->pmatrix_index] :
+                           PLL_SCALE_BUFFER_NONE) :
+                        edge->back->scaler_index;
+
+    retval = pll_update_sumtable(partition,
+                                 up_clv,
+                                 edge->clv_index,
+                                 up_scaler,
+                                 edge->scaler_index,
+                                 params_indices,
+                                 ws->sumtable[0]);
+    if (retval)
+      retval = pll_compute_likelihood_derivatives(partition,
+                                                  up_scaler,
+                                                  edge->scaler_index,
+                                                  edge->length,
+                                                  params_indices,
+                                                  ws->sumtable[0],
+                                                  &d_f,
+                                                  &dd_f);
+
+    if (retval)
+      gradient[edge->pmatrix_index] = -d_f;
+  }
+
+  if (retval && logl)
+    *logl = pll_compute_edge_loglikelihood(partition,
+                                           root->clv_index,
+                                           root->scaler_index,
+                                           root->back->clv_index,
+                                           root->back->scaler_index,
+                                           root->pmatrix_index,
+                                           params_indices,
+                                           NULL);
+
+  if (!workspace)
+    pll_optimize_workspace_destroy(ws);
+  free(ops);
+  free(edges);
+
+  return retval;
+}
@@ -21,7 +21,7 @@
 
 #include "pll.h"
 
-static void unscale(double * prob, unsigned int times);
+static void unscale(double * prob, unsigned int times, double threshold);
 
 PLL_EXPORT void pll_show_pmatrix(const pll_partition_t * partition,
                                  unsigned int index,
@@ -45,12 +45,12 @@ PLL_EXPORT void pll_show_pmatrix(const pll_partition_t * partition,
   }
 }
 
-static void unscale(double * prob, unsigned int times)
+static void unscale(double * prob, unsigned int times, double threshold)
 {
   unsigned int i;
 
   for (i = 0; i < times; ++i)
-    *prob *= PLL_SCALE_THRESHOLD;
+    *prob *= threshold;
 }
 
 PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
@@ -61,6 +61,11 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
   unsigned int s,i,j,k;
 
   double * clv = partition->clv[clv_index];
+  const float * clv_sp = (const float *)(partition->clv[clv_index]);
+  int single_precision = (partition->attributes &
+                          PLL_ATTRIB_SINGLE_PRECISION) ? 1 : 0;
+  double threshold = single_precision ?
+                       PLL_SCALE_THRESHOLD_SP : PLL_SCALE_THRESHOLD;
   unsigned int * scaler = (scaler_index == PLL_SCALE_BUFFER_NONE) ?
                           NULL : partition->scale_buffer[scaler_index];
   unsigned int states = partition->states;
@@ -76,6 +81,10 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
       (partition->attributes & PLL_ATTRIB_PATTERN_TIP))
     return;
 
+  /* evicted CLV of a partition with PLL_ATTRIB_LIMIT_MEMORY */
+  if (!clv)
+    return;
+
   printf ("[ ");
   for (s = 0; s < partition->sites; ++s)
   {
@@ -86,12 +95,14 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
       printf("(");
       for (k = 0; k < states-1; ++k)
       {
-        prob = clv[i*rates*states_padded + j*states_padded + k];
-        if (scaler) unscale(&prob, scaler[i]);
+        size_t offset = i*rates*states_padded + j*states_padded + k;
+        prob = single_precision ? clv_sp[offset] : clv[offset];
+        if (scaler) unscale(&prob, scaler[i], threshold);
         printf("%.*f,", float_precision, prob);
       }
-      prob = clv[i*rates*states_padded + j*states_padded + k];
-      if (scaler) unscale(&prob, scaler[i]);
+      size_t offset = i*rates*states_padded + j*states_padded + k;
+      prob = single_precision ? clv_sp[offset] : clv[offset];
+      if (scaler) unscale(&prob, scaler[i], threshold);
       printf("%.*f)", float_precision, prob);
       if (j < rates - 1) printf(",");
     }
@@ -21,18 +21,56 @@
 
 #include "pll.h"
 
+/* address of the CLV entries of a site; CLVs of single-precision partitions
+   hold floats */
+static double * clv_site(const pll_partition_t * partition,
+                         double * clv,
+                         unsigned int site)
+{
+  size_t span = partition->states_padded * partition->rate_cats;
+
+  if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+    return (double *)((float *)clv + site * span);
+
+  return clv + site * span;
+}
+
+static unsigned int * scaler_site(const pll_partition_t * partition,
+                                  unsigned int * scaler,
+                                  unsigned int site)
+{
+  if (!scaler) return NULL;
+
+  if (partition->attributes & PLL_ATTRIB_RATE_SCALERS)
+    return scaler + site * partition->rate_cats;
+
+  return scaler + site;
+}
+
+static void create_lookup(pll_partition_t * partition,
+                          const pll_operation_t * op,
+                          double * lookup)
+{
+  partition->kernels.create_lookup(partition->states,
+                                   partition->rate_cats,
+                                   lookup,
+                                   partition->pmatrix[op->child1_matrix_index],
+                                   partition->pmatrix[op->child2_matrix_index],
+                                   partition->tipmap,
+                                   partition->maxstates,
+                                   partition->attributes);
+}
+
+/* the case_* functions update the sites [begin,end) of the parent CLV;
+   case_tiptip expects the tip-tip lookup table to be already computed */
 static void case_tiptip(pll_partition_t * partition,
-                        const pll_operation_t * op)
+                        const pll_operation_t * op,
+                        unsigned int begin,
+                        unsigned int end,
+                        const double * lookup)
 {
-  const double * left_matrix = partition->pmatrix[op->child1_matrix_index];
-  const double * right_matrix = partition->pmatrix[op->child2_matrix_index];
   double * parent_clv = partition->clv[op->parent_clv_index];
   unsigned int * parent_scaler;
-  unsigned int sites = partition->sites;
-
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->states;
 
   /* get parent scaler */
   if (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE)
@@ -40,33 +78,28 @@ static void case_tiptip(pll_partition_t * partition,
   else
     parent_scaler = partition->scale_buffer[op->parent_scaler_index];
 
-  /* precompute lookup table */
-  pll_core_create_lookup(partition->states,
-                         partition->rate_cats,
-                         partition->ttlookup,
-                         left_matrix,
-                         right_matrix,
-                         partition->tipmap,
-                         partition->maxstates,
-                         partition->attributes);
-
-
-  /* and update CLV at inner node */
-  pll_core_update_partial_tt(partition->states,
-                             sites,
-                             partition->rate_cats,
-                             parent_clv,
-                             parent_scaler,
-                             partition->tipchars[op->child1_clv_index],
-                             partition->tipchars[op->child2_clv_index],
-                             partition->tipmap,
-                             partition->maxstates,
-                             partition->ttlookup,
-                             partition->attributes);
+  /* update CLV at inner node */
+  partition->kernels.update_partial_tt(partition->states,
+                                       end - begin,
+                                       partition->rate_cats,
+                                       clv_site(partition, parent_clv, begin),
+                                       scaler_site(partition,
+                                                   parent_scaler,
+                                                   begin),
+                                       partition->tipchars[op->child1_clv_index]
+                                         + begin,
+                                       partition->tipchars[op->child2_clv_index]
+                                         + begin,
+                                       partition->tipmap,
+                                       partition->maxstates,
+                                       lookup,
+                                       partition->attributes);
 }
 
 static void case_tipinner(pll_partition_t * partition,
-                          const pll_operation_t * op)
+                          const pll_operation_t * op,
+                          unsigned int begin,
+                          unsigned int end)
 {
   double * parent_clv = partition->clv[op->parent_clv_index];
   unsigned int tip_clv_index;
@@ -75,11 +108,6 @@ static void case_tipinner(pll_partition_t * partition,
   unsigned int inner_matrix_index;
   unsigned int * right_scaler;
   unsigned int * parent_scaler;
-  unsigned int sites = partition->sites;
-
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->states;
 
   /* get parent scaler */
   if (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE)
@@ -110,25 +138,33 @@ static void case_tipinner(pll_partition_t * partition,
     else
       right_scaler = partition->scale_buffer[op->child1_scaler_index];
   }
-  
 
-  pll_core_update_partial_ti(partition->states,
-                             sites,
-                             partition->rate_cats,
-                             parent_clv,
-                             parent_scaler,
-                             partition->tipchars[tip_clv_index],
-                             partition->clv[inner_clv_index],
-                             partition->pmatrix[tip_matrix_index],
-                             partition->pmatrix[inner_matrix_index],
-                             right_scaler,
-                             partition->tipmap,
-                             partition->maxstates,
-                             partition->attributes);
+  partition->kernels.update_partial_ti(partition->states,
+                                       end - begin,
+                                       partition->rate_cats,
+                                       clv_site(partition, parent_clv, begin),
+                                       scaler_site(partition,
+                                                   parent_scaler,
+                                                   begin),
+                                       partition->tipchars[tip_clv_index]
+                                         + begin,
+                                       clv_site(partition,
+                                                partition->clv[inner_clv_index],
+                                                begin),
+                                       partition->pmatrix[tip_matrix_index],
+                                       partition->pmatrix[inner_matrix_index],
+                                       scaler_site(partition,
+                                                   right_scaler,
+                                                   begin),
+                                       partition->tipmap,
+                                       partition->maxstates,
+                                       partition->attributes);
 }
 
 static void case_innerinner(pll_partition_t * partition,
-                            const pll_operation_t * op)
+                            const pll_operation_t * op,
+                            unsigned int begin,
+                            unsigned int end)
 {
   const double * left_matrix = partition->pmatrix[op->child1_matrix_index];
   const double * right_matrix = partition->pmatrix[op->child2_matrix_index];
@@ -138,11 +174,6 @@ static void case_innerinner(pll_partition_t * partition,
   unsigned int * parent_scaler;
   unsigned int * left_scaler;
   unsigned int * right_scaler;
-  unsigned int sites = partition->sites;
-
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->states;
 
   /* get parent scaler */
   if (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE)
@@ -161,18 +192,24 @@ static void case_innerinner(pll_partition_t * partition,
   else
     right_scaler = NULL;
 
-  pll_core_update_partial_ii(partition->states,
-                             sites,
-                             partition->rate_cats,
-                             parent_clv,
-                             parent_scaler,
-                             left_clv,
-                             right_clv,
-                             left_matrix,
-                             right_matrix,
-                             left_scaler,
-                             right_scaler,
-                             partition->attributes);
+  partition->kernels.update_partial_ii(partition->states,
+                                       end - begin,
+                                       partition->rate_cats,
+                                       clv_site(partition, parent_clv, begin),
+                                       scaler_site(partition,
+                                                   parent_scaler,
+                                                   begin),
+                                       clv_site(partition, left_clv, begin),
+                                       clv_site(partition, right_clv, begin),
+                                       left_matrix,
+                                       right_matrix,
+                                       scaler_site(partition,
+                                                   left_scaler,
+                                                   begin),
+                                       scaler_site(partition,
+                                                   right_scaler,
+                                                   begin),
+                                       partition->attributes);
 }
 
 static void case_repeats(pll_partition_t * partition,
@@ -214,38 +251,233 @@ static void case_repeats(pll_partition_t * partition,
     right_scaler = NULL;
 
   /* call the function with the shortest clv on the left */
-  pll_core_update_partial_repeats(partition->states,
-                                parent_sites,
-                                inv  ? left_sites   : right_sites,
-                                !inv ? left_sites   : right_sites,
-                                partition->rate_cats,
-                                parent_clv,
-                                parent_scaler,
-                                inv  ? left_clv     : right_clv,
-                                !inv ? left_clv     : right_clv,
-                                inv  ? left_matrix  : right_matrix,
-                                !inv ? left_matrix  : right_matrix,
-                                inv  ? left_scaler  : right_scaler,
-                                !inv ? left_scaler  : right_scaler,
-                                parent_id_site,
-                                inv  ? left_site_id : right_site_id,
-                                !inv ? left_site_id : right_site_id,
-                                bclv_buffer,
-                                partition->attributes);
-}
-
-PLL_EXPORT void pll_update_partials(pll_partition_t * partition,
-                                    const pll_operation_t * operations,
-                                    unsigned int count)
-{
-  pll_update_partials_rep(partition, operations, count, 1);
-}
-
-
-PLL_EXPORT void pll_update_partials_rep(pll_partition_t * partition,
-                                    const pll_operation_t * operations,
-                                    unsigned int count,
-                                    unsigned int update_repeats)
+  partition->kernels.update_partial_repeats(partition->states,
+                                            parent_sites,
+                                            inv  ? left_sites   : right_sites,
+                                            !inv ? left_sites   : right_sites,
+                                            partition->rate_cats,
+                                            parent_clv,
+                                            parent_scaler,
+                                            inv  ? left_clv     : right_clv,
+                                            !inv ? left_clv     : right_clv,
+                                            inv  ? left_matrix  : right_matrix,
+                                            !inv ? left_matrix  : right_matrix,
+                                            inv  ? left_scaler  : right_scaler,
+                                            !inv ? left_scaler  : right_scaler,
+                                            parent_id_site,
+                                            inv  ? left_site_id : right_site_id,
+                                            !inv ? left_site_id : right_site_id,
+                                            bclv_buffer,
+                                            partition->attributes);
+}
+
+/* updates the sites [begin,end) of the parent CLV with the kernel of the
+   operation; tip-tip operations use the given (already computed) lookup */
+static void case_sites(pll_partition_t * partition,
+                       const pll_operation_t * op,
+                       unsigned int begin,
+                       unsigned int end,
+                       const double * lookup)
+{
+  if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+  {
+    if ((op->child1_clv_index < partition->tips) &&
+        (op->child2_clv_index < partition->tips))
+      case_tiptip(partition, op, begin, end, lookup);
+    else if ((op->child1_clv_index < partition->tips) ||
+             (op->child2_clv_index < partition->tips))
+      case_tipinner(partition, op, begin, end);
+    else
+      case_innerinner(partition, op, begin, end);
+  }
+  else
+    case_innerinner(partition, op, begin, end);
+}
+
+/* sets the sites [begin,end) of the parent CLV to one and its scalers to
+   zero, which is the result of the kernels at all-gap sites */
+static void case_gaps(pll_partition_t * partition,
+                      const pll_operation_t * op,
+                      unsigned int begin,
+                      unsigned int end)
+{
+  unsigned int i,j;
+  unsigned int states = partition->states;
+  unsigned int states_padded = partition->states_padded;
+  char * clv = (char *)clv_site(partition,
+                                partition->clv[op->parent_clv_index],
+                                begin);
+  size_t span = (char *)clv_site(partition,
+                                 partition->clv[op->parent_clv_index],
+                                 begin + 1) - clv;
+
+  /* fill the first site and replicate it */
+  for (i = 0; i < partition->rate_cats; ++i)
+    for (j = 0; j < states_padded; ++j)
+    {
+      if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+        ((float *)clv)[i*states_padded+j] = j < states ? 1.0f : 0.0f;
+      else
+        ((double *)clv)[i*states_padded+j] = j < states ? 1.0 : 0.0;
+    }
+  for (i = begin + 1; i < end; ++i)
+    memcpy(clv + (i - begin) * span, clv, span);
+
+  if (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE)
+  {
+    unsigned int * scaler = partition->scale_buffer[op->parent_scaler_index];
+    unsigned int per_site = (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                              partition->rate_cats : 1;
+    memset(scaler_site(partition, scaler, begin),
+           0,
+           (end - begin) * per_site * sizeof(unsigned int));
+  }
+}
+
+/* updates the sites [begin,end) of the parent CLV from child1 (child == 1)
+   or child2 only, the other child being undetermined at these sites */
+static void case_single(pll_partition_t * partition,
+                        const pll_operation_t * op,
+                        unsigned int child,
+                        unsigned int begin,
+                        unsigned int end)
+{
+  double * parent_clv = partition->clv[op->parent_clv_index];
+  unsigned int clv_index;
+  unsigned int matrix_index;
+  int scaler_index;
+  unsigned int * child_scaler;
+  unsigned int * parent_scaler;
+
+  /* get parent scaler */
+  if (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE)
+    parent_scaler = NULL;
+  else
+    parent_scaler = partition->scale_buffer[op->parent_scaler_index];
+
+  if (child == 1)
+  {
+    clv_index = op->child1_clv_index;
+    matrix_index = op->child1_matrix_index;
+    scaler_index = op->child1_scaler_index;
+  }
+  else
+  {
+    clv_index = op->child2_clv_index;
+    matrix_index = op->child2_matrix_index;
+    scaler_index = op->child2_scaler_index;
+  }
+
+  if (scaler_index == PLL_SCALE_BUFFER_NONE)
+    child_scaler = NULL;
+  else
+    child_scaler = partition->scale_buffer[scaler_index];
+
+  partition->kernels.update_partial_single(partition->states,
+                                           end - begin,
+                                           partition->rate_cats,
+                                           clv_site(partition,
+                                                    parent_clv,
+                                                    begin),
+                                           scaler_site(partition,
+                                                       parent_scaler,
+                                                       begin),
+                                           clv_site(partition,
+                                                    partition->clv[clv_index],
+                                                    begin),
+                                           partition->pmatrix[matrix_index],
+                                           scaler_site(partition,
+                                                       child_scaler,
+                                                       begin),
+                                           partition->attributes);
+}
+
+/* returns which children of the operation are undetermined at site (bit 0
+   for child1, bit 1 for child2). A single undetermined child is reported
+   only if the other child has a CLV and there is a single-child kernel */
+static unsigned int gap_children(const pll_partition_t * partition,
+                                 const pll_operation_t * op,
+                                 const unsigned int * left,
+                                 const unsigned int * right,
+                                 unsigned int site)
+{
+  unsigned int gaps = PLL_GAP_BIT(left, site) | PLL_GAP_BIT(right, site) << 1;
+  unsigned int other;
+
+  if (gaps != 1 && gaps != 2)
+    return gaps;
+
+  other = (gaps == 1) ? op->child2_clv_index : op->child1_clv_index;
+  if (!partition->kernels.update_partial_single ||
+      ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+       other < partition->tips))
+    return 0;
+
+  return gaps;
+}
+
+/* updates the sites [begin,end) of the parent CLV. Under
+   PLL_ATTRIB_GAP_ELISION, runs of at least PLL_GAPS_MIN_RUN sites at which
+   both children are undetermined are written directly, runs at which one
+   child is undetermined are computed from the other child, and the remaining
+   sites (including shorter runs) are passed to the kernels */
+static void update_sites(pll_partition_t * partition,
+                         const pll_operation_t * op,
+                         unsigned int begin,
+                         unsigned int end,
+                         const double * lookup)
+{
+  unsigned int run, stop, gaps;
+  const unsigned int * left = pll_get_gap_bitvector(partition,
+                                                    op->child1_clv_index);
+  const unsigned int * right = pll_get_gap_bitvector(partition,
+                                                     op->child2_clv_index);
+
+  if (!left)
+  {
+    case_sites(partition, op, begin, end, lookup);
+    return;
+  }
+
+  while (begin < end)
+  {
+    run = pll_gaps_run_end(left, right, begin, end);
+    gaps = gap_children(partition, op, left, right, begin);
+    if (gaps && run - begin >= PLL_GAPS_MIN_RUN)
+    {
+      if (gaps == 3)
+        case_gaps(partition, op, begin, run);
+      else
+        case_single(partition, op, (gaps == 1) ? 2 : 1, begin, run);
+      begin = run;
+      continue;
+    }
+
+    /* extend the computed run up to the next long elided run */
+    for (stop = run; stop < end; stop = run)
+    {
+      run = pll_gaps_run_end(left, right, stop, end);
+      if (gap_children(partition, op, left, right, stop) &&
+          run - stop >= PLL_GAPS_MIN_RUN)
+        break;
+    }
+
+    case_sites(partition, op, begin, stop, lookup);
+    begin = stop;
+  }
+}
+
+/* processes the operations on the sites [begin,end) using the given tip-tip
+   lookup table. If pool is set, all threads of the pool call this function
+   with disjoint ranges and the same lookup table, which thread 0 computes */
+static void update_partials_range(pll_partition_t * partition,
+                                  const pll_operation_t * operations,
+                                  unsigned int count,
+                                  unsigned int begin,
+                                  unsigned int end,
+                                  double * lookup,
+                                  struct pll_threadpool * pool,
+                                  unsigned int tid)
 {
   unsigned int i;
   const pll_operation_t * op;
@@ -253,12 +485,317 @@ PLL_EXPORT void pll_update_partials_rep(pll_partition_t * partition,
   for (i = 0; i < count; ++i)
   {
     op = &(operations[i]);
-    if (pll_repeats_enabled(partition) && update_repeats) 
+    if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+        (op->child1_clv_index < partition->tips) &&
+        (op->child2_clv_index < partition->tips))
+    {
+      /* tip-tip case */
+      if (pool)
+      {
+        /* wait until all threads are done with the previous lookup */
+        pll_threadpool_barrier(pool);
+        if (!tid)
+          create_lookup(partition, op, lookup);
+        pll_threadpool_barrier(pool);
+      }
+      else
+        create_lookup(partition, op, lookup);
+    }
+
+    if (begin < end)
+      update_sites(partition, op, begin, end, lookup);
+  }
+}
+
+typedef struct partials_job_s
+{
+  pll_partition_t * partition;
+  const pll_operation_t * operations;
+  unsigned int count;
+  struct pll_threadpool * pool;
+} partials_job_t;
+
+static int partials_job(void * data, unsigned int tid, unsigned int count)
+{
+  partials_job_t * job = (partials_job_t *)data;
+  pll_partition_t * partition = job->partition;
+  unsigned int begin, end;
+
+  pll_threadpool_sites(partition->sites + partition->asc_additional_sites,
+                       tid,
+                       count,
+                       &begin,
+                       &end);
+
+  /* sites are independent, hence each thread can process all operations
+     on its range without synchronization */
+  update_partials_range(partition,
+                        job->operations,
+                        job->count,
+                        begin,
+                        end,
+                        partition->ttlookup,
+                        job->pool,
+                        tid);
+  return PLL_SUCCESS;
+}
+
+/* processes the operations on all sites, splitting the sites among the
+   threads of the partition if it has a thread pool */
+static void update_partials_sites(pll_partition_t * partition,
+                                  const pll_operation_t * operations,
+                                  unsigned int count)
+{
+  unsigned int sites = partition->sites + partition->asc_additional_sites;
+
+  if (partition->threadpool)
+  {
+    partials_job_t job;
+
+    job.partition = partition;
+    job.operations = operations;
+    job.count = count;
+    job.pool = partition->threadpool;
+    pll_threadpool_run(partition->threadpool, partials_job, &job);
+  }
+  else
+    update_partials_range(partition,
+                          operations,
+                          count,
+                          0,
+                          sites,
+                          partition->ttlookup,
+                          NULL,
+                          0);
+}
+
+static int is_resident(const pll_partition_t * partition,
+                       unsigned int clv_index)
+{
+  return clv_index < partition->tips ||
+         partition->clv_manager->node_slot[clv_index] != PLL_CLV_SLOT_NONE;
+}
+
+static void pin(pll_partition_t * partition, unsigned int clv_index)
+{
+  if (clv_index >= partition->tips)
+    partition->clv_manager->pins[clv_index]++;
+}
+
+static void unpin(pll_partition_t * partition, unsigned int clv_index)
+{
+  if (clv_index >= partition->tips)
+    partition->clv_manager->pins[clv_index]--;
+}
+
+/* makes the CLV of clv_index resident under PLL_ATTRIB_LIMIT_MEMORY by
+   recomputing the evicted CLVs of its subtree. The subtree is traversed with
+   an explicit stack, as it may be as deep as the tree. A child that is
+   resident while the other one is recomputed is pinned by the stack frame
+   of its parent (recorded in stack_pins, bit 0 for child 1 and bit 1 for
+   child 2). When both children are missing, the more expensive one is
+   recomputed first, such that fewer CLVs are pinned at the same time */
+static int fetch_clv(pll_partition_t * partition, unsigned int clv_index)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+  unsigned int * stack = manager->stack;
+  char * stack_pins = manager->stack_pins;
+  unsigned int top = 0;
+  unsigned int node, c1, c2;
+  const pll_operation_t * op;
+  int retval = PLL_SUCCESS;
+
+  if (is_resident(partition, clv_index))
+  {
+    if (clv_index >= partition->tips)
+      manager->last_use[clv_index] = ++manager->clock;
+    return PLL_SUCCESS;
+  }
+
+  stack[top++] = clv_index;
+  stack_pins[clv_index] = 0;
+
+  while (top && retval)
+  {
+    node = stack[top-1];
+    op = manager->producer + node;
+    c1 = op->child1_clv_index;
+    c2 = op->child2_clv_index;
+
+    if (!manager->has_producer[node])
+    {
+      pll_errno = PLL_ERROR_CLV_UNAVAILABLE;
+      snprintf(pll_errmsg, 200, "CLV %u has not been computed.", node);
+      retval = PLL_FAILURE;
+    }
+    else if (manager->producer_version[2*node] != manager->version[c1] ||
+             manager->producer_version[2*node+1] != manager->version[c2])
+    {
+      pll_errno = PLL_ERROR_CLV_UNAVAILABLE;
+      snprintf(pll_errmsg, 200,
+               "CLV %u was evicted and cannot be recomputed, as the CLV of "
+               "one of its children has been overwritten.", node);
+      retval = PLL_FAILURE;
+    }
+    else if (!is_resident(partition, c1) && !is_resident(partition, c2))
+    {
+      node = manager->cost[c1] >= manager->cost[c2] ? c1 : c2;
+      stack[top++] = node;
+      stack_pins[node] = 0;
+    }
+    else if (!is_resident(partition, c1) || !is_resident(partition, c2))
+    {
+      if (is_resident(partition, c1))
+      {
+        if (!(stack_pins[node] & 1)) pin(partition, c1);
+        stack_pins[node] |= 1;
+        node = c2;
+      }
+      else
+      {
+        if (!(stack_pins[node] & 2)) pin(partition, c2);
+        stack_pins[node] |= 2;
+        node = c1;
+      }
+      stack[top++] = node;
+      stack_pins[node] = 0;
+    }
+    else
+    {
+      if (!(stack_pins[node] & 1)) pin(partition, c1);
+      if (!(stack_pins[node] & 2)) pin(partition, c2);
+      stack_pins[node] = 3;
+
+      retval = pll_clv_acquire(partition, node);
+      if (retval)
+      {
+        update_partials_sites(partition, op, 1);
+        unpin(partition, c1);
+        unpin(partition, c2);
+        --top;
+      }
+    }
+  }
+
+  /* on failure, release the children pinned by the remaining frames */
+  while (top)
+  {
+    op = manager->producer + stack[--top];
+    if (stack_pins[stack[top]] & 1) unpin(partition, op->child1_clv_index);
+    if (stack_pins[stack[top]] & 2) unpin(partition, op->child2_clv_index);
+  }
+
+  return retval;
+}
+
+/* makes the CLVs of the given nodes resident at the same time, recomputing
+   evicted CLVs as needed, and pins them until pll_clv_release() is called.
+   Does nothing for partitions without PLL_ATTRIB_LIMIT_MEMORY */
+PLL_EXPORT int pll_clv_require(pll_partition_t * partition,
+                               const unsigned int * clv_indices,
+                               unsigned int count)
+{
+  unsigned int i;
+
+  if (!partition->clv_manager)
+    return PLL_SUCCESS;
+
+  for (i = 0; i < count; ++i)
+  {
+    if (!fetch_clv(partition, clv_indices[i]))
+    {
+      pll_clv_release(partition, clv_indices, i);
+      return PLL_FAILURE;
+    }
+    pin(partition, clv_indices[i]);
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* processes the operations one by one under PLL_ATTRIB_LIMIT_MEMORY, making
+   the children resident and assigning a slot to the parent first. On failure,
+   the parents of the operations that were not processed are invalidated */
+static int update_partials_limited(pll_partition_t * partition,
+                                   const pll_operation_t * operations,
+                                   unsigned int count)
+{
+  unsigned int i;
+  unsigned int children[2];
+  const pll_operation_t * op;
+
+  for (i = 0; i < count; ++i)
+  {
+    op = &(operations[i]);
+    children[0] = op->child1_clv_index;
+    children[1] = op->child2_clv_index;
+
+    if (!pll_clv_require(partition, children, 2))
+      break;
+
+    if (!pll_clv_acquire(partition, op->parent_clv_index))
+    {
+      pll_clv_release(partition, children, 2);
+      break;
+    }
+
+    update_partials_sites(partition, op, 1);
+    pll_clv_release(partition, children, 2);
+    pll_clv_computed(partition, op);
+  }
+
+  if (i == count)
+    return PLL_SUCCESS;
+
+  for (; i < count; ++i)
+    pll_clv_invalidate(partition, operations[i].parent_clv_index);
+
+  return PLL_FAILURE;
+}
+
+/* returns PLL_FAILURE only under PLL_ATTRIB_LIMIT_MEMORY, if a CLV could not
+   be made resident */
+PLL_EXPORT int pll_update_partials(pll_partition_t * partition,
+                                   const pll_operation_t * operations,
+                                   unsigned int count)
+{
+  return pll_update_partials_rep(partition, operations, count, 1);
+}
+
+static int update_partials_rep(pll_partition_t * partition,
+                               const pll_operation_t * operations,
+                               unsigned int count,
+                               unsigned int update_repeats)
+{
+  unsigned int i;
+  const pll_operation_t * op;
+  unsigned int sites = partition->sites + partition->asc_additional_sites;
+
+  pll_gaps_operations(partition, operations, count);
+
+  if (partition->clv_manager)
+    return update_partials_limited(partition, operations, count);
+
+  if (!pll_repeats_enabled(partition))
+  {
+    update_partials_sites(partition, operations, count);
+    return PLL_SUCCESS;
+  }
+
+  /* site repeats: sequential processing */
+  for (i = 0; i < count; ++i)
+  {
+    /* operations decided by pll_adaptive_enable_repeats are timed */
+    int timed = partition->repeats->tuning &&
+                !partition->repeats->tuning->calibrated;
+    double start = timed ? pll_repeats_clock() : 0;
+
+    op = &(operations[i]);
+    if (update_repeats)
       pll_update_repeats(partition, op);
 
-    if (pll_repeats_enabled(partition)
-        && (partition->repeats->pernode_ids[op->child1_clv_index]
-            ||  partition->repeats->pernode_ids[op->child2_clv_index]))
+    if (partition->repeats->pernode_ids[op->child1_clv_index]
+        || partition->repeats->pernode_ids[op->child2_clv_index])
     {
       case_repeats(partition, op);
     }
@@ -268,25 +805,471 @@ PLL_EXPORT void pll_update_partials_rep(pll_partition_t * partition,
           (op->child2_clv_index < partition->tips))
       {
         /* tip-tip case */
-        case_tiptip(partition,op);
+        create_lookup(partition, op, partition->ttlookup);
+        case_tiptip(partition, op, 0, sites, partition->ttlookup);
       }
-      else if ((operations[i].child1_clv_index < partition->tips) ||
-               (operations[i].child2_clv_index < partition->tips))
+      else if ((op->child1_clv_index < partition->tips) ||
+               (op->child2_clv_index < partition->tips))
       {
         /* tip-inner */
-        case_tipinner(partition,op);
+        case_tipinner(partition, op, 0, sites);
       }
       else
       {
         /* inner-inner */
-        case_innerinner(partition,op);
+        case_innerinner(partition, op, 0, sites);
       }
     }
     else
     {
       /* inner-inner */
-      case_innerinner(partition,op);
+      case_innerinner(partition, op, 0, sites);
     }
+
+    if (timed)
+      pll_repeats_tuning_record(partition, op, start);
   }
+
+  return PLL_SUCCESS;
 }
 
+PLL_EXPORT int pll_update_partials_rep(pll_partition_t * partition,
+                                       const pll_operation_t * operations,
+                                       unsigned int count,
+                                       unsigned int update_repeats)
+{
+  int retval = update_partials_rep(partition, operations, count,
+                                   update_repeats);
+
+  pll_clv_tracking_operations(partition, operations, count);
+  return retval;
+}
+
+/* same as pll_update_partials, but only updates the sites
+   [site_begin, site_end) of the parent CLVs, which may include the
+   ascertainment bias sites (site_end <= sites + asc_additional_sites).
+   Disjoint ranges can be processed concurrently, except that tip-tip
+   operations of partitions with PLL_ATTRIB_PATTERN_TIP rebuild the shared
+   tip-tip lookup table */
+PLL_EXPORT int pll_update_partials_range(pll_partition_t * partition,
+                                         const pll_operation_t * operations,
+                                         unsigned int count,
+                                         unsigned int site_begin,
+                                         unsigned int site_end)
+{
+  unsigned int sites = partition->sites + partition->asc_additional_sites;
+
+  if (pll_repeats_enabled(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with site repeats.");
+    return PLL_FAILURE;
+  }
+
+  if (partition->clv_manager)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  /* the gap bitvectors of the parents are updated for all sites at once */
+  if (partition->gap_bits)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with PLL_ATTRIB_GAP_ELISION.");
+    return PLL_FAILURE;
+  }
+
+  if (site_begin > site_end || site_end > sites)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Invalid site range [%u,%u) (sites: %u).",
+             site_begin, site_end, sites);
+    return PLL_FAILURE;
+  }
+
+  update_partials_range(partition,
+                        operations,
+                        count,
+                        site_begin,
+                        site_end,
+                        partition->ttlookup,
+                        NULL,
+                        0);
+
+  return PLL_SUCCESS;
+}
+
+/* size (in doubles) of the tip-tip lookup table allocated in pll.c */
+static size_t lookup_size(const pll_partition_t * partition)
+{
+  unsigned int l2_maxstates = (unsigned int)ceil(log2(partition->maxstates));
+  size_t size = (1 << (2 * l2_maxstates)) *
+                (partition->states_padded * partition->rate_cats);
+
+  /* the dedicated 4x4 AVX kernels use a table of fixed size */
+  if (partition->states == 4 && size < 1024 * partition->rate_cats)
+    size = 1024 * partition->rate_cats;
+
+  return size;
+}
+
+/* updates all sites of the parent CLV of a single operation */
+static void update_partial(pll_partition_t * partition,
+                           const pll_operation_t * op,
+                           double * lookup)
+{
+  unsigned int sites = partition->sites + partition->asc_additional_sites;
+
+  /* tip-tip case */
+  if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+      (op->child1_clv_index < partition->tips) &&
+      (op->child2_clv_index < partition->tips))
+    create_lookup(partition, op, lookup);
+
+  update_sites(partition, op, 0, sites, lookup);
+}
+
+typedef struct levels_job_s
+{
+  pll_partition_t * partition;
+  const pll_operation_t * operations;   /* sorted by level */
+  const unsigned int * level_start;     /* first operation of each level */
+  unsigned int levels;
+  double ** lookup;                     /* per-thread tip-tip lookup tables */
+  struct pll_threadpool * pool;
+} levels_job_t;
+
+static int levels_job(void * data, unsigned int tid, unsigned int count)
+{
+  levels_job_t * job = (levels_job_t *)data;
+  pll_partition_t * partition = job->partition;
+  const pll_operation_t * ops;
+  unsigned int i, l, n;
+  unsigned int begin, end;
+
+  for (l = 0; l < job->levels; ++l)
+  {
+    ops = job->operations + job->level_start[l];
+    n = job->level_start[l+1] - job->level_start[l];
+
+    if (n < count)
+    {
+      /* too few operations to keep all threads busy, split the sites */
+      pll_threadpool_sites(partition->sites + partition->asc_additional_sites,
+                           tid,
+                           count,
+                           &begin,
+                           &end);
+      update_partials_range(partition,
+                            ops,
+                            n,
+                            begin,
+                            end,
+                            partition->ttlookup,
+                            job->pool,
+                            tid);
+    }
+    else
+    {
+      for (i = tid; i < n; i += count)
+        update_partial(partition, ops + i, job->lookup[tid]);
+    }
+
+    /* the next level reads the CLVs computed at this level */
+    if (l + 1 < job->levels)
+      pll_threadpool_barrier(job->pool);
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* sorts the operations by level, i.e. by their distance from the tips, and
+   stores the index of the first operation of each level in level_start.
+   Returns the number of levels, or 0 if the operations cannot be reordered
+   because a CLV is written more than once or read before being written */
+static unsigned int levelize(const pll_partition_t * partition,
+                             const pll_operation_t * operations,
+                             unsigned int count,
+                             pll_operation_t * sorted,
+                             unsigned int * level_start)
+{
+  unsigned int i, l;
+  unsigned int levels = 0;
+  unsigned int nodes = partition->tips + partition->clv_buffers;
+  const pll_operation_t * op;
+
+  unsigned int * level = (unsigned int *)calloc(nodes, sizeof(unsigned int));
+  char * read = (char *)calloc(nodes, sizeof(char));
+  if (!level || !read)
+  {
+    free(level);
+    free(read);
+    return 0;
+  }
+
+  /* the level of an operation is one more than the level of its children */
+  for (i = 0; i < count; ++i)
+  {
+    op = &(operations[i]);
+
+    if (level[op->parent_clv_index] || read[op->parent_clv_index])
+      break;
+
+    l = PLL_MAX(level[op->child1_clv_index], level[op->child2_clv_index]) + 1;
+    level[op->parent_clv_index] = l;
+    read[op->child1_clv_index] = read[op->child2_clv_index] = 1;
+    levels = PLL_MAX(levels, l);
+  }
+
+  if (i < count)
+    levels = 0;
+
+  if (levels)
+  {
+    /* stable counting sort; level_start[l] first counts the operations of
+       level l, then the operations up to level l, and finally, after
+       placing the operations backwards, the operations below level l */
+    memset(level_start, 0, (levels + 1) * sizeof(unsigned int));
+    for (i = 0; i < count; ++i)
+      level_start[level[operations[i].parent_clv_index]]++;
+    for (l = 1; l <= levels; ++l)
+      level_start[l] += level_start[l-1];
+    for (i = count; i > 0; --i)
+    {
+      op = &(operations[i-1]);
+      sorted[--level_start[level[op->parent_clv_index]]] = *op;
+    }
+
+    /* shift such that level_start[l] is the first operation of level l+1 */
+    for (l = 0; l < levels; ++l)
+      level_start[l] = level_start[l+1];
+    level_start[levels] = count;
+  }
+
+  free(read);
+  free(level);
+
+  return levels;
+}
+
+/* same as pll_update_partials, but operations whose children are already
+   computed are processed concurrently. Operations are grouped by their
+   distance from the tips, and the operations of each level are distributed
+   among the threads of the partition. Levels with fewer operations than
+   threads are split by sites instead. This suits trees with many taxa and
+   few sites, for which splitting the sites alone does not scale.
+   Falls back to pll_update_partials if the partition has no thread pool, uses
+   site repeats or PLL_ATTRIB_LIMIT_MEMORY, or if a CLV is written more than
+   once in the list. Returns the result of pll_update_partials in that case */
+PLL_EXPORT int pll_update_partials_levels(pll_partition_t * partition,
+                                          const pll_operation_t * operations,
+                                          unsigned int count)
+{
+  unsigned int i;
+  unsigned int levels = 0;
+  unsigned int threads;
+  int lookup_ok = 1;
+  int retval = PLL_SUCCESS;
+  levels_job_t job;
+
+  if (!partition->threadpool || pll_repeats_enabled(partition) ||
+      partition->clv_manager || count < 2)
+    return pll_update_partials(partition, operations, count);
+
+  threads = pll_threadpool_size(partition->threadpool);
+
+  unsigned int * level_start = (unsigned int *)malloc((count + 1) *
+                                                      sizeof(unsigned int));
+  pll_operation_t * sorted = (pll_operation_t *)malloc(count *
+                                                       sizeof(pll_operation_t));
+  double ** lookup = (double **)calloc(threads, sizeof(double *));
+
+  if (level_start && sorted && lookup)
+    levels = levelize(partition, operations, count, sorted, level_start);
+
+  if (levels)
+  {
+    /* tip-tip operations, which are all in the first level, need their own
+       lookup tables when processed concurrently */
+    lookup[0] = partition->ttlookup;
+    if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+        level_start[1] >= threads)
+    {
+      for (i = 1; i < threads && lookup_ok; ++i)
+      {
+        lookup[i] = (double *)pll_aligned_alloc(lookup_size(partition) *
+                                                  sizeof(double),
+                                                partition->alignment);
+        lookup_ok = lookup[i] != NULL;
+      }
+    }
+  }
+
+  if (levels && lookup_ok)
+  {
+    job.partition = partition;
+    job.operations = sorted;
+    job.level_start = level_start;
+    job.levels = levels;
+    job.lookup = lookup;
+    job.pool = partition->threadpool;
+
+    pll_gaps_operations(partition, operations, count);
+    pll_threadpool_run(partition->threadpool, levels_job, &job);
+    pll_clv_tracking_operations(partition, operations, count);
+  }
+  else
+    retval = pll_update_partials(partition, operations, count);
+
+  if (lookup)
+    for (i = 1; i < threads; ++i)
+      if (lookup[i])
+        pll_aligned_free(lookup[i]);
+  free(lookup);
+  free(sorted);
+  free(level_start);
+
+  return retval;
+}
+
+typedef struct set_partials_s
+{
+  pll_partition_set_t * set;
+  const pll_operation_t * operations;
+  unsigned int count;
+  double ** lookup;                     /* per-thread tip-tip lookup tables */
+} set_partials_t;
+
+static int set_partials_task(void * data,
+                             unsigned int tid,
+                             unsigned int task_index)
+{
+  set_partials_t * job = (set_partials_t *)data;
+  const pll_set_task_t * task = job->set->tasks + task_index;
+  pll_partition_t * partition = job->set->partitions[task->partition];
+  unsigned int end;
+
+  /* partitions with site repeats or limited CLV memory are processed whole
+     by their first task */
+  if (pll_repeats_enabled(partition) || partition->clv_manager)
+  {
+    if (!task->begin)
+      return pll_update_partials(partition, job->operations, job->count);
+    return PLL_SUCCESS;
+  }
+
+  /* the tasks cover all allocated sites, of which only the first ones are
+     computed under PLL_ATTRIB_SITE_COMPACTION */
+  end = PLL_MIN(task->end, partition->sites + partition->asc_additional_sites);
+  if (task->begin >= end)
+    return PLL_SUCCESS;
+
+  update_partials_range(partition,
+                        job->operations,
+                        job->count,
+                        task->begin,
+                        end,
+                        job->lookup ? job->lookup[tid] : partition->ttlookup,
+                        NULL,
+                        0);
+
+  return PLL_SUCCESS;
+}
+
+/* returns non-zero if the operations contain a tip-tip operation that uses
+   the lookup table of the partition */
+static int uses_lookup(const pll_partition_t * partition,
+                       const pll_operation_t * operations,
+                       unsigned int count)
+{
+  unsigned int i;
+
+  if (!(partition->attributes & PLL_ATTRIB_PATTERN_TIP))
+    return 0;
+
+  for (i = 0; i < count; ++i)
+    if ((operations[i].child1_clv_index < partition->tips) &&
+        (operations[i].child2_clv_index < partition->tips))
+      return 1;
+
+  return 0;
+}
+
+/* applies pll_update_partials to all partitions of the set. Chunks of sites
+   of different partitions, as well as of the same partition, are processed
+   concurrently; tip-tip lookup tables are therefore kept per thread */
+PLL_EXPORT int pll_partition_set_update_partials(pll_partition_set_t * set,
+                                                 const pll_operation_t * operations,
+                                                 unsigned int count)
+{
+  unsigned int i;
+  unsigned int threads = pll_partition_set_threads(set);
+  size_t size = 0;
+  size_t alignment = PLL_ALIGNMENT_CPU;
+  int retval = PLL_SUCCESS;
+  set_partials_t job;
+
+  job.set = set;
+  job.operations = operations;
+  job.count = count;
+  job.lookup = NULL;
+
+  if (threads > 1)
+  {
+    for (i = 0; i < set->count; ++i)
+      if (uses_lookup(set->partitions[i], operations, count))
+      {
+        size = PLL_MAX(size, lookup_size(set->partitions[i]));
+        alignment = PLL_MAX(alignment, set->partitions[i]->alignment);
+      }
+  }
+
+  if (size)
+  {
+    job.lookup = (double **)calloc(threads, sizeof(double *));
+    for (i = 0; i < threads && job.lookup && retval; ++i)
+    {
+      job.lookup[i] = (double *)pll_aligned_alloc(size * sizeof(double),
+                                                  alignment);
+      if (!job.lookup[i])
+        retval = PLL_FAILURE;
+    }
+    if (!job.lookup || !retval)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate memory for lookup tables.");
+      retval = PLL_FAILURE;
+    }
+  }
+
+  if (retval)
+  {
+    /* partitions processed whole propagate their gaps in
+       pll_update_partials */
+    for (i = 0; i < set->count; ++i)
+      if (!pll_repeats_enabled(set->partitions[i]) &&
+          !set->partitions[i]->clv_manager)
+        pll_gaps_operations(set->partitions[i], operations, count);
+    retval = pll_partition_set_run(set, set_partials_task, &job);
+  }
+
+  if (retval)
+    for (i = 0; i < set->count; ++i)
+      pll_clv_tracking_operations(set->partitions[i], operations, count);
+
+  if (job.lookup)
+  {
+    for (i = 0; i < threads; ++i)
+      if (job.lookup[i])
+        pll_aligned_free(job.lookup[i]);
+    free(job.lookup);
+  }
+
+  return retval;
+}
@@ -0,0 +1,353 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <pthread.h>
+#include "pll.h"
+
+/* Partitions of a partitioned analysis differ widely in the number of sites
+   and states, hence neither one thread per partition nor splitting each
+   partition among all threads balances the load. Instead, the sites of all
+   partitions are cut into chunks of similar cost, and each chunk is a task.
+   Every thread starts with a contiguous range of tasks and, once its range
+   is exhausted, steals tasks from the end of the ranges of other threads. */
+
+/* chunks start at multiples of SITE_BLOCK sites to keep the alignment of the
+   CLV, scaler and sumtable buffers (see threads.c) */
+#define SITE_BLOCK 16
+
+/* approximate number of floating point operations per task */
+#define TASK_COST 65536
+
+struct pll_task_queue
+{
+  pthread_mutex_t mutex;
+  unsigned int first;         /* initial range of tasks of the thread */
+  unsigned int last;
+  unsigned int head;          /* next task of the owner */
+  unsigned int tail;          /* one past the next task to be stolen */
+};
+
+typedef struct set_run_s
+{
+  pll_partition_set_t * set;
+  int (*task)(void * data, unsigned int tid, unsigned int task_index);
+  void * data;
+} set_run_t;
+
+static size_t site_cost(const pll_partition_t * partition)
+{
+  return (size_t)partition->states * partition->states_padded *
+         partition->rate_cats;
+}
+
+/* number of sites per task for a given partition. Small partitions form a
+   single task, large ones are split such that each thread gets at least one
+   chunk even if there is only one partition */
+static unsigned int chunk_sites(const pll_partition_t * partition,
+                                unsigned int threads)
+{
+  unsigned int sites = partition->alloc_sites +
+                       partition->asc_additional_sites;
+  size_t chunk = TASK_COST / site_cost(partition);
+
+  chunk = PLL_MIN(chunk, (sites + threads - 1) / threads);
+  chunk = (chunk + SITE_BLOCK - 1) / SITE_BLOCK * SITE_BLOCK;
+
+  return (unsigned int)PLL_MAX(chunk, SITE_BLOCK);
+}
+
+static int create_tasks(pll_partition_set_t * set, unsigned int threads)
+{
+  unsigned int i, j, k;
+  unsigned int sites, chunk;
+  size_t total = 0;
+  size_t cost = 0;
+
+  set->task_count = 0;
+  for (i = 0; i < set->count; ++i)
+  {
+    sites = set->partitions[i]->alloc_sites +
+            set->partitions[i]->asc_additional_sites;
+    chunk = chunk_sites(set->partitions[i], threads);
+    set->task_count += PLL_MAX((sites + chunk - 1) / chunk, 1);
+  }
+
+  set->tasks = (pll_set_task_t *)malloc(set->task_count *
+                                        sizeof(pll_set_task_t));
+  set->task_values = (double *)malloc(2 * set->task_count * sizeof(double));
+  if (!set->tasks || !set->task_values)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for partition set.");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0, k = 0; i < set->count; ++i)
+  {
+    sites = set->partitions[i]->alloc_sites +
+            set->partitions[i]->asc_additional_sites;
+    chunk = chunk_sites(set->partitions[i], threads);
+    j = 0;
+    do
+    {
+      set->tasks[k].partition = i;
+      set->tasks[k].begin = j;
+      set->tasks[k].end = PLL_MIN(j + chunk, sites);
+      total += (set->tasks[k].end - j) * site_cost(set->partitions[i]);
+      j += chunk;
+      ++k;
+    }
+    while (j < sites);
+  }
+
+  if (!set->queues)
+    return PLL_SUCCESS;
+
+  /* initial ranges of equal cost, such that stealing is only needed to
+     compensate for the imbalance of the last tasks */
+  for (i = 0, k = 0; i < threads; ++i)
+  {
+    set->queues[i].first = k;
+    while (k < set->task_count &&
+           (cost + (set->tasks[k].end - set->tasks[k].begin) *
+                   site_cost(set->partitions[set->tasks[k].partition]) / 2)
+             * threads < total * (i + 1))
+    {
+      cost += (set->tasks[k].end - set->tasks[k].begin) *
+              site_cost(set->partitions[set->tasks[k].partition]);
+      ++k;
+    }
+    if (i + 1 == threads)
+      k = set->task_count;
+    set->queues[i].last = k;
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* creates a set of partitions that share the same tree, i.e. the same CLV,
+   scaler and probability matrix indices. The partitions are not copied and
+   remain owned by the caller. threads is the number of threads used for
+   evaluating the set, including the calling thread. The thread pools of the
+   partitions themselves are not used by the set functions */
+PLL_EXPORT pll_partition_set_t * pll_partition_set_create(
+                                                pll_partition_t ** partitions,
+                                                unsigned int count,
+                                                unsigned int threads)
+{
+  unsigned int i;
+
+  if (!count || !threads)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Partition sets require at least one partition and one thread.");
+    return NULL;
+  }
+
+  pll_partition_set_t * set = (pll_partition_set_t *)calloc(1,
+                                                  sizeof(pll_partition_set_t));
+  if (!set)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for partition set.");
+    return NULL;
+  }
+
+  set->count = count;
+  set->partitions = (pll_partition_t **)malloc(count *
+                                               sizeof(pll_partition_t *));
+  if (!set->partitions)
+  {
+    free(set);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for partition set.");
+    return NULL;
+  }
+  memcpy(set->partitions, partitions, count * sizeof(pll_partition_t *));
+
+  if (threads > 1)
+  {
+    set->threadpool = pll_threadpool_create(threads);
+    if (!set->threadpool)
+    {
+      pll_partition_set_destroy(set);
+      return NULL;
+    }
+
+    set->queues = (struct pll_task_queue *)calloc(threads,
+                                              sizeof(struct pll_task_queue));
+    if (!set->queues)
+    {
+      pll_partition_set_destroy(set);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate memory for partition set.");
+      return NULL;
+    }
+    for (i = 0; i < threads; ++i)
+      pthread_mutex_init(&set->queues[i].mutex, NULL);
+  }
+
+  if (!create_tasks(set, threads))
+  {
+    pll_partition_set_destroy(set);
+    return NULL;
+  }
+
+  return set;
+}
+
+PLL_EXPORT void pll_partition_set_destroy(pll_partition_set_t * set)
+{
+  unsigned int i;
+
+  if (!set) return;
+
+  if (set->queues)
+  {
+    for (i = 0; i < pll_threadpool_size(set->threadpool); ++i)
+      pthread_mutex_destroy(&set->queues[i].mutex);
+    free(set->queues);
+  }
+
+  pll_threadpool_destroy(set->threadpool);
+  free(set->task_values);
+  free(set->tasks);
+  free(set->partitions);
+  free(set);
+}
+
+PLL_EXPORT unsigned int pll_partition_set_threads(
+                                            const pll_partition_set_t * set)
+{
+  return pll_threadpool_size(set->threadpool);
+}
+
+/* takes the next task of thread tid, or steals the last task of the first
+   non-empty queue of another thread. Returns 0 if no tasks are left */
+static int next_task(struct pll_task_queue * queues,
+                     unsigned int tid,
+                     unsigned int count,
+                     unsigned int * task_index)
+{
+  unsigned int i;
+  struct pll_task_queue * queue = queues + tid;
+  int found = 0;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (queue->head < queue->tail)
+  {
+    *task_index = queue->head++;
+    found = 1;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  /* tasks are never added, hence a thread that finds all queues empty is
+     done */
+  for (i = 1; i < count && !found; ++i)
+  {
+    queue = queues + (tid + i) % count;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->head < queue->tail)
+    {
+      *task_index = --queue->tail;
+      found = 1;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+  }
+
+  return found;
+}
+
+static int set_job(void * data, unsigned int tid, unsigned int count)
+{
+  set_run_t * run = (set_run_t *)data;
+  unsigned int task_index;
+  int retval = PLL_SUCCESS;
+
+  while (next_task(run->set->queues, tid, count, &task_index))
+    if (run->task(run->data, tid, task_index) == PLL_FAILURE)
+      retval = PLL_FAILURE;
+
+  return retval;
+}
+
+/* executes task(data, tid, i) for every task i of the set, where tid is the
+   index of the executing thread. The order in which tasks are executed is
+   unspecified; results that must be reproducible should be stored per task
+   (e.g. in set->task_values) and reduced in task order */
+PLL_EXPORT int pll_partition_set_run(pll_partition_set_t * set,
+                                     int (*task)(void * data,
+                                                 unsigned int tid,
+                                                 unsigned int task_index),
+                                     void * data)
+{
+  unsigned int i;
+  int retval = PLL_SUCCESS;
+  set_run_t run;
+
+  if (!set->threadpool)
+  {
+    for (i = 0; i < set->task_count; ++i)
+      if (task(data, 0, i) == PLL_FAILURE)
+        retval = PLL_FAILURE;
+    return retval;
+  }
+
+  for (i = 0; i < pll_threadpool_size(set->threadpool); ++i)
+  {
+    set->queues[i].head = set->queues[i].first;
+    set->queues[i].tail = set->queues[i].last;
+  }
+
+  run.set = set;
+  run.task = task;
+  run.data = data;
+
+  return pll_threadpool_run(set->threadpool, set_job, &run);
+}
+
+/* sums the per-task values of each partition in task order. values is
+   set->task_values or set->task_values + 1, stride is 2 */
+PLL_EXPORT double pll_partition_set_reduce(const pll_partition_set_t * set,
+                                           const double * values,
+                                           double * partition_values)
+{
+  unsigned int i, p;
+  double sum = 0;
+  double psum = 0;
+
+  for (i = 0; i < set->task_count; ++i)
+  {
+    p = set->tasks[i].partition;
+    psum += values[2*i];
+
+    if (i + 1 == set->task_count || set->tasks[i+1].partition != p)
+    {
+      if (partition_values)
+        partition_values[p] = psum;
+      sum += psum;
+      psum = 0;
+    }
+  }
+
+  return sum;
+}
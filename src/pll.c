@@ -21,10 +21,14 @@
 
 #include "pll.h"
 
+#if (!defined(__WIN32__) && !defined(__WIN64__))
+#include <sys/mman.h>
+#endif
+
 __thread int pll_errno;
 __thread char pll_errmsg[200] = {0};
 
-__thread pll_hardware_t pll_hardware = {0,0,0,0,0,0,0,0,0,0,0,0};
+__thread pll_hardware_t pll_hardware = {0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 
 static void dealloc_partition_data(pll_partition_t * partition);
 
@@ -34,9 +38,36 @@ static void dealloc_partition_data(pll_partition_t * partition)
 
   if (!partition) return;
 
+  pll_clv_tracking_destroy(partition->clv_tracking);
+  partition->clv_tracking = NULL;
+  pll_compaction_destroy(partition->compaction);
+  partition->compaction = NULL;
+  pll_pmatrix_cache_destroy(partition->pmatrix_cache);
+  partition->pmatrix_cache = NULL;
+
+  if (partition->arena)
+  {
+    /* the buffers and their pointer tables are part of the arena */
+    pll_aligned_free(partition->arena);
+    partition->clv = NULL;
+    partition->pmatrix = NULL;
+    partition->subst_params = NULL;
+    partition->scale_buffer = NULL;
+    partition->frequencies = NULL;
+    partition->eigenvecs = NULL;
+    partition->inv_eigenvecs = NULL;
+    partition->eigenvals = NULL;
+    partition->tipchars = NULL;
+  }
+
   free(partition->rates);
   free(partition->rate_weights);
   free(partition->eigen_decomp_valid);
+  free(partition->eigen_version);
+  free(partition->eigen_input);
+  free(partition->model_structure);
+  free(partition->eigen_work);
+  free(partition->eigen_rows);
   if (partition->prop_invar)
     free(partition->prop_invar);
   if (partition->invariant)
@@ -67,10 +98,14 @@ static void dealloc_partition_data(pll_partition_t * partition)
   {
     int start = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) ?
                     partition->tips : 0;
-    for (i = start; i < partition->clv_buffers + partition->tips; ++i)
+    /* inner CLVs under PLL_ATTRIB_LIMIT_MEMORY belong to the CLV manager */
+    unsigned int end = (partition->attributes & PLL_ATTRIB_LIMIT_MEMORY) ?
+                         partition->tips : partition->nodes;
+    for (i = start; i < end; ++i)
       pll_aligned_free(partition->clv[i]);
   }
   free(partition->clv);
+  pll_clv_manager_destroy(partition->clv_manager);
 
   if (partition->pmatrix)
   {
@@ -107,6 +142,8 @@ static void dealloc_partition_data(pll_partition_t * partition)
   if (partition->pattern_weights)
     free(partition->pattern_weights);
 
+  free(partition->gap_bits);
+
   if (partition->repeats) 
   {
     pll_repeats_t *repeats = partition->repeats;
@@ -125,9 +162,17 @@ static void dealloc_partition_data(pll_partition_t * partition)
     free(repeats->id_site_buffer);
     free(repeats->bclv_buffer);
     free(repeats->charmap);
+    free(repeats->hash_keys);
+    free(repeats->hash_ids);
+    pll_repeats_clear_pool(partition);
+    free(repeats->class_sites);
+    free(repeats->pool);
+    free(repeats->tuning);
     free(repeats);
   }
 
+  pll_threadpool_destroy(partition->threadpool);
+
   free(partition);
 }
 
@@ -265,8 +310,10 @@ static int update_charmap(pll_partition_t * partition, const pll_state_t * map)
 
     /* for AVX we do not need to reallocate ttlookup as it has fixed size */
     if ((partition->states == 4) &&
-        (partition->attributes & PLL_ATTRIB_ARCH_AVX) &&
-        PLL_STAT(avx_present))
+        (((partition->attributes & PLL_ATTRIB_ARCH_AVX) &&
+          PLL_STAT(avx_present)) ||
+         ((partition->attributes & PLL_ATTRIB_ARCH_AVX512) &&
+          PLL_STAT(avx512f_present))))
       return PLL_SUCCESS;
 
     free(partition->ttlookup);
@@ -300,7 +347,8 @@ static int create_charmap(pll_partition_t * partition, const pll_state_t * userm
   /* If ascertainment bias correction attribute is set, CLVs will be allocated
      with additional sites for each state */
   unsigned int sites_alloc = partition->asc_bias_alloc ?
-                   partition->sites + partition->states : partition->sites;
+                   partition->alloc_sites + partition->states :
+                   partition->alloc_sites;
 
   //memcpy(map, partition->map, PLL_ASCII_SIZE * sizeof(unsigned int));
   memcpy(map, usermap, PLL_ASCII_SIZE * sizeof(pll_state_t));
@@ -364,8 +412,10 @@ static int create_charmap(pll_partition_t * partition, const pll_state_t * userm
   /* dedicated 4x4 function  - if AVX is not used we can allocate less space
      in case not all 16 possible ambiguities are present */
   if ((partition->states == 4) &&
-      (partition->attributes & PLL_ATTRIB_ARCH_AVX) &&
-      PLL_STAT(avx_present))
+      (((partition->attributes & PLL_ATTRIB_ARCH_AVX) &&
+        PLL_STAT(avx_present)) ||
+       ((partition->attributes & PLL_ATTRIB_ARCH_AVX512) &&
+        PLL_STAT(avx512f_present))))
   {
     partition->ttlookup = pll_aligned_alloc(1024 * partition->rate_cats *
                                             sizeof(double),
@@ -391,6 +441,10 @@ static int create_charmap(pll_partition_t * partition, const pll_state_t * userm
     }
   }
 
+  /* tip character arrays of partitions with an arena are already allocated */
+  if (partition->tipchars)
+    return PLL_SUCCESS;
+
   /* allocate tip character arrays */
   partition->tipchars = (unsigned char **)calloc(partition->tips,
                                                  sizeof(unsigned char *));
@@ -418,132 +472,227 @@ static int create_charmap(pll_partition_t * partition, const pll_state_t * userm
   return PLL_SUCCESS;
 }
 
-PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
-                                                  unsigned int clv_buffers,
-                                                  unsigned int states,
-                                                  unsigned int sites,
-                                                  unsigned int rate_matrices,
-                                                  unsigned int prob_matrices,
-                                                  unsigned int rate_cats,
-                                                  unsigned int scale_buffers,
-                                                  unsigned int attributes)
+/* returns the address of size bytes at the next multiple of alignment in the
+   arena and advances offset past them. Returns NULL if arena is NULL, in which
+   case only the offsets are computed */
+static void * arena_carve(char * arena,
+                          size_t * offset,
+                          size_t size,
+                          size_t alignment)
 {
-  unsigned int i;
-  unsigned int sites_alloc;
+  void * mem;
 
-  /* make sure that multiple ARCH were not specified */
-  if (PLL_POPCNT32(attributes & PLL_ATTRIB_ARCH_MASK) > 1)
-  {
-    pll_errno = PLL_ERROR_PARAM_INVALID;
-    snprintf(pll_errmsg, 200, "Multiple architecture flags specified.");
-    return PLL_FAILURE;
-  }
- 
-  /* disable repeats if there are to few sites */
-  if (sites < 16 && (attributes & PLL_ATTRIB_SITE_REPEATS)) 
-  {
-    attributes &= ~PLL_ATTRIB_SITE_REPEATS;
-  }
+  *offset = (*offset + alignment - 1) / alignment * alignment;
+  mem = arena ? arena + *offset : NULL;
+  *offset += size;
 
+  return mem;
+}
 
-  /* allocate partition */
-  pll_partition_t * partition = (pll_partition_t *)malloc(sizeof(pll_partition_t));
-  if (!partition)
+/* places the partition buffers in the arena and returns the required arena
+   size. If arena is NULL, only the size is computed. Buffers are laid out in
+   the order they are used: the pointer tables, the model of each rate matrix,
+   the p-matrices, the tip data, and the inner CLVs, each followed by the scale
+   buffer that is usually written together with it */
+static size_t arena_layout(pll_partition_t * partition, char * arena)
+{
+  unsigned int i;
+  unsigned int states = partition->states;
+  unsigned int states_padded = partition->states_padded;
+  unsigned int rate_cats = partition->rate_cats;
+  unsigned int sites_alloc = partition->alloc_sites +
+                             partition->asc_additional_sites;
+  size_t alignment = partition->alignment;
+  size_t offset = 0;
+  size_t clv_size;
+  size_t scaler_size;
+  size_t displacement;
+  void * mem;
+
+  clv_size = (size_t)sites_alloc * states_padded * rate_cats *
+             ((partition->attributes & PLL_ATTRIB_SINGLE_PRECISION) ?
+               sizeof(float) : sizeof(double));
+  scaler_size = ((partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                  (size_t)sites_alloc * rate_cats : sites_alloc) *
+                sizeof(unsigned int);
+  displacement = (states_padded - states) * states_padded * sizeof(double);
+
+  /* pointer tables */
+  partition->clv = (double **)arena_carve(arena,
+                                          &offset,
+                                          partition->nodes * sizeof(double *),
+                                          sizeof(void *));
+  partition->pmatrix = (double **)arena_carve(arena,
+                                              &offset,
+                                              partition->prob_matrices *
+                                                sizeof(double *),
+                                              sizeof(void *));
+  partition->scale_buffer = (unsigned int **)arena_carve(arena,
+                                                         &offset,
+                                                 partition->scale_buffers *
+                                                   sizeof(unsigned int *),
+                                                         sizeof(void *));
+  partition->eigenvecs = (double **)arena_carve(arena,
+                                                &offset,
+                                                partition->rate_matrices *
+                                                  sizeof(double *),
+                                                sizeof(void *));
+  partition->inv_eigenvecs = (double **)arena_carve(arena,
+                                                    &offset,
+                                                    partition->rate_matrices *
+                                                      sizeof(double *),
+                                                    sizeof(void *));
+  partition->eigenvals = (double **)arena_carve(arena,
+                                                &offset,
+                                                partition->rate_matrices *
+                                                  sizeof(double *),
+                                                sizeof(void *));
+  partition->frequencies = (double **)arena_carve(arena,
+                                                  &offset,
+                                                  partition->rate_matrices *
+                                                    sizeof(double *),
+                                                  sizeof(void *));
+  partition->subst_params = (double **)arena_carve(arena,
+                                                   &offset,
+                                                   partition->rate_matrices *
+                                                     sizeof(double *),
+                                                   sizeof(void *));
+  if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+    partition->tipchars = (unsigned char **)arena_carve(arena,
+                                                        &offset,
+                                                        partition->tips *
+                                                      sizeof(unsigned char *),
+                                                        sizeof(void *));
+
+  /* eigen decomposition, frequencies and rates of each rate matrix */
+  for (i = 0; i < partition->rate_matrices; ++i)
   {
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg, 200, "Cannot allocate memory for partition.");
-    return PLL_FAILURE;
+    mem = arena_carve(arena,
+                      &offset,
+                      states * states_padded * sizeof(double),
+                      alignment);
+    if (arena) partition->eigenvecs[i] = (double *)mem;
+
+    mem = arena_carve(arena,
+                      &offset,
+                      states * states_padded * sizeof(double),
+                      alignment);
+    if (arena) partition->inv_eigenvecs[i] = (double *)mem;
+
+    mem = arena_carve(arena, &offset, states_padded * sizeof(double), alignment);
+    if (arena) partition->eigenvals[i] = (double *)mem;
+
+    mem = arena_carve(arena, &offset, states_padded * sizeof(double), alignment);
+    if (arena) partition->frequencies[i] = (double *)mem;
+
+    mem = arena_carve(arena,
+                      &offset,
+                      ((states * states - states) / 2) * sizeof(double),
+                      alignment);
+    if (arena) partition->subst_params[i] = (double *)mem;
   }
 
-  /* extract architecture and set vectorization parameters */
-  partition->alignment = PLL_ALIGNMENT_CPU;
-  partition->attributes = attributes;
-  partition->states_padded = states;
-#ifdef HAVE_SSE3
-  if (attributes & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+  /* p-matrices, contiguous as in alloc_buffers */
+  mem = arena_carve(arena,
+                    &offset,
+                    partition->prob_matrices * states * states_padded *
+                      rate_cats * sizeof(double) + displacement,
+                    alignment);
+  if (arena)
   {
-    partition->alignment = PLL_ALIGNMENT_SSE;
-    partition->states_padded = (states+1) & 0xFFFFFFFE;
+    partition->pmatrix[0] = (double *)mem;
+    for (i = 1; i < partition->prob_matrices; ++i)
+      partition->pmatrix[i] = partition->pmatrix[i-1] +
+                              states * states_padded * rate_cats;
   }
-#endif
-#ifdef HAVE_AVX
-  if (attributes & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+
+  /* tip characters or tip CLVs */
+  for (i = 0; i < partition->tips; ++i)
   {
-    partition->alignment = PLL_ALIGNMENT_AVX;
-    partition->states_padded = (states+3) & 0xFFFFFFFC;
+    if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+    {
+      mem = arena_carve(arena, &offset, sites_alloc, alignment);
+      if (arena) partition->tipchars[i] = (unsigned char *)mem;
+    }
+    else
+    {
+      mem = arena_carve(arena, &offset, clv_size, alignment);
+      if (arena) partition->clv[i] = (double *)mem;
+    }
   }
-#endif
-#ifdef HAVE_AVX2
-  if (attributes & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+
+  /* inner CLVs interleaved with the scale buffers */
+  for (i = 0; i < PLL_MAX(partition->clv_buffers, partition->scale_buffers); ++i)
   {
-    partition->alignment = PLL_ALIGNMENT_AVX;
-    partition->states_padded = (states+3) & 0xFFFFFFFC;
+    if (i < partition->clv_buffers)
+    {
+      mem = arena_carve(arena, &offset, clv_size, alignment);
+      if (arena) partition->clv[partition->tips + i] = (double *)mem;
+    }
+    if (i < partition->scale_buffers)
+    {
+      mem = arena_carve(arena, &offset, scaler_size, alignment);
+      if (arena) partition->scale_buffer[i] = (unsigned int *)mem;
+    }
   }
-#endif
-
-  unsigned int states_padded = partition->states_padded;
 
-  /* initialize properties */
-
-  partition->tips = tips;
-  partition->clv_buffers = clv_buffers;
-  partition->nodes = tips + clv_buffers;
-  partition->states = states;
-  partition->sites = sites;
-  partition->pattern_weight_sum = sites;
+  return offset;
+}
 
-  partition->rate_matrices = rate_matrices;
-  partition->prob_matrices = prob_matrices;
-  partition->rate_cats = rate_cats;
-  partition->scale_buffers = scale_buffers;
+/* allocates the arena of a partition and places the buffers in it. The
+   buffers are copied from the arena of source, or zeroed if source is NULL */
+static int alloc_arena(pll_partition_t * partition, const void * source)
+{
+  size_t size = arena_layout(partition, NULL);
+  size_t alignment = partition->alignment;
 
-  partition->prop_invar = NULL;
-  partition->invariant = NULL;
-  partition->pattern_weights = NULL;
+  if (partition->attributes & PLL_ATTRIB_ARENA_HUGEPAGES)
+  {
+    alignment = PLL_HUGEPAGE_SIZE;
+    size = (size + PLL_HUGEPAGE_SIZE - 1) / PLL_HUGEPAGE_SIZE *
+           PLL_HUGEPAGE_SIZE;
+  }
 
-  partition->eigenvecs = NULL;
-  partition->inv_eigenvecs = NULL;
-  partition->eigenvals = NULL;
+  partition->arena = pll_aligned_alloc(size, alignment);
+  if (!partition->arena)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for arena.");
+    return PLL_FAILURE;
+  }
+  partition->arena_size = size;
 
-  partition->rates = NULL;
-  partition->rate_weights = NULL;
-  partition->subst_params = NULL;
-  partition->scale_buffer = NULL;
-  partition->frequencies = NULL;
-  partition->eigen_decomp_valid = 0;
+#ifdef MADV_HUGEPAGE
+  /* only a hint, the arena works with regular pages as well */
+  if (partition->attributes & PLL_ATTRIB_ARENA_HUGEPAGES)
+    madvise(partition->arena, size, MADV_HUGEPAGE);
+#endif
 
-  partition->ttlookup = NULL;
-  partition->tipchars = NULL;
-  partition->charmap = NULL;
-  partition->tipmap = NULL;
-  
-  partition->repeats = NULL;
+  /* copy the buffers of source, or zero them out as in alloc_buffers */
+  if (source)
+    memcpy(partition->arena, source, size);
+  else
+    memset(partition->arena, 0, size);
+  arena_layout(partition, (char *)partition->arena);
 
-  /* If ascertainment bias correction attribute is set, CLVs will be allocated
-     with additional sites for each state */
-  partition->asc_bias_alloc =
-               (partition->attributes &
-                 (PLL_ATTRIB_AB_MASK | PLL_ATTRIB_AB_FLAG)) > 0;
-  partition->asc_additional_sites = (partition->asc_bias_alloc ? states : 0);
-  sites_alloc = partition->asc_additional_sites + sites;
+  return PLL_SUCCESS;
+}
 
-  /* allocate structures */
+/* allocates the CLVs, p-matrices, eigen decompositions, substitution
+   parameters, frequencies and scale buffers as separate blocks. On failure,
+   the buffers allocated so far are released by dealloc_partition_data */
+static int alloc_buffers(pll_partition_t * partition, unsigned int sites_alloc)
+{
+  unsigned int i;
+  unsigned int states = partition->states;
+  unsigned int states_padded = partition->states_padded;
+  unsigned int rate_cats = partition->rate_cats;
+  unsigned int attributes = partition->attributes;
 
-  /* eigen_decomp_valid */
-  partition->eigen_decomp_valid = (int *)calloc(partition->rate_matrices,
-                                                sizeof(int));
-  if (!partition->eigen_decomp_valid)
-  {
-    dealloc_partition_data(partition);
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
-    return PLL_FAILURE;
-  }
   /* clv */
   partition->clv = (double **)calloc(partition->nodes, sizeof(double *));
   if (!partition->clv)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
     return PLL_FAILURE;
@@ -557,14 +706,22 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
     int start = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) ?
                     partition->tips : 0;
 
-    for (i = start; i < partition->tips + partition->clv_buffers; ++i)
+    /* single-precision CLVs are stored as float in the same buffers */
+    size_t clv_elem_size = (partition->attributes &
+                            PLL_ATTRIB_SINGLE_PRECISION) ?
+                              sizeof(float) : sizeof(double);
+
+    /* with limited memory, inner CLVs are held by a fixed number of slots */
+    unsigned int end = (partition->attributes & PLL_ATTRIB_LIMIT_MEMORY) ?
+                         partition->tips : partition->nodes;
+
+    for (i = start; i < end; ++i)
     {
       partition->clv[i] = pll_aligned_alloc(sites_alloc * states_padded *
-                                            rate_cats * sizeof(double),
+                                            rate_cats * clv_elem_size,
                                             partition->alignment);
       if (!partition->clv[i])
       {
-        dealloc_partition_data(partition);
         pll_errno = PLL_ERROR_MEM_ALLOC;
         snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
         return PLL_FAILURE;
@@ -573,15 +730,21 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
          states with vectorized code */
       memset(partition->clv[i],
              0,
-             (size_t)sites_alloc*states_padded*rate_cats*sizeof(double));
+             (size_t)sites_alloc*states_padded*rate_cats*clv_elem_size);
     }
   }
+  if (partition->attributes & PLL_ATTRIB_LIMIT_MEMORY)
+  {
+    partition->clv_manager = pll_clv_manager_create(partition);
+    if (!partition->clv_manager)
+      return PLL_FAILURE;
+  }
+
   /* pmatrix */
   partition->pmatrix = (double **)calloc(partition->prob_matrices,
                                          sizeof(double *));
   if (!partition->pmatrix)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg, 200, "Unable to allocate enough memory for p-matrix.");
     return PLL_FAILURE;
@@ -598,7 +761,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                             partition->alignment);
   if (!partition->pmatrix[0])
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg, 200, "Unable to allocate enough memory for p-matrix.");
     return PLL_FAILURE;
@@ -618,7 +780,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                            sizeof(double *));
   if (!partition->eigenvecs)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
              200,
@@ -632,7 +793,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                 partition->alignment);
     if (!partition->eigenvecs[i])
     {
-      dealloc_partition_data(partition);
       pll_errno = PLL_ERROR_MEM_ALLOC;
       snprintf(pll_errmsg,
                200,
@@ -648,7 +808,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                sizeof(double *));
   if (!partition->inv_eigenvecs)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
              200,
@@ -662,7 +821,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                     partition->alignment);
     if (!partition->inv_eigenvecs[i])
     {
-      dealloc_partition_data(partition);
       snprintf(pll_errmsg,
                200,
                "Unable to allocate enough memory for inverse eigenvectors.");
@@ -677,7 +835,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                sizeof(double *));
   if (!partition->eigenvals)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
              200,
@@ -690,7 +847,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                 partition->alignment);
     if (!partition->eigenvals[i])
     {
-      dealloc_partition_data(partition);
       pll_errno = PLL_ERROR_MEM_ALLOC;
       snprintf(pll_errmsg,
                200,
@@ -706,7 +862,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                               sizeof(double *));
   if (!partition->subst_params)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
              200,
@@ -720,7 +875,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                    partition->alignment);
     if (!partition->subst_params[i])
     {
-      dealloc_partition_data(partition);
       pll_errno = PLL_ERROR_MEM_ALLOC;
       snprintf(pll_errmsg,
                200,
@@ -735,7 +889,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                              sizeof(double *));
   if (!partition->frequencies)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
              200,
@@ -748,7 +901,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                   partition->alignment);
     if (!partition->frequencies[i])
     {
-      dealloc_partition_data(partition);
       pll_errno = PLL_ERROR_MEM_ALLOC;
       snprintf(pll_errmsg,
                200,
@@ -761,71 +913,11 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
            states_padded*sizeof(double));
   }
 
-  /* rates */
-  partition->rates = (double *)calloc(partition->rate_cats,sizeof(double));
-  if (!partition->rates)
-  {
-    dealloc_partition_data(partition);
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg,
-             200,
-             "Unable to allocate enough memory for heterogeneity rates.");
-    return PLL_FAILURE;
-  }
-
-  /* rate weights */
-  partition->rate_weights = (double *)calloc(partition->rate_cats,sizeof(double));
-  if (partition->rate_weights)
-  {
-    /* initialize to 1/n_rates */
-    for (i = 0; i < partition->rate_cats; ++i)
-      partition->rate_weights[i] = 1.0/partition->rate_cats;
-  }
-  else
-  {
-    dealloc_partition_data(partition);
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg,
-             200,
-             "Unable to allocate enough memory for rate weights.");
-    return PLL_FAILURE;
-  }
-
-  /* proportion of invariant sites */
-  partition->prop_invar = (double *)calloc(partition->rate_matrices,
-                                             sizeof(double));
-  if (!partition->prop_invar)
-  {
-    dealloc_partition_data(partition);
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg,
-             200,
-             "Unable to allocate enough memory for invar sites proportion.");
-    return PLL_FAILURE;
-  }
-
-  /* site weights */
-  partition->pattern_weights = (unsigned int *)malloc(sites_alloc *
-                                                      sizeof(unsigned int));
-  if (!partition->pattern_weights)
-  {
-    dealloc_partition_data(partition);
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg,
-             200,
-             "Unable to allocate enough memory for site pattern weights.");
-    return PLL_FAILURE;
-  }
-  for (i = 0; i < partition->sites; ++i) partition->pattern_weights[i] = 1;
-  /* additional positions if asc_bias is set are initialized to zero */
-  for (i = sites; i < sites_alloc; ++i) partition->pattern_weights[i] = 0;
-
   /* scale_buffer */
   partition->scale_buffer = (unsigned int **)calloc(partition->scale_buffers,
                                                     sizeof(unsigned int *));
   if (!partition->scale_buffer)
   {
-    dealloc_partition_data(partition);
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
              200,
@@ -843,7 +935,6 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
                                                           sizeof(unsigned int));
       if (!partition->scale_buffer[i])
       {
-        dealloc_partition_data(partition);
         pll_errno = PLL_ERROR_MEM_ALLOC;
         snprintf(pll_errmsg,
                  200,
@@ -853,26 +944,532 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
     }
   }
 
-  if (pll_repeats_enabled(partition)) 
-  {
-    if (PLL_FAILURE == pll_repeats_initialize(partition))
-    {
-      dealloc_partition_data(partition);
-      return PLL_FAILURE;
-    }
-  }
-  return partition;
+  return PLL_SUCCESS;
 }
 
-PLL_EXPORT void pll_partition_destroy(pll_partition_t * partition)
+PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
+                                                  unsigned int clv_buffers,
+                                                  unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_matrices,
+                                                  unsigned int prob_matrices,
+                                                  unsigned int rate_cats,
+                                                  unsigned int scale_buffers,
+                                                  unsigned int attributes)
 {
-  dealloc_partition_data(partition);
-}
+  unsigned int i;
+  unsigned int sites_alloc;
 
-static int set_tipchars_4x4(pll_partition_t * partition,
-                            unsigned int tip_index,
-                            const pll_state_t * map,
-                            const char * sequence)
+  /* make sure that multiple ARCH were not specified */
+  if (PLL_POPCNT32(attributes & PLL_ATTRIB_ARCH_MASK) > 1)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Multiple architecture flags specified.");
+    return PLL_FAILURE;
+  }
+ 
+  /* single-precision CLVs are only supported for plain CLV storage */
+  if ((attributes & PLL_ATTRIB_SINGLE_PRECISION) &&
+      (attributes & (PLL_ATTRIB_PATTERN_TIP | PLL_ATTRIB_SITE_REPEATS |
+                     PLL_ATTRIB_AB_MASK | PLL_ATTRIB_AB_FLAG)))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "PLL_ATTRIB_SINGLE_PRECISION cannot be combined with tip "
+             "patterns, site repeats or ascertainment bias correction.");
+    return PLL_FAILURE;
+  }
+
+  /* single-precision CLVs only pay off with the AVX-512 kernels; the scalar
+     fallback is slower than the vectorized double-precision kernels */
+  if (attributes & PLL_ATTRIB_SINGLE_PRECISION)
+  {
+    int avx512 = 0;
+#ifdef HAVE_AVX512
+    avx512 = (attributes & PLL_ATTRIB_ARCH_AVX512) &&
+             PLL_STAT(avx512f_present);
+#endif
+    if (!avx512)
+    {
+      pll_errno = PLL_ERROR_PARAM_INVALID;
+      snprintf(pll_errmsg, 200,
+               "PLL_ATTRIB_SINGLE_PRECISION requires PLL_ATTRIB_ARCH_AVX512 "
+               "on a CPU with AVX-512F support.");
+      return PLL_FAILURE;
+    }
+  }
+
+  /* evicted CLVs are recomputed from whole operations, which site repeats
+     do not support */
+  if ((attributes & PLL_ATTRIB_LIMIT_MEMORY) &&
+      (attributes & PLL_ATTRIB_SITE_REPEATS))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "PLL_ATTRIB_LIMIT_MEMORY cannot be combined with site repeats.");
+    return PLL_FAILURE;
+  }
+
+  if (attributes & PLL_ATTRIB_ARENA_HUGEPAGES)
+    attributes |= PLL_ATTRIB_ARENA;
+
+  /* the arena has a fixed layout, whereas site repeats and limited memory
+     allocate CLVs on demand */
+  if ((attributes & PLL_ATTRIB_ARENA) &&
+      (attributes & (PLL_ATTRIB_SITE_REPEATS | PLL_ATTRIB_LIMIT_MEMORY)))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "PLL_ATTRIB_ARENA cannot be combined with site repeats or "
+             "PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  /* NUMA placement moves the CLVs of a partition, which must therefore be
+     allocated separately and for the whole lifetime of the partition */
+  if ((attributes & PLL_ATTRIB_NUMA) &&
+      (attributes & (PLL_ATTRIB_ARENA | PLL_ATTRIB_SITE_REPEATS |
+                     PLL_ATTRIB_LIMIT_MEMORY)))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "PLL_ATTRIB_NUMA cannot be combined with PLL_ATTRIB_ARENA, "
+             "site repeats or PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  /* site repeats keep per-node site classes, which would have to be rebuilt
+     for every new order of the sites */
+  if ((attributes & PLL_ATTRIB_SITE_COMPACTION) &&
+      (attributes & PLL_ATTRIB_SITE_REPEATS))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "PLL_ATTRIB_SITE_COMPACTION cannot be combined with site "
+             "repeats.");
+    return PLL_FAILURE;
+  }
+
+  /* site repeats already share the CLV entries of all-gap sites */
+  if ((attributes & PLL_ATTRIB_GAP_ELISION) &&
+      (attributes & PLL_ATTRIB_SITE_REPEATS))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "PLL_ATTRIB_GAP_ELISION cannot be combined with site repeats.");
+    return PLL_FAILURE;
+  }
+
+  /* disable repeats if there are to few sites */
+  if (sites < 16 && (attributes & PLL_ATTRIB_SITE_REPEATS)) 
+  {
+    attributes &= ~PLL_ATTRIB_SITE_REPEATS;
+  }
+
+
+  /* allocate partition */
+  pll_partition_t * partition = (pll_partition_t *)malloc(sizeof(pll_partition_t));
+  if (!partition)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for partition.");
+    return PLL_FAILURE;
+  }
+
+  /* extract architecture and set vectorization parameters */
+  partition->alignment = PLL_ALIGNMENT_CPU;
+  partition->attributes = attributes;
+  partition->states_padded = states;
+#ifdef HAVE_SSE3
+  if (attributes & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+  {
+    partition->alignment = PLL_ALIGNMENT_SSE;
+    partition->states_padded = (states+1) & 0xFFFFFFFE;
+  }
+#endif
+#ifdef HAVE_AVX
+  if (attributes & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    partition->alignment = PLL_ALIGNMENT_AVX;
+    partition->states_padded = (states+3) & 0xFFFFFFFC;
+  }
+#endif
+#ifdef HAVE_AVX2
+  if (attributes & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    partition->alignment = PLL_ALIGNMENT_AVX;
+    partition->states_padded = (states+3) & 0xFFFFFFFC;
+  }
+#endif
+#ifdef HAVE_AVX512
+  /* AVX-512 kernels use masked loads/stores for the trailing quadruple, so we
+     keep the AVX padding and only increase the alignment */
+  if (attributes & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    partition->alignment = PLL_ALIGNMENT_AVX512;
+    partition->states_padded = (states+3) & 0xFFFFFFFC;
+  }
+#endif
+
+  /* resolve the kernels once instead of at every call */
+  pll_core_select_kernels(&partition->kernels, states, attributes);
+
+  /* initialize properties */
+
+  partition->tips = tips;
+  partition->clv_buffers = clv_buffers;
+  partition->nodes = tips + clv_buffers;
+  partition->states = states;
+  partition->sites = sites;
+  partition->alloc_sites = sites;
+  partition->pattern_weight_sum = sites;
+
+  partition->rate_matrices = rate_matrices;
+  partition->prob_matrices = prob_matrices;
+  partition->rate_cats = rate_cats;
+  partition->scale_buffers = scale_buffers;
+
+  partition->prop_invar = NULL;
+  partition->invariant = NULL;
+  partition->pattern_weights = NULL;
+
+  partition->eigenvecs = NULL;
+  partition->inv_eigenvecs = NULL;
+  partition->eigenvals = NULL;
+
+  partition->rates = NULL;
+  partition->rate_weights = NULL;
+  partition->subst_params = NULL;
+  partition->scale_buffer = NULL;
+  partition->frequencies = NULL;
+  partition->eigen_decomp_valid = 0;
+  partition->eigen_version = NULL;
+  partition->eigen_input = NULL;
+  partition->model_structure = NULL;
+  partition->eigen_work = NULL;
+  partition->eigen_rows = NULL;
+
+  partition->ttlookup = NULL;
+  partition->tipchars = NULL;
+  partition->charmap = NULL;
+  partition->tipmap = NULL;
+  
+  partition->repeats = NULL;
+  partition->threadpool = NULL;
+  partition->clv_manager = NULL;
+  partition->arena = NULL;
+  partition->arena_size = 0;
+  partition->clv_tracking = NULL;
+  partition->pmatrix_cache = NULL;
+  partition->gap_bits = NULL;
+  partition->compaction = NULL;
+
+  /* If ascertainment bias correction attribute is set, CLVs will be allocated
+     with additional sites for each state */
+  partition->asc_bias_alloc =
+               (partition->attributes &
+                 (PLL_ATTRIB_AB_MASK | PLL_ATTRIB_AB_FLAG)) > 0;
+  partition->asc_additional_sites = (partition->asc_bias_alloc ? states : 0);
+  sites_alloc = partition->asc_additional_sites + sites;
+
+  /* allocate structures */
+
+  /* eigen_decomp_valid */
+  partition->eigen_decomp_valid = (int *)calloc(partition->rate_matrices,
+                                                sizeof(int));
+  if (!partition->eigen_decomp_valid)
+  {
+    dealloc_partition_data(partition);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  /* eigen versions and the parameters of the last decompositions */
+  partition->eigen_version = (unsigned long *)calloc(partition->rate_matrices,
+                                                     sizeof(unsigned long));
+  partition->eigen_input = (double *)calloc((size_t)partition->rate_matrices *
+                                              ((states*states-states)/2 +
+                                               states),
+                                            sizeof(double));
+  partition->model_structure = (unsigned int *)calloc(partition->rate_matrices,
+                                                      sizeof(unsigned int));
+  if (!partition->eigen_version || !partition->eigen_input ||
+      !partition->model_structure)
+  {
+    dealloc_partition_data(partition);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  /* CLVs, p-matrices, eigen decompositions and scale buffers */
+  if (partition->attributes & PLL_ATTRIB_ARENA)
+  {
+    if (!alloc_arena(partition, NULL))
+    {
+      dealloc_partition_data(partition);
+      return PLL_FAILURE;
+    }
+  }
+  else if (!alloc_buffers(partition, sites_alloc))
+  {
+    dealloc_partition_data(partition);
+    return PLL_FAILURE;
+  }
+
+  /* rates */
+  partition->rates = (double *)calloc(partition->rate_cats,sizeof(double));
+  if (!partition->rates)
+  {
+    dealloc_partition_data(partition);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for heterogeneity rates.");
+    return PLL_FAILURE;
+  }
+
+  /* rate weights */
+  partition->rate_weights = (double *)calloc(partition->rate_cats,sizeof(double));
+  if (partition->rate_weights)
+  {
+    /* initialize to 1/n_rates */
+    for (i = 0; i < partition->rate_cats; ++i)
+      partition->rate_weights[i] = 1.0/partition->rate_cats;
+  }
+  else
+  {
+    dealloc_partition_data(partition);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for rate weights.");
+    return PLL_FAILURE;
+  }
+
+  /* proportion of invariant sites */
+  partition->prop_invar = (double *)calloc(partition->rate_matrices,
+                                             sizeof(double));
+  if (!partition->prop_invar)
+  {
+    dealloc_partition_data(partition);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for invar sites proportion.");
+    return PLL_FAILURE;
+  }
+
+  /* site weights */
+  partition->pattern_weights = (unsigned int *)malloc(sites_alloc *
+                                                      sizeof(unsigned int));
+  if (!partition->pattern_weights)
+  {
+    dealloc_partition_data(partition);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for site pattern weights.");
+    return PLL_FAILURE;
+  }
+  for (i = 0; i < partition->sites; ++i) partition->pattern_weights[i] = 1;
+  /* additional positions if asc_bias is set are initialized to zero */
+  for (i = sites; i < sites_alloc; ++i) partition->pattern_weights[i] = 0;
+
+  if (pll_repeats_enabled(partition)) 
+  {
+    if (PLL_FAILURE == pll_repeats_initialize(partition))
+    {
+      dealloc_partition_data(partition);
+      return PLL_FAILURE;
+    }
+  }
+
+  if (attributes & PLL_ATTRIB_GAP_ELISION)
+  {
+    if (!pll_gaps_initialize(partition))
+    {
+      dealloc_partition_data(partition);
+      return PLL_FAILURE;
+    }
+  }
+
+  if (attributes & PLL_ATTRIB_SITE_COMPACTION)
+  {
+    if (!pll_compaction_initialize(partition, NULL))
+    {
+      dealloc_partition_data(partition);
+      return PLL_FAILURE;
+    }
+  }
+
+  if ((attributes & PLL_ATTRIB_THREADS) && pll_default_threads() > 1)
+  {
+    if (!pll_set_threads(partition, pll_default_threads()))
+    {
+      dealloc_partition_data(partition);
+      return PLL_FAILURE;
+    }
+  }
+  return partition;
+}
+
+PLL_EXPORT void pll_partition_destroy(pll_partition_t * partition)
+{
+  dealloc_partition_data(partition);
+}
+
+static void * clone_array(const void * src, size_t size, int * failed)
+{
+  void * dst;
+
+  if (!src) return NULL;
+
+  dst = malloc(size);
+  if (dst)
+    memcpy(dst, src, size);
+  else
+    *failed = 1;
+
+  return dst;
+}
+
+/* returns a deep copy of a partition created with PLL_ATTRIB_ARENA. All CLVs,
+   p-matrices, eigen decompositions, scale buffers and tip characters are
+   copied with a single memcpy of the arena */
+PLL_EXPORT pll_partition_t * pll_partition_clone(
+                                        const pll_partition_t * partition)
+{
+  unsigned int states = partition->states;
+  unsigned int sites_alloc = partition->alloc_sites +
+                             partition->asc_additional_sites;
+  size_t ttlookup_size;
+  int failed = 0;
+
+  if (!partition->arena)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Only partitions with PLL_ATTRIB_ARENA can be cloned.");
+    return NULL;
+  }
+
+  pll_partition_t * clone = (pll_partition_t *)malloc(sizeof(pll_partition_t));
+  if (!clone)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for partition.");
+    return NULL;
+  }
+  memcpy(clone, partition, sizeof(pll_partition_t));
+
+  clone->arena = NULL;
+  clone->clv_tracking = NULL;
+  clone->pmatrix_cache = NULL;
+  clone->compaction = NULL;
+  clone->threadpool = NULL;
+  clone->rates = clone_array(partition->rates,
+                             partition->rate_cats * sizeof(double),
+                             &failed);
+  clone->rate_weights = clone_array(partition->rate_weights,
+                                    partition->rate_cats * sizeof(double),
+                                    &failed);
+  clone->eigen_decomp_valid = clone_array(partition->eigen_decomp_valid,
+                                          partition->rate_matrices *
+                                            sizeof(int),
+                                          &failed);
+  clone->eigen_version = clone_array(partition->eigen_version,
+                                     partition->rate_matrices *
+                                       sizeof(unsigned long),
+                                     &failed);
+  clone->eigen_input = clone_array(partition->eigen_input,
+                                   (size_t)partition->rate_matrices *
+                                     ((states*states-states)/2 + states) *
+                                     sizeof(double),
+                                   &failed);
+  clone->model_structure = clone_array(partition->model_structure,
+                                       partition->rate_matrices *
+                                         sizeof(unsigned int),
+                                       &failed);
+  clone->eigen_work = NULL;
+  clone->eigen_rows = NULL;
+  clone->prop_invar = clone_array(partition->prop_invar,
+                                  partition->rate_matrices * sizeof(double),
+                                  &failed);
+  clone->invariant = clone_array(partition->invariant,
+                                 partition->alloc_sites * sizeof(int),
+                                 &failed);
+  clone->pattern_weights = clone_array(partition->pattern_weights,
+                                       sites_alloc * sizeof(unsigned int),
+                                       &failed);
+  clone->charmap = clone_array(partition->charmap,
+                               PLL_ASCII_SIZE * sizeof(unsigned char),
+                               &failed);
+  clone->tipmap = clone_array(partition->tipmap,
+                              PLL_ASCII_SIZE * sizeof(pll_state_t),
+                              &failed);
+  clone->gap_bits = clone_array(partition->gap_bits,
+                                (size_t)partition->nodes *
+                                  ((sites_alloc + 31) / 32) *
+                                  sizeof(unsigned int),
+                                &failed);
+
+  /* the tip-tip lookup is recomputed at every update, hence only its size
+     (see create_charmap) matters */
+  clone->ttlookup = NULL;
+  if (partition->ttlookup)
+  {
+    if ((partition->states == 4) &&
+        (((partition->attributes & PLL_ATTRIB_ARCH_AVX) &&
+          PLL_STAT(avx_present)) ||
+         ((partition->attributes & PLL_ATTRIB_ARCH_AVX512) &&
+          PLL_STAT(avx512f_present))))
+      ttlookup_size = 1024 * partition->rate_cats;
+    else
+      ttlookup_size = (1 << (2 * (unsigned int)ceil(log2(partition->maxstates)))) *
+                      (partition->states_padded * partition->rate_cats);
+
+    clone->ttlookup = pll_aligned_alloc(ttlookup_size * sizeof(double),
+                                        partition->alignment);
+    if (!clone->ttlookup)
+      failed = 1;
+  }
+
+  if (partition->compaction &&
+      !pll_compaction_initialize(clone, partition->compaction))
+    failed = 1;
+
+  if (failed)
+  {
+    /* the pointer tables still refer to the arena of the source partition */
+    arena_layout(clone, NULL);
+    dealloc_partition_data(clone);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for partition.");
+    return NULL;
+  }
+
+  if (!alloc_arena(clone, partition->arena))
+  {
+    dealloc_partition_data(clone);
+    return NULL;
+  }
+
+  if (partition->threadpool &&
+      !pll_set_threads(clone, pll_threadpool_size(partition->threadpool)))
+  {
+    dealloc_partition_data(clone);
+    return NULL;
+  }
+
+  return clone;
+}
+
+static int set_tipchars_4x4(pll_partition_t * partition,
+                            unsigned int tip_index,
+                            const pll_state_t * map,
+                            const char * sequence)
 {
   pll_state_t c;
   unsigned int i;
@@ -1013,13 +1610,50 @@ static int set_tipclv(pll_partition_t * partition,
     }
   }
 
+  pll_clv_tracking_tip(partition, tip_index);
   return PLL_SUCCESS;
 }
 
-PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
-                                  unsigned int tip_index,
-                                  const pll_state_t * map,
-                                  const char * sequence)
+static int set_tipclv_sp(pll_partition_t * partition,
+                         unsigned int tip_index,
+                         const pll_state_t * map,
+                         const char * sequence)
+{
+  pll_state_t c;
+  unsigned int i,j,k;
+  float * tipclv = (float *)(partition->clv[tip_index]);
+
+  /* iterate through sites */
+  for (i = 0; i < partition->sites; ++i)
+  {
+    if ((c = map[(int)sequence[i]]) == 0)
+    {
+      pll_errno = PLL_ERROR_TIPDATA_ILLEGALSTATE;
+      snprintf(pll_errmsg, 200, "Illegal state code in tip \"%c\"", sequence[i]);
+      return PLL_FAILURE;
+    }
+
+    /* decompose basecall into the encoded residues and set the appropriate
+       positions in the tip vector of each rate category */
+    for (j = 0; j < partition->rate_cats; ++j)
+    {
+      pll_state_t state = c;
+      for (k = 0; k < partition->states; ++k)
+      {
+        tipclv[k] = state & 1;
+        state >>= 1;
+      }
+      tipclv += partition->states_padded;
+    }
+  }
+
+  return PLL_SUCCESS;
+}
+
+static int set_tip_states(pll_partition_t * partition,
+                          unsigned int tip_index,
+                          const pll_state_t * map,
+                          const char * sequence)
 {
   int rc;
 
@@ -1031,7 +1665,7 @@ PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
   if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
   {
     /* create (or update) character map for tip-tip precomputations */
-    if (partition->tipchars)
+    if (partition->charmap)
     {
       update_charmap(partition,map);
     }
@@ -1049,17 +1683,46 @@ PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
     else
       rc = set_tipchars(partition, tip_index, map, sequence);
   }
+  else if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+    rc = set_tipclv_sp(partition, tip_index, map, sequence);
   else
     rc = set_tipclv(partition, tip_index, map, sequence);
 
+  if (rc == PLL_SUCCESS)
+  {
+    pll_gaps_tip(partition, tip_index, map, sequence);
+    pll_clv_tracking_tip(partition, tip_index);
+  }
+
   return rc;
 }
 
-//TODO: <DOC> We should account for padding before calling this function
-PLL_EXPORT int pll_set_tip_clv(pll_partition_t * partition,
-                               unsigned int tip_index,
-                               const double * clv,
-                               int padding)
+PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
+                                  unsigned int tip_index,
+                                  const pll_state_t * map,
+                                  const char * sequence)
+{
+  int rc;
+  unsigned int sites = partition->sites;
+
+  if (!partition->compaction)
+    return set_tip_states(partition, tip_index, map, sequence);
+
+  /* the sequence is given in the original order of the sites, hence all
+     sites are set and only this tip is moved to the stored order */
+  partition->sites = partition->alloc_sites;
+  rc = set_tip_states(partition, tip_index, map, sequence);
+  partition->sites = sites;
+  if (rc == PLL_SUCCESS)
+    pll_compaction_tip(partition, tip_index);
+
+  return rc;
+}
+
+static int set_tip_clv(pll_partition_t * partition,
+                       unsigned int tip_index,
+                       const double * clv,
+                       int padding)
 {
   unsigned int i,j,k;
 
@@ -1071,6 +1734,31 @@ PLL_EXPORT int pll_set_tip_clv(pll_partition_t * partition,
     return PLL_FAILURE;
   }
 
+  /* a tip set from its states under site repeats holds only its classes */
+  if (pll_repeats_enabled(partition) &&
+      !pll_repeats_reset_tip(partition, tip_index))
+    return PLL_FAILURE;
+
+  pll_gaps_tip_clv(partition, tip_index, clv, padding);
+
+  if (partition->attributes & PLL_ATTRIB_SINGLE_PRECISION)
+  {
+    float * tipclv_sp = (float *)(partition->clv[tip_index]);
+
+    for (i = 0; i < partition->sites; ++i)
+    {
+      for (j = 0; j < partition->rate_cats; ++j)
+      {
+        for (k = 0; k < partition->states; ++k)
+          tipclv_sp[k] = (float)clv[k];
+        tipclv_sp += partition->states_padded;
+      }
+      clv += padding ? partition->states_padded : partition->states;
+    }
+
+    return PLL_SUCCESS;
+  }
+
   double * tipclv = partition->clv[tip_index];
 
   for (i = 0; i < partition->sites; ++i)
@@ -1102,17 +1790,60 @@ PLL_EXPORT int pll_set_tip_clv(pll_partition_t * partition,
   return PLL_SUCCESS;
 }
 
+//TODO: <DOC> We should account for padding before calling this function
+PLL_EXPORT int pll_set_tip_clv(pll_partition_t * partition,
+                               unsigned int tip_index,
+                               const double * clv,
+                               int padding)
+{
+  int rc;
+  unsigned int sites = partition->sites;
+
+  if (!partition->compaction)
+    rc = set_tip_clv(partition, tip_index, clv, padding);
+  else
+  {
+    /* the CLV is given in the original order of the sites */
+    partition->sites = partition->alloc_sites;
+    rc = set_tip_clv(partition, tip_index, clv, padding);
+    partition->sites = sites;
+    if (rc == PLL_SUCCESS)
+      pll_compaction_tip(partition, tip_index);
+  }
+
+  if (rc == PLL_SUCCESS)
+    pll_clv_tracking_tip(partition, tip_index);
+
+  return rc;
+}
+
+/* under PLL_ATTRIB_SITE_COMPACTION, pattern_weights holds the weights of all
+   sites the partition was created with, and the sites are reordered such
+   that only the ones of positive weight are computed. The inner CLVs must be
+   recomputed afterwards */
 PLL_EXPORT void pll_set_pattern_weights(pll_partition_t * partition,
                                         const unsigned int * pattern_weights)
 {
   unsigned int i;
-  memcpy(partition->pattern_weights,
-         pattern_weights,
-         sizeof(unsigned int)*partition->sites);
+  unsigned int sites = partition->sites;
+
+  if (partition->compaction)
+  {
+    pll_compaction_apply(partition, pattern_weights);
+
+    /* the buffers are placed by the sites each thread computes; on failure
+       they merely stay where they are */
+    if (partition->sites != sites)
+      pll_place_threads(partition);
+  }
+  else
+    memcpy(partition->pattern_weights,
+           pattern_weights,
+           sizeof(unsigned int)*partition->sites);
 
   /* recompute the sum of weights */
   partition->pattern_weight_sum = 0;
-  for (i=0; i<partition->sites; ++i)
+  for (i=0; i<partition->alloc_sites; ++i)
     partition->pattern_weight_sum += pattern_weights[i];
 }
 
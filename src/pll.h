@@ -81,6 +81,7 @@
 #define PLL_ALIGNMENT_CPU   8
 #define PLL_ALIGNMENT_SSE  16
 #define PLL_ALIGNMENT_AVX  32
+#define PLL_ALIGNMENT_AVX512 64
 
 #define PLL_LINEALLOC 2048
 
@@ -92,6 +93,10 @@
 #define PLL_SCALE_THRESHOLD_SQRT (1.0/PLL_SCALE_FACTOR_SQRT)
 #define PLL_SCALE_BUFFER_NONE -1
 
+/* scaling constants for single-precision CLVs (FLT_MIN is 2**-126) */
+#define PLL_SCALE_FACTOR_SP 4294967296.0f  /*  2**32 (exactly)  */
+#define PLL_SCALE_THRESHOLD_SP (1.0f/PLL_SCALE_FACTOR_SP)
+
 /* in per-rate scaling mode, maximum difference between scalers
  * please see https://github.com/xflouris/libpll/issues/44  */
 #define PLL_SCALE_RATE_MAXDIFF 4
@@ -126,6 +131,68 @@
 #define PLL_ATTRIB_SITE_REPEATS    (1 << 10)
 #define PLL_REPEATS_LOOKUP_SIZE  2000000 
 
+/* single-precision CLVs (requires PLL_ATTRIB_ARCH_AVX512) */
+
+#define PLL_ATTRIB_SINGLE_PRECISION (1 << 11)
+
+/* site-parallel computation with a persistent thread pool */
+
+#define PLL_ATTRIB_THREADS         (1 << 12)
+
+/* memory saving: only a limited number of inner CLVs are kept in memory and
+   evicted CLVs are recomputed when needed. The default number of slots is
+   ceil(log2(tips)) + 4, which pll_set_clv_slots() can change. If no slot is
+   available, pll_update_partials() returns PLL_FAILURE with pll_errno set to
+   PLL_ERROR_CLV_UNAVAILABLE, and the CLVs of the operations that were not
+   computed cannot be used until they are updated again */
+
+#define PLL_ATTRIB_LIMIT_MEMORY    (1 << 13)
+
+/* all CLVs, p-matrices, eigen decompositions, scale buffers and tip
+   characters of a partition are carved from a single aligned arena.
+   PLL_ATTRIB_ARENA_HUGEPAGES additionally requests transparent huge pages
+   for the arena (where supported) and implies PLL_ATTRIB_ARENA */
+
+#define PLL_ATTRIB_ARENA           (1 << 14)
+#define PLL_ATTRIB_ARENA_HUGEPAGES (1 << 15)
+#define PLL_HUGEPAGE_SIZE          (2 << 20)
+
+/* NUMA placement: when threads are set, each thread first-touches the range
+   of sites it computes in every CLV and scale buffer */
+
+#define PLL_ATTRIB_NUMA            (1 << 16)
+
+/* gap elision: sites at which a whole subtree is undetermined are tracked
+   per node. In runs of at least PLL_GAPS_MIN_RUN sites at which both children
+   of an operation are undetermined the parent CLV is set to one, and in runs
+   at which one child is undetermined it is computed from the other child
+   only. The likelihood and the derivative functions are computed as usual */
+
+#define PLL_ATTRIB_GAP_ELISION     (1 << 17)
+#define PLL_GAPS_MIN_RUN           8
+#define PLL_GAP_BIT(bits,site)     (((bits)[(site) >> 5] >> ((site) & 31)) & 1)
+
+/* site compaction: pll_set_pattern_weights stores the sites of positive
+   weight first and the kernels only process these */
+
+#define PLL_ATTRIB_SITE_COMPACTION (1 << 18)
+
+/* closed-form p-matrices for the 4-state models with HKY structure (see
+   PLL_MODEL_STRUCTURE_*). They agree with the eigen decomposition only up to
+   rounding, hence they are used only if requested */
+
+#define PLL_ATTRIB_CLOSED_PMATRIX  (1 << 19)
+
+/* structure of the rate matrices, detected by pll_update_eigen. The 4-state
+   models with a single transition and a single transversion rate, whose
+   frequencies sum to 1, have closed-form p-matrices */
+
+#define PLL_MODEL_STRUCTURE_GENERIC      0
+#define PLL_MODEL_STRUCTURE_JC69         1
+#define PLL_MODEL_STRUCTURE_K80          2
+#define PLL_MODEL_STRUCTURE_F81          3
+#define PLL_MODEL_STRUCTURE_HKY          4
+
 /* topological rearrangements */
 
 #define PLL_UTREE_MOVE_SPR                  1
@@ -173,6 +240,8 @@
 #define PLL_ERROR_MSA_EMPTY                131
 #define PLL_ERROR_MSA_MAP_INVALID          132
 #define PLL_ERROR_TREE_INVALID             133
+#define PLL_ERROR_THREAD_CREATE            134
+#define PLL_ERROR_CLV_UNAVAILABLE          135
 
 /* utree specific */
 
@@ -216,11 +285,265 @@ typedef struct pll_hardware_s
   int popcnt_present;
   int avx_present;
   int avx2_present;
+  int avx512f_present;
+  int avx512dq_present;
 
   /* TODO: add chip,core,mem info */
 } pll_hardware_t;
 
+/* kernel set of a partition, resolved once by pll_partition_create() from the
+   number of states and the architecture / precision attributes. The entries
+   have the same signatures as the corresponding pll_core_* functions */
+typedef struct pll_kernels
+{
+  void (*create_lookup)(unsigned int states,
+                        unsigned int rate_cats,
+                        double * lookup,
+                        const double * left_matrix,
+                        const double * right_matrix,
+                        const pll_state_t * tipmap,
+                        unsigned int tipmap_size,
+                        unsigned int attrib);
+
+  void (*update_partial_tt)(unsigned int states,
+                            unsigned int sites,
+                            unsigned int rate_cats,
+                            double * parent_clv,
+                            unsigned int * parent_scaler,
+                            const unsigned char * left_tipchars,
+                            const unsigned char * right_tipchars,
+                            const pll_state_t * tipmap,
+                            unsigned int tipmap_size,
+                            const double * lookup,
+                            unsigned int attrib);
+
+  void (*update_partial_ti)(unsigned int states,
+                            unsigned int sites,
+                            unsigned int rate_cats,
+                            double * parent_clv,
+                            unsigned int * parent_scaler,
+                            const unsigned char * left_tipchars,
+                            const double * right_clv,
+                            const double * left_matrix,
+                            const double * right_matrix,
+                            const unsigned int * right_scaler,
+                            const pll_state_t * tipmap,
+                            unsigned int tipmap_size,
+                            unsigned int attrib);
+
+  void (*update_partial_ii)(unsigned int states,
+                            unsigned int sites,
+                            unsigned int rate_cats,
+                            double * parent_clv,
+                            unsigned int * parent_scaler,
+                            const double * left_clv,
+                            const double * right_clv,
+                            const double * left_matrix,
+                            const double * right_matrix,
+                            const unsigned int * left_scaler,
+                            const unsigned int * right_scaler,
+                            unsigned int attrib);
+
+  void (*update_partial_single)(unsigned int states,
+                                unsigned int sites,
+                                unsigned int rate_cats,
+                                double * parent_clv,
+                                unsigned int * parent_scaler,
+                                const double * child_clv,
+                                const double * child_matrix,
+                                const unsigned int * child_scaler,
+                                unsigned int attrib);
+
+  void (*update_partial_repeats)(unsigned int states,
+                                 unsigned int parent_sites,
+                                 unsigned int left_sites,
+                                 unsigned int right_sites,
+                                 unsigned int rate_cats,
+                                 double * parent_clv,
+                                 unsigned int * parent_scaler,
+                                 const double * left_clv,
+                                 const double * right_clv,
+                                 const double * left_matrix,
+                                 const double * right_matrix,
+                                 const unsigned int * left_scaler,
+                                 const unsigned int * right_scaler,
+                                 const unsigned int * parent_id_site,
+                                 const unsigned int * left_site_id,
+                                 const unsigned int * right_site_id,
+                                 double * bclv_buffer,
+                                 unsigned int attrib);
+
+  double (*root_loglikelihood)(unsigned int states,
+                               unsigned int sites,
+                               unsigned int rate_cats,
+                               const double * clv,
+                               const unsigned int * scaler,
+                               double * const * frequencies,
+                               const double * rate_weights,
+                               const unsigned int * pattern_weights,
+                               const double * invar_proportion,
+                               const int * invar_indices,
+                               const unsigned int * freqs_indices,
+                               double * persite_lnl,
+                               unsigned int attrib);
+
+  double (*root_loglikelihood_repeats)(unsigned int states,
+                                       unsigned int sites,
+                                       unsigned int rate_cats,
+                                       const double * clv,
+                                       const unsigned int * site_id,
+                                       const unsigned int * scaler,
+                                       double * const * frequencies,
+                                       const double * rate_weights,
+                                       const unsigned int * pattern_weights,
+                                       const double * invar_proportion,
+                                       const int * invar_indices,
+                                       const unsigned int * freqs_indices,
+                                       double * persite_lnl,
+                                       unsigned int attrib);
+
+  double (*edge_loglikelihood_ti)(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  const double * parent_clv,
+                                  const unsigned int * parent_scaler,
+                                  const unsigned char * tipchars,
+                                  const pll_state_t * tipmap,
+                                  unsigned int tipmap_size,
+                                  const double * pmatrix,
+                                  double * const * frequencies,
+                                  const double * rate_weights,
+                                  const unsigned int * pattern_weights,
+                                  const double * invar_proportion,
+                                  const int * invar_indices,
+                                  const unsigned int * freqs_indices,
+                                  double * persite_lnl,
+                                  unsigned int attrib);
+
+  double (*edge_loglikelihood_ii)(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  const double * parent_clv,
+                                  const unsigned int * parent_scaler,
+                                  const double * child_clv,
+                                  const unsigned int * child_scaler,
+                                  const double * pmatrix,
+                                  double * const * frequencies,
+                                  const double * rate_weights,
+                                  const unsigned int * pattern_weights,
+                                  const double * invar_proportion,
+                                  const int * invar_indices,
+                                  const unsigned int * freqs_indices,
+                                  double * persite_lnl,
+                                  unsigned int attrib);
+
+  double (*edge_loglikelihood_repeats)(unsigned int states,
+                                       unsigned int sites,
+                                       unsigned int child_sites,
+                                       unsigned int rate_cats,
+                                       const double * parent_clv,
+                                       const unsigned int * parent_scaler,
+                                       const double * child_clv,
+                                       const unsigned int * child_scaler,
+                                       const double * pmatrix,
+                                       double ** frequencies,
+                                       const double * rate_weights,
+                                       const unsigned int * pattern_weights,
+                                       const double * invar_proportion,
+                                       const int * invar_indices,
+                                       const unsigned int * freqs_indices,
+                                       double * persite_lnl,
+                                       const unsigned int * parent_site_id,
+                                       const unsigned int * child_site_id,
+                                       double * bclv,
+                                       unsigned int attrib);
+
+  int (*update_sumtable_ti)(unsigned int states,
+                            unsigned int sites,
+                            unsigned int rate_cats,
+                            const double * parent_clv,
+                            const unsigned char * left_tipchars,
+                            const unsigned int * parent_scaler,
+                            double * const * eigenvecs,
+                            double * const * inv_eigenvecs,
+                            double * const * freqs,
+                            const pll_state_t * tipmap,
+                            unsigned int tipmap_size,
+                            double * sumtable,
+                            unsigned int attrib);
+
+  int (*update_sumtable_ii)(unsigned int states,
+                            unsigned int sites,
+                            unsigned int rate_cats,
+                            const double * parent_clv,
+                            const double * child_clv,
+                            const unsigned int * parent_scaler,
+                            const unsigned int * child_scaler,
+                            double * const * eigenvecs,
+                            double * const * inv_eigenvecs,
+                            double * const * freqs,
+                            double * sumtable,
+                            unsigned int attrib);
+
+  int (*update_sumtable_repeats)(unsigned int states,
+                                 unsigned int sites,
+                                 unsigned int parent_sites,
+                                 unsigned int rate_cats,
+                                 const double * clvp,
+                                 const double * clvc,
+                                 const unsigned int * parent_scaler,
+                                 const unsigned int * child_scaler,
+                                 double * const * eigenvecs,
+                                 double * const * inv_eigenvecs,
+                                 double * const * freqs,
+                                 double * sumtable,
+                                 const unsigned int * parent_site_id,
+                                 const unsigned int * child_site_id,
+                                 double * bclv_buffer,
+                                 unsigned int inv,
+                                 unsigned int attrib);
+
+  int (*likelihood_derivatives)(unsigned int states,
+                                unsigned int sites,
+                                unsigned int rate_cats,
+                                const double * rate_weights,
+                                const unsigned int * parent_scaler,
+                                const unsigned int * child_scaler,
+                                unsigned int parent_ids,
+                                unsigned int child_ids,
+                                const int * invariant,
+                                const unsigned int * pattern_weights,
+                                double branch_length,
+                                const double * prop_invar,
+                                double * const * freqs,
+                                const double * rates,
+                                double * const * eigenvals,
+                                const double * sumtable,
+                                double * d_f,
+                                double * dd_f,
+                                unsigned int attrib);
+
+  int (*update_pmatrix)(double ** pmatrix,
+                        unsigned int states,
+                        unsigned int rate_cats,
+                        const double * rates,
+                        const double * branch_lengths,
+                        const unsigned int * matrix_indices,
+                        const unsigned int * params_indices,
+                        const double * prop_invar,
+                        double * const * eigenvals,
+                        double * const * eigenvecs,
+                        double * const * inv_eigenvecs,
+                        unsigned int count,
+                        unsigned int attrib);
+} pll_kernels_t;
+
 struct pll_repeats;
+struct pll_threadpool;
+struct pll_clv_manager;
+struct pll_clv_tracking;
+struct pll_compaction;
+struct pll_pmatrix_cache;
 
 typedef struct pll_partition
 {
@@ -269,8 +592,68 @@ typedef struct pll_partition
 
   /* site repeats */
   struct pll_repeats *repeats;
+
+  /* kernels selected for this partition */
+  pll_kernels_t kernels;
+
+  /* worker threads for site-parallel computation (NULL if serial) */
+  struct pll_threadpool * threadpool;
+
+  /* CLV slots for PLL_ATTRIB_LIMIT_MEMORY (NULL otherwise) */
+  struct pll_clv_manager * clv_manager;
+
+  /* single allocation holding the partition buffers under PLL_ATTRIB_ARENA
+     (NULL otherwise) */
+  void * arena;
+  size_t arena_size;
+
+  /* provenance of the CLVs, allocated by pll_utree_update_partials_lazy */
+  struct pll_clv_tracking * clv_tracking;
+
+  /* p-matrix cache, enabled by pll_set_pmatrix_cache (NULL otherwise) */
+  struct pll_pmatrix_cache * pmatrix_cache;
+
+  /* all-gap bitvectors of the nodes under PLL_ATTRIB_GAP_ELISION (NULL
+     otherwise), see pll_get_gap_bitvector */
+  unsigned int * gap_bits;
+
+  /* number of sites the buffers are allocated for (excluding the
+     ascertainment bias sites), which is larger than sites if sites of zero
+     weight are skipped under PLL_ATTRIB_SITE_COMPACTION */
+  unsigned int alloc_sites;
+  struct pll_compaction * compaction;
+
+  /* version of the eigen decomposition of each rate matrix, incremented by
+     pll_update_eigen whenever the decomposition changes, and the
+     substitution parameters and frequencies it was computed from */
+  unsigned long * eigen_version;
+  double * eigen_input;
+
+  /* structure of each rate matrix (PLL_MODEL_STRUCTURE_*) */
+  unsigned int * model_structure;
+
+  /* work space of pll_update_eigen, allocated at its first call */
+  double * eigen_work;
+  double ** eigen_rows;
 } pll_partition_t;
 
+/* state of pll_adaptive_enable_repeats. The fastest per-site time of
+   operations is kept per range of the ratio of child classes to sites,
+   separately for nodes computed with and without repeats */
+
+#define PLL_REPEATS_TUNING_BINS 10
+
+typedef struct pll_repeats_tuning
+{
+  int choice[PLL_REPEATS_TUNING_BINS];  /* 0 undecided, 1 without, 2 with */
+  int calibrated;                /* no more operations are timed */
+  int decided;                   /* the last operation was decided by us */
+  unsigned int decisions;
+  unsigned int explored[PLL_REPEATS_TUNING_BINS];
+  unsigned int samples[2][PLL_REPEATS_TUNING_BINS];  /* without/with repeats */
+  double time[2][PLL_REPEATS_TUNING_BINS];
+} pll_repeats_tuning_t;
+
 typedef struct pll_repeats
 {
   /* (node,site) -> class identifier (starts at 1) */
@@ -302,8 +685,58 @@ typedef struct pll_repeats
   double * bclv_buffer;
   unsigned int lookup_buffer_size;
   char * charmap;
+
+  /* open-addressing table of the (left,right) class pairs of a node. Used
+     instead of lookup_buffer unless that was allocated by
+     pll_resize_repeats_lookup and is large enough. Only the slots listed in
+     toclean_buffer are cleared */
+  unsigned long long * hash_keys;
+  unsigned int * hash_ids;
+  unsigned int hash_mask;        /* number of slots - 1 */
+
+  /* memory budget of the CLVs of inner nodes in bytes, 0 if unlimited, see
+     pll_repeats_set_budget. CLVs are then allocated in size classes, and
+     released CLVs are kept in a free list per class */
+  size_t budget;
+  size_t clv_bytes;              /* CLVs held, in use or pooled */
+  size_t pool_bytes;             /* CLVs pooled */
+  unsigned int (*unbudgeted_enable_repeats)(struct pll_partition *partition,
+                                            unsigned int left_clv,
+                                            unsigned int right_clv);
+  unsigned int class_count;
+  unsigned int * class_sites;    /* sites of each class, decreasing */
+  double ** pool;
+
+  /* set by pll_repeats_enable_adaptive */
+  pll_repeats_tuning_t * tuning;
 } pll_repeats_t;
 
+/* set of partitions sharing one tree, evaluated in a single call */
+
+typedef struct pll_set_task
+{
+  unsigned int partition;
+  unsigned int begin;
+  unsigned int end;
+} pll_set_task_t;
+
+struct pll_task_queue;
+
+typedef struct pll_partition_set
+{
+  unsigned int count;
+  pll_partition_t ** partitions;
+
+  /* chunks of sites of all partitions, ordered by partition and site */
+  unsigned int task_count;
+  pll_set_task_t * tasks;
+  double * task_values;            /* two results per task */
+
+  /* worker threads and their work-stealing queues (NULL if serial) */
+  struct pll_threadpool * threadpool;
+  struct pll_task_queue * queues;
+} pll_partition_set_t;
+
 /* Structure for driving likelihood operations */
 
 typedef struct pll_operation
@@ -318,6 +751,97 @@ typedef struct pll_operation
   int child2_scaler_index;
 } pll_operation_t;
 
+/* inner CLVs kept in memory under PLL_ATTRIB_LIMIT_MEMORY. partition->clv[i]
+   points to the slot holding the CLV of node i, or is NULL if the CLV was
+   evicted. An evicted CLV is recomputed from the operation that last
+   computed it, provided the CLVs of its children were not overwritten since */
+
+#define PLL_CLV_SLOT_NONE ((unsigned int)-1)
+
+typedef struct pll_clv_manager
+{
+  unsigned int slots;
+  double ** slot_clv;                /* CLV buffer of each slot */
+  unsigned int * slot_node;          /* node held by each slot */
+
+  /* per node */
+  unsigned int * node_slot;          /* slot holding the CLV of the node */
+  unsigned int * pins;               /* > 0 if the CLV may not be evicted */
+  unsigned long * last_use;
+  unsigned int * cost;               /* operations to recompute the subtree */
+  unsigned int * version;            /* incremented when the CLV changes */
+  pll_operation_t * producer;        /* operation that computed the CLV */
+  unsigned int * producer_version;   /* versions of the children at that time */
+  char * has_producer;
+
+  unsigned long clock;
+  unsigned int * stack;              /* recomputation work space */
+  char * stack_pins;
+} pll_clv_manager_t;
+
+/* record of the operations that produced the CLVs of a partition, used by
+   pll_utree_update_partials_lazy to recompute only stale CLVs. Times are
+   taken from a per-partition clock; 0 stands for an unknown content */
+
+typedef struct pll_clv_tracking
+{
+  unsigned long clock;
+  pll_operation_t * op;              /* last operation writing each CLV */
+  unsigned long * clv_time;          /* time of that operation */
+  unsigned long * scaler_time;       /* last update of each scale buffer */
+  unsigned long * pmatrix_time;      /* last update of each p-matrix */
+} pll_clv_tracking_t;
+
+/* order of the stored sites under PLL_ATTRIB_SITE_COMPACTION */
+
+typedef struct pll_compaction
+{
+  unsigned int * site_order;         /* original index of each stored site */
+  unsigned int * site_slot;          /* stored index of each original site */
+  unsigned int * order;              /* new order being applied */
+  unsigned int * weights;            /* weights in the original order */
+  unsigned int * source;             /* source position of each stored site */
+  void * buffer;                     /* permutation work space */
+} pll_compaction_t;
+
+/* cache of p-matrices, see pll_set_pmatrix_cache(). The cached p-matrices
+   are invalidated by pll_set_category_rates(),
+   pll_update_invariant_sites_proportion() and changes of the eigen
+   decomposition. Callers that write partition->rates or
+   partition->prop_invar directly must call pll_pmatrix_cache_invalidate(),
+   or stale p-matrices are returned */
+
+typedef struct pll_pmatrix_cache
+{
+  unsigned int entries;
+  size_t matrix_size;                /* doubles per p-matrix */
+  unsigned long stamp;               /* current model version */
+  unsigned long * entry_stamp;       /* model version of each entry, 0 = none */
+  double * branch_length;
+  unsigned int * params_indices;     /* rate_cats indices per entry */
+  double * pmatrix;
+
+  unsigned long hits;
+  unsigned long misses;
+
+  /* work space of pll_update_prob_matrices */
+  unsigned int miss_capacity;
+  unsigned int * miss_matrix;
+  double * miss_length;
+  unsigned long lookups;
+  unsigned long * pending;           /* lookup in which a matrix index missed */
+} pll_pmatrix_cache_t;
+
+/* persistent buffers of pll_optimize_branch_lengths and
+   pll_utree_compute_gradient, one sumtable per partition */
+
+typedef struct pll_optimize_workspace
+{
+  unsigned int partition_count;
+  size_t * sumtable_size;            /* doubles allocated per sumtable */
+  double ** sumtable;
+} pll_optimize_workspace_t;
+
 /* Doubly-linked list */
 
 typedef struct pll_dlist
@@ -606,6 +1130,9 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
 
 PLL_EXPORT void pll_partition_destroy(pll_partition_t * partition);
 
+PLL_EXPORT pll_partition_t * pll_partition_clone(
+                                        const pll_partition_t * partition);
+
 PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
                                   unsigned int tip_index,
                                   const pll_state_t * map,
@@ -670,8 +1197,37 @@ PLL_EXPORT void pll_default_reallocate_repeats(pll_partition_t * partition,
                               int scaler_index,
                               unsigned int sites_to_alloc);
 
+PLL_EXPORT unsigned int pll_budget_enable_repeats(pll_partition_t * partition,
+                                                  unsigned int left_clv,
+                                                  unsigned int right_clv);
+
+PLL_EXPORT void pll_budget_reallocate_repeats(pll_partition_t * partition,
+                                              unsigned int parent,
+                                              int scaler_index,
+                                              unsigned int sites_to_alloc);
+
+PLL_EXPORT int pll_repeats_set_budget(pll_partition_t * partition,
+                                      size_t budget);
+
+PLL_EXPORT void pll_repeats_clear_pool(pll_partition_t * partition);
+
+PLL_EXPORT unsigned int pll_adaptive_enable_repeats(pll_partition_t * partition,
+                                                    unsigned int left_clv,
+                                                    unsigned int right_clv);
+
+PLL_EXPORT int pll_repeats_enable_adaptive(pll_partition_t * partition);
+
+PLL_EXPORT double pll_repeats_clock(void);
+
+PLL_EXPORT void pll_repeats_tuning_record(pll_partition_t * partition,
+                                          const pll_operation_t * op,
+                                          double start);
+
 PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition);
 
+PLL_EXPORT int pll_repeats_reset_tip(pll_partition_t * partition,
+                                     unsigned int tip_index);
+
 PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
                                   unsigned int tip_index,
                                   const pll_state_t * map,
@@ -718,6 +1274,9 @@ PLL_EXPORT void pll_set_category_weights(pll_partition_t * partition,
 PLL_EXPORT int pll_update_eigen(pll_partition_t * partition,
                                 unsigned int params_index);
 
+PLL_EXPORT unsigned long pll_get_eigen_version(const pll_partition_t * partition,
+                                               unsigned int params_index);
+
 PLL_EXPORT int pll_update_prob_matrices(pll_partition_t * partition,
                                         const unsigned int * params_index,
                                         const unsigned int * matrix_indices,
@@ -754,16 +1313,70 @@ PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
                                                  const unsigned int * freqs_indices,
                                                  double * persite_lnl);
 
+PLL_EXPORT double pll_compute_root_loglikelihood_range(pll_partition_t * partition,
+                                                       unsigned int clv_index,
+                                                       int scaler_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int site_begin,
+                                                       unsigned int site_end);
+
+PLL_EXPORT double pll_compute_edge_loglikelihood_range(pll_partition_t * partition,
+                                                       unsigned int parent_clv_index,
+                                                       int parent_scaler_index,
+                                                       unsigned int child_clv_index,
+                                                       int child_scaler_index,
+                                                       unsigned int matrix_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int site_begin,
+                                                       unsigned int site_end);
+
+PLL_EXPORT double pll_partition_set_compute_root_loglikelihood(
+                                      pll_partition_set_t * set,
+                                      unsigned int clv_index,
+                                      int scaler_index,
+                                      unsigned int * const * freqs_indices,
+                                      double * partition_lnl);
+
+PLL_EXPORT double pll_partition_set_compute_edge_loglikelihood(
+                                      pll_partition_set_t * set,
+                                      unsigned int parent_clv_index,
+                                      int parent_scaler_index,
+                                      unsigned int child_clv_index,
+                                      int child_scaler_index,
+                                      unsigned int matrix_index,
+                                      unsigned int * const * freqs_indices,
+                                      double * partition_lnl);
+
 /* functions in partials.c */
 
-PLL_EXPORT void pll_update_partials(pll_partition_t * partition,
-                                    const pll_operation_t * operations,
-                                    unsigned int count);
+PLL_EXPORT int pll_update_partials(pll_partition_t * partition,
+                                   const pll_operation_t * operations,
+                                   unsigned int count);
 
-PLL_EXPORT void pll_update_partials_rep(pll_partition_t * partition,
-                                        const pll_operation_t * operations,
-                                        unsigned int count,
-                                        unsigned int update_repeats);
+PLL_EXPORT int pll_update_partials_range(pll_partition_t * partition,
+                                         const pll_operation_t * operations,
+                                         unsigned int count,
+                                         unsigned int site_begin,
+                                         unsigned int site_end);
+
+PLL_EXPORT int pll_update_partials_levels(pll_partition_t * partition,
+                                          const pll_operation_t * operations,
+                                          unsigned int count);
+
+PLL_EXPORT int pll_partition_set_update_partials(pll_partition_set_t * set,
+                                                 const pll_operation_t * operations,
+                                                 unsigned int count);
+
+PLL_EXPORT int pll_clv_require(pll_partition_t * partition,
+                               const unsigned int * clv_indices,
+                               unsigned int count);
+
+PLL_EXPORT int pll_update_partials_rep(pll_partition_t * partition,
+                                       const pll_operation_t * operations,
+                                       unsigned int count,
+                                       unsigned int update_repeats);
 
 /* functions in derivatives.c */
 
@@ -784,6 +1397,260 @@ PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
                                                   double * d_f,
                                                   double * dd_f);
 
+PLL_EXPORT int pll_update_sumtable_range(pll_partition_t * partition,
+                                         unsigned int parent_clv_index,
+                                         unsigned int child_clv_index,
+                                         int parent_scaler_index,
+                                         int child_scaler_index,
+                                         const unsigned int * params_indices,
+                                         double * sumtable,
+                                         unsigned int site_begin,
+                                         unsigned int site_end);
+
+PLL_EXPORT int pll_compute_likelihood_derivatives_range(pll_partition_t * partition,
+                                                        int parent_scaler_index,
+                                                        int child_scaler_index,
+                                                        double branch_length,
+                                                        const unsigned int * params_indices,
+                                                        const double * sumtable,
+                                                        double * d_f,
+                                                        double * dd_f,
+                                                        unsigned int site_begin,
+                                                        unsigned int site_end);
+
+PLL_EXPORT int pll_compute_likelihood_derivatives_multi(pll_partition_t * partition,
+                                                        unsigned int parent_clv_index,
+                                                        unsigned int child_clv_index,
+                                                        int parent_scaler_index,
+                                                        int child_scaler_index,
+                                                        unsigned int count,
+                                                        const double * branch_lengths,
+                                                        const unsigned int * params_indices,
+                                                        const double * sumtable,
+                                                        double * logl,
+                                                        double * d_f,
+                                                        double * dd_f);
+
+PLL_EXPORT int pll_partition_set_update_sumtable(pll_partition_set_t * set,
+                                                 unsigned int parent_clv_index,
+                                                 unsigned int child_clv_index,
+                                                 int parent_scaler_index,
+                                                 int child_scaler_index,
+                                                 unsigned int * const * params_indices,
+                                                 double * const * sumtables);
+
+PLL_EXPORT int pll_partition_set_compute_likelihood_derivatives(
+                                        pll_partition_set_t * set,
+                                        int parent_scaler_index,
+                                        int child_scaler_index,
+                                        double branch_length,
+                                        unsigned int * const * params_indices,
+                                        double * const * sumtables,
+                                        double * d_f,
+                                        double * dd_f,
+                                        double * partition_d_f,
+                                        double * partition_dd_f);
+
+/* functions in threads.c */
+
+PLL_EXPORT struct pll_threadpool * pll_threadpool_create(unsigned int count);
+
+PLL_EXPORT void pll_threadpool_destroy(struct pll_threadpool * pool);
+
+PLL_EXPORT unsigned int pll_threadpool_size(const struct pll_threadpool * pool);
+
+PLL_EXPORT int pll_threadpool_run(struct pll_threadpool * pool,
+                                  int (*job)(void * data,
+                                             unsigned int tid,
+                                             unsigned int count),
+                                  void * data);
+
+PLL_EXPORT void pll_threadpool_barrier(struct pll_threadpool * pool);
+
+PLL_EXPORT void pll_threadpool_sites(unsigned int sites,
+                                     unsigned int tid,
+                                     unsigned int count,
+                                     unsigned int * begin,
+                                     unsigned int * end);
+
+PLL_EXPORT int pll_set_threads(pll_partition_t * partition,
+                               unsigned int count);
+
+PLL_EXPORT int pll_place_threads(pll_partition_t * partition);
+
+PLL_EXPORT unsigned int pll_get_threads(const pll_partition_t * partition);
+
+PLL_EXPORT void pll_get_thread_sites(const pll_partition_t * partition,
+                                     unsigned int tid,
+                                     unsigned int * begin,
+                                     unsigned int * end);
+
+PLL_EXPORT unsigned int pll_default_threads(void);
+
+/* functions in clv_manager.c */
+
+PLL_EXPORT pll_clv_manager_t * pll_clv_manager_create(
+                                           const pll_partition_t * partition);
+
+PLL_EXPORT void pll_clv_manager_destroy(pll_clv_manager_t * manager);
+
+PLL_EXPORT int pll_clv_acquire(pll_partition_t * partition,
+                               unsigned int clv_index);
+
+PLL_EXPORT void pll_clv_computed(pll_partition_t * partition,
+                                 const pll_operation_t * op);
+
+PLL_EXPORT void pll_clv_invalidate(pll_partition_t * partition,
+                                   unsigned int clv_index);
+
+PLL_EXPORT void pll_clv_release(pll_partition_t * partition,
+                                const unsigned int * clv_indices,
+                                unsigned int count);
+
+PLL_EXPORT int pll_set_clv_slots(pll_partition_t * partition,
+                                 unsigned int slots);
+
+PLL_EXPORT unsigned int pll_get_clv_slots(const pll_partition_t * partition);
+
+/* functions in compaction.c */
+
+PLL_EXPORT int pll_compaction_initialize(pll_partition_t * partition,
+                                         const pll_compaction_t * source);
+
+PLL_EXPORT void pll_compaction_destroy(pll_compaction_t * compaction);
+
+PLL_EXPORT void pll_compaction_apply(pll_partition_t * partition,
+                                     const unsigned int * pattern_weights);
+
+PLL_EXPORT void pll_compaction_tip(pll_partition_t * partition,
+                                   unsigned int tip_index);
+
+PLL_EXPORT void pll_compaction_expand(pll_partition_t * partition);
+
+PLL_EXPORT void pll_compaction_scatter(const pll_partition_t * partition,
+                                       double * persite_values);
+
+/* functions in gaps.c */
+
+PLL_EXPORT int pll_gaps_initialize(pll_partition_t * partition);
+
+PLL_EXPORT unsigned int * pll_get_gap_bitvector(const pll_partition_t * partition,
+                                                unsigned int clv_index);
+
+PLL_EXPORT void pll_gaps_tip(pll_partition_t * partition,
+                             unsigned int tip_index,
+                             const pll_state_t * map,
+                             const char * sequence);
+
+PLL_EXPORT void pll_gaps_tip_clv(pll_partition_t * partition,
+                                 unsigned int tip_index,
+                                 const double * clv,
+                                 int padding);
+
+PLL_EXPORT void pll_gaps_operations(pll_partition_t * partition,
+                                    const pll_operation_t * operations,
+                                    unsigned int count);
+
+PLL_EXPORT unsigned int pll_gaps_run_end(const unsigned int * left,
+                                         const unsigned int * right,
+                                         unsigned int site,
+                                         unsigned int end);
+
+/* functions in clv_tracking.c */
+
+PLL_EXPORT void pll_clv_tracking_destroy(pll_clv_tracking_t * tracking);
+
+PLL_EXPORT void pll_clv_tracking_operations(pll_partition_t * partition,
+                                            const pll_operation_t * operations,
+                                            unsigned int count);
+
+PLL_EXPORT void pll_clv_tracking_pmatrices(pll_partition_t * partition,
+                                           const unsigned int * matrix_indices,
+                                           unsigned int count);
+
+PLL_EXPORT void pll_clv_tracking_tip(pll_partition_t * partition,
+                                     unsigned int tip_index);
+
+PLL_EXPORT void pll_invalidate_partials(pll_partition_t * partition);
+
+PLL_EXPORT int pll_utree_update_partials_lazy(pll_partition_t * partition,
+                                              const pll_utree_t * tree,
+                                              const pll_unode_t * root_edge,
+                                              unsigned int * ops_count);
+
+/* functions in pmatrix_cache.c */
+
+PLL_EXPORT void pll_pmatrix_cache_destroy(pll_pmatrix_cache_t * cache);
+
+PLL_EXPORT int pll_set_pmatrix_cache(pll_partition_t * partition,
+                                     unsigned int entries);
+
+PLL_EXPORT void pll_pmatrix_cache_invalidate(pll_partition_t * partition);
+
+PLL_EXPORT int pll_pmatrix_cache_lookup(pll_partition_t * partition,
+                                        const unsigned int * params_indices,
+                                        const unsigned int * matrix_indices,
+                                        const double * branch_lengths,
+                                        unsigned int count,
+                                        unsigned int * misses);
+
+PLL_EXPORT void pll_pmatrix_cache_store(pll_partition_t * partition,
+                                        const unsigned int * params_indices,
+                                        unsigned int misses);
+
+/* functions in optimize.c */
+
+PLL_EXPORT pll_optimize_workspace_t * pll_optimize_workspace_create(
+                                        pll_partition_t * const * partitions,
+                                        unsigned int count);
+
+PLL_EXPORT void pll_optimize_workspace_destroy(
+                                        pll_optimize_workspace_t * workspace);
+
+PLL_EXPORT int pll_optimize_branch_lengths(pll_partition_t * const * partitions,
+                                           unsigned int count,
+                                           pll_utree_t * tree,
+                                           unsigned int * const * params_indices,
+                                           double min_length,
+                                           double max_length,
+                                           double tolerance,
+                                           unsigned int smoothings,
+                                           pll_optimize_workspace_t * workspace,
+                                           double * logl);
+
+/* the upward CLVs need tree->edge_count - 1 spare CLV and scale buffers,
+   distinct from those of the tree, see optimize.c */
+PLL_EXPORT int pll_utree_compute_gradient(pll_partition_t * partition,
+                                          const pll_utree_t * tree,
+                                          const unsigned int * params_indices,
+                                          const unsigned int * up_clv_indices,
+                                          const int * up_scaler_indices,
+                                          pll_optimize_workspace_t * workspace,
+                                          double * gradient,
+                                          double * logl);
+
+/* functions in partition_set.c */
+
+PLL_EXPORT pll_partition_set_t * pll_partition_set_create(
+                                                pll_partition_t ** partitions,
+                                                unsigned int count,
+                                                unsigned int threads);
+
+PLL_EXPORT void pll_partition_set_destroy(pll_partition_set_t * set);
+
+PLL_EXPORT unsigned int pll_partition_set_threads(
+                                            const pll_partition_set_t * set);
+
+PLL_EXPORT int pll_partition_set_run(pll_partition_set_t * set,
+                                     int (*task)(void * data,
+                                                 unsigned int tid,
+                                                 unsigned int task_index),
+                                     void * data);
+
+PLL_EXPORT double pll_partition_set_reduce(const pll_partition_set_t * set,
+                                           const double * values,
+                                           double * partition_values);
+
 /* functions in gamma.c */
 
 PLL_EXPORT int pll_compute_gamma_cats(double alpha,
@@ -1020,6 +1887,16 @@ PLL_EXPORT void pll_core_update_partial_ii(unsigned int states,
                                            const unsigned int * right_scaler,
                                            unsigned int attrib);
 
+PLL_EXPORT void pll_core_update_partial_single(unsigned int states,
+                                               unsigned int sites,
+                                               unsigned int rate_cats,
+                                               double * parent_clv,
+                                               unsigned int * parent_scaler,
+                                               const double * child_clv,
+                                               const double * child_matrix,
+                                               const unsigned int * child_scaler,
+                                               unsigned int attrib);
+
 PLL_EXPORT void pll_core_update_partial_repeats(unsigned int states,
                                                 unsigned int parent_sites,
                                                 unsigned int left_sites,
@@ -1198,6 +2075,25 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
                                                double * dd_f,
                                                unsigned int attrib);
 
+PLL_EXPORT int pll_core_likelihood_derivatives_multi(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     const double * rate_weights,
+                                                     const unsigned int * site_scalings,
+                                                     const int * invariant,
+                                                     const unsigned int * pattern_weights,
+                                                     unsigned int count,
+                                                     const double * branch_lengths,
+                                                     const double * prop_invar,
+                                                     double * const * freqs,
+                                                     const double * rates,
+                                                     double * const * eigenvals,
+                                                     const double * sumtable,
+                                                     double * logl,
+                                                     double * d_f,
+                                                     double * dd_f,
+                                                     unsigned int attrib);
+
 PLL_EXPORT int pll_core_update_sumtable_repeats_avx(unsigned int states,
                                                     unsigned int sites,
                                                     unsigned int parent_sites,
@@ -1674,6 +2570,16 @@ PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
                                                 const unsigned int * right_scaler,
                                                 unsigned int attrib);
 
+PLL_EXPORT void pll_core_update_partial_single_avx2(unsigned int states,
+                                                    unsigned int sites,
+                                                    unsigned int rate_cats,
+                                                    double * parent_clv,
+                                                    unsigned int * parent_scaler,
+                                                    const double * child_clv,
+                                                    const double * child_matrix,
+                                                    const unsigned int * child_scaler,
+                                                    unsigned int attrib);
+
 PLL_EXPORT void pll_core_update_partial_repeats_generic_avx2(unsigned int states,
                                                              unsigned int parent_sites,
                                                              unsigned int left_sites,
@@ -1692,9 +2598,130 @@ PLL_EXPORT void pll_core_update_partial_repeats_generic_avx2(unsigned int states
                                                              const unsigned int * right_site_id,
                                                              double * bclv_buffer,
                                                              unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_repeatsbclv_generic_avx2(unsigned int states,
+                                                                 unsigned int parent_sites,
+                                                                 unsigned int left_sites,
+                                                                 unsigned int right_sites,
+                                                                 unsigned int rate_cats,
+                                                                 double * parent_clv,
+                                                                 unsigned int * parent_scaler,
+                                                                 const double * left_clv,
+                                                                 const double * right_clv,
+                                                                 const double * left_matrix,
+                                                                 const double * right_matrix,
+                                                                 const unsigned int * left_scaler,
+                                                                 const unsigned int * right_scaler,
+                                                                 const unsigned int * parent_id_site,
+                                                                 const unsigned int * left_site_id,
+                                                                 const unsigned int * right_site_id,
+                                                                 double * bclv_buffer,
+                                                                 unsigned int attrib);
 #endif
 
 
+/* functions in core_partials_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT void pll_core_update_partial_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const unsigned char * left_tipchars,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * right_scaler,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ti_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const unsigned char * left_tipchars,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const double * left_clv,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * left_scaler,
+                                                  const unsigned int * right_scaler,
+                                                  unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_single_avx512(unsigned int states,
+                                                      unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const double * child_clv,
+                                                      const double * child_matrix,
+                                                      const unsigned int * child_scaler,
+                                                      unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ii_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const double * left_clv,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * left_scaler,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_repeats_generic_avx512(unsigned int states,
+                                                               unsigned int parent_sites,
+                                                               unsigned int left_sites,
+                                                               unsigned int right_sites,
+                                                               unsigned int rate_cats,
+                                                               double * parent_clv,
+                                                               unsigned int * parent_scaler,
+                                                               const double * left_clv,
+                                                               const double * right_clv,
+                                                               const double * left_matrix,
+                                                               const double * right_matrix,
+                                                               const unsigned int * left_scaler,
+                                                               const unsigned int * right_scaler,
+                                                               const unsigned int * parent_id_site,
+                                                               const unsigned int * left_site_id,
+                                                               const unsigned int * right_site_id,
+                                                               double * bclv_buffer,
+                                                               unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_repeatsbclv_generic_avx512(unsigned int states,
+                                                                   unsigned int parent_sites,
+                                                                   unsigned int left_sites,
+                                                                   unsigned int right_sites,
+                                                                   unsigned int rate_cats,
+                                                                   double * parent_clv,
+                                                                   unsigned int * parent_scaler,
+                                                                   const double * left_clv,
+                                                                   const double * right_clv,
+                                                                   const double * left_matrix,
+                                                                   const double * right_matrix,
+                                                                   const unsigned int * left_scaler,
+                                                                   const unsigned int * right_scaler,
+                                                                   const unsigned int * parent_id_site,
+                                                                   const unsigned int * left_site_id,
+                                                                   const unsigned int * right_site_id,
+                                                                   double * bclv_buffer,
+                                                                   unsigned int attrib);
+#endif
+
 /* functions in core_derivatives_sse.c */
 
 #ifdef HAVE_SSE3
@@ -1788,6 +2815,23 @@ PLL_EXPORT int pll_core_likelihood_derivatives_avx(unsigned int states,
                                                    double * d_f,
                                                    double * dd_f);
 
+PLL_EXPORT int pll_core_likelihood_derivatives_multi_avx(unsigned int states,
+                                                         unsigned int states_padded,
+                                                         unsigned int rate_cats,
+                                                         unsigned int sites,
+                                                         unsigned int points_padded,
+                                                         const unsigned int * pattern_weights,
+                                                         const double * rate_weights,
+                                                         const unsigned int * site_scalings,
+                                                         const int * invariant,
+                                                         const double * prop_invar,
+                                                         double * const * freqs,
+                                                         const double * sumtable,
+                                                         const double * diagptable,
+                                                         double * logl,
+                                                         double * d_f,
+                                                         double * dd_f);
+
 PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx(unsigned int states,
                                                             unsigned int sites,
                                                             unsigned int parent_sites,
@@ -1887,6 +2931,24 @@ int pll_core_likelihood_derivatives_avx2(unsigned int states,
                                          double * d_f,
                                          double * dd_f);
 
+PLL_EXPORT
+int pll_core_likelihood_derivatives_multi_avx2(unsigned int states,
+                                               unsigned int states_padded,
+                                               unsigned int rate_cats,
+                                               unsigned int sites,
+                                               unsigned int points_padded,
+                                               const unsigned int * pattern_weights,
+                                               const double * rate_weights,
+                                               const unsigned int * site_scalings,
+                                               const int * invariant,
+                                               const double * prop_invar,
+                                               double * const * freqs,
+                                               const double * sumtable,
+                                               const double * diagptable,
+                                               double * logl,
+                                               double * d_f,
+                                               double * dd_f);
+
 PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx2(unsigned int states,
                                                              unsigned int sites,
                                                              unsigned int parent_sites,
@@ -1904,6 +2966,125 @@ PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx2(unsigned int states
                                                              double * bclv_buffer,
                                                              unsigned int inv,
                                                              unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_repeatsbclv_generic_avx2(unsigned int states,
+                                                                 unsigned int sites,
+                                                                 unsigned int parent_sites,
+                                                                 unsigned int rate_cats,
+                                                                 const double * clvp,
+                                                                 const double * clvc,
+                                                                 const unsigned int * parent_scaler,
+                                                                 const unsigned int * child_scaler,
+                                                                 double * const * eigenvecs,
+                                                                 double * const * inv_eigenvecs,
+                                                                 double * const * freqs,
+                                                                 double *sumtable,
+                                                                 const unsigned int * parent_site_id,
+                                                                 const unsigned int * child_site_id,
+                                                                 double * bclv_buffer,
+                                                                 unsigned int inv,
+                                                                 unsigned int attrib);
+#endif
+
+/* functions in core_derivatives_avx512.c */
+
+#ifdef HAVE_AVX512
+
+PLL_EXPORT int pll_core_update_sumtable_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * clvp,
+                                                  const double * clvc,
+                                                  const unsigned int * parent_scaler,
+                                                  const unsigned int * child_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  double * sumtable,
+                                                  unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * parent_clv,
+                                                  const unsigned char * left_tipchars,
+                                                  const unsigned int * parent_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  double * sumtable,
+                                                  unsigned int attrib);
+
+PLL_EXPORT
+int pll_core_likelihood_derivatives_avx512(unsigned int states,
+                                           unsigned int states_padded,
+                                           unsigned int rate_cats,
+                                           unsigned int ef_sites,
+                                           const unsigned int * pattern_weights,
+                                           const double * rate_weights,
+                                           const int * invariant,
+                                           const double * prop_invar,
+                                           double * const * freqs,
+                                           const double * sumtable,
+                                           const double * diagptable,
+                                           double * d_f,
+                                           double * dd_f);
+
+PLL_EXPORT
+int pll_core_likelihood_derivatives_multi_avx512(unsigned int states,
+                                                 unsigned int states_padded,
+                                                 unsigned int rate_cats,
+                                                 unsigned int sites,
+                                                 unsigned int points_padded,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * rate_weights,
+                                                 const unsigned int * site_scalings,
+                                                 const int * invariant,
+                                                 const double * prop_invar,
+                                                 double * const * freqs,
+                                                 const double * sumtable,
+                                                 const double * diagptable,
+                                                 double * logl,
+                                                 double * d_f,
+                                                 double * dd_f);
+
+PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx512(unsigned int states,
+                                                               unsigned int sites,
+                                                               unsigned int parent_sites,
+                                                               unsigned int rate_cats,
+                                                               const double * clvp,
+                                                               const double * clvc,
+                                                               const unsigned int * parent_scaler,
+                                                               const unsigned int * child_scaler,
+                                                               double * const * eigenvecs,
+                                                               double * const * inv_eigenvecs,
+                                                               double * const * freqs,
+                                                               double *sumtable,
+                                                               const unsigned int * parent_site_id,
+                                                               const unsigned int * child_site_id,
+                                                               double * bclv_buffer,
+                                                               unsigned int inv,
+                                                               unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_repeatsbclv_generic_avx512(unsigned int states,
+                                                                   unsigned int sites,
+                                                                   unsigned int parent_sites,
+                                                                   unsigned int rate_cats,
+                                                                   const double * clvp,
+                                                                   const double * clvc,
+                                                                   const unsigned int * parent_scaler,
+                                                                   const unsigned int * child_scaler,
+                                                                   double * const * eigenvecs,
+                                                                   double * const * inv_eigenvecs,
+                                                                   double * const * freqs,
+                                                                   double *sumtable,
+                                                                   const unsigned int * parent_site_id,
+                                                                   const unsigned int * child_site_id,
+                                                                   double * bclv_buffer,
+                                                                   unsigned int inv,
+                                                                   unsigned int attrib);
 #endif
 
 /* functions in core_likelihood_sse.c */
@@ -2319,6 +3500,158 @@ double pll_core_edge_loglikelihood_repeats_generic_avx2(unsigned int states,
                                                         double * bclv,
                                                         unsigned int attrib);
 
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeatsbclv_generic_avx2(unsigned int states,
+                                                            unsigned int sites,
+                                                            const unsigned int child_sites,
+                                                            unsigned int rate_cats,
+                                                            const double * parent_clv,
+                                                            const unsigned int * parent_scaler,
+                                                            const double * child_clv,
+                                                            const unsigned int * child_scaler,
+                                                            const double * pmatrix,
+                                                            double ** frequencies,
+                                                            const double * rate_weights,
+                                                            const unsigned int * pattern_weights,
+                                                            const double * invar_proportion,
+                                                            const int * invar_indices,
+                                                            const unsigned int * freqs_indices,
+                                                            double * persite_lnl,
+                                                            const unsigned int * parent_site_id,
+                                                            const unsigned int * child_site_id,
+                                                            double * bclv,
+                                                            unsigned int attrib);
+
+#endif
+
+/* functions in core_likelihood_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT
+double pll_core_root_loglikelihood_avx512(unsigned int states,
+                                          unsigned int sites,
+                                          unsigned int rate_cats,
+                                          const double * clv,
+                                          const unsigned int * scaler,
+                                          double * const * frequencies,
+                                          const double * rate_weights,
+                                          const unsigned int * pattern_weights,
+                                          const double * invar_proportion,
+                                          const int * invar_indices,
+                                          const unsigned int * freqs_indices,
+                                          double * persite_lnl);
+
+PLL_EXPORT
+double pll_core_root_loglikelihood_repeats_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * clv,
+                                                  const unsigned int * site_id,
+                                                  const unsigned int * scaler,
+                                                  double * const * frequencies,
+                                                  const double * rate_weights,
+                                                  const unsigned int * pattern_weights,
+                                                  const double * invar_proportion,
+                                                  const int * invar_indices,
+                                                  const unsigned int * freqs_indices,
+                                                  double * persite_lnl);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_4x4_avx512(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const unsigned char * tipchars,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const unsigned char * tipchars,
+                                             const pll_state_t * tipmap,
+                                             unsigned int tipmap_size,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const double * child_clv,
+                                             const unsigned int * child_scaler,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeats_generic_avx512(unsigned int states,
+                                                          unsigned int sites,
+                                                          const unsigned int child_sites,
+                                                          unsigned int rate_cats,
+                                                          const double * parent_clv,
+                                                          const unsigned int * parent_scaler,
+                                                          const double * child_clv,
+                                                          const unsigned int * child_scaler,
+                                                          const double * pmatrix,
+                                                          double ** frequencies,
+                                                          const double * rate_weights,
+                                                          const unsigned int * pattern_weights,
+                                                          const double * invar_proportion,
+                                                          const int * invar_indices,
+                                                          const unsigned int * freqs_indices,
+                                                          double * persite_lnl,
+                                                          const unsigned int * parent_site_id,
+                                                          const unsigned int * child_site_id,
+                                                          double * bclv,
+                                                          unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeatsbclv_generic_avx512(unsigned int states,
+                                                              unsigned int sites,
+                                                              const unsigned int child_sites,
+                                                              unsigned int rate_cats,
+                                                              const double * parent_clv,
+                                                              const unsigned int * parent_scaler,
+                                                              const double * child_clv,
+                                                              const unsigned int * child_scaler,
+                                                              const double * pmatrix,
+                                                              double ** frequencies,
+                                                              const double * rate_weights,
+                                                              const unsigned int * pattern_weights,
+                                                              const double * invar_proportion,
+                                                              const int * invar_indices,
+                                                              const unsigned int * freqs_indices,
+                                                              double * persite_lnl,
+                                                              const unsigned int * parent_site_id,
+                                                              const unsigned int * child_site_id,
+                                                              double * bclv,
+                                                              unsigned int attrib);
 #endif
 
 /* functions in core_pmatrix.c */
@@ -2337,6 +3670,22 @@ PLL_EXPORT int pll_core_update_pmatrix(double ** pmatrix,
                                        unsigned int count,
                                        unsigned int attrib);
 
+PLL_EXPORT void pll_core_pmatrix_4x4_closed_coefs(const double * subst_params,
+                                                  const double * frequencies,
+                                                  double * coefs);
+
+PLL_EXPORT int pll_core_update_pmatrix_4x4_closed(double ** pmatrix,
+                                                  unsigned int rate_cats,
+                                                  const double * rates,
+                                                  const double * branch_lengths,
+                                                  const unsigned int * matrix_indices,
+                                                  const unsigned int * params_indices,
+                                                  const double * prop_invar,
+                                                  double * const * subst_params,
+                                                  double * const * frequencies,
+                                                  unsigned int count,
+                                                  unsigned int attrib);
+
 /* functions in core_pmatrix_avx2.c */
 
 #ifdef HAVE_AVX2
@@ -2351,6 +3700,49 @@ PLL_EXPORT int pll_core_update_pmatrix_20x20_avx2(double ** pmatrix,
                                                   double * const * eigenvecs,
                                                   double * const * inv_eigenvecs,
                                                   unsigned int count);
+
+PLL_EXPORT int pll_core_update_pmatrix_batch_avx2(double ** pmatrix,
+                                                  unsigned int states,
+                                                  unsigned int rate_cats,
+                                                  const double * rates,
+                                                  const double * branch_lengths,
+                                                  const unsigned int * matrix_indices,
+                                                  const unsigned int * params_indices,
+                                                  const double * prop_invar,
+                                                  double * const * eigenvals,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  unsigned int count);
+#endif
+
+/* functions in core_pmatrix_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT int pll_core_update_pmatrix_avx512(double ** pmatrix,
+                                              unsigned int states,
+                                              unsigned int rate_cats,
+                                              const double * rates,
+                                              const double * branch_lengths,
+                                              const unsigned int * matrix_indices,
+                                              const unsigned int * params_indices,
+                                              const double * prop_invar,
+                                              double * const * eigenvals,
+                                              double * const * eigenvecs,
+                                              double * const * inv_eigenvecs,
+                                              unsigned int count);
+
+PLL_EXPORT int pll_core_update_pmatrix_batch_avx512(double ** pmatrix,
+                                                    unsigned int states,
+                                                    unsigned int rate_cats,
+                                                    const double * rates,
+                                                    const double * branch_lengths,
+                                                    const unsigned int * matrix_indices,
+                                                    const unsigned int * params_indices,
+                                                    const double * prop_invar,
+                                                    double * const * eigenvals,
+                                                    double * const * eigenvecs,
+                                                    double * const * inv_eigenvecs,
+                                                    unsigned int count);
 #endif
 
 /* functions in core_pmatrix_avx.c */
@@ -2379,6 +3771,17 @@ PLL_EXPORT int pll_core_update_pmatrix_20x20_avx(double ** pmatrix,
                                                  double * const * eigenvecs,
                                                  double * const * inv_eigenvecs,
                                                  unsigned int count);
+
+PLL_EXPORT int pll_core_update_pmatrix_4x4_closed_avx(double ** pmatrix,
+                                                      unsigned int rate_cats,
+                                                      const double * rates,
+                                                      const double * branch_lengths,
+                                                      const unsigned int * matrix_indices,
+                                                      const unsigned int * params_indices,
+                                                      const double * prop_invar,
+                                                      double * const * subst_params,
+                                                      double * const * frequencies,
+                                                      unsigned int count);
 #endif
 
 /* functions in core_pmatrix_sse.c */
@@ -2409,6 +3812,230 @@ PLL_EXPORT int pll_core_update_pmatrix_20x20_sse(double ** pmatrix,
                                                unsigned int count);
 #endif
 
+/* functions in core_math.c */
+
+PLL_EXPORT void pll_core_log(unsigned int count,
+                             const double * x,
+                             double * y,
+                             unsigned int attrib);
+
+PLL_EXPORT void pll_core_exp(unsigned int count,
+                             const double * x,
+                             double * y,
+                             unsigned int attrib);
+
+PLL_EXPORT void pll_core_expm1(unsigned int count,
+                               const double * x,
+                               double * y,
+                               unsigned int attrib);
+
+/* functions in core_math_sse.c */
+
+#ifdef HAVE_SSE3
+PLL_EXPORT void pll_core_log_sse(unsigned int count,
+                                 const double * x,
+                                 double * y);
+
+PLL_EXPORT void pll_core_exp_sse(unsigned int count,
+                                 const double * x,
+                                 double * y);
+
+PLL_EXPORT void pll_core_expm1_sse(unsigned int count,
+                                   const double * x,
+                                   double * y);
+
+PLL_EXPORT double pll_core_site_loglikelihoods_sse(unsigned int count,
+                                                   double * site_lk,
+                                                   const unsigned int * site_scalings,
+                                                   const unsigned int * pattern_weights,
+                                                   double * persite_lnl,
+                                                   double logl);
+#endif
+
+/* functions in core_math_avx.c */
+
+#ifdef HAVE_AVX
+PLL_EXPORT void pll_core_log_avx(unsigned int count,
+                                 const double * x,
+                                 double * y);
+
+PLL_EXPORT void pll_core_exp_avx(unsigned int count,
+                                 const double * x,
+                                 double * y);
+
+PLL_EXPORT void pll_core_expm1_avx(unsigned int count,
+                                   const double * x,
+                                   double * y);
+
+PLL_EXPORT double pll_core_site_loglikelihoods_avx(unsigned int count,
+                                                   double * site_lk,
+                                                   const unsigned int * site_scalings,
+                                                   const unsigned int * pattern_weights,
+                                                   double * persite_lnl,
+                                                   double logl);
+#endif
+
+/* functions in core_math_avx2.c */
+
+#ifdef HAVE_AVX2
+PLL_EXPORT void pll_core_log_avx2(unsigned int count,
+                                  const double * x,
+                                  double * y);
+
+PLL_EXPORT void pll_core_exp_avx2(unsigned int count,
+                                  const double * x,
+                                  double * y);
+
+PLL_EXPORT void pll_core_expm1_avx2(unsigned int count,
+                                    const double * x,
+                                    double * y);
+
+PLL_EXPORT double pll_core_site_loglikelihoods_avx2(unsigned int count,
+                                                    double * site_lk,
+                                                    const unsigned int * site_scalings,
+                                                    const unsigned int * pattern_weights,
+                                                    double * persite_lnl,
+                                                    double logl);
+#endif
+
+/* functions in core_math_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT void pll_core_log_avx512(unsigned int count,
+                                    const double * x,
+                                    double * y);
+
+PLL_EXPORT void pll_core_exp_avx512(unsigned int count,
+                                    const double * x,
+                                    double * y);
+
+PLL_EXPORT void pll_core_expm1_avx512(unsigned int count,
+                                      const double * x,
+                                      double * y);
+
+PLL_EXPORT double pll_core_site_loglikelihoods_avx512(unsigned int count,
+                                                      double * site_lk,
+                                                      const unsigned int * site_scalings,
+                                                      const unsigned int * pattern_weights,
+                                                      double * persite_lnl,
+                                                      double logl);
+#endif
+
+/* functions in core_kernels.c */
+
+PLL_EXPORT void pll_core_select_kernels(pll_kernels_t * kernels,
+                                        unsigned int states,
+                                        unsigned int attrib);
+
+/* functions in core_sp.c */
+
+PLL_EXPORT void pll_core_update_partial_ii_sp(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              float * parent_clv,
+                                              unsigned int * parent_scaler,
+                                              const float * left_clv,
+                                              const float * right_clv,
+                                              const double * left_matrix,
+                                              const double * right_matrix,
+                                              const unsigned int * left_scaler,
+                                              const unsigned int * right_scaler,
+                                              unsigned int attrib);
+
+PLL_EXPORT double pll_core_root_loglikelihood_sp(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const float * clv,
+                                                 const unsigned int * scaler,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_sp(unsigned int states,
+                                         unsigned int sites,
+                                         unsigned int rate_cats,
+                                         const float * parent_clv,
+                                         const unsigned int * parent_scaler,
+                                         const float * child_clv,
+                                         const unsigned int * child_scaler,
+                                         const double * pmatrix,
+                                         double * const * frequencies,
+                                         const double * rate_weights,
+                                         const unsigned int * pattern_weights,
+                                         const double * invar_proportion,
+                                         const int * invar_indices,
+                                         const unsigned int * freqs_indices,
+                                         double * persite_lnl,
+                                         unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_ii_sp(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              const float * parent_clv,
+                                              const float * child_clv,
+                                              const unsigned int * parent_scaler,
+                                              const unsigned int * child_scaler,
+                                              double * const * eigenvecs,
+                                              double * const * inv_eigenvecs,
+                                              double * const * freqs,
+                                              double * sumtable,
+                                              unsigned int attrib);
+
+/* functions in core_sp_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT void pll_core_update_partial_ii_sp_avx512(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const float * left_clv,
+                                                     const float * right_clv,
+                                                     const double * left_matrix,
+                                                     const double * right_matrix,
+                                                     const unsigned int * left_scaler,
+                                                     const unsigned int * right_scaler,
+                                                     unsigned int attrib);
+
+PLL_EXPORT double pll_core_root_loglikelihood_sp_avx512(unsigned int states,
+                                                        unsigned int sites,
+                                                        unsigned int rate_cats,
+                                                        const float * clv,
+                                                        const unsigned int * scaler,
+                                                        double * const * frequencies,
+                                                        const double * rate_weights,
+                                                        const unsigned int * pattern_weights,
+                                                        const double * invar_proportion,
+                                                        const int * invar_indices,
+                                                        const unsigned int * freqs_indices,
+                                                        double * persite_lnl,
+                                                        unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_sp_avx512(unsigned int states,
+                                                unsigned int sites,
+                                                unsigned int rate_cats,
+                                                const float * parent_clv,
+                                                const unsigned int * parent_scaler,
+                                                const float * child_clv,
+                                                const unsigned int * child_scaler,
+                                                const double * pmatrix,
+                                                double * const * frequencies,
+                                                const double * rate_weights,
+                                                const unsigned int * pattern_weights,
+                                                const double * invar_proportion,
+                                                const int * invar_indices,
+                                                const unsigned int * freqs_indices,
+                                                double * persite_lnl,
+                                                unsigned int attrib);
+#endif
+
 /* functions in compress.c */
 
 PLL_EXPORT unsigned int * pll_compress_site_patterns(char ** sequence,
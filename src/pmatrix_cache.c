@@ -0,0 +1,240 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* A bounded, direct-mapped cache of transition probability matrices keyed by
+   the bit pattern of the branch length and the parameter indices of the rate
+   categories. Entries are stamped with a model version that is incremented
+   whenever eigen decompositions, category rates or invariant site
+   proportions change, which invalidates all of them at once */
+
+PLL_EXPORT void pll_pmatrix_cache_destroy(pll_pmatrix_cache_t * cache)
+{
+  if (!cache) return;
+
+  free(cache->entry_stamp);
+  free(cache->branch_length);
+  free(cache->params_indices);
+  pll_aligned_free(cache->pmatrix);
+  free(cache->miss_matrix);
+  free(cache->miss_length);
+  free(cache->pending);
+  free(cache);
+}
+
+static pll_pmatrix_cache_t * cache_create(const pll_partition_t * partition,
+                                          unsigned int entries)
+{
+  pll_pmatrix_cache_t * cache = (pll_pmatrix_cache_t *)calloc(1,
+                                                  sizeof(pll_pmatrix_cache_t));
+  if (!cache)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for cache.");
+    return NULL;
+  }
+
+  cache->entries = entries;
+  cache->matrix_size = (size_t)partition->states * partition->states_padded *
+                       partition->rate_cats;
+  cache->stamp = 1;
+
+  cache->entry_stamp = (unsigned long *)calloc(entries, sizeof(unsigned long));
+  cache->branch_length = (double *)calloc(entries, sizeof(double));
+  cache->params_indices = (unsigned int *)calloc((size_t)entries *
+                                                   partition->rate_cats,
+                                                 sizeof(unsigned int));
+  cache->pmatrix = (double *)pll_aligned_alloc(entries * cache->matrix_size *
+                                                 sizeof(double),
+                                               partition->alignment);
+  cache->pending = (unsigned long *)calloc(partition->prob_matrices,
+                                           sizeof(unsigned long));
+  if (!cache->entry_stamp || !cache->branch_length ||
+      !cache->params_indices || !cache->pmatrix || !cache->pending)
+  {
+    pll_pmatrix_cache_destroy(cache);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for cache.");
+    return NULL;
+  }
+
+  return cache;
+}
+
+/* sets the number of p-matrices kept in the cache of a partition. A value of
+   0 disables caching */
+PLL_EXPORT int pll_set_pmatrix_cache(pll_partition_t * partition,
+                                     unsigned int entries)
+{
+  pll_pmatrix_cache_t * cache = NULL;
+
+  if (partition->pmatrix_cache && partition->pmatrix_cache->entries == entries)
+    return PLL_SUCCESS;
+
+  if (entries)
+  {
+    cache = cache_create(partition, entries);
+    if (!cache)
+      return PLL_FAILURE;
+  }
+
+  pll_pmatrix_cache_destroy(partition->pmatrix_cache);
+  partition->pmatrix_cache = cache;
+
+  return PLL_SUCCESS;
+}
+
+/* invalidates all cached p-matrices after a change of the model */
+PLL_EXPORT void pll_pmatrix_cache_invalidate(pll_partition_t * partition)
+{
+  if (partition->pmatrix_cache)
+    partition->pmatrix_cache->stamp++;
+}
+
+static unsigned int cache_entry(const pll_pmatrix_cache_t * cache,
+                                double branch_length,
+                                const unsigned int * params_indices,
+                                unsigned int rate_cats)
+{
+  unsigned long long h;
+  unsigned int i;
+
+  memcpy(&h, &branch_length, sizeof(double));
+  for (i = 0; i < rate_cats; ++i)
+    h = h * 31 + params_indices[i];
+
+  /* finalizer of MurmurHash3 */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return (unsigned int)(h % cache->entries);
+}
+
+static int grow_misses(pll_pmatrix_cache_t * cache, unsigned int count)
+{
+  unsigned int * miss_matrix;
+  double * miss_length;
+
+  if (count <= cache->miss_capacity)
+    return PLL_SUCCESS;
+
+  miss_matrix = (unsigned int *)malloc(count * sizeof(unsigned int));
+  miss_length = (double *)malloc(count * sizeof(double));
+  if (!miss_matrix || !miss_length)
+  {
+    free(miss_matrix);
+    free(miss_length);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for cache.");
+    return PLL_FAILURE;
+  }
+
+  free(cache->miss_matrix);
+  free(cache->miss_length);
+  cache->miss_matrix = miss_matrix;
+  cache->miss_length = miss_length;
+  cache->miss_capacity = count;
+
+  return PLL_SUCCESS;
+}
+
+/* copies cached p-matrices into the requested matrix indices. The matrix
+   indices and branch lengths that were not found are stored in
+   miss_matrix and miss_length, and their number is returned in misses. A hit
+   on a matrix index that has an earlier miss in the same call is treated as
+   a miss, such that the last request for each matrix index prevails */
+PLL_EXPORT int pll_pmatrix_cache_lookup(pll_partition_t * partition,
+                                        const unsigned int * params_indices,
+                                        const unsigned int * matrix_indices,
+                                        const double * branch_lengths,
+                                        unsigned int count,
+                                        unsigned int * misses)
+{
+  pll_pmatrix_cache_t * cache = partition->pmatrix_cache;
+  unsigned int rate_cats = partition->rate_cats;
+  unsigned int i, e;
+
+  if (!grow_misses(cache, count))
+    return PLL_FAILURE;
+
+  cache->lookups++;
+
+  *misses = 0;
+  for (i = 0; i < count; ++i)
+  {
+    e = cache_entry(cache, branch_lengths[i], params_indices, rate_cats);
+
+    if (cache->pending[matrix_indices[i]] != cache->lookups &&
+        cache->entry_stamp[e] == cache->stamp &&
+        !memcmp(cache->branch_length + e, branch_lengths + i, sizeof(double)) &&
+        !memcmp(cache->params_indices + (size_t)e * rate_cats,
+                params_indices,
+                rate_cats * sizeof(unsigned int)))
+    {
+      memcpy(partition->pmatrix[matrix_indices[i]],
+             cache->pmatrix + e * cache->matrix_size,
+             cache->matrix_size * sizeof(double));
+      cache->hits++;
+    }
+    else
+    {
+      cache->miss_matrix[*misses] = matrix_indices[i];
+      cache->miss_length[*misses] = branch_lengths[i];
+      cache->pending[matrix_indices[i]] = cache->lookups;
+      (*misses)++;
+    }
+  }
+  cache->misses += *misses;
+
+  return PLL_SUCCESS;
+}
+
+/* stores the p-matrices computed for the misses of the last lookup. Only the
+   last miss of each matrix index still holds its p-matrix */
+PLL_EXPORT void pll_pmatrix_cache_store(pll_partition_t * partition,
+                                        const unsigned int * params_indices,
+                                        unsigned int misses)
+{
+  pll_pmatrix_cache_t * cache = partition->pmatrix_cache;
+  unsigned int rate_cats = partition->rate_cats;
+  unsigned int i, e, m;
+
+  for (i = misses; i > 0; --i)
+  {
+    m = cache->miss_matrix[i-1];
+    if (cache->pending[m] != cache->lookups)
+      continue;
+    cache->pending[m] = 0;
+
+    e = cache_entry(cache, cache->miss_length[i-1], params_indices, rate_cats);
+
+    cache->entry_stamp[e] = cache->stamp;
+    cache->branch_length[e] = cache->miss_length[i-1];
+    memcpy(cache->params_indices + (size_t)e * rate_cats,
+           params_indices,
+           rate_cats * sizeof(unsigned int));
+    memcpy(cache->pmatrix + e * cache->matrix_size,
+           partition->pmatrix[m],
+           cache->matrix_size * sizeof(double));
+  }
+}
@@ -20,8 +20,17 @@
 */
 
 #include "pll.h"
+#include <time.h>
 
 const unsigned int EMPTY_ELEMENT = (unsigned int) -1;
+const unsigned long long EMPTY_KEY = (unsigned long long) -1;
+
+/* entries of the dense lookup buffer per site */
+#define PLL_REPEATS_DENSE_FACTOR 8
+
+/* timed operations of each kind before pll_adaptive_enable_repeats learns
+   its threshold */
+#define PLL_REPEATS_CALIBRATION 8
 
 
 // map in charmap each char to a unique char identifier, according to map
@@ -44,6 +53,23 @@ static void repeats_fill_charmap(const pll_state_t *map, char *charmap)
   }
 }
 
+/* returns the slot of key in the hash table of the repeats, or the empty slot
+   at which it is to be inserted. Slots are probed linearly, such that a probe
+   mostly stays within one cache line of keys */
+static unsigned int hash_slot(const pll_repeats_t * repeats,
+                              unsigned int mask,
+                              unsigned long long key)
+{
+  const unsigned long long * keys = repeats->hash_keys;
+  unsigned int slot = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) &
+                      mask;
+
+  while (keys[slot] != key && keys[slot] != EMPTY_KEY)
+    slot = (slot + 1) & mask;
+
+  return slot;
+}
+
 PLL_EXPORT int pll_repeats_enabled(const pll_partition_t *partition)
 {
   return PLL_ATTRIB_SITE_REPEATS & partition->attributes;
@@ -104,7 +130,7 @@ PLL_EXPORT unsigned int pll_default_enable_repeats(pll_partition_t *partition,
   pll_repeats_t * repeats = partition->repeats;
   unsigned long long min_size = (unsigned long long)repeats->pernode_ids[left_clv] 
                           * (unsigned long long)repeats->pernode_ids[right_clv];
-  return !(!min_size || ((unsigned long long)repeats->lookup_buffer_size <= min_size)
+  return !(!min_size
       || (repeats->pernode_ids[left_clv] > (partition->sites / 2))
       || (repeats->pernode_ids[right_clv] > (partition->sites / 2)));
 }
@@ -117,10 +143,150 @@ PLL_EXPORT unsigned int pll_no_enable_repeats(pll_partition_t *partition,
 }
 
 
+PLL_EXPORT double pll_repeats_clock(void)
+{
+#if (defined(__WIN32__) || defined(__WIN64__))
+  return (double)clock() / CLOCKS_PER_SEC;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+#endif
+}
+
+/* larger ratio of classes to sites of the children, a lower bound of the
+   ratio of the parent */
+static double child_ratio(const pll_partition_t * partition,
+                          unsigned int left_clv,
+                          unsigned int right_clv)
+{
+  const unsigned int * ids = partition->repeats->pernode_ids;
+
+  return (double)PLL_MAX(ids[left_clv], ids[right_clv]) / partition->sites;
+}
+
+static unsigned int ratio_bin(double ratio)
+{
+  return PLL_MIN((unsigned int)(ratio * PLL_REPEATS_TUNING_BINS),
+                 PLL_REPEATS_TUNING_BINS - 1);
+}
+
+/* enable_repeats callback installed by pll_repeats_enable_adaptive. Nodes of
+   similar ratios are alternately computed with and without repeats until the
+   faster choice is known for that range. Ranges still undecided once the
+   calibration ends fall back to pll_default_enable_repeats */
+PLL_EXPORT unsigned int pll_adaptive_enable_repeats(pll_partition_t * partition,
+                                                    unsigned int left_clv,
+                                                    unsigned int right_clv)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  pll_repeats_tuning_t * tuning = repeats->tuning;
+  unsigned int k;
+  unsigned int enable;
+
+  if (!repeats->pernode_ids[left_clv] || !repeats->pernode_ids[right_clv])
+    return 0;
+
+  k = ratio_bin(child_ratio(partition, left_clv, right_clv));
+
+  if (tuning->choice[k])
+    return tuning->choice[k] - 1;
+
+  if (tuning->calibrated)
+    return pll_default_enable_repeats(partition, left_clv, right_clv);
+
+  enable = tuning->explored[k]++ & 1;
+  tuning->decided = 1 + enable;
+
+  return enable;
+}
+
+/* fixes the choice of range k once both variants were timed often enough,
+   and ends the calibration after a bounded number of timed operations */
+static void tuning_fit(pll_repeats_tuning_t * tuning, unsigned int k)
+{
+  if (tuning->samples[0][k] >= PLL_REPEATS_CALIBRATION &&
+      tuning->samples[1][k] >= PLL_REPEATS_CALIBRATION)
+  {
+    tuning->choice[k] = (tuning->time[1][k] < tuning->time[0][k]) ? 2 : 1;
+  }
+
+  if (tuning->decisions >=
+      4 * PLL_REPEATS_TUNING_BINS * PLL_REPEATS_CALIBRATION)
+    tuning->calibrated = 1;
+}
+
+/* records the time of an operation started at start (pll_repeats_clock)
+   whose parent was decided by pll_adaptive_enable_repeats */
+PLL_EXPORT void pll_repeats_tuning_record(pll_partition_t * partition,
+                                          const pll_operation_t * op,
+                                          double start)
+{
+  pll_repeats_tuning_t * tuning = partition->repeats->tuning;
+  unsigned int k;
+  int enabled;
+  double elapsed;
+
+  if (!tuning || !tuning->decided)
+    return;
+
+  k = ratio_bin(child_ratio(partition,
+                            op->child1_clv_index,
+                            op->child2_clv_index));
+  enabled = tuning->decided - 1;
+
+  elapsed = (pll_repeats_clock() - start) / partition->sites;
+  if (!tuning->samples[enabled][k] || elapsed < tuning->time[enabled][k])
+    tuning->time[enabled][k] = elapsed;
+  tuning->samples[enabled][k]++;
+  tuning->decisions++;
+  tuning->decided = 0;
+
+  tuning_fit(tuning, k);
+}
+
+/* Replaces the enable_repeats policy by one that learns from the timings of
+ * the first operations below which ratio of classes to sites computing a
+ * node with repeats pays off. Calling it again restarts the calibration.
+ */
+PLL_EXPORT int pll_repeats_enable_adaptive(pll_partition_t * partition)
+{
+  pll_repeats_t * repeats = partition->repeats;
+
+  if (!pll_repeats_enabled(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Site repeats are not enabled.");
+    return PLL_FAILURE;
+  }
+
+  if (!repeats->tuning)
+  {
+    repeats->tuning = (pll_repeats_tuning_t *)malloc(
+                                                sizeof(pll_repeats_tuning_t));
+    if (!repeats->tuning)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate memory for repeats tuning.");
+      return PLL_FAILURE;
+    }
+  }
+  memset(repeats->tuning, 0, sizeof(pll_repeats_tuning_t));
+
+  /* keep a memory budget in control */
+  if (repeats->enable_repeats == pll_budget_enable_repeats)
+    repeats->unbudgeted_enable_repeats = pll_adaptive_enable_repeats;
+  else
+    repeats->enable_repeats = pll_adaptive_enable_repeats;
+
+  return PLL_SUCCESS;
+}
+
 PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition)
 {
   int sites_alloc = partition->asc_additional_sites + partition->sites;
   unsigned int i;
+  unsigned int hash_size = 1;
   partition->repeats = malloc(sizeof(pll_repeats_t));
   if (!partition->repeats) 
   {
@@ -171,10 +337,20 @@ PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition)
       * partition->rate_cats * partition->states_padded
       * sizeof(double), partition->alignment);
   repeats->charmap = calloc(PLL_ASCII_SIZE, sizeof(char));
+
+  /* keep the hash table at most half full */
+  while (hash_size < 2 * (unsigned int)sites_alloc)
+    hash_size <<= 1;
+  repeats->hash_mask = hash_size - 1;
+  repeats->hash_keys = malloc(hash_size * sizeof(unsigned long long));
+  repeats->hash_ids = malloc(hash_size * sizeof(unsigned int));
+  if (repeats->hash_keys)
+    memset(repeats->hash_keys, 0xFF, hash_size * sizeof(unsigned long long));
+
   if (!(repeats->pernode_ids
        && repeats->pernode_allocated_clvs && repeats->bclv_buffer
        && repeats->toclean_buffer && repeats->id_site_buffer 
-       && repeats->charmap))
+       && repeats->charmap && repeats->hash_keys && repeats->hash_ids))
   {
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
@@ -190,29 +366,27 @@ PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
                                   const pll_state_t * map,
                                   const char * sequence)
 {
-  if (!partition->repeats->lookup_buffer)
-    pll_resize_repeats_lookup(partition, PLL_REPEATS_LOOKUP_SIZE);
-   
   unsigned int s;
+  unsigned int char_id[PLL_ASCII_SIZE];
   pll_repeats_t * repeats = partition->repeats;
   unsigned int ** id_site = repeats->pernode_id_site;
   unsigned int additional_sites = 
     partition->asc_bias_alloc ? partition->states : 0;
 
   repeats_fill_charmap(map, repeats->charmap);
+  memset(char_id, EMPTY_ELEMENT, sizeof(char_id));
   repeats->pernode_ids[tip_index] = 0;
   unsigned int curr_id = 0;
   /* fill pernode_site_id */
   for (s = 0; s < partition->sites; ++s) 
   {
-    unsigned int index_lookup = repeats->charmap[(int)sequence[s]];
-    if (EMPTY_ELEMENT == repeats->lookup_buffer[index_lookup]) 
+    unsigned int index_lookup = (unsigned char)repeats->charmap[(int)sequence[s]];
+    if (EMPTY_ELEMENT == char_id[index_lookup]) 
     {
-      repeats->toclean_buffer[curr_id] = index_lookup;
       repeats->id_site_buffer[curr_id] = s;
-      repeats->lookup_buffer[index_lookup] = curr_id++;
+      char_id[index_lookup] = curr_id++;
     }
-    repeats->pernode_site_id[tip_index][s] = repeats->lookup_buffer[index_lookup];
+    repeats->pernode_site_id[tip_index][s] = char_id[index_lookup];
   }
   unsigned int ids = curr_id;
   repeats->pernode_ids[tip_index] = ids;
@@ -222,7 +396,6 @@ PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
   for (s = 0; s < ids; ++s) 
   {
     id_site[tip_index][s] = repeats->id_site_buffer[s];
-    repeats->lookup_buffer[repeats->toclean_buffer[s]] = EMPTY_ELEMENT;
   }
   for (s = 0; s < additional_sites; ++s) 
   {
@@ -252,6 +425,37 @@ PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
   return PLL_SUCCESS;
 }
 
+/* drops the site classes of a tip whose CLV is set for all sites, as by
+   pll_set_tip_clv, and gives it back a CLV for all sites */
+PLL_EXPORT int pll_repeats_reset_tip(pll_partition_t * partition,
+                                     unsigned int tip_index)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int sites_alloc = partition->alloc_sites +
+                             partition->asc_additional_sites;
+  size_t sizealloc = (size_t)sites_alloc * partition->states_padded *
+                     partition->rate_cats * sizeof(double);
+
+  if (!repeats->pernode_ids[tip_index])
+    return PLL_SUCCESS;
+
+  pll_aligned_free(partition->clv[tip_index]);
+  partition->clv[tip_index] = pll_aligned_alloc(sizealloc,
+                                                partition->alignment);
+  if (!partition->clv[tip_index])
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for tip CLV.");
+    return PLL_FAILURE;
+  }
+  memset(partition->clv[tip_index], 0, sizealloc);
+
+  repeats->pernode_ids[tip_index] = 0;
+  repeats->pernode_allocated_clvs[tip_index] = 0;
+
+  return PLL_SUCCESS;
+}
+
 PLL_EXPORT void pll_default_reallocate_repeats(pll_partition_t * partition,
                               unsigned int parent,
                               int scaler_index,
@@ -294,13 +498,301 @@ PLL_EXPORT void pll_default_reallocate_repeats(pll_partition_t * partition,
   memset(partition->clv[parent], 0, sites_to_alloc);
 }
 
+static size_t clv_site_bytes(const pll_partition_t * partition)
+{
+  return (size_t)partition->states_padded * partition->rate_cats *
+         sizeof(double);
+}
+
+/* index of the smallest size class holding sites */
+static unsigned int repeats_class(const pll_repeats_t * repeats,
+                                  unsigned int sites)
+{
+  unsigned int lo = 0;
+  unsigned int hi = repeats->class_count - 1;
+
+  while (lo < hi)
+  {
+    unsigned int mid = (lo + hi + 1) / 2;
+    if (repeats->class_sites[mid] >= sites)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return lo;
+}
+
+/* the first bytes of a pooled CLV link it to the next one of its class */
+static double * pool_next(const double * clv)
+{
+  double * next;
+  memcpy(&next, clv, sizeof(double *));
+  return next;
+}
+
+static void pool_push(pll_repeats_t * repeats,
+                      unsigned int k,
+                      double * clv,
+                      size_t bytes)
+{
+  memcpy(clv, &repeats->pool[k], sizeof(double *));
+  repeats->pool[k] = clv;
+  repeats->pool_bytes += bytes;
+}
+
+static double * pool_pop(pll_repeats_t * repeats, unsigned int k, size_t bytes)
+{
+  double * clv = repeats->pool[k];
+
+  if (clv)
+  {
+    repeats->pool[k] = pool_next(clv);
+    repeats->pool_bytes -= bytes;
+  }
+
+  return clv;
+}
+
+/* frees pooled CLVs, largest first, until bytes more fit into the budget */
+static void trim_pool(pll_partition_t * partition, size_t bytes)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  size_t site_bytes = clv_site_bytes(partition);
+  unsigned int k;
+
+  for (k = 0; k < repeats->class_count &&
+              repeats->clv_bytes + bytes > repeats->budget; ++k)
+  {
+    size_t class_bytes = repeats->class_sites[k] * site_bytes;
+
+    while (repeats->pool[k] &&
+           repeats->clv_bytes + bytes > repeats->budget)
+    {
+      pll_aligned_free(pool_pop(repeats, k, class_bytes));
+      repeats->clv_bytes -= class_bytes;
+    }
+  }
+}
+
+/* returns the CLV of an inner node to the pool, or frees it if its size is
+   not a size class */
+static void release_clv(pll_partition_t * partition, unsigned int node)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int sites = repeats->pernode_allocated_clvs[node];
+  size_t bytes = sites * clv_site_bytes(partition);
+  unsigned int k = repeats_class(repeats, sites);
+
+  if (!partition->clv[node])
+    return;
+
+  if (sites && repeats->class_sites[k] == sites)
+    pool_push(repeats, k, partition->clv[node], bytes);
+  else
+  {
+    pll_aligned_free(partition->clv[node]);
+    repeats->clv_bytes -= bytes;
+  }
+
+  partition->clv[node] = NULL;
+  repeats->pernode_allocated_clvs[node] = 0;
+}
+
+/* takes a CLV of class k from the pool, or allocates it after freeing
+   pooled CLVs until it fits into the budget */
+static double * acquire_clv(pll_partition_t * partition, unsigned int k)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  size_t bytes = repeats->class_sites[k] * clv_site_bytes(partition);
+  double * clv = pool_pop(repeats, k, bytes);
+
+  if (clv)
+  {
+    trim_pool(partition, 0);
+    return clv;
+  }
+
+  trim_pool(partition, bytes);
+
+  clv = pll_aligned_alloc(bytes, partition->alignment);
+  if (clv)
+  {
+    repeats->clv_bytes += bytes;
+    /* avoid valgrind errors */
+    memset(clv, 0, bytes);
+  }
+
+  return clv;
+}
+
+/* enable_repeats callback installed by pll_repeats_set_budget. Computing a
+   node without repeats takes a CLV for all sites, so once that would exceed
+   the budget, repeats are used whenever both children have them. Otherwise
+   the policy that was installed before decides */
+PLL_EXPORT unsigned int pll_budget_enable_repeats(pll_partition_t * partition,
+                                                  unsigned int left_clv,
+                                                  unsigned int right_clv)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int sites = partition->sites + (partition->asc_bias_alloc ?
+                                             partition->states : 0);
+  size_t in_use = repeats->clv_bytes - repeats->pool_bytes;
+
+  if (in_use + sites * clv_site_bytes(partition) > repeats->budget)
+    return repeats->pernode_ids[left_clv] && repeats->pernode_ids[right_clv];
+
+  return repeats->unbudgeted_enable_repeats(partition, left_clv, right_clv);
+}
+
+/* reallocation callback installed by pll_repeats_set_budget. CLVs are
+   rounded up to their size class and reused as long as the class of a node
+   does not change */
+PLL_EXPORT void pll_budget_reallocate_repeats(pll_partition_t * partition,
+                                              unsigned int parent,
+                                              int scaler_index,
+                                              unsigned int sites_to_alloc)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int k = repeats_class(repeats, sites_to_alloc);
+  unsigned int sites = repeats->class_sites[k];
+
+  if (partition->clv[parent] &&
+      sites == repeats->pernode_allocated_clvs[parent])
+    return;
+
+  release_clv(partition, parent);
+  partition->clv[parent] = acquire_clv(partition, k);
+  if (!partition->clv[parent])
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for repeats structure.");
+    return;
+  }
+  repeats->pernode_allocated_clvs[parent] = sites;
+
+  // reallocate scales
+  if (PLL_SCALE_BUFFER_NONE != scaler_index)
+  {
+    unsigned int scaler_size = sites;
+    if (partition->attributes & PLL_ATTRIB_RATE_SCALERS)
+      scaler_size *= partition->rate_cats;
+    free(partition->scale_buffer[scaler_index]);
+    partition->scale_buffer[scaler_index] = calloc(scaler_size,
+        sizeof(unsigned int));
+  }
+  // reallocate id to site lookup
+  free(repeats->pernode_id_site[parent]);
+  repeats->pernode_id_site[parent] = malloc(sites * sizeof(unsigned int));
+}
+
+/* frees the pooled CLVs */
+PLL_EXPORT void pll_repeats_clear_pool(pll_partition_t * partition)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  size_t site_bytes = clv_site_bytes(partition);
+  unsigned int k;
+
+  if (!repeats || !repeats->pool)
+    return;
+
+  for (k = 0; k < repeats->class_count; ++k)
+  {
+    size_t bytes = repeats->class_sites[k] * site_bytes;
+
+    while (repeats->pool[k])
+    {
+      pll_aligned_free(pool_pop(repeats, k, bytes));
+      repeats->clv_bytes -= bytes;
+    }
+  }
+}
+
+/* Limits the memory held by the repeats CLVs of inner nodes to budget bytes,
+ * or removes the limit if budget is 0. Released CLVs are pooled by size
+ * class for reuse by other nodes, and freed whenever a new CLV would exceed
+ * the budget. Nodes are computed with repeats whenever a CLV for all sites
+ * would exceed the budget, which can then only be exceeded by the CLVs in
+ * use.
+ */
+PLL_EXPORT int pll_repeats_set_budget(pll_partition_t * partition,
+                                      size_t budget)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int sites;
+  unsigned int i;
+
+  if (!pll_repeats_enabled(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Site repeats are not enabled.");
+    return PLL_FAILURE;
+  }
+
+  pll_repeats_clear_pool(partition);
+
+  if (!budget)
+  {
+    if (repeats->reallocate_repeats == pll_budget_reallocate_repeats)
+      repeats->reallocate_repeats = pll_default_reallocate_repeats;
+    if (repeats->enable_repeats == pll_budget_enable_repeats)
+      repeats->enable_repeats = repeats->unbudgeted_enable_repeats;
+    repeats->budget = 0;
+    return PLL_SUCCESS;
+  }
+
+  if (!repeats->class_sites)
+  {
+    /* four size classes per halving of the number of sites */
+    sites = partition->sites + (partition->asc_bias_alloc ?
+                                  partition->states : 0);
+    repeats->class_sites = (unsigned int *)malloc(
+                                  (4 * 33 + 1) * sizeof(unsigned int));
+    repeats->pool = (double **)calloc(4 * 33 + 1, sizeof(double *));
+    if (!repeats->class_sites || !repeats->pool)
+    {
+      free(repeats->class_sites);
+      free(repeats->pool);
+      repeats->class_sites = NULL;
+      repeats->pool = NULL;
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate memory for CLV pool.");
+      return PLL_FAILURE;
+    }
+
+    repeats->class_count = 0;
+    while (sites > 1)
+    {
+      repeats->class_sites[repeats->class_count++] = sites;
+      sites = PLL_MIN(sites - 1, (unsigned int)ceil(sites * 0.8408964));
+    }
+    repeats->class_sites[repeats->class_count++] = 1;
+  }
+
+  /* account for the CLVs allocated so far */
+  repeats->clv_bytes = 0;
+  for (i = partition->tips; i < partition->tips + partition->clv_buffers; ++i)
+    if (partition->clv[i])
+      repeats->clv_bytes += repeats->pernode_allocated_clvs[i] *
+                            clv_site_bytes(partition);
+
+  repeats->budget = budget;
+  repeats->reallocate_repeats = pll_budget_reallocate_repeats;
+  if (repeats->enable_repeats != pll_budget_enable_repeats)
+  {
+    repeats->unbudgeted_enable_repeats = repeats->enable_repeats;
+    repeats->enable_repeats = pll_budget_enable_repeats;
+  }
+
+  return PLL_SUCCESS;
+}
+
 /* Fill the repeat structure in partition for the parent node of op */
 PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
                     const pll_operation_t * op) 
 {
-  if (!partition->repeats->lookup_buffer)
-    pll_resize_repeats_lookup(partition, PLL_REPEATS_LOOKUP_SIZE);
-  
   pll_repeats_t * repeats = partition->repeats;
   unsigned int left = op->child1_clv_index;
   unsigned int right = op->child2_clv_index;
@@ -319,6 +811,7 @@ PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
   unsigned int sites_to_alloc;
   unsigned int s;
   unsigned int ids = 0;
+  int dense = 0;
   // in case site repeats is activated but not used for this node
   if (!partition->repeats->enable_repeats(partition, left, right))
   {
@@ -329,22 +822,62 @@ PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
   } 
   else
   {
+    // pairs of few identifiers are indexed directly in a dense buffer,
+    // sized by the number of sites unless set by pll_resize_repeats_lookup
+    if (!repeats->lookup_buffer)
+      pll_resize_repeats_lookup(partition,
+                                PLL_MIN(PLL_REPEATS_LOOKUP_SIZE,
+                                        PLL_REPEATS_DENSE_FACTOR *
+                                          partition->sites));
+    dense = repeats->lookup_buffer &&
+      (unsigned long long)ids_left * repeats->pernode_ids[right] <
+      repeats->lookup_buffer_size;
+
     // fill the parent repeats identifiers
-    for (s = 0; s < partition->sites; ++s) 
+    if (dense)
     {
-      unsigned int index_lookup = site_id_left[s] +
-        site_id_right[s] * ids_left;
-      unsigned int id = repeats->lookup_buffer[index_lookup];
-      if (EMPTY_ELEMENT == id) 
+      for (s = 0; s < partition->sites; ++s) 
       {
-        toclean_buffer[curr_id] = index_lookup;
-        id_site_buffer[curr_id] = s;
-        id = curr_id;
-        repeats->lookup_buffer[index_lookup] = curr_id++;
+        unsigned int index_lookup = site_id_left[s] +
+          site_id_right[s] * ids_left;
+        unsigned int id = repeats->lookup_buffer[index_lookup];
+        if (EMPTY_ELEMENT == id) 
+        {
+          toclean_buffer[curr_id] = index_lookup;
+          id_site_buffer[curr_id] = s;
+          id = curr_id;
+          repeats->lookup_buffer[index_lookup] = curr_id++;
+        }
+        site_id_parent[s] = id;
+      }
+    }
+    else
+    {
+      // only use as many slots as the number of classes can fill
+      unsigned long long max_ids = PLL_MIN((unsigned long long)ids_left *
+                                             repeats->pernode_ids[right],
+                                           partition->sites);
+      unsigned int mask = repeats->hash_mask;
+      while (mask && mask + 1 >= 4 * max_ids)
+        mask >>= 1;
+
+      for (s = 0; s < partition->sites; ++s) 
+      {
+        unsigned long long key = site_id_left[s] |
+          ((unsigned long long)site_id_right[s] << 32);
+        unsigned int slot = hash_slot(repeats, mask, key);
+        if (EMPTY_KEY == repeats->hash_keys[slot]) 
+        {
+          toclean_buffer[curr_id] = slot;
+          id_site_buffer[curr_id] = s;
+          repeats->hash_keys[slot] = key;
+          repeats->hash_ids[slot] = curr_id++;
+        }
+        site_id_parent[s] = repeats->hash_ids[slot];
       }
-      site_id_parent[s] = id;
     }
     ids = curr_id;
+
     for (s = 0; s < additional_sites; ++s) 
     {
       site_id_parent[s + partition->sites] = ids + s;
@@ -372,7 +905,10 @@ PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
   for (s = 0; s < ids; ++s) 
   {
     id_site[parent][s] = id_site_buffer[s];
-    repeats->lookup_buffer[toclean_buffer[s]] = EMPTY_ELEMENT;
+    if (dense)
+      repeats->lookup_buffer[toclean_buffer[s]] = EMPTY_ELEMENT;
+    else
+      repeats->hash_keys[toclean_buffer[s]] = EMPTY_KEY;
   }
   for (s = 0; s < additional_sites; ++s) 
   {
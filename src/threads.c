@@ -0,0 +1,463 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+#include "pll.h"
+
+/* Persistent pool of worker threads used by partitions created with
+   PLL_ATTRIB_THREADS. A job is executed by all threads of the pool, the
+   calling thread taking the role of thread 0, and each thread processes its
+   own range of sites. Since the CLVs of a site only depend on the CLVs of the
+   same site in the child nodes, a thread can process a whole list of
+   operations on its range without synchronizing with the other threads. */
+
+/* the number of sites assigned to a thread is a multiple of SITE_BLOCK, such
+   that each range of CLV, scaler and sumtable entries keeps the alignment of
+   the buffer it belongs to */
+#define SITE_BLOCK 16
+
+typedef struct pll_thread_s
+{
+  struct pll_threadpool * pool;
+  unsigned int tid;
+  pthread_t thread;
+} pll_thread_t;
+
+struct pll_threadpool
+{
+  unsigned int count;         /* number of threads including the caller */
+  pll_thread_t * threads;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t start_cond;
+  pthread_cond_t done_cond;
+  unsigned int generation;    /* incremented for every job */
+  unsigned int pending;       /* workers still running the current job */
+  int shutdown;
+
+  int (*job)(void * data, unsigned int tid, unsigned int count);
+  void * data;
+
+  /* error of the first failing worker, reported to the calling thread */
+  int status;
+  int error;
+  char errmsg[200];
+
+  /* barrier */
+  pthread_mutex_t barrier_mutex;
+  pthread_cond_t barrier_cond;
+  unsigned int barrier_waiting;
+  unsigned int barrier_generation;
+};
+
+static void record_failure(struct pll_threadpool * pool)
+{
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->status == PLL_SUCCESS)
+  {
+    pool->status = PLL_FAILURE;
+    pool->error = pll_errno;
+    memcpy(pool->errmsg, pll_errmsg, 200);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+static void * worker(void * arg)
+{
+  pll_thread_t * self = (pll_thread_t *)arg;
+  struct pll_threadpool * pool = self->pool;
+  unsigned int generation = 0;
+
+  while (1)
+  {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->generation == generation && !pool->shutdown)
+      pthread_cond_wait(&pool->start_cond, &pool->mutex);
+
+    if (pool->shutdown)
+    {
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+    generation = pool->generation;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (pool->job(pool->data, self->tid, pool->count) == PLL_FAILURE)
+      record_failure(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->pending == 0)
+      pthread_cond_signal(&pool->done_cond);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  return NULL;
+}
+
+PLL_EXPORT struct pll_threadpool * pll_threadpool_create(unsigned int count)
+{
+  unsigned int i;
+
+  if (count < 2)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "A thread pool requires at least two threads.");
+    return NULL;
+  }
+
+  struct pll_threadpool * pool = (struct pll_threadpool *)calloc(1,
+                                                sizeof(struct pll_threadpool));
+  if (!pool)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for thread pool.");
+    return NULL;
+  }
+
+  pool->threads = (pll_thread_t *)calloc(count, sizeof(pll_thread_t));
+  if (!pool->threads)
+  {
+    free(pool);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for thread pool.");
+    return NULL;
+  }
+
+  pool->count = count;
+  pool->status = PLL_SUCCESS;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->start_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pthread_mutex_init(&pool->barrier_mutex, NULL);
+  pthread_cond_init(&pool->barrier_cond, NULL);
+
+  /* thread 0 is the caller of pll_threadpool_run() */
+  for (i = 1; i < count; ++i)
+  {
+    pool->threads[i].pool = pool;
+    pool->threads[i].tid = i;
+    if (pthread_create(&pool->threads[i].thread,
+                       NULL,
+                       worker,
+                       pool->threads + i))
+    {
+      pool->count = i;
+      pll_threadpool_destroy(pool);
+      pll_errno = PLL_ERROR_THREAD_CREATE;
+      snprintf(pll_errmsg, 200, "Cannot create worker thread.");
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+PLL_EXPORT void pll_threadpool_destroy(struct pll_threadpool * pool)
+{
+  unsigned int i;
+
+  if (!pool) return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 1; i < pool->count; ++i)
+    pthread_join(pool->threads[i].thread, NULL);
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->start_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_mutex_destroy(&pool->barrier_mutex);
+  pthread_cond_destroy(&pool->barrier_cond);
+
+  free(pool->threads);
+  free(pool);
+}
+
+PLL_EXPORT unsigned int pll_threadpool_size(const struct pll_threadpool * pool)
+{
+  return pool ? pool->count : 1;
+}
+
+/* executes job(data, tid, count) on every thread of the pool and waits until
+   all threads have finished. If a job fails, the error of the first failing
+   thread is reported to the caller */
+PLL_EXPORT int pll_threadpool_run(struct pll_threadpool * pool,
+                                  int (*job)(void * data,
+                                             unsigned int tid,
+                                             unsigned int count),
+                                  void * data)
+{
+  int status;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->job = job;
+  pool->data = data;
+  pool->status = PLL_SUCCESS;
+  pool->pending = pool->count - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (job(data, 0, pool->count) == PLL_FAILURE)
+    record_failure(pool);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->pending)
+    pthread_cond_wait(&pool->done_cond, &pool->mutex);
+  status = pool->status;
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (status == PLL_FAILURE)
+  {
+    pll_errno = pool->error;
+    memcpy(pll_errmsg, pool->errmsg, 200);
+  }
+
+  return status;
+}
+
+/* blocks until all threads of the pool have reached the barrier; must be
+   called by every thread running the current job */
+PLL_EXPORT void pll_threadpool_barrier(struct pll_threadpool * pool)
+{
+  unsigned int generation;
+
+  pthread_mutex_lock(&pool->barrier_mutex);
+  generation = pool->barrier_generation;
+  if (++pool->barrier_waiting == pool->count)
+  {
+    pool->barrier_waiting = 0;
+    pool->barrier_generation++;
+    pthread_cond_broadcast(&pool->barrier_cond);
+  }
+  else
+  {
+    while (generation == pool->barrier_generation)
+      pthread_cond_wait(&pool->barrier_cond, &pool->barrier_mutex);
+  }
+  pthread_mutex_unlock(&pool->barrier_mutex);
+}
+
+/* range of sites [begin,end) processed by thread tid out of count threads */
+PLL_EXPORT void pll_threadpool_sites(unsigned int sites,
+                                     unsigned int tid,
+                                     unsigned int count,
+                                     unsigned int * begin,
+                                     unsigned int * end)
+{
+  unsigned int chunk = (sites + count - 1) / count;
+
+  chunk = (chunk + SITE_BLOCK - 1) / SITE_BLOCK * SITE_BLOCK;
+
+  *begin = PLL_MIN(tid * chunk, sites);
+  *end = PLL_MIN(*begin + chunk, sites);
+}
+
+typedef struct place_job_s
+{
+  const pll_partition_t * partition;
+  char * dst;
+  const char * src;
+  size_t site_size;
+} place_job_t;
+
+static int place_job(void * data, unsigned int tid, unsigned int count)
+{
+  place_job_t * args = (place_job_t *)data;
+  const pll_partition_t * partition = args->partition;
+  unsigned int begin, end;
+
+  /* same split as the computation; the last thread also moves the sites of
+     zero weight that PLL_ATTRIB_SITE_COMPACTION stores after them */
+  pll_threadpool_sites(partition->sites + partition->asc_additional_sites,
+                       tid,
+                       count,
+                       &begin,
+                       &end);
+  if (tid == count - 1)
+    end = partition->alloc_sites + partition->asc_additional_sites;
+
+  if (begin < end)
+    memcpy(args->dst + begin * args->site_size,
+           args->src + begin * args->site_size,
+           (end - begin) * args->site_size);
+
+  return PLL_SUCCESS;
+}
+
+/* moves a site-major buffer to a new buffer whose pages are first touched by
+   the threads that compute the respective sites, such that the operating
+   system places them on the NUMA nodes of these threads */
+static void * place_buffer(const pll_partition_t * partition,
+                           struct pll_threadpool * pool,
+                           void * buffer,
+                           size_t site_size,
+                           int aligned)
+{
+  size_t size = (size_t)(partition->alloc_sites +
+                         partition->asc_additional_sites) * site_size;
+  place_job_t args;
+
+  void * placed = aligned ? pll_aligned_alloc(size, partition->alignment) :
+                           malloc(size);
+  if (!placed)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for NUMA placement.");
+    return NULL;
+  }
+
+  args.partition = partition;
+  args.dst = (char *)placed;
+  args.src = (const char *)buffer;
+  args.site_size = site_size;
+  pll_threadpool_run(pool, place_job, &args);
+
+  return placed;
+}
+
+/* places the CLVs and scale buffers of a partition for the threads of pool.
+   Buffers are moved one at a time, hence at most one additional buffer is
+   allocated at any time. On failure, the buffers moved so far remain valid */
+static int place_partition(pll_partition_t * partition,
+                           struct pll_threadpool * pool)
+{
+  unsigned int i;
+  void * placed;
+  size_t clv_site_size = partition->states_padded * partition->rate_cats *
+                         ((partition->attributes &
+                           PLL_ATTRIB_SINGLE_PRECISION) ?
+                           sizeof(float) : sizeof(double));
+  size_t scaler_site_size = ((partition->attributes &
+                              PLL_ATTRIB_RATE_SCALERS) ?
+                              partition->rate_cats : 1) * sizeof(unsigned int);
+
+  for (i = 0; i < partition->nodes; ++i)
+  {
+    if (!partition->clv[i]) continue;
+
+    placed = place_buffer(partition,
+                          pool,
+                          partition->clv[i],
+                          clv_site_size,
+                          1);
+    if (!placed)
+      return PLL_FAILURE;
+    pll_aligned_free(partition->clv[i]);
+    partition->clv[i] = (double *)placed;
+  }
+
+  /* scale buffers are not aligned (see alloc_buffers in pll.c) */
+  for (i = 0; i < partition->scale_buffers; ++i)
+  {
+    if (!partition->scale_buffer[i]) continue;
+
+    placed = place_buffer(partition,
+                          pool,
+                          partition->scale_buffer[i],
+                          scaler_site_size,
+                          0);
+    if (!placed)
+      return PLL_FAILURE;
+    free(partition->scale_buffer[i]);
+    partition->scale_buffer[i] = (unsigned int *)placed;
+  }
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_set_threads(pll_partition_t * partition,
+                               unsigned int count)
+{
+  struct pll_threadpool * pool = NULL;
+
+  if (!count)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Number of threads must be positive.");
+    return PLL_FAILURE;
+  }
+
+  if (count > 1)
+  {
+    pool = pll_threadpool_create(count);
+    if (!pool)
+      return PLL_FAILURE;
+
+    if ((partition->attributes & PLL_ATTRIB_NUMA) &&
+        !place_partition(partition, pool))
+    {
+      pll_threadpool_destroy(pool);
+      return PLL_FAILURE;
+    }
+  }
+
+  pll_threadpool_destroy(partition->threadpool);
+  partition->threadpool = pool;
+
+  return PLL_SUCCESS;
+}
+
+/* places the buffers of a PLL_ATTRIB_NUMA partition again for its thread
+   pool, e.g. after site compaction changed the sites computed by each
+   thread */
+PLL_EXPORT int pll_place_threads(pll_partition_t * partition)
+{
+  if (!(partition->attributes & PLL_ATTRIB_NUMA) || !partition->threadpool)
+    return PLL_SUCCESS;
+
+  return place_partition(partition, partition->threadpool);
+}
+
+PLL_EXPORT unsigned int pll_get_threads(const pll_partition_t * partition)
+{
+  return pll_threadpool_size(partition->threadpool);
+}
+
+/* range of sites [begin,end) computed by thread tid of the partition, which
+   includes the additional sites of the ascertainment bias correction */
+PLL_EXPORT void pll_get_thread_sites(const pll_partition_t * partition,
+                                     unsigned int tid,
+                                     unsigned int * begin,
+                                     unsigned int * end)
+{
+  pll_threadpool_sites(partition->sites + partition->asc_additional_sites,
+                       tid,
+                       pll_threadpool_size(partition->threadpool),
+                       begin,
+                       end);
+}
+
+/* number of threads used for partitions created with PLL_ATTRIB_THREADS */
+PLL_EXPORT unsigned int pll_default_threads(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cpus > 0)
+    return (unsigned int)cpus;
+#endif
+  return 1;
+}
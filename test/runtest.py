@@ -42,7 +42,7 @@ import time
 #####################
 do_memtest       =  1                 # Evaluate memory leaks
 num_replicates   = 20                 # Number of samples for the speed test
-all_args         = [18,16,20,24,0,1,2,3,4,5,8,9]
+all_args         = [18,16,20,24,48,0,1,2,3,4,5,8,9,32,33]
                                       # 0: No vector / No tip pattern
                                       # 1: No vector / Tip pattern
                                       # 2: AVX / No tip pattern
@@ -55,6 +55,9 @@ all_args         = [18,16,20,24,0,1,2,3,4,5,8,9]
                                       #18: AVX / repeats
                                       #20: SSE / repeats
                                       #24: AVX2 / repeats
+                                      #32: AVX512 / No tip pattern
+                                      #33: AVX512 / Tip pattern
+                                      #48: AVX512 / repeats
 #####################
 
 colors={"default":"",
@@ -169,6 +172,10 @@ def runSpeedTest(files):
           attrib += " avx2"
           attribstr += " AVX2"
           typestr   += "F"
+      elif (args & 32):
+          attrib += " avx512"
+          attribstr += " AVX512"
+          typestr   += "Z"
       if (args & 16):
           attrib    += " sr"
           attribstr += " Site repeats"
@@ -301,6 +308,10 @@ def runValidation(files):
           attrib    += " avx2"
           attribstr += " AVX2"
           typestr   += "F"
+      elif (args & 32):
+          attrib    += " avx512"
+          attribstr += " AVX512"
+          typestr   += "Z"
       if (args & 16):
           attrib    += " sr"
           attribstr += "Site repeats"
@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    arena.c
+
+    This test compares partitions allocated in a single arena
+    (PLL_ATTRIB_ARENA and PLL_ATTRIB_ARENA_HUGEPAGES) with a partition whose
+    buffers are allocated separately, and checks that pll_partition_clone
+    returns an independent deep copy. The arena does not support site
+    repeats, which are dropped from the attributes of all partitions.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 45
+#define N_TIPS 6
+#define N_INNER 4
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+static unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  set_related_tips(partition, N_SITES, 12, "ACGTACGTN-", 29);
+  pll_update_invariant_sites_proportion(partition, 0, 0.1);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+static double loglikelihood(pll_partition_t * partition)
+{
+  pll_update_partials(partition, operations, N_INNER);
+
+  return pll_compute_edge_loglikelihood(partition, 8, 2, 9, 3, 1,
+                                        params_indices, NULL);
+}
+
+static const char * compare_clvs(const pll_partition_t * a,
+                                 const pll_partition_t * b)
+{
+  unsigned int i;
+
+  for (i = N_TIPS; i < N_TIPS + N_INNER; ++i)
+    if (memcmp(a->clv[i], b->clv[i], pll_get_clv_size(a, i)))
+      return "MISMATCH";
+
+  return "identical";
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int parents[N_INNER]    = { 6, 7, 8, 9 };
+  unsigned int children[2*N_INNER] = { 0, 1, 2, 3, 6, 7, 4, 5 };
+  double other_lengths[N_MATRICES] = { 0.5, 0.5, 0.5, 0.5 };
+  unsigned int attributes = get_attributes(argc, argv) &
+                            ~PLL_ATTRIB_SITE_REPEATS;
+
+  /* ((0,1)6,(2,3)7)8 and (4,5)9, evaluated at the edge 8-9 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % N_MATRICES;
+    operations[i].child2_matrix_index = c2 % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  pll_partition_t * plain = create(attributes);
+  pll_partition_t * arena = create(attributes | PLL_ATTRIB_ARENA);
+  pll_partition_t * huge = create(attributes | PLL_ATTRIB_ARENA_HUGEPAGES);
+
+  double logl_plain = loglikelihood(plain);
+  double logl_arena = loglikelihood(arena);
+  double logl_huge = loglikelihood(huge);
+
+  printf("arena: %s, huge pages: %s\n",
+         arena->arena ? "yes" : "no",
+         huge->arena ? "yes" : "no");
+  printf("logL: %.6f arena: %.6f %s huge pages: %.6f %s\n",
+         logl_plain,
+         logl_arena,
+         logl_arena == logl_plain ? "OK" : "MISMATCH",
+         logl_huge,
+         logl_huge == logl_plain ? "OK" : "MISMATCH");
+  printf("CLVs: arena %s, huge pages %s\n",
+         compare_clvs(plain, arena),
+         compare_clvs(plain, huge));
+
+  /* the clone keeps its CLVs and p-matrices when the original changes */
+  pll_partition_t * clone = pll_partition_clone(arena);
+  if (!clone)
+    fatal("Fail cloning partition: %s\n", pll_errmsg);
+  printf("clone CLVs: %s\n", compare_clvs(arena, clone));
+
+  pll_update_prob_matrices(arena,
+                           params_indices,
+                           matrix_indices,
+                           other_lengths,
+                           N_MATRICES);
+  double logl_changed = loglikelihood(arena);
+  pll_partition_destroy(arena);
+
+  double logl_clone = pll_compute_edge_loglikelihood(clone, 8, 2, 9, 3, 1,
+                                                     params_indices, NULL);
+  printf("changed original logL: %.6f clone logL: %.6f %s\n",
+         logl_changed,
+         logl_clone,
+         logl_clone == logl_plain ? "OK" : "MISMATCH");
+  logl_clone = loglikelihood(clone);
+  printf("clone recomputed logL: %.6f %s\n",
+         logl_clone,
+         logl_clone == logl_plain ? "OK" : "MISMATCH");
+
+  /* only arena partitions can be cloned */
+  pll_errno = 0;
+  pll_partition_t * failed = pll_partition_clone(plain);
+  printf("clone without arena: %s (%s)\n",
+         failed ? "success" : "failure",
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                "no error");
+
+  pll_partition_destroy(plain);
+  pll_partition_destroy(huge);
+  pll_partition_destroy(clone);
+
+  return (0);
+}
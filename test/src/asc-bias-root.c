@@ -0,0 +1,141 @@
+/*
+ Copyright (C) 2015 Diego Darriba
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+/*
+    asc-bias-root.c
+
+    This test evaluates the ascertainment bias correction of the root
+    log-likelihood. On the rooted tree ((0,1),(2,3)) the root log-likelihood
+    must be equal to the log-likelihood of the edge between the two children
+    of the root, whose length is the sum of their branch lengths. The number
+    of rate categories (6) differs from the number of states, such that the
+    ascertainment bias sites of the root CLV are found only when they are
+    offset by the number of states.
+ */
+#include "common.h"
+
+#define STATES 4
+#define RATE_CATS 6
+#define N_SITES 10
+#define N_TIPS 4
+
+static double frequencies[4]  = { 0.1, 0.2, 0.3, 0.4 };
+static double subst_params[6] = { 1, 5, 1, 1, 5, 1 };
+static unsigned int params_indices[RATE_CATS] = {0};
+static unsigned int invar_weights[STATES] = { 50, 40, 60, 20 };
+
+static const char * sequences[N_TIPS] = { "ACGTACGTAC",
+                                          "ACCTAGGTTC",
+                                          "TCGAACGTAA",
+                                          "GCGTTCATAC" };
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, t;
+  unsigned int attributes = get_attributes(argc, argv);
+  unsigned int asc_types[3] = { PLL_ATTRIB_AB_LEWIS,
+                                PLL_ATTRIB_AB_FELSENSTEIN,
+                                PLL_ATTRIB_AB_STAMATAKIS };
+  const char * asc_names[3] = { "Lewis", "Felsenstein", "Stamatakis" };
+  unsigned int matrix_indices[4] = { 0, 1, 2, 3 };
+  double branch_lengths[4] = { 0.1, 0.2, 0.15, 0.3 };
+  double root_branches[3] = { 0.25, 0.35, 0.6 };
+  unsigned int root_matrices[3] = { 4, 5, 6 };
+  double rate_cats[RATE_CATS];
+  pll_operation_t operations[3];
+
+  /* ((0,1)4,(2,3)5)6 */
+  for (i = 0; i < 3; ++i)
+  {
+    operations[i].parent_clv_index    = N_TIPS + i;
+    operations[i].child1_clv_index    = 2*i;
+    operations[i].child2_clv_index    = 2*i + 1;
+    operations[i].child1_matrix_index = 2*i;
+    operations[i].child2_matrix_index = 2*i + 1;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = i < 2 ? PLL_SCALE_BUFFER_NONE : 0;
+    operations[i].child2_scaler_index = i < 2 ? PLL_SCALE_BUFFER_NONE : 1;
+  }
+
+  pll_compute_gamma_cats(0.5, RATE_CATS, rate_cats, PLL_GAMMA_RATES_MEAN);
+
+  for (t = 0; t < 3; ++t)
+  {
+    pll_partition_t * partition = pll_partition_create(N_TIPS,
+                                                       3,
+                                                       STATES,
+                                                       N_SITES,
+                                                       1,
+                                                       7,
+                                                       RATE_CATS,
+                                                       3,
+                                                       attributes |
+                                                         asc_types[t]);
+    if (!partition)
+      fatal("Fail creating partition: %s\n", pll_errmsg);
+
+    pll_set_frequencies(partition, 0, frequencies);
+    pll_set_subst_params(partition, 0, subst_params);
+    pll_set_category_rates(partition, rate_cats);
+    if (asc_types[t] == PLL_ATTRIB_AB_STAMATAKIS)
+      pll_set_asc_state_weights(partition, invar_weights);
+
+    for (i = 0; i < N_TIPS; ++i)
+      pll_set_tip_states(partition, i, pll_map_nt, sequences[i]);
+
+    pll_update_prob_matrices(partition,
+                             params_indices,
+                             matrix_indices,
+                             branch_lengths,
+                             4);
+    pll_update_prob_matrices(partition,
+                             params_indices,
+                             root_matrices,
+                             root_branches,
+                             3);
+
+    pll_update_partials(partition, operations, 3);
+
+    double root_logl = pll_compute_root_loglikelihood(partition,
+                                                      6,
+                                                      2,
+                                                      params_indices,
+                                                      NULL);
+    double edge_logl = pll_compute_edge_loglikelihood(partition,
+                                                      4,
+                                                      0,
+                                                      5,
+                                                      1,
+                                                      6,
+                                                      params_indices,
+                                                      NULL);
+
+    printf("%-12s root logL: %.6f edge logL: %.6f %s\n",
+           asc_names[t],
+           root_logl,
+           edge_logl,
+           fabs(root_logl - edge_logl) < 1e-6 ? "OK" : "MISMATCH");
+
+    pll_partition_destroy(partition);
+  }
+
+  return (0);
+}
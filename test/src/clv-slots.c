@@ -0,0 +1,212 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    clv-slots.c
+
+    This test evaluates PLL_ATTRIB_LIMIT_MEMORY on trees of 64 tips, whose 62
+    inner CLVs do not fit in the default ceil(log2(64)) + 4 = 10 slots. The
+    log-likelihoods of a caterpillar and a balanced tree must be equal to
+    those computed with all CLVs in memory, also after the CLVs have been
+    evicted and recomputed. An update that cannot get a slot must fail with
+    PLL_ERROR_CLV_UNAVAILABLE and leave its parent CLV unusable.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 30
+#define N_TIPS 64
+#define N_INNER (N_TIPS - 2)
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    0,
+                                                    0.5,
+                                                    attributes);
+
+  /* related sequences: each tip mutates some sites of the previous one */
+  set_related_tips(partition, N_SITES, 3, "ACGT-", 42);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+static void set_operation(pll_operation_t * op,
+                          unsigned int parent,
+                          unsigned int child1,
+                          unsigned int child2)
+{
+  op->parent_clv_index    = parent;
+  op->child1_clv_index    = child1;
+  op->child2_clv_index    = child2;
+  op->child1_matrix_index = child1 % N_MATRICES;
+  op->child2_matrix_index = child2 % N_MATRICES;
+  op->parent_scaler_index = PLL_SCALE_BUFFER_NONE;
+  op->child1_scaler_index = PLL_SCALE_BUFFER_NONE;
+  op->child2_scaler_index = PLL_SCALE_BUFFER_NONE;
+}
+
+static double edge_loglikelihood(pll_partition_t * partition,
+                                 unsigned int clv1,
+                                 unsigned int clv2)
+{
+  return pll_compute_edge_loglikelihood(partition,
+                                        clv1,
+                                        PLL_SCALE_BUFFER_NONE,
+                                        clv2,
+                                        PLL_SCALE_BUFFER_NONE,
+                                        0,
+                                        params_indices,
+                                        NULL);
+}
+
+static const char * compare(double a, double b)
+{
+  return fabs(a - b) < 1e-9 ? "OK" : "MISMATCH";
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, level, count;
+  unsigned int first, next;
+  unsigned int pinned[2] = { 124, 125 };
+  size_t clv_size;
+  int retval;
+  double logl_full, logl_limited;
+  pll_operation_t operations[N_INNER];
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* site repeats cannot be combined with PLL_ATTRIB_LIMIT_MEMORY */
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  pll_partition_t * full = create(attributes);
+  pll_partition_t * limited = create(attributes | PLL_ATTRIB_LIMIT_MEMORY);
+
+  printf("default slots: %u\n", pll_get_clv_slots(limited));
+
+  /* caterpillar: (((0,1)64,2)65,3)66 ... 125, evaluated at the edge 125-63 */
+  set_operation(operations, N_TIPS, 0, 1);
+  for (i = 1; i < N_INNER; ++i)
+    set_operation(operations + i, N_TIPS + i, N_TIPS + i - 1, i + 1);
+
+  if (!pll_update_partials(full, operations, N_INNER) ||
+      !pll_update_partials(limited, operations, N_INNER))
+    fatal("Fail updating partials: %s\n", pll_errmsg);
+
+  logl_full = edge_loglikelihood(full, N_TIPS + N_INNER - 1, N_TIPS - 1);
+  logl_limited = edge_loglikelihood(limited, N_TIPS + N_INNER - 1, N_TIPS - 1);
+  printf("caterpillar logL: %.6f limited: %.6f %s\n",
+         logl_full, logl_limited, compare(logl_full, logl_limited));
+
+  /* the CLV of node 70 was evicted and is recomputed from its subtree */
+  i = 70;
+  printf("caterpillar CLV %u resident: %s\n", i, limited->clv[i] ? "yes" : "no");
+  if (!pll_clv_require(limited, &i, 1))
+    fatal("Fail recomputing CLV: %s\n", pll_errmsg);
+  clv_size = pll_get_clv_size(limited, i);
+  printf("caterpillar CLV %u recomputed: %s\n",
+         i,
+         memcmp(limited->clv[i], full->clv[i], clv_size) ? "MISMATCH" : "OK");
+  pll_clv_release(limited, &i, 1);
+
+  /* balanced tree: level 1 holds the nodes 64-95, level 2 96-111, ..., and
+     level 5 the nodes 124 and 125, evaluated at the edge 124-125 */
+  count = 0;
+  first = 0;
+  next = N_TIPS;
+  for (level = N_TIPS / 2; level >= 2; level /= 2)
+  {
+    for (i = 0; i < level; ++i)
+    {
+      set_operation(operations + count, next + i, first + 2*i, first + 2*i+1);
+      ++count;
+    }
+    first = next;
+    next += level;
+  }
+
+  if (!pll_update_partials(full, operations, count) ||
+      !pll_update_partials(limited, operations, count))
+    fatal("Fail updating partials: %s\n", pll_errmsg);
+
+  logl_full = edge_loglikelihood(full, 124, 125);
+  logl_limited = edge_loglikelihood(limited, 124, 125);
+  printf("balanced logL: %.6f limited: %.6f %s\n",
+         logl_full, logl_limited, compare(logl_full, logl_limited));
+
+  /* evict all but 3 CLVs, then recompute the subtrees of 32 tips */
+  if (!pll_set_clv_slots(limited, 3) ||
+      !pll_set_clv_slots(limited, 10))
+    fatal("Fail setting CLV slots: %s\n", pll_errmsg);
+  logl_limited = edge_loglikelihood(limited, 112, 113);
+  logl_full = edge_loglikelihood(full, 112, 113);
+  printf("balanced logL after eviction: %.6f limited: %.6f %s\n",
+         logl_full, logl_limited, compare(logl_full, logl_limited));
+
+  /* with 2 of 4 slots pinned, the children of node 112 (subtrees of 4 tips)
+     cannot be recomputed */
+  if (!pll_set_clv_slots(limited, 4) ||
+      !pll_clv_require(limited, pinned, 2))
+    fatal("Fail pinning CLVs: %s\n", pll_errmsg);
+  pll_errno = 0;
+  set_operation(operations, 112, 96, 97);
+  retval = pll_update_partials(limited, operations, 1);
+  printf("update with 2 free slots: %s (%s)\n",
+         retval ? "success" : "failure",
+         pll_errno == PLL_ERROR_CLV_UNAVAILABLE ? "CLV unavailable" : "no error");
+  pll_clv_release(limited, pinned, 2);
+
+  /* the CLV of node 112 must not be used until it is updated again */
+  pll_errno = 0;
+  logl_limited = edge_loglikelihood(limited, 112, 113);
+  printf("logL of the failed CLV: %f (%s)\n",
+         logl_limited,
+         pll_errno == PLL_ERROR_CLV_UNAVAILABLE ? "CLV unavailable" : "no error");
+
+  if (!pll_set_clv_slots(limited, 10) ||
+      !pll_update_partials(limited, operations, 1))
+    fatal("Fail updating partials: %s\n", pll_errmsg);
+  logl_limited = edge_loglikelihood(limited, 112, 113);
+  printf("logL after the update: %.6f limited: %.6f %s\n",
+         logl_full, logl_limited, compare(logl_full, logl_limited));
+
+  pll_partition_destroy(full);
+  pll_partition_destroy(limited);
+
+  return (0);
+}
@@ -51,6 +51,11 @@ unsigned int get_attributes(int argc, char **argv)
       /* avx2 vectorization */
       attributes |= PLL_ATTRIB_ARCH_AVX2;
     }
+    else if (!strcmp (argv[i], "avx512"))
+    {
+      /* avx512 vectorization */
+      attributes |= PLL_ATTRIB_ARCH_AVX512;
+    }
     else
     {
       printf("Unrecognised attribute: %s\n", argv[i]);
@@ -202,6 +207,113 @@ pll_partition_t * parse_msa_reduced(const char * filename,
   return partition;
 }
 
+/* model of the tests with generated data */
+const double test_frequencies_nt[4] = { 0.3, 0.4, 0.1, 0.2 };
+const double test_subst_params_nt[6] = { 1, 2.5, 1, 1, 2.5, 1 };
+
+unsigned int next_random(unsigned int * seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed;
+}
+
+/* create a nucleotide partition with a single rate matrix set to the test
+   model and gamma-distributed rates with shape alpha */
+pll_partition_t * create_nt_partition(unsigned int tips,
+                                      unsigned int clv_buffers,
+                                      unsigned int sites,
+                                      unsigned int prob_matrices,
+                                      unsigned int rate_cats,
+                                      unsigned int scale_buffers,
+                                      double alpha,
+                                      unsigned int attributes)
+{
+  pll_partition_t * partition = pll_partition_create(tips,
+                                                     clv_buffers,
+                                                     4,
+                                                     sites,
+                                                     1,
+                                                     prob_matrices,
+                                                     rate_cats,
+                                                     scale_buffers,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  double * rates = (double *)xmalloc(rate_cats * sizeof(double));
+  pll_compute_gamma_cats(alpha, rate_cats, rates, PLL_GAMMA_RATES_MEAN);
+  pll_set_frequencies(partition, 0, test_frequencies_nt);
+  pll_set_subst_params(partition, 0, test_subst_params_nt);
+  pll_set_category_rates(partition, rates);
+  free(rates);
+
+  return partition;
+}
+
+/* replace count random sites of seq by random characters of alphabet */
+void mutate_sequence(char * seq,
+                     unsigned int sites,
+                     unsigned int count,
+                     const char * alphabet,
+                     unsigned int * seed)
+{
+  unsigned int i;
+  unsigned int len = strlen(alphabet);
+
+  for (i = 0; i < count; ++i)
+  {
+    next_random(seed);
+    seq[(*seed >> 16) % sites] = alphabet[(*seed >> 8) % len];
+  }
+}
+
+/* set related nucleotide sequences: starting from ACGTACGT..., each tip
+   mutates count sites of the previous one */
+void set_related_tips(pll_partition_t * partition,
+                      unsigned int sites,
+                      unsigned int count,
+                      const char * alphabet,
+                      unsigned int seed)
+{
+  unsigned int i, j;
+  char * seq = (char *)xmalloc(sites + 1);
+
+  for (j = 0; j < sites; ++j)
+    seq[j] = "ACGT"[j % 4];
+  seq[sites] = 0;
+
+  for (i = 0; i < partition->tips; ++i)
+  {
+    mutate_sequence(seq, sites, count, alphabet, &seed);
+    pll_set_tip_states(partition, i, pll_map_nt, seq);
+  }
+
+  free(seq);
+}
+
+/* set nucleotide sequences whose sites are copies of the given number of
+   random columns, for site repeats */
+void set_repeated_tips(pll_partition_t * partition,
+                       unsigned int sites,
+                       unsigned int patterns)
+{
+  unsigned int i, j;
+  char * seq = (char *)xmalloc(sites + 1);
+
+  seq[sites] = 0;
+  for (i = 0; i < partition->tips; ++i)
+  {
+    for (j = 0; j < sites; ++j)
+    {
+      unsigned int seed = ((j * 2654435761u) >> 8) % patterns * 131 + i;
+      seq[j] = "ACGTACGTACGTN-"[(next_random(&seed) >> 16) % 14];
+    }
+    pll_set_tip_states(partition, i, pll_map_nt, seq);
+  }
+
+  free(seq);
+}
+
 int cb_full_traversal(pll_unode_t * node)
 {
   return 1;
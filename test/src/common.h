@@ -45,6 +45,33 @@ pll_partition_t * parse_msa_reduced(const char * filename,
                             pll_utree_t * tree,
                             unsigned int attributes,
                             unsigned int max_sites);
+/* generated test data */
+extern const double test_frequencies_nt[4];
+extern const double test_subst_params_nt[6];
+
+unsigned int next_random(unsigned int * seed);
+pll_partition_t * create_nt_partition(unsigned int tips,
+                                      unsigned int clv_buffers,
+                                      unsigned int sites,
+                                      unsigned int prob_matrices,
+                                      unsigned int rate_cats,
+                                      unsigned int scale_buffers,
+                                      double alpha,
+                                      unsigned int attributes);
+void mutate_sequence(char * seq,
+                     unsigned int sites,
+                     unsigned int count,
+                     const char * alphabet,
+                     unsigned int * seed);
+void set_related_tips(pll_partition_t * partition,
+                      unsigned int sites,
+                      unsigned int count,
+                      const char * alphabet,
+                      unsigned int seed);
+void set_repeated_tips(pll_partition_t * partition,
+                       unsigned int sites,
+                       unsigned int patterns);
+
 int cb_full_traversal(pll_unode_t * node);
 int cb_rfull_traversal(pll_rnode_t * node);
 
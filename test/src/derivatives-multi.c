@@ -0,0 +1,178 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    derivatives-multi.c
+
+    This test compares the log-likelihoods and derivatives computed by
+    pll_compute_likelihood_derivatives_multi at several branch lengths with
+    single-point derivatives and with edge log-likelihoods at the same
+    branch lengths, serially and with a thread pool.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 150
+#define N_TIPS 6
+#define N_INNER 4
+#define N_MATRICES 5
+#define N_POINTS 11
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes, double pinv)
+{
+  double branch_lengths[N_MATRICES-1] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES-1] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  set_related_tips(partition, N_SITES, 40, "ACGTACGTN-", 17);
+
+  pll_update_invariant_sites_proportion(partition, 0, pinv);
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES-1);
+  pll_update_partials(partition, operations, N_INNER);
+
+  return partition;
+}
+
+static int near(double a, double b)
+{
+  return fabs(a - b) <= 1e-9 * PLL_MAX(1, fabs(b));
+}
+
+static void test(unsigned int attributes, double pinv, unsigned int threads)
+{
+  unsigned int i;
+  unsigned int matrix_index = N_MATRICES - 1;
+  double branch_lengths[N_POINTS];
+  double logl[N_POINTS], d_f[N_POINTS], dd_f[N_POINTS];
+  int ok_logl = 1;
+  int ok_derivatives = 1;
+
+  pll_partition_t * partition = create(attributes, pinv);
+  if (!pll_set_threads(partition, threads))
+    fatal("Fail setting threads: %s\n", pll_errmsg);
+
+  double * sumtable = pll_aligned_alloc(
+    partition->sites * partition->rate_cats * partition->states_padded *
+    sizeof(double), partition->alignment);
+  if (!sumtable)
+    fatal("Fail creating sumtable\n");
+
+  for (i = 0; i < N_POINTS; ++i)
+    branch_lengths[i] = 0.001 + 0.07 * i * i;
+
+  pll_update_sumtable(partition, 8, 9, 2, 3, params_indices, sumtable);
+  if (!pll_compute_likelihood_derivatives_multi(partition, 8, 9, 2, 3,
+                                                N_POINTS,
+                                                branch_lengths,
+                                                params_indices,
+                                                sumtable,
+                                                logl,
+                                                d_f,
+                                                dd_f))
+    fatal("Fail computing derivatives: %s\n", pll_errmsg);
+
+  for (i = 0; i < N_POINTS; ++i)
+  {
+    double single_d_f, single_dd_f;
+
+    pll_compute_likelihood_derivatives(partition, 2, 3,
+                                       branch_lengths[i],
+                                       params_indices,
+                                       sumtable,
+                                       &single_d_f,
+                                       &single_dd_f);
+    if (!near(d_f[i], single_d_f) || !near(dd_f[i], single_dd_f))
+      ok_derivatives = 0;
+
+    pll_update_prob_matrices(partition,
+                             params_indices,
+                             &matrix_index,
+                             branch_lengths + i,
+                             1);
+    if (!near(logl[i],
+               pll_compute_edge_loglikelihood(partition, 8, 2, 9, 3,
+                                              matrix_index,
+                                              params_indices,
+                                              NULL)))
+      ok_logl = 0;
+  }
+
+  printf("pinv %.1f, %u thread%s: logL at t=%.3f %.6f, derivatives %s, "
+         "logL %s\n",
+         pinv,
+         threads,
+         threads > 1 ? "s" : "",
+         branch_lengths[N_POINTS-1],
+         logl[N_POINTS-1],
+         ok_derivatives ? "OK" : "MISMATCH",
+         ok_logl ? "OK" : "MISMATCH");
+
+  pll_aligned_free(sumtable);
+  pll_partition_destroy(partition);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int parents[N_INNER]    = { 6, 7, 8, 9 };
+  unsigned int children[2*N_INNER] = { 0, 1, 2, 3, 6, 7, 4, 5 };
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* ((0,1)6,(2,3)7)8 and (4,5)9, evaluated at the edge 8-9 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % (N_MATRICES-1);
+    operations[i].child2_matrix_index = c2 % (N_MATRICES-1);
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  test(attributes, 0, 1);
+  test(attributes, 0.2, 1);
+  test(attributes, 0, 3);
+
+  return (0);
+}
@@ -0,0 +1,195 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    derivatives-zero-weights.c
+
+    This test evaluates the likelihood derivatives of an alignment in which
+    some sites have a zero weight, as in bootstrap replicates. The results
+    must be equal to those of the alignment without these sites. The zero
+    weights are mixed with weights of 1 within groups of 4 adjacent sites,
+    which the vectorized kernels process at once.
+ */
+#include "common.h"
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA 4
+#define N_SITES 16
+#define N_TIPS 5
+#define NUM_BRANCHES 4
+
+static double titv = 2.5;
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+static double testbranches[NUM_BRANCHES] = {0.05, 0.2, 0.7, 2.0};
+
+static const char * sequences[N_TIPS] = { "WAACTCGCTAGAATTC",
+                                          "CACCATGCTAGAATTG",
+                                          "AG-C-TGCAGTTCTTC",
+                                          "CGTCTTGCAAACAT-C",
+                                          "CGACTTGCCATTAT-T" };
+
+static unsigned int weights[N_SITES] = { 1, 0, 1, 1,
+                                         0, 1, 1, 1,
+                                         2, 0, 1, 0,
+                                         1, 1, 1, 1 };
+
+static pll_partition_t * create(unsigned int attributes,
+                                unsigned int sites,
+                                const unsigned int * site_list,
+                                const unsigned int * site_weights)
+{
+  unsigned int i,j;
+  double rate_cats[N_CAT_GAMMA];
+  double frequencies[4] = { 0.3, 0.4, 0.1, 0.2 };
+  double subst_params[6] = {1,titv,1,1,titv,1};
+  char seq[N_SITES+1];
+
+  pll_partition_t * partition = pll_partition_create(N_TIPS,
+                                                     3,
+                                                     N_STATES_NT,
+                                                     sites,
+                                                     1,
+                                                     2*N_TIPS-3,
+                                                     N_CAT_GAMMA,
+                                                     0,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  pll_compute_gamma_cats(0.5, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  pll_set_frequencies(partition, 0, frequencies);
+  pll_set_subst_params(partition, 0, subst_params);
+  pll_set_category_rates(partition, rate_cats);
+
+  for (i = 0; i < N_TIPS; ++i)
+  {
+    for (j = 0; j < sites; ++j)
+      seq[j] = sequences[i][site_list[j]];
+    seq[sites] = 0;
+    pll_set_tip_states(partition, i, pll_map_nt, seq);
+  }
+  pll_set_pattern_weights(partition, site_weights);
+
+  return partition;
+}
+
+static void derivatives(pll_partition_t * partition,
+                        const pll_operation_t * operations,
+                        double * d_f,
+                        double * dd_f)
+{
+  unsigned int b;
+  double branch_lengths[4] = { 0.1, 0.2, 0.3, 0.4};
+  unsigned int matrix_indices[4] = { 0, 1, 2, 3 };
+  double * sumtable = pll_aligned_alloc(partition->sites *
+                                          partition->rate_cats *
+                                          partition->states_padded *
+                                          sizeof(double),
+                                        partition->alignment);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           4);
+  pll_update_partials(partition, operations, 3);
+  pll_update_sumtable(partition, 6, 7,
+                      PLL_SCALE_BUFFER_NONE, PLL_SCALE_BUFFER_NONE,
+                      params_indices, sumtable);
+
+  for (b = 0; b < NUM_BRANCHES; ++b)
+    pll_compute_likelihood_derivatives(partition,
+                                       PLL_SCALE_BUFFER_NONE,
+                                       PLL_SCALE_BUFFER_NONE,
+                                       testbranches[b],
+                                       params_indices,
+                                       sumtable,
+                                       d_f + b,
+                                       dd_f + b);
+
+  pll_aligned_free(sumtable);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, b;
+  unsigned int all_sites[N_SITES];
+  unsigned int kept_sites[N_SITES];
+  unsigned int kept_weights[N_SITES];
+  unsigned int kept = 0;
+  double d_f[NUM_BRANCHES], dd_f[NUM_BRANCHES];
+  double ref_d_f[NUM_BRANCHES], ref_dd_f[NUM_BRANCHES];
+  pll_operation_t operations[3];
+  unsigned int attributes = get_attributes(argc, argv);
+
+  for (i = 0; i < 3; ++i)
+  {
+    operations[i].parent_scaler_index = PLL_SCALE_BUFFER_NONE;
+    operations[i].child1_scaler_index = PLL_SCALE_BUFFER_NONE;
+    operations[i].child2_scaler_index = PLL_SCALE_BUFFER_NONE;
+  }
+  operations[0].parent_clv_index    = 5;
+  operations[0].child1_clv_index    = 0;
+  operations[0].child2_clv_index    = 1;
+  operations[0].child1_matrix_index = 1;
+  operations[0].child2_matrix_index = 1;
+  operations[1].parent_clv_index    = 6;
+  operations[1].child1_clv_index    = 5;
+  operations[1].child2_clv_index    = 2;
+  operations[1].child1_matrix_index = 0;
+  operations[1].child2_matrix_index = 1;
+  operations[2].parent_clv_index    = 7;
+  operations[2].child1_clv_index    = 3;
+  operations[2].child2_clv_index    = 4;
+  operations[2].child1_matrix_index = 1;
+  operations[2].child2_matrix_index = 1;
+
+  for (i = 0; i < N_SITES; ++i)
+  {
+    all_sites[i] = i;
+    if (weights[i])
+    {
+      kept_sites[kept] = i;
+      kept_weights[kept++] = weights[i];
+    }
+  }
+
+  pll_partition_t * partition = create(attributes, N_SITES, all_sites, weights);
+  pll_partition_t * reference = create(attributes, kept, kept_sites, kept_weights);
+
+  derivatives(partition, operations, d_f, dd_f);
+  derivatives(reference, operations, ref_d_f, ref_dd_f);
+
+  for (b = 0; b < NUM_BRANCHES; ++b)
+    printf("Branch %5.2f : %12.4e %12.4e  reference %12.4e %12.4e %s\n",
+           testbranches[b],
+           d_f[b],
+           dd_f[b],
+           ref_d_f[b],
+           ref_dd_f[b],
+           fabs(d_f[b] - ref_d_f[b]) < 1e-8 &&
+             fabs(dd_f[b] - ref_dd_f[b]) < 1e-8 ? "OK" : "MISMATCH");
+
+  pll_partition_destroy(partition);
+  pll_partition_destroy(reference);
+
+  return (0);
+}
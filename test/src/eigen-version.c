@@ -0,0 +1,161 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    eigen-version.c
+
+    This test checks that pll_update_eigen skips the decomposition when the
+    substitution parameters and frequencies of a rate matrix are set again to
+    the same values, and that the p-matrices are identical to those of a
+    partition that decomposes the same parameters from scratch.
+ */
+#include "common.h"
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA 4
+#define N_SITES 10
+#define N_RATE_MATRICES 2
+
+static unsigned int attributes;
+
+static double frequencies[2][4] = { { 0.3, 0.4, 0.1, 0.2 },
+                                    { 0.1, 0.2, 0.3, 0.4 } };
+static double subst_params[2][6] = { {1,2.5,1,1,2.5,1},
+                                     {1.2,3.1,0.7,0.9,4.0,1} };
+
+static pll_partition_t * create(void)
+{
+  double rate_cats[N_CAT_GAMMA];
+  pll_partition_t * partition = pll_partition_create(4,
+                                                     2,
+                                                     N_STATES_NT,
+                                                     N_SITES,
+                                                     N_RATE_MATRICES,
+                                                     N_RATE_MATRICES,
+                                                     N_CAT_GAMMA,
+                                                     2,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  pll_compute_gamma_cats(0.5, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  pll_set_category_rates(partition, rate_cats);
+
+  return partition;
+}
+
+static void set_model(pll_partition_t * partition,
+                      unsigned int params_index,
+                      unsigned int model)
+{
+  pll_set_frequencies(partition, params_index, frequencies[model]);
+  pll_set_subst_params(partition, params_index, subst_params[model]);
+}
+
+/* updates p-matrix params_index of the partition from rate matrix
+   params_index */
+static void update(pll_partition_t * partition, unsigned int params_index)
+{
+  unsigned int params_indices[N_CAT_GAMMA];
+  double branch_length = 0.3;
+  unsigned int i;
+
+  for (i = 0; i < N_CAT_GAMMA; ++i)
+    params_indices[i] = params_index;
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           &params_index,
+                           &branch_length,
+                           1);
+}
+
+/* compares p-matrix 0 of the partition with that of a partition created
+   with the given model */
+static const char * compare(const pll_partition_t * partition,
+                            unsigned int model)
+{
+  pll_partition_t * fresh = create();
+  size_t size = partition->states * partition->states_padded *
+                partition->rate_cats * sizeof(double);
+  int same;
+
+  set_model(fresh, 0, model);
+  update(fresh, 0);
+  same = !memcmp(partition->pmatrix[0], fresh->pmatrix[0], size);
+  pll_partition_destroy(fresh);
+
+  return same ? "identical" : "MISMATCH";
+}
+
+static void report(const char * label, const pll_partition_t * partition,
+                   unsigned int model)
+{
+  printf("%-24s versions %lu %lu, p-matrix %s\n",
+         label,
+         pll_get_eigen_version(partition, 0),
+         pll_get_eigen_version(partition, 1),
+         compare(partition, model));
+}
+
+int main(int argc, char * argv[])
+{
+  attributes = get_attributes(argc, argv);
+
+  pll_partition_t * partition = create();
+
+  printf("%-24s versions %lu %lu\n",
+         "created",
+         pll_get_eigen_version(partition, 0),
+         pll_get_eigen_version(partition, 1));
+
+  set_model(partition, 0, 0);
+  set_model(partition, 1, 1);
+  update(partition, 0);
+  report("first update", partition, 0);
+
+  /* same values set again: the decomposition is reused */
+  set_model(partition, 0, 0);
+  update(partition, 0);
+  report("same parameters", partition, 0);
+
+  update(partition, 1);
+  report("second rate matrix", partition, 0);
+
+  /* changed values are decomposed again */
+  set_model(partition, 0, 1);
+  update(partition, 0);
+  report("changed parameters", partition, 1);
+
+  set_model(partition, 0, 1);
+  update(partition, 0);
+  report("same parameters", partition, 1);
+
+  /* earlier values are not remembered and are decomposed again */
+  pll_set_frequencies(partition, 0, frequencies[0]);
+  pll_set_subst_params(partition, 0, subst_params[0]);
+  update(partition, 0);
+  report("reverted parameters", partition, 0);
+
+  pll_partition_destroy(partition);
+
+  return (0);
+}
@@ -0,0 +1,193 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    gap-elision.c
+
+    This test compares the CLVs and log-likelihoods computed with
+    PLL_ATTRIB_GAP_ELISION with those computed without it. The alignment has
+    gap runs covering whole subtrees (elided), gap runs in one subtree only
+    (computed from the other subtree) and gap runs shorter than
+    PLL_GAPS_MIN_RUN (computed as usual).
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 64
+#define N_TIPS 12
+#define N_INNER 10
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+/* gap runs [begin,end) of the tips [first,last) */
+static unsigned int gap_runs[][4] = { { 0,  4,  8, 32},
+                                      { 4,  8, 20, 48},
+                                      { 0,  8, 56, 60},
+                                      { 8, 12, 50, 55},
+                                      { 8, 12, 40, 64} };
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  unsigned int i, j, r;
+  unsigned int seed = 7;
+  char seq[N_SITES+1];
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  for (i = 0; i < N_TIPS; ++i)
+  {
+    for (j = 0; j < N_SITES; ++j)
+      seq[j] = "ACGTACGTN"[(next_random(&seed) >> 16) % 9];
+    for (r = 0; r < sizeof(gap_runs) / sizeof(gap_runs[0]); ++r)
+      if (i >= gap_runs[r][0] && i < gap_runs[r][1])
+        for (j = gap_runs[r][2]; j < gap_runs[r][3]; ++j)
+          seq[j] = '-';
+    seq[N_SITES] = 0;
+    pll_set_tip_states(partition, i, pll_map_nt, seq);
+  }
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+static double max_clv_diff(const pll_partition_t * a,
+                           const pll_partition_t * b,
+                           unsigned int clv_index)
+{
+  unsigned int i;
+  double diff = 0;
+  unsigned int size = N_SITES * a->rate_cats * a->states_padded;
+
+  for (i = 0; i < size; ++i)
+    diff = PLL_MAX(diff, fabs(a->clv[clv_index][i] - b->clv[clv_index][i]));
+
+  return diff;
+}
+
+static unsigned int gap_sites(const pll_partition_t * partition,
+                              unsigned int clv_index)
+{
+  unsigned int i, count = 0;
+  const unsigned int * bits = pll_get_gap_bitvector(partition, clv_index);
+
+  for (i = 0; i < N_SITES; ++i)
+    count += PLL_GAP_BIT(bits, i);
+
+  return count;
+}
+
+/* sites at which exactly one of the two nodes is all-gap */
+static unsigned int one_sided_sites(const pll_partition_t * partition,
+                                    unsigned int child1,
+                                    unsigned int child2)
+{
+  unsigned int i, count = 0;
+  const unsigned int * left = pll_get_gap_bitvector(partition, child1);
+  const unsigned int * right = pll_get_gap_bitvector(partition, child2);
+
+  for (i = 0; i < N_SITES; ++i)
+    count += PLL_GAP_BIT(left, i) ^ PLL_GAP_BIT(right, i);
+
+  return count;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int parents[N_INNER]  = {12, 13, 14, 15, 16, 17, 18, 19, 20, 21};
+  unsigned int children[2*N_INNER] = { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9,
+                                      10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+  pll_operation_t operations[N_INNER];
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* site repeats cannot be combined with PLL_ATTRIB_GAP_ELISION */
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  /* (((0,1)12,(2,3)13)18,((4,5)14,(6,7)15)19)21,((8,9)16,(10,11)17)20 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % N_MATRICES;
+    operations[i].child2_matrix_index = c2 % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  pll_partition_t * partition = create(attributes);
+  pll_partition_t * elided = create(attributes | PLL_ATTRIB_GAP_ELISION);
+
+  pll_update_partials(partition, operations, N_INNER);
+  pll_update_partials(elided, operations, N_INNER);
+
+  for (i = 0; i < N_INNER; ++i)
+    printf("CLV %u: %2u all-gap sites, %2u one-sided, %s\n",
+           parents[i],
+           gap_sites(elided, parents[i]),
+           one_sided_sites(elided, children[2*i], children[2*i+1]),
+           max_clv_diff(partition, elided, parents[i]) < 1e-12 ?
+             "within 1e-12" : "MISMATCH");
+
+  double logl = pll_compute_edge_loglikelihood(partition,
+                                               21, 9,
+                                               20, 8,
+                                               0,
+                                               params_indices,
+                                               NULL);
+  double logl_elided = pll_compute_edge_loglikelihood(elided,
+                                                      21, 9,
+                                                      20, 8,
+                                                      0,
+                                                      params_indices,
+                                                      NULL);
+  printf("logL: %.6f elided: %.6f %s\n",
+         logl,
+         logl_elided,
+         fabs(logl - logl_elided) < 1e-9 ? "OK" : "MISMATCH");
+
+  pll_partition_destroy(partition);
+  pll_partition_destroy(elided);
+
+  return (0);
+}
@@ -0,0 +1,275 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    gradient.c
+
+    This test compares the gradient computed by pll_utree_compute_gradient
+    with the derivative of each branch computed separately, from a full
+    traversal towards that branch, and with central finite differences of
+    the log-likelihood. The upward CLVs are computed with and without scale
+    buffers, and an upward CLV on a CLV of the tree is rejected.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 120
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static const char * newick = "((A:0.1,B:0.2):0.05,(C:0.1,(D:0.3,E:0.1):0.1)"
+                             ":0.2,((F:0.1,G:0.2):0.1,H:0.4):0.1);";
+
+static pll_partition_t * create(const pll_utree_t * tree,
+                                unsigned int attributes,
+                                unsigned int spare)
+{
+  unsigned int i, j;
+  unsigned int seed = 5;
+  char seq[N_SITES+1];
+
+  pll_partition_t * partition = create_nt_partition(tree->tip_count,
+                                                    tree->inner_count + spare,
+                                                    N_SITES,
+                                                    tree->edge_count,
+                                                    N_CAT_GAMMA,
+                                                    tree->inner_count + spare,
+                                                    0.5,
+                                                    attributes);
+
+  for (j = 0; j < N_SITES; ++j)
+    seq[j] = "ACGT"[j % 4];
+  seq[N_SITES] = 0;
+  for (i = 0; i < tree->tip_count; ++i)
+  {
+    mutate_sequence(seq, N_SITES, 30, "ACGTACGTN-", &seed);
+    pll_set_tip_states(partition, tree->nodes[i]->clv_index, pll_map_nt, seq);
+  }
+
+  return partition;
+}
+
+/* updates all p-matrices and the CLVs towards the edge of the inner node
+   root, and returns the log-likelihood */
+static double full_loglikelihood(pll_partition_t * partition,
+                                 const pll_utree_t * tree,
+                                 pll_unode_t * root)
+{
+  unsigned int trav_size, matrix_count, ops_count;
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  pll_unode_t ** travbuffer = (pll_unode_t **)malloc(nodes_count *
+                                                     sizeof(pll_unode_t *));
+  double * branch_lengths = (double *)malloc(tree->edge_count *
+                                             sizeof(double));
+  unsigned int * matrix_indices = (unsigned int *)malloc(tree->edge_count *
+                                                       sizeof(unsigned int));
+  pll_operation_t * operations = (pll_operation_t *)malloc(tree->inner_count *
+                                                      sizeof(pll_operation_t));
+
+  if (!pll_utree_traverse(root,
+                          PLL_TREE_TRAVERSE_POSTORDER,
+                          cb_full_traversal,
+                          travbuffer,
+                          &trav_size))
+    fatal("Fail traversing tree: %s\n", pll_errmsg);
+
+  pll_utree_create_operations(travbuffer,
+                              trav_size,
+                              branch_lengths,
+                              matrix_indices,
+                              operations,
+                              &matrix_count,
+                              &ops_count);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           matrix_count);
+  pll_update_partials(partition, operations, ops_count);
+
+  free(travbuffer);
+  free(branch_lengths);
+  free(matrix_indices);
+  free(operations);
+
+  return pll_compute_edge_loglikelihood(partition,
+                                        root->clv_index,
+                                        root->scaler_index,
+                                        root->back->clv_index,
+                                        root->back->scaler_index,
+                                        root->pmatrix_index,
+                                        params_indices,
+                                        NULL);
+}
+
+/* stores one node of each edge of the tree, indexed by p-matrix index, with
+   the end-point of the node being an inner node */
+static void get_edges(const pll_utree_t * tree, pll_unode_t ** edges)
+{
+  unsigned int i;
+
+  for (i = 0; i < tree->tip_count; ++i)
+    edges[tree->nodes[i]->pmatrix_index] = tree->nodes[i]->back;
+
+  for (i = tree->tip_count; i < tree->tip_count + tree->inner_count; ++i)
+  {
+    pll_unode_t * node = tree->nodes[i];
+
+    do
+    {
+      if (node->back->next)
+        edges[node->pmatrix_index] = node;
+      node = node->next;
+    }
+    while (node != tree->nodes[i]);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int attributes = get_attributes(argc, argv);
+
+  pll_utree_t * tree = pll_utree_parse_newick_string(newick);
+  if (!tree)
+    fatal("Fail parsing tree: %s\n", pll_errmsg);
+
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  unsigned int edge_count = tree->edge_count;
+  pll_unode_t ** edges = (pll_unode_t **)malloc(edge_count *
+                                                sizeof(pll_unode_t *));
+  unsigned int * up_clv_indices = (unsigned int *)malloc(edge_count *
+                                                         sizeof(unsigned int));
+  int * up_scaler_indices = (int *)malloc(edge_count * sizeof(int));
+  double * gradient = (double *)malloc(edge_count * sizeof(double));
+  double * unscaled_gradient = (double *)malloc(edge_count * sizeof(double));
+  double logl, unscaled_logl;
+
+  for (i = 0; i < edge_count; ++i)
+  {
+    up_clv_indices[i] = nodes_count + i;
+    up_scaler_indices[i] = tree->inner_count + i;
+  }
+  get_edges(tree, edges);
+
+  pll_partition_t * partition = create(tree, attributes, edge_count);
+  pll_partition_t * reference = create(tree, attributes, 0);
+
+  double * sumtable = pll_aligned_alloc(
+    reference->sites * reference->rate_cats * reference->states_padded *
+    sizeof(double), reference->alignment);
+  if (!sumtable)
+    fatal("Fail creating sumtable\n");
+
+  full_loglikelihood(partition, tree, tree->vroot);
+  if (!pll_utree_compute_gradient(partition, tree, params_indices,
+                                  up_clv_indices, up_scaler_indices, NULL,
+                                  gradient, &logl))
+    fatal("Fail computing gradient: %s\n", pll_errmsg);
+  if (!pll_utree_compute_gradient(partition, tree, params_indices,
+                                  up_clv_indices, NULL, NULL,
+                                  unscaled_gradient, &unscaled_logl))
+    fatal("Fail computing gradient: %s\n", pll_errmsg);
+
+  double ref_logl = full_loglikelihood(reference, tree, tree->vroot);
+  printf("logL: %.6f %s\n",
+         logl,
+         fabs(logl - ref_logl) < 1e-9 && fabs(unscaled_logl - ref_logl) < 1e-9 ?
+           "OK" : "MISMATCH");
+
+  for (i = 0; i < edge_count; ++i)
+  {
+    pll_unode_t * edge = edges[i];
+    double d_f, dd_f;
+    double h = 1e-6;
+    double lengths[2] = { edge->length - h, edge->length + h };
+    double logl_h[2];
+    unsigned int j;
+
+    full_loglikelihood(reference, tree, edge);
+    pll_update_sumtable(reference,
+                        edge->clv_index,
+                        edge->back->clv_index,
+                        edge->scaler_index,
+                        edge->back->scaler_index,
+                        params_indices,
+                        sumtable);
+    pll_compute_likelihood_derivatives(reference,
+                                       edge->scaler_index,
+                                       edge->back->scaler_index,
+                                       edge->length,
+                                       params_indices,
+                                       sumtable,
+                                       &d_f,
+                                       &dd_f);
+
+    for (j = 0; j < 2; ++j)
+    {
+      unsigned int matrix_index = edge->pmatrix_index;
+
+      pll_update_prob_matrices(reference,
+                               params_indices,
+                               &matrix_index,
+                               lengths + j,
+                               1);
+      logl_h[j] = pll_compute_edge_loglikelihood(reference,
+                                                 edge->clv_index,
+                                                 edge->scaler_index,
+                                                 edge->back->clv_index,
+                                                 edge->back->scaler_index,
+                                                 matrix_index,
+                                                 params_indices,
+                                                 NULL);
+    }
+    double finite = (logl_h[1] - logl_h[0]) / (2 * h);
+
+    printf("edge %2u: derivative %s, unscaled %s, finite differences %s\n",
+           i,
+           fabs(gradient[i] + d_f) <= 1e-8 * PLL_MAX(1, fabs(d_f)) ?
+             "OK" : "MISMATCH",
+           fabs(unscaled_gradient[i] - gradient[i]) <=
+             1e-8 * PLL_MAX(1, fabs(d_f)) ? "OK" : "MISMATCH",
+           fabs(gradient[i] - finite) <= 1e-4 * PLL_MAX(1, fabs(finite)) ?
+             "OK" : "MISMATCH");
+  }
+
+  /* the upward CLV of an edge other than the root edge on an inner CLV */
+  i = (tree->vroot->pmatrix_index + 1) % edge_count;
+  up_clv_indices[i] = tree->nodes[tree->tip_count]->clv_index;
+  printf("upward CLV of the tree: %s\n",
+         !pll_utree_compute_gradient(partition, tree, params_indices,
+                                     up_clv_indices, up_scaler_indices, NULL,
+                                     gradient, NULL) &&
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "rejected" : "ACCEPTED");
+
+  pll_aligned_free(sumtable);
+  pll_partition_destroy(partition);
+  pll_partition_destroy(reference);
+  free(edges);
+  free(up_clv_indices);
+  free(up_scaler_indices);
+  free(gradient);
+  free(unscaled_gradient);
+  pll_utree_destroy(tree, NULL);
+
+  return (0);
+}
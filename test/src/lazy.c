@@ -0,0 +1,301 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    lazy.c
+
+    This test compares pll_utree_update_partials_lazy with a full traversal
+    after branch length changes, an NNI move and its rollback, changes of
+    tip data through pll_set_tip_states and pll_set_tip_clv and a change of
+    the evaluated edge, and prints the number of CLVs recomputed by the lazy
+    update in each case. Under PLL_ATTRIB_PATTERN_TIP, which has no tip CLVs,
+    the tip CLV is set through pll_set_tip_states instead.
+ */
+#include "common.h"
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA 4
+#define N_SITES 120
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static const char * newick = "((A:0.1,B:0.2):0.05,(C:0.1,(D:0.3,E:0.1):0.1)"
+                             ":0.2,((F:0.1,G:0.2):0.1,H:0.4):0.1);";
+
+static char * make_sequence(unsigned int seed)
+{
+  unsigned int j;
+  static char seq[N_SITES+1];
+
+  for (j = 0; j < N_SITES; ++j)
+    seq[j] = "ACGT"[j % 4];
+  seq[N_SITES] = 0;
+  mutate_sequence(seq, N_SITES, 40, "ACGTACGTN-", &seed);
+
+  return seq;
+}
+
+/* sets the tip to the CLV of the sequence */
+static void set_tip_clv(pll_partition_t * partition,
+                        unsigned int tip_index,
+                        const char * sequence)
+{
+  unsigned int i, k;
+  double clv[N_SITES * N_STATES_NT];
+
+  if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+  {
+    pll_set_tip_states(partition, tip_index, pll_map_nt, sequence);
+    return;
+  }
+
+  for (i = 0; i < N_SITES; ++i)
+    for (k = 0; k < N_STATES_NT; ++k)
+      clv[i * N_STATES_NT + k] =
+                    (pll_map_nt[(unsigned char)sequence[i]] >> k) & 1;
+
+  if (!pll_set_tip_clv(partition, tip_index, clv, PLL_FALSE))
+    fatal("Fail setting tip CLV: %s\n", pll_errmsg);
+}
+
+static pll_partition_t * create(const pll_utree_t * tree,
+                                unsigned int attributes)
+{
+  unsigned int i;
+
+  pll_partition_t * partition = create_nt_partition(tree->tip_count,
+                                                    tree->inner_count,
+                                                    N_SITES,
+                                                    tree->edge_count,
+                                                    N_CAT_GAMMA,
+                                                    tree->inner_count,
+                                                    0.5,
+                                                    attributes);
+
+  for (i = 0; i < tree->tip_count; ++i)
+    pll_set_tip_states(partition,
+                       tree->nodes[i]->clv_index,
+                       pll_map_nt,
+                       make_sequence(7 + tree->nodes[i]->clv_index));
+
+  return partition;
+}
+
+static double edge_loglikelihood(pll_partition_t * partition,
+                                 const pll_unode_t * edge)
+{
+  return pll_compute_edge_loglikelihood(partition,
+                                        edge->clv_index,
+                                        edge->scaler_index,
+                                        edge->back->clv_index,
+                                        edge->back->scaler_index,
+                                        edge->pmatrix_index,
+                                        params_indices,
+                                        NULL);
+}
+
+/* updates all p-matrices and CLVs of the partition through a full traversal
+   from the inner node edge */
+static double full_loglikelihood(pll_partition_t * partition,
+                                 const pll_utree_t * tree,
+                                 pll_unode_t * edge,
+                                 int update_pmatrices)
+{
+  unsigned int trav_size, matrix_count, ops_count;
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  pll_unode_t ** travbuffer = (pll_unode_t **)malloc(nodes_count *
+                                                     sizeof(pll_unode_t *));
+  double * branch_lengths = (double *)malloc(tree->edge_count *
+                                             sizeof(double));
+  unsigned int * matrix_indices = (unsigned int *)malloc(tree->edge_count *
+                                                       sizeof(unsigned int));
+  pll_operation_t * operations = (pll_operation_t *)malloc(tree->inner_count *
+                                                      sizeof(pll_operation_t));
+
+  if (!pll_utree_traverse(edge,
+                          PLL_TREE_TRAVERSE_POSTORDER,
+                          cb_full_traversal,
+                          travbuffer,
+                          &trav_size))
+    fatal("Fail traversing tree: %s\n", pll_errmsg);
+
+  pll_utree_create_operations(travbuffer,
+                              trav_size,
+                              branch_lengths,
+                              matrix_indices,
+                              operations,
+                              &matrix_count,
+                              &ops_count);
+
+  if (update_pmatrices)
+    pll_update_prob_matrices(partition,
+                             params_indices,
+                             matrix_indices,
+                             branch_lengths,
+                             matrix_count);
+  pll_update_partials(partition, operations, ops_count);
+
+  free(travbuffer);
+  free(branch_lengths);
+  free(matrix_indices);
+  free(operations);
+
+  return edge_loglikelihood(partition, edge);
+}
+
+static void check(const char * label,
+                  pll_partition_t * lazy,
+                  pll_partition_t * full,
+                  const pll_utree_t * tree,
+                  pll_unode_t * edge)
+{
+  unsigned int count;
+
+  if (!pll_utree_update_partials_lazy(lazy, tree, edge, &count))
+    fatal("Fail updating CLVs: %s\n", pll_errmsg);
+
+  double logl_lazy = edge_loglikelihood(lazy, edge);
+  double logl_full = full_loglikelihood(full, tree, edge, 0);
+
+  printf("%-20s recomputed %u of %u CLVs, logL: %.6f %s\n",
+         label,
+         count,
+         tree->inner_count,
+         logl_lazy,
+         fabs(logl_lazy - logl_full) < 1e-9 ? "OK" : "MISMATCH");
+}
+
+static void set_branch_length(pll_partition_t * partition,
+                              pll_unode_t * node,
+                              double length)
+{
+  unsigned int matrix_index = node->pmatrix_index;
+
+  node->length = node->back->length = length;
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           &matrix_index,
+                           &length,
+                           1);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  pll_unode_t * edge = NULL;
+  pll_unode_t * other_edge = NULL;
+  pll_utree_rb_t rollback;
+  unsigned int attributes = get_attributes(argc, argv);
+
+  pll_utree_t * tree = pll_utree_parse_newick_string(newick);
+  if (!tree)
+    fatal("Fail parsing tree: %s\n", pll_errmsg);
+
+  /* two inner edges that do not share a node */
+  for (i = tree->tip_count; i < tree->tip_count + tree->inner_count; ++i)
+  {
+    pll_unode_t * node = tree->nodes[i];
+    pll_unode_t * inner = node->next ? node : NULL;
+
+    while (inner && !inner->back->next)
+      inner = inner->next == node ? NULL : inner->next;
+    if (!inner)
+      continue;
+    if (!edge)
+      edge = inner;
+    else if (inner != edge->back &&
+             inner->clv_index != edge->clv_index &&
+             inner->clv_index != edge->back->clv_index &&
+             inner->back->clv_index != edge->clv_index &&
+             inner->back->clv_index != edge->back->clv_index)
+    {
+      other_edge = inner;
+      break;
+    }
+  }
+  if (!edge || !other_edge)
+    fatal("Tree has no two disjoint inner edges\n");
+
+  pll_partition_t * lazy = create(tree, attributes);
+  pll_partition_t * full = create(tree, attributes);
+
+  full_loglikelihood(lazy, tree, edge, 1);
+  full_loglikelihood(full, tree, edge, 1);
+
+  check("first update", lazy, full, tree, edge);
+  check("no change", lazy, full, tree, edge);
+
+  /* branch of a tip of the tree */
+  set_branch_length(lazy, tree->nodes[0], 0.25);
+  set_branch_length(full, tree->nodes[0], 0.25);
+  check("tip branch", lazy, full, tree, edge);
+
+  /* the evaluated branch does not affect its end-points */
+  set_branch_length(lazy, edge, 0.15);
+  set_branch_length(full, edge, 0.15);
+  check("evaluated branch", lazy, full, tree, edge);
+
+  if (!pll_utree_nni(edge, PLL_UTREE_MOVE_NNI_LEFT, &rollback))
+    fatal("Fail applying NNI: %s\n", pll_errmsg);
+  check("NNI", lazy, full, tree, edge);
+
+  if (!pll_utree_rollback(&rollback, NULL, NULL))
+    fatal("Fail rolling back NNI: %s\n", pll_errmsg);
+  check("NNI rollback", lazy, full, tree, edge);
+
+  pll_set_tip_states(lazy, tree->nodes[1]->clv_index, pll_map_nt,
+                     make_sequence(99));
+  pll_set_tip_states(full, tree->nodes[1]->clv_index, pll_map_nt,
+                     make_sequence(99));
+  check("tip data", lazy, full, tree, edge);
+
+  set_tip_clv(lazy, tree->nodes[2]->clv_index, make_sequence(55));
+  set_tip_clv(full, tree->nodes[2]->clv_index, make_sequence(55));
+  check("tip CLV", lazy, full, tree, edge);
+
+  check("other edge", lazy, full, tree, other_edge);
+  check("no change", lazy, full, tree, other_edge);
+  check("back to first edge", lazy, full, tree, edge);
+
+  pll_partition_destroy(lazy);
+  pll_partition_destroy(full);
+
+  /* lazy updates cannot track the CLVs of PLL_ATTRIB_LIMIT_MEMORY */
+  if (!(attributes & PLL_ATTRIB_SITE_REPEATS))
+  {
+    unsigned int count;
+    pll_partition_t * limited = create(tree,
+                                       attributes | PLL_ATTRIB_LIMIT_MEMORY);
+    pll_errno = 0;
+    int retval = pll_utree_update_partials_lazy(limited, tree, edge, &count);
+    printf("limited memory: %s (%s)\n",
+           retval ? "success" : "failure",
+           pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                  "no error");
+    pll_partition_destroy(limited);
+  }
+  else
+    printf("limited memory: failure (invalid parameter)\n");
+
+  pll_utree_destroy(tree, NULL);
+
+  return (0);
+}
@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    levels.c
+
+    This test compares the CLVs computed by pll_update_partials_levels, which
+    processes the independent operations of each level of the tree on
+    different threads, with those computed serially by pll_update_partials.
+    The trees have many tips and few sites, and the operations are listed in
+    postorder, such that the levels must be derived from the dependencies.
+    A list that writes a CLV twice is processed serially.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 9
+#define N_TIPS 64
+#define N_INNER (N_TIPS - 2)
+#define N_MATRICES 4
+#define N_THREADS 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  set_related_tips(partition, N_SITES, 2, "ACGTACGTN-", 17);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+/* appends the operations of the balanced subtree of the tips
+   [first, first+size) in postorder, numbering the inner nodes from next */
+static unsigned int postorder(pll_operation_t * operations,
+                              unsigned int * count,
+                              unsigned int first,
+                              unsigned int size,
+                              unsigned int * next)
+{
+  unsigned int c1, c2;
+  pll_operation_t * op;
+
+  if (size == 1)
+    return first;
+
+  c1 = postorder(operations, count, first, size / 2, next);
+  c2 = postorder(operations, count, first + size / 2, size - size / 2, next);
+
+  op = operations + (*count)++;
+  op->parent_clv_index    = (*next)++;
+  op->child1_clv_index    = c1;
+  op->child2_clv_index    = c2;
+  op->child1_matrix_index = c1 % N_MATRICES;
+  op->child2_matrix_index = c2 % N_MATRICES;
+  op->parent_scaler_index = op->parent_clv_index - N_TIPS;
+  op->child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                          (int)(c1 - N_TIPS);
+  op->child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                          (int)(c2 - N_TIPS);
+
+  return op->parent_clv_index;
+}
+
+static const char * compare(pll_partition_t * serial,
+                            pll_partition_t * levels,
+                            unsigned int count)
+{
+  unsigned int i;
+
+  for (i = N_TIPS; i < N_TIPS + count; ++i)
+    if (memcmp(serial->clv[i], levels->clv[i], pll_get_clv_size(serial, i)) ||
+        memcmp(serial->scale_buffer[i - N_TIPS],
+               levels->scale_buffer[i - N_TIPS],
+               N_SITES * sizeof(unsigned int)))
+      return "MISMATCH";
+
+  return "identical";
+}
+
+static double loglikelihood(pll_partition_t * partition,
+                            unsigned int clv1,
+                            unsigned int clv2)
+{
+  return pll_compute_edge_loglikelihood(partition,
+                                        clv1, clv1 - N_TIPS,
+                                        clv2, clv2 - N_TIPS,
+                                        0,
+                                        params_indices,
+                                        NULL);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int count = 0;
+  unsigned int next = N_TIPS;
+  unsigned int left, right;
+  pll_operation_t operations[N_INNER];
+  pll_operation_t repeated[N_INNER + N_INNER / 2];
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* two balanced subtrees of 32 tips, evaluated at the edge joining them */
+  left = postorder(operations, &count, 0, N_TIPS / 2, &next);
+  right = postorder(operations, &count, N_TIPS / 2, N_TIPS / 2, &next);
+
+  pll_partition_t * serial = create(attributes);
+  pll_partition_t * levels = create(attributes);
+
+  if (!pll_set_threads(levels, N_THREADS))
+    fatal("Fail setting threads: %s\n", pll_errmsg);
+
+  pll_update_partials(serial, operations, count);
+  if (!pll_update_partials_levels(levels, operations, count))
+    fatal("Fail updating partials: %s\n", pll_errmsg);
+
+  double logl_serial = loglikelihood(serial, left, right);
+  double logl_levels = loglikelihood(levels, left, right);
+
+  printf("CLVs and scalers: %s\n", compare(serial, levels, count));
+  printf("logL: %.6f levels: %.6f %s\n",
+         logl_serial,
+         logl_levels,
+         fabs(logl_serial - logl_levels) < 1e-9 ? "OK" : "MISMATCH");
+
+  /* a list that computes the left subtree twice */
+  memcpy(repeated, operations, (count / 2) * sizeof(pll_operation_t));
+  memcpy(repeated + count / 2, operations, count * sizeof(pll_operation_t));
+  for (i = 0; i < count; ++i)
+    memset(levels->clv[N_TIPS + i], 0, pll_get_clv_size(levels, N_TIPS + i));
+  if (!pll_update_partials_levels(levels, repeated, count / 2 + count))
+    fatal("Fail updating partials: %s\n", pll_errmsg);
+  printf("CLVs of a list with repeated operations: %s\n",
+         compare(serial, levels, count));
+
+  pll_partition_destroy(serial);
+  pll_partition_destroy(levels);
+
+  return (0);
+}
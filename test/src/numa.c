@@ -0,0 +1,159 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    numa.c
+
+    This test compares a partition created with PLL_ATTRIB_NUMA, whose CLVs
+    and scale buffers are placed by the threads that compute them, with a
+    serial partition. The buffers are placed again when the number of
+    threads changes, which must keep their content. PLL_ATTRIB_NUMA does not
+    support site repeats, which are dropped from the attributes of both
+    partitions.
+ */
+#include "common.h"
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA 4
+#define N_SITES 150
+#define N_TIPS 6
+#define N_INNER 4
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  set_related_tips(partition, N_SITES, 40, "ACGTACGTN-", 31);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+static double loglikelihood(pll_partition_t * partition)
+{
+  pll_update_partials(partition, operations, N_INNER);
+
+  return pll_compute_edge_loglikelihood(partition, 8, 2, 9, 3, 1,
+                                        params_indices, NULL);
+}
+
+static const char * compare(const pll_partition_t * a,
+                            const pll_partition_t * b,
+                            double logl_a,
+                            double logl_b)
+{
+  unsigned int i;
+
+  for (i = 0; i < N_TIPS + N_INNER; ++i)
+    if (a->clv[i] && memcmp(a->clv[i], b->clv[i], pll_get_clv_size(a, i)))
+      return "CLV MISMATCH";
+
+  return fabs(logl_a - logl_b) < 1e-9 ? "OK" : "MISMATCH";
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, t;
+  unsigned int parents[N_INNER]    = { 6, 7, 8, 9 };
+  unsigned int children[2*N_INNER] = { 0, 1, 2, 3, 6, 7, 4, 5 };
+  unsigned int threads[3] = { 4, 3, 1 };
+  unsigned int attributes = get_attributes(argc, argv) &
+                            ~PLL_ATTRIB_SITE_REPEATS;
+
+  /* ((0,1)6,(2,3)7)8 and (4,5)9, evaluated at the edge 8-9 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % N_MATRICES;
+    operations[i].child2_matrix_index = c2 % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  pll_partition_t * serial = create(attributes);
+  pll_partition_t * numa = create(attributes | PLL_ATTRIB_NUMA);
+
+  double logl_serial = loglikelihood(serial);
+  printf("serial logL: %.6f\n", logl_serial);
+
+  for (t = 0; t < 3; ++t)
+  {
+    if (!pll_set_threads(numa, threads[t]))
+      fatal("Fail setting threads: %s\n", pll_errmsg);
+
+    double logl_numa = loglikelihood(numa);
+    printf("NUMA with %u threads logL: %.6f %s\n",
+           pll_get_threads(numa),
+           logl_numa,
+           compare(serial, numa, logl_serial, logl_numa));
+  }
+
+  /* NUMA placement cannot be combined with an arena */
+  pll_errno = 0;
+  pll_partition_t * failed = pll_partition_create(N_TIPS,
+                                                  N_INNER,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  1,
+                                                  N_MATRICES,
+                                                  N_CAT_GAMMA,
+                                                  N_INNER,
+                                                  attributes |
+                                                    PLL_ATTRIB_NUMA |
+                                                    PLL_ATTRIB_ARENA);
+  printf("NUMA with arena: %s (%s)\n",
+         failed ? "success" : "failure",
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                "no error");
+
+  pll_partition_destroy(serial);
+  pll_partition_destroy(numa);
+
+  return (0);
+}
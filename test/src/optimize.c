@@ -0,0 +1,277 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    optimize.c
+
+    This test optimizes the branch lengths of a tree, linked across two
+    partitions, with pll_optimize_branch_lengths. It checks that the
+    log-likelihood improves, that the reported log-likelihood matches a full
+    evaluation of the optimized tree, that a second run from the same start
+    gives identical branch lengths, and that optimizing again does not change
+    the result.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 200
+#define N_PARTITIONS 2
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static const char * newick = "((A:0.1,B:0.1):0.1,(C:0.1,(D:0.1,E:0.1):0.1)"
+                             ":0.1,((F:0.1,G:0.1):0.1,H:0.1):0.1);";
+
+/* sequences evolved along ((A,B),(C,(D,E)),((F,G),H)): tips share the
+   mutations of their ancestors */
+static void make_sequence(char * seq, unsigned int tip, unsigned int seed)
+{
+  unsigned int j, k;
+  unsigned int groups[4] = { 2 + tip / 2, tip < 2 ? 0 : tip < 5 ? 1 : 2,
+                             tip == 3 || tip == 4 ? 6 :
+                               tip == 5 || tip == 6 ? 7 : 8 + tip,
+                             16 + tip };
+
+  for (j = 0; j < N_SITES; ++j)
+    seq[j] = "ACGT"[(j * 7) % 4];
+  seq[N_SITES] = 0;
+
+  for (k = 0; k < 4; ++k)
+  {
+    unsigned int s = seed + groups[k] * 7919;
+    mutate_sequence(seq, N_SITES, 12 + 6 * k, "ACGT", &s);
+  }
+}
+
+static pll_partition_t * create(const pll_utree_t * tree,
+                                unsigned int attributes,
+                                unsigned int index)
+{
+  unsigned int i;
+  char seq[N_SITES+1];
+  double frequencies[4] = { 0.25, 0.25, 0.25, 0.25 };
+  double subst_params[6] = { 1, 4, 1, 1, 4, 1 };
+  double alpha[2] = { 0.5, 1.5 };
+
+  pll_partition_t * partition = create_nt_partition(tree->tip_count,
+                                                    tree->inner_count,
+                                                    N_SITES,
+                                                    tree->edge_count,
+                                                    N_CAT_GAMMA,
+                                                    tree->inner_count,
+                                                    alpha[index],
+                                                    attributes);
+
+  /* the second partition has a different model */
+  if (index == 1)
+  {
+    pll_set_frequencies(partition, 0, frequencies);
+    pll_set_subst_params(partition, 0, subst_params);
+  }
+
+  for (i = 0; i < tree->tip_count; ++i)
+  {
+    unsigned int tip = tree->nodes[i]->clv_index;
+
+    make_sequence(seq, tip, 11 + index);
+    pll_set_tip_states(partition, tip, pll_map_nt, seq);
+  }
+
+  return partition;
+}
+
+/* updates all p-matrices and CLVs of the partition from the branch lengths
+   of the tree and returns the log-likelihood at tree->vroot */
+static double full_loglikelihood(pll_partition_t * partition,
+                                 const pll_utree_t * tree)
+{
+  unsigned int trav_size, matrix_count, ops_count;
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  pll_unode_t * root = tree->vroot;
+  pll_unode_t ** travbuffer = (pll_unode_t **)malloc(nodes_count *
+                                                     sizeof(pll_unode_t *));
+  double * branch_lengths = (double *)malloc(tree->edge_count *
+                                             sizeof(double));
+  unsigned int * matrix_indices = (unsigned int *)malloc(tree->edge_count *
+                                                       sizeof(unsigned int));
+  pll_operation_t * operations = (pll_operation_t *)malloc(tree->inner_count *
+                                                      sizeof(pll_operation_t));
+
+  if (!pll_utree_traverse(root,
+                          PLL_TREE_TRAVERSE_POSTORDER,
+                          cb_full_traversal,
+                          travbuffer,
+                          &trav_size))
+    fatal("Fail traversing tree: %s\n", pll_errmsg);
+
+  pll_utree_create_operations(travbuffer,
+                              trav_size,
+                              branch_lengths,
+                              matrix_indices,
+                              operations,
+                              &matrix_count,
+                              &ops_count);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           matrix_count);
+  pll_update_partials(partition, operations, ops_count);
+
+  free(travbuffer);
+  free(branch_lengths);
+  free(matrix_indices);
+  free(operations);
+
+  return pll_compute_edge_loglikelihood(partition,
+                                        root->clv_index,
+                                        root->scaler_index,
+                                        root->back->clv_index,
+                                        root->back->scaler_index,
+                                        root->pmatrix_index,
+                                        params_indices,
+                                        NULL);
+}
+
+/* stores the branch lengths of the tree, indexed by p-matrix index */
+static void get_branch_lengths(const pll_utree_t * tree, double * lengths)
+{
+  unsigned int i;
+
+  for (i = 0; i < tree->tip_count + tree->inner_count; ++i)
+  {
+    const pll_unode_t * node = tree->nodes[i];
+
+    do
+    {
+      lengths[node->pmatrix_index] = node->length;
+      node = node->next;
+    }
+    while (node && node != tree->nodes[i]);
+  }
+}
+
+/* optimizes the branch lengths of a freshly parsed tree, and returns the
+   partitions and the tree */
+static double optimize(unsigned int attributes,
+                       pll_partition_t ** partitions,
+                       pll_utree_t ** tree,
+                       double * initial_logl)
+{
+  unsigned int i;
+  unsigned int * indices[N_PARTITIONS] = { params_indices, params_indices };
+  double logl;
+
+  *tree = pll_utree_parse_newick_string(newick);
+  if (!*tree)
+    fatal("Fail parsing tree: %s\n", pll_errmsg);
+
+  *initial_logl = 0;
+  for (i = 0; i < N_PARTITIONS; ++i)
+  {
+    partitions[i] = create(*tree, attributes, i);
+    *initial_logl += full_loglikelihood(partitions[i], *tree);
+  }
+
+  if (!pll_optimize_branch_lengths(partitions, N_PARTITIONS, *tree, indices,
+                                   1e-6, 10, 1e-6, 32, NULL, &logl))
+    fatal("Fail optimizing branch lengths: %s\n", pll_errmsg);
+
+  return logl;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int attributes = get_attributes(argc, argv);
+  unsigned int * indices[N_PARTITIONS] = { params_indices, params_indices };
+  pll_partition_t * partitions[N_PARTITIONS];
+  pll_partition_t * second_partitions[N_PARTITIONS];
+  pll_utree_t * tree;
+  pll_utree_t * second_tree;
+  double initial_logl, second_initial_logl;
+  double full_logl = 0;
+  double again_logl;
+
+  double logl = optimize(attributes, partitions, &tree, &initial_logl);
+  double second_logl = optimize(attributes,
+                                second_partitions,
+                                &second_tree,
+                                &second_initial_logl);
+
+  printf("initial logL: %.4f\n", initial_logl);
+  printf("optimized logL: %.4f (%s)\n",
+         logl,
+         logl > initial_logl ? "improved" : "NOT IMPROVED");
+
+  /* evaluation from scratch of the optimized tree */
+  for (i = 0; i < N_PARTITIONS; ++i)
+  {
+    pll_partition_t * fresh = create(tree, attributes, i);
+    full_logl += full_loglikelihood(fresh, tree);
+    pll_partition_destroy(fresh);
+  }
+  printf("full evaluation: %s\n",
+         fabs(full_logl - logl) < 1e-8 ? "OK" : "MISMATCH");
+
+  double * lengths = (double *)malloc(tree->edge_count * sizeof(double));
+  double * second_lengths = (double *)malloc(tree->edge_count *
+                                             sizeof(double));
+  get_branch_lengths(tree, lengths);
+  get_branch_lengths(second_tree, second_lengths);
+  printf("second run: %s\n",
+         second_logl == logl &&
+         !memcmp(lengths, second_lengths, tree->edge_count * sizeof(double)) ?
+           "identical" : "MISMATCH");
+
+  /* the optimum is stable */
+  pll_optimize_workspace_t * workspace =
+                      pll_optimize_workspace_create(partitions, N_PARTITIONS);
+  if (!pll_optimize_branch_lengths(partitions, N_PARTITIONS, tree, indices,
+                                   1e-6, 10, 1e-6, 32, workspace, &again_logl))
+    fatal("Fail optimizing branch lengths: %s\n", pll_errmsg);
+  printf("optimized again: %s\n",
+         again_logl >= logl - 1e-8 && again_logl - logl < 1e-4 ?
+           "OK" : "MISMATCH");
+
+  pll_errno = 0;
+  int retval = pll_optimize_branch_lengths(partitions, N_PARTITIONS, tree,
+                                           indices, 1e-6, 10, 0, 32,
+                                           workspace, &again_logl);
+  printf("zero tolerance: %s (%s)\n",
+         retval ? "success" : "failure",
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                "no error");
+
+  pll_optimize_workspace_destroy(workspace);
+  for (i = 0; i < N_PARTITIONS; ++i)
+  {
+    pll_partition_destroy(partitions[i]);
+    pll_partition_destroy(second_partitions[i]);
+  }
+  free(lengths);
+  free(second_lengths);
+  pll_utree_destroy(tree, NULL);
+  pll_utree_destroy(second_tree, NULL);
+
+  return (0);
+}
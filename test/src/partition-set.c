@@ -0,0 +1,237 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    partition-set.c
+
+    This test evaluates a set of three partitions of different sizes and
+    state counts (nucleotides, nucleotides with invariant sites and amino
+    acids) with three threads, and compares the CLVs, log-likelihoods and
+    derivatives of each partition with those computed for the partition on
+    its own.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_TIPS 8
+#define N_INNER 6
+#define N_MATRICES 4
+#define N_PARTITIONS 3
+#define N_THREADS 3
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+static unsigned int partition_states[N_PARTITIONS] = { 4, 4, 20 };
+static unsigned int partition_sites[N_PARTITIONS] = { 130, 61, 37 };
+
+static pll_partition_t * create(unsigned int attributes, unsigned int p)
+{
+  unsigned int i, j;
+  unsigned int seed = 23 + p;
+  unsigned int states = partition_states[p];
+  unsigned int sites = partition_sites[p];
+  const char * alphabet = states == 4 ? "ACGT" : "ARNDCQEGHILKMFPSTWYV";
+  char * seq = (char *)xmalloc(sites + 1);
+  double rate_cats[N_CAT_GAMMA];
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = pll_partition_create(N_TIPS,
+                                                     N_INNER,
+                                                     states,
+                                                     sites,
+                                                     1,
+                                                     N_MATRICES,
+                                                     N_CAT_GAMMA,
+                                                     N_INNER,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  pll_compute_gamma_cats(0.5 + p, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  if (states == 4)
+  {
+    pll_set_frequencies(partition, 0, test_frequencies_nt);
+    pll_set_subst_params(partition, 0, test_subst_params_nt);
+  }
+  else
+  {
+    pll_set_frequencies(partition, 0, pll_aa_freqs_lg);
+    pll_set_subst_params(partition, 0, pll_aa_rates_lg);
+  }
+  pll_set_category_rates(partition, rate_cats);
+
+  for (j = 0; j < sites; ++j)
+    seq[j] = alphabet[(j * 7) % states];
+  seq[sites] = 0;
+  for (i = 0; i < N_TIPS; ++i)
+  {
+    for (j = 0; j < sites / 3; ++j)
+    {
+      next_random(&seed);
+      seq[(seed >> 16) % sites] = (seed >> 8) % 10 ?
+                                    alphabet[(seed >> 4) % states] : '-';
+    }
+    pll_set_tip_states(partition,
+                       i,
+                       states == 4 ? pll_map_nt : pll_map_aa,
+                       seq);
+  }
+  free(seq);
+
+  if (p == 1)
+    pll_update_invariant_sites_proportion(partition, 0, 0.2);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, p;
+  unsigned int clv_equal = 1;
+  double edge[N_PARTITIONS], root[N_PARTITIONS];
+  double d_f[N_PARTITIONS], dd_f[N_PARTITIONS];
+  double set_edge[N_PARTITIONS], set_root[N_PARTITIONS];
+  double set_d_f[N_PARTITIONS], set_dd_f[N_PARTITIONS];
+  double total_edge, total_root, total_d_f, total_dd_f;
+  double * sumtables[N_PARTITIONS];
+  unsigned int * set_params[N_PARTITIONS];
+  pll_partition_t * single[N_PARTITIONS];
+  pll_partition_t * members[N_PARTITIONS];
+  pll_operation_t operations[N_INNER];
+  unsigned int parents[N_INNER]    = {  8,  9, 10, 11, 12, 13 };
+  unsigned int children[2*N_INNER] = {  0,  1,  2,  3,  8,  9,
+                                        4,  5,  6,  7, 11, 12 };
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* ((0,1)8,(2,3)9)10 and ((4,5)11,(6,7)12)13, evaluated at the edge
+     10-13 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % N_MATRICES;
+    operations[i].child2_matrix_index = c2 % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  for (p = 0; p < N_PARTITIONS; ++p)
+  {
+    single[p] = create(attributes, p);
+    members[p] = create(attributes, p);
+    set_params[p] = params_indices;
+    sumtables[p] = pll_aligned_alloc(partition_sites[p] * N_CAT_GAMMA *
+                                       single[p]->states_padded *
+                                       sizeof(double),
+                                     single[p]->alignment);
+
+    /* each partition on its own */
+    pll_update_partials(single[p], operations, N_INNER);
+    edge[p] = pll_compute_edge_loglikelihood(single[p], 10, 2, 13, 5, 1,
+                                             params_indices, NULL);
+    root[p] = pll_compute_root_loglikelihood(single[p], 10, 2,
+                                             params_indices, NULL);
+    pll_update_sumtable(single[p], 10, 13, 2, 5, params_indices, sumtables[p]);
+    pll_compute_likelihood_derivatives(single[p], 2, 5, 0.1, params_indices,
+                                       sumtables[p], d_f + p, dd_f + p);
+  }
+
+  pll_partition_set_t * set = pll_partition_set_create(members,
+                                                       N_PARTITIONS,
+                                                       N_THREADS);
+  if (!set)
+    fatal("Fail creating partition set: %s\n", pll_errmsg);
+
+  if (!pll_partition_set_update_partials(set, operations, N_INNER))
+    fatal("Fail updating partials: %s\n", pll_errmsg);
+  total_edge = pll_partition_set_compute_edge_loglikelihood(set, 10, 2, 13, 5,
+                                                            1, set_params,
+                                                            set_edge);
+  total_root = pll_partition_set_compute_root_loglikelihood(set, 10, 2,
+                                                            set_params,
+                                                            set_root);
+  if (!pll_partition_set_update_sumtable(set, 10, 13, 2, 5, set_params,
+                                         sumtables) ||
+      !pll_partition_set_compute_likelihood_derivatives(set, 2, 5, 0.1,
+                                                        set_params, sumtables,
+                                                        &total_d_f,
+                                                        &total_dd_f,
+                                                        set_d_f, set_dd_f))
+    fatal("Fail computing derivatives: %s\n", pll_errmsg);
+
+  printf("threads: %u\n", pll_partition_set_threads(set));
+  for (p = 0; p < N_PARTITIONS; ++p)
+  {
+    clv_equal = 1;
+    for (i = N_TIPS; i < N_TIPS + N_INNER; ++i)
+      if (memcmp(single[p]->clv[i],
+                 members[p]->clv[i],
+                 pll_get_clv_size(single[p], i)))
+        clv_equal = 0;
+
+    printf("partition %u (%2u states, %3u sites): CLVs %s\n",
+           p, partition_states[p], partition_sites[p],
+           clv_equal ? "identical" : "MISMATCH");
+    printf("  edge logL %.6f set %.6f %s\n",
+           edge[p], set_edge[p],
+           fabs(edge[p] - set_edge[p]) < 1e-9 ? "OK" : "MISMATCH");
+    printf("  root logL %.6f set %.6f %s\n",
+           root[p], set_root[p],
+           fabs(root[p] - set_root[p]) < 1e-9 ? "OK" : "MISMATCH");
+    printf("  derivatives %.4e %.4e set %.4e %.4e %s\n",
+           d_f[p], dd_f[p], set_d_f[p], set_dd_f[p],
+           fabs(d_f[p] - set_d_f[p]) < 1e-9 &&
+             fabs(dd_f[p] - set_dd_f[p]) < 1e-9 ? "OK" : "MISMATCH");
+
+    total_edge -= edge[p];
+    total_root -= root[p];
+    total_d_f -= d_f[p];
+    total_dd_f -= dd_f[p];
+  }
+
+  printf("totals: %s\n",
+         fabs(total_edge) < 1e-9 && fabs(total_root) < 1e-9 &&
+           fabs(total_d_f) < 1e-9 && fabs(total_dd_f) < 1e-9 ?
+           "OK" : "MISMATCH");
+
+  pll_partition_set_destroy(set);
+  for (p = 0; p < N_PARTITIONS; ++p)
+  {
+    pll_aligned_free(sumtables[p]);
+    pll_partition_destroy(single[p]);
+    pll_partition_destroy(members[p]);
+  }
+
+  return (0);
+}
@@ -0,0 +1,138 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    pmatrix-batch.c
+
+    This test compares p-matrices updated in a single call, which the AVX2
+    and AVX-512 kernels compute in batches of several branches (except for
+    the hand-tuned 4x4 and 20x20 kernels), with the same p-matrices updated
+    one branch at a time. Tip patterns do not affect
+    the p-matrices and are dropped from the attributes, since setting the
+    proportion of invariant sites requires the tip states under
+    PLL_ATTRIB_PATTERN_TIP.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_MATRICES 13
+
+static unsigned int attributes;
+
+static double branch_lengths[N_MATRICES] = { 0.0, 1e-8, 0.001, 0.01, 0.05,
+                                             0.1, 0.2, 0.35, 0.5, 1.0, 2.0,
+                                             5.0, 20.0 };
+
+static pll_partition_t * create(unsigned int states, double pinv)
+{
+  unsigned int i;
+  unsigned int params_count = states * (states - 1) / 2;
+  double rate_cats[N_CAT_GAMMA];
+  double * frequencies = (double *)malloc(states * sizeof(double));
+  double * subst_params = (double *)malloc(params_count * sizeof(double));
+  double sum = 0;
+
+  pll_partition_t * partition = pll_partition_create(4,
+                                                     2,
+                                                     states,
+                                                     10,
+                                                     1,
+                                                     N_MATRICES,
+                                                     N_CAT_GAMMA,
+                                                     2,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  for (i = 0; i < states; ++i)
+    sum += frequencies[i] = 1 + (i * 7) % 5;
+  for (i = 0; i < states; ++i)
+    frequencies[i] /= sum;
+  for (i = 0; i < params_count; ++i)
+    subst_params[i] = 0.5 + (i * 13) % 11 / 4.0;
+
+  pll_compute_gamma_cats(0.5, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  pll_set_frequencies(partition, 0, frequencies);
+  pll_set_subst_params(partition, 0, subst_params);
+  pll_set_category_rates(partition, rate_cats);
+  pll_update_invariant_sites_proportion(partition, 0, pinv);
+
+  free(frequencies);
+  free(subst_params);
+
+  return partition;
+}
+
+static void test(unsigned int states, double pinv)
+{
+  unsigned int i, j;
+  unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+  unsigned int matrix_indices[N_MATRICES];
+  double max_diff = 0;
+
+  pll_partition_t * batched = create(states, pinv);
+  pll_partition_t * single = create(states, pinv);
+
+  for (i = 0; i < N_MATRICES; ++i)
+    matrix_indices[i] = i;
+
+  pll_update_prob_matrices(batched,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  for (i = 0; i < N_MATRICES; ++i)
+    pll_update_prob_matrices(single,
+                             params_indices,
+                             matrix_indices + i,
+                             branch_lengths + i,
+                             1);
+
+  for (i = 0; i < N_MATRICES; ++i)
+    for (j = 0; j < states * single->states_padded * N_CAT_GAMMA; ++j)
+      max_diff = PLL_MAX(max_diff,
+                         fabs(batched->pmatrix[i][j] - single->pmatrix[i][j]));
+
+  printf("states %2u, pinv %.1f: %s\n",
+         states,
+         pinv,
+         max_diff < 1e-12 ? "OK" : "MISMATCH");
+
+  pll_partition_destroy(batched);
+  pll_partition_destroy(single);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int states[5] = { 4, 5, 20, 32, 61 };
+
+  attributes = get_attributes(argc, argv) & ~PLL_ATTRIB_PATTERN_TIP;
+
+  for (i = 0; i < 5; ++i)
+  {
+    test(states[i], 0);
+    test(states[i], 0.3);
+  }
+
+  return (0);
+}
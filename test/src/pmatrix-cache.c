@@ -0,0 +1,161 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    pmatrix-cache.c
+
+    This test counts the hits and misses of the p-matrix cache across changes
+    of the branch lengths, the category rates and the proportion of invariant
+    sites, and compares the p-matrices with those of a partition without
+    cache. Writing partition->rates directly does not invalidate the cache,
+    which returns stale p-matrices until pll_pmatrix_cache_invalidate() is
+    called.
+ */
+#include "common.h"
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA 4
+#define N_SITES 12
+#define N_TIPS 4
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+static unsigned int matrix_indices[N_MATRICES] = {0, 1, 2, 3};
+
+static const char * sequences[N_TIPS] = { "AAC-CTAGATCT",
+                                          "ACC-TTAGATGT",
+                                          "A-C-TAGGCTCT",
+                                          "ATCTTAAGA-CG" };
+
+static pll_partition_t * create(unsigned int attributes,
+                                const double * rate_cats)
+{
+  unsigned int i;
+  double frequencies[4] = { 0.3, 0.4, 0.1, 0.2 };
+  double subst_params[6] = {1,2.5,1,1,2.5,1};
+
+  pll_partition_t * partition = pll_partition_create(N_TIPS,
+                                                     2,
+                                                     N_STATES_NT,
+                                                     N_SITES,
+                                                     1,
+                                                     N_MATRICES,
+                                                     N_CAT_GAMMA,
+                                                     0,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  pll_set_frequencies(partition, 0, frequencies);
+  pll_set_subst_params(partition, 0, subst_params);
+  pll_set_category_rates(partition, rate_cats);
+
+  for (i = 0; i < N_TIPS; ++i)
+    pll_set_tip_states(partition, i, pll_map_nt, sequences[i]);
+
+  return partition;
+}
+
+/* updates the p-matrices of both partitions and prints the cache counters
+   of this update, and whether the p-matrices are equal */
+static void update(const char * label,
+                   pll_partition_t * cached,
+                   pll_partition_t * reference,
+                   const double * branch_lengths)
+{
+  unsigned int i;
+  unsigned long hits = cached->pmatrix_cache->hits;
+  unsigned long misses = cached->pmatrix_cache->misses;
+  size_t size = (size_t)cached->rate_cats * cached->states *
+                cached->states_padded * sizeof(double);
+  int equal = 1;
+
+  if (!pll_update_prob_matrices(cached,
+                                params_indices,
+                                matrix_indices,
+                                branch_lengths,
+                                N_MATRICES) ||
+      !pll_update_prob_matrices(reference,
+                                params_indices,
+                                matrix_indices,
+                                branch_lengths,
+                                N_MATRICES))
+    fatal("Fail updating p-matrices: %s\n", pll_errmsg);
+
+  for (i = 0; i < N_MATRICES; ++i)
+    if (memcmp(cached->pmatrix[i], reference->pmatrix[i], size))
+      equal = 0;
+
+  printf("%-28s hits %lu misses %lu pmatrices %s\n",
+         label,
+         cached->pmatrix_cache->hits - hits,
+         cached->pmatrix_cache->misses - misses,
+         equal ? "equal" : "stale");
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  double rate_cats[N_CAT_GAMMA];
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  double other_lengths[N_MATRICES] = { 0.05, 0.1, 0.3, 0.7 };
+  unsigned int attributes = get_attributes(argc, argv);
+
+  pll_compute_gamma_cats(0.5, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+
+  pll_partition_t * cached = create(attributes, rate_cats);
+  pll_partition_t * reference = create(attributes, rate_cats);
+
+  if (!pll_set_pmatrix_cache(cached, 64))
+    fatal("Fail creating p-matrix cache: %s\n", pll_errmsg);
+
+  update("first update", cached, reference, branch_lengths);
+  update("same branch lengths", cached, reference, branch_lengths);
+  update("two branch lengths changed", cached, reference, other_lengths);
+
+  /* the setters invalidate the cache */
+  pll_compute_gamma_cats(1.5, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  pll_set_category_rates(cached, rate_cats);
+  pll_set_category_rates(reference, rate_cats);
+  update("pll_set_category_rates", cached, reference, branch_lengths);
+  update("same branch lengths", cached, reference, branch_lengths);
+
+  pll_update_invariant_sites_proportion(cached, 0, 0.2);
+  pll_update_invariant_sites_proportion(reference, 0, 0.2);
+  update("invariant sites proportion", cached, reference, branch_lengths);
+
+  /* writing the rates directly does not */
+  pll_compute_gamma_cats(0.8, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  for (i = 0; i < N_CAT_GAMMA; ++i)
+  {
+    cached->rates[i] = rate_cats[i];
+    reference->rates[i] = rate_cats[i];
+  }
+  update("rates written directly", cached, reference, branch_lengths);
+
+  pll_pmatrix_cache_invalidate(cached);
+  update("pll_pmatrix_cache_invalidate", cached, reference, branch_lengths);
+
+  pll_partition_destroy(cached);
+  pll_partition_destroy(reference);
+
+  return (0);
+}
@@ -0,0 +1,182 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    pmatrix-closed.c
+
+    This test compares the closed-form p-matrices of PLL_ATTRIB_CLOSED_PMATRIX
+    with the p-matrices computed from the eigen decomposition, for the four
+    model structures (JC69, K80, F81, HKY), with and without a proportion of
+    invariant sites. Frequencies that do not sum to 1 must fall back to the
+    eigen decomposition, giving identical p-matrices.
+ */
+#include "common.h"
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA 4
+#define N_SITES 12
+#define N_TIPS 5
+#define N_MODELS 5
+#define N_BRANCHES 5
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+static double branch_lengths[N_BRANCHES] = {0.001, 0.1, 0.5, 2, 10};
+
+static const char * model_names[N_MODELS] = { "JC69", "K80", "F81", "HKY",
+                                              "skewed" };
+static double model_params[N_MODELS][6] = { {1,1,1,1,1,1},
+                                            {1,4,1,1,4,1},
+                                            {1,1,1,1,1,1},
+                                            {1,4,1,1,4,1},
+                                            {1,1,1,1,1,1} };
+static double model_freqs[N_MODELS][4] = { {0.25, 0.25, 0.25, 0.25},
+                                           {0.25, 0.25, 0.25, 0.25},
+                                           {0.1, 0.2, 0.3, 0.4},
+                                           {0.1, 0.2, 0.3, 0.4},
+                                           {1.0/3, 0.25, 0.25, 0.25} };
+
+static const char * sequences[N_TIPS] = { "WAC-CTA-ATCT",
+                                          "CCC-TTA-ATGT",
+                                          "A-C-TAG-CTCT",
+                                          "CTCTTAA-A-CG",
+                                          "CAC-TCA-A-TG" };
+
+static pll_partition_t * create(unsigned int attributes,
+                                unsigned int model,
+                                double pinvar)
+{
+  unsigned int i;
+  double rate_cats[N_CAT_GAMMA];
+  unsigned int matrix_indices[N_BRANCHES] = {0, 1, 2, 3, 4};
+
+  pll_partition_t * partition = pll_partition_create(N_TIPS,
+                                                     3,
+                                                     N_STATES_NT,
+                                                     N_SITES,
+                                                     1,
+                                                     N_BRANCHES,
+                                                     N_CAT_GAMMA,
+                                                     0,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  pll_compute_gamma_cats(0.5, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  pll_set_frequencies(partition, 0, model_freqs[model]);
+  pll_set_subst_params(partition, 0, model_params[model]);
+  pll_set_category_rates(partition, rate_cats);
+
+  /* the invariant sites are found from the tip states */
+  for (i = 0; i < N_TIPS; ++i)
+    pll_set_tip_states(partition, i, pll_map_nt, sequences[i]);
+  pll_update_invariant_sites_proportion(partition, 0, pinvar);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_BRANCHES);
+
+  return partition;
+}
+
+static double loglikelihood(pll_partition_t * partition)
+{
+  unsigned int i;
+  pll_operation_t operations[3];
+  unsigned int parents[3]  = {5, 6, 7};
+  unsigned int children[6] = {0, 1, 5, 2, 3, 4};
+  unsigned int matrices[6] = {1, 2, 0, 3, 1, 4};
+
+  for (i = 0; i < 3; ++i)
+  {
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = children[2*i];
+    operations[i].child2_clv_index    = children[2*i+1];
+    operations[i].child1_matrix_index = matrices[2*i];
+    operations[i].child2_matrix_index = matrices[2*i+1];
+    operations[i].parent_scaler_index = PLL_SCALE_BUFFER_NONE;
+    operations[i].child1_scaler_index = PLL_SCALE_BUFFER_NONE;
+    operations[i].child2_scaler_index = PLL_SCALE_BUFFER_NONE;
+  }
+
+  pll_update_partials(partition, operations, 3);
+
+  return pll_compute_edge_loglikelihood(partition,
+                                        6,
+                                        PLL_SCALE_BUFFER_NONE,
+                                        7,
+                                        PLL_SCALE_BUFFER_NONE,
+                                        2,
+                                        params_indices,
+                                        NULL);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int m, p, b, i, j, k;
+  double pinvar[2] = {0, 0.2};
+  unsigned int attributes = get_attributes(argc, argv);
+
+  for (m = 0; m < N_MODELS; ++m)
+  {
+    for (p = 0; p < 2; ++p)
+    {
+      pll_partition_t * eigen = create(attributes, m, pinvar[p]);
+      pll_partition_t * closed = create(attributes | PLL_ATTRIB_CLOSED_PMATRIX,
+                                        m,
+                                        pinvar[p]);
+      unsigned int states = closed->states;
+      unsigned int states_padded = closed->states_padded;
+      double max_diff = 0;
+
+      for (b = 0; b < N_BRANCHES; ++b)
+        for (k = 0; k < closed->rate_cats; ++k)
+          for (i = 0; i < states; ++i)
+            for (j = 0; j < states; ++j)
+            {
+              size_t offset = (k*states + i)*states_padded + j;
+              double diff = fabs(closed->pmatrix[b][offset] -
+                                 eigen->pmatrix[b][offset]);
+              if (diff > max_diff)
+                max_diff = diff;
+            }
+
+      double logl_eigen = loglikelihood(eigen);
+      double logl_closed = loglikelihood(closed);
+
+      printf("%-7s pinv %.1f structure %u pmatrix %s logL %.6f %.6f %s\n",
+             model_names[m],
+             pinvar[p],
+             closed->model_structure[0],
+             max_diff == 0 ? "identical" :
+               (max_diff < 1e-12 ? "within 1e-12" : "MISMATCH"),
+             logl_eigen,
+             logl_closed,
+             fabs(logl_eigen - logl_closed) < 1e-9 ? "OK" : "MISMATCH");
+
+      pll_partition_destroy(eigen);
+      pll_partition_destroy(closed);
+    }
+  }
+
+  return (0);
+}
@@ -0,0 +1,189 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    repeats-adaptive.c
+
+    This test compares a partition with site repeats and the self-tuning
+    policy of pll_repeats_enable_adaptive with a partition without repeats.
+    During the calibration nodes of similar class ratios are alternately
+    computed with and without repeats, which must not change the results.
+    It also checks that the calibration decides every range of class ratios
+    that occurs, and that the policy is installed beneath a memory budget.
+    Site repeats are not combined with tip patterns, which are dropped from
+    the attributes of the partitions with repeats.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 400
+#define N_PATTERNS 90
+#define N_TIPS 16
+#define N_INNER 14
+#define N_MATRICES 4
+#define N_ROUNDS 40
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  /* site j repeats one of N_PATTERNS columns */
+  set_repeated_tips(partition, N_SITES, N_PATTERNS);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+/* inner nodes 16..23 join pairs of tips in the order tip(k) = k * step mod
+   16, 24..27 pairs of those, and 28 and 29 are the roots of two subtrees of
+   8 tips, joined by the evaluated edge */
+static void set_operations(unsigned int step)
+{
+  unsigned int i;
+
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = i < 8 ? (2 * i * step) % N_TIPS : N_TIPS + 2 * (i - 8);
+    unsigned int c2 = i < 8 ? ((2 * i + 1) * step) % N_TIPS : c1 + 1;
+
+    operations[i].parent_clv_index    = N_TIPS + i;
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = (i + 1) % N_MATRICES;
+    operations[i].child2_matrix_index = (i + 2) % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+}
+
+static double loglikelihood(pll_partition_t * partition)
+{
+  pll_update_partials(partition, operations, N_INNER);
+
+  return pll_compute_edge_loglikelihood(partition,
+                                        N_TIPS + N_INNER - 2,
+                                        N_INNER - 2,
+                                        N_TIPS + N_INNER - 1,
+                                        N_INNER - 1,
+                                        0,
+                                        params_indices,
+                                        NULL);
+}
+
+/* every range of class ratios in which operations were timed was decided */
+static int decided(const pll_repeats_tuning_t * tuning)
+{
+  unsigned int k;
+
+  for (k = 0; k < PLL_REPEATS_TUNING_BINS; ++k)
+    if ((tuning->samples[0][k] || tuning->samples[1][k]) &&
+        !tuning->choice[k])
+      return 0;
+
+  return 1;
+}
+
+/* evaluates N_ROUNDS rearrangements of the tips, and returns the number of
+   log-likelihoods that differ from the reference */
+static unsigned int evaluate(pll_partition_t * adaptive,
+                             pll_partition_t * reference)
+{
+  unsigned int i;
+  unsigned int steps[4] = { 1, 5, 3, 7 };
+  unsigned int mismatches = 0;
+
+  for (i = 0; i < N_ROUNDS; ++i)
+  {
+    set_operations(steps[i % 4]);
+    if (fabs(loglikelihood(adaptive) - loglikelihood(reference)) >= 1e-9)
+      ++mismatches;
+  }
+
+  return mismatches;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int attributes = get_attributes(argc, argv);
+  unsigned int repeats_attributes = (attributes | PLL_ATTRIB_SITE_REPEATS) &
+                                    ~PLL_ATTRIB_PATTERN_TIP;
+
+  pll_partition_t * reference = create(attributes & ~PLL_ATTRIB_SITE_REPEATS);
+  pll_partition_t * adaptive = create(repeats_attributes);
+
+  if (!pll_repeats_enable_adaptive(adaptive))
+    fatal("Fail enabling adaptive repeats: %s\n", pll_errmsg);
+
+  unsigned int mismatches = evaluate(adaptive, reference);
+  printf("adaptive: %u rearrangements, %s, ranges in use %s\n",
+         N_ROUNDS,
+         mismatches ? "MISMATCH" : "OK",
+         decided(adaptive->repeats->tuning) ? "decided" : "UNDECIDED");
+
+  /* restarting the calibration under a memory budget */
+  pll_repeats_set_budget(adaptive,
+                         2 * pll_get_clv_size(reference, N_TIPS) *
+                           sizeof(double));
+  pll_repeats_enable_adaptive(adaptive);
+  mismatches = evaluate(adaptive, reference);
+  printf("adaptive with budget: %u rearrangements, %s, ranges in use %s, "
+         "policy %s\n",
+         N_ROUNDS,
+         mismatches ? "MISMATCH" : "OK",
+         decided(adaptive->repeats->tuning) ? "decided" : "UNDECIDED",
+         adaptive->repeats->enable_repeats == pll_budget_enable_repeats &&
+         adaptive->repeats->unbudgeted_enable_repeats ==
+           pll_adaptive_enable_repeats ? "beneath budget" : "MISMATCH");
+
+  pll_errno = 0;
+  int retval = pll_repeats_enable_adaptive(reference);
+  printf("adaptive without repeats: %s (%s)\n",
+         retval ? "success" : "failure",
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                "no error");
+
+  pll_partition_destroy(reference);
+  pll_partition_destroy(adaptive);
+
+  return (0);
+}
@@ -0,0 +1,232 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    repeats-bclv.c
+
+    This test compares partitions with site repeats with partitions without,
+    for 4, 8 and 20 states. The tips use alphabets of different sizes, such
+    that children often have much fewer classes than their parents and the
+    bclv kernels, which buffer the products of the children with classes,
+    compute the CLVs, sumtables and edge log-likelihoods. Edges are also
+    evaluated between a tip of few classes and an inner node, in both
+    directions. Site repeats are not combined with tip patterns, which are
+    dropped from the attributes of the partitions with repeats.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 300
+#define N_TIPS 6
+#define N_INNER 4
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes,
+                                unsigned int states,
+                                const pll_state_t * map,
+                                const char * alphabet)
+{
+  unsigned int i, j;
+  unsigned int params_count = states * (states - 1) / 2;
+  unsigned int alphabet_size = strlen(alphabet);
+  unsigned int seed = 3;
+  char seq[N_SITES+1];
+  double rate_cats[N_CAT_GAMMA];
+  double * frequencies = (double *)malloc(states * sizeof(double));
+  double * subst_params = (double *)malloc(params_count * sizeof(double));
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+  double sum = 0;
+
+  pll_partition_t * partition = pll_partition_create(N_TIPS,
+                                                     N_INNER,
+                                                     states,
+                                                     N_SITES,
+                                                     1,
+                                                     N_MATRICES,
+                                                     N_CAT_GAMMA,
+                                                     N_INNER,
+                                                     attributes);
+  if (!partition)
+    fatal("Fail creating partition: %s\n", pll_errmsg);
+
+  for (i = 0; i < states; ++i)
+    sum += frequencies[i] = 1 + (i * 7) % 5;
+  for (i = 0; i < states; ++i)
+    frequencies[i] /= sum;
+  for (i = 0; i < params_count; ++i)
+    subst_params[i] = 0.5 + (i * 13) % 11 / 4.0;
+
+  pll_compute_gamma_cats(0.5, N_CAT_GAMMA, rate_cats, PLL_GAMMA_RATES_MEAN);
+  pll_set_frequencies(partition, 0, frequencies);
+  pll_set_subst_params(partition, 0, subst_params);
+  pll_set_category_rates(partition, rate_cats);
+
+  /* tip i draws from the first 2i + 2 characters of the alphabet */
+  seq[N_SITES] = 0;
+  for (i = 0; i < N_TIPS; ++i)
+  {
+    unsigned int size = PLL_MIN(2 * i + 2, alphabet_size);
+
+    for (j = 0; j < N_SITES; ++j)
+      seq[j] = alphabet[(next_random(&seed) >> 16) % size];
+    pll_set_tip_states(partition, i, map, seq);
+  }
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+  pll_update_partials(partition, operations, N_INNER);
+
+  free(frequencies);
+  free(subst_params);
+
+  return partition;
+}
+
+static int near(double a, double b)
+{
+  return fabs(a - b) <= 1e-9 * PLL_MAX(1, fabs(b));
+}
+
+/* compares the edge log-likelihoods, per-site log-likelihoods and
+   derivatives of both partitions at the edge between clv1 and clv2 */
+static const char * compare_edge(pll_partition_t * repeats,
+                                 pll_partition_t * reference,
+                                 unsigned int clv1,
+                                 int scaler1,
+                                 unsigned int clv2,
+                                 int scaler2)
+{
+  unsigned int i;
+  double persite[N_SITES];
+  double ref_persite[N_SITES];
+  double d_f, dd_f, ref_d_f, ref_dd_f;
+  double * sumtable = pll_aligned_alloc(
+    reference->sites * reference->rate_cats * reference->states_padded *
+    sizeof(double), reference->alignment);
+  double * ref_sumtable = pll_aligned_alloc(
+    reference->sites * reference->rate_cats * reference->states_padded *
+    sizeof(double), reference->alignment);
+  int same;
+
+  if (!sumtable || !ref_sumtable)
+    fatal("Fail creating sumtable\n");
+
+  double logl = pll_compute_edge_loglikelihood(repeats, clv1, scaler1,
+                                               clv2, scaler2, 1,
+                                               params_indices, persite);
+  double ref_logl = pll_compute_edge_loglikelihood(reference, clv1, scaler1,
+                                                   clv2, scaler2, 1,
+                                                   params_indices,
+                                                   ref_persite);
+  same = near(logl, ref_logl);
+  for (i = 0; i < N_SITES; ++i)
+    if (fabs(persite[i] - ref_persite[i]) >
+        1e-12 * PLL_MAX(1, fabs(ref_persite[i])))
+      same = 0;
+
+  pll_update_sumtable(repeats, clv1, clv2, scaler1, scaler2,
+                      params_indices, sumtable);
+  pll_update_sumtable(reference, clv1, clv2, scaler1, scaler2,
+                      params_indices, ref_sumtable);
+  pll_compute_likelihood_derivatives(repeats, scaler1, scaler2, 0.15,
+                                     params_indices, sumtable, &d_f, &dd_f);
+  pll_compute_likelihood_derivatives(reference, scaler1, scaler2, 0.15,
+                                     params_indices, ref_sumtable,
+                                     &ref_d_f, &ref_dd_f);
+
+  pll_aligned_free(sumtable);
+  pll_aligned_free(ref_sumtable);
+
+  if (!near(d_f, ref_d_f) || !near(dd_f, ref_dd_f))
+    return "derivatives MISMATCH";
+
+  return same ? "OK" : "logL MISMATCH";
+}
+
+static void test(unsigned int attributes,
+                 unsigned int states,
+                 const pll_state_t * map,
+                 const char * alphabet)
+{
+  unsigned int i;
+  unsigned int repeats_attributes = (attributes | PLL_ATTRIB_SITE_REPEATS) &
+                                    ~PLL_ATTRIB_PATTERN_TIP;
+
+  pll_partition_t * reference = create(attributes & ~PLL_ATTRIB_SITE_REPEATS,
+                                       states, map, alphabet);
+  pll_partition_t * repeats = create(repeats_attributes,
+                                     states, map, alphabet);
+
+  printf("states %2u, classes", states);
+  for (i = 0; i < N_TIPS + N_INNER; ++i)
+    printf(" %u", pll_get_sites_number(repeats, i));
+  printf("\n");
+
+  printf("  inner edge: %s\n",
+         compare_edge(repeats, reference, 8, 2, 9, 3));
+  printf("  tip to inner node: %s\n",
+         compare_edge(repeats, reference, 0, PLL_SCALE_BUFFER_NONE, 8, 2));
+  printf("  inner node to tip: %s\n",
+         compare_edge(repeats, reference, 8, 2, 0, PLL_SCALE_BUFFER_NONE));
+
+  pll_partition_destroy(reference);
+  pll_partition_destroy(repeats);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int parents[N_INNER]    = { 6, 7, 8, 9 };
+  unsigned int children[2*N_INNER] = { 0, 1, 2, 3, 6, 7, 4, 5 };
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* ((0,1)6,(2,3)7)8 and (4,5)9 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % N_MATRICES;
+    operations[i].child2_matrix_index = c2 % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  test(attributes, 4, pll_map_nt, "ACGTN-");
+  test(attributes, 8, pll_map_nt, "ACGTMRWS");
+  test(attributes, 20, pll_map_aa, "ARNDCQEGHILKMFPSTWYV");
+
+  return (0);
+}
@@ -0,0 +1,183 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    repeats-budget.c
+
+    This test compares a partition with site repeats under a memory budget
+    (pll_repeats_set_budget) with a partition without repeats, while the
+    tips are rearranged between evaluations, as in a tree search. It checks
+    that the CLVs held stay within the budget, that pooled CLVs can be
+    released, and that a budget of 0 removes the limit. Site repeats are not
+    combined with tip patterns, which are dropped from the attributes of the
+    partitions with repeats.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 400
+#define N_PATTERNS 90
+#define N_TIPS 16
+#define N_INNER 14
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  /* site j repeats one of N_PATTERNS columns */
+  set_repeated_tips(partition, N_SITES, N_PATTERNS);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+/* inner nodes 16..23 join pairs of tips in the order tip(k) = k * step mod
+   16, 24..27 pairs of those, and 28 and 29 are the roots of two subtrees of
+   8 tips, joined by the evaluated edge */
+static void set_operations(unsigned int step)
+{
+  unsigned int i;
+
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = i < 8 ? (2 * i * step) % N_TIPS : N_TIPS + 2 * (i - 8);
+    unsigned int c2 = i < 8 ? ((2 * i + 1) * step) % N_TIPS : c1 + 1;
+
+    operations[i].parent_clv_index    = N_TIPS + i;
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = (i + 1) % N_MATRICES;
+    operations[i].child2_matrix_index = (i + 2) % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+}
+
+static double loglikelihood(pll_partition_t * partition)
+{
+  pll_update_partials(partition, operations, N_INNER);
+
+  return pll_compute_edge_loglikelihood(partition,
+                                        N_TIPS + N_INNER - 2,
+                                        N_INNER - 2,
+                                        N_TIPS + N_INNER - 1,
+                                        N_INNER - 1,
+                                        0,
+                                        params_indices,
+                                        NULL);
+}
+
+static void check(const char * label,
+                  pll_partition_t * budgeted,
+                  pll_partition_t * reference,
+                  size_t budget)
+{
+  double ref_logl = loglikelihood(reference);
+  double logl = loglikelihood(budgeted);
+
+  printf("%-22s logL: %.6f %s%s\n",
+         label,
+         logl,
+         fabs(logl - ref_logl) < 1e-9 ? "OK" : "MISMATCH",
+         !budget ? "" : budgeted->repeats->clv_bytes <= budget ?
+           ", within budget" : ", OVER BUDGET");
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int steps[4] = { 1, 5, 3, 1 };
+  unsigned int attributes = get_attributes(argc, argv);
+  unsigned int repeats_attributes = (attributes | PLL_ATTRIB_SITE_REPEATS) &
+                                    ~PLL_ATTRIB_PATTERN_TIP;
+  char label[30];
+
+  pll_partition_t * reference = create(attributes & ~PLL_ATTRIB_SITE_REPEATS);
+  pll_partition_t * budgeted = create(repeats_attributes);
+
+  /* room for the CLVs of 2 inner nodes without repeats, which is enough for
+     the repeats CLVs in use but not for the pool the tip rearrangements
+     would build up without a limit */
+  size_t full_clv = pll_get_clv_size(reference, N_TIPS) * sizeof(double);
+  size_t budget = 2 * full_clv;
+
+  if (!pll_repeats_set_budget(budgeted, budget))
+    fatal("Fail setting budget: %s\n", pll_errmsg);
+
+  for (i = 0; i < 4; ++i)
+  {
+    set_operations(steps[i]);
+    snprintf(label, 30, "tip order step %u", steps[i]);
+    check(label, budgeted, reference, budget);
+  }
+
+  size_t pooled = budgeted->repeats->pool_bytes;
+  size_t held = budgeted->repeats->clv_bytes;
+  pll_repeats_clear_pool(budgeted);
+  printf("clear pool: %s\n",
+         pooled && !budgeted->repeats->pool_bytes &&
+         budgeted->repeats->clv_bytes == held - pooled ? "OK" : "MISMATCH");
+
+  /* a budget smaller than the CLVs in use */
+  pll_repeats_set_budget(budgeted, full_clv / 4);
+  set_operations(5);
+  check("small budget", budgeted, reference, 0);
+
+  /* no limit */
+  pll_repeats_set_budget(budgeted, 0);
+  set_operations(3);
+  check("no budget", budgeted, reference, 0);
+
+  pll_errno = 0;
+  int retval = pll_repeats_set_budget(reference, budget);
+  printf("budget without repeats: %s (%s)\n",
+         retval ? "success" : "failure",
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                "no error");
+
+  pll_partition_destroy(reference);
+  pll_partition_destroy(budgeted);
+
+  return (0);
+}
@@ -0,0 +1,164 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    repeats-hash.c
+
+    This test compares a partition with site repeats with a partition
+    without, on an alignment of 16 taxa whose columns repeat a limited number
+    of patterns. Near the tips the products of the class counts of the
+    children are small and the classes are identified through the dense
+    lookup buffer, near the root they exceed it and the hash table is used.
+    A large lookup buffer set with pll_resize_repeats_lookup forces the dense
+    lookup everywhere and must give the same result. Site repeats are not
+    combined with tip patterns, which are dropped from the attributes of the
+    partitions with repeats.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 400
+#define N_PATTERNS 90
+#define N_TIPS 16
+#define N_INNER 14
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  /* site j repeats one of N_PATTERNS columns */
+  set_repeated_tips(partition, N_SITES, N_PATTERNS);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+static double loglikelihood(pll_partition_t * partition, double * persite)
+{
+  pll_update_partials(partition, operations, N_INNER);
+
+  return pll_compute_edge_loglikelihood(partition,
+                                        N_TIPS + N_INNER - 2,
+                                        N_INNER - 2,
+                                        N_TIPS + N_INNER - 1,
+                                        N_INNER - 1,
+                                        0,
+                                        params_indices,
+                                        persite);
+}
+
+static int same_persite(const double * a, const double * b)
+{
+  unsigned int i;
+
+  for (i = 0; i < N_SITES; ++i)
+    if (fabs(a[i] - b[i]) > 1e-12 * PLL_MAX(1, fabs(b[i])))
+      return 0;
+
+  return 1;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int attributes = get_attributes(argc, argv);
+  double persite[N_SITES];
+  double ref_persite[N_SITES];
+
+  /* inner nodes 16..23 join pairs of tips, 24..27 pairs of those, and 28
+     and 29 are the roots of two subtrees of 8 tips, joined by the evaluated
+     edge */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = i < 8 ? 2 * i : N_TIPS + 2 * (i - 8);
+    unsigned int c2 = c1 + 1;
+
+    operations[i].parent_clv_index    = N_TIPS + i;
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = (i + 1) % N_MATRICES;
+    operations[i].child2_matrix_index = (i + 2) % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  pll_partition_t * reference = create(attributes & ~PLL_ATTRIB_SITE_REPEATS);
+  unsigned int repeats_attributes = (attributes | PLL_ATTRIB_SITE_REPEATS) &
+                                    ~PLL_ATTRIB_PATTERN_TIP;
+  pll_partition_t * hashed = create(repeats_attributes);
+  pll_partition_t * dense = create(repeats_attributes);
+
+  /* dense lookup for any product of class counts */
+  pll_resize_repeats_lookup(dense, N_SITES * N_SITES);
+
+  double ref_logl = loglikelihood(reference, ref_persite);
+  printf("without repeats logL: %.6f\n", ref_logl);
+
+  double logl = loglikelihood(hashed, persite);
+  printf("hashed repeats logL: %.6f %s, per site %s\n",
+         logl,
+         fabs(logl - ref_logl) < 1e-9 ? "OK" : "MISMATCH",
+         same_persite(persite, ref_persite) ? "OK" : "MISMATCH");
+
+  logl = loglikelihood(dense, persite);
+  printf("dense repeats logL: %.6f %s, per site %s\n",
+         logl,
+         fabs(logl - ref_logl) < 1e-9 ? "OK" : "MISMATCH",
+         same_persite(persite, ref_persite) ? "OK" : "MISMATCH");
+
+  /* the classes found through the table and the buffer agree */
+  for (i = N_TIPS; i < N_TIPS + N_INNER; ++i)
+    if (pll_get_sites_number(hashed, i) != pll_get_sites_number(dense, i))
+      break;
+  printf("classes of the root nodes: %u and %u, %s\n",
+         pll_get_sites_number(hashed, N_TIPS + N_INNER - 2),
+         pll_get_sites_number(hashed, N_TIPS + N_INNER - 1),
+         i == N_TIPS + N_INNER ? "same as dense lookup" : "MISMATCH");
+
+  pll_partition_destroy(reference);
+  pll_partition_destroy(hashed);
+  pll_partition_destroy(dense);
+
+  return (0);
+}
@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    single-precision.c
+
+    This test compares the log-likelihoods, per-site log-likelihoods and
+    derivatives of a partition with PLL_ATTRIB_SINGLE_PRECISION with those
+    of a double-precision partition, on a caterpillar tree deep enough to
+    require scaling. Single-precision CLVs require the AVX-512 kernels and do
+    not support tip patterns and site repeats, which are dropped from its
+    attributes; the test is skipped for the other architectures.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 40
+#define N_TIPS 48
+#define N_INNER (N_TIPS - 2)
+#define N_MATRICES 4
+#define TOLERANCE 1e-5
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.1, 0.3, 0.6, 1.2 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  /* related sequences: each tip mutates some sites of the previous one */
+  set_related_tips(partition, N_SITES, 6, "ACGTACGTRY-", 11);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+static int close(double a, double b)
+{
+  return fabs(a - b) <= TOLERANCE * PLL_MAX(1, fabs(b));
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, s;
+  unsigned int top = N_TIPS + N_INNER - 1;
+  unsigned int persite_ok = 1;
+  double persite_dp[N_SITES], persite_sp[N_SITES];
+  double d_f[2], dd_f[2];
+  pll_operation_t operations[N_INNER];
+  unsigned int attributes = get_attributes(argc, argv);
+  unsigned int sp_attributes = (attributes & ~(PLL_ATTRIB_PATTERN_TIP |
+                                               PLL_ATTRIB_SITE_REPEATS)) |
+                               PLL_ATTRIB_SINGLE_PRECISION;
+
+  /* single precision is only available with the AVX-512 kernels */
+  if (!(attributes & PLL_ATTRIB_ARCH_AVX512))
+    skip_test();
+
+  /* caterpillar (((0,1)48,2)49,3)50 ... 93, scaled at every inner node */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    operations[i].parent_clv_index    = N_TIPS + i;
+    operations[i].child1_clv_index    = i ? N_TIPS + i - 1 : 0;
+    operations[i].child2_clv_index    = i + 1;
+    operations[i].child1_matrix_index = i % N_MATRICES;
+    operations[i].child2_matrix_index = (i + 1) % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = i ? (int)(i - 1) :
+                                            PLL_SCALE_BUFFER_NONE;
+    operations[i].child2_scaler_index = PLL_SCALE_BUFFER_NONE;
+  }
+
+  pll_partition_t * partition[2] = { create(attributes),
+                                     create(sp_attributes) };
+
+  for (i = 0; i < 2; ++i)
+  {
+    double * sumtable = pll_aligned_alloc(N_SITES * N_CAT_GAMMA *
+                                            partition[i]->states_padded *
+                                            sizeof(double),
+                                          partition[i]->alignment);
+    if (!sumtable)
+      fatal("Fail allocating sumtable\n");
+
+    pll_update_partials(partition[i], operations, N_INNER);
+    pll_update_sumtable(partition[i],
+                        top, N_TIPS - 1,
+                        N_INNER - 1, PLL_SCALE_BUFFER_NONE,
+                        params_indices,
+                        sumtable);
+    pll_compute_likelihood_derivatives(partition[i],
+                                       N_INNER - 1,
+                                       PLL_SCALE_BUFFER_NONE,
+                                       0.2,
+                                       params_indices,
+                                       sumtable,
+                                       d_f + i,
+                                       dd_f + i);
+    pll_aligned_free(sumtable);
+  }
+
+  double logl_dp = pll_compute_edge_loglikelihood(partition[0],
+                                                  top, N_INNER - 1,
+                                                  N_TIPS - 1,
+                                                  PLL_SCALE_BUFFER_NONE,
+                                                  0,
+                                                  params_indices,
+                                                  persite_dp);
+  double logl_sp = pll_compute_edge_loglikelihood(partition[1],
+                                                  top, N_INNER - 1,
+                                                  N_TIPS - 1,
+                                                  PLL_SCALE_BUFFER_NONE,
+                                                  0,
+                                                  params_indices,
+                                                  persite_sp);
+  double root_dp = pll_compute_root_loglikelihood(partition[0],
+                                                  top, N_INNER - 1,
+                                                  params_indices,
+                                                  NULL);
+  double root_sp = pll_compute_root_loglikelihood(partition[1],
+                                                  top, N_INNER - 1,
+                                                  params_indices,
+                                                  NULL);
+
+  for (s = 0; s < N_SITES; ++s)
+    if (!close(persite_sp[s], persite_dp[s]))
+      persite_ok = 0;
+
+  printf("edge logL: %.6f single precision %s\n",
+         logl_dp, close(logl_sp, logl_dp) ? "OK" : "MISMATCH");
+  printf("root logL: %.6f single precision %s\n",
+         root_dp, close(root_sp, root_dp) ? "OK" : "MISMATCH");
+  printf("per-site logL: single precision %s\n",
+         persite_ok ? "OK" : "MISMATCH");
+  printf("derivatives: %.4e %.4e single precision %s\n",
+         d_f[0], dd_f[0],
+         close(d_f[1], d_f[0]) && close(dd_f[1], dd_f[0]) ? "OK" : "MISMATCH");
+
+  pll_partition_destroy(partition[0]);
+  pll_partition_destroy(partition[1]);
+
+  return (0);
+}
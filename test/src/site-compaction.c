@@ -0,0 +1,290 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    site-compaction.c
+
+    This test compares a partition with PLL_ATTRIB_SITE_COMPACTION with a
+    partition without, for bootstrap replicates of the sites. It compares
+    edge and root log-likelihoods, per-site log-likelihoods, which are
+    returned in the original site order, and derivatives, after setting new
+    weights, new tip data and with a thread pool. The compacted partition
+    also uses PLL_ATTRIB_NUMA, whose buffers are placed again when new
+    weights change the sites computed by each thread. Site compaction does
+    not support site repeats, which are dropped from the attributes of both
+    partitions.
+ */
+#include "common.h"
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA 4
+#define N_SITES 150
+#define N_TIPS 6
+#define N_INNER 4
+#define N_MATRICES 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_operation_t operations[N_INNER];
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  set_related_tips(partition, N_SITES, 40, "ACGTACGTN-", 23);
+
+  pll_update_invariant_sites_proportion(partition, 0, 0.2);
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+/* weights of a bootstrap replicate of the sites */
+static void bootstrap(unsigned int * weights, unsigned int seed)
+{
+  unsigned int i;
+
+  memset(weights, 0, N_SITES * sizeof(unsigned int));
+  for (i = 0; i < N_SITES; ++i)
+    weights[(next_random(&seed) >> 16) % N_SITES]++;
+}
+
+static char * make_sequence(unsigned int seed)
+{
+  unsigned int j;
+  static char seq[N_SITES+1];
+
+  for (j = 0; j < N_SITES; ++j)
+    seq[j] = "ACGT"[(j * 3) % 4];
+  seq[N_SITES] = 0;
+  mutate_sequence(seq, N_SITES, 60, "ACGTACGTN-", &seed);
+
+  return seq;
+}
+
+/* sets the tip to the states of a sequence, or to their CLV if clv is set,
+   and updates the invariant sites */
+static void set_tip(pll_partition_t * partition,
+                    unsigned int tip_index,
+                    unsigned int seed,
+                    int clv)
+{
+  unsigned int i, k;
+  double tipclv[N_SITES * N_STATES_NT];
+  const char * sequence = make_sequence(seed);
+
+  /* there are no tip CLVs under PLL_ATTRIB_PATTERN_TIP */
+  if (!clv || (partition->attributes & PLL_ATTRIB_PATTERN_TIP))
+  {
+    if (!pll_set_tip_states(partition, tip_index, pll_map_nt, sequence))
+      fatal("Fail setting tip states: %s\n", pll_errmsg);
+  }
+  else
+  {
+    for (i = 0; i < N_SITES; ++i)
+      for (k = 0; k < N_STATES_NT; ++k)
+        tipclv[i * N_STATES_NT + k] =
+                      (pll_map_nt[(unsigned char)sequence[i]] >> k) & 1;
+
+    if (!pll_set_tip_clv(partition, tip_index, tipclv, PLL_FALSE))
+      fatal("Fail setting tip CLV: %s\n", pll_errmsg);
+  }
+
+  pll_update_invariant_sites(partition);
+}
+
+static int near(double a, double b)
+{
+  return fabs(a - b) <= 1e-9 * PLL_MAX(1, fabs(b));
+}
+
+static void compare(const char * label,
+                    pll_partition_t * compacted,
+                    pll_partition_t * reference)
+{
+  unsigned int i;
+  unsigned int freqs_indices[N_CAT_GAMMA] = {0,0,0,0};
+  double persite[N_SITES];
+  double ref_persite[N_SITES];
+  double root_persite[N_SITES];
+  double d_f, dd_f, ref_d_f, ref_dd_f;
+  int same_persite = 1;
+  double * sumtable = pll_aligned_alloc(
+    N_SITES * N_CAT_GAMMA * reference->states_padded * sizeof(double),
+    reference->alignment);
+  double * ref_sumtable = pll_aligned_alloc(
+    N_SITES * N_CAT_GAMMA * reference->states_padded * sizeof(double),
+    reference->alignment);
+
+  if (!sumtable || !ref_sumtable)
+    fatal("Fail creating sumtable\n");
+
+  /* inner CLVs are recomputed after new weights */
+  pll_update_partials(compacted, operations, N_INNER);
+  pll_update_partials(reference, operations, N_INNER);
+
+  double logl = pll_compute_edge_loglikelihood(compacted, 8, 2, 9, 3, 1,
+                                               params_indices, persite);
+  double ref_logl = pll_compute_edge_loglikelihood(reference, 8, 2, 9, 3, 1,
+                                                   params_indices,
+                                                   ref_persite);
+  for (i = 0; i < N_SITES; ++i)
+    if (fabs(persite[i] - ref_persite[i]) >
+        1e-12 * PLL_MAX(1, fabs(ref_persite[i])))
+      same_persite = 0;
+
+  /* the root of the rooted tree ((0,1),(2,3)) */
+  double root_logl = pll_compute_root_loglikelihood(compacted, 8, 2,
+                                                    freqs_indices,
+                                                    root_persite);
+  double ref_root_logl = pll_compute_root_loglikelihood(reference, 8, 2,
+                                                        freqs_indices,
+                                                        ref_persite);
+  for (i = 0; i < N_SITES; ++i)
+    if (fabs(root_persite[i] - ref_persite[i]) >
+        1e-12 * PLL_MAX(1, fabs(ref_persite[i])))
+      same_persite = 0;
+
+  pll_update_sumtable(compacted, 8, 9, 2, 3, params_indices, sumtable);
+  pll_update_sumtable(reference, 8, 9, 2, 3, params_indices, ref_sumtable);
+  pll_compute_likelihood_derivatives(compacted, 2, 3, 0.15, params_indices,
+                                     sumtable, &d_f, &dd_f);
+  pll_compute_likelihood_derivatives(reference, 2, 3, 0.15, params_indices,
+                                     ref_sumtable, &ref_d_f, &ref_dd_f);
+
+  printf("%-16s %3u sites computed, logL %.6f %s, root %s, per site %s, "
+         "derivatives %s\n",
+         label,
+         compacted->sites,
+         logl,
+         near(logl, ref_logl) ? "OK" : "MISMATCH",
+         near(root_logl, ref_root_logl) ? "OK" : "MISMATCH",
+         same_persite ? "OK" : "MISMATCH",
+         near(d_f, ref_d_f) && near(dd_f, ref_dd_f) ? "OK" : "MISMATCH");
+
+  pll_aligned_free(sumtable);
+  pll_aligned_free(ref_sumtable);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int parents[N_INNER]    = { 6, 7, 8, 9 };
+  unsigned int children[2*N_INNER] = { 0, 1, 2, 3, 6, 7, 4, 5 };
+  unsigned int weights[N_SITES];
+  unsigned int attributes = get_attributes(argc, argv) &
+                            ~PLL_ATTRIB_SITE_REPEATS;
+
+  /* ((0,1)6,(2,3)7)8 and (4,5)9, evaluated at the edge 8-9 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % N_MATRICES;
+    operations[i].child2_matrix_index = c2 % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  pll_partition_t * reference = create(attributes);
+  pll_partition_t * compacted = create(attributes |
+                                       PLL_ATTRIB_SITE_COMPACTION |
+                                       PLL_ATTRIB_NUMA);
+
+  bootstrap(weights, 1);
+  pll_set_pattern_weights(reference, weights);
+  pll_set_pattern_weights(compacted, weights);
+  compare("replicate 1", compacted, reference);
+
+  bootstrap(weights, 2);
+  pll_set_pattern_weights(reference, weights);
+  pll_set_pattern_weights(compacted, weights);
+  compare("replicate 2", compacted, reference);
+
+  /* new tip data are given in the original order of the sites */
+  set_tip(reference, 3, 31, 0);
+  set_tip(compacted, 3, 31, 0);
+  compare("new tip states", compacted, reference);
+  set_tip(reference, 4, 37, 1);
+  set_tip(compacted, 4, 37, 1);
+  compare("new tip CLV", compacted, reference);
+
+  if (!pll_set_threads(compacted, 3))
+    fatal("Fail setting threads: %s\n", pll_errmsg);
+  compare("with 3 threads", compacted, reference);
+
+  /* the NUMA placement follows the sites computed by each thread */
+  bootstrap(weights, 3);
+  pll_set_pattern_weights(reference, weights);
+  pll_set_pattern_weights(compacted, weights);
+  compare("replicate 3", compacted, reference);
+  pll_set_threads(compacted, 1);
+
+  for (i = 0; i < N_SITES; ++i)
+    weights[i] = 1;
+  pll_set_pattern_weights(reference, weights);
+  pll_set_pattern_weights(compacted, weights);
+  compare("all sites", compacted, reference);
+
+  pll_partition_destroy(reference);
+  pll_partition_destroy(compacted);
+
+  /* site compaction cannot be combined with site repeats */
+  pll_errno = 0;
+  pll_partition_t * failed = pll_partition_create(N_TIPS,
+                                                  N_INNER,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  1,
+                                                  N_MATRICES,
+                                                  N_CAT_GAMMA,
+                                                  N_INNER,
+                                                  attributes |
+                                                    PLL_ATTRIB_SITE_COMPACTION |
+                                                    PLL_ATTRIB_SITE_REPEATS);
+  printf("compaction with repeats: %s (%s)\n",
+         failed ? "success" : "failure",
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                "no error");
+
+  return (0);
+}
@@ -0,0 +1,184 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    site-ranges.c
+
+    This test computes the CLVs, log-likelihoods and derivatives of a
+    partition in ranges of sites, processed in reverse order, and compares
+    them with those computed for the whole partition. Site ranges do not
+    support site repeats, which are dropped from the attributes of the
+    partition processed in ranges.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 50
+#define N_TIPS 6
+#define N_INNER 4
+#define N_MATRICES 4
+#define RANGE 7
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  set_related_tips(partition, N_SITES, 12, "ACGTACGTN-", 3);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, begin, end;
+  unsigned int clv_equal = 1;
+  unsigned int persite_equal = 1;
+  double persite[2][N_SITES];
+  double edge[2], root[2], d_f[2], dd_f[2];
+  double d1, d2;
+  pll_operation_t operations[N_INNER];
+  unsigned int parents[N_INNER]    = { 6, 7, 8, 9 };
+  unsigned int children[2*N_INNER] = { 0, 1, 2, 3, 6, 7, 4, 5 };
+  unsigned int attributes = get_attributes(argc, argv);
+  double * sumtable[2];
+
+  /* ((0,1)6,(2,3)7)8 and (4,5)9, evaluated at the edge 8-9 */
+  for (i = 0; i < N_INNER; ++i)
+  {
+    unsigned int c1 = children[2*i];
+    unsigned int c2 = children[2*i+1];
+
+    operations[i].parent_clv_index    = parents[i];
+    operations[i].child1_clv_index    = c1;
+    operations[i].child2_clv_index    = c2;
+    operations[i].child1_matrix_index = c1 % N_MATRICES;
+    operations[i].child2_matrix_index = c2 % N_MATRICES;
+    operations[i].parent_scaler_index = i;
+    operations[i].child1_scaler_index = c1 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c1 - N_TIPS);
+    operations[i].child2_scaler_index = c2 < N_TIPS ? PLL_SCALE_BUFFER_NONE :
+                                                      (int)(c2 - N_TIPS);
+  }
+
+  pll_partition_t * partition[2] = { create(attributes),
+                                     create(attributes &
+                                            ~PLL_ATTRIB_SITE_REPEATS) };
+
+  for (i = 0; i < 2; ++i)
+    sumtable[i] = pll_aligned_alloc(N_SITES * N_CAT_GAMMA *
+                                      partition[i]->states_padded *
+                                      sizeof(double),
+                                    partition[i]->alignment);
+
+  /* whole partition */
+  pll_update_partials(partition[0], operations, N_INNER);
+  edge[0] = pll_compute_edge_loglikelihood(partition[0], 8, 2, 9, 3, 1,
+                                           params_indices, persite[0]);
+  root[0] = pll_compute_root_loglikelihood(partition[0], 8, 2,
+                                           params_indices, NULL);
+  pll_update_sumtable(partition[0], 8, 9, 2, 3, params_indices, sumtable[0]);
+  pll_compute_likelihood_derivatives(partition[0], 2, 3, 0.1, params_indices,
+                                     sumtable[0], d_f, dd_f);
+
+  /* ranges of RANGE sites from the last one */
+  edge[1] = root[1] = d_f[1] = dd_f[1] = 0;
+  for (end = N_SITES; end > 0; end = begin)
+  {
+    begin = end > RANGE ? end - RANGE : 0;
+
+    if (!pll_update_partials_range(partition[1], operations, N_INNER,
+                                   begin, end) ||
+        !pll_update_sumtable_range(partition[1], 8, 9, 2, 3, params_indices,
+                                   sumtable[1], begin, end) ||
+        !pll_compute_likelihood_derivatives_range(partition[1], 2, 3, 0.1,
+                                                  params_indices, sumtable[1],
+                                                  &d1, &d2, begin, end))
+      fatal("Fail computing range [%u,%u): %s\n", begin, end, pll_errmsg);
+
+    edge[1] += pll_compute_edge_loglikelihood_range(partition[1], 8, 2, 9, 3,
+                                                    1, params_indices,
+                                                    persite[1], begin, end);
+    root[1] += pll_compute_root_loglikelihood_range(partition[1], 8, 2,
+                                                    params_indices, NULL,
+                                                    begin, end);
+    d_f[1] += d1;
+    dd_f[1] += d2;
+  }
+
+  /* the kernels of the whole partition may sum the categories of a site in
+     another order */
+  for (i = 0; i < N_SITES; ++i)
+    if (fabs(persite[0][i] - persite[1][i]) > 1e-12)
+      persite_equal = 0;
+
+  for (i = N_TIPS; i < N_TIPS + N_INNER; ++i)
+    if (memcmp(partition[0]->clv[i],
+               partition[1]->clv[i],
+               pll_get_clv_size(partition[0], i)))
+      clv_equal = 0;
+
+  printf("CLVs: %s\n", clv_equal ? "identical" : "MISMATCH");
+  printf("per-site logL: %s\n", persite_equal ? "within 1e-12" : "MISMATCH");
+  printf("edge logL: %.6f ranges: %.6f %s\n",
+         edge[0], edge[1], fabs(edge[0] - edge[1]) < 1e-9 ? "OK" : "MISMATCH");
+  printf("root logL: %.6f ranges: %.6f %s\n",
+         root[0], root[1], fabs(root[0] - root[1]) < 1e-9 ? "OK" : "MISMATCH");
+  printf("derivatives: %.4e %.4e ranges: %.4e %.4e %s\n",
+         d_f[0], dd_f[0], d_f[1], dd_f[1],
+         fabs(d_f[0] - d_f[1]) < 1e-9 && fabs(dd_f[0] - dd_f[1]) < 1e-9 ?
+           "OK" : "MISMATCH");
+
+  /* ranges beyond the last site are rejected */
+  pll_errno = 0;
+  i = pll_update_partials_range(partition[1], operations, N_INNER,
+                                N_SITES - 1, N_SITES + 1);
+  printf("range [%u,%u): %s (%s)\n",
+         N_SITES - 1, N_SITES + 1,
+         i ? "success" : "failure",
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "invalid parameter" :
+                                                "no error");
+
+  for (i = 0; i < 2; ++i)
+  {
+    pll_aligned_free(sumtable[i]);
+    pll_partition_destroy(partition[i]);
+  }
+
+  return (0);
+}
@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    threads.c
+
+    This test compares a partition with a thread pool (pll_set_threads) with
+    a serial one. The CLVs and per-site log-likelihoods must be identical, as
+    each thread computes its own range of sites, and the log-likelihoods and
+    derivatives, which are summed over the threads, equal up to rounding.
+ */
+#include "common.h"
+
+#define N_CAT_GAMMA 4
+#define N_SITES 203
+#define N_TIPS 16
+#define N_INNER (N_TIPS - 2)
+#define N_MATRICES 4
+#define N_THREADS 4
+
+static unsigned int params_indices[N_CAT_GAMMA] = {0,0,0,0};
+
+static pll_partition_t * create(unsigned int attributes)
+{
+  unsigned int j;
+  double branch_lengths[N_MATRICES] = { 0.05, 0.1, 0.2, 0.4 };
+  unsigned int matrix_indices[N_MATRICES] = { 0, 1, 2, 3 };
+  unsigned int weights[N_SITES];
+
+  pll_partition_t * partition = create_nt_partition(N_TIPS,
+                                                    N_INNER,
+                                                    N_SITES,
+                                                    N_MATRICES,
+                                                    N_CAT_GAMMA,
+                                                    N_INNER,
+                                                    0.5,
+                                                    attributes);
+
+  /* related sequences: each tip mutates some sites of the previous one */
+  set_related_tips(partition, N_SITES, 40, "ACGTACGTN-", 5);
+
+  for (j = 0; j < N_SITES; ++j)
+    weights[j] = 1 + j % 3;
+  pll_set_pattern_weights(partition, weights);
+  pll_update_invariant_sites_proportion(partition, 0, 0.1);
+
+  pll_update_prob_matrices(partition,
+                           params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           N_MATRICES);
+
+  return partition;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, level, first, next;
+  unsigned int count = 0;
+  unsigned int clv_equal = 1;
+  double persite[2][N_SITES];
+  double logl[2], d_f[2], dd_f[2];
+  pll_operation_t operations[N_INNER];
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* balanced tree: level 1 holds the nodes 16-23, level 2 24-27 and level 3
+     the nodes 28 and 29, evaluated at the edge 28-29 */
+  first = 0;
+  next = N_TIPS;
+  for (level = N_TIPS / 2; level >= 2; level /= 2)
+  {
+    for (i = 0; i < level; ++i)
+    {
+      pll_operation_t * op = operations + count;
+      op->parent_clv_index    = next + i;
+      op->child1_clv_index    = first + 2*i;
+      op->child2_clv_index    = first + 2*i + 1;
+      op->child1_matrix_index = (2*i) % N_MATRICES;
+      op->child2_matrix_index = (2*i + 1) % N_MATRICES;
+      op->parent_scaler_index = next + i - N_TIPS;
+      op->child1_scaler_index = first ? (int)(first + 2*i - N_TIPS) :
+                                        PLL_SCALE_BUFFER_NONE;
+      op->child2_scaler_index = first ? (int)(first + 2*i + 1 - N_TIPS) :
+                                        PLL_SCALE_BUFFER_NONE;
+      ++count;
+    }
+    first = next;
+    next += level;
+  }
+
+  pll_partition_t * partition[2] = { create(attributes),
+                                     create(attributes) };
+
+  if (!pll_set_threads(partition[1], N_THREADS))
+    fatal("Fail setting threads: %s\n", pll_errmsg);
+  printf("threads: %u %u\n",
+         pll_get_threads(partition[0]),
+         pll_get_threads(partition[1]));
+
+  for (i = 0; i < 2; ++i)
+  {
+    double * sumtable = pll_aligned_alloc(N_SITES * N_CAT_GAMMA *
+                                            partition[i]->states_padded *
+                                            sizeof(double),
+                                          partition[i]->alignment);
+    if (!sumtable)
+      fatal("Fail allocating sumtable\n");
+
+    pll_update_partials(partition[i], operations, count);
+    logl[i] = pll_compute_edge_loglikelihood(partition[i],
+                                             28, 12,
+                                             29, 13,
+                                             1,
+                                             params_indices,
+                                             persite[i]);
+    pll_update_sumtable(partition[i],
+                        28, 29,
+                        12, 13,
+                        params_indices,
+                        sumtable);
+    pll_compute_likelihood_derivatives(partition[i],
+                                       12, 13,
+                                       0.1,
+                                       params_indices,
+                                       sumtable,
+                                       d_f + i,
+                                       dd_f + i);
+    pll_aligned_free(sumtable);
+  }
+
+  for (i = N_TIPS; i < N_TIPS + N_INNER; ++i)
+    if (memcmp(partition[0]->clv[i],
+               partition[1]->clv[i],
+               pll_get_clv_size(partition[0], i)))
+      clv_equal = 0;
+
+  printf("CLVs: %s\n", clv_equal ? "identical" : "MISMATCH");
+  printf("per-site logL: %s\n",
+         memcmp(persite[0], persite[1], sizeof(persite[0])) ?
+           "MISMATCH" : "identical");
+  printf("logL: %.6f threads: %.6f %s\n",
+         logl[0], logl[1],
+         fabs(logl[0] - logl[1]) < 1e-9 ? "OK" : "MISMATCH");
+  printf("derivatives: %.4e %.4e threads: %.4e %.4e %s\n",
+         d_f[0], dd_f[0], d_f[1], dd_f[1],
+         fabs(d_f[0] - d_f[1]) < 1e-9 && fabs(dd_f[0] - dd_f[1]) < 1e-9 ?
+           "OK" : "MISMATCH");
+
+  /* back to serial computation */
+  pll_set_threads(partition[1], 1);
+  printf("threads after reset: %u\n", pll_get_threads(partition[1]));
+
+  pll_partition_destroy(partition[0]);
+  pll_partition_destroy(partition[1]);
+
+  return (0);
+}
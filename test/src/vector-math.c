@@ -0,0 +1,139 @@
+/*
+    Copyright (C) 2015 Diego Darriba
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+/*
+    vector-math.c
+
+    This test compares the vectorized log, exp and expm1 of the architecture
+    selected by the attributes with libm, over arguments across the whole
+    double range, including the arguments that are passed on to libm. The
+    array length is not a multiple of any vector width, and the functions
+    are also called in place.
+ */
+#include "common.h"
+#include <float.h>
+#include <stdint.h>
+
+#define N_VALUES 1003
+
+typedef void (*vector_func_t)(unsigned int count,
+                              const double * x,
+                              double * y,
+                              unsigned int attrib);
+
+/* distance in units in the last place, equal values (both zeros, both
+   infinities of the same sign or both NaN) have distance 0 */
+static uint64_t ulp_distance(double a, double b)
+{
+  int64_t ia, ib;
+
+  if (a == b || (isnan(a) && isnan(b)))
+    return 0;
+  if (isnan(a) || isnan(b) || isinf(a) || isinf(b))
+    return UINT64_MAX;
+
+  memcpy(&ia, &a, sizeof(double));
+  memcpy(&ib, &b, sizeof(double));
+  if (ia < 0) ia = INT64_MIN - ia;
+  if (ib < 0) ib = INT64_MIN - ib;
+
+  return ia > ib ? (uint64_t)(ia - ib) : (uint64_t)(ib - ia);
+}
+
+static void test(const char * name,
+                 vector_func_t vector_func,
+                 double (*libm_func)(double),
+                 const double * x,
+                 unsigned int attributes,
+                 uint64_t bound)
+{
+  unsigned int i;
+  uint64_t max_ulp = 0;
+  double * y = (double *)malloc(N_VALUES * sizeof(double));
+  double * z = (double *)malloc(N_VALUES * sizeof(double));
+
+  vector_func(N_VALUES, x, y, attributes);
+  for (i = 0; i < N_VALUES; ++i)
+  {
+    uint64_t ulp = ulp_distance(y[i], libm_func(x[i]));
+    if (ulp > max_ulp)
+      max_ulp = ulp;
+  }
+
+  memcpy(z, x, N_VALUES * sizeof(double));
+  vector_func(N_VALUES, z, z, attributes);
+
+  printf("%-6s within %u ULP of libm: %s, in place: %s\n",
+         name,
+         (unsigned int)bound,
+         max_ulp <= bound ? "OK" : "MISMATCH",
+         memcmp(y, z, N_VALUES * sizeof(double)) ? "MISMATCH" : "identical");
+
+  free(y);
+  free(z);
+}
+
+/* fills x with count values from lo to hi, followed by the special values */
+static void fill(double * x,
+                 double lo,
+                 double hi,
+                 const double * special,
+                 unsigned int special_count)
+{
+  unsigned int i;
+  unsigned int count = N_VALUES - special_count;
+
+  for (i = 0; i < count; ++i)
+    x[i] = lo + (hi - lo) * i / (count - 1);
+  memcpy(x + count, special, special_count * sizeof(double));
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int attributes = get_attributes(argc, argv);
+  double x[N_VALUES];
+
+  double log_special[9] = { 0.0, 4.9e-324, DBL_MIN, 1.0, 1.0 + DBL_EPSILON,
+                            1.0 - DBL_EPSILON / 2, DBL_MAX, HUGE_VAL, -1.0 };
+  double exp_special[9] = { 0.0, -0.0, 1e-300, -1e-300, 708.9, 709.8, -745.2,
+                            HUGE_VAL, -HUGE_VAL };
+  double expm1_special[9] = { 0.0, -0.0, 1e-300, -1e-10, 1e-10, 0.6931,
+                              -0.3466, 709.8, -HUGE_VAL };
+
+  /* exponentially spaced arguments of log, from denormals to DBL_MAX */
+  fill(x, -744.0, 709.0, log_special, 9);
+  for (i = 0; i < N_VALUES - 9; ++i)
+    x[i] = exp(x[i]);
+  test("log", pll_core_log, log, x, attributes, 1);
+
+  fill(x, -750.0, 715.0, exp_special, 9);
+  test("exp", pll_core_exp, exp, x, attributes, 1);
+
+  fill(x, -40.0, 720.0, expm1_special, 9);
+  test("expm1", pll_core_expm1, expm1, x, attributes, 2);
+
+  /* small arguments of expm1, where cancellation matters */
+  fill(x, -1.0, 1.0, expm1_special, 9);
+  test("expm1", pll_core_expm1, expm1, x, attributes, 2);
+
+  return (0);
+}